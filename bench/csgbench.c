@@ -0,0 +1,761 @@
+/*++
+
+Module Name:
+
+    csgbench.c
+
+Abstract:
+
+    Measures the transform kernels the swap paths call.
+
+        csgbench [-f features] [-k kernel] [-m milliseconds] [-q] [-s]
+
+    Every provider of every cipher that this processor can run is timed
+    (each CPU tier reachable by masking features, down to the portable
+    ones), enciphering and deciphering, for transfers of 512 bytes to
+    8 MB at the sector sizes volumes come in (512 and 4096 bytes).  Each
+    point is taken with page aligned and with odd buffer addresses, in
+    place, from one buffer to another, and in two passes, on one thread
+    and on one thread per processor (or, with -s, on each power of two
+    threads in between as well, to show how a kernel scales with the
+    processors running it).  memcpy and the copy transform are timed the
+    same way, out of place, as the baseline.
+
+    The two pass rows copy the source to the destination and then
+    transform the destination in place, which is what the swap paths
+    would do with a cipher on top of the copy they used to make; the out
+    of place rows are the single pass the transforms make instead.
+
+    Before anything is timed, each kernel's output is checked against the
+    portable kernel of its cipher.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        kernel      provider name, "memcpy" or "copy"
+        op          encrypt, decrypt or copy
+        sector      data unit size
+        size        bytes per call
+        align       0 for page aligned buffers, else the byte offset
+        placement   inplace, outofplace or twopass
+        threads     threads running at once
+        gbps        10^9 bytes per second, over all threads
+        cpb         timestamp counts per byte, per thread; processor
+                    cycles on x64 when the TSC runs at the nominal clock
+        vs_memcpy   gbps relative to memcpy at the same size, alignment
+                    and threads
+
+        -f      CSG_CPU_* features the providers may use, as the
+                driver's CpuFeatureMask
+        -k      only providers whose name contains this
+        -m      time per point, 100 ms unless told
+        -q      the sizes 4 KB, 64 KB and 1 MB only
+        -s      1, 2, 4 and so on threads up to one per processor
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgbench.c ../csgAes.c ../csgXts.c \
+           ../csgCtr.c ../csgProvider.c ../csgCpu.c ../csgTransform.c \
+           -lpthread -o csgbench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csgProvider.h"
+
+#define BENCH_MAX_SIZE          (8 * 1024 * 1024)
+#define BENCH_PAGE_SIZE         4096
+#define BENCH_MISALIGNMENT      1
+#define BENCH_MAX_KERNELS       16
+#define BENCH_CHECK_SIZE        (64 * 1024)
+
+//
+//  Enough thread counts for 1, 2, 4 and so on up to any processor count.
+//
+
+#define BENCH_MAX_THREAD_STEPS  33
+
+//
+//  Where a kernel's output goes.
+//
+
+#define BENCH_IN_PLACE          0
+#define BENCH_OUT_OF_PLACE      1
+#define BENCH_TWO_PASS          2
+#define BENCH_PLACEMENTS        3
+
+static CONST CHAR *PlacementNames[BENCH_PLACEMENTS] = {
+
+    "inplace", "outofplace", "twopass"
+};
+
+static CONST SIZE_T BenchSizes[] = {
+
+    512, 2048, 8192, 32768, 131072, 524288, 2097152, 8388608
+};
+
+static CONST SIZE_T QuickSizes[] = {
+
+    4096, 65536, 1048576
+};
+
+static CONST ULONG SectorSizes[] = { 512, 4096 };
+
+typedef struct _BENCH_KERNEL {
+
+    CONST CHAR *Name;
+
+    ULONG Cipher;
+
+    //
+    //  NULL for memcpy.
+    //
+
+    PCCSG_TRANSFORM Transform;
+
+    CONST VOID *Key;
+
+} BENCH_KERNEL, *PBENCH_KERNEL;
+
+typedef CONST BENCH_KERNEL *PCBENCH_KERNEL;
+
+//
+//  One point: what every thread runs, and how often.
+//
+
+typedef struct _BENCH_POINT {
+
+    PCBENCH_KERNEL Kernel;
+
+    BOOLEAN Encrypt;
+
+    ULONG SectorSize;
+
+    SIZE_T Size;
+
+    ULONG Align;
+
+    ULONG Placement;
+
+    ULONG Iterations;
+
+    pthread_barrier_t Start;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+typedef struct _BENCH_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Cpu;
+
+    PBENCH_POINT Point;
+
+    PUCHAR Source;
+
+    PUCHAR Destination;
+
+    ULONGLONG Ticks;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+static CSG_XTS_KEY XtsKey;
+static CSG_CTR_KEY CtrKey;
+
+static BENCH_KERNEL Kernels[BENCH_MAX_KERNELS];
+static ULONG KernelCount;
+
+static ULONGLONG TimestampFrequency;
+
+
+static VOID
+RunKernel (
+    __in PCBENCH_KERNEL Kernel,
+    __in BOOLEAN Encrypt,
+    __in ULONG SectorSize,
+    __in ULONG Placement,
+    __in CONST UCHAR *Source,
+    __out UCHAR *Destination,
+    __in SIZE_T Size
+    )
+{
+    if (Placement == BENCH_TWO_PASS) {
+
+        memcpy( Destination, Source, Size );
+        Source = Destination;
+    }
+
+    if (Kernel->Transform == NULL) {
+
+        memcpy( Destination, Source, Size );
+
+    } else if (Encrypt) {
+
+        Kernel->Transform->Encrypt( Kernel->Key, 0x1234, SectorSize, Source, Destination, Size );
+
+    } else {
+
+        Kernel->Transform->Decrypt( Kernel->Key, 0x1234, SectorSize, Source, Destination, Size );
+    }
+}
+
+
+static PVOID
+BenchThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+    PBENCH_POINT point = thread->Point;
+    PUCHAR source = thread->Source + point->Align;
+    PUCHAR destination = (point->Placement == BENCH_IN_PLACE) ? source : thread->Destination + point->Align;
+    ULONGLONG start;
+    ULONG i;
+
+    pthread_barrier_wait( &point->Start );
+
+    start = csgReadTimestamp();
+
+    for (i = 0; i < point->Iterations; i++) {
+
+        RunKernel( point->Kernel, point->Encrypt, point->SectorSize, point->Placement, source, destination, point->Size );
+    }
+
+    thread->Ticks = csgReadTimestamp() - start;
+
+    return NULL;
+}
+
+
+static VOID
+PinThread (
+    __in pthread_t Thread,
+    __in ULONG Cpu
+    )
+{
+    cpu_set_t set;
+
+    CPU_ZERO( &set );
+    CPU_SET( Cpu, &set );
+
+    pthread_setaffinity_np( Thread, sizeof(set), &set );
+}
+
+
+static ULONG
+Calibrate (
+    __in PBENCH_POINT Point,
+    __in PBENCH_THREAD Thread,
+    __in ULONG Milliseconds
+    )
+/*++
+
+Routine Description:
+
+    Finds how many calls of a point take about Milliseconds on one
+    thread.
+
+--*/
+{
+    ULONGLONG target = TimestampFrequency / 1000 * Milliseconds;
+    ULONGLONG ticks;
+    ULONGLONG start;
+    ULONG iterations = 1;
+    ULONG i;
+
+    for (;;) {
+
+        start = csgReadTimestamp();
+
+        for (i = 0; i < iterations; i++) {
+
+            RunKernel( Point->Kernel,
+                       Point->Encrypt,
+                       Point->SectorSize,
+                       Point->Placement,
+                       Thread->Source + Point->Align,
+                       (Point->Placement == BENCH_IN_PLACE) ? Thread->Source + Point->Align : Thread->Destination + Point->Align,
+                       Point->Size );
+        }
+
+        ticks = csgReadTimestamp() - start;
+
+        if (ticks >= target / 4 || iterations >= 0x40000000) {
+
+            break;
+        }
+
+        iterations *= 2;
+    }
+
+    if (ticks == 0) {
+
+        return iterations;
+    }
+
+    iterations = (ULONG)((ULONGLONG)iterations * target / ticks);
+
+    return (iterations != 0) ? iterations : 1;
+}
+
+
+static double
+RunPoint (
+    __in PBENCH_POINT Point,
+    __in PBENCH_THREAD Threads,
+    __in ULONG ThreadCount,
+    __out double *CyclesPerByte
+    )
+/*++
+
+Routine Description:
+
+    Runs a point on ThreadCount threads at once, each pinned to its own
+    processor, and returns the combined rate in GB/s.
+
+--*/
+{
+    ULONGLONG longest = 0;
+    ULONGLONG ticks = 0;
+    double bytes = (double)Point->Size * Point->Iterations;
+    ULONG i;
+
+    pthread_barrier_init( &Point->Start, NULL, ThreadCount );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Point = Point;
+        Threads[i].Ticks = 0;
+
+        pthread_create( &Threads[i].Thread, NULL, BenchThread, &Threads[i] );
+
+        PinThread( Threads[i].Thread, Threads[i].Cpu );
+    }
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        if (Threads[i].Ticks > longest) {
+
+            longest = Threads[i].Ticks;
+        }
+        ticks += Threads[i].Ticks;
+    }
+
+    pthread_barrier_destroy( &Point->Start );
+
+    *CyclesPerByte = (double)ticks / ThreadCount / bytes;
+
+    if (longest == 0) {
+
+        return 0;
+    }
+
+    return bytes * ThreadCount / ((double)longest / TimestampFrequency) / 1e9;
+}
+
+
+static VOID
+AddKernel (
+    __in CONST CHAR *Name,
+    __in ULONG Cipher,
+    __in_opt PCCSG_TRANSFORM Transform,
+    __in_opt CONST CHAR *Filter
+    )
+{
+    CONST VOID *key = (Cipher == CSG_CIPHER_XTS) ? (CONST VOID *)&XtsKey : (CONST VOID *)&CtrKey;
+    ULONG i;
+
+    for (i = 0; i < KernelCount; i++) {
+
+        if (Kernels[i].Transform == Transform) {
+
+            return;
+        }
+    }
+
+    if (Filter != NULL && Transform != NULL && strstr( Name, Filter ) == NULL) {
+
+        return;
+    }
+
+    if (KernelCount < BENCH_MAX_KERNELS) {
+
+        Kernels[KernelCount].Name = Name;
+        Kernels[KernelCount].Cipher = Cipher;
+        Kernels[KernelCount].Transform = Transform;
+        Kernels[KernelCount].Key = key;
+        KernelCount++;
+    }
+}
+
+
+static VOID
+FindKernels (
+    __in ULONG Features,
+    __in_opt CONST CHAR *Filter
+    )
+/*++
+
+Routine Description:
+
+    Lists the providers reachable with subsets of Features, best first,
+    by taking away the features the better tiers need one at a time.
+
+--*/
+{
+    static CONST ULONG tiers[] = {
+
+        CSG_CPU_ALL,
+        CSG_CPU_ALL & ~CSG_CPU_AVX512,
+        CSG_CPU_ALL & ~(CSG_CPU_AVX512 | CSG_CPU_VAES),
+        CSG_CPU_ALL & ~(CSG_CPU_AVX512 | CSG_CPU_VAES | CSG_CPU_AVX2),
+        0
+    };
+    static CONST ULONG ciphers[] = { CSG_CIPHER_XTS, CSG_CIPHER_CTR };
+    PCCSG_TRANSFORM transform;
+    ULONG c;
+    ULONG t;
+
+    AddKernel( "memcpy", CSG_CIPHER_XTS, NULL, NULL );
+    AddKernel( csgCopyTransform.Name, CSG_CIPHER_XTS, &csgCopyTransform, NULL );
+
+    for (c = 0; c < sizeof(ciphers) / sizeof(ciphers[0]); c++) {
+
+        for (t = 0; t < sizeof(tiers) / sizeof(tiers[0]); t++) {
+
+            transform = csgProviderSelect( ciphers[c], Features & tiers[t] );
+
+            if (transform != NULL) {
+
+                AddKernel( transform->Name, ciphers[c], transform, Filter );
+            }
+        }
+    }
+}
+
+
+static BOOLEAN
+CheckKernels (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Checks every cipher kernel against the portable kernel of its cipher,
+    out of place and in place, both ways, at both sector sizes.
+
+--*/
+{
+    PUCHAR plain = malloc( BENCH_CHECK_SIZE + 1 );
+    PUCHAR expected = malloc( BENCH_CHECK_SIZE );
+    PUCHAR actual = malloc( BENCH_CHECK_SIZE + 1 );
+    PCCSG_TRANSFORM reference;
+    BOOLEAN passed = TRUE;
+    ULONG s;
+    ULONG i;
+
+    if (plain == NULL || expected == NULL || actual == NULL) {
+
+        return FALSE;
+    }
+
+    for (i = 0; i < BENCH_CHECK_SIZE + 1; i++) {
+
+        plain[i] = (UCHAR)(i * 131 + 7);
+    }
+
+    for (i = 0; i < KernelCount; i++) {
+
+        PCBENCH_KERNEL kernel = &Kernels[i];
+
+        if (kernel->Transform == NULL || kernel->Transform == &csgCopyTransform) {
+
+            continue;
+        }
+
+        reference = csgProviderSelect( kernel->Cipher, 0 );
+
+        for (s = 0; s < sizeof(SectorSizes) / sizeof(SectorSizes[0]); s++) {
+
+            //
+            //  The source is at an odd address on purpose.
+            //
+
+            reference->Encrypt( kernel->Key, 7, SectorSizes[s], plain + 1, expected, BENCH_CHECK_SIZE );
+
+            kernel->Transform->Encrypt( kernel->Key, 7, SectorSizes[s], plain + 1, actual, BENCH_CHECK_SIZE );
+
+            if (memcmp( expected, actual, BENCH_CHECK_SIZE ) != 0) {
+
+                fprintf( stderr, "csgbench: %s encrypts differently at sector size %u\n",
+                         kernel->Name, SectorSizes[s] );
+                passed = FALSE;
+            }
+
+            memcpy( actual + 1, expected, BENCH_CHECK_SIZE );
+
+            kernel->Transform->Decrypt( kernel->Key, 7, SectorSizes[s], actual + 1, actual + 1, BENCH_CHECK_SIZE );
+
+            if (memcmp( plain + 1, actual + 1, BENCH_CHECK_SIZE ) != 0) {
+
+                fprintf( stderr, "csgbench: %s does not decrypt in place at sector size %u\n",
+                         kernel->Name, SectorSizes[s] );
+                passed = FALSE;
+            }
+        }
+    }
+
+    free( plain );
+    free( expected );
+    free( actual );
+
+    return passed;
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgbench [-f features] [-k kernel] [-m milliseconds] [-q] [-s]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    UCHAR keyBytes[CSG_XTS_KEY_SIZE];
+    ULONG features = csgCpuQueryFeatures();
+    CONST CHAR *filter = NULL;
+    ULONG milliseconds = 100;
+    CONST SIZE_T *sizes = BenchSizes;
+    ULONG sizeCount = sizeof(BenchSizes) / sizeof(BenchSizes[0]);
+    ULONG cpuCount = csgCpuCount();
+    ULONG threadCounts[BENCH_MAX_THREAD_STEPS];
+    ULONG threadSteps = 0;
+    BOOLEAN scaling = FALSE;
+    PBENCH_THREAD threads;
+    BENCH_POINT point;
+    double memcpyRate[2][BENCH_MAX_THREAD_STEPS][sizeof(BenchSizes) / sizeof(BenchSizes[0])];
+    double rate;
+    double cpb;
+    ULONG k, s, z, a, p, t;
+    int option;
+
+    while ((option = getopt( argc, argv, "f:k:m:qs" )) != -1) {
+
+        switch (option) {
+
+            case 'f':   features &= (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'k':   filter = optarg; break;
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            case 'q':
+
+                sizes = QuickSizes;
+                sizeCount = sizeof(QuickSizes) / sizeof(QuickSizes[0]);
+                break;
+
+            case 's':   scaling = TRUE; break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || milliseconds == 0) {
+
+        Usage();
+        return 2;
+    }
+
+    for (k = 0; k < sizeof(keyBytes); k++) {
+
+        keyBytes[k] = (UCHAR)(k * 29 + 1);
+    }
+
+    if (!NT_SUCCESS( csgXtsSetKey( &XtsKey, keyBytes ) ) ||
+        !NT_SUCCESS( csgCtrSetKey( &CtrKey, keyBytes ) )) {
+
+        fprintf( stderr, "csgbench: cannot set the keys\n" );
+        return 1;
+    }
+
+    TimestampFrequency = csgTimestampFrequency();
+
+    FindKernels( features, filter );
+
+    if (!CheckKernels()) {
+
+        return 1;
+    }
+
+    threads = calloc( cpuCount, sizeof(BENCH_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    for (t = 0; t < cpuCount; t++) {
+
+        threads[t].Cpu = t;
+        threads[t].Source = aligned_alloc( BENCH_PAGE_SIZE, BENCH_MAX_SIZE + BENCH_PAGE_SIZE );
+        threads[t].Destination = aligned_alloc( BENCH_PAGE_SIZE, BENCH_MAX_SIZE + BENCH_PAGE_SIZE );
+
+        if (threads[t].Source == NULL || threads[t].Destination == NULL) {
+
+            fprintf( stderr, "csgbench: out of memory\n" );
+            return 1;
+        }
+
+        memset( threads[t].Source, 0x5a, BENCH_MAX_SIZE + BENCH_PAGE_SIZE );
+        memset( threads[t].Destination, 0xa5, BENCH_MAX_SIZE + BENCH_PAGE_SIZE );
+    }
+
+    for (t = 1; t < cpuCount; t *= 2) {
+
+        if (t == 1 || scaling) {
+
+            threadCounts[threadSteps++] = t;
+        }
+    }
+
+    threadCounts[threadSteps++] = cpuCount;
+
+    fprintf( stderr, "csgbench: features 0x%x, %u processors, timestamp %llu Hz\n",
+             features, cpuCount, (unsigned long long)TimestampFrequency );
+
+    printf( "kernel,op,sector,size,align,placement,threads,gbps,cpb,vs_memcpy\n" );
+
+    //
+    //  memcpy is the first kernel, so its rates are known by the time the
+    //  others are compared with it.
+    //
+
+    for (k = 0; k < KernelCount; k++) {
+
+        for (s = 0; s < sizeof(SectorSizes) / sizeof(SectorSizes[0]); s++) {
+
+            //
+            //  The baselines do not depend on the sector size.
+            //
+
+            if (Kernels[k].Transform == NULL || Kernels[k].Transform == &csgCopyTransform) {
+
+                if (s != 0) {
+
+                    continue;
+                }
+            }
+
+            for (z = 0; z < sizeCount; z++) {
+
+                if (sizes[z] % SectorSizes[s] != 0) {
+
+                    continue;
+                }
+
+                for (a = 0; a < 2; a++) {
+
+                    for (p = 0; p < BENCH_PLACEMENTS; p++) {
+
+                        for (t = 0; t < threadSteps; t++) {
+
+                            //
+                            //  Copying a buffer onto itself measures nothing,
+                            //  nor does copying it twice.
+                            //
+
+                            if (p != BENCH_OUT_OF_PLACE &&
+                                (Kernels[k].Transform == NULL || Kernels[k].Transform == &csgCopyTransform)) {
+
+                                continue;
+                            }
+
+                            point.Kernel = &Kernels[k];
+                            point.SectorSize = SectorSizes[s];
+                            point.Size = sizes[z];
+                            point.Align = a ? BENCH_MISALIGNMENT : 0;
+                            point.Placement = p;
+
+                            for (point.Encrypt = TRUE; ; point.Encrypt = FALSE) {
+
+                                point.Iterations = Calibrate( &point, &threads[0], milliseconds );
+
+                                rate = RunPoint( &point, threads, threadCounts[t], &cpb );
+
+                                if (Kernels[k].Transform == NULL) {
+
+                                    memcpyRate[a][t][z] = rate;
+                                }
+
+                                printf( "%s,%s,%u,%zu,%u,%s,%u,%.3f,%.3f,%.3f\n",
+                                        Kernels[k].Name,
+                                        (Kernels[k].Transform == NULL ||
+                                         Kernels[k].Transform == &csgCopyTransform) ? "copy" :
+                                        point.Encrypt ? "encrypt" : "decrypt",
+                                        point.SectorSize,
+                                        point.Size,
+                                        point.Align,
+                                        PlacementNames[point.Placement],
+                                        threadCounts[t],
+                                        rate,
+                                        cpb,
+                                        (memcpyRate[a][t][z] > 0) ? rate / memcpyRate[a][t][z] : 0 );
+
+                                fflush( stdout );
+
+                                //
+                                //  Copies go one way only.
+                                //
+
+                                if (!point.Encrypt ||
+                                    Kernels[k].Transform == NULL ||
+                                    Kernels[k].Transform == &csgCopyTransform) {
+
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (t = 0; t < cpuCount; t++) {
+
+        free( threads[t].Source );
+        free( threads[t].Destination );
+    }
+
+    free( threads );
+
+    csgSecureZeroMemory( keyBytes, sizeof(keyBytes) );
+    csgXtsClearKey( &XtsKey );
+    csgCtrClearKey( &CtrKey );
+
+    return 0;
+}
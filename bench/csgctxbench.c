@@ -0,0 +1,676 @@
+/*++
+
+Module Name:
+
+    csgctxbench.c
+
+Abstract:
+
+    Measures allocating pre2Post contexts from one lookaside list shared
+    by all processors, as the driver used to, against one list per
+    processor, as it does now (see CreatePre2PostContextLists in csg.c).
+
+        csgctxbench [-d outstanding] [-m milliseconds] [-r percent]
+                    [-t threads]
+
+    Each thread plays the callbacks of one processor: it allocates a
+    context, fills it in as a pre-operation callback would, keeps a few
+    operations outstanding, and frees the oldest once it has read it back
+    as a post-operation callback would.  Contexts are cache aligned and as
+    large as PRE_2_POST_CONTEXT.
+
+    The lists are modelled on NPAGED_LOOKASIDE_LIST: a 16 byte SList head
+    swapped with cmpxchg16b, a depth past which frees go back to pool, and
+    allocation and free counters updated without a lock, all on the list's
+    cache line.  A context that misses the list comes from a pool of the
+    thread's own, so that the rows measure the lists and not malloc; that
+    is cheaper than pool, so rows with many misses flatter their mode.
+
+        global      every thread uses the same list
+        percpu      each thread uses the list of the processor it is
+                    pinned to
+        remote      as percpu, but some of the contexts are freed to the
+                    next processor's list, as when an operation completes
+                    on another processor than the one that issued it
+
+    Each point runs on 1, 2, 4, ... threads up to one per processor (or
+    only the -t count), each pinned to a processor of its own.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        mode        global, percpu or remote
+        threads     threads allocating at once
+        mops        10^6 contexts allocated and freed per second, over
+                    all threads
+        ns_per_op   nanoseconds per allocation and free, per thread
+        miss_pct    allocations the lists could not serve
+
+        -d      operations each thread keeps outstanding, 4 unless told
+        -m      time per point, 200 ms unless told
+        -r      percent of the contexts the remote rows free to another
+                processor's list, 50 unless told
+        -t      only this many threads
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -mcx16 -DCSG_USER_MODE -I.. csgctxbench.c ../csgCpu.c \
+           -lpthread -o csgctxbench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgCpu.h"
+
+#define BENCH_MAX_THREADS       1024
+#define BENCH_MAX_OUTSTANDING   64
+
+//
+//  The most entries a lookaside list keeps; the system tunes a list's
+//  depth between 4 and 256 by how often it misses.
+//
+
+#define BENCH_LIST_DEPTH        256
+
+#define BENCH_CONTEXT_SIZE      256
+
+#define BENCH_GLOBAL            0
+#define BENCH_PER_CPU           1
+#define BENCH_REMOTE            2
+#define BENCH_MODES             3
+
+static CONST CHAR *ModeNames[BENCH_MODES] = {
+
+    "global", "percpu", "remote"
+};
+
+//
+//  A context, with what the callbacks put in it.  Next links it into a
+//  list while it is free.
+//
+
+typedef struct CSG_ALIGN(64) _BENCH_CONTEXT {
+
+    struct _BENCH_CONTEXT *Next;
+
+    PVOID VolumeContext;
+
+    PVOID SwapDescriptor;
+
+    ULONGLONG Issued;
+
+    ULONG Length;
+
+    ULONG Processor;
+
+    UCHAR Record[BENCH_CONTEXT_SIZE - 40];
+
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+//
+//  An SList head and the lookaside fields around it.  Depth counts the
+//  entries, Sequence changes on every push so that a pop cannot be fooled
+//  by an entry popped and pushed back meanwhile.
+//
+
+typedef union _BENCH_SLIST_HEADER {
+
+    struct {
+
+        ULONGLONG Depth : 16;
+
+        ULONGLONG Sequence : 48;
+
+        PBENCH_CONTEXT Next;
+    };
+
+    unsigned __int128 Value;
+
+} BENCH_SLIST_HEADER;
+
+typedef struct CSG_ALIGN(64) _BENCH_LOOKASIDE {
+
+    volatile BENCH_SLIST_HEADER Head;
+
+    ULONG TotalAllocates;
+
+    ULONG AllocateMisses;
+
+    ULONG TotalFrees;
+
+    ULONG FreeMisses;
+
+} BENCH_LOOKASIDE, *PBENCH_LOOKASIDE;
+
+typedef struct _BENCH_POINT {
+
+    ULONG Mode;
+
+    ULONG ThreadCount;
+
+    ULONG Outstanding;
+
+    ULONG RemotePercent;
+
+    PBENCH_LOOKASIDE Lists;
+
+    pthread_barrier_t Start;
+
+    volatile BOOLEAN Stop;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+typedef struct CSG_ALIGN(64) _BENCH_THREAD {
+
+    pthread_t Thread;
+
+    PBENCH_POINT Point;
+
+    ULONG Cpu;
+
+    //
+    //  Stands for pool: contexts the lists had no room for.
+    //
+
+    PBENCH_CONTEXT Pool;
+
+    ULONGLONG Operations;
+
+    ULONGLONG Misses;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+//
+//  Plain increments, as the system makes them on lookaside counters: no
+//  lock, and a lost count now and then is of no matter.
+//
+
+#define BENCH_COUNT(_field)                                                 \
+    __atomic_store_n( &(_field), __atomic_load_n( &(_field), __ATOMIC_RELAXED ) + 1, __ATOMIC_RELAXED )
+
+
+static PBENCH_CONTEXT
+ListPop (
+    __in PBENCH_LOOKASIDE List
+    )
+{
+    BENCH_SLIST_HEADER old;
+    BENCH_SLIST_HEADER new;
+
+    do {
+
+        old.Value = List->Head.Value;
+
+        if (old.Next == NULL) {
+
+            return NULL;
+        }
+
+        //
+        //  The entry may be popped by another processor before the swap;
+        //  contexts are never given back to the system during a run, so
+        //  reading its link is safe, and the swap fails.
+        //
+
+        new.Next = old.Next->Next;
+        new.Depth = old.Depth - 1;
+        new.Sequence = old.Sequence;
+
+    } while (!__sync_bool_compare_and_swap( &List->Head.Value, old.Value, new.Value ));
+
+    return old.Next;
+}
+
+
+static BOOLEAN
+ListPush (
+    __in PBENCH_LOOKASIDE List,
+    __in PBENCH_CONTEXT Context
+    )
+{
+    BENCH_SLIST_HEADER old;
+    BENCH_SLIST_HEADER new;
+
+    do {
+
+        old.Value = List->Head.Value;
+
+        if (old.Depth >= BENCH_LIST_DEPTH) {
+
+            return FALSE;
+        }
+
+        Context->Next = old.Next;
+
+        new.Next = Context;
+        new.Depth = old.Depth + 1;
+        new.Sequence = old.Sequence + 1;
+
+    } while (!__sync_bool_compare_and_swap( &List->Head.Value, old.Value, new.Value ));
+
+    return TRUE;
+}
+
+
+static PBENCH_CONTEXT
+AllocateContext (
+    __in PBENCH_THREAD Thread,
+    __in PBENCH_LOOKASIDE List
+    )
+/*++
+
+Routine Description:
+
+    ExAllocateFromNPagedLookasideList, with the thread's pool behind it.
+
+--*/
+{
+    PBENCH_CONTEXT context;
+
+    BENCH_COUNT( List->TotalAllocates );
+
+    context = ListPop( List );
+
+    if (context == NULL) {
+
+        BENCH_COUNT( List->AllocateMisses );
+        Thread->Misses++;
+
+        context = Thread->Pool;
+
+        if (context != NULL) {
+
+            Thread->Pool = context->Next;
+
+        } else {
+
+            context = aligned_alloc( 64, sizeof(BENCH_CONTEXT) );
+
+            if (context == NULL) {
+
+                fprintf( stderr, "csgctxbench: out of memory\n" );
+                exit( 1 );
+            }
+        }
+    }
+
+    return context;
+}
+
+
+static VOID
+FreeContext (
+    __in PBENCH_THREAD Thread,
+    __in PBENCH_LOOKASIDE List,
+    __in PBENCH_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    ExFreeToNPagedLookasideList, with the thread's pool behind it.
+
+--*/
+{
+    BENCH_COUNT( List->TotalFrees );
+
+    if (!ListPush( List, Context )) {
+
+        BENCH_COUNT( List->FreeMisses );
+
+        Context->Next = Thread->Pool;
+        Thread->Pool = Context;
+    }
+}
+
+
+static PVOID
+BenchThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+    PBENCH_POINT point = thread->Point;
+    PBENCH_CONTEXT outstanding[BENCH_MAX_OUTSTANDING];
+    PBENCH_LOOKASIDE own;
+    PBENCH_LOOKASIDE next;
+    PBENCH_CONTEXT context;
+    ULONGLONG operations = 0;
+    ULONGLONG random = 0x9e3779b97f4a7c15ULL ^ thread->Cpu;
+    ULONG slot = 0;
+    ULONG i;
+
+    if (point->Mode == BENCH_GLOBAL) {
+
+        own = next = &point->Lists[0];
+
+    } else {
+
+        own = &point->Lists[thread->Cpu];
+        next = &point->Lists[(thread->Cpu + 1) % point->ThreadCount];
+    }
+
+    memset( outstanding, 0, sizeof(outstanding) );
+
+    pthread_barrier_wait( &point->Start );
+
+    while (!point->Stop) {
+
+        for (i = 0; i < 64; i++) {
+
+            //
+            //  The post-operation callback of the oldest operation reads
+            //  its context back and frees it.
+            //
+
+            context = outstanding[slot];
+
+            if (context != NULL) {
+
+                if (context->Processor != thread->Cpu || context->Length == 0) {
+
+                    fprintf( stderr, "csgctxbench: a context changed under its operation\n" );
+                    exit( 1 );
+                }
+
+                random ^= random << 13;
+                random ^= random >> 7;
+                random ^= random << 17;
+
+                if (point->Mode == BENCH_REMOTE &&
+                    (ULONG)(random % 100) < point->RemotePercent) {
+
+                    FreeContext( thread, next, context );
+
+                } else {
+
+                    FreeContext( thread, own, context );
+                }
+            }
+
+            //
+            //  The pre-operation callback of the next one fills one in.
+            //
+
+            context = AllocateContext( thread, own );
+
+            context->VolumeContext = thread;
+            context->SwapDescriptor = outstanding;
+            context->Issued = operations;
+            context->Length = 4096;
+            context->Processor = thread->Cpu;
+            memset( context->Record, (int)operations, sizeof(context->Record) );
+
+            outstanding[slot] = context;
+            slot = (slot + 1) % point->Outstanding;
+
+            operations++;
+        }
+    }
+
+    for (i = 0; i < point->Outstanding; i++) {
+
+        if (outstanding[i] != NULL) {
+
+            FreeContext( thread, own, outstanding[i] );
+        }
+    }
+
+    thread->Operations = operations;
+
+    return NULL;
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+ReleaseContexts (
+    __in PBENCH_CONTEXT Context
+    )
+{
+    PBENCH_CONTEXT next;
+
+    while (Context != NULL) {
+
+        next = Context->Next;
+        free( Context );
+        Context = next;
+    }
+}
+
+
+static VOID
+RunPoint (
+    __in ULONG Mode,
+    __in ULONG ThreadCount,
+    __in ULONG Outstanding,
+    __in ULONG RemotePercent,
+    __in ULONG Milliseconds,
+    __in PBENCH_THREAD Threads
+    )
+/*++
+
+Routine Description:
+
+    Runs one point and prints its line.
+
+--*/
+{
+    BENCH_POINT point;
+    struct timespec interval;
+    cpu_set_t set;
+    ULONGLONG operations = 0;
+    ULONGLONG misses = 0;
+    double start;
+    double seconds;
+    ULONG i;
+
+    memset( &point, 0, sizeof(point) );
+
+    point.Mode = Mode;
+    point.ThreadCount = ThreadCount;
+    point.Outstanding = Outstanding;
+    point.RemotePercent = RemotePercent;
+    point.Lists = aligned_alloc( 64, ThreadCount * sizeof(BENCH_LOOKASIDE) );
+
+    if (point.Lists == NULL) {
+
+        fprintf( stderr, "csgctxbench: out of memory\n" );
+        exit( 1 );
+    }
+
+    memset( point.Lists, 0, ThreadCount * sizeof(BENCH_LOOKASIDE) );
+
+    pthread_barrier_init( &point.Start, NULL, ThreadCount + 1 );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Point = &point;
+        Threads[i].Cpu = i;
+        Threads[i].Pool = NULL;
+        Threads[i].Operations = 0;
+        Threads[i].Misses = 0;
+
+        pthread_create( &Threads[i].Thread, NULL, BenchThread, &Threads[i] );
+
+        CPU_ZERO( &set );
+        CPU_SET( i, &set );
+
+        pthread_setaffinity_np( Threads[i].Thread, sizeof(set), &set );
+    }
+
+    pthread_barrier_wait( &point.Start );
+
+    start = Now();
+
+    interval.tv_sec = Milliseconds / 1000;
+    interval.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    nanosleep( &interval, NULL );
+
+    point.Stop = TRUE;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        operations += Threads[i].Operations;
+        misses += Threads[i].Misses;
+    }
+
+    seconds = Now() - start;
+
+    pthread_barrier_destroy( &point.Start );
+
+    //
+    //  Every thread has stopped, so the lists and pools can be emptied.
+    //
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        ReleaseContexts( point.Lists[i].Head.Next );
+        ReleaseContexts( Threads[i].Pool );
+    }
+
+    free( point.Lists );
+
+    printf( "%s,%u,%.2f,%.1f,%.3f\n",
+            ModeNames[Mode],
+            ThreadCount,
+            operations / seconds / 1e6,
+            (operations != 0) ? seconds * 1e9 * ThreadCount / operations : 0.0,
+            (operations != 0) ? 100.0 * misses / operations : 0.0 );
+
+    fflush( stdout );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgctxbench [-d outstanding] [-m milliseconds] [-r percent]\n"
+             "                   [-t threads]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    ULONG cpuCount = csgCpuCount();
+    ULONG outstanding = 4;
+    ULONG milliseconds = 200;
+    ULONG remotePercent = 50;
+    ULONG onlyThreads = 0;
+    PBENCH_THREAD threads;
+    ULONG threadCount;
+    ULONG mode;
+    int option;
+
+    while ((option = getopt( argc, argv, "d:m:r:t:" )) != -1) {
+
+        switch (option) {
+
+            case 'd':   outstanding = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'r':   remotePercent = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   onlyThreads = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (cpuCount > BENCH_MAX_THREADS) {
+
+        cpuCount = BENCH_MAX_THREADS;
+    }
+
+    if (optind != argc || outstanding == 0 || outstanding > BENCH_MAX_OUTSTANDING ||
+        milliseconds == 0 || remotePercent > 100 || onlyThreads > cpuCount) {
+
+        Usage();
+        return 2;
+    }
+
+    threads = aligned_alloc( 64, cpuCount * sizeof(BENCH_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    fprintf( stderr, "csgctxbench: %u processors, %u byte contexts\n",
+             cpuCount, (ULONG)sizeof(BENCH_CONTEXT) );
+
+    printf( "mode,threads,mops,ns_per_op,miss_pct\n" );
+
+    for (threadCount = 1; ; threadCount *= 2) {
+
+        if (threadCount > cpuCount) {
+
+            threadCount = cpuCount;
+        }
+
+        if (onlyThreads != 0) {
+
+            threadCount = onlyThreads;
+        }
+
+        for (mode = 0; mode < BENCH_MODES; mode++) {
+
+            //
+            //  On one thread there is no other processor to free to.
+            //
+
+            if (mode == BENCH_REMOTE && threadCount == 1) {
+
+                continue;
+            }
+
+            RunPoint( mode, threadCount, outstanding, remotePercent, milliseconds, threads );
+        }
+
+        if (onlyThreads != 0 || threadCount == cpuCount) {
+
+            break;
+        }
+    }
+
+    free( threads );
+
+    return 0;
+}
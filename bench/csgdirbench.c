@@ -0,0 +1,846 @@
+/*++
+
+Module Name:
+
+    csgdirbench.c
+
+Abstract:
+
+    Measures the directory entry walker (csgDirWalk.h) on large
+    directories.
+
+        csgdirbench [-b bytes] [-c capacity] [-e entries] [-m milliseconds]
+                    [-t threads]
+
+    A directory of 10000 files, with names of 8 to 40 characters, is laid
+    out as the results of the queries that would list it, each query
+    returning as many entries as fit in the buffer, for the id classes
+    Explorer and the shell use and for FileBothDirectoryInformation, which
+    FindFirstFile asks for.  None, one in ten or all of its files are
+    protected, and their ids, or for the class without ids the hashes of
+    their names (csgDirWalkHashName), are in a cache of the driver's
+    (csgKeyCache.h) as the post-operation callback finds them.  Every thread goes over a
+    copy of the whole directory again and again, as the post-operation
+    callback would, sharing the one cache.  Each point runs on 1, 2, 4,
+    ... threads up to twice the processors (or only the -t count), each
+    pinned to a processor.
+
+    The "walk" rows walk the entries with a lookup that knows no file,
+    the cost of the walk itself; the "cache" rows look every file up.
+    The "copy" rows only copy the results to another buffer, what the
+    callback does with them anyway, for scale.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        mode        walk, cache or copy
+        class       both (FileIdBothDirectoryInformation), full
+                    (FileIdFullDirectoryInformation), extd_both
+                    (FileIdExtdBothDirectoryInformation) or both_name
+                    (FileBothDirectoryInformation, looked up by name)
+        entries     entries in the directory
+        protected   percent of them protected
+        threads     threads running at once
+        ns_entry    nanoseconds per entry, per thread
+        ms_dir      milliseconds to go over the whole directory, per
+                    thread
+        patched     entries patched by one pass over the directory
+
+        -b      bytes returned by each query, 64K unless told
+        -c      the cache's capacity, 4096 (the driver's default) unless
+                told
+        -e      entries in the directory, 10000 unless told
+        -m      time per point, 200 ms unless told
+        -t      only this many threads
+
+    Before it is timed, the first pass over each directory is checked,
+    when the cache can hold all its protected files: every one of them,
+    and no other file, must come out of it with its header taken off its
+    sizes.
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgdirbench.c ../csgDirWalk.c \
+           ../csgKeyCache.c ../csgCpu.c -lpthread -o csgdirbench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgDirWalk.h"
+#include "csgKeyCache.h"
+#include "csgCpu.h"
+
+#define BENCH_MAX_THREADS       256
+
+#define BENCH_HEADER_SIZE       0x1000
+
+//
+//  FILE_INFORMATION_CLASS values of the classes measured.
+//
+
+#define BENCH_BOTH              3
+#define BENCH_ID_BOTH           37
+#define BENCH_ID_FULL           38
+#define BENCH_ID_EXTD_BOTH      63
+
+typedef struct _BENCH_CLASS {
+
+    CONST CHAR *Name;
+
+    ULONG InformationClass;
+
+    ULONG FileIdOffset;
+
+    ULONG FileNameOffset;
+
+} BENCH_CLASS, *PBENCH_CLASS;
+
+typedef CONST BENCH_CLASS *PCBENCH_CLASS;
+
+//
+//  Where the file id, if any, and the name are in an entry of each class.
+//
+
+static CONST BENCH_CLASS Classes[] = {
+
+    { "both",       BENCH_ID_BOTH,      96, 104 },
+    { "full",       BENCH_ID_FULL,      72, 80 },
+    { "extd_both",  BENCH_ID_EXTD_BOTH, 72, 114 },
+    { "both_name",  BENCH_BOTH,         0,  94 },
+};
+
+//
+//  The directory's name, which its files' names are hashed on from.
+//
+
+static CONST USHORT DirectoryName[] = {
+    '\\', 'D', 'e', 'v', 'i', 'c', 'e', '\\', 'V', 'o', 'l', 'u', 'm', 'e', '\\',
+    'b', 'e', 'n', 'c', 'h', '\\'
+};
+
+//
+//  A directory laid out as the results of the queries listing it.
+//
+
+typedef struct _BENCH_DIR {
+
+    PUCHAR Buffers;
+
+    ULONG BufferSize;
+
+    ULONG BufferCount;
+
+    //
+    //  Bytes the file system filled in, for each buffer.
+    //
+
+    PULONG Lengths;
+
+    ULONG Entries;
+
+    ULONG Protected;
+
+} BENCH_DIR, *PBENCH_DIR;
+
+typedef struct _BENCH_POINT {
+
+    CONST CHAR *Mode;
+
+    PCBENCH_CLASS Class;
+
+    PBENCH_DIR Dir;
+
+    PCSG_KEYCACHE Cache;
+
+    ULONGLONG DirectoryHash;
+
+    pthread_barrier_t Start;
+
+    volatile BOOLEAN Stop;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+typedef struct _BENCH_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Cpu;
+
+    PBENCH_POINT Point;
+
+    //
+    //  The thread's copy of the directory, and where "copy" copies it.
+    //
+
+    PUCHAR Buffers;
+
+    PUCHAR Target;
+
+    ULONGLONG Passes;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+static ULONG
+HeaderSize (
+    __in PVOID Context,
+    __in ULONGLONG FileId,
+    __in_bcount(FileNameLength) CONST UCHAR *FileName,
+    __in ULONG FileNameLength
+    )
+{
+    PBENCH_POINT point = Context;
+    CSG_KEYCACHE_ID id;
+    ULONG headerSize;
+
+    memset( &id, 0, sizeof(id) );
+
+    //
+    //  Keyed as the driver keys ProtectedIds (ProtectedIdKey and
+    //  ProtectedNameKey).
+    //
+
+    if (FileId != 0) {
+
+        id.FileId = FileId;
+
+    } else {
+
+        id.FileId = csgDirWalkHashName( point->DirectoryHash, FileName, FileNameLength );
+        id.Generation = 1;
+    }
+
+    if (!csgKeyCacheLookup( point->Cache, &id, &headerSize )) {
+
+        return 0;
+    }
+
+    return headerSize;
+}
+
+
+static ULONG
+NoHeader (
+    __in PVOID Context,
+    __in ULONGLONG FileId,
+    __in_bcount(FileNameLength) CONST UCHAR *FileName,
+    __in ULONG FileNameLength
+    )
+{
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( FileId );
+    UNREFERENCED_PARAMETER( FileName );
+    UNREFERENCED_PARAMETER( FileNameLength );
+
+    return 0;
+}
+
+
+static ULONGLONG
+FileId (
+    __in ULONG Index
+    )
+{
+    //
+    //  Sparse, with a sequence number in the top 16 bits, as on NTFS.
+    //
+
+    return (1ULL << 48) | (0x100 + (ULONGLONG)Index * 3);
+}
+
+
+static ULONG
+FileName (
+    __in ULONG Index,
+    __out_ecount(40) PUSHORT Name
+    )
+{
+    ULONG length = 8 + (Index * 13) % 33;
+    ULONG digits = Index;
+    ULONG c;
+
+    //
+    //  The index in base 26 first, so names are unique.
+    //
+
+    for (c = 0; c < length; c++) {
+
+        if (c < 5) {
+
+            Name[c] = (USHORT)('a' + digits % 26);
+            digits /= 26;
+
+        } else {
+
+            Name[c] = (USHORT)('a' + (Index + c) % 26);
+        }
+    }
+
+    return length * sizeof(USHORT);
+}
+
+
+static BOOLEAN
+IsProtected (
+    __in ULONG Index,
+    __in ULONG Percent
+    )
+{
+    return ((Index * 37) % 100) < Percent;
+}
+
+
+static LONGLONG
+FileSize (
+    __in ULONG Index
+    )
+{
+    return ((LONGLONG)Index * 7919) % (1 << 20);
+}
+
+
+static VOID
+BuildDirectory (
+    __in PCBENCH_CLASS Class,
+    __in ULONG Entries,
+    __in ULONG Percent,
+    __in ULONG BufferSize,
+    __out PBENCH_DIR Dir
+    )
+/*++
+
+Routine Description:
+
+    Lays a directory out, entry by entry, each 8 byte aligned, starting a
+    new buffer whenever the next entry does not fit.  Every eighth file is
+    a directory.  Protected files are listed header included.
+
+--*/
+{
+    PUCHAR buffer;
+    PUCHAR entry;
+    PUCHAR previous = NULL;
+    ULONG offset = 0;
+    ULONG entrySize;
+    ULONG nameLength;
+    USHORT name[40];
+    ULONG attributes;
+    ULONGLONG id;
+    LONGLONG size;
+    ULONG count;
+    ULONG i;
+
+    memset( Dir, 0, sizeof(BENCH_DIR) );
+
+    Dir->BufferSize = BufferSize;
+    Dir->Entries = Entries;
+
+    //
+    //  No entry is larger than the name offset and 40 characters, so
+    //  there can be no more buffers than that many entries per buffer.
+    //
+
+    count = Entries / (BufferSize / (Class->FileNameOffset + 80 + 8)) + 1;
+
+    Dir->Buffers = calloc( count, BufferSize );
+    Dir->Lengths = calloc( count, sizeof(ULONG) );
+
+    if (Dir->Buffers == NULL || Dir->Lengths == NULL) {
+
+        fprintf( stderr, "csgdirbench: out of memory\n" );
+        exit( 1 );
+    }
+
+    buffer = Dir->Buffers;
+    Dir->BufferCount = 1;
+
+    for (i = 0; i < Entries; i++) {
+
+        nameLength = FileName( i, name );
+        entrySize = (Class->FileNameOffset + nameLength + 7) & ~7U;
+
+        if (offset + entrySize > BufferSize) {
+
+            Dir->Lengths[Dir->BufferCount - 1] = offset;
+
+            buffer += BufferSize;
+            Dir->BufferCount++;
+            offset = 0;
+            previous = NULL;
+        }
+
+        entry = buffer + offset;
+
+        if (previous != NULL) {
+
+            *(PULONG)previous = (ULONG)(entry - previous);
+        }
+
+        attributes = ((i % 8) == 7) ? 0x10 : 0x20;
+        id = FileId( i );
+        size = FileSize( i );
+
+        if ((attributes & 0x10) == 0 && IsProtected( i, Percent )) {
+
+            size += BENCH_HEADER_SIZE;
+            Dir->Protected++;
+        }
+
+        memcpy( entry + 40, &size, sizeof(size) );
+        size = (size + 4095) & ~4095LL;
+        memcpy( entry + 48, &size, sizeof(size) );
+        memcpy( entry + 56, &attributes, sizeof(attributes) );
+        memcpy( entry + 60, &nameLength, sizeof(nameLength) );
+        memcpy( entry + Class->FileNameOffset, name, nameLength );
+
+        if (Class->FileIdOffset != 0) {
+
+            memcpy( entry + Class->FileIdOffset, &id, sizeof(id) );
+        }
+
+        previous = entry;
+        offset += entrySize;
+    }
+
+    Dir->Lengths[Dir->BufferCount - 1] = offset;
+}
+
+
+static ULONG
+Pass (
+    __in PBENCH_POINT Point,
+    __inout PUCHAR Buffers,
+    __out_opt PUCHAR Target
+    )
+/*++
+
+Routine Description:
+
+    Goes over the whole directory once, as the point's mode says.
+
+--*/
+{
+    PBENCH_DIR dir = Point->Dir;
+    ULONG patched = 0;
+    ULONG i;
+
+    for (i = 0; i < dir->BufferCount; i++) {
+
+        if (Target != NULL) {
+
+            memcpy( Target, Buffers + (SIZE_T)i * dir->BufferSize, dir->Lengths[i] );
+
+        } else {
+
+            patched += csgDirWalkPatchSizes( Buffers + (SIZE_T)i * dir->BufferSize,
+                                             dir->Lengths[i],
+                                             Point->Class->InformationClass,
+                                             (Point->Cache != NULL) ? HeaderSize : NoHeader,
+                                             Point,
+                                             NULL );
+        }
+    }
+
+    return patched;
+}
+
+
+static VOID
+CheckPass (
+    __in PBENCH_POINT Point,
+    __in ULONG Percent
+    )
+/*++
+
+Routine Description:
+
+    Patches a copy of the directory and checks every entry's sizes.
+
+--*/
+{
+    PBENCH_DIR dir = Point->Dir;
+    PUCHAR copy = malloc( (SIZE_T)dir->BufferCount * dir->BufferSize );
+    PUCHAR entry;
+    LONGLONG endOfFile;
+    LONGLONG expected;
+    ULONG attributes;
+    ULONG next;
+    ULONG index = 0;
+    ULONG patched;
+    ULONG i;
+
+    memcpy( copy, dir->Buffers, (SIZE_T)dir->BufferCount * dir->BufferSize );
+
+    patched = Pass( Point, copy, NULL );
+
+    for (i = 0; i < dir->BufferCount; i++) {
+
+        entry = copy + (SIZE_T)i * dir->BufferSize;
+
+        for (;;) {
+
+            memcpy( &endOfFile, entry + 40, sizeof(endOfFile) );
+            memcpy( &attributes, entry + 56, sizeof(attributes) );
+
+            expected = FileSize( index );
+
+            if ((attributes & 0x10) == 0 && IsProtected( index, Percent ) && Point->Cache == NULL) {
+
+                expected += BENCH_HEADER_SIZE;
+            }
+
+            if (endOfFile != expected) {
+
+                fprintf( stderr, "csgdirbench: entry %u is %lld bytes long, not %lld\n",
+                         index, (long long)endOfFile, (long long)expected );
+                exit( 1 );
+            }
+
+            index++;
+
+            memcpy( &next, entry, sizeof(next) );
+
+            if (next == 0) {
+
+                break;
+            }
+
+            entry += next;
+        }
+    }
+
+    if (index != dir->Entries || patched != ((Point->Cache != NULL) ? dir->Protected : 0)) {
+
+        fprintf( stderr, "csgdirbench: %u entries walked, %u patched\n", index, patched );
+        exit( 1 );
+    }
+
+    free( copy );
+}
+
+
+static PVOID
+BenchThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+    PBENCH_POINT point = thread->Point;
+    ULONGLONG passes = 0;
+
+    pthread_barrier_wait( &point->Start );
+
+    while (!point->Stop) {
+
+        Pass( point, thread->Buffers, thread->Target );
+        passes++;
+    }
+
+    thread->Passes = passes;
+
+    return NULL;
+}
+
+
+static VOID
+PinThread (
+    __in pthread_t Thread,
+    __in ULONG Cpu
+    )
+{
+    cpu_set_t set;
+
+    CPU_ZERO( &set );
+    CPU_SET( Cpu, &set );
+
+    pthread_setaffinity_np( Thread, sizeof(set), &set );
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+RunPoint (
+    __in CONST CHAR *Mode,
+    __in PCBENCH_CLASS Class,
+    __in PBENCH_DIR Dir,
+    __in ULONG Percent,
+    __in ULONG Capacity,
+    __in ULONG ThreadCount,
+    __in ULONG CpuCount,
+    __in ULONG Milliseconds,
+    __in PBENCH_THREAD Threads
+    )
+/*++
+
+Routine Description:
+
+    Runs one point, in the "cache" mode with a new cache holding the
+    protected files' ids or name hashes, and prints its line.
+
+--*/
+{
+    BENCH_POINT point;
+    CSG_KEYCACHE_ID id;
+    ULONG headerSize = BENCH_HEADER_SIZE;
+    USHORT name[40];
+    ULONG nameLength;
+    struct timespec interval;
+    SIZE_T size = (SIZE_T)Dir->BufferCount * Dir->BufferSize;
+    ULONGLONG passes = 0;
+    ULONG patched;
+    double start;
+    double seconds;
+    double perDir;
+    ULONG i;
+
+    memset( &point, 0, sizeof(point) );
+
+    point.Mode = Mode;
+    point.Class = Class;
+    point.Dir = Dir;
+    point.DirectoryHash = csgDirWalkHashName( CSG_DIR_NAME_HASH_SEED,
+                                              (CONST UCHAR *)DirectoryName,
+                                              sizeof(DirectoryName) );
+
+    if (strcmp( Mode, "cache" ) == 0) {
+
+        if (!NT_SUCCESS( csgKeyCacheCreate( Capacity, sizeof(ULONG), &point.Cache ) )) {
+
+            fprintf( stderr, "csgdirbench: cannot create a cache of %u ids\n", Capacity );
+            exit( 1 );
+        }
+
+        for (i = 0; i < Dir->Entries; i++) {
+
+            if ((i % 8) != 7 && IsProtected( i, Percent )) {
+
+                memset( &id, 0, sizeof(id) );
+
+                if (Class->FileIdOffset != 0) {
+
+                    id.FileId = FileId( i );
+
+                } else {
+
+                    nameLength = FileName( i, name );
+                    id.FileId = csgDirWalkHashName( point.DirectoryHash, (CONST UCHAR *)name, nameLength );
+                    id.Generation = 1;
+                }
+
+                csgKeyCacheInsert( point.Cache, &id, &headerSize );
+            }
+        }
+    }
+
+    if (strcmp( Mode, "copy" ) != 0 && Capacity >= Dir->Protected) {
+
+        CheckPass( &point, Percent );
+    }
+
+    pthread_barrier_init( &point.Start, NULL, ThreadCount + 1 );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Point = &point;
+        Threads[i].Cpu = i % CpuCount;
+        Threads[i].Passes = 0;
+        Threads[i].Buffers = malloc( size );
+        Threads[i].Target = (strcmp( Mode, "copy" ) == 0) ? malloc( Dir->BufferSize ) : NULL;
+
+        memcpy( Threads[i].Buffers, Dir->Buffers, size );
+
+        pthread_create( &Threads[i].Thread, NULL, BenchThread, &Threads[i] );
+
+        PinThread( Threads[i].Thread, Threads[i].Cpu );
+    }
+
+    pthread_barrier_wait( &point.Start );
+
+    start = Now();
+
+    interval.tv_sec = Milliseconds / 1000;
+    interval.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    nanosleep( &interval, NULL );
+
+    point.Stop = TRUE;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        passes += Threads[i].Passes;
+
+        free( Threads[i].Buffers );
+        free( Threads[i].Target );
+    }
+
+    seconds = Now() - start;
+
+    pthread_barrier_destroy( &point.Start );
+
+    //
+    //  One more pass, on the pristine directory, for the count.
+    //
+
+    patched = 0;
+
+    if (strcmp( Mode, "copy" ) != 0) {
+
+        PUCHAR copy = malloc( size );
+
+        memcpy( copy, Dir->Buffers, size );
+        patched = Pass( &point, copy, NULL );
+        free( copy );
+    }
+
+    if (point.Cache != NULL) {
+
+        csgKeyCacheDestroy( point.Cache );
+    }
+
+    perDir = (passes != 0) ? seconds * ThreadCount / passes : 0.0;
+
+    printf( "%s,%s,%u,%u,%u,%.2f,%.3f,%u\n",
+            Mode,
+            Class->Name,
+            Dir->Entries,
+            Percent,
+            ThreadCount,
+            perDir * 1e9 / Dir->Entries,
+            perDir * 1e3,
+            patched );
+
+    fflush( stdout );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgdirbench [-b bytes] [-c capacity] [-e entries] [-m milliseconds] [-t threads]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    static CONST ULONG percents[] = { 0, 10, 100 };
+    ULONG cpuCount = csgCpuCount();
+    ULONG bufferSize = 64 * 1024;
+    ULONG capacity = 4096;
+    ULONG entries = 10000;
+    ULONG milliseconds = 200;
+    ULONG onlyThreads = 0;
+    PBENCH_THREAD threads;
+    ULONG threadCount;
+    BENCH_DIR dir;
+    ULONG c, p;
+    int option;
+
+    while ((option = getopt( argc, argv, "b:c:e:m:t:" )) != -1) {
+
+        switch (option) {
+
+            case 'b':   bufferSize = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'c':   capacity = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'e':   entries = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   onlyThreads = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || bufferSize < 1024 || bufferSize > 0x1000000 ||
+        capacity == 0 || capacity > 0x10000 || entries == 0 || entries > 10000000 ||
+        milliseconds == 0 || onlyThreads > BENCH_MAX_THREADS) {
+
+        Usage();
+        return 2;
+    }
+
+    threads = calloc( BENCH_MAX_THREADS, sizeof(BENCH_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    fprintf( stderr, "csgdirbench: %u processors, %u byte queries, %u ids cached at most\n",
+             cpuCount, bufferSize, capacity );
+
+    printf( "mode,class,entries,protected,threads,ns_entry,ms_dir,patched\n" );
+
+    for (threadCount = 1; threadCount <= 2 * cpuCount && threadCount <= BENCH_MAX_THREADS; threadCount *= 2) {
+
+        if (onlyThreads != 0) {
+
+            threadCount = onlyThreads;
+        }
+
+        for (c = 0; c < sizeof(Classes) / sizeof(Classes[0]); c++) {
+
+            for (p = 0; p < sizeof(percents) / sizeof(percents[0]); p++) {
+
+                BuildDirectory( &Classes[c], entries, percents[p], bufferSize, &dir );
+
+                if (p == 0) {
+
+                    RunPoint( "copy", &Classes[c], &dir, percents[p], capacity,
+                              threadCount, cpuCount, milliseconds, threads );
+                    RunPoint( "walk", &Classes[c], &dir, percents[p], capacity,
+                              threadCount, cpuCount, milliseconds, threads );
+                }
+
+                RunPoint( "cache", &Classes[c], &dir, percents[p], capacity,
+                          threadCount, cpuCount, milliseconds, threads );
+
+                free( dir.Buffers );
+                free( dir.Lengths );
+            }
+        }
+
+        if (onlyThreads != 0) {
+
+            break;
+        }
+    }
+
+    free( threads );
+
+    return 0;
+}
@@ -0,0 +1,461 @@
+/*++
+
+Module Name:
+
+    csgkeybench.c
+
+Abstract:
+
+    Measures the file key cache (csgKeyCache.h) under concurrent opens.
+
+        csgkeybench [-c capacity] [-m milliseconds] [-t threads]
+
+    Every thread plays a stream of opens of files with derived keys, as
+    csgStreamSetDerivedKey does them: look the file's key up and, on a
+    miss, derive it with HKDF, expand it for XTS and insert it.  The
+    files are picked at random, uniformly or with 80% of the opens going
+    to 20% of the files, from a set half the cache's capacity, twice it
+    and eight times it.  Each point runs on 1, 2, 4, ... threads up to
+    twice the processors (or only the -t count), each pinned to a
+    processor; a cache is created for each point and starts empty.
+
+    The "derive" rows are the same opens without a cache, what every open
+    would cost without it.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        mode        cache or derive
+        dist        uniform or skewed
+        files       files opened
+        capacity    keys the cache holds
+        threads     threads running at once
+        mops        10^6 opens per second, over all threads
+        ns          nanoseconds per open, per thread
+        hit_pct     opens that found the key cached
+        evictions   keys evicted
+
+        -c      the cache's capacity, 512 (the driver's default) unless
+                told
+        -m      time per point, 200 ms unless told
+        -t      only this many threads
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgkeybench.c ../csgKeyCache.c \
+           ../csgHkdf.c ../csgAes.c ../csgXts.c ../csgCpu.c \
+           -lpthread -o csgkeybench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgKeyCache.h"
+#include "csgHkdf.h"
+#include "csgXts.h"
+
+#define BENCH_LABEL             "CipherStreamGuard file key"
+
+#define BENCH_MAX_THREADS       256
+
+typedef struct _BENCH_POINT {
+
+    //
+    //  NULL for the derive rows.
+    //
+
+    PCSG_KEYCACHE Cache;
+
+    ULONG Files;
+
+    BOOLEAN Skewed;
+
+    pthread_barrier_t Start;
+
+    volatile BOOLEAN Stop;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+typedef struct _BENCH_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Cpu;
+
+    PBENCH_POINT Point;
+
+    ULONGLONG Random;
+
+    ULONGLONG Opens;
+
+    //
+    //  Where keys are expanded or copied to, as the stream context.
+    //
+
+    CSG_XTS_KEY Key;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+static UCHAR MasterKeyPrk[CSG_SHA256_DIGEST_SIZE];
+
+
+static ULONGLONG
+NextRandom (
+    __inout PBENCH_THREAD Thread
+    )
+{
+    ULONGLONG x = Thread->Random;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    Thread->Random = x;
+
+    return x;
+}
+
+
+static ULONGLONG
+PickFile (
+    __inout PBENCH_THREAD Thread
+    )
+{
+    PBENCH_POINT point = Thread->Point;
+    ULONGLONG r = NextRandom( Thread );
+    ULONG hot = (point->Files + 4) / 5;
+
+    //
+    //  File ids are sparse, as on a real volume.
+    //
+
+    if (point->Skewed && (r % 5) != 0) {
+
+        return 0x10000 + ((r >> 8) % hot) * 7;
+    }
+
+    return 0x10000 + ((r >> 8) % point->Files) * 7;
+}
+
+
+static VOID
+Open (
+    __inout PBENCH_THREAD Thread,
+    __in ULONGLONG FileId
+    )
+{
+    PBENCH_POINT point = Thread->Point;
+    CSG_KEYCACHE_ID id;
+    CSG_HKDF_INFO info[3];
+    UCHAR context[12];
+    UCHAR fileKey[CSG_XTS_KEY_SIZE];
+    ULONG i;
+
+    memset( &id, 0, sizeof(id) );
+
+    id.FileId = FileId;
+    id.Generation = 1;
+    id.Algorithm = 0;
+
+    //
+    //  The IV seed of the file's header.
+    //
+
+    for (i = 0; i < sizeof(id.Salt); i++) {
+
+        id.Salt[i] = (UCHAR)((FileId * 0x9e3779b97f4a7c15ULL) >> (4 * i));
+    }
+
+    if (point->Cache != NULL &&
+        csgKeyCacheLookup( point->Cache, &id, &Thread->Key )) {
+
+        return;
+    }
+
+    memset( context, 0, sizeof(context) );
+
+    for (i = 0; i < 8; i++) {
+
+        context[4 + i] = (UCHAR)(FileId >> (8 * i));
+    }
+
+    info[0].Data = BENCH_LABEL;
+    info[0].Length = sizeof(BENCH_LABEL) - 1;
+    info[1].Data = context;
+    info[1].Length = sizeof(context);
+    info[2].Data = id.Salt;
+    info[2].Length = sizeof(id.Salt);
+
+    csgHkdfExpand( MasterKeyPrk, info, 3, fileKey, sizeof(fileKey) );
+
+    csgXtsSetKey( &Thread->Key, fileKey );
+
+    if (point->Cache != NULL) {
+
+        csgKeyCacheInsert( point->Cache, &id, &Thread->Key );
+    }
+}
+
+
+static PVOID
+BenchThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+    PBENCH_POINT point = thread->Point;
+    ULONGLONG opens = 0;
+
+    pthread_barrier_wait( &point->Start );
+
+    while (!point->Stop) {
+
+        Open( thread, PickFile( thread ) );
+        opens++;
+    }
+
+    thread->Opens = opens;
+
+    return NULL;
+}
+
+
+static VOID
+PinThread (
+    __in pthread_t Thread,
+    __in ULONG Cpu
+    )
+{
+    cpu_set_t set;
+
+    CPU_ZERO( &set );
+    CPU_SET( Cpu, &set );
+
+    pthread_setaffinity_np( Thread, sizeof(set), &set );
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+RunPoint (
+    __in CONST CHAR *Dist,
+    __in ULONG Capacity,
+    __in ULONG Files,
+    __in ULONG ThreadCount,
+    __in ULONG CpuCount,
+    __in ULONG Milliseconds,
+    __in PBENCH_THREAD Threads
+    )
+/*++
+
+Routine Description:
+
+    Runs one point, with a new cache of Capacity keys or, if Capacity is
+    zero, without one, and prints its line.
+
+--*/
+{
+    BENCH_POINT point;
+    CSG_KEYCACHE_STATS stats;
+    struct timespec interval;
+    ULONGLONG opens = 0;
+    double start;
+    double seconds;
+    ULONG i;
+
+    memset( &point, 0, sizeof(point) );
+
+    point.Files = Files;
+    point.Skewed = (strcmp( Dist, "skewed" ) == 0);
+
+    if (Capacity != 0 &&
+        !NT_SUCCESS( csgKeyCacheCreate( Capacity, sizeof(CSG_XTS_KEY), &point.Cache ) )) {
+
+        fprintf( stderr, "csgkeybench: cannot create a cache of %u keys\n", Capacity );
+        exit( 1 );
+    }
+
+    pthread_barrier_init( &point.Start, NULL, ThreadCount + 1 );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Point = &point;
+        Threads[i].Cpu = i % CpuCount;
+        Threads[i].Random = 0x9e3779b97f4a7c15ULL * (i + 1);
+        Threads[i].Opens = 0;
+
+        pthread_create( &Threads[i].Thread, NULL, BenchThread, &Threads[i] );
+
+        PinThread( Threads[i].Thread, Threads[i].Cpu );
+    }
+
+    pthread_barrier_wait( &point.Start );
+
+    start = Now();
+
+    interval.tv_sec = Milliseconds / 1000;
+    interval.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    nanosleep( &interval, NULL );
+
+    point.Stop = TRUE;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        opens += Threads[i].Opens;
+    }
+
+    seconds = Now() - start;
+
+    pthread_barrier_destroy( &point.Start );
+
+    memset( &stats, 0, sizeof(stats) );
+
+    if (point.Cache != NULL) {
+
+        csgKeyCacheQueryStats( point.Cache, &stats );
+        csgKeyCacheDestroy( point.Cache );
+    }
+
+    printf( "%s,%s,%u,%u,%u,%.3f,%.1f,%.1f,%llu\n",
+            (Capacity != 0) ? "cache" : "derive",
+            Dist,
+            Files,
+            Capacity,
+            ThreadCount,
+            opens / seconds / 1e6,
+            (opens != 0) ? seconds * ThreadCount * 1e9 / opens : 0.0,
+            (stats.Hits + stats.Misses != 0) ? 100.0 * stats.Hits / (stats.Hits + stats.Misses) : 0.0,
+            (unsigned long long)stats.Evictions );
+
+    fflush( stdout );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgkeybench [-c capacity] [-m milliseconds] [-t threads]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    static CONST ULONG fileFactors[] = { 1, 4, 16 };
+    static CONST CHAR *dists[] = { "uniform", "skewed" };
+    UCHAR masterKey[CSG_SHA256_DIGEST_SIZE];
+    ULONG cpuCount = csgCpuCount();
+    ULONG capacity = 512;
+    ULONG milliseconds = 200;
+    ULONG onlyThreads = 0;
+    PBENCH_THREAD threads;
+    ULONG threadCount;
+    ULONG f, d, i;
+    int option;
+
+    while ((option = getopt( argc, argv, "c:m:t:" )) != -1) {
+
+        switch (option) {
+
+            case 'c':   capacity = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   onlyThreads = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || capacity < 2 || capacity > 0x10000 || milliseconds == 0 ||
+        onlyThreads > BENCH_MAX_THREADS) {
+
+        Usage();
+        return 2;
+    }
+
+    for (i = 0; i < sizeof(masterKey); i++) {
+
+        masterKey[i] = (UCHAR)(i * 29 + 1);
+    }
+
+    csgHkdfExtract( NULL, 0, masterKey, sizeof(masterKey), MasterKeyPrk );
+
+    threads = aligned_alloc( 64, BENCH_MAX_THREADS * sizeof(BENCH_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    fprintf( stderr, "csgkeybench: %u processors, %zu byte keys\n",
+             cpuCount, sizeof(CSG_XTS_KEY) );
+
+    printf( "mode,dist,files,capacity,threads,mops,ns,hit_pct,evictions\n" );
+
+    for (threadCount = 1; threadCount <= 2 * cpuCount && threadCount <= BENCH_MAX_THREADS; threadCount *= 2) {
+
+        if (onlyThreads != 0) {
+
+            threadCount = onlyThreads;
+        }
+
+        RunPoint( "uniform", 0, capacity, threadCount, cpuCount, milliseconds, threads );
+
+        for (d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+
+            for (f = 0; f < sizeof(fileFactors) / sizeof(fileFactors[0]); f++) {
+
+                RunPoint( dists[d],
+                          capacity,
+                          capacity * fileFactors[f] / 2,
+                          threadCount,
+                          cpuCount,
+                          milliseconds,
+                          threads );
+            }
+        }
+
+        if (onlyThreads != 0) {
+
+            break;
+        }
+    }
+
+    free( threads );
+
+    return 0;
+}
@@ -0,0 +1,779 @@
+/*++
+
+Module Name:
+
+    csgpoolbench.c
+
+Abstract:
+
+    Measures the crypto worker pool (csgWorkPool.h) against enciphering
+    and deciphering on the issuing thread.
+
+        csgpoolbench [-d outstanding] [-m milliseconds] [-q depth]
+                     [-t producers] [-w workers]
+
+    Each producer plays a thread issuing large writes, as csgPreWriteBuffers
+    sees them: it keeps a number of writes outstanding and, as each one
+    completes, issues the next.  In the "pool" rows a write is submitted
+    to the pool, which enciphers it with XTS on a worker; when the queue
+    is full the producer enciphers it itself, as the driver does.  In the
+    "inline" rows every write is enciphered by its producer.  Each point
+    runs writes of 64 KB, 256 KB and 1 MB on 1, 2, 4, ... producers up to
+    twice the processors (or only the -t count); a pool is created for
+    each point.
+
+    The "split" rows are one producer reading, as csgPostReadBuffers sees
+    it: one read of 1 MB, 4 MB or 8 MB at a time, deciphered in chunks
+    by the producer and a pool of 1, 2, 4, ... workers up to the
+    processors (or only the -w count), split the way the driver splits
+    it.  The single-thread rate is the inline row of the same size with
+    one producer.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        mode        pool, inline or split
+        size        bytes per write or read
+        producers   threads issuing writes or reads
+        workers     pool workers over all nodes, 0 for inline
+        mbps        10^6 bytes enciphered per second, over all producers
+        p50_us      microseconds from issue to completion, median
+        p99_us      and 99th percentile
+        p999_us     and 99.9th percentile
+        inline_pct  writes the pool refused because the queue was full;
+                    for split, chunks the producer deciphered itself
+        wakeups     times a worker was woken, per write or read
+
+        -d      writes each producer keeps outstanding, 4 unless told
+        -m      time per point, 200 ms unless told
+        -q      the queue depth of each node, 256 (the driver's default)
+                unless told
+        -t      only this many producers
+        -w      workers per node, one per processor unless told; for
+                split, only this many
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgpoolbench.c ../csgWorkPool.c \
+           ../csgHist.c ../csgAes.c ../csgXts.c ../csgCtr.c \
+           ../csgProvider.c ../csgCpu.c ../csgTransform.c \
+           -lpthread -o csgpoolbench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgWorkPool.h"
+#include "csgProvider.h"
+#include "csgHist.h"
+#include "csgXts.h"
+
+#define BENCH_MAX_PRODUCERS     256
+#define BENCH_MAX_OUTSTANDING   64
+#define BENCH_SECTOR_SIZE       512
+
+//
+//  How csgRead.c splits a read: chunks of at least this many bytes, up
+//  to this many for each thread that can take one.
+//
+
+#define BENCH_MIN_CHUNK         (256 * 1024)
+#define BENCH_CHUNKS_PER_THREAD 4
+
+typedef struct _BENCH_POINT {
+
+    //
+    //  NULL for the inline rows.
+    //
+
+    PCSG_WORKPOOL Pool;
+
+    ULONG Size;
+
+    PCSG_HIST Latency;
+
+    pthread_barrier_t Start;
+
+    volatile BOOLEAN Stop;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+//
+//  A write in flight.  It is cache aligned so the worker finishing one
+//  does not disturb the producer polling the next.
+//
+
+typedef struct CSG_ALIGN(64) _BENCH_WRITE {
+
+    CSG_WORK_ITEM WorkItem;
+
+    PBENCH_POINT Point;
+
+    PUCHAR Source;
+
+    PUCHAR Target;
+
+    ULONGLONG DataUnit;
+
+    ULONGLONG Issued;
+
+    volatile LONG Done;
+
+} BENCH_WRITE, *PBENCH_WRITE;
+
+typedef struct _BENCH_PRODUCER {
+
+    pthread_t Thread;
+
+    PBENCH_POINT Point;
+
+    ULONG Outstanding;
+
+    BENCH_WRITE Writes[BENCH_MAX_OUTSTANDING];
+
+    ULONGLONG Bytes;
+
+    ULONGLONG Refused;
+
+} BENCH_PRODUCER, *PBENCH_PRODUCER;
+
+//
+//  A read deciphered in chunks.  Released is set once the pool has let
+//  go of the job, when the producer may issue the next read with it.
+//
+
+typedef struct _BENCH_READ {
+
+    CSG_WORK_JOB Job;
+
+    PBENCH_POINT Point;
+
+    PUCHAR Source;
+
+    PUCHAR Target;
+
+    ULONG ChunkLength;
+
+    ULONGLONG DataUnit;
+
+    ULONGLONG Issued;
+
+    volatile LONG ProducerChunks;
+
+    volatile LONG Done;
+
+    volatile LONG Released;
+
+} BENCH_READ, *PBENCH_READ;
+
+static PCCSG_TRANSFORM Transform;
+static CSG_XTS_KEY Key;
+static ULONGLONG Frequency;
+
+static __thread BOOLEAN IsProducer;
+
+
+static VOID
+Encipher (
+    __in PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Enciphers a write and marks it done, on a worker or on its producer.
+
+--*/
+{
+    PBENCH_WRITE write = Context;
+    PBENCH_POINT point = write->Point;
+
+    Transform->Encrypt( &Key,
+                        write->DataUnit,
+                        BENCH_SECTOR_SIZE,
+                        write->Source,
+                        write->Target,
+                        point->Size );
+
+    csgHistRecord( point->Latency,
+                   csgTimestampToNanoseconds( csgReadTimestamp() - write->Issued, Frequency ) );
+
+    __atomic_store_n( &write->Done, 1, __ATOMIC_RELEASE );
+}
+
+
+static VOID
+WaitForWrite (
+    __in PBENCH_WRITE Write
+    )
+{
+    ULONG spins = 0;
+
+    while (__atomic_load_n( &Write->Done, __ATOMIC_ACQUIRE ) == 0) {
+
+        if (++spins < 1024) {
+
+            continue;
+        }
+
+        sched_yield();
+    }
+}
+
+
+static PVOID
+ProducerThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_PRODUCER producer = Parameter;
+    PBENCH_POINT point = producer->Point;
+    PBENCH_WRITE write;
+    ULONGLONG bytes = 0;
+    ULONGLONG refused = 0;
+    ULONG next = 0;
+    ULONG i;
+
+    for (i = 0; i < producer->Outstanding; i++) {
+
+        producer->Writes[i].Done = 1;
+    }
+
+    pthread_barrier_wait( &point->Start );
+
+    while (!point->Stop) {
+
+        write = &producer->Writes[next];
+        next = (next + 1) % producer->Outstanding;
+
+        WaitForWrite( write );
+
+        write->Done = 0;
+        write->DataUnit += point->Size / BENCH_SECTOR_SIZE;
+        write->Issued = csgReadTimestamp();
+
+        bytes += point->Size;
+
+        if (point->Pool != NULL) {
+
+            csgWorkItemInitialize( &write->WorkItem, Encipher, write );
+
+            if (csgWorkPoolSubmit( point->Pool, &write->WorkItem )) {
+
+                continue;
+            }
+
+            refused++;
+        }
+
+        Encipher( write );
+    }
+
+    for (i = 0; i < producer->Outstanding; i++) {
+
+        WaitForWrite( &producer->Writes[i] );
+    }
+
+    producer->Bytes = bytes;
+    producer->Refused = refused;
+
+    return NULL;
+}
+
+
+static VOID
+DecipherChunk (
+    __in PVOID Context,
+    __in ULONG Chunk
+    )
+{
+    PBENCH_READ read = Context;
+    ULONG offset = Chunk * read->ChunkLength;
+    ULONG length = read->Point->Size - offset;
+
+    if (length > read->ChunkLength) {
+
+        length = read->ChunkLength;
+    }
+
+    Transform->Decrypt( &Key,
+                        read->DataUnit + offset / BENCH_SECTOR_SIZE,
+                        BENCH_SECTOR_SIZE,
+                        read->Source + offset,
+                        read->Target + offset,
+                        length );
+
+    if (IsProducer) {
+
+        read->ProducerChunks++;
+    }
+}
+
+
+static VOID
+CompleteRead (
+    __in PVOID Context
+    )
+{
+    PBENCH_READ read = Context;
+
+    csgHistRecord( read->Point->Latency,
+                   csgTimestampToNanoseconds( csgReadTimestamp() - read->Issued, Frequency ) );
+
+    __atomic_store_n( &read->Done, 1, __ATOMIC_RELEASE );
+}
+
+
+static VOID
+ReleaseRead (
+    __in PVOID Context
+    )
+{
+    PBENCH_READ read = Context;
+
+    __atomic_store_n( &read->Released, 1, __ATOMIC_RELEASE );
+}
+
+
+static VOID
+WaitForFlag (
+    __in volatile LONG *Flag
+    )
+{
+    ULONG spins = 0;
+
+    while (__atomic_load_n( Flag, __ATOMIC_ACQUIRE ) == 0) {
+
+        if (++spins < 1024) {
+
+            continue;
+        }
+
+        sched_yield();
+    }
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+RunPoint (
+    __in BOOLEAN UsePool,
+    __in ULONG Size,
+    __in ULONG ProducerCount,
+    __in ULONG Outstanding,
+    __in ULONG Workers,
+    __in ULONG QueueDepth,
+    __in ULONG Milliseconds,
+    __in PBENCH_PRODUCER Producers
+    )
+/*++
+
+Routine Description:
+
+    Runs one point and prints its line.
+
+--*/
+{
+    BENCH_POINT point;
+    CSG_WORKPOOL_STATS stats;
+    CSG_HIST_SNAPSHOT latency;
+    struct timespec interval;
+    ULONGLONG bytes = 0;
+    ULONGLONG refused = 0;
+    ULONGLONG writes;
+    double start;
+    double seconds;
+    ULONG i, j;
+
+    memset( &point, 0, sizeof(point) );
+    memset( &stats, 0, sizeof(stats) );
+
+    point.Size = Size;
+
+    if (!NT_SUCCESS( csgHistCreate( &point.Latency ) )) {
+
+        fprintf( stderr, "csgpoolbench: cannot create a histogram\n" );
+        exit( 1 );
+    }
+
+    if (UsePool &&
+        !NT_SUCCESS( csgWorkPoolCreate( Workers, QueueDepth, &point.Pool ) )) {
+
+        fprintf( stderr, "csgpoolbench: cannot create a pool of %u workers a node\n", Workers );
+        exit( 1 );
+    }
+
+    pthread_barrier_init( &point.Start, NULL, ProducerCount + 1 );
+
+    for (i = 0; i < ProducerCount; i++) {
+
+        Producers[i].Point = &point;
+        Producers[i].Outstanding = Outstanding;
+        Producers[i].Bytes = 0;
+        Producers[i].Refused = 0;
+
+        for (j = 0; j < Outstanding; j++) {
+
+            Producers[i].Writes[j].Point = &point;
+            Producers[i].Writes[j].DataUnit = (ULONGLONG)(i * Outstanding + j) << 32;
+        }
+
+        pthread_create( &Producers[i].Thread, NULL, ProducerThread, &Producers[i] );
+    }
+
+    pthread_barrier_wait( &point.Start );
+
+    start = Now();
+
+    interval.tv_sec = Milliseconds / 1000;
+    interval.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    nanosleep( &interval, NULL );
+
+    point.Stop = TRUE;
+
+    for (i = 0; i < ProducerCount; i++) {
+
+        pthread_join( Producers[i].Thread, NULL );
+
+        bytes += Producers[i].Bytes;
+        refused += Producers[i].Refused;
+    }
+
+    seconds = Now() - start;
+
+    pthread_barrier_destroy( &point.Start );
+
+    if (point.Pool != NULL) {
+
+        csgWorkPoolQueryStats( point.Pool, &stats );
+        csgWorkPoolDestroy( point.Pool );
+    }
+
+    csgHistSnapshot( point.Latency, &latency );
+    csgHistDestroy( point.Latency );
+
+    writes = bytes / Size;
+
+    printf( "%s,%u,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+            UsePool ? "pool" : "inline",
+            Size,
+            ProducerCount,
+            stats.Workers,
+            bytes / seconds / 1e6,
+            csgHistPercentile( &latency, 500000 ) / 1e3,
+            csgHistPercentile( &latency, 990000 ) / 1e3,
+            csgHistPercentile( &latency, 999000 ) / 1e3,
+            (writes != 0) ? 100.0 * refused / writes : 0.0,
+            (writes != 0) ? (double)stats.Wakeups / writes : 0.0 );
+
+    fflush( stdout );
+}
+
+
+static VOID
+RunSplitPoint (
+    __in ULONG Size,
+    __in ULONG Workers,
+    __in ULONG QueueDepth,
+    __in ULONG Milliseconds,
+    __in PUCHAR Source,
+    __in PUCHAR Target
+    )
+/*++
+
+Routine Description:
+
+    Runs one split point, its reads issued from this thread, and prints
+    its line.
+
+--*/
+{
+    BENCH_POINT point;
+    BENCH_READ read;
+    CSG_WORKPOOL_STATS stats;
+    CSG_HIST_SNAPSHOT latency;
+    ULONGLONG bytes = 0;
+    ULONGLONG reads = 0;
+    ULONGLONG chunks = 0;
+    ULONGLONG producerChunks = 0;
+    ULONG threads;
+    ULONG chunkCount;
+    ULONG chunkLength;
+    double start;
+    double seconds;
+
+    memset( &point, 0, sizeof(point) );
+    memset( &read, 0, sizeof(read) );
+
+    point.Size = Size;
+
+    if (!NT_SUCCESS( csgHistCreate( &point.Latency ) ) ||
+        !NT_SUCCESS( csgWorkPoolCreate( Workers, QueueDepth, &point.Pool ) )) {
+
+        fprintf( stderr, "csgpoolbench: cannot create a pool of %u workers a node\n", Workers );
+        exit( 1 );
+    }
+
+    threads = csgWorkPoolConcurrency( point.Pool );
+    chunkCount = Size / BENCH_MIN_CHUNK;
+
+    if (chunkCount > threads * BENCH_CHUNKS_PER_THREAD) {
+
+        chunkCount = threads * BENCH_CHUNKS_PER_THREAD;
+    }
+
+    if (chunkCount == 0) {
+
+        chunkCount = 1;
+    }
+
+    chunkLength = (Size + chunkCount - 1) / chunkCount;
+    chunkLength = (chunkLength + BENCH_SECTOR_SIZE - 1) & ~(BENCH_SECTOR_SIZE - 1);
+    chunkCount = (Size + chunkLength - 1) / chunkLength;
+
+    read.Point = &point;
+    read.Source = Source;
+    read.Target = Target;
+    read.ChunkLength = chunkLength;
+
+    IsProducer = TRUE;
+
+    start = Now();
+
+    do {
+
+        read.DataUnit += Size / BENCH_SECTOR_SIZE;
+        read.Done = 0;
+        read.Released = 0;
+        read.ProducerChunks = 0;
+
+        read.Job.ChunkRoutine = DecipherChunk;
+        read.Job.CompleteRoutine = CompleteRead;
+        read.Job.ReleaseRoutine = ReleaseRead;
+        read.Job.Context = &read;
+        read.Job.ChunkCount = chunkCount;
+
+        read.Issued = csgReadTimestamp();
+
+        if (csgWorkPoolRunJob( point.Pool, &read.Job )) {
+
+            CompleteRead( &read );
+        }
+
+        producerChunks += read.ProducerChunks;
+
+        csgWorkJobRelease( &read.Job );
+
+        WaitForFlag( &read.Done );
+        WaitForFlag( &read.Released );
+
+        bytes += Size;
+        chunks += chunkCount;
+        reads++;
+
+        seconds = Now() - start;
+
+    } while (seconds * 1000 < Milliseconds);
+
+    IsProducer = FALSE;
+
+    csgWorkPoolQueryStats( point.Pool, &stats );
+    csgWorkPoolDestroy( point.Pool );
+
+    csgHistSnapshot( point.Latency, &latency );
+    csgHistDestroy( point.Latency );
+
+    printf( "split,%u,1,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+            Size,
+            stats.Workers,
+            bytes / seconds / 1e6,
+            csgHistPercentile( &latency, 500000 ) / 1e3,
+            csgHistPercentile( &latency, 990000 ) / 1e3,
+            csgHistPercentile( &latency, 999000 ) / 1e3,
+            (chunks != 0) ? 100.0 * producerChunks / chunks : 0.0,
+            (reads != 0) ? (double)stats.Wakeups / reads : 0.0 );
+
+    fflush( stdout );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgpoolbench [-d outstanding] [-m milliseconds] [-q depth]\n"
+             "                    [-t producers] [-w workers]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    static CONST ULONG sizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024 };
+    static CONST ULONG splitSizes[] = { 1024 * 1024, 4096 * 1024, 8192 * 1024 };
+    UCHAR keyBytes[CSG_XTS_KEY_SIZE];
+    ULONG cpuCount = csgCpuCount();
+    ULONG outstanding = 4;
+    ULONG milliseconds = 200;
+    ULONG queueDepth = 256;
+    ULONG onlyProducers = 0;
+    ULONG workers = 64;
+    BOOLEAN workersSet = FALSE;
+    PUCHAR splitBuffers;
+    ULONG splitWorkers;
+    PBENCH_PRODUCER producers;
+    PUCHAR buffers;
+    SIZE_T span;
+    ULONG maxProducers;
+    ULONG producerCount;
+    ULONG s, i, j;
+    int option;
+
+    while ((option = getopt( argc, argv, "d:m:q:t:w:" )) != -1) {
+
+        switch (option) {
+
+            case 'd':   outstanding = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'q':   queueDepth = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   onlyProducers = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'w':   workers = (ULONG)strtoul( optarg, NULL, 0 ); workersSet = TRUE; break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || outstanding == 0 || outstanding > BENCH_MAX_OUTSTANDING ||
+        milliseconds == 0 || queueDepth == 0 || queueDepth > 0x10000 ||
+        onlyProducers > BENCH_MAX_PRODUCERS || workers == 0 || workers > 64) {
+
+        Usage();
+        return 2;
+    }
+
+    Frequency = csgTimestampFrequency();
+    Transform = csgProviderSelect( CSG_CIPHER_XTS, csgCpuQueryFeatures() );
+
+    for (i = 0; i < sizeof(keyBytes); i++) {
+
+        keyBytes[i] = (UCHAR)(i * 31 + 7);
+    }
+
+    csgXtsSetKey( &Key, keyBytes );
+
+    producers = aligned_alloc( 64, BENCH_MAX_PRODUCERS * sizeof(BENCH_PRODUCER) );
+
+    //
+    //  Every write of every producer has buffers of its own, as writes to
+    //  different files would.
+    //
+
+    maxProducers = (onlyProducers != 0) ? onlyProducers : (2 * cpuCount < BENCH_MAX_PRODUCERS ? 2 * cpuCount : BENCH_MAX_PRODUCERS);
+    span = (SIZE_T)sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    buffers = aligned_alloc( 4096, 2 * span * outstanding * maxProducers );
+    splitBuffers = aligned_alloc( 4096, 2 * (SIZE_T)splitSizes[sizeof(splitSizes) / sizeof(splitSizes[0]) - 1] );
+
+    if (producers == NULL || buffers == NULL || splitBuffers == NULL) {
+
+        return 1;
+    }
+
+    for (i = 0; i < maxProducers; i++) {
+
+        for (j = 0; j < outstanding; j++) {
+
+            producers[i].Writes[j].Source = buffers + 2 * span * (i * outstanding + j);
+            producers[i].Writes[j].Target = producers[i].Writes[j].Source + span;
+
+            memset( producers[i].Writes[j].Source, (int)(i + j), span );
+        }
+    }
+
+    fprintf( stderr, "csgpoolbench: %u processors, provider %s\n",
+             cpuCount, Transform->Name );
+
+    printf( "mode,size,producers,workers,mbps,p50_us,p99_us,p999_us,inline_pct,wakeups\n" );
+
+    for (producerCount = 1; producerCount <= 2 * cpuCount && producerCount <= BENCH_MAX_PRODUCERS; producerCount *= 2) {
+
+        if (onlyProducers != 0) {
+
+            producerCount = onlyProducers;
+        }
+
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+            RunPoint( FALSE, sizes[s], producerCount, outstanding, workers,
+                      queueDepth, milliseconds, producers );
+
+            RunPoint( TRUE, sizes[s], producerCount, outstanding, workers,
+                      queueDepth, milliseconds, producers );
+        }
+
+        if (onlyProducers != 0) {
+
+            break;
+        }
+    }
+
+    memset( splitBuffers, 0x5a, 2 * (SIZE_T)splitSizes[sizeof(splitSizes) / sizeof(splitSizes[0]) - 1] );
+
+    for (splitWorkers = 1; splitWorkers <= cpuCount && splitWorkers <= 64; splitWorkers *= 2) {
+
+        if (workersSet) {
+
+            splitWorkers = workers;
+        }
+
+        for (s = 0; s < sizeof(splitSizes) / sizeof(splitSizes[0]); s++) {
+
+            RunSplitPoint( splitSizes[s], splitWorkers, queueDepth, milliseconds,
+                           splitBuffers,
+                           splitBuffers + splitSizes[sizeof(splitSizes) / sizeof(splitSizes[0]) - 1] );
+        }
+
+        if (workersSet) {
+
+            break;
+        }
+    }
+
+    free( splitBuffers );
+    free( buffers );
+    free( producers );
+
+    return 0;
+}
@@ -0,0 +1,367 @@
+/*++
+
+Module Name:
+
+    csgtracebench.c
+
+Abstract:
+
+    Measures what an I/O path event costs written to the binary trace
+    rings (csgTrace.h), against formatting the same message, which is what
+    LOG_PRINT did for every event before handing it to DbgPrint.
+
+        csgtracebench [-m milliseconds] [-r records] [-t threads]
+
+        trace       csgTraceWrite of a READ_SWAP event with six arguments
+        format      the READ_SWAP format and arguments through snprintf
+                    into a buffer of the thread's own; DbgPrint and the
+                    debugger transport behind it would come on top
+
+    Each point runs on 1, 2, 4, ... threads up to one per processor (or
+    only the -t count), each pinned to a processor of its own, so that
+    each writes its own ring as the driver's callbacks would.
+
+    One line of comma separated values per point goes to standard output,
+    after a header line:
+
+        mode        trace or format
+        threads     threads writing at once
+        mevents     10^6 events per second, over all threads
+        ns_per_event
+                    nanoseconds per event, per thread
+
+        -m      time per point, 200 ms unless told
+        -r      records each ring holds, 1024, the driver's default,
+                unless told
+        -t      only this many threads
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgtracebench.c ../csgTrace.c \
+           ../csgCpu.c -lpthread -o csgtracebench
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgTrace.h"
+
+#define BENCH_MAX_THREADS       1024
+
+#define BENCH_TRACE             0
+#define BENCH_FORMAT            1
+#define BENCH_MODES             2
+
+static CONST CHAR *ModeNames[BENCH_MODES] = {
+
+    "trace", "format"
+};
+
+//
+//  The formats from csgTraceEvents.h, which the decoder applies and
+//  LOG_PRINT used to.
+//
+
+static CONST CHAR *Formats[CSG_TRACE_EVENT_COUNT] = {
+
+    "",
+
+#define CSG_TRACE_EVENT( _name, _level, _flag, _format )    _format,
+#include "csgTraceEvents.h"
+#undef CSG_TRACE_EVENT
+};
+
+typedef struct _BENCH_POINT {
+
+    ULONG Mode;
+
+    PCSG_TRACE Trace;
+
+    pthread_barrier_t Start;
+
+    volatile BOOLEAN Stop;
+
+} BENCH_POINT, *PBENCH_POINT;
+
+typedef struct CSG_ALIGN(64) _BENCH_THREAD {
+
+    pthread_t Thread;
+
+    PBENCH_POINT Point;
+
+    ULONG Cpu;
+
+    ULONGLONG Events;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+static PVOID
+BenchThread (
+    __in PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+    PBENCH_POINT point = thread->Point;
+    CHAR message[256];
+    ULONGLONG events = 0;
+    ULONGLONG length = 0;
+    ULONG i;
+
+    pthread_barrier_wait( &point->Start );
+
+    while (!point->Stop) {
+
+        for (i = 0; i < 256; i++) {
+
+            //
+            //  Arguments that change from event to event, as buffer
+            //  addresses and lengths do.
+            //
+
+            if (point->Mode == BENCH_TRACE) {
+
+                csgTraceWrite( point->Trace,
+                               CSG_TRACE_READ_SWAP,
+                               (ULONGLONG)(ULONG_PTR)point,
+                               (ULONGLONG)(ULONG_PTR)message + events,
+                               (ULONGLONG)(ULONG_PTR)thread + events,
+                               (ULONGLONG)(ULONG_PTR)message - events,
+                               (ULONGLONG)(ULONG_PTR)thread - events,
+                               4096 + (events & 0xfff) );
+
+            } else {
+
+                length += snprintf( message,
+                                    sizeof(message),
+                                    Formats[CSG_TRACE_READ_SWAP],
+                                    (unsigned long long)(ULONG_PTR)point,
+                                    (unsigned long long)(ULONG_PTR)message + events,
+                                    (unsigned long long)(ULONG_PTR)thread + events,
+                                    (unsigned long long)(ULONG_PTR)message - events,
+                                    (unsigned long long)(ULONG_PTR)thread - events,
+                                    (unsigned long long)(4096 + (events & 0xfff)) );
+            }
+
+            events++;
+        }
+    }
+
+    //
+    //  Keeps the formatting from being optimized away.
+    //
+
+    if (length == 1) {
+
+        fprintf( stderr, "%s\n", message );
+    }
+
+    thread->Events = events;
+
+    return NULL;
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+RunPoint (
+    __in ULONG Mode,
+    __in ULONG ThreadCount,
+    __in ULONG RingRecords,
+    __in ULONG Milliseconds,
+    __in PBENCH_THREAD Threads
+    )
+/*++
+
+Routine Description:
+
+    Runs one point and prints its line.
+
+--*/
+{
+    BENCH_POINT point;
+    struct timespec interval;
+    cpu_set_t set;
+    ULONGLONG events = 0;
+    double start;
+    double seconds;
+    ULONG i;
+    NTSTATUS status;
+
+    memset( &point, 0, sizeof(point) );
+
+    point.Mode = Mode;
+
+    status = csgTraceCreate( RingRecords, &point.Trace );
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgtracebench: cannot create a trace: %08x\n", (unsigned)status );
+        exit( 1 );
+    }
+
+    pthread_barrier_init( &point.Start, NULL, ThreadCount + 1 );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Point = &point;
+        Threads[i].Cpu = i;
+        Threads[i].Events = 0;
+
+        pthread_create( &Threads[i].Thread, NULL, BenchThread, &Threads[i] );
+
+        CPU_ZERO( &set );
+        CPU_SET( i, &set );
+
+        pthread_setaffinity_np( Threads[i].Thread, sizeof(set), &set );
+    }
+
+    pthread_barrier_wait( &point.Start );
+
+    start = Now();
+
+    interval.tv_sec = Milliseconds / 1000;
+    interval.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    nanosleep( &interval, NULL );
+
+    point.Stop = TRUE;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        events += Threads[i].Events;
+    }
+
+    seconds = Now() - start;
+
+    pthread_barrier_destroy( &point.Start );
+
+    csgTraceDestroy( point.Trace );
+
+    printf( "%s,%u,%.2f,%.1f\n",
+            ModeNames[Mode],
+            ThreadCount,
+            events / seconds / 1e6,
+            (events != 0) ? seconds * 1e9 * ThreadCount / events : 0.0 );
+
+    fflush( stdout );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgtracebench [-m milliseconds] [-r records] [-t threads]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    ULONG cpuCount = csgCpuCount();
+    ULONG milliseconds = 200;
+    ULONG ringRecords = 1024;
+    ULONG onlyThreads = 0;
+    PBENCH_THREAD threads;
+    ULONG threadCount;
+    ULONG mode;
+    int option;
+
+    while ((option = getopt( argc, argv, "m:r:t:" )) != -1) {
+
+        switch (option) {
+
+            case 'm':   milliseconds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'r':   ringRecords = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   onlyThreads = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (cpuCount > BENCH_MAX_THREADS) {
+
+        cpuCount = BENCH_MAX_THREADS;
+    }
+
+    if (optind != argc || milliseconds == 0 ||
+        ringRecords == 0 || ringRecords > 0x10000 || onlyThreads > cpuCount) {
+
+        Usage();
+        return 2;
+    }
+
+    threads = aligned_alloc( 64, cpuCount * sizeof(BENCH_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    fprintf( stderr, "csgtracebench: %u processors, %u byte records\n",
+             cpuCount, (ULONG)sizeof(CSG_TRACE_RECORD) );
+
+    printf( "mode,threads,mevents,ns_per_event\n" );
+
+    for (threadCount = 1; ; threadCount *= 2) {
+
+        if (threadCount > cpuCount) {
+
+            threadCount = cpuCount;
+        }
+
+        if (onlyThreads != 0) {
+
+            threadCount = onlyThreads;
+        }
+
+        for (mode = 0; mode < BENCH_MODES; mode++) {
+
+            RunPoint( mode, threadCount, ringRecords, milliseconds, threads );
+        }
+
+        if (onlyThreads != 0 || threadCount == cpuCount) {
+
+            break;
+        }
+    }
+
+    free( threads );
+
+    return 0;
+}
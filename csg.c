@@ -16,6 +16,14 @@ Abstract:
     IRP_MJ_WRITE
     IRP_MJ_DIRECTORY_CONTROL
 
+    and keeps the header of a protected file out of the sizes queried and
+    set through IRP_MJ_QUERY_INFORMATION and IRP_MJ_SET_INFORMATION.
+
+    When a volume key is configured, the data of noncached reads and writes
+    is enciphered on its way through the swapped buffer: with AES-XTS, one
+    sector per data unit, or with AES-CTR when the cipher policy asks for
+    it.
+
     By default this filter attaches to all volumes it is notified about.  It
     does support having multiple instances on a given volume.
 
@@ -26,7 +34,11 @@ Environment:
 --*/
 
 #include "csgGlobal.h"
+#include "csgComm.h"
+#include "csgConfig.h"
+#include "csgCreate.h"
 #include "csgDirCtrl.h"
+#include "csgFileInfo.h"
 #include "csgRead.h"
 #include "csgWrite.h"
 
@@ -39,10 +51,84 @@ ULONG LoggingFlags = 0;             // all disabled by default
 #define MIN_SECTOR_SIZE 0x200
 
 //
-//  This is a lookAside list used to allocate our pre-2-post structure.
+//  These are the lookAside lists used to allocate our pre-2-post
+//  structure, one per processor (see csgStruct.h).
+//
+
+PNPAGED_LOOKASIDE_LIST Pre2PostContextLists;
+ULONG Pre2PostContextListCount;
+
+//
+//  Cache of the nonpaged buffers we swap in, each with its MDL already
+//  built (see csgSwapDesc.h).  The configuration's SwapCacheBytes bounds
+//  what each size class keeps, in the per-CPU magazines and the depot
+//  together.  A thread ages the cache every SWAP_CACHE_AGE_INTERVAL, and
+//  trims it instead while the memory manager signals that nonpaged pool
+//  is short.
+//
+
+#define SWAP_CACHE_AGE_INTERVAL (-10 * 1000 * 1000)     // 1s, relative
+
+PCSG_BUFCACHE SwapBufferCache;
+
+KEVENT SwapCacheAgerStop;
+PETHREAD SwapCacheAger;
+
+PKEVENT LowNonPagedPoolEvent;
+HANDLE LowNonPagedPoolHandle;
+
+//
+//  Binary trace of the I/O paths (see csgTrace.h), TRACE_RECORDS_PER_CPU
+//  records per processor unless the TraceRecordsPerCpu parameter says
+//  otherwise.
+//
+
+#define TRACE_RECORDS_PER_CPU   1024
+
+PCSG_TRACE TraceRing;
+
+//
+//  Expanded keys of files with derived keys, see csgStream.c.
+//  KEY_CACHE_ENTRIES of them unless the KeyCacheEntries parameter says
+//  otherwise.
+//
+
+#define KEY_CACHE_ENTRIES       512
+
+PCSG_KEYCACHE FileKeyCache;
+
+//
+//  Protected files remembered on each volume for directory listings, see
+//  csgDirCtrl.c.  PROTECTED_ID_ENTRIES of them, at about 128 bytes each,
+//  unless the ProtectedIdEntries parameter says otherwise.
+//
+
+#define PROTECTED_ID_ENTRIES    4096
+
+//
+//  Workers for enciphering large writes, see csgWrite.c.  A worker for
+//  each processor of a node, up to CRYPTO_WORKERS_PER_NODE, each node's
+//  queue holding CRYPTO_QUEUE_DEPTH writes, unless the CryptoWorkers and
+//  CryptoQueueDepth parameters say otherwise.
+//
+
+#define CRYPTO_WORKERS_PER_NODE 64
+#define CRYPTO_QUEUE_DEPTH      256
+
+PCSG_WORKPOOL CryptoWorkPool;
+
+//
+//  Cost of the read and write path stages, see csgStruct.h.
 //
 
-NPAGED_LOOKASIDE_LIST Pre2PostContextList;
+PCSG_HIST StageCost[CSG_STAGE_COUNT];
+
+//
+//  Counters of the statistics section, see csgStruct.h and csgComm.c.
+//
+
+PCSG_STATS_CPU StatsCpu;
+ULONG StatsCpuCount;
 
 CSG_GLOBAL_DATA g_Global;
 
@@ -64,12 +150,50 @@ CleanupVolumeContext(
     __in FLT_CONTEXT_TYPE ContextType
     );
 
+VOID
+CleanupStreamContext(
+    __in PFLT_CONTEXT Context,
+    __in FLT_CONTEXT_TYPE ContextType
+    );
+
 NTSTATUS
 InstanceQueryTeardown (
     __in PCFLT_RELATED_OBJECTS FltObjects,
     __in FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
     );
 
+VOID
+LogVolumeLatency (
+    __in PVOLUME_CONTEXT VolCtx,
+    __in ULONG Operation
+    );
+
+NTSTATUS
+CreateStageCost (
+    VOID
+    );
+
+VOID
+DeleteStageCost (
+    VOID
+    );
+
+NTSTATUS
+StartSwapCacheAger (
+    VOID
+    );
+
+VOID
+StopSwapCacheAger (
+    VOID
+    );
+
+KSTART_ROUTINE SwapCacheAgerThread;
+VOID
+SwapCacheAgerThread (
+    __in PVOID Context
+    );
+
 DRIVER_INITIALIZE DriverEntry;
 NTSTATUS
 DriverEntry (
@@ -87,6 +211,23 @@ ReadDriverParameters (
     __in PUNICODE_STRING RegistryPath
     );
 
+NTSTATUS
+CreatePre2PostContextLists (
+    VOID
+    );
+
+VOID
+DeletePre2PostContextLists (
+    VOID
+    );
+
+PVOID
+Pre2PostContextAllocate (
+    __in POOL_TYPE PoolType,
+    __in SIZE_T NumberOfBytes,
+    __in ULONG Tag
+    );
+
 //
 //  Assign text sections for each routine.
 //
@@ -95,8 +236,16 @@ ReadDriverParameters (
 #pragma alloc_text(PAGE, InstanceSetup)
 #pragma alloc_text(PAGE, CleanupVolumeContext)
 #pragma alloc_text(PAGE, InstanceQueryTeardown)
+#pragma alloc_text(PAGE, LogVolumeLatency)
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(INIT, ReadDriverParameters)
+#pragma alloc_text(INIT, CreatePre2PostContextLists)
+#pragma alloc_text(INIT, CreateStageCost)
+#pragma alloc_text(PAGE, DeleteStageCost)
+#pragma alloc_text(INIT, StartSwapCacheAger)
+#pragma alloc_text(PAGE, StopSwapCacheAger)
+#pragma alloc_text(PAGE, SwapCacheAgerThread)
+#pragma alloc_text(PAGE, DeletePre2PostContextLists)
 #pragma alloc_text(PAGE, FilterUnload)
 #endif
 
@@ -105,6 +254,11 @@ ReadDriverParameters (
 //
 
 CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
+    { IRP_MJ_CREATE,
+      0,
+      NULL,
+      csgPostCreate },
+
     { IRP_MJ_READ,
       0,
       csgPreReadBuffers,
@@ -120,6 +274,21 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
       csgPreDirCtrlBuffers,
       csgPostDirCtrlBuffers },
 
+    { IRP_MJ_QUERY_INFORMATION,
+      0,
+      csgPreQueryInformation,
+      csgPostQueryInformation },
+
+    { IRP_MJ_SET_INFORMATION,
+      0,
+      csgPreSetInformation,
+      NULL },
+
+    { IRP_MJ_NETWORK_QUERY_OPEN,
+      0,
+      csgPreNetworkQueryOpen,
+      NULL },
+
     { IRP_MJ_OPERATION_END }
 };
 
@@ -137,6 +306,12 @@ CONST FLT_CONTEXT_REGISTRATION ContextNotifications[] = {
        sizeof(VOLUME_CONTEXT),
        CONTEXT_TAG },
 
+     { FLT_STREAM_CONTEXT,
+       0,
+       CleanupStreamContext,
+       sizeof(STREAM_CONTEXT),
+       CONTEXT_TAG },
+
      { FLT_CONTEXT_END }
 };
 
@@ -218,12 +393,14 @@ Return Value:
     USHORT size;
     UCHAR volPropBuffer[sizeof(FLT_VOLUME_PROPERTIES)+512];
     PFLT_VOLUME_PROPERTIES volProp = (PFLT_VOLUME_PROPERTIES)volPropBuffer;
+    ULONG op;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
 
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER( Flags );
     UNREFERENCED_PARAMETER( VolumeDeviceType );
-    UNREFERENCED_PARAMETER( VolumeFilesystemType );
 
     try {
 
@@ -246,6 +423,27 @@ Return Value:
             leave;
         }
 
+        //
+        //  Init the fields the cleanup routine looks at, then get the
+        //  latency histograms.
+        //
+
+        ctx->Name.Buffer = NULL;
+        ctx->FileSystemType = VolumeFilesystemType;
+        ctx->ProtectedIds = NULL;
+        ctx->ProtectedIdsUsed = FALSE;
+        RtlZeroMemory( ctx->Latency, sizeof(ctx->Latency) );
+
+        for (op = 0; op < CSG_LATENCY_OPERATIONS; op++) {
+
+            status = csgHistCreate( &ctx->Latency[op] );
+
+            if (!NT_SUCCESS(status)) {
+
+                leave;
+            }
+        }
+
         //
         //  Always get the volume properties, so I can get a sector size
         //
@@ -271,10 +469,23 @@ Return Value:
         ctx->SectorSize = max(volProp->SectorSize,MIN_SECTOR_SIZE);
 
         //
-        //  Init the buffer field (which may be allocated later).
+        //  FAT file ids are reused as soon as a file is deleted, so a
+        //  remembered one could name any file; those volumes go without.
         //
 
-        ctx->Name.Buffer = NULL;
+        if ((g_Global.ProtectedIdEntries != 0) &&
+            (VolumeFilesystemType != FLT_FSTYPE_FAT) &&
+            (VolumeFilesystemType != FLT_FSTYPE_EXFAT)) {
+
+            status = csgKeyCacheCreate( g_Global.ProtectedIdEntries,
+                                        sizeof(ULONG),
+                                        &ctx->ProtectedIds );
+
+            if (!NT_SUCCESS(status)) {
+
+                leave;
+            }
+        }
 
         //
         //  Get the storage device object we want a name for.
@@ -385,6 +596,16 @@ Return Value:
                     ctx->SectorSize,
                     &ctx->Name) );
 
+        config = ConfigReadLock( &configCookie );
+
+        LOG_PRINT( LOGFL_VOLCTX,
+                   ("csg!InstanceSetup:                  Cipher=%s, CpuFeatures=0x%02x, Name=\"%wZ\"\n",
+                    config->CipherEnabled ? config->CipherTransform->Name : "none",
+                    g_Global.CpuFeatures,
+                    &ctx->Name) );
+
+        ConfigReadUnlock( configCookie );
+
         //
         //  It is OK for the context to already be defined.
         //
@@ -433,7 +654,8 @@ CleanupVolumeContext(
 Routine Description:
 
     The given context is being freed.
-    Free the allocated name buffer if there one.
+    Free the allocated name buffer if there one, the protected file ids,
+    and the latency histograms after logging a summary of them.
 
 Arguments:
 
@@ -448,6 +670,7 @@ Return Value:
 --*/
 {
     PVOLUME_CONTEXT ctx = Context;
+    ULONG op;
 
     PAGED_CODE();
 
@@ -455,6 +678,23 @@ Return Value:
 
     ASSERT(ContextType == FLT_VOLUME_CONTEXT);
 
+    for (op = 0; op < CSG_LATENCY_OPERATIONS; op++) {
+
+        if (ctx->Latency[op] != NULL) {
+
+            LogVolumeLatency( ctx, op );
+
+            csgHistDestroy( ctx->Latency[op] );
+            ctx->Latency[op] = NULL;
+        }
+    }
+
+    if (ctx->ProtectedIds != NULL) {
+
+        csgKeyCacheDestroy( ctx->ProtectedIds );
+        ctx->ProtectedIds = NULL;
+    }
+
     if (ctx->Name.Buffer != NULL) {
 
         ExFreePool(ctx->Name.Buffer);
@@ -463,6 +703,43 @@ Return Value:
 }
 
 
+VOID
+CleanupStreamContext(
+    __in PFLT_CONTEXT Context,
+    __in FLT_CONTEXT_TYPE ContextType
+    )
+/*++
+
+Routine Description:
+
+    The given context is being freed.
+    Wipe the file key out of it.  Not pageable; the last reference to a
+    stream context may go at DPC level.
+
+Arguments:
+
+    Context - The context being freed
+
+    ContextType - The type of context this is
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSTREAM_CONTEXT ctx = Context;
+
+    UNREFERENCED_PARAMETER( ContextType );
+
+    ASSERT(ContextType == FLT_STREAM_CONTEXT);
+
+    RtlSecureZeroMemory( &ctx->Key, sizeof(ctx->Key) );
+
+    FltDeletePushLock( &ctx->SizeLock );
+}
+
+
 NTSTATUS
 InstanceQueryTeardown (
     __in PCFLT_RELATED_OBJECTS FltObjects,
@@ -512,13 +789,84 @@ DriverEntry (
 
     ReadDriverParameters( RegistryPath );
 
-    ExInitializeNPagedLookasideList( &Pre2PostContextList,
-                                     NULL,
-                                     NULL,
-                                     0,
-                                     sizeof(PRE_2_POST_CONTEXT),
-                                     PRE_2_POST_TAG,
-                                     0 );
+    g_Global.TimestampFrequency = csgTimestampFrequency();
+
+    status = csgConfigInitialize( RegistryPath );
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = csgCreateStatistics();
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = csgTraceCreate( g_Global.TraceRecordsPerCpu, &TraceRing );
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = CreateStageCost();
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = CreatePre2PostContextLists();
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = csgBufCacheCreate( g_Global.Config->SwapCacheBytes,
+                                csgSwapDescCreate,
+                                csgSwapDescDestroy,
+                                (PVOID)(ULONG_PTR)BUFFER_SWAP_TAG,
+                                &SwapBufferCache );
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    status = StartSwapCacheAger();
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    if (g_Global.KeyCacheEntries != 0) {
+
+        status = csgKeyCacheCreate( g_Global.KeyCacheEntries,
+                                    sizeof(CSG_FILE_KEY),
+                                    &FileKeyCache );
+
+        if (! NT_SUCCESS( status )) {
+
+            goto SwapDriverEntryExit;
+        }
+    }
+
+    if (g_Global.CryptoWorkers != 0) {
+
+        status = csgWorkPoolCreate( g_Global.CryptoWorkers,
+                                    g_Global.CryptoQueueDepth,
+                                    &CryptoWorkPool );
+
+        if (! NT_SUCCESS( status )) {
+
+            goto SwapDriverEntryExit;
+        }
+    }
 
     status = FltRegisterFilter( DriverObject,
                                 &FilterRegistration,
@@ -529,10 +877,19 @@ DriverEntry (
         goto SwapDriverEntryExit;
     }
 
+    status = csgOpenControlPort( gFilterHandle );
+
+    if (! NT_SUCCESS( status )) {
+
+        FltUnregisterFilter( gFilterHandle );
+        goto SwapDriverEntryExit;
+    }
+
     status = FltStartFiltering( gFilterHandle );
 
     if (! NT_SUCCESS( status )) {
 
+        csgCloseControlPort();
         FltUnregisterFilter( gFilterHandle );
         goto SwapDriverEntryExit;
     }
@@ -543,7 +900,35 @@ SwapDriverEntryExit:
 
     if(! NT_SUCCESS( status )) {
 
-        ExDeleteNPagedLookasideList( &Pre2PostContextList );
+        if (CryptoWorkPool != NULL) {
+
+            csgWorkPoolDestroy( CryptoWorkPool );
+        }
+
+        DeletePre2PostContextLists();
+
+        StopSwapCacheAger();
+
+        if (SwapBufferCache != NULL) {
+
+            csgBufCacheDestroy( SwapBufferCache );
+        }
+
+        if (FileKeyCache != NULL) {
+
+            csgKeyCacheDestroy( FileKeyCache );
+        }
+
+        DeleteStageCost();
+
+        if (TraceRing != NULL) {
+
+            csgTraceDestroy( TraceRing );
+        }
+
+        csgDeleteStatistics();
+
+        csgConfigCleanup();
     }
 
     return status;
@@ -559,9 +944,37 @@ FilterUnload (
 
     UNREFERENCED_PARAMETER( Flags );
 
+    csgCloseControlPort();
+
     FltUnregisterFilter( gFilterHandle );
 
-    ExDeleteNPagedLookasideList( &Pre2PostContextList );
+    //
+    //  Unregistering waited for the pended writes, so the workers are idle.
+    //
+
+    if (CryptoWorkPool != NULL) {
+
+        csgWorkPoolDestroy( CryptoWorkPool );
+    }
+
+    DeletePre2PostContextLists();
+
+    StopSwapCacheAger();
+
+    csgBufCacheDestroy( SwapBufferCache );
+
+    if (FileKeyCache != NULL) {
+
+        csgKeyCacheDestroy( FileKeyCache );
+    }
+
+    DeleteStageCost();
+
+    csgTraceDestroy( TraceRing );
+
+    csgDeleteStatistics();
+
+    csgConfigCleanup();
 
     LOG_PRINT(LOGFL_ERRORS, ("DriverEntry unload ok!\n"));
 
@@ -575,13 +988,25 @@ ReadDriverParameters (
       )
 {
     OBJECT_ATTRIBUTES attributes;
-    HANDLE driverRegKey;
+    HANDLE driverRegKey = NULL;
     NTSTATUS status;
     ULONG resultLength;
     UNICODE_STRING valueName;
     UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
 
-    g_Global.DebugFlags = LOGFL_ERRORS | LOGFL_READ | LOGFL_WRITE | LOGFL_DIRCTRL | LOGFL_VOLCTX;    // open all
+    //
+    //  What can change while the driver runs is read by csgConfigRead;
+    //  these are the parameters that only take effect at load.  The debug
+    //  flags here only cover logging until the configuration is published.
+    //
+
+    g_Global.DebugFlags = LOGFL_ERRORS | LOGFL_READ | LOGFL_WRITE | LOGFL_DIRCTRL | LOGFL_VOLCTX | LOGFL_CREATE;    // open all
+    g_Global.CpuFeatures = csgCpuQueryFeatures();
+    g_Global.TraceRecordsPerCpu = TRACE_RECORDS_PER_CPU;
+    g_Global.KeyCacheEntries = KEY_CACHE_ENTRIES;
+    g_Global.ProtectedIdEntries = PROTECTED_ID_ENTRIES;
+    g_Global.CryptoWorkers = CRYPTO_WORKERS_PER_NODE;
+    g_Global.CryptoQueueDepth = CRYPTO_QUEUE_DEPTH;
 
     InitializeObjectAttributes( &attributes,
                 RegistryPath,
@@ -600,7 +1025,7 @@ ReadDriverParameters (
         goto ERROR;
     }
 
-    RtlInitUnicodeString( &valueName, L"DebugFlags" );
+    RtlInitUnicodeString( &valueName, L"StageTiming" );
 
     status = ZwQueryValueKey( driverRegKey,
                 &valueName,
@@ -611,12 +1036,625 @@ ReadDriverParameters (
 
     if (NT_SUCCESS( status )) {
 
-        g_Global.DebugFlags = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+        g_Global.StageTiming = (*((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data)) != 0);
     }
 
-ERROR:
-    if (driverRegKey)
-        ZwClose(driverRegKey);
-    
-    LOG_PRINT(LOGFL_ERRORS, ("Current DebugFlags : 0x%x\n", g_Global.DebugFlags));
+    //
+    //  CpuFeatureMask hides processor features from the provider
+    //  selection, forcing a lower tier.  Used to compare tiers on one
+    //  machine or to step around a misbehaving one.
+    //
+
+    RtlInitUnicodeString( &valueName, L"CpuFeatureMask" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        g_Global.CpuFeatures &= *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+    }
+
+    //
+    //  TraceRecordsPerCpu sizes the trace rings; csgTraceCreate takes up
+    //  to 64K records a ring.
+    //
+
+    RtlInitUnicodeString( &valueName, L"TraceRecordsPerCpu" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG records = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+
+        if (records != 0 && records <= 0x10000) {
+
+            g_Global.TraceRecordsPerCpu = records;
+        }
+    }
+
+    //
+    //  KeyCacheEntries sizes the file key cache, up to 64K keys of about
+    //  3K each; zero turns it off.
+    //
+
+    RtlInitUnicodeString( &valueName, L"KeyCacheEntries" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG entries = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+
+        if (entries <= 0x10000) {
+
+            g_Global.KeyCacheEntries = entries;
+        }
+    }
+
+    //
+    //  ProtectedIdEntries sizes each volume's cache of protected file ids,
+    //  up to 64K; zero leaves protected files listed with their header.
+    //
+
+    RtlInitUnicodeString( &valueName, L"ProtectedIdEntries" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG entries = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+
+        if (entries <= 0x10000) {
+
+            g_Global.ProtectedIdEntries = entries;
+        }
+    }
+
+    //
+    //  CryptoWorkers caps the crypto workers on each node, up to 64; zero
+    //  enciphers every write on its issuer's thread.
+    //
+
+    RtlInitUnicodeString( &valueName, L"CryptoWorkers" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG workers = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+
+        if (workers <= 64) {
+
+            g_Global.CryptoWorkers = workers;
+        }
+    }
+
+    //
+    //  CryptoQueueDepth is how many writes may wait for a node's workers,
+    //  up to 64K; a write that finds the queue full is enciphered inline.
+    //
+
+    RtlInitUnicodeString( &valueName, L"CryptoQueueDepth" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG depth = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+
+        if (depth != 0 && depth <= 0x10000) {
+
+            g_Global.CryptoQueueDepth = depth;
+        }
+    }
+
+ERROR:
+    if (driverRegKey)
+        ZwClose(driverRegKey);
+}
+
+
+NTSTATUS
+CreatePre2PostContextLists (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates a pre2Post context lookaside list for each processor.  The
+    lists sit in one cache aligned array; each list is itself cache line
+    aligned, so no two processors share a list head.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    ULONG count = csgCpuCount();
+    ULONG i;
+
+    Pre2PostContextLists = ExAllocatePoolWithTag( NonPagedPoolCacheAligned,
+                                                  count * sizeof(NPAGED_LOOKASIDE_LIST),
+                                                  PRE_2_POST_TAG );
+
+    if (Pre2PostContextLists == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < count; i++) {
+
+        ExInitializeNPagedLookasideList( &Pre2PostContextLists[i],
+                                         Pre2PostContextAllocate,
+                                         NULL,
+                                         0,
+                                         sizeof(PRE_2_POST_CONTEXT),
+                                         PRE_2_POST_TAG,
+                                         0 );
+    }
+
+    Pre2PostContextListCount = count;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+DeletePre2PostContextLists (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Deletes the lookaside lists made by CreatePre2PostContextLists, if it
+    made any.  Every context must have been freed.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (Pre2PostContextLists == NULL) {
+
+        return;
+    }
+
+    for (i = 0; i < Pre2PostContextListCount; i++) {
+
+        ExDeleteNPagedLookasideList( &Pre2PostContextLists[i] );
+    }
+
+    ExFreePoolWithTag( Pre2PostContextLists, PRE_2_POST_TAG );
+
+    Pre2PostContextLists = NULL;
+    Pre2PostContextListCount = 0;
+}
+
+
+PVOID
+Pre2PostContextAllocate (
+    __in POOL_TYPE PoolType,
+    __in SIZE_T NumberOfBytes,
+    __in ULONG Tag
+    )
+/*++
+
+Routine Description:
+
+    Allocation routine of the pre2Post lookaside lists.  Plain nonpaged
+    pool only promises 16 byte alignment; the contexts want a cache line
+    each.
+
+Arguments:
+
+    PoolType - Ignored; the lists are nonpaged.
+
+    NumberOfBytes - sizeof(PRE_2_POST_CONTEXT).
+
+    Tag - The list's tag.
+
+Return Value:
+
+    The memory, or NULL.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( PoolType );
+
+    return ExAllocatePoolWithTag( NonPagedPoolCacheAligned, NumberOfBytes, Tag );
+}
+
+
+VOID
+LogVolumeLatency (
+    __in PVOLUME_CONTEXT VolCtx,
+    __in ULONG Operation
+    )
+/*++
+
+Routine Description:
+
+    Logs the count, mean and percentiles of one of a volume's latency
+    histograms, in microseconds.
+
+Arguments:
+
+    VolCtx - The volume.
+
+    Operation - Which histogram, a CSG_LATENCY_* value.
+
+Return Value:
+
+    None
+
+--*/
+{
+    static CONST CHAR *operationNames[CSG_LATENCY_OPERATIONS] = { "read", "write", "dirctrl" };
+    PCSG_HIST_SNAPSHOT snapshot;
+    ULONGLONG frequency = g_Global.TimestampFrequency;
+
+    PAGED_CODE();
+
+    if (!FlagOn( g_Global.DebugFlags, LOGFL_VOLCTX )) {
+
+        return;
+    }
+
+    snapshot = ExAllocatePoolWithTag( PagedPool,
+                                      sizeof(CSG_HIST_SNAPSHOT),
+                                      STATS_TAG );
+
+    if (snapshot == NULL) {
+
+        return;
+    }
+
+    csgHistSnapshot( VolCtx->Latency[Operation], snapshot );
+
+    if (snapshot->Count != 0) {
+
+        LOG_PRINT( LOGFL_VOLCTX,
+                   ("csg!LogVolumeLatency:               %wZ %s count=%I64u mean=%I64uus p50=%I64uus p90=%I64uus p99=%I64uus p99.9=%I64uus max=%I64uus\n",
+                    &VolCtx->Name,
+                    operationNames[Operation],
+                    snapshot->Count,
+                    csgTimestampToNanoseconds( snapshot->Sum / snapshot->Count, frequency ) / 1000,
+                    csgTimestampToNanoseconds( csgHistPercentile( snapshot, 500000 ), frequency ) / 1000,
+                    csgTimestampToNanoseconds( csgHistPercentile( snapshot, 900000 ), frequency ) / 1000,
+                    csgTimestampToNanoseconds( csgHistPercentile( snapshot, 990000 ), frequency ) / 1000,
+                    csgTimestampToNanoseconds( csgHistPercentile( snapshot, 999000 ), frequency ) / 1000,
+                    csgTimestampToNanoseconds( csgHistPercentile( snapshot, 1000000 ), frequency ) / 1000) );
+    }
+
+    ExFreePoolWithTag( snapshot, STATS_TAG );
+}
+
+
+NTSTATUS
+CreateStageCost (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates the stage cost histograms.  They exist whether or not stage
+    timing is on, so it can be turned on at any time.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    NTSTATUS status;
+    ULONG stage;
+
+    for (stage = 0; stage < CSG_STAGE_COUNT; stage++) {
+
+        status = csgHistCreate( &StageCost[stage] );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+DeleteStageCost (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Logs a summary of the stage cost histograms that have anything in
+    them, then frees them all.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    static CONST CHAR *stageNames[CSG_STAGE_COUNT] = {
+        "read allocate",
+        "read mdl",
+        "read transform",
+        "read post wait",
+        "write allocate",
+        "write mdl",
+        "write transform"
+    };
+    PCSG_HIST_SNAPSHOT snapshot;
+    ULONGLONG frequency = g_Global.TimestampFrequency;
+    ULONG stage;
+
+    PAGED_CODE();
+
+    snapshot = ExAllocatePoolWithTag( PagedPool,
+                                      sizeof(CSG_HIST_SNAPSHOT),
+                                      STATS_TAG );
+
+    for (stage = 0; stage < CSG_STAGE_COUNT; stage++) {
+
+        if (StageCost[stage] == NULL) {
+
+            continue;
+        }
+
+        if (snapshot != NULL) {
+
+            csgHistSnapshot( StageCost[stage], snapshot );
+
+            if (snapshot->Count != 0) {
+
+                LOG_PRINT( LOGFL_ERRORS,
+                           ("csg!DeleteStageCost:                %s count=%I64u mean=%I64uns p50=%I64uns p99=%I64uns max=%I64uns\n",
+                            stageNames[stage],
+                            snapshot->Count,
+                            csgTimestampToNanoseconds( snapshot->Sum / snapshot->Count, frequency ),
+                            csgTimestampToNanoseconds( csgHistPercentile( snapshot, 500000 ), frequency ),
+                            csgTimestampToNanoseconds( csgHistPercentile( snapshot, 990000 ), frequency ),
+                            csgTimestampToNanoseconds( csgHistPercentile( snapshot, 1000000 ), frequency )) );
+            }
+        }
+
+        csgHistDestroy( StageCost[stage] );
+        StageCost[stage] = NULL;
+    }
+
+    if (snapshot != NULL) {
+
+        ExFreePoolWithTag( snapshot, STATS_TAG );
+    }
+}
+
+
+NTSTATUS
+StartSwapCacheAger (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Opens the memory manager's low nonpaged pool condition and starts the
+    thread that ages and trims the swap buffer cache.  Without the
+    condition the cache is only aged.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    STATUS_SUCCESS, or why the thread could not be created.
+
+--*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    UNICODE_STRING eventName;
+    HANDLE handle;
+    NTSTATUS status;
+
+    KeInitializeEvent( &SwapCacheAgerStop, NotificationEvent, FALSE );
+
+    RtlInitUnicodeString( &eventName, L"\\KernelObjects\\LowNonPagedPoolCondition" );
+
+    LowNonPagedPoolEvent = IoCreateNotificationEvent( &eventName,
+                                                      &LowNonPagedPoolHandle );
+
+    if (LowNonPagedPoolEvent == NULL) {
+
+        LOG_PRINT( LOGFL_ERRORS,
+                   ("csg!StartSwapCacheAger:             no low memory condition, only aging the swap cache\n") );
+    }
+
+    InitializeObjectAttributes( &attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL );
+
+    status = PsCreateSystemThread( &handle,
+                                   THREAD_ALL_ACCESS,
+                                   &attributes,
+                                   NULL,
+                                   NULL,
+                                   SwapCacheAgerThread,
+                                   NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    //
+    //  Referencing a handle we just created cannot fail.
+    //
+
+    status = ObReferenceObjectByHandle( handle,
+                                        THREAD_ALL_ACCESS,
+                                        *PsThreadType,
+                                        KernelMode,
+                                        (PVOID *)&SwapCacheAger,
+                                        NULL );
+
+    ASSERT( NT_SUCCESS( status ) );
+
+    ZwClose( handle );
+
+    return status;
+}
+
+
+VOID
+StopSwapCacheAger (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Stops the thread StartSwapCacheAger started, waits for it, and closes
+    the low memory condition.  Whatever of it was started.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (SwapCacheAger != NULL) {
+
+        KeSetEvent( &SwapCacheAgerStop, IO_NO_INCREMENT, FALSE );
+
+        KeWaitForSingleObject( SwapCacheAger, Executive, KernelMode, FALSE, NULL );
+
+        ObDereferenceObject( SwapCacheAger );
+        SwapCacheAger = NULL;
+    }
+
+    if (LowNonPagedPoolHandle != NULL) {
+
+        ZwClose( LowNonPagedPoolHandle );
+        LowNonPagedPoolHandle = NULL;
+        LowNonPagedPoolEvent = NULL;
+    }
+}
+
+
+VOID
+SwapCacheAgerThread (
+    __in PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Ages the swap buffer cache every SWAP_CACHE_AGE_INTERVAL, so that what
+    a burst of I/O left in it goes back to the system, and trims it
+    whole instead while nonpaged pool is short.  Runs until
+    SwapCacheAgerStop is signaled.
+
+Arguments:
+
+    Context - Unused.
+
+Return Value:
+
+    None
+
+--*/
+{
+    LARGE_INTEGER interval;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( Context );
+
+    interval.QuadPart = SWAP_CACHE_AGE_INTERVAL;
+
+    while (KeWaitForSingleObject( &SwapCacheAgerStop,
+                                  Executive,
+                                  KernelMode,
+                                  FALSE,
+                                  &interval ) == STATUS_TIMEOUT) {
+
+        if ((LowNonPagedPoolEvent != NULL) &&
+            (KeReadStateEvent( LowNonPagedPoolEvent ) != 0)) {
+
+            csgBufCacheTrim( SwapBufferCache );
+
+        } else {
+
+            csgBufCacheAge( SwapBufferCache );
+        }
+    }
+
+    PsTerminateSystemThread( STATUS_SUCCESS );
 }
@@ -0,0 +1,973 @@
+/*++
+
+Module Name:
+
+    csgAes.c
+
+Abstract:
+
+    Portable AES block cipher used for key setup and as the fallback when
+    the processor has no AES instructions.
+
+    The cipher is bitsliced after the constant-time "ct64" design of
+    BearSSL: four blocks are spread over eight 64 bit words, one word per
+    bit of every byte, and SubBytes is evaluated as a boolean circuit
+    (Boyar and Peralta).  There are no table lookups and no branches on
+    key or data, so the fallback does not leak through the cache the way
+    a table-driven AES does.  Processing four blocks costs the same as
+    one, so the modes hand over blocks in batches where they can.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgAes.h"
+
+//
+//  Number of blocks one pass of the bitsliced core carries.
+//
+
+#define CSG_AES_CT_LANES    4
+
+static CONST UCHAR csgAesRcon[10] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+CSG_INLINE ULONG
+csgAesLoad32 (
+    CONST UCHAR *p
+    )
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+CSG_INLINE VOID
+csgAesStore32 (
+    UCHAR *p,
+    ULONG v
+    )
+{
+    p[0] = (UCHAR)v;
+    p[1] = (UCHAR)(v >> 8);
+    p[2] = (UCHAR)(v >> 16);
+    p[3] = (UCHAR)(v >> 24);
+}
+
+/*************************************************************************
+    Bitsliced core
+*************************************************************************/
+
+//
+//  The AES S-box as a circuit of 113 gates: a linear top layer, the
+//  inversion in GF(2^8) and a linear bottom layer.  q[0] holds bit 0 of
+//  every byte, q[7] bit 7.
+//
+
+static VOID
+csgAesBitsliceSbox (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG x0, x1, x2, x3, x4, x5, x6, x7;
+    ULONGLONG y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    ULONGLONG y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    ULONGLONG y20, y21;
+    ULONGLONG z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    ULONGLONG z10, z11, z12, z13, z14, z15, z16, z17;
+    ULONGLONG t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    ULONGLONG t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    ULONGLONG t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    ULONGLONG t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    ULONGLONG t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    ULONGLONG t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    ULONGLONG t60, t61, t62, t63, t64, t65, t66, t67;
+    ULONGLONG s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    //
+    //  Top linear transformation.
+    //
+
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    //
+    //  Non-linear section.
+    //
+
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    //
+    //  Bottom linear transformation.
+    //
+
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+//
+//  The inverse S-box is the forward one conjugated by the inverse of its
+//  affine transformation.
+//
+
+CSG_INLINE VOID
+csgAesBitsliceInvAffine (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG q0, q1, q2, q3, q4, q5, q6, q7;
+
+    q0 = ~q[0];
+    q1 = ~q[1];
+    q2 = q[2];
+    q3 = q[3];
+    q4 = q[4];
+    q5 = ~q[5];
+    q6 = ~q[6];
+    q7 = q[7];
+
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+static VOID
+csgAesBitsliceInvSbox (
+    ULONGLONG q[8]
+    )
+{
+    csgAesBitsliceInvAffine( q );
+    csgAesBitsliceSbox( q );
+    csgAesBitsliceInvAffine( q );
+}
+
+//
+//  Convert between four blocks held as words and the bitsliced form.  The
+//  transposition is its own inverse.
+//
+
+#define CSG_AES_SWAPN(_cl, _ch, _s, _x, _y) {                                   \
+    ULONGLONG _a = (_x);                                                        \
+    ULONGLONG _b = (_y);                                                        \
+    (_x) = (_a & (ULONGLONG)(_cl)) | ((_b & (ULONGLONG)(_cl)) << (_s));         \
+    (_y) = ((_a & (ULONGLONG)(_ch)) >> (_s)) | (_b & (ULONGLONG)(_ch));         \
+}
+
+#define CSG_AES_SWAP2(_x, _y)   CSG_AES_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, _x, _y)
+#define CSG_AES_SWAP4(_x, _y)   CSG_AES_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, _x, _y)
+#define CSG_AES_SWAP8(_x, _y)   CSG_AES_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, _x, _y)
+
+static VOID
+csgAesOrtho (
+    ULONGLONG q[8]
+    )
+{
+    CSG_AES_SWAP2( q[0], q[1] );
+    CSG_AES_SWAP2( q[2], q[3] );
+    CSG_AES_SWAP2( q[4], q[5] );
+    CSG_AES_SWAP2( q[6], q[7] );
+
+    CSG_AES_SWAP4( q[0], q[2] );
+    CSG_AES_SWAP4( q[1], q[3] );
+    CSG_AES_SWAP4( q[4], q[6] );
+    CSG_AES_SWAP4( q[5], q[7] );
+
+    CSG_AES_SWAP8( q[0], q[4] );
+    CSG_AES_SWAP8( q[1], q[5] );
+    CSG_AES_SWAP8( q[2], q[6] );
+    CSG_AES_SWAP8( q[3], q[7] );
+}
+
+CSG_INLINE VOID
+csgAesInterleaveIn (
+    ULONGLONG *q0,
+    ULONGLONG *q1,
+    CONST ULONG w[4]
+    )
+{
+    ULONGLONG x0, x1, x2, x3;
+
+    x0 = w[0];
+    x1 = w[1];
+    x2 = w[2];
+    x3 = w[3];
+    x0 |= (x0 << 16);
+    x1 |= (x1 << 16);
+    x2 |= (x2 << 16);
+    x3 |= (x3 << 16);
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    x0 |= (x0 << 8);
+    x1 |= (x1 << 8);
+    x2 |= (x2 << 8);
+    x3 |= (x3 << 8);
+    x0 &= 0x00FF00FF00FF00FFULL;
+    x1 &= 0x00FF00FF00FF00FFULL;
+    x2 &= 0x00FF00FF00FF00FFULL;
+    x3 &= 0x00FF00FF00FF00FFULL;
+    *q0 = x0 | (x2 << 8);
+    *q1 = x1 | (x3 << 8);
+}
+
+CSG_INLINE VOID
+csgAesInterleaveOut (
+    ULONG w[4],
+    ULONGLONG q0,
+    ULONGLONG q1
+    )
+{
+    ULONGLONG x0, x1, x2, x3;
+
+    x0 = q0 & 0x00FF00FF00FF00FFULL;
+    x1 = q1 & 0x00FF00FF00FF00FFULL;
+    x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    x0 |= (x0 >> 8);
+    x1 |= (x1 >> 8);
+    x2 |= (x2 >> 8);
+    x3 |= (x3 >> 8);
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    w[0] = (ULONG)x0 | (ULONG)(x0 >> 16);
+    w[1] = (ULONG)x1 | (ULONG)(x1 >> 16);
+    w[2] = (ULONG)x2 | (ULONG)(x2 >> 16);
+    w[3] = (ULONG)x3 | (ULONG)(x3 >> 16);
+}
+
+CSG_INLINE VOID
+csgAesBitsliceAddRoundKey (
+    ULONGLONG q[8],
+    CONST ULONGLONG *sk
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 8; i++) {
+
+        q[i] ^= sk[i];
+    }
+}
+
+CSG_INLINE VOID
+csgAesBitsliceShiftRows (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG x;
+    ULONG i;
+
+    for (i = 0; i < 8; i++) {
+
+        x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+             | ((x & 0x00000000FFF00000ULL) >> 4)
+             | ((x & 0x00000000000F0000ULL) << 12)
+             | ((x & 0x0000FF0000000000ULL) >> 8)
+             | ((x & 0x000000FF00000000ULL) << 8)
+             | ((x & 0xF000000000000000ULL) >> 12)
+             | ((x & 0x0FFF000000000000ULL) << 4);
+    }
+}
+
+CSG_INLINE VOID
+csgAesBitsliceInvShiftRows (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG x;
+    ULONG i;
+
+    for (i = 0; i < 8; i++) {
+
+        x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+             | ((x & 0x000000000FFF0000ULL) << 4)
+             | ((x & 0x00000000F0000000ULL) >> 12)
+             | ((x & 0x000000FF00000000ULL) << 8)
+             | ((x & 0x0000FF0000000000ULL) >> 8)
+             | ((x & 0x000F000000000000ULL) << 12)
+             | ((x & 0xFFF0000000000000ULL) >> 4);
+    }
+}
+
+CSG_INLINE ULONGLONG
+csgAesRotr32 (
+    ULONGLONG x
+    )
+{
+    return (x << 32) | (x >> 32);
+}
+
+static VOID
+csgAesBitsliceMixColumns (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG q0, q1, q2, q3, q4, q5, q6, q7;
+    ULONGLONG r0, r1, r2, r3, r4, r5, r6, r7;
+
+    q0 = q[0];
+    q1 = q[1];
+    q2 = q[2];
+    q3 = q[3];
+    q4 = q[4];
+    q5 = q[5];
+    q6 = q[6];
+    q7 = q[7];
+    r0 = (q0 >> 16) | (q0 << 48);
+    r1 = (q1 >> 16) | (q1 << 48);
+    r2 = (q2 >> 16) | (q2 << 48);
+    r3 = (q3 >> 16) | (q3 << 48);
+    r4 = (q4 >> 16) | (q4 << 48);
+    r5 = (q5 >> 16) | (q5 << 48);
+    r6 = (q6 >> 16) | (q6 << 48);
+    r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q7 ^ r7 ^ r0 ^ csgAesRotr32( q0 ^ r0 );
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ csgAesRotr32( q1 ^ r1 );
+    q[2] = q1 ^ r1 ^ r2 ^ csgAesRotr32( q2 ^ r2 );
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ csgAesRotr32( q3 ^ r3 );
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ csgAesRotr32( q4 ^ r4 );
+    q[5] = q4 ^ r4 ^ r5 ^ csgAesRotr32( q5 ^ r5 );
+    q[6] = q5 ^ r5 ^ r6 ^ csgAesRotr32( q6 ^ r6 );
+    q[7] = q6 ^ r6 ^ r7 ^ csgAesRotr32( q7 ^ r7 );
+}
+
+static VOID
+csgAesBitsliceInvMixColumns (
+    ULONGLONG q[8]
+    )
+{
+    ULONGLONG q0, q1, q2, q3, q4, q5, q6, q7;
+    ULONGLONG r0, r1, r2, r3, r4, r5, r6, r7;
+
+    q0 = q[0];
+    q1 = q[1];
+    q2 = q[2];
+    q3 = q[3];
+    q4 = q[4];
+    q5 = q[5];
+    q6 = q[6];
+    q7 = q[7];
+    r0 = (q0 >> 16) | (q0 << 48);
+    r1 = (q1 >> 16) | (q1 << 48);
+    r2 = (q2 >> 16) | (q2 << 48);
+    r3 = (q3 >> 16) | (q3 << 48);
+    r4 = (q4 >> 16) | (q4 << 48);
+    r5 = (q5 >> 16) | (q5 << 48);
+    r6 = (q6 >> 16) | (q6 << 48);
+    r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^ csgAesRotr32( q0 ^ q5 ^ q6 ^ r0 ^ r5 );
+    q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^ csgAesRotr32( q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6 );
+    q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^ csgAesRotr32( q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7 );
+    q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^ csgAesRotr32( q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7 );
+    q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^ csgAesRotr32( q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6 );
+    q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^ csgAesRotr32( q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7 );
+    q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^ csgAesRotr32( q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7 );
+    q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^ csgAesRotr32( q4 ^ q5 ^ q7 ^ r4 ^ r7 );
+}
+
+//
+//  Apply SubWord to a key schedule word.
+//
+
+static ULONG
+csgAesSubWord (
+    ULONG x
+    )
+{
+    ULONGLONG q[8];
+
+    RtlZeroMemory( q, sizeof(q) );
+
+    q[0] = x;
+    csgAesOrtho( q );
+    csgAesBitsliceSbox( q );
+    csgAesOrtho( q );
+
+    return (ULONG)q[0];
+}
+
+//
+//  Run up to four blocks through the bitsliced cipher.  Unused lanes are
+//  enciphered as zeros and discarded.
+//
+
+static VOID
+csgAesBitsliceCrypt (
+    PCCSG_AES_KEY Key,
+    BOOLEAN Encrypt,
+    CONST UCHAR *In,
+    UCHAR *Out,
+    SIZE_T Count
+    )
+{
+    CONST ULONGLONG *sk = Key->BitslicedKeys;
+    ULONG rounds = Key->Rounds;
+    ULONGLONG q[8];
+    ULONG w[4 * CSG_AES_CT_LANES];
+    ULONG r;
+    ULONG i;
+
+    RtlZeroMemory( w, sizeof(w) );
+
+    for (i = 0; i < 4 * Count; i++) {
+
+        w[i] = csgAesLoad32( In + 4 * i );
+    }
+
+    for (i = 0; i < CSG_AES_CT_LANES; i++) {
+
+        csgAesInterleaveIn( &q[i], &q[i + 4], w + 4 * i );
+    }
+
+    csgAesOrtho( q );
+
+    if (Encrypt) {
+
+        csgAesBitsliceAddRoundKey( q, sk );
+
+        for (r = 1; r < rounds; r++) {
+
+            csgAesBitsliceSbox( q );
+            csgAesBitsliceShiftRows( q );
+            csgAesBitsliceMixColumns( q );
+            csgAesBitsliceAddRoundKey( q, sk + 8 * r );
+        }
+
+        csgAesBitsliceSbox( q );
+        csgAesBitsliceShiftRows( q );
+        csgAesBitsliceAddRoundKey( q, sk + 8 * rounds );
+
+    } else {
+
+        csgAesBitsliceAddRoundKey( q, sk + 8 * rounds );
+
+        for (r = rounds - 1; r > 0; r--) {
+
+            csgAesBitsliceInvShiftRows( q );
+            csgAesBitsliceInvSbox( q );
+            csgAesBitsliceAddRoundKey( q, sk + 8 * r );
+            csgAesBitsliceInvMixColumns( q );
+        }
+
+        csgAesBitsliceInvShiftRows( q );
+        csgAesBitsliceInvSbox( q );
+        csgAesBitsliceAddRoundKey( q, sk );
+    }
+
+    csgAesOrtho( q );
+
+    for (i = 0; i < CSG_AES_CT_LANES; i++) {
+
+        csgAesInterleaveOut( w + 4 * i, q[i], q[i + 4] );
+    }
+
+    for (i = 0; i < 4 * Count; i++) {
+
+        csgAesStore32( Out + 4 * i, w[i] );
+    }
+
+    csgSecureZeroMemory( q, sizeof(q) );
+    csgSecureZeroMemory( w, sizeof(w) );
+}
+
+/*************************************************************************
+    Byte oriented helpers for the AES-NI decryption schedule
+*************************************************************************/
+
+//
+//  Multiply by x in GF(2^8), without a branch on the top bit.
+//
+
+CSG_INLINE UCHAR
+csgAesXtime (
+    UCHAR a
+    )
+{
+    return (UCHAR)((a << 1) ^ (0x1b & (0 - (a >> 7))));
+}
+
+CSG_INLINE VOID
+csgAesMixColumns (
+    UCHAR State[16]
+    )
+{
+    ULONG c;
+    UCHAR a0, a1, a2, a3, all;
+
+    for (c = 0; c < 16; c += 4) {
+
+        a0 = State[c];
+        a1 = State[c + 1];
+        a2 = State[c + 2];
+        a3 = State[c + 3];
+        all = a0 ^ a1 ^ a2 ^ a3;
+
+        State[c]     ^= all ^ csgAesXtime( a0 ^ a1 );
+        State[c + 1] ^= all ^ csgAesXtime( a1 ^ a2 );
+        State[c + 2] ^= all ^ csgAesXtime( a2 ^ a3 );
+        State[c + 3] ^= all ^ csgAesXtime( a3 ^ a0 );
+    }
+}
+
+CSG_INLINE VOID
+csgAesInvMixColumns (
+    UCHAR State[16]
+    )
+{
+    ULONG c;
+    UCHAR u, v;
+
+    //
+    //  InvMixColumns is MixColumns preceded by multiplying each column
+    //  by {04}x^2 + {05}.
+    //
+
+    for (c = 0; c < 16; c += 4) {
+
+        u = csgAesXtime( csgAesXtime( State[c] ^ State[c + 2] ) );
+        v = csgAesXtime( csgAesXtime( State[c + 1] ^ State[c + 3] ) );
+
+        State[c]     ^= u;
+        State[c + 1] ^= v;
+        State[c + 2] ^= u;
+        State[c + 3] ^= v;
+    }
+
+    csgAesMixColumns( State );
+}
+
+/*************************************************************************
+    Interface
+*************************************************************************/
+
+NTSTATUS
+csgAesSetKey (
+    __out PCSG_AES_KEY Key,
+    __in_bcount(KeyLength) CONST UCHAR *KeyBytes,
+    __in ULONG KeyLength
+    )
+/*++
+
+Routine Description:
+
+    Expands an AES key into its encryption, decryption and bitsliced
+    schedules.
+
+Arguments:
+
+    Key - Receives the expanded key.
+
+    KeyBytes - The raw key.
+
+    KeyLength - Length of the raw key in bytes: 16, 24 or 32.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - unsupported key length
+
+--*/
+{
+    ULONG w[4 * (CSG_AES_MAX_ROUNDS + 1)];
+    ULONGLONG q[8];
+    ULONGLONG *sk = Key->BitslicedKeys;
+    ULONG nk = KeyLength / 4;
+    ULONG total;
+    ULONG tmp;
+    ULONG i;
+    ULONG r;
+
+    if (KeyLength != 16 && KeyLength != 24 && KeyLength != 32) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Key->Rounds = nk + 6;
+    total = 4 * (Key->Rounds + 1);
+
+    for (i = 0; i < nk; i++) {
+
+        w[i] = csgAesLoad32( KeyBytes + 4 * i );
+    }
+
+    tmp = w[nk - 1];
+
+    for (i = nk; i < total; i++) {
+
+        if ((i % nk) == 0) {
+
+            tmp = (tmp << 24) | (tmp >> 8);
+            tmp = csgAesSubWord( tmp ) ^ csgAesRcon[i / nk - 1];
+
+        } else if (nk > 6 && (i % nk) == 4) {
+
+            tmp = csgAesSubWord( tmp );
+        }
+
+        tmp ^= w[i - nk];
+        w[i] = tmp;
+    }
+
+    for (i = 0; i < total; i++) {
+
+        csgAesStore32( Key->EncRoundKeys + 4 * i, w[i] );
+    }
+
+    //
+    //  Bitsliced schedule: every round key is replicated into all four
+    //  lanes, then transposed like the data.
+    //
+
+    for (r = 0; r <= Key->Rounds; r++) {
+
+        csgAesInterleaveIn( &q[0], &q[4], w + 4 * r );
+
+        q[1] = q[2] = q[3] = q[0];
+        q[5] = q[6] = q[7] = q[4];
+
+        csgAesOrtho( q );
+
+        RtlCopyMemory( sk + 8 * r, q, sizeof(q) );
+    }
+
+    //
+    //  Build the equivalent inverse cipher schedule.
+    //
+
+    RtlCopyMemory( Key->DecRoundKeys,
+                   Key->EncRoundKeys + Key->Rounds * CSG_AES_BLOCK_SIZE,
+                   CSG_AES_BLOCK_SIZE );
+
+    for (r = 1; r < Key->Rounds; r++) {
+
+        RtlCopyMemory( Key->DecRoundKeys + r * CSG_AES_BLOCK_SIZE,
+                       Key->EncRoundKeys + (Key->Rounds - r) * CSG_AES_BLOCK_SIZE,
+                       CSG_AES_BLOCK_SIZE );
+
+        csgAesInvMixColumns( Key->DecRoundKeys + r * CSG_AES_BLOCK_SIZE );
+    }
+
+    RtlCopyMemory( Key->DecRoundKeys + Key->Rounds * CSG_AES_BLOCK_SIZE,
+                   Key->EncRoundKeys,
+                   CSG_AES_BLOCK_SIZE );
+
+    csgSecureZeroMemory( w, sizeof(w) );
+    csgSecureZeroMemory( q, sizeof(q) );
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgAesClearKey (
+    __inout PCSG_AES_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    Wipes an expanded key.
+
+Arguments:
+
+    Key - The key to wipe.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgSecureZeroMemory( Key, sizeof(CSG_AES_KEY) );
+}
+
+
+VOID
+csgAesEncryptBlocks (
+    __in PCCSG_AES_KEY Key,
+    __in_ecount(Count * CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_ecount(Count * CSG_AES_BLOCK_SIZE) UCHAR *Out,
+    __in SIZE_T Count
+    )
+/*++
+
+Routine Description:
+
+    Encrypts independent blocks (ECB).  In and Out may be the same buffer.
+
+Arguments:
+
+    Key - The expanded key.
+
+    In - The plaintext blocks.
+
+    Out - Receives the ciphertext blocks.
+
+    Count - Number of blocks.
+
+Return Value:
+
+    None
+
+--*/
+{
+    SIZE_T n;
+
+    while (Count > 0) {
+
+        n = (Count < CSG_AES_CT_LANES) ? Count : CSG_AES_CT_LANES;
+
+        csgAesBitsliceCrypt( Key, TRUE, In, Out, n );
+
+        In += n * CSG_AES_BLOCK_SIZE;
+        Out += n * CSG_AES_BLOCK_SIZE;
+        Count -= n;
+    }
+}
+
+
+VOID
+csgAesDecryptBlocks (
+    __in PCCSG_AES_KEY Key,
+    __in_ecount(Count * CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_ecount(Count * CSG_AES_BLOCK_SIZE) UCHAR *Out,
+    __in SIZE_T Count
+    )
+/*++
+
+Routine Description:
+
+    Decrypts independent blocks (ECB).  In and Out may be the same buffer.
+
+Arguments:
+
+    Key - The expanded key.
+
+    In - The ciphertext blocks.
+
+    Out - Receives the plaintext blocks.
+
+    Count - Number of blocks.
+
+Return Value:
+
+    None
+
+--*/
+{
+    SIZE_T n;
+
+    while (Count > 0) {
+
+        n = (Count < CSG_AES_CT_LANES) ? Count : CSG_AES_CT_LANES;
+
+        csgAesBitsliceCrypt( Key, FALSE, In, Out, n );
+
+        In += n * CSG_AES_BLOCK_SIZE;
+        Out += n * CSG_AES_BLOCK_SIZE;
+        Count -= n;
+    }
+}
+
+
+VOID
+csgAesEncryptBlock (
+    __in PCCSG_AES_KEY Key,
+    __in_bcount(CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_bcount(CSG_AES_BLOCK_SIZE) UCHAR *Out
+    )
+/*++
+
+Routine Description:
+
+    Encrypts one block.  In and Out may be the same buffer.
+
+Arguments:
+
+    Key - The expanded key.
+
+    In - The plaintext block.
+
+    Out - Receives the ciphertext block.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgAesBitsliceCrypt( Key, TRUE, In, Out, 1 );
+}
+
+
+VOID
+csgAesDecryptBlock (
+    __in PCCSG_AES_KEY Key,
+    __in_bcount(CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_bcount(CSG_AES_BLOCK_SIZE) UCHAR *Out
+    )
+/*++
+
+Routine Description:
+
+    Decrypts one block.  In and Out may be the same buffer.
+
+Arguments:
+
+    Key - The expanded key.
+
+    In - The ciphertext block.
+
+    Out - Receives the plaintext block.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgAesBitsliceCrypt( Key, FALSE, In, Out, 1 );
+}
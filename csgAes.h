@@ -0,0 +1,82 @@
+#ifndef __CSG_AES_H__
+#define __CSG_AES_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    AES block cipher
+*************************************************************************/
+
+#define CSG_AES_BLOCK_SIZE      16
+#define CSG_AES_MAX_ROUNDS      14
+#define CSG_AES_MAX_KEY_SIZE    32
+
+//
+//  An expanded AES key.  The encryption schedule is laid out in the order
+//  the rounds consume it.  The decryption schedule is for the "equivalent
+//  inverse cipher" (FIPS-197 5.3.5): reversed, with InvMixColumns applied
+//  to the middle round keys, which is also the form AESDEC expects.  The
+//  bitsliced schedule feeds the portable cipher, eight words per round.
+//
+
+typedef struct _CSG_AES_KEY {
+
+    CSG_ALIGN(16) UCHAR EncRoundKeys[(CSG_AES_MAX_ROUNDS + 1) * CSG_AES_BLOCK_SIZE];
+
+    CSG_ALIGN(16) UCHAR DecRoundKeys[(CSG_AES_MAX_ROUNDS + 1) * CSG_AES_BLOCK_SIZE];
+
+    ULONGLONG BitslicedKeys[(CSG_AES_MAX_ROUNDS + 1) * 8];
+
+    //
+    //  10, 12 or 14 depending on the key length.
+    //
+
+    ULONG Rounds;
+
+} CSG_AES_KEY, *PCSG_AES_KEY;
+
+typedef CONST CSG_AES_KEY *PCCSG_AES_KEY;
+
+NTSTATUS
+csgAesSetKey (
+    __out PCSG_AES_KEY Key,
+    __in_bcount(KeyLength) CONST UCHAR *KeyBytes,
+    __in ULONG KeyLength
+    );
+
+VOID
+csgAesClearKey (
+    __inout PCSG_AES_KEY Key
+    );
+
+VOID
+csgAesEncryptBlocks (
+    __in PCCSG_AES_KEY Key,
+    __in_ecount(Count * CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_ecount(Count * CSG_AES_BLOCK_SIZE) UCHAR *Out,
+    __in SIZE_T Count
+    );
+
+VOID
+csgAesDecryptBlocks (
+    __in PCCSG_AES_KEY Key,
+    __in_ecount(Count * CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_ecount(Count * CSG_AES_BLOCK_SIZE) UCHAR *Out,
+    __in SIZE_T Count
+    );
+
+VOID
+csgAesEncryptBlock (
+    __in PCCSG_AES_KEY Key,
+    __in_bcount(CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_bcount(CSG_AES_BLOCK_SIZE) UCHAR *Out
+    );
+
+VOID
+csgAesDecryptBlock (
+    __in PCCSG_AES_KEY Key,
+    __in_bcount(CSG_AES_BLOCK_SIZE) CONST UCHAR *In,
+    __out_bcount(CSG_AES_BLOCK_SIZE) UCHAR *Out
+    );
+
+#endif // __CSG_AES_H__
@@ -0,0 +1,929 @@
+/*++
+
+Module Name:
+
+    csgBufCache.c
+
+Abstract:
+
+    A cache of swap buffers so the read, write and directory control paths
+    do not go to the pool allocator for every operation.
+
+    Each processor has a magazine: a few buffers of every size class
+    behind a lock of its own, so operations on different processors do
+    not contend.  Behind the magazines sits a depot per size class, shared
+    by all processors.  An allocation that finds its magazine empty
+    refills it from the depot; a free that finds it full moves half of it
+    there.  Only when the depot is empty (or full, on free) does the real
+    allocator see the request.
+
+    What a class keeps is bounded as a whole, magazines and depot
+    together: the magazines get a share of the bound that shrinks with
+    the number of processors, down to none for the large classes on a
+    machine with many of them, and the depot the rest.
+
+    A thread may change processors between picking a magazine and locking
+    it; the lock keeps that correct, it only costs some locality.
+
+    When the allocator fails, the cache is trimmed and the allocation
+    retried once, so cached buffers never stand between the system and
+    memory it needs.  Its owner also trims it when memory runs short and
+    ages it periodically, so that buffers a burst of I/O left behind go
+    back to the system once the burst is over.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgBufCache.h"
+
+//
+//  Buffers per class in one magazine, and how many move at once between a
+//  magazine and the depot.
+//
+
+#define CSG_BUFCACHE_MAGAZINE_SIZE  8
+#define CSG_BUFCACHE_BATCH          (CSG_BUFCACHE_MAGAZINE_SIZE / 2)
+
+#define CSG_BUFCACHE_CACHE_LINE     64
+
+//
+//  Tag of the cache's own memory.  What it caches comes from the
+//  caller's allocator.
+//
+
+#define CSG_BUFCACHE_TAG            'cbBS'
+
+typedef struct CSG_ALIGN(CSG_BUFCACHE_CACHE_LINE) _CSG_BUFCACHE_MAGAZINE {
+
+    CSG_LOCK Lock;
+
+    ULONG Count[CSG_BUFCACHE_CLASSES];
+
+    PVOID Buffers[CSG_BUFCACHE_CLASSES][CSG_BUFCACHE_MAGAZINE_SIZE];
+
+    ULONGLONG Hits[CSG_BUFCACHE_CLASSES];
+
+    //
+    //  Hits when the cache was last aged.
+    //
+
+    ULONGLONG AgedHits[CSG_BUFCACHE_CLASSES];
+
+} CSG_BUFCACHE_MAGAZINE, *PCSG_BUFCACHE_MAGAZINE;
+
+//
+//  Depot buffers are chained through their first pointer.
+//
+
+typedef struct CSG_ALIGN(CSG_BUFCACHE_CACHE_LINE) _CSG_BUFCACHE_DEPOT {
+
+    CSG_LOCK Lock;
+
+    PVOID Head;
+
+    ULONG Count;
+
+    ULONG Limit;
+
+    //
+    //  The lowest Count since the cache was last aged: buffers nobody
+    //  needed in that time.
+    //
+
+    ULONG LowWater;
+
+    ULONGLONG Hits;
+
+    ULONGLONG Misses;
+
+} CSG_BUFCACHE_DEPOT, *PCSG_BUFCACHE_DEPOT;
+
+struct _CSG_BUFCACHE {
+
+    CSG_BUFCACHE_DEPOT Depot[CSG_BUFCACHE_CLASSES];
+
+    //
+    //  Buffers of each class one magazine keeps at most; read without a
+    //  lock, since a magazine over it is only brought back under it late.
+    //
+
+    ULONG MagazineLimit[CSG_BUFCACHE_CLASSES];
+
+    PCSG_BUFCACHE_ALLOCATE Allocate;
+
+    PCSG_BUFCACHE_FREE Free;
+
+    PVOID Context;
+
+    volatile LONGLONG Oversize;
+
+    volatile LONGLONG Trimmed;
+
+    //
+    //  Where the allocation for this structure really starts; the
+    //  magazines are aligned up to a cache line after it.
+    //
+
+    PVOID Allocation;
+
+    ULONG CpuCount;
+
+    PCSG_BUFCACHE_MAGAZINE Magazines;
+};
+
+CSG_INLINE ULONG
+csgBufCacheClass (
+    SIZE_T Size
+    )
+{
+    ULONG cls = 0;
+
+    while (((SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + cls)) < Size) {
+
+        cls++;
+    }
+
+    return cls;
+}
+
+CSG_INLINE SIZE_T
+csgBufCacheClassSize (
+    ULONG Class
+    )
+{
+    return (SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + Class);
+}
+
+CSG_INLINE PCSG_BUFCACHE_MAGAZINE
+csgBufCacheMagazine (
+    PCSG_BUFCACHE Cache
+    )
+{
+    return &Cache->Magazines[csgCurrentCpu() % Cache->CpuCount];
+}
+
+//
+//  Splits the buffers of a class a ClassBytes bound allows, at least a
+//  magazine's worth, between the magazines and the depot.  All the
+//  magazines together get at most half.
+//
+
+static VOID
+csgBufCacheLimits (
+    SIZE_T ClassBytes,
+    ULONG Class,
+    ULONG CpuCount,
+    PULONG MagazineLimit,
+    PULONG DepotLimit
+    )
+{
+    SIZE_T limit = ClassBytes / csgBufCacheClassSize( Class );
+    SIZE_T magazine;
+
+    if (limit < CSG_BUFCACHE_MAGAZINE_SIZE) {
+
+        limit = CSG_BUFCACHE_MAGAZINE_SIZE;
+
+    } else if (limit > MAXULONG) {
+
+        limit = MAXULONG;
+    }
+
+    magazine = limit / (2 * (SIZE_T)CpuCount);
+
+    if (magazine > CSG_BUFCACHE_MAGAZINE_SIZE) {
+
+        magazine = CSG_BUFCACHE_MAGAZINE_SIZE;
+    }
+
+    *MagazineLimit = (ULONG)magazine;
+    *DepotLimit = (ULONG)(limit - magazine * CpuCount);
+}
+
+//
+//  Hands a chain of buffers back to the allocator.  Returns the number of
+//  bytes released.
+//
+
+static SIZE_T
+csgBufCacheRelease (
+    PCSG_BUFCACHE Cache,
+    ULONG Class,
+    PVOID List
+    )
+{
+    SIZE_T released = 0;
+    PVOID next;
+
+    while (List != NULL) {
+
+        next = *(PVOID *)List;
+
+        Cache->Free( List, csgBufCacheClassSize( Class ), Cache->Context );
+
+        csgInterlockedIncrement64( &Cache->Trimmed );
+        released += csgBufCacheClassSize( Class );
+        List = next;
+    }
+
+    return released;
+}
+
+//
+//  Takes buffers of a class out of a magazine, whose lock the caller
+//  holds, until Keep are left, and chains them onto List.
+//
+
+static PVOID
+csgBufCacheMagazineTake (
+    PCSG_BUFCACHE_MAGAZINE Magazine,
+    ULONG Class,
+    ULONG Keep,
+    PVOID List
+    )
+{
+    PVOID buffer;
+
+    while (Magazine->Count[Class] > Keep) {
+
+        buffer = Magazine->Buffers[Class][--Magazine->Count[Class]];
+
+        *(PVOID *)buffer = List;
+        List = buffer;
+    }
+
+    return List;
+}
+
+//
+//  Takes up to Count buffers off a depot, whose lock the caller holds,
+//  and chains them onto List.
+//
+
+static PVOID
+csgBufCacheDepotTake (
+    PCSG_BUFCACHE_DEPOT Depot,
+    ULONG Count,
+    PVOID List
+    )
+{
+    PVOID buffer;
+
+    while (Count > 0 && Depot->Head != NULL) {
+
+        buffer = Depot->Head;
+        Depot->Head = *(PVOID *)buffer;
+        Depot->Count--;
+        Count--;
+
+        *(PVOID *)buffer = List;
+        List = buffer;
+    }
+
+    if (Depot->LowWater > Depot->Count) {
+
+        Depot->LowWater = Depot->Count;
+    }
+
+    return List;
+}
+
+//
+//  Put buffers into the depot.  Whatever does not fit goes back to the
+//  allocator.
+//
+
+static VOID
+csgBufCacheDepotPut (
+    PCSG_BUFCACHE Cache,
+    ULONG Class,
+    PVOID *Buffers,
+    ULONG Count
+    )
+{
+    PCSG_BUFCACHE_DEPOT depot = &Cache->Depot[Class];
+    CSG_LOCK_STATE lockState;
+    ULONG i = 0;
+
+    csgLockAcquire( &depot->Lock, &lockState );
+
+    while (i < Count && depot->Count < depot->Limit) {
+
+        *(PVOID *)Buffers[i] = depot->Head;
+        depot->Head = Buffers[i];
+        depot->Count++;
+        i++;
+    }
+
+    csgLockRelease( &depot->Lock, lockState );
+
+    for (; i < Count; i++) {
+
+        Cache->Free( Buffers[i], csgBufCacheClassSize( Class ), Cache->Context );
+    }
+}
+
+
+NTSTATUS
+csgBufCacheCreate (
+    __in SIZE_T ClassBytes,
+    __in PCSG_BUFCACHE_ALLOCATE Allocate,
+    __in PCSG_BUFCACHE_FREE Free,
+    __in_opt PVOID Context,
+    __out PCSG_BUFCACHE *Cache
+    )
+/*++
+
+Routine Description:
+
+    Creates a buffer cache.
+
+Arguments:
+
+    ClassBytes - Upper bound on the memory each size class keeps, in the
+        magazines of all processors and the depot together.  Every class
+        may keep at least one magazine's worth.
+
+    Allocate - Allocates the objects the cache hands out.
+
+    Free - Releases memory from Allocate.
+
+    Context - Passed to Allocate and Free.
+
+    Cache - Receives the cache.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    PCSG_BUFCACHE cache;
+    ULONG cpuCount = csgCpuCount();
+    SIZE_T size;
+    PVOID allocation;
+    ULONG cls;
+    ULONG i;
+
+    *Cache = NULL;
+
+    size = sizeof(CSG_BUFCACHE) +
+           CSG_BUFCACHE_CACHE_LINE +
+           cpuCount * sizeof(CSG_BUFCACHE_MAGAZINE);
+
+    allocation = csgAllocateNonPaged( size, CSG_BUFCACHE_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    //
+    //  The allocator only promises pointer alignment, so place the
+    //  structure (whose members ask for cache line alignment) ourselves.
+    //
+
+    cache = (PCSG_BUFCACHE)(((ULONG_PTR)allocation + CSG_BUFCACHE_CACHE_LINE - 1) &
+                            ~(ULONG_PTR)(CSG_BUFCACHE_CACHE_LINE - 1));
+
+    cache->Allocation = allocation;
+    cache->Allocate = Allocate;
+    cache->Free = Free;
+    cache->Context = Context;
+    cache->CpuCount = cpuCount;
+    cache->Magazines = (PCSG_BUFCACHE_MAGAZINE)(cache + 1);
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        csgLockInit( &cache->Depot[cls].Lock );
+
+        csgBufCacheLimits( ClassBytes,
+                           cls,
+                           cpuCount,
+                           &cache->MagazineLimit[cls],
+                           &cache->Depot[cls].Limit );
+    }
+
+    for (i = 0; i < cpuCount; i++) {
+
+        csgLockInit( &cache->Magazines[i].Lock );
+    }
+
+    *Cache = cache;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgBufCacheDestroy (
+    __in PCSG_BUFCACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Releases every cached buffer and the cache itself.  No other call may
+    be in progress or follow.
+
+Arguments:
+
+    Cache - The cache to destroy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgBufCacheTrim( Cache );
+
+    csgFreeNonPaged( Cache->Allocation, CSG_BUFCACHE_TAG );
+}
+
+
+PVOID
+csgBufCacheAllocate (
+    __in PCSG_BUFCACHE Cache,
+    __in SIZE_T Size
+    )
+/*++
+
+Routine Description:
+
+    Gets a buffer of at least Size bytes.
+
+Arguments:
+
+    Cache - The cache.
+
+    Size - Bytes needed; must not be zero.
+
+Return Value:
+
+    The buffer, or NULL if there is no memory even after trimming the
+    cache.  The same Size must be passed to csgBufCacheFree.
+
+--*/
+{
+    PCSG_BUFCACHE_MAGAZINE magazine;
+    PCSG_BUFCACHE_DEPOT depot;
+    CSG_LOCK_STATE lockState;
+    PVOID batch[CSG_BUFCACHE_BATCH];
+    PVOID buffer;
+    PVOID list;
+    ULONG cls;
+    ULONG limit;
+    ULONG n = 0;
+
+    ASSERT(Size != 0);
+
+    if (Size > CSG_BUFCACHE_MAX_SIZE) {
+
+        csgInterlockedIncrement64( &Cache->Oversize );
+
+        buffer = Cache->Allocate( Size, Cache->Context );
+
+        if (buffer == NULL) {
+
+            csgBufCacheTrim( Cache );
+            buffer = Cache->Allocate( Size, Cache->Context );
+        }
+
+        return buffer;
+    }
+
+    cls = csgBufCacheClass( Size );
+    limit = Cache->MagazineLimit[cls];
+    magazine = csgBufCacheMagazine( Cache );
+
+    csgLockAcquire( &magazine->Lock, &lockState );
+
+    if (magazine->Count[cls] > 0) {
+
+        buffer = magazine->Buffers[cls][--magazine->Count[cls]];
+        magazine->Hits[cls]++;
+
+        csgLockRelease( &magazine->Lock, lockState );
+
+        return buffer;
+    }
+
+    csgLockRelease( &magazine->Lock, lockState );
+
+    //
+    //  The magazine is empty.  Take a batch from the depot, keep one and
+    //  refill the magazine with the rest; a class without magazines takes
+    //  just the one.
+    //
+
+    depot = &Cache->Depot[cls];
+
+    csgLockAcquire( &depot->Lock, &lockState );
+
+    list = csgBufCacheDepotTake( depot, (limit != 0) ? CSG_BUFCACHE_BATCH : 1, NULL );
+
+    if (list != NULL) {
+
+        depot->Hits++;
+
+    } else {
+
+        depot->Misses++;
+    }
+
+    csgLockRelease( &depot->Lock, lockState );
+
+    if (list == NULL) {
+
+        buffer = Cache->Allocate( csgBufCacheClassSize( cls ), Cache->Context );
+
+        if (buffer == NULL) {
+
+            csgBufCacheTrim( Cache );
+            buffer = Cache->Allocate( csgBufCacheClassSize( cls ), Cache->Context );
+        }
+
+        return buffer;
+    }
+
+    buffer = list;
+    list = *(PVOID *)list;
+
+    while (list != NULL) {
+
+        batch[n++] = list;
+        list = *(PVOID *)list;
+    }
+
+    if (n > 0) {
+
+        csgLockAcquire( &magazine->Lock, &lockState );
+
+        while (n > 0 && magazine->Count[cls] < limit) {
+
+            magazine->Buffers[cls][magazine->Count[cls]++] = batch[--n];
+        }
+
+        csgLockRelease( &magazine->Lock, lockState );
+
+        //
+        //  Someone filled the magazine while we were at the depot.
+        //
+
+        if (n > 0) {
+
+            csgBufCacheDepotPut( Cache, cls, batch, n );
+        }
+    }
+
+    return buffer;
+}
+
+
+VOID
+csgBufCacheFree (
+    __in PCSG_BUFCACHE Cache,
+    __in PVOID Buffer,
+    __in SIZE_T Size
+    )
+/*++
+
+Routine Description:
+
+    Returns a buffer from csgBufCacheAllocate.
+
+Arguments:
+
+    Cache - The cache.
+
+    Buffer - The buffer.
+
+    Size - The Size it was allocated with.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_BUFCACHE_MAGAZINE magazine;
+    CSG_LOCK_STATE lockState;
+    PVOID batch[CSG_BUFCACHE_MAGAZINE_SIZE + 1];
+    ULONG cls;
+    ULONG limit;
+    ULONG n = 0;
+
+    if (Size > CSG_BUFCACHE_MAX_SIZE) {
+
+        Cache->Free( Buffer, Size, Cache->Context );
+        return;
+    }
+
+    cls = csgBufCacheClass( Size );
+    limit = Cache->MagazineLimit[cls];
+    magazine = csgBufCacheMagazine( Cache );
+
+    csgLockAcquire( &magazine->Lock, &lockState );
+
+    //
+    //  A full magazine sends half its buffers to the depot so the next few
+    //  allocations and frees both stay local.  One over a limit that was
+    //  just lowered sends the excess too, and a class without magazines
+    //  sends everything.
+    //
+
+    if (magazine->Count[cls] >= limit) {
+
+        while (magazine->Count[cls] > limit / 2) {
+
+            batch[n++] = magazine->Buffers[cls][--magazine->Count[cls]];
+        }
+    }
+
+    if (magazine->Count[cls] < limit) {
+
+        magazine->Buffers[cls][magazine->Count[cls]++] = Buffer;
+
+    } else {
+
+        batch[n++] = Buffer;
+    }
+
+    csgLockRelease( &magazine->Lock, lockState );
+
+    if (n > 0) {
+
+        csgBufCacheDepotPut( Cache, cls, batch, n );
+    }
+}
+
+
+SIZE_T
+csgBufCacheTrim (
+    __in PCSG_BUFCACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Hands every cached buffer back to the allocator.  Call it when memory
+    is short; the cache refills on demand.
+
+Arguments:
+
+    Cache - The cache.
+
+Return Value:
+
+    Number of bytes released.
+
+--*/
+{
+    PCSG_BUFCACHE_MAGAZINE magazine;
+    PCSG_BUFCACHE_DEPOT depot;
+    CSG_LOCK_STATE lockState;
+    PVOID list;
+    SIZE_T released = 0;
+    ULONG cls;
+    ULONG cpu;
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        for (cpu = 0; cpu < Cache->CpuCount; cpu++) {
+
+            magazine = &Cache->Magazines[cpu];
+
+            csgLockAcquire( &magazine->Lock, &lockState );
+
+            list = csgBufCacheMagazineTake( magazine, cls, 0, NULL );
+
+            csgLockRelease( &magazine->Lock, lockState );
+
+            released += csgBufCacheRelease( Cache, cls, list );
+        }
+
+        depot = &Cache->Depot[cls];
+
+        csgLockAcquire( &depot->Lock, &lockState );
+
+        list = csgBufCacheDepotTake( depot, MAXULONG, NULL );
+
+        csgLockRelease( &depot->Lock, lockState );
+
+        released += csgBufCacheRelease( Cache, cls, list );
+    }
+
+    return released;
+}
+
+
+SIZE_T
+csgBufCacheAge (
+    __in PCSG_BUFCACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Hands back to the allocator buffers the cache had no use for since it
+    was last aged.  A magazine no allocation was served from in that time
+    goes to the depot, and each depot releases half of the buffers it held
+    throughout.  Called periodically, it lets the cache of an idle system
+    decay to nothing, while one that is busy keeps what it uses.
+
+Arguments:
+
+    Cache - The cache.
+
+Return Value:
+
+    Number of bytes released.
+
+--*/
+{
+    PCSG_BUFCACHE_MAGAZINE magazine;
+    PCSG_BUFCACHE_DEPOT depot;
+    CSG_LOCK_STATE lockState;
+    PVOID batch[CSG_BUFCACHE_MAGAZINE_SIZE];
+    PVOID list;
+    SIZE_T released = 0;
+    ULONG cls;
+    ULONG cpu;
+    ULONG n;
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        for (cpu = 0; cpu < Cache->CpuCount; cpu++) {
+
+            magazine = &Cache->Magazines[cpu];
+            n = 0;
+
+            csgLockAcquire( &magazine->Lock, &lockState );
+
+            if (magazine->Hits[cls] == magazine->AgedHits[cls]) {
+
+                while (magazine->Count[cls] > 0) {
+
+                    batch[n++] = magazine->Buffers[cls][--magazine->Count[cls]];
+                }
+            }
+
+            magazine->AgedHits[cls] = magazine->Hits[cls];
+
+            csgLockRelease( &magazine->Lock, lockState );
+
+            if (n > 0) {
+
+                csgBufCacheDepotPut( Cache, cls, batch, n );
+            }
+        }
+
+        //
+        //  After the magazines, so that what they just sent down counts
+        //  as held from now on.
+        //
+
+        depot = &Cache->Depot[cls];
+
+        csgLockAcquire( &depot->Lock, &lockState );
+
+        list = csgBufCacheDepotTake( depot, (depot->LowWater + 1) / 2, NULL );
+        depot->LowWater = depot->Count;
+
+        csgLockRelease( &depot->Lock, lockState );
+
+        released += csgBufCacheRelease( Cache, cls, list );
+    }
+
+    return released;
+}
+
+
+VOID
+csgBufCacheSetClassBytes (
+    __in PCSG_BUFCACHE Cache,
+    __in SIZE_T ClassBytes
+    )
+/*++
+
+Routine Description:
+
+    Changes the bound on what each size class keeps.  Magazines and depots
+    over their new share hand the excess back to the allocator at once; a
+    magazine a free was filling meanwhile is brought under it by its next
+    free, or by aging.
+
+Arguments:
+
+    Cache - The cache.
+
+    ClassBytes - As for csgBufCacheCreate.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_BUFCACHE_MAGAZINE magazine;
+    PCSG_BUFCACHE_DEPOT depot;
+    CSG_LOCK_STATE lockState;
+    ULONG magazineLimit;
+    ULONG depotLimit;
+    PVOID list;
+    ULONG cls;
+    ULONG cpu;
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        csgBufCacheLimits( ClassBytes,
+                           cls,
+                           Cache->CpuCount,
+                           &magazineLimit,
+                           &depotLimit );
+
+        Cache->MagazineLimit[cls] = magazineLimit;
+
+        for (cpu = 0; cpu < Cache->CpuCount; cpu++) {
+
+            magazine = &Cache->Magazines[cpu];
+
+            csgLockAcquire( &magazine->Lock, &lockState );
+
+            list = csgBufCacheMagazineTake( magazine, cls, magazineLimit, NULL );
+
+            csgLockRelease( &magazine->Lock, lockState );
+
+            csgBufCacheRelease( Cache, cls, list );
+        }
+
+        depot = &Cache->Depot[cls];
+
+        csgLockAcquire( &depot->Lock, &lockState );
+
+        depot->Limit = depotLimit;
+
+        list = (depot->Count > depotLimit) ?
+               csgBufCacheDepotTake( depot, depot->Count - depotLimit, NULL ) :
+               NULL;
+
+        csgLockRelease( &depot->Lock, lockState );
+
+        csgBufCacheRelease( Cache, cls, list );
+    }
+}
+
+
+VOID
+csgBufCacheQueryStats (
+    __in PCSG_BUFCACHE Cache,
+    __out PCSG_BUFCACHE_STATS Stats
+    )
+/*++
+
+Routine Description:
+
+    Sums the counters of all magazines and the depot.  The counters keep
+    moving while this runs, so the result is a close snapshot, not an
+    exact one.
+
+Arguments:
+
+    Cache - The cache.
+
+    Stats - Receives the counters.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG cls;
+    ULONG cpu;
+
+    RtlZeroMemory( Stats, sizeof(CSG_BUFCACHE_STATS) );
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        for (cpu = 0; cpu < Cache->CpuCount; cpu++) {
+
+            Stats->Hits[cls] += Cache->Magazines[cpu].Hits[cls];
+            Stats->Cached[cls] += Cache->Magazines[cpu].Count[cls];
+        }
+
+        Stats->Hits[cls] += Cache->Depot[cls].Hits;
+        Stats->Misses[cls] = Cache->Depot[cls].Misses;
+        Stats->Cached[cls] += Cache->Depot[cls].Count;
+    }
+
+    Stats->Oversize = (ULONGLONG)Cache->Oversize;
+    Stats->Trimmed = (ULONGLONG)Cache->Trimmed;
+}
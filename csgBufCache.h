@@ -0,0 +1,131 @@
+#ifndef __CSG_BUFCACHE_H__
+#define __CSG_BUFCACHE_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Size classed buffer cache
+*************************************************************************/
+
+//
+//  Buffers come in power of two size classes from 4K to 1M.  Larger
+//  requests bypass the cache and go straight to the allocator.
+//
+
+#define CSG_BUFCACHE_MIN_SHIFT  12
+#define CSG_BUFCACHE_MAX_SHIFT  20
+#define CSG_BUFCACHE_CLASSES    (CSG_BUFCACHE_MAX_SHIFT - CSG_BUFCACHE_MIN_SHIFT + 1)
+
+#define CSG_BUFCACHE_MAX_SIZE   ((SIZE_T)1 << CSG_BUFCACHE_MAX_SHIFT)
+
+//
+//  Where the memory really comes from.  Both callbacks may be called at
+//  DISPATCH_LEVEL, never with a cache lock held.
+//
+//  The cache does not look inside what the allocator returns, except that
+//  it borrows the first pointer of an object while the object sits in the
+//  cache.  So an object may be a bare buffer or a descriptor of one (see
+//  csgSwapDesc.h), as long as it starts with a pointer's worth of space
+//  nobody else uses while it is free.
+//
+
+typedef PVOID
+(*PCSG_BUFCACHE_ALLOCATE) (
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    );
+
+typedef VOID
+(*PCSG_BUFCACHE_FREE) (
+    __in PVOID Buffer,
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    );
+
+typedef struct _CSG_BUFCACHE_STATS {
+
+    //
+    //  Requests served from a per-CPU magazine or the depot.
+    //
+
+    ULONGLONG Hits[CSG_BUFCACHE_CLASSES];
+
+    //
+    //  Requests that had to go to the allocator.
+    //
+
+    ULONGLONG Misses[CSG_BUFCACHE_CLASSES];
+
+    //
+    //  Requests too large for any class.
+    //
+
+    ULONGLONG Oversize;
+
+    //
+    //  Buffers handed back to the allocator by trims, by aging and when
+    //  the bound was lowered.
+    //
+
+    ULONGLONG Trimmed;
+
+    //
+    //  Buffers the cache holds right now.
+    //
+
+    ULONG Cached[CSG_BUFCACHE_CLASSES];
+
+} CSG_BUFCACHE_STATS, *PCSG_BUFCACHE_STATS;
+
+typedef struct _CSG_BUFCACHE CSG_BUFCACHE, *PCSG_BUFCACHE;
+
+NTSTATUS
+csgBufCacheCreate (
+    __in SIZE_T ClassBytes,
+    __in PCSG_BUFCACHE_ALLOCATE Allocate,
+    __in PCSG_BUFCACHE_FREE Free,
+    __in_opt PVOID Context,
+    __out PCSG_BUFCACHE *Cache
+    );
+
+VOID
+csgBufCacheDestroy (
+    __in PCSG_BUFCACHE Cache
+    );
+
+PVOID
+csgBufCacheAllocate (
+    __in PCSG_BUFCACHE Cache,
+    __in SIZE_T Size
+    );
+
+VOID
+csgBufCacheFree (
+    __in PCSG_BUFCACHE Cache,
+    __in PVOID Buffer,
+    __in SIZE_T Size
+    );
+
+SIZE_T
+csgBufCacheTrim (
+    __in PCSG_BUFCACHE Cache
+    );
+
+SIZE_T
+csgBufCacheAge (
+    __in PCSG_BUFCACHE Cache
+    );
+
+VOID
+csgBufCacheSetClassBytes (
+    __in PCSG_BUFCACHE Cache,
+    __in SIZE_T ClassBytes
+    );
+
+VOID
+csgBufCacheQueryStats (
+    __in PCSG_BUFCACHE Cache,
+    __out PCSG_BUFCACHE_STATS Stats
+    );
+
+#endif // __CSG_BUFCACHE_H__
@@ -0,0 +1,101 @@
+#ifndef __CSG_CAPTURE_H__
+#define __CSG_CAPTURE_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    I/O capture files
+*************************************************************************/
+
+//
+//  A capture is the sequence of reads, writes and directory queries that
+//  reached the filter, taken from the IO_* trace events (csgTraceEvents.h)
+//  by csgctl capture and replayed through the driver's callbacks by the
+//  simulation's csgreplay.  The file is a CSG_CAPTURE_HEADER followed by
+//  RecordCount fixed size records in time order, so a reader can map it
+//  and index the records directly.  No data is captured, only where the
+//  I/O went and how it was sent.
+//
+//  Files and threads are numbered in the order they first appear; the
+//  pointers and ids they had in the captured system are not kept.
+//
+
+#define CSG_CAPTURE_MAGIC       0x43475343      // 'CSGC'
+#define CSG_CAPTURE_VERSION     1
+
+typedef struct _CSG_CAPTURE_HEADER {
+
+    ULONG Magic;
+
+    USHORT Version;
+
+    //
+    //  sizeof(CSG_CAPTURE_RECORD) when the file was written; readers step
+    //  through the records by it.
+    //
+
+    USHORT RecordSize;
+
+    ULONG FileCount;
+
+    ULONG ThreadCount;
+
+    ULONGLONG RecordCount;
+
+    //
+    //  Timestamp units per second, for Time.
+    //
+
+    ULONGLONG TimestampFrequency;
+
+} CSG_CAPTURE_HEADER, *PCSG_CAPTURE_HEADER;
+
+//
+//  How the operation was sent.
+//
+
+#define CSG_CAPTURE_NOCACHE         0x0001  // IRP_NOCACHE
+#define CSG_CAPTURE_PAGING          0x0002  // IRP_PAGING_IO
+#define CSG_CAPTURE_FAST_IO         0x0004  // fast I/O rather than an IRP
+#define CSG_CAPTURE_SYSTEM_BUFFER   0x0008  // the buffer was a system buffer
+
+typedef struct _CSG_CAPTURE_RECORD {
+
+    //
+    //  Timestamp units since the first record.
+    //
+
+    ULONGLONG Time;
+
+    //
+    //  Byte offset of a read or write.
+    //
+
+    LONGLONG Offset;
+
+    ULONG Length;
+
+    ULONG File;
+
+    USHORT Thread;
+
+    //
+    //  IRP_MJ_READ, IRP_MJ_WRITE or IRP_MJ_DIRECTORY_CONTROL, and for the
+    //  last, the minor function, FILE_INFORMATION_CLASS and SL_* flags.
+    //
+
+    UCHAR MajorFunction;
+
+    UCHAR MinorFunction;
+
+    UCHAR InformationClass;
+
+    UCHAR OperationFlags;
+
+    USHORT Flags;
+
+} CSG_CAPTURE_RECORD, *PCSG_CAPTURE_RECORD;
+
+typedef CONST CSG_CAPTURE_RECORD *PCCSG_CAPTURE_RECORD;
+
+#endif // __CSG_CAPTURE_H__
@@ -0,0 +1,721 @@
+/*++
+
+Module Name:
+
+    csgComm.c
+
+Abstract:
+
+    The statistics section and the control port csgctl talks to.
+
+    The counters live in a pagefile backed section.  The driver maps it in
+    system space, locks it and writes through the MDL's system address, so
+    counting is safe at DISPATCH_LEVEL.  csgctl asks over the control port
+    (csgControl.h) for a read only view of the same pages and then polls
+    them without any further round trips.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "csgComm.h"
+#include "csgConfig.h"
+#include "csgControl.h"
+
+typedef struct _CSG_COMM_DATA {
+
+    //
+    //  The statistics section, its view in system space and the MDL that
+    //  locks that view.
+    //
+
+    HANDLE StatsSection;
+
+    PVOID StatsSectionObject;
+
+    PVOID StatsView;
+
+    SIZE_T StatsSize;
+
+    PMDL StatsMdl;
+
+    //
+    //  The control port and the one client connected to it, if any.
+    //
+
+    PFLT_FILTER Filter;
+
+    PFLT_PORT ServerPort;
+
+    PFLT_PORT ClientPort;
+
+} CSG_COMM_DATA;
+
+static CSG_COMM_DATA Comm;
+
+static NTSTATUS
+ControlConnect (
+    __in PFLT_PORT ClientPort,
+    __in_opt PVOID ServerPortCookie,
+    __in_bcount_opt(SizeOfContext) PVOID ConnectionContext,
+    __in ULONG SizeOfContext,
+    __deref_out_opt PVOID *ConnectionPortCookie
+    );
+
+static VOID
+ControlDisconnect (
+    __in_opt PVOID ConnectionCookie
+    );
+
+static NTSTATUS
+ControlMessage (
+    __in_opt PVOID PortCookie,
+    __in_bcount_opt(InputBufferLength) PVOID InputBuffer,
+    __in ULONG InputBufferLength,
+    __out_bcount_part_opt(OutputBufferLength,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    );
+
+static NTSTATUS
+ControlMapStatistics (
+    __out PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    );
+
+static NTSTATUS
+ControlReadTrace (
+    __in ULONG Ring,
+    __out PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, csgCreateStatistics)
+#pragma alloc_text(PAGE, csgDeleteStatistics)
+#pragma alloc_text(INIT, csgOpenControlPort)
+#pragma alloc_text(PAGE, csgCloseControlPort)
+#pragma alloc_text(PAGE, ControlConnect)
+#pragma alloc_text(PAGE, ControlDisconnect)
+#pragma alloc_text(PAGE, ControlMessage)
+#pragma alloc_text(PAGE, ControlMapStatistics)
+#pragma alloc_text(PAGE, ControlReadTrace)
+#endif
+
+
+NTSTATUS
+csgCreateStatistics (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates the statistics section with a block of counters per processor
+    and points StatsCpu at the blocks.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    LARGE_INTEGER maximumSize;
+    SIZE_T viewSize = 0;
+    PCSG_STATS stats;
+    ULONG cpuCount = csgCpuCount();
+    NTSTATUS status;
+
+    Comm.StatsSize = csgStatsSize( cpuCount );
+    maximumSize.QuadPart = Comm.StatsSize;
+
+    InitializeObjectAttributes( &attributes,
+                                NULL,
+                                OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
+
+    try {
+
+        status = ZwCreateSection( &Comm.StatsSection,
+                                  SECTION_ALL_ACCESS,
+                                  &attributes,
+                                  &maximumSize,
+                                  PAGE_READWRITE,
+                                  SEC_COMMIT,
+                                  NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            Comm.StatsSection = NULL;
+            leave;
+        }
+
+        status = ObReferenceObjectByHandle( Comm.StatsSection,
+                                            SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                            NULL,
+                                            KernelMode,
+                                            &Comm.StatsSectionObject,
+                                            NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            Comm.StatsSectionObject = NULL;
+            leave;
+        }
+
+        status = MmMapViewInSystemSpace( Comm.StatsSectionObject,
+                                         &Comm.StatsView,
+                                         &viewSize );
+
+        if (!NT_SUCCESS( status )) {
+
+            Comm.StatsView = NULL;
+            leave;
+        }
+
+        //
+        //  The view is pageable.  Lock it, and count through the MDL's
+        //  system address, which stays valid at any IRQL.
+        //
+
+        Comm.StatsMdl = IoAllocateMdl( Comm.StatsView,
+                                       (ULONG)Comm.StatsSize,
+                                       FALSE,
+                                       FALSE,
+                                       NULL );
+
+        if (Comm.StatsMdl == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        try {
+
+            MmProbeAndLockPages( Comm.StatsMdl,
+                                 KernelMode,
+                                 IoWriteAccess );
+
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+
+            status = GetExceptionCode();
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            IoFreeMdl( Comm.StatsMdl );
+            Comm.StatsMdl = NULL;
+            leave;
+        }
+
+        stats = MmGetSystemAddressForMdlSafe( Comm.StatsMdl,
+                                              NormalPagePriority );
+
+        if (stats == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        //
+        //  A new section is zero filled, so only the header needs to be
+        //  set.
+        //
+
+        csgStatsInitialize( stats,
+                            cpuCount,
+                            g_Global.TimestampFrequency );
+
+        StatsCpu = csgStatsCpu( stats, 0 );
+        StatsCpuCount = cpuCount;
+
+    } finally {
+
+        if (!NT_SUCCESS( status )) {
+
+            csgDeleteStatistics();
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+csgDeleteStatistics (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Releases whatever csgCreateStatistics set up.  Views csgctl still has
+    keep the pages alive until it unmaps them.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    StatsCpu = NULL;
+    StatsCpuCount = 0;
+
+    if (Comm.StatsMdl != NULL) {
+
+        if (FlagOn( Comm.StatsMdl->MdlFlags, MDL_PAGES_LOCKED )) {
+
+            MmUnlockPages( Comm.StatsMdl );
+        }
+
+        IoFreeMdl( Comm.StatsMdl );
+        Comm.StatsMdl = NULL;
+    }
+
+    if (Comm.StatsView != NULL) {
+
+        MmUnmapViewInSystemSpace( Comm.StatsView );
+        Comm.StatsView = NULL;
+    }
+
+    if (Comm.StatsSectionObject != NULL) {
+
+        ObDereferenceObject( Comm.StatsSectionObject );
+        Comm.StatsSectionObject = NULL;
+    }
+
+    if (Comm.StatsSection != NULL) {
+
+        ZwClose( Comm.StatsSection );
+        Comm.StatsSection = NULL;
+    }
+}
+
+
+NTSTATUS
+csgOpenControlPort (
+    __in PFLT_FILTER Filter
+    )
+/*++
+
+Routine Description:
+
+    Creates the control port.  Only administrators and the system may
+    connect, one client at a time.
+
+Arguments:
+
+    Filter - Our filter handle.
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+{
+    PSECURITY_DESCRIPTOR securityDescriptor;
+    OBJECT_ATTRIBUTES attributes;
+    UNICODE_STRING portName;
+    NTSTATUS status;
+
+    Comm.Filter = Filter;
+
+    status = FltBuildDefaultSecurityDescriptor( &securityDescriptor,
+                                                FLT_PORT_ALL_ACCESS );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    RtlInitUnicodeString( &portName, CSG_CONTROL_PORT_NAME );
+
+    InitializeObjectAttributes( &attributes,
+                                &portName,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                securityDescriptor );
+
+    status = FltCreateCommunicationPort( Filter,
+                                         &Comm.ServerPort,
+                                         &attributes,
+                                         NULL,
+                                         ControlConnect,
+                                         ControlDisconnect,
+                                         ControlMessage,
+                                         1 );
+
+    FltFreeSecurityDescriptor( securityDescriptor );
+
+    if (!NT_SUCCESS( status )) {
+
+        Comm.ServerPort = NULL;
+    }
+
+    return status;
+}
+
+
+VOID
+csgCloseControlPort (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Closes the control port.  A connected client is disconnected when the
+    filter is unregistered.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Comm.ServerPort != NULL) {
+
+        FltCloseCommunicationPort( Comm.ServerPort );
+        Comm.ServerPort = NULL;
+    }
+}
+
+
+static NTSTATUS
+ControlConnect (
+    __in PFLT_PORT ClientPort,
+    __in_opt PVOID ServerPortCookie,
+    __in_bcount_opt(SizeOfContext) PVOID ConnectionContext,
+    __in ULONG SizeOfContext,
+    __deref_out_opt PVOID *ConnectionPortCookie
+    )
+/*++
+
+Routine Description:
+
+    Accepts a connection to the control port.
+
+Arguments:
+
+    ClientPort - The new client's port.
+
+    ServerPortCookie, ConnectionContext, SizeOfContext - Unused.
+
+    ConnectionPortCookie - Receives NULL; there is only ever one client.
+
+Return Value:
+
+    STATUS_SUCCESS
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( ServerPortCookie );
+    UNREFERENCED_PARAMETER( ConnectionContext );
+    UNREFERENCED_PARAMETER( SizeOfContext );
+
+    ASSERT( Comm.ClientPort == NULL );
+
+    Comm.ClientPort = ClientPort;
+    *ConnectionPortCookie = NULL;
+
+    return STATUS_SUCCESS;
+}
+
+
+static VOID
+ControlDisconnect (
+    __in_opt PVOID ConnectionCookie
+    )
+/*++
+
+Routine Description:
+
+    Closes our end of a client's connection.  Views of the statistics
+    section it mapped are its own and stay.
+
+Arguments:
+
+    ConnectionCookie - Unused.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( ConnectionCookie );
+
+    FltCloseClientPort( Comm.Filter, &Comm.ClientPort );
+}
+
+
+static NTSTATUS
+ControlMessage (
+    __in_opt PVOID PortCookie,
+    __in_bcount_opt(InputBufferLength) PVOID InputBuffer,
+    __in ULONG InputBufferLength,
+    __out_bcount_part_opt(OutputBufferLength,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Carries out a CSG_CONTROL_* command.  Called at PASSIVE_LEVEL in the
+    context of the client's thread; both buffers are the client's.
+
+Arguments:
+
+    PortCookie - Unused.
+
+    InputBuffer - The CSG_CONTROL_MESSAGE.
+
+    InputBufferLength - Its size.
+
+    OutputBuffer - Receives the command's output, if any.
+
+    OutputBufferLength - Its size.
+
+    ReturnOutputBufferLength - Receives the number of bytes returned.
+
+Return Value:
+
+    Status of the command.
+
+--*/
+{
+    CSG_CONTROL_MESSAGE message;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( PortCookie );
+
+    *ReturnOutputBufferLength = 0;
+
+    if (InputBuffer == NULL || InputBufferLength < sizeof(CSG_CONTROL_MESSAGE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    try {
+
+        if (ExGetPreviousMode() == UserMode) {
+
+            ProbeForRead( InputBuffer, sizeof(CSG_CONTROL_MESSAGE), sizeof(ULONG) );
+        }
+
+        RtlCopyMemory( &message, InputBuffer, sizeof(CSG_CONTROL_MESSAGE) );
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        return GetExceptionCode();
+    }
+
+    switch (message.Command) {
+
+        case CSG_CONTROL_MAP_STATISTICS:
+
+            return ControlMapStatistics( OutputBuffer,
+                                         OutputBufferLength,
+                                         ReturnOutputBufferLength );
+
+        case CSG_CONTROL_SET_STAGE_TIMING:
+
+            g_Global.StageTiming = (BOOLEAN)(message.Argument != 0);
+            return STATUS_SUCCESS;
+
+        case CSG_CONTROL_SET_DEBUG_FLAGS:
+
+            g_Global.DebugFlags = message.Argument;
+            return STATUS_SUCCESS;
+
+        case CSG_CONTROL_READ_TRACE:
+
+            return ControlReadTrace( message.Argument,
+                                     OutputBuffer,
+                                     OutputBufferLength,
+                                     ReturnOutputBufferLength );
+
+        case CSG_CONTROL_RELOAD_CONFIG:
+
+            return csgConfigReload();
+
+        default:
+
+            return STATUS_INVALID_PARAMETER;
+    }
+}
+
+
+static NTSTATUS
+ControlMapStatistics (
+    __out PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Maps a read only view of the statistics section into the calling
+    process.  The driver never reads anything back from the section, so
+    nothing the client does to its view can mislead it.
+
+Arguments:
+
+    OutputBuffer - Receives a CSG_CONTROL_MAP_REPLY.
+
+    OutputBufferLength - Its size.
+
+    ReturnOutputBufferLength - Receives the size of the reply.
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+{
+    CSG_CONTROL_MAP_REPLY reply;
+    PVOID base = NULL;
+    SIZE_T viewSize = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (OutputBuffer == NULL || OutputBufferLength < sizeof(CSG_CONTROL_MAP_REPLY)) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    status = ZwMapViewOfSection( Comm.StatsSection,
+                                 ZwCurrentProcess(),
+                                 &base,
+                                 0,
+                                 0,
+                                 NULL,
+                                 &viewSize,
+                                 ViewUnmap,
+                                 0,
+                                 PAGE_READONLY );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    reply.Address = (ULONGLONG)(ULONG_PTR)base;
+    reply.Size = Comm.StatsSize;
+
+    try {
+
+        if (ExGetPreviousMode() == UserMode) {
+
+            ProbeForWrite( OutputBuffer, sizeof(CSG_CONTROL_MAP_REPLY), sizeof(ULONG) );
+        }
+
+        RtlCopyMemory( OutputBuffer, &reply, sizeof(CSG_CONTROL_MAP_REPLY) );
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        ZwUnmapViewOfSection( ZwCurrentProcess(), base );
+
+        return GetExceptionCode();
+    }
+
+    *ReturnOutputBufferLength = sizeof(CSG_CONTROL_MAP_REPLY);
+
+    return STATUS_SUCCESS;
+}
+
+
+static NTSTATUS
+ControlReadTrace (
+    __in ULONG Ring,
+    __out PVOID OutputBuffer,
+    __in ULONG OutputBufferLength,
+    __out PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Copies the records of one trace ring to the client.
+
+Arguments:
+
+    Ring - Which ring.
+
+    OutputBuffer - Receives the records.
+
+    OutputBufferLength - Its size.
+
+    ReturnOutputBufferLength - Receives the size of the records copied.
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+{
+    ULONG count;
+
+    PAGED_CODE();
+
+    if (Ring >= csgTraceRingCount( TraceRing )) {
+
+        return STATUS_NO_MORE_ENTRIES;
+    }
+
+    if (OutputBuffer == NULL || OutputBufferLength < sizeof(CSG_TRACE_RECORD)) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    try {
+
+        if (ExGetPreviousMode() == UserMode) {
+
+            ProbeForWrite( OutputBuffer, OutputBufferLength, sizeof(ULONG) );
+        }
+
+        count = csgTraceSnapshot( TraceRing,
+                                  Ring,
+                                  (PCSG_TRACE_RECORD)OutputBuffer,
+                                  OutputBufferLength / sizeof(CSG_TRACE_RECORD) );
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        return GetExceptionCode();
+    }
+
+    *ReturnOutputBufferLength = count * sizeof(CSG_TRACE_RECORD);
+
+    return STATUS_SUCCESS;
+}
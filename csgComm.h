@@ -0,0 +1,30 @@
+#ifndef __CSG_COMM_H__
+#define __CSG_COMM_H__
+
+
+#include "csgGlobal.h"
+#include "csgStruct.h"
+
+
+NTSTATUS
+csgCreateStatistics (
+    VOID
+    );
+
+VOID
+csgDeleteStatistics (
+    VOID
+    );
+
+NTSTATUS
+csgOpenControlPort (
+    __in PFLT_FILTER Filter
+    );
+
+VOID
+csgCloseControlPort (
+    VOID
+    );
+
+
+#endif // __CSG_COMM_H__
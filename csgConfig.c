@@ -0,0 +1,974 @@
+/*++
+
+Module Name:
+
+    csgConfig.c
+
+Abstract:
+
+    Reading the driver's parameters into a configuration, and replacing
+    the configuration while the driver runs.
+
+    A configuration (CSG_CONFIG) is built complete, published with one
+    pointer store and never written again.  The I/O paths read it inside
+    grace period read sections (csgRcu.h), which take no lock, so a reload
+    never holds them up; the old configuration is freed only once every
+    section that could have seen it has ended.
+
+    What decides how data already on disk reads back is fixed for as long
+    as the driver runs: the ProtectedExtensions list, the cipher and the
+    CipherKey, WrappingKey and MasterKey.  Open streams were classified,
+    and the data written with those keys, under the configuration they
+    came from, so a reload that changes any of them is refused and the
+    driver must be restarted to change them.  Everything else may be
+    reloaded freely.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "csgConfig.h"
+
+extern PCSG_BUFCACHE SwapBufferCache;
+extern PCSG_KEYCACHE FileKeyCache;
+
+//
+//  Default bound on the swap buffers each size class keeps in the buffer
+//  cache, per-CPU magazines and depot together.
+//
+
+#define DEFAULT_SWAP_CACHE_BYTES    (8 * 1024 * 1024)
+
+//
+//  Default size from which noncached writes are enciphered by the crypto
+//  workers rather than on the thread that issued them.
+//
+
+#define DEFAULT_OFFLOAD_THRESHOLD   (256 * 1024)
+
+//
+//  Default size from which noncached reads are deciphered in chunks by
+//  the crypto workers and the completing thread together.
+//
+
+#define DEFAULT_PARALLEL_READ_THRESHOLD (1024 * 1024)
+
+typedef struct _CSG_CONFIG_DATA {
+
+    //
+    //  Our copy of the service key path; the one DriverEntry gets does
+    //  not outlive it.
+    //
+
+    UNICODE_STRING RegistryPath;
+
+    //
+    //  Serializes reloads, which csgRcuSynchronize requires.
+    //
+
+    FAST_MUTEX Lock;
+
+    ULONG Version;
+
+    ULONG MasterKeyGeneration;
+
+} CSG_CONFIG_DATA;
+
+static CSG_CONFIG_DATA ConfigData;
+
+static NTSTATUS
+csgConfigRead (
+    __out PCSG_CONFIG *Config
+    );
+
+static BOOLEAN
+csgConfigReadDword (
+    __in HANDLE DriverRegKey,
+    __in PCWSTR Name,
+    __out PULONG Value
+    );
+
+static VOID
+csgConfigReadKeys (
+    __in HANDLE DriverRegKey,
+    __inout PCSG_CONFIG Config
+    );
+
+static VOID
+csgConfigReadExtensions (
+    __in HANDLE DriverRegKey,
+    __inout PCSG_CONFIG Config
+    );
+
+static BOOLEAN
+csgConfigSamePolicy (
+    __in PCCSG_CONFIG Current,
+    __in PCCSG_CONFIG Config
+    );
+
+static VOID
+csgConfigPublish (
+    __in PCSG_CONFIG Config
+    );
+
+static VOID
+csgConfigFree (
+    __in PCSG_CONFIG Config
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, csgConfigInitialize)
+#pragma alloc_text(PAGE, csgConfigReload)
+#pragma alloc_text(PAGE, csgConfigCleanup)
+#pragma alloc_text(PAGE, csgConfigRead)
+#pragma alloc_text(PAGE, csgConfigReadDword)
+#pragma alloc_text(PAGE, csgConfigReadKeys)
+#pragma alloc_text(PAGE, csgConfigReadExtensions)
+#pragma alloc_text(PAGE, csgConfigSamePolicy)
+#pragma alloc_text(PAGE, csgConfigPublish)
+#pragma alloc_text(PAGE, csgConfigFree)
+#endif
+
+
+NTSTATUS
+csgConfigInitialize (
+    __in PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Description:
+
+    Reads and publishes the first configuration.  Must come after
+    ReadDriverParameters, which the cipher selection depends on, and
+    before anything looks at g_Global.Config.
+
+Arguments:
+
+    RegistryPath - The driver's service key.
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+{
+    PCSG_CONFIG config;
+    NTSTATUS status;
+
+    ExInitializeFastMutex( &ConfigData.Lock );
+
+    ConfigData.RegistryPath.Buffer = ExAllocatePoolWithTag( PagedPool,
+                                                            RegistryPath->Length,
+                                                            CONFIG_TAG );
+
+    if (ConfigData.RegistryPath.Buffer == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ConfigData.RegistryPath.MaximumLength = RegistryPath->Length;
+    RtlCopyUnicodeString( &ConfigData.RegistryPath, RegistryPath );
+
+    status = csgRcuCreate( &g_Global.ConfigRcu );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    status = csgConfigRead( &config );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    csgConfigPublish( config );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+csgConfigReload (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Reads the driver's parameters again and replaces the configuration.
+    Returns once the old configuration is gone, which waits for the reads
+    in flight that use it.  Called at PASSIVE_LEVEL.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status of the operation.  On failure the configuration is unchanged.
+
+    STATUS_INVALID_DEVICE_STATE - the parameters change the protected
+        extensions, the cipher or a key (csgConfigSamePolicy)
+
+--*/
+{
+    PCSG_CONFIG config;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    ExAcquireFastMutex( &ConfigData.Lock );
+
+    status = csgConfigRead( &config );
+
+    if (NT_SUCCESS( status ) &&
+        !csgConfigSamePolicy( g_Global.Config, config )) {
+
+        LOG_PRINT(LOGFL_ERRORS, ("Configuration %u changes the protected extensions, cipher or keys, reload refused\n",
+                                 config->Version));
+
+        csgConfigFree( config );
+
+        status = STATUS_INVALID_DEVICE_STATE;
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        csgConfigPublish( config );
+    }
+
+    ExReleaseFastMutex( &ConfigData.Lock );
+
+    return status;
+}
+
+
+VOID
+csgConfigCleanup (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Frees the configuration and whatever csgConfigInitialize set up.  No
+    reader may be left.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (g_Global.Config != NULL) {
+
+        csgConfigFree( g_Global.Config );
+        g_Global.Config = NULL;
+    }
+
+    if (g_Global.ConfigRcu != NULL) {
+
+        csgRcuDestroy( g_Global.ConfigRcu );
+        g_Global.ConfigRcu = NULL;
+    }
+
+    if (ConfigData.RegistryPath.Buffer != NULL) {
+
+        ExFreePoolWithTag( ConfigData.RegistryPath.Buffer, CONFIG_TAG );
+        ConfigData.RegistryPath.Buffer = NULL;
+    }
+}
+
+
+static NTSTATUS
+csgConfigRead (
+    __out PCSG_CONFIG *Config
+    )
+/*++
+
+Routine Description:
+
+    Builds a configuration from the driver's parameters.  Parameters that
+    are missing or malformed keep their defaults, as does everything when
+    the key cannot be opened.
+
+Arguments:
+
+    Config - Receives the configuration.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+    STATUS_INVALID_PARAMETER - the parameters ask for CTR without a
+        ProtectedExtensions list
+
+--*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE driverRegKey = NULL;
+    PCSG_CONFIG config;
+    ULONG value;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    //  The read paths use the expanded keys at DISPATCH_LEVEL.
+    //
+
+    config = ExAllocatePoolWithTag( NonPagedPoolCacheAligned,
+                                    sizeof(CSG_CONFIG),
+                                    CONFIG_TAG );
+
+    if (config == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( config, sizeof(CSG_CONFIG) );
+
+    config->Version = ++ConfigData.Version;
+    config->DebugFlags = LOGFL_ERRORS | LOGFL_READ | LOGFL_WRITE | LOGFL_DIRCTRL | LOGFL_VOLCTX | LOGFL_CREATE;    // open all
+    config->CipherAlgorithm = CSG_CIPHER_XTS;
+    config->SwapCacheBytes = DEFAULT_SWAP_CACHE_BYTES;
+    config->OffloadThreshold = DEFAULT_OFFLOAD_THRESHOLD;
+    config->ParallelReadThreshold = DEFAULT_PARALLEL_READ_THRESHOLD;
+
+    InitializeObjectAttributes( &attributes,
+                &ConfigData.RegistryPath,
+                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                NULL,
+                NULL );
+
+    status = ZwOpenKey( &driverRegKey,
+            KEY_READ,
+            &attributes );
+
+    if (!NT_SUCCESS( status )) {
+
+        LOG_PRINT(LOGFL_ERRORS, ("ZwOpenKey Error Code: 0x%x\n", status));
+
+        driverRegKey = NULL;
+    }
+
+    if (driverRegKey != NULL) {
+
+        csgConfigReadDword( driverRegKey, L"DebugFlags", &config->DebugFlags );
+
+        if (csgConfigReadDword( driverRegKey, L"NoncachedOnly", &value )) {
+
+            config->NoncachedOnly = (value != 0);
+        }
+
+        if (csgConfigReadDword( driverRegKey, L"LockUserBuffers", &value )) {
+
+            config->LockUserBuffers = (value != 0);
+        }
+
+        if (csgConfigReadDword( driverRegKey, L"SwapCacheBytes", &value )) {
+
+            config->SwapCacheBytes = value;
+        }
+
+        csgConfigReadDword( driverRegKey, L"OffloadThreshold", &config->OffloadThreshold );
+        csgConfigReadDword( driverRegKey, L"ParallelReadThreshold", &config->ParallelReadThreshold );
+
+        //
+        //  CipherAlgorithm picks the cipher policy, XTS unless told
+        //  otherwise.
+        //
+
+        csgConfigReadDword( driverRegKey, L"CipherAlgorithm", &config->CipherAlgorithm );
+
+        csgConfigReadExtensions( driverRegKey, config );
+    }
+
+    //
+    //  The provider is picked here, once per configuration; the I/O paths
+    //  just call it.
+    //
+
+    config->CipherTransform = csgProviderSelect( config->CipherAlgorithm,
+                                                 g_Global.CpuFeatures );
+
+    if (driverRegKey != NULL) {
+
+        csgConfigReadKeys( driverRegKey, config );
+
+        ZwClose( driverRegKey );
+    }
+
+    //
+    //  CTR reuses keystream wherever a position is enciphered twice, so it
+    //  is only safe under a key and nonce of each file's own.  Without a
+    //  ProtectedExtensions list there are no file keys, and the volume
+    //  key would encipher every file with the same keystream.
+    //
+
+    if ((config->CipherAlgorithm == CSG_CIPHER_CTR) &&
+        (config->ProtectedExtensionCount == 0)) {
+
+        LOG_PRINT(LOGFL_ERRORS, ("CipherAlgorithm CTR needs ProtectedExtensions, configuration refused\n"));
+
+        csgConfigFree( config );
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  Keys derived under the current configuration stay good unless the
+    //  master key changed.  Reloads are serialized, so the current
+    //  configuration cannot go away under us.
+    //
+
+    if ((g_Global.Config == NULL) ||
+        (g_Global.Config->MasterKeyPresent != config->MasterKeyPresent) ||
+        !RtlEqualMemory( g_Global.Config->MasterKeyPrk,
+                         config->MasterKeyPrk,
+                         sizeof(config->MasterKeyPrk) )) {
+
+        ConfigData.MasterKeyGeneration++;
+    }
+
+    config->MasterKeyGeneration = ConfigData.MasterKeyGeneration;
+
+    if (!config->CipherEnabled) {
+
+        LOG_PRINT(LOGFL_ERRORS, ("No usable CipherKey, data will not be enciphered\n"));
+    }
+
+    LOG_PRINT(LOGFL_ERRORS, ("Configuration %u: DebugFlags : 0x%x, CipherEnabled : %d, CpuFeatures : 0x%x\n",
+                             config->Version,
+                             config->DebugFlags,
+                             config->CipherEnabled,
+                             g_Global.CpuFeatures));
+
+    *Config = config;
+
+    return STATUS_SUCCESS;
+}
+
+
+static BOOLEAN
+csgConfigReadDword (
+    __in HANDLE DriverRegKey,
+    __in PCWSTR Name,
+    __out PULONG Value
+    )
+/*++
+
+Routine Description:
+
+    Reads a REG_DWORD parameter.
+
+Arguments:
+
+    DriverRegKey - The driver's service key.
+
+    Name - The value's name.
+
+    Value - Receives the value; untouched if it cannot be read.
+
+Return Value:
+
+    TRUE if Value was set.
+
+--*/
+{
+    UNICODE_STRING valueName;
+    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
+    PKEY_VALUE_PARTIAL_INFORMATION partial = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    ULONG resultLength;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    RtlInitUnicodeString( &valueName, Name );
+
+    status = ZwQueryValueKey( DriverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                buffer,
+                sizeof(buffer),
+                &resultLength );
+
+    if (!NT_SUCCESS( status ) || (partial->DataLength != sizeof(ULONG))) {
+
+        return FALSE;
+    }
+
+    *Value = *((PULONG) &partial->Data);
+
+    return TRUE;
+}
+
+
+static VOID
+csgConfigReadKeys (
+    __in HANDLE DriverRegKey,
+    __inout PCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Reads the volume key for the configuration's cipher policy, the
+    wrapping key and the master key, and expands them into the
+    configuration.
+
+Arguments:
+
+    DriverRegKey - The driver's service key.
+
+    Config - The configuration being built.
+
+Return Value:
+
+    None.  A key that is missing or malformed is left unset.
+
+--*/
+{
+    UNICODE_STRING valueName;
+    UCHAR keyBuffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + CSG_XTS_KEY_SIZE];
+    PKEY_VALUE_PARTIAL_INFORMATION keyValue = (PKEY_VALUE_PARTIAL_INFORMATION)keyBuffer;
+    ULONG resultLength;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    //  The volume key is a REG_BINARY value.  For XTS it is 64 bytes, the
+    //  data key followed by the tweak key; for CTR it is 40 bytes, the key
+    //  followed by the nonce.  If it is missing or malformed we still
+    //  load, but only swap buffers.
+    //
+
+    RtlInitUnicodeString( &valueName, L"CipherKey" );
+
+    status = ZwQueryValueKey( DriverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                keyBuffer,
+                sizeof(keyBuffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (keyValue->Type == REG_BINARY) &&
+        (Config->CipherAlgorithm == CSG_CIPHER_XTS) &&
+        (keyValue->DataLength == CSG_XTS_KEY_SIZE)) {
+
+        status = csgXtsSetKey( &Config->XtsKey, keyValue->Data );
+
+        Config->CipherTransformKey = &Config->XtsKey;
+        Config->CipherEnabled = NT_SUCCESS( status );
+
+    } else if (NT_SUCCESS( status ) &&
+               (keyValue->Type == REG_BINARY) &&
+               (Config->CipherAlgorithm == CSG_CIPHER_CTR) &&
+               (keyValue->DataLength == CSG_CTR_KEY_SIZE)) {
+
+        status = csgCtrSetKey( &Config->CtrKey, keyValue->Data );
+
+        Config->CipherTransformKey = &Config->CtrKey;
+        Config->CipherEnabled = NT_SUCCESS( status );
+    }
+
+    RtlSecureZeroMemory( keyBuffer, sizeof(keyBuffer) );
+
+    //
+    //  WrappingKey is the AES-256 key the file keys in protected files'
+    //  headers are wrapped under.
+    //
+
+    RtlInitUnicodeString( &valueName, L"WrappingKey" );
+
+    status = ZwQueryValueKey( DriverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                keyBuffer,
+                sizeof(keyBuffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (keyValue->Type == REG_BINARY) &&
+        (keyValue->DataLength == CSG_AES_MAX_KEY_SIZE)) {
+
+        status = csgAesSetKey( &Config->WrappingKey,
+                               keyValue->Data,
+                               CSG_AES_MAX_KEY_SIZE );
+
+        Config->WrappingKeyPresent = NT_SUCCESS( status );
+    }
+
+    RtlSecureZeroMemory( keyBuffer, sizeof(keyBuffer) );
+
+    //
+    //  MasterKey is the 256 bit key file keys are derived from.  Only the
+    //  HKDF pseudorandom key extracted from it is kept.
+    //
+
+    RtlInitUnicodeString( &valueName, L"MasterKey" );
+
+    status = ZwQueryValueKey( DriverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                keyBuffer,
+                sizeof(keyBuffer),
+                &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (keyValue->Type == REG_BINARY) &&
+        (keyValue->DataLength == CSG_SHA256_DIGEST_SIZE)) {
+
+        csgHkdfExtract( NULL,
+                        0,
+                        keyValue->Data,
+                        CSG_SHA256_DIGEST_SIZE,
+                        Config->MasterKeyPrk );
+
+        Config->MasterKeyPresent = TRUE;
+    }
+
+    RtlSecureZeroMemory( keyBuffer, sizeof(keyBuffer) );
+}
+
+
+static BOOLEAN
+csgConfigSamePolicy (
+    __in PCCSG_CONFIG Current,
+    __in PCCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Decides whether a configuration read on a reload keeps what the data
+    on disk and the open streams depend on: the same ProtectedExtensions,
+    in any order and any case, the same cipher, and the same volume, wrapping and
+    master keys.  Keys are compared expanded, which is the same as
+    comparing them as configured.
+
+Arguments:
+
+    Current - The configuration in effect.  Reloads are serialized, so it
+        cannot go away under us.
+
+    Config - The configuration just read.
+
+Return Value:
+
+    TRUE if Config may replace Current.
+
+--*/
+{
+    PCCSG_CONFIG from;
+    PCCSG_CONFIG to;
+    ULONG pass;
+    ULONG i;
+    ULONG j;
+
+    PAGED_CODE();
+
+    if ((Current->CipherAlgorithm != Config->CipherAlgorithm) ||
+        (Current->CipherEnabled != Config->CipherEnabled) ||
+        (Current->WrappingKeyPresent != Config->WrappingKeyPresent) ||
+        (Current->MasterKeyPresent != Config->MasterKeyPresent) ||
+        (Current->ProtectedExtensionCount != Config->ProtectedExtensionCount)) {
+
+        return FALSE;
+    }
+
+    if (Config->CipherEnabled &&
+        (!RtlEqualMemory( &Current->XtsKey, &Config->XtsKey, sizeof(Config->XtsKey) ) ||
+         !RtlEqualMemory( &Current->CtrKey, &Config->CtrKey, sizeof(Config->CtrKey) ))) {
+
+        return FALSE;
+    }
+
+    if (Config->WrappingKeyPresent &&
+        !RtlEqualMemory( &Current->WrappingKey, &Config->WrappingKey, sizeof(Config->WrappingKey) )) {
+
+        return FALSE;
+    }
+
+    if (Config->MasterKeyPresent &&
+        !RtlEqualMemory( Current->MasterKeyPrk, Config->MasterKeyPrk, sizeof(Config->MasterKeyPrk) )) {
+
+        return FALSE;
+    }
+
+    //
+    //  Each list must hold every extension of the other.
+    //
+
+    for (pass = 0; pass < 2; pass++) {
+
+        from = (pass == 0) ? Config : Current;
+        to = (pass == 0) ? Current : Config;
+
+        for (i = 0; i < from->ProtectedExtensionCount; i++) {
+
+            for (j = 0; j < to->ProtectedExtensionCount; j++) {
+
+                if (RtlEqualUnicodeString( &from->ProtectedExtensions[i],
+                                           &to->ProtectedExtensions[j],
+                                           TRUE )) {
+
+                    break;
+                }
+            }
+
+            if (j == to->ProtectedExtensionCount) {
+
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+csgConfigReadExtensions (
+    __in HANDLE DriverRegKey,
+    __inout PCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Reads the ProtectedExtensions parameter, a REG_MULTI_SZ of file
+    extensions with or without the leading dot, into the configuration.
+    The strings and the array describing them share one paged allocation.
+
+Arguments:
+
+    DriverRegKey - The driver's service key.
+
+    Config - The configuration being built.
+
+Return Value:
+
+    None.  Without a usable list every file is protected.
+
+--*/
+{
+    UNICODE_STRING valueName;
+    PKEY_VALUE_PARTIAL_INFORMATION value = NULL;
+    PUNICODE_STRING extensions;
+    PWCHAR chars;
+    PWCHAR next;
+    PWCHAR end;
+    ULONG resultLength;
+    ULONG count;
+    ULONG i;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    RtlInitUnicodeString( &valueName, L"ProtectedExtensions" );
+
+    status = ZwQueryValueKey( DriverRegKey,
+                &valueName,
+                KeyValuePartialInformation,
+                NULL,
+                0,
+                &resultLength );
+
+    if ((status != STATUS_BUFFER_TOO_SMALL) && (status != STATUS_BUFFER_OVERFLOW)) {
+
+        return;
+    }
+
+    value = ExAllocatePoolWithTag( PagedPool, resultLength, NAME_TAG );
+
+    if (value == NULL) {
+
+        return;
+    }
+
+    try {
+
+        status = ZwQueryValueKey( DriverRegKey,
+                    &valueName,
+                    KeyValuePartialInformation,
+                    value,
+                    resultLength,
+                    &resultLength );
+
+        if (!NT_SUCCESS( status ) || (value->Type != REG_MULTI_SZ)) {
+
+            leave;
+        }
+
+        //
+        //  Count the non empty strings, then copy them after an array of
+        //  UNICODE_STRINGs describing them.
+        //
+
+        end = (PWCHAR)value->Data + value->DataLength / sizeof(WCHAR);
+        count = 0;
+
+        for (next = (PWCHAR)value->Data; next < end && *next != UNICODE_NULL; next++) {
+
+            count++;
+
+            while (next < end && *next != UNICODE_NULL) {
+
+                next++;
+            }
+        }
+
+        if (count == 0) {
+
+            leave;
+        }
+
+        extensions = ExAllocatePoolWithTag( PagedPool,
+                                            count * sizeof(UNICODE_STRING) + value->DataLength,
+                                            NAME_TAG );
+
+        if (extensions == NULL) {
+
+            leave;
+        }
+
+        chars = (PWCHAR)(extensions + count);
+        RtlCopyMemory( chars, value->Data, value->DataLength );
+        end = chars + value->DataLength / sizeof(WCHAR);
+
+        for (i = 0, next = chars; i < count; i++) {
+
+            if (*next == L'.') {
+
+                next++;
+            }
+
+            extensions[i].Buffer = next;
+
+            while (next < end && *next != UNICODE_NULL) {
+
+                next++;
+            }
+
+            extensions[i].Length = (USHORT)((next - extensions[i].Buffer) * sizeof(WCHAR));
+            extensions[i].MaximumLength = extensions[i].Length;
+
+            LOG_PRINT(LOGFL_CREATE, ("Protected extension : %wZ\n", &extensions[i]));
+
+            next++;
+        }
+
+        Config->ProtectedExtensions = extensions;
+        Config->ProtectedExtensionCount = count;
+
+    } finally {
+
+        ExFreePoolWithTag( value, NAME_TAG );
+    }
+}
+
+
+static VOID
+csgConfigPublish (
+    __in PCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Makes a configuration the current one and frees the one it replaces
+    after a grace period.  Callers are serialized.
+
+Arguments:
+
+    Config - The new configuration.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_CONFIG oldConfig = g_Global.Config;
+
+    PAGED_CODE();
+
+    csgStoreReleasePointer( &g_Global.Config, Config );
+
+    g_Global.DebugFlags = Config->DebugFlags;
+
+    if (SwapBufferCache != NULL) {
+
+        csgBufCacheSetClassBytes( SwapBufferCache, Config->SwapCacheBytes );
+    }
+
+    if (oldConfig != NULL) {
+
+        csgRcuSynchronize( g_Global.ConfigRcu );
+
+        //
+        //  Keys derived from a master key no longer configured would never
+        //  be looked up again; do not keep them around.  An open that
+        //  still had the old configuration may cache one more, which only
+        //  waits for eviction.
+        //
+
+        if ((FileKeyCache != NULL) &&
+            (oldConfig->MasterKeyGeneration != Config->MasterKeyGeneration)) {
+
+            csgKeyCacheFlush( FileKeyCache );
+        }
+
+        csgConfigFree( oldConfig );
+    }
+}
+
+
+static VOID
+csgConfigFree (
+    __in PCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Wipes the keys of a configuration no one can see any more and frees
+    it.
+
+Arguments:
+
+    Config - The configuration.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    csgXtsClearKey( &Config->XtsKey );
+    csgCtrClearKey( &Config->CtrKey );
+    csgAesClearKey( &Config->WrappingKey );
+    RtlSecureZeroMemory( Config->MasterKeyPrk, sizeof(Config->MasterKeyPrk) );
+
+    if (Config->ProtectedExtensions != NULL) {
+
+        ExFreePoolWithTag( Config->ProtectedExtensions, NAME_TAG );
+    }
+
+    ExFreePoolWithTag( Config, CONFIG_TAG );
+}
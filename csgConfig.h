@@ -0,0 +1,25 @@
+#ifndef __CSG_CONFIG_H__
+#define __CSG_CONFIG_H__
+
+
+#include "csgGlobal.h"
+#include "csgStruct.h"
+
+
+NTSTATUS
+csgConfigInitialize (
+    __in PUNICODE_STRING RegistryPath
+    );
+
+NTSTATUS
+csgConfigReload (
+    VOID
+    );
+
+VOID
+csgConfigCleanup (
+    VOID
+    );
+
+
+#endif // __CSG_CONFIG_H__
@@ -0,0 +1,82 @@
+#ifndef __CSG_CONTROL_H__
+#define __CSG_CONTROL_H__
+
+/*************************************************************************
+    Control port protocol
+*************************************************************************/
+
+//
+//  Messages csgctl sends the driver through its filter communication port.
+//  Shared by the driver and csgctl; include it after fltKernel.h,
+//  windows.h or csgPort.h, whichever defines the base types.
+//
+//  The port admits one connection at a time, from administrators only.
+//  Every message is a CSG_CONTROL_MESSAGE; what comes back in the output
+//  buffer depends on the command.
+//
+
+#define CSG_CONTROL_PORT_NAME       L"\\CsgControlPort"
+
+//
+//  Maps the statistics section (csgStats.h) read only into the caller's
+//  address space.  Output: CSG_CONTROL_MAP_REPLY.  The view stays until
+//  the caller unmaps it or exits; counters can then be polled without
+//  further messages.
+//
+
+#define CSG_CONTROL_MAP_STATISTICS  1
+
+//
+//  Turns stage timing off (Argument zero) or on.  No output.
+//
+
+#define CSG_CONTROL_SET_STAGE_TIMING 2
+
+//
+//  Replaces the DebugFlags (LOGFL_*) with Argument.  No output.
+//
+
+#define CSG_CONTROL_SET_DEBUG_FLAGS 3
+
+//
+//  Copies the newest complete trace records (csgTrace.h) of ring
+//  Argument, oldest first.  Output: as many CSG_TRACE_RECORDs as fit; the
+//  reply length says how many came back.  Fails with
+//  STATUS_NO_MORE_ENTRIES for a ring past the last.
+//
+
+#define CSG_CONTROL_READ_TRACE      4
+
+//
+//  Reads the driver's parameters again and puts the new configuration in
+//  effect; returns once the old one is no longer in use.  Replaces any
+//  DebugFlags set with CSG_CONTROL_SET_DEBUG_FLAGS.  Parameters that
+//  change the protected extensions, the cipher or a key are refused with
+//  STATUS_INVALID_DEVICE_STATE, leaving the configuration as it was; they
+//  take a restart of the driver.  No output.
+//
+
+#define CSG_CONTROL_RELOAD_CONFIG   5
+
+typedef struct _CSG_CONTROL_MESSAGE {
+
+    ULONG Command;
+
+    ULONG Argument;
+
+} CSG_CONTROL_MESSAGE, *PCSG_CONTROL_MESSAGE;
+
+typedef struct _CSG_CONTROL_MAP_REPLY {
+
+    //
+    //  Address of the view in the caller, and its size in bytes.  64 bits
+    //  wide so a 32-bit csgctl talks to a 64-bit driver unchanged.
+    //
+
+    ULONGLONG Address;
+
+    ULONGLONG Size;
+
+} CSG_CONTROL_MAP_REPLY, *PCSG_CONTROL_MAP_REPLY;
+
+#endif // __CSG_CONTROL_H__
@@ -0,0 +1,280 @@
+/*++
+
+Module Name:
+
+    csgCpu.c
+
+Abstract:
+
+    Processor feature detection for the cipher kernels.  It runs once,
+    when the driver loads; nothing on the I/O path asks the processor
+    what it supports.
+
+    Also the user mode versions of the processor count and number the
+    per-CPU caches use; the kernel gets these from Ke routines.  And the
+    calibration of the timestamp counter against a clock of known rate.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#if defined(CSG_USER_MODE) && defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(CSG_USER_MODE)
+#include <time.h>
+#endif
+
+#include "csgCpu.h"
+
+//
+//  XCR0 bits for the register state the wide kernels touch.
+//
+
+#define CSG_XCR0_YMM    0x06
+#define CSG_XCR0_ZMM    0xe0
+
+//
+//  How long the timestamp counter is measured for, in microseconds.
+//
+
+#define CSG_CALIBRATION_US  10000
+
+
+ULONG
+csgCpuQueryFeatures (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Reports the CSG_CPU_* features this processor and OS support.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    A mask of CSG_CPU_* bits.  Always zero on non-x64 builds.
+
+--*/
+{
+    ULONG features = 0;
+
+#ifdef CSG_ARCH_AMD64
+    ULONG leaf1[4];
+    ULONG leaf7[4];
+    ULONGLONG xcr0 = 0;
+
+    csgCpuid( 0, 0, leaf1 );
+
+    if (leaf1[0] >= 7) {
+
+        csgCpuid( 7, 0, leaf7 );
+
+    } else {
+
+        RtlZeroMemory( leaf7, sizeof(leaf7) );
+    }
+
+    csgCpuid( 1, 0, leaf1 );
+
+    if (leaf1[2] & (1UL << 25)) {
+
+        features |= CSG_CPU_AESNI;
+    }
+
+    if (leaf1[2] & (1UL << 1)) {
+
+        features |= CSG_CPU_PCLMULQDQ;
+    }
+
+    if (leaf7[1] & (1UL << 29)) {
+
+        features |= CSG_CPU_SHANI;
+    }
+
+    //
+    //  Everything else needs the OS to save the wider registers.
+    //
+
+    if (leaf1[2] & (1UL << 27)) {
+
+        xcr0 = csgReadXcr0();
+    }
+
+    if ((xcr0 & CSG_XCR0_YMM) == CSG_XCR0_YMM) {
+
+        if (leaf7[1] & (1UL << 5)) {
+
+            features |= CSG_CPU_AVX2;
+        }
+
+        if (leaf7[2] & (1UL << 9)) {
+
+            features |= CSG_CPU_VAES;
+        }
+
+        if (((xcr0 & CSG_XCR0_ZMM) == CSG_XCR0_ZMM) &&
+            (leaf7[1] & (1UL << 16))) {
+
+            features |= CSG_CPU_AVX512;
+        }
+    }
+#endif
+
+    return features;
+}
+
+
+ULONGLONG
+csgTimestampFrequency (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Measures how fast csgReadTimestamp counts.  On x64 it reads the time
+    stamp counter, which is timed here against the performance counter
+    (the C runtime clock in user mode) for CSG_CALIBRATION_US.  Elsewhere
+    it reads a clock whose rate is already known.
+
+    Kernel callers must be at PASSIVE_LEVEL; it busy waits.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Timestamp units per second.
+
+--*/
+{
+#if defined(CSG_ARCH_AMD64) && defined(CSG_USER_MODE)
+    struct timespec start;
+    struct timespec now;
+    ULONGLONG startTicks;
+    ULONGLONG elapsed;
+
+    timespec_get( &start, TIME_UTC );
+    startTicks = csgReadTimestamp();
+
+    do {
+
+        timespec_get( &now, TIME_UTC );
+
+        elapsed = (ULONGLONG)(now.tv_sec - start.tv_sec) * 1000000000ULL +
+                  (ULONGLONG)now.tv_nsec - (ULONGLONG)start.tv_nsec;
+
+    } while (elapsed < CSG_CALIBRATION_US * 1000ULL);
+
+    return (csgReadTimestamp() - startTicks) * 1000000000ULL / elapsed;
+
+#elif defined(CSG_ARCH_AMD64)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG startTicks;
+    ULONGLONG endTicks;
+
+    start = KeQueryPerformanceCounter( &frequency );
+    startTicks = csgReadTimestamp();
+
+    KeStallExecutionProcessor( CSG_CALIBRATION_US );
+
+    endTicks = csgReadTimestamp();
+    end = KeQueryPerformanceCounter( NULL );
+
+    if (end.QuadPart <= start.QuadPart) {
+
+        return 0;
+    }
+
+    return (endTicks - startTicks) * (ULONGLONG)frequency.QuadPart /
+           (ULONGLONG)(end.QuadPart - start.QuadPart);
+
+#elif defined(CSG_USER_MODE)
+    return 1000000000ULL;
+
+#else
+    LARGE_INTEGER frequency;
+
+    KeQueryPerformanceCounter( &frequency );
+
+    return (ULONGLONG)frequency.QuadPart;
+#endif
+}
+
+#ifdef CSG_USER_MODE
+
+ULONG
+csgCpuCount (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of processors that may run our threads.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The processor count, at least 1.
+
+--*/
+{
+#ifdef __linux__
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return (n > 0) ? (ULONG)n : 1;
+#else
+    return 1;
+#endif
+}
+
+
+ULONG
+csgCurrentCpu (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of the processor the caller is running on.  The
+    thread may move at any time, so this is only a hint for spreading
+    load.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The processor number.
+
+--*/
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+
+    return (cpu >= 0) ? (ULONG)cpu : 0;
+#else
+    return 0;
+#endif
+}
+
+#endif // CSG_USER_MODE
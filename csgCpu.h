@@ -0,0 +1,58 @@
+#ifndef __CSG_CPU_H__
+#define __CSG_CPU_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Processor features the cipher kernels depend on
+*************************************************************************/
+
+//
+//  A feature is only reported when the processor has it and, for the
+//  ones that use YMM or ZMM registers, the OS saves that register state.
+//
+
+#define CSG_CPU_AESNI       0x00000001
+#define CSG_CPU_PCLMULQDQ   0x00000002
+#define CSG_CPU_AVX2        0x00000004
+#define CSG_CPU_VAES        0x00000008
+#define CSG_CPU_AVX512      0x00000010
+#define CSG_CPU_SHANI       0x00000020
+
+#define CSG_CPU_ALL         0x0000003f
+
+ULONG
+csgCpuQueryFeatures (
+    VOID
+    );
+
+/*************************************************************************
+    Timestamps
+*************************************************************************/
+
+//
+//  csgReadTimestamp (csgPort.h) counts in units of its own.  Measure how
+//  many make a second once, at load, and convert with the result.
+//
+
+ULONGLONG
+csgTimestampFrequency (
+    VOID
+    );
+
+CSG_INLINE ULONGLONG
+csgTimestampToNanoseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    )
+{
+    if (Frequency == 0) {
+
+        return 0;
+    }
+
+    return (Ticks / Frequency) * 1000000000ULL +
+           (Ticks % Frequency) * 1000000000ULL / Frequency;
+}
+
+#endif // __CSG_CPU_H__
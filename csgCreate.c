@@ -0,0 +1,316 @@
+#include "csgCreate.h"
+#include "csgGlobal.h"
+#include "csgStruct.h"
+#include "csgStream.h"
+#include "csgDirWalk.h"
+
+static BOOLEAN
+csgIsProtectedName (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PCCSG_CONFIG Config,
+    __out PULONGLONG NameHash
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, csgPostCreate)
+#pragma alloc_text(PAGE, csgIsProtectedName)
+#endif
+
+
+FLT_POSTOP_CALLBACK_STATUS
+csgPostCreate(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in_opt PVOID CompletionContext,
+    __in FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    Decides once, when a stream is opened, whether the driver protects it,
+    and if so attaches a stream context to it and loads the stream's header
+    into it.  The read and write paths look for that context and leave
+    every other stream alone.
+
+    With no ProtectedExtensions list every file is protected and nothing
+    needs to be recorded.
+
+    A stream is classified by the name it is first opened by; renaming it
+    later does not change its class until every handle is closed.  An open
+    that overwrites or supersedes the stream empties it, header and all,
+    so it classifies the stream again as if it were new.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Unused.
+
+    Flags - Denotes whether the completion is successful or is being drained.
+
+Return Value:
+
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
+
+--*/
+{
+    PSTREAM_CONTEXT streamCtx = NULL;
+    PSTREAM_CONTEXT oldCtx = NULL;
+    BOOLEAN isDirectory;
+    ULONGLONG nameHash;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    PAGED_CODE();
+
+    //
+    //  The stream is classified, and its header loaded, under a single
+    //  configuration.
+    //
+
+    config = ConfigReadLock( &configCookie );
+
+    if (config->ProtectedExtensionCount == 0 ||
+        FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING ) ||
+        !NT_SUCCESS( Data->IoStatus.Status ) ||
+        (Data->IoStatus.Status == STATUS_REPARSE)) {
+
+        ConfigReadUnlock( configCookie );
+
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    try {
+
+        //
+        //  Volume opens, paging files and directories are never protected.
+        //
+
+        if (FlagOn( FltObjects->FileObject->Flags, FO_VOLUME_OPEN ) ||
+            FlagOn( Data->Iopb->OperationFlags, SL_OPEN_PAGING_FILE )) {
+
+            leave;
+        }
+
+        status = FltIsDirectory( FltObjects->FileObject,
+                                 FltObjects->Instance,
+                                 &isDirectory );
+
+        if (!NT_SUCCESS( status ) || isDirectory) {
+
+            leave;
+        }
+
+        //
+        //  Another open of the stream may have classified it already, or
+        //  be loading its header right now.
+        //
+
+        status = FltGetStreamContext( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &oldCtx );
+
+        if (NT_SUCCESS( status )) {
+
+            KeWaitForSingleObject( &oldCtx->Loaded,
+                                   Executive,
+                                   KernelMode,
+                                   FALSE,
+                                   NULL );
+
+            if ((Data->IoStatus.Information != FILE_OVERWRITTEN) &&
+                (Data->IoStatus.Information != FILE_SUPERSEDED)) {
+
+                leave;
+            }
+
+            FltDeleteContext( oldCtx );
+            FltReleaseContext( oldCtx );
+            oldCtx = NULL;
+        }
+
+        if (!csgIsProtectedName( Data, config, &nameHash )) {
+
+            leave;
+        }
+
+        if (!config->WrappingKeyPresent && !config->MasterKeyPresent) {
+
+            CSG_TRACE1( CREATE_NO_KEY,
+                        FltObjects->FileObject );
+
+            leave;
+        }
+
+        status = FltAllocateContext( FltObjects->Filter,
+                                     FLT_STREAM_CONTEXT,
+                                     sizeof(STREAM_CONTEXT),
+                                     NonPagedPool,
+                                     &streamCtx );
+
+        if (!NT_SUCCESS( status )) {
+
+            CSG_TRACE1( CREATE_NO_CONTEXT,
+                        (ULONG)status );
+
+            streamCtx = NULL;
+            leave;
+        }
+
+        RtlZeroMemory( streamCtx, sizeof(STREAM_CONTEXT) );
+
+        FltInitializePushLock( &streamCtx->SizeLock );
+        KeInitializeEvent( &streamCtx->Loaded, NotificationEvent, FALSE );
+        streamCtx->LoadStatus = STATUS_PENDING;
+        streamCtx->NameHash = nameHash;
+
+        //
+        //  If a racing open got there first, wait for it to load the
+        //  header rather than read it twice.
+        //
+
+        status = FltSetStreamContext( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                                      streamCtx,
+                                      &oldCtx );
+
+        if (status == STATUS_FLT_CONTEXT_ALREADY_DEFINED) {
+
+            KeWaitForSingleObject( &oldCtx->Loaded,
+                                   Executive,
+                                   KernelMode,
+                                   FALSE,
+                                   NULL );
+            leave;
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            CSG_TRACE1( CREATE_SET_FAILED,
+                        (ULONG)status );
+
+            leave;
+        }
+
+        status = csgStreamLoadHeader( FltObjects, streamCtx, config );
+
+        //
+        //  Publish the result before waking the waiters; the I/O paths
+        //  only look at LoadStatus.
+        //
+
+        InterlockedExchange( &streamCtx->LoadStatus, status );
+        KeSetEvent( &streamCtx->Loaded, IO_NO_INCREMENT, FALSE );
+
+        if (!NT_SUCCESS( status )) {
+
+            FltDeleteContext( streamCtx );
+        }
+
+        CSG_TRACE3( CREATE_PROTECTED,
+                    FltObjects->FileObject,
+                    NT_SUCCESS( status ),
+                    (ULONG)status );
+
+    } finally {
+
+        if (oldCtx != NULL) {
+
+            FltReleaseContext( oldCtx );
+        }
+
+        if (streamCtx != NULL) {
+
+            FltReleaseContext( streamCtx );
+        }
+
+        ConfigReadUnlock( configCookie );
+    }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+
+static BOOLEAN
+csgIsProtectedName (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PCCSG_CONFIG Config,
+    __out PULONGLONG NameHash
+    )
+/*++
+
+Routine Description:
+
+    Checks the extension of the file being opened against the
+    ProtectedExtensions list.
+
+Arguments:
+
+    Data - The create being completed.
+
+    Config - The configuration holding the list.
+
+    NameHash - Receives the hash of the file's normalized name
+        (csgDirWalkHashName), or zero.
+
+Return Value:
+
+    TRUE if the file is protected.
+
+--*/
+{
+    PFLT_FILE_NAME_INFORMATION nameInfo;
+    BOOLEAN isProtected = FALSE;
+    NTSTATUS status;
+    ULONG i;
+
+    PAGED_CODE();
+
+    *NameHash = 0;
+
+    status = FltGetFileNameInformation( Data,
+                                        FLT_FILE_NAME_NORMALIZED |
+                                            FLT_FILE_NAME_QUERY_DEFAULT,
+                                        &nameInfo );
+
+    if (!NT_SUCCESS( status )) {
+
+        return FALSE;
+    }
+
+    status = FltParseFileNameInformation( nameInfo );
+
+    if (NT_SUCCESS( status )) {
+
+        for (i = 0; i < Config->ProtectedExtensionCount; i++) {
+
+            if (RtlEqualUnicodeString( &nameInfo->Extension,
+                                       &Config->ProtectedExtensions[i],
+                                       TRUE )) {
+
+                isProtected = TRUE;
+                break;
+            }
+        }
+    }
+
+    if (isProtected) {
+
+        *NameHash = csgDirWalkHashName( CSG_DIR_NAME_HASH_SEED,
+                                        (CONST UCHAR *)nameInfo->Name.Buffer,
+                                        nameInfo->Name.Length );
+    }
+
+    FltReleaseFileNameInformation( nameInfo );
+
+    return isProtected;
+}
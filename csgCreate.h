@@ -0,0 +1,18 @@
+#ifndef __CSG_POST_CREATE_H__
+#define __CSG_POST_CREATE_H__
+
+
+#include "csgGlobal.h"
+#include "csgStruct.h"
+
+
+FLT_POSTOP_CALLBACK_STATUS
+csgPostCreate(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in_opt PVOID CompletionContext,
+    __in FLT_POST_OPERATION_FLAGS Flags
+    );
+
+
+#endif // __CSG_POST_CREATE_H__
@@ -0,0 +1,502 @@
+/*++
+
+Module Name:
+
+    csgCtr.c
+
+Abstract:
+
+    AES-CTR keystream for large sequential reads and writes.  The counter
+    block for the 16 bytes at file position P is
+
+        LE64(P / 16) || LE64(Nonce)
+
+    so any block of the file can be produced without reference to its
+    neighbours, and the same routine both enciphers and deciphers.  Because
+    the counter depends only on the position, rewriting a block reuses its
+    keystream; this mode trades that for throughput and is meant for
+    policies covering bulk media and backup data, with XTS as the default.
+
+    The VAES kernels run 16 (YMM) or 32 (ZMM) blocks per iteration.  They
+    need the extended register state saved in kernel mode, which costs more
+    than it gains on small transfers, so they only take runs of at least
+    CSG_CTR_WIDE_MIN bytes and leave the tail to the AES-NI kernel.  The
+    portable kernel feeds the constant-time cipher in csgAes.c four
+    counters at a time.  csgProvider.c decides which kernel a volume uses.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgCtr.h"
+
+#define CSG_CTR_WIDE_MIN    (16 * 1024)
+
+/*************************************************************************
+    Portable implementation
+*************************************************************************/
+
+//
+//  Number of counter blocks the portable kernel enciphers at once.
+//
+
+#define CSG_CTR_CT_BLOCKS   4
+
+VOID
+csgCtrCryptGeneric (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    XORs the keystream into a run of data; enciphering and deciphering are
+    the same operation.  In and Out may be the same buffer, but must not
+    otherwise overlap.
+
+Arguments:
+
+    Key - The expanded key.
+
+    BlockIndex - File position of the first byte divided by the AES block
+        size.
+
+    In - The input.
+
+    Out - Receives the output.
+
+    Length - Number of bytes; need not be a multiple of the block size.
+
+Return Value:
+
+    None
+
+--*/
+{
+    UCHAR ks[CSG_CTR_CT_BLOCKS * CSG_AES_BLOCK_SIZE];
+    SIZE_T chunk;
+    SIZE_T i;
+    ULONG b;
+
+    while (Length > 0) {
+
+        chunk = (Length < sizeof(ks)) ? Length : sizeof(ks);
+
+        for (b = 0; b < CSG_CTR_CT_BLOCKS; b++) {
+
+            for (i = 0; i < 8; i++) {
+
+                ks[16 * b + i] = (UCHAR)((BlockIndex + b) >> (8 * i));
+                ks[16 * b + i + 8] = (UCHAR)(Key->Nonce >> (8 * i));
+            }
+        }
+
+        csgAesEncryptBlocks( &Key->Key,
+                             ks,
+                             ks,
+                             (chunk + CSG_AES_BLOCK_SIZE - 1) / CSG_AES_BLOCK_SIZE );
+
+        for (i = 0; i < chunk; i++) {
+
+            Out[i] = In[i] ^ ks[i];
+        }
+
+        In += chunk;
+        Out += chunk;
+        Length -= chunk;
+        BlockIndex += CSG_CTR_CT_BLOCKS;
+    }
+
+    csgSecureZeroMemory( ks, sizeof(ks) );
+}
+
+#ifdef CSG_ARCH_AMD64
+
+/*************************************************************************
+    AES-NI implementation
+*************************************************************************/
+
+#define CSG_CTR_FOR_LANES(_m)   _m(0) _m(1) _m(2) _m(3) _m(4) _m(5) _m(6) _m(7)
+
+#define CSG_CTR_INIT_XMM(_l)                                                    \
+    b##_l = _mm_xor_si128( _mm_add_epi64( ctr, _mm_set_epi64x( 0, (_l) ) ), k );
+#define CSG_CTR_ENC_XMM(_l)     b##_l = _mm_aesenc_si128( b##_l, k );
+#define CSG_CTR_LAST_XMM(_l)    b##_l = _mm_aesenclast_si128( b##_l, k );
+#define CSG_CTR_XOR_XMM(_l)                                                     \
+    _mm_storeu_si128( (__m128i *)Out + (_l),                                    \
+                      _mm_xor_si128( b##_l, _mm_loadu_si128( (CONST __m128i *)In + (_l) ) ) );
+
+CSG_TARGET("aes") VOID
+csgCtrCryptAesNi (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    AES-NI version of csgCtrCryptGeneric.  Only call this when the
+    processor supports AES-NI.
+
+Arguments:
+
+    See csgCtrCryptGeneric.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CONST __m128i *rk = (CONST __m128i *)Key->Key.EncRoundKeys;
+    ULONG rounds = Key->Key.Rounds;
+    __m128i ctr = _mm_set_epi64x( (LONGLONG)Key->Nonce, (LONGLONG)BlockIndex );
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+    __m128i k;
+    ULONG r;
+    UCHAR tail[CSG_AES_BLOCK_SIZE];
+    SIZE_T i;
+
+    while (Length >= 8 * CSG_AES_BLOCK_SIZE) {
+
+        k = rk[0];
+        CSG_CTR_FOR_LANES( CSG_CTR_INIT_XMM )
+
+        for (r = 1; r < rounds; r++) {
+
+            k = rk[r];
+            CSG_CTR_FOR_LANES( CSG_CTR_ENC_XMM )
+        }
+
+        k = rk[rounds];
+        CSG_CTR_FOR_LANES( CSG_CTR_LAST_XMM )
+
+        CSG_CTR_FOR_LANES( CSG_CTR_XOR_XMM )
+
+        ctr = _mm_add_epi64( ctr, _mm_set_epi64x( 0, 8 ) );
+        In += 8 * CSG_AES_BLOCK_SIZE;
+        Out += 8 * CSG_AES_BLOCK_SIZE;
+        Length -= 8 * CSG_AES_BLOCK_SIZE;
+    }
+
+    while (Length > 0) {
+
+        b0 = _mm_xor_si128( ctr, rk[0] );
+
+        for (r = 1; r < rounds; r++) {
+
+            b0 = _mm_aesenc_si128( b0, rk[r] );
+        }
+
+        b0 = _mm_aesenclast_si128( b0, rk[rounds] );
+
+        if (Length >= CSG_AES_BLOCK_SIZE) {
+
+            _mm_storeu_si128( (__m128i *)Out,
+                              _mm_xor_si128( b0, _mm_loadu_si128( (CONST __m128i *)In ) ) );
+
+            In += CSG_AES_BLOCK_SIZE;
+            Out += CSG_AES_BLOCK_SIZE;
+            Length -= CSG_AES_BLOCK_SIZE;
+
+        } else {
+
+            _mm_storeu_si128( (__m128i *)tail, b0 );
+
+            for (i = 0; i < Length; i++) {
+
+                Out[i] = In[i] ^ tail[i];
+            }
+
+            csgSecureZeroMemory( tail, sizeof(tail) );
+            Length = 0;
+        }
+
+        ctr = _mm_add_epi64( ctr, _mm_set_epi64x( 0, 1 ) );
+    }
+}
+
+/*************************************************************************
+    VAES implementations
+*************************************************************************/
+
+//
+//  Both wide kernels process as many whole iterations as fit and return
+//  the number of bytes done.
+//
+
+#define CSG_CTR_INIT_YMM(_l)                                                    \
+    b##_l = _mm256_xor_si256( _mm256_add_epi64( ctr, _mm256_set_epi64x( 0, 2 * (_l), 0, 2 * (_l) ) ), k );
+#define CSG_CTR_ENC_YMM(_l)     b##_l = _mm256_aesenc_epi128( b##_l, k );
+#define CSG_CTR_LAST_YMM(_l)    b##_l = _mm256_aesenclast_epi128( b##_l, k );
+#define CSG_CTR_XOR_YMM(_l)                                                     \
+    _mm256_storeu_si256( (__m256i *)Out + (_l),                                 \
+                         _mm256_xor_si256( b##_l, _mm256_loadu_si256( (CONST __m256i *)In + (_l) ) ) );
+
+static CSG_TARGET("vaes,avx2") SIZE_T
+csgCtrVaes256Kernel (
+    PCCSG_CTR_KEY Key,
+    ULONGLONG BlockIndex,
+    CONST UCHAR *In,
+    UCHAR *Out,
+    SIZE_T Length
+    )
+{
+    CONST __m128i *rk = (CONST __m128i *)Key->Key.EncRoundKeys;
+    ULONG rounds = Key->Key.Rounds;
+    __m256i ctr;
+    __m256i b0, b1, b2, b3, b4, b5, b6, b7;
+    __m256i k;
+    SIZE_T done = 0;
+    ULONG r;
+
+    //
+    //  Each YMM register holds two consecutive counter blocks.
+    //
+
+    ctr = _mm256_broadcastsi128_si256( _mm_set_epi64x( (LONGLONG)Key->Nonce, (LONGLONG)BlockIndex ) );
+    ctr = _mm256_add_epi64( ctr, _mm256_set_epi64x( 0, 1, 0, 0 ) );
+
+    while (Length - done >= 16 * CSG_AES_BLOCK_SIZE) {
+
+        k = _mm256_broadcastsi128_si256( rk[0] );
+        CSG_CTR_FOR_LANES( CSG_CTR_INIT_YMM )
+
+        for (r = 1; r < rounds; r++) {
+
+            k = _mm256_broadcastsi128_si256( rk[r] );
+            CSG_CTR_FOR_LANES( CSG_CTR_ENC_YMM )
+        }
+
+        k = _mm256_broadcastsi128_si256( rk[rounds] );
+        CSG_CTR_FOR_LANES( CSG_CTR_LAST_YMM )
+
+        CSG_CTR_FOR_LANES( CSG_CTR_XOR_YMM )
+
+        ctr = _mm256_add_epi64( ctr, _mm256_set_epi64x( 0, 16, 0, 16 ) );
+        In += 16 * CSG_AES_BLOCK_SIZE;
+        Out += 16 * CSG_AES_BLOCK_SIZE;
+        done += 16 * CSG_AES_BLOCK_SIZE;
+    }
+
+    return done;
+}
+
+#define CSG_CTR_INIT_ZMM(_l)                                                    \
+    b##_l = _mm512_xor_si512( _mm512_add_epi64( ctr, _mm512_set_epi64( 0, 4 * (_l), 0, 4 * (_l), 0, 4 * (_l), 0, 4 * (_l) ) ), k );
+#define CSG_CTR_ENC_ZMM(_l)     b##_l = _mm512_aesenc_epi128( b##_l, k );
+#define CSG_CTR_LAST_ZMM(_l)    b##_l = _mm512_aesenclast_epi128( b##_l, k );
+#define CSG_CTR_XOR_ZMM(_l)                                                     \
+    _mm512_storeu_si512( (__m512i *)Out + (_l),                                 \
+                         _mm512_xor_si512( b##_l, _mm512_loadu_si512( (CONST __m512i *)In + (_l) ) ) );
+
+static CSG_TARGET("vaes,avx512f") SIZE_T
+csgCtrVaes512Kernel (
+    PCCSG_CTR_KEY Key,
+    ULONGLONG BlockIndex,
+    CONST UCHAR *In,
+    UCHAR *Out,
+    SIZE_T Length
+    )
+{
+    CONST __m128i *rk = (CONST __m128i *)Key->Key.EncRoundKeys;
+    ULONG rounds = Key->Key.Rounds;
+    __m512i ctr;
+    __m512i b0, b1, b2, b3, b4, b5, b6, b7;
+    __m512i k;
+    SIZE_T done = 0;
+    ULONG r;
+
+    //
+    //  Each ZMM register holds four consecutive counter blocks.
+    //
+
+    ctr = _mm512_broadcast_i32x4( _mm_set_epi64x( (LONGLONG)Key->Nonce, (LONGLONG)BlockIndex ) );
+    ctr = _mm512_add_epi64( ctr, _mm512_set_epi64( 0, 3, 0, 2, 0, 1, 0, 0 ) );
+
+    while (Length - done >= 32 * CSG_AES_BLOCK_SIZE) {
+
+        k = _mm512_broadcast_i32x4( rk[0] );
+        CSG_CTR_FOR_LANES( CSG_CTR_INIT_ZMM )
+
+        for (r = 1; r < rounds; r++) {
+
+            k = _mm512_broadcast_i32x4( rk[r] );
+            CSG_CTR_FOR_LANES( CSG_CTR_ENC_ZMM )
+        }
+
+        k = _mm512_broadcast_i32x4( rk[rounds] );
+        CSG_CTR_FOR_LANES( CSG_CTR_LAST_ZMM )
+
+        CSG_CTR_FOR_LANES( CSG_CTR_XOR_ZMM )
+
+        ctr = _mm512_add_epi64( ctr, _mm512_set_epi64( 0, 32, 0, 32, 0, 32, 0, 32 ) );
+        In += 32 * CSG_AES_BLOCK_SIZE;
+        Out += 32 * CSG_AES_BLOCK_SIZE;
+        done += 32 * CSG_AES_BLOCK_SIZE;
+    }
+
+    return done;
+}
+
+VOID
+csgCtrCryptVaes256 (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    VAES (YMM) version of csgCtrCryptGeneric.  Only call this when the
+    processor supports VAES and AVX2 and the OS saves YMM state.
+
+Arguments:
+
+    See csgCtrCryptGeneric.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CSG_XSTATE_SAVE xstate;
+    SIZE_T done = 0;
+
+    if (Length >= CSG_CTR_WIDE_MIN &&
+        NT_SUCCESS( csgSaveExtendedState( CSG_XSTATE_MASK_AVX, &xstate ) )) {
+
+        done = csgCtrVaes256Kernel( Key, BlockIndex, In, Out, Length );
+        csgRestoreExtendedState( &xstate );
+    }
+
+    csgCtrCryptAesNi( Key,
+                      BlockIndex + done / CSG_AES_BLOCK_SIZE,
+                      In + done,
+                      Out + done,
+                      Length - done );
+}
+
+
+VOID
+csgCtrCryptVaes512 (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    VAES (ZMM) version of csgCtrCryptGeneric.  Only call this when the
+    processor supports VAES and AVX-512F and the OS saves ZMM state.
+
+Arguments:
+
+    See csgCtrCryptGeneric.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CSG_XSTATE_SAVE xstate;
+    SIZE_T done = 0;
+
+    if (Length >= CSG_CTR_WIDE_MIN &&
+        NT_SUCCESS( csgSaveExtendedState( CSG_XSTATE_MASK_AVX | CSG_XSTATE_MASK_AVX512, &xstate ) )) {
+
+        done = csgCtrVaes512Kernel( Key, BlockIndex, In, Out, Length );
+        csgRestoreExtendedState( &xstate );
+    }
+
+    csgCtrCryptAesNi( Key,
+                      BlockIndex + done / CSG_AES_BLOCK_SIZE,
+                      In + done,
+                      Out + done,
+                      Length - done );
+}
+
+#endif // CSG_ARCH_AMD64
+
+/*************************************************************************
+    Interface
+*************************************************************************/
+
+NTSTATUS
+csgCtrSetKey (
+    __out PCSG_CTR_KEY Key,
+    __in_bcount(CSG_CTR_KEY_SIZE) CONST UCHAR *KeyBytes
+    )
+/*++
+
+Routine Description:
+
+    Expands an AES-CTR key.
+
+Arguments:
+
+    Key - Receives the expanded key.
+
+    KeyBytes - A 32 byte AES key followed by an 8 byte nonce.
+
+Return Value:
+
+    STATUS_SUCCESS
+
+--*/
+{
+    ULONG i;
+
+    RtlZeroMemory( Key, sizeof(CSG_CTR_KEY) );
+
+    csgAesSetKey( &Key->Key, KeyBytes, CSG_AES_MAX_KEY_SIZE );
+
+    for (i = 0; i < sizeof(ULONGLONG); i++) {
+
+        Key->Nonce |= (ULONGLONG)KeyBytes[CSG_AES_MAX_KEY_SIZE + i] << (8 * i);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgCtrClearKey (
+    __inout PCSG_CTR_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    Wipes an expanded CTR key.
+
+Arguments:
+
+    Key - The key to wipe.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgSecureZeroMemory( Key, sizeof(CSG_CTR_KEY) );
+}
+
@@ -0,0 +1,109 @@
+#ifndef __CSG_CTR_H__
+#define __CSG_CTR_H__
+
+#include "csgAes.h"
+
+/*************************************************************************
+    AES-CTR stream mode for large sequential I/O
+*************************************************************************/
+
+//
+//  The counter is the block's position in the stream and nothing else,
+//  so enciphering other data at a position already written reuses its
+//  keystream, and the XOR of the two ciphertexts is the XOR of the two
+//  plaintexts.  The driver holds CTR to what it can use it for safely:
+//
+//  -   It is a per-file cipher only.  The configuration is refused when
+//      CipherAlgorithm asks for CTR without a ProtectedExtensions list,
+//      since the volume key would give every file the same keystream
+//      (see csgConfigRead).
+//
+//  -   A CTR stream's data only grows.  A write that is not paging I/O
+//      must start at or past the end of the data, and a size change
+//      that would cut the data is refused; both fail with
+//      STATUS_ACCESS_DENIED (see csgStreamExtend and csgStreamSetSize).
+//      An open that overwrites or supersedes the stream starts it over
+//      with a new file key.
+//
+//  What this does not cover is paging I/O, which is never refused.
+//  Writes through a mapped view rewrite data in place, and the cache
+//  writes a partly filled last sector again as appends fill it, so
+//  whoever sees the disk before and after learns the XOR of those
+//  sectors' old and new contents.  Appending in whole sectors, or
+//  noncached, avoids the second; nothing but XTS avoids the first.
+//
+
+//
+//  The raw key is an AES-256 key followed by a 64 bit nonce.
+//
+
+#define CSG_CTR_KEY_SIZE    (CSG_AES_MAX_KEY_SIZE + sizeof(ULONGLONG))
+
+typedef struct _CSG_CTR_KEY {
+
+    CSG_AES_KEY Key;
+
+    ULONGLONG Nonce;
+
+} CSG_CTR_KEY, *PCSG_CTR_KEY;
+
+typedef CONST CSG_CTR_KEY *PCCSG_CTR_KEY;
+
+NTSTATUS
+csgCtrSetKey (
+    __out PCSG_CTR_KEY Key,
+    __in_bcount(CSG_CTR_KEY_SIZE) CONST UCHAR *KeyBytes
+    );
+
+VOID
+csgCtrClearKey (
+    __inout PCSG_CTR_KEY Key
+    );
+
+//
+//  One entry point per implementation, all with the same arguments.  The
+//  caller picks one once (see csgProvider.h); the generic one works
+//  everywhere.
+//
+
+VOID
+csgCtrCryptGeneric (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+#ifdef CSG_ARCH_AMD64
+
+VOID
+csgCtrCryptAesNi (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+VOID
+csgCtrCryptVaes256 (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+VOID
+csgCtrCryptVaes512 (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+#endif // CSG_ARCH_AMD64
+
+#endif // __CSG_CTR_H__
@@ -1,8 +1,51 @@
 #include "csgDirCtrl.h"
 #include "csgGlobal.h"
 #include "csgStruct.h"
+#include "csgDirWalk.h"
 
-extern NPAGED_LOOKASIDE_LIST Pre2PostContextList;
+extern PCSG_BUFCACHE SwapBufferCache;
+
+//
+//  What csgDirCtrlHeaderSize looks the entries of a query up in.
+//
+
+typedef struct _CSG_DIR_LOOKUP {
+
+    PCSG_KEYCACHE ProtectedIds;
+
+    ULONGLONG DirectoryHash;
+
+} CSG_DIR_LOOKUP, *PCSG_DIR_LOOKUP;
+
+static BOOLEAN
+csgDirCtrlIsSwappedClass (
+    __in FILE_INFORMATION_CLASS FileInformationClass
+    );
+
+static ULONG
+csgDirCtrlCopyLength (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    );
+
+static VOID
+csgDirCtrlPatchSizes (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    );
+
+static ULONGLONG
+csgDirCtrlDirectoryHash (
+    __in PFLT_CALLBACK_DATA Data
+    );
+
+static ULONG
+csgDirCtrlHeaderSize (
+    __in PVOID Context,
+    __in ULONGLONG FileId,
+    __in_bcount(FileNameLength) CONST UCHAR *FileName,
+    __in ULONG FileNameLength
+    );
 
 FLT_PREOP_CALLBACK_STATUS
 csgPreDirCtrlBuffers(
@@ -43,14 +86,31 @@ Return Value:
 {
     PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PCSG_SWAP_DESC swapDesc = NULL;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
     NTSTATUS status;
+    ULONGLONG startTime = csgReadTimestamp();
 
     try {
 
+        //
+        //  Record the operation for capture before anything decides to
+        //  leave it alone.
+        //
+
+        CSG_TRACE6( IO_DIRCTRL,
+                    FltObjects->FileObject,
+                    iopb->MinorFunction,
+                    iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass,
+                    iopb->Parameters.DirectoryControl.QueryDirectory.Length,
+                    ((ULONGLONG)iopb->OperationFlags << 32) | Data->Flags,
+                    PsGetCurrentThreadId() );
+
         //
         //  If they are trying to get ZERO bytes, then don't do anything and
         //  we don't need a post-operation callback.
@@ -61,6 +121,20 @@ Return Value:
             leave;
         }
 
+        //
+        //  Only directory enumerations return what we rewrite, and only in
+        //  the classes whose entries carry file sizes.  Change
+        //  notifications in particular are left alone: they stay pending
+        //  for as long as nothing changes, hours for Explorer's, and a
+        //  swapped buffer would hold nonpaged pool all that time.
+        //
+
+        if ((iopb->MinorFunction != IRP_MN_QUERY_DIRECTORY) ||
+            !csgDirCtrlIsSwappedClass( iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass )) {
+
+            leave;
+        }
+
         //
         //  Get our volume context.  If we can't get it, just return.
         //
@@ -71,93 +145,118 @@ Return Value:
 
         if (!NT_SUCCESS(status)) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreDirCtrlBuffers:          Error getting volume context, status=%x\n",
-                        status) );
+            CSG_TRACE1( DIRCTRL_NO_VOLCTX,
+                        (ULONG)status );
 
             leave;
         }
 
         //
-        //  Allocate nonPaged memory for the buffer we are swapping to.
-        //  If we fail to get the memory, just don't swap buffers on this
-        //  operation.
+        //  Get a nonPaged buffer to swap to from our cache.  If we fail to
+        //  get the memory, just don't swap buffers on this operation.
         //
 
-        newBuf = ExAllocatePoolWithTag( NonPagedPool,
-                                        iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                        BUFFER_SWAP_TAG );
+        swapDesc = csgBufCacheAllocate( SwapBufferCache,
+                                        iopb->Parameters.DirectoryControl.QueryDirectory.Length );
 
-        if (newBuf == NULL) {
+        if (swapDesc == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreDirCtrlBuffers:          %wZ Failed to allocate %d bytes of memory.\n",
-                        &volCtx->Name,
-                        iopb->Parameters.DirectoryControl.QueryDirectory.Length) );
+            CSG_TRACE2( DIRCTRL_NO_BUFFER,
+                        volCtx,
+                        iopb->Parameters.DirectoryControl.QueryDirectory.Length );
+
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        newBuf = swapDesc->Buffer;
+
         //
         //  We need to build a MDL because Directory Control Operations are always IRP operations.  
         //
 
 
         //
-        //  Allocate a MDL for the new allocated memory.  If we fail
+        //  The descriptor already describes the buffer; the MDL for this
+        //  I/O is a partial copy of that, which the post-operation
+        //  callback takes back for the descriptor's next I/O.  If we fail
         //  the MDL allocation then we won't swap buffer for this operation
         //
 
-        newMdl = IoAllocateMdl( newBuf,
-                                iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                FALSE,
-                                FALSE,
-                                NULL );
+        newMdl = csgSwapDescBuildMdl( swapDesc,
+                                      iopb->Parameters.DirectoryControl.QueryDirectory.Length );
 
         if (newMdl == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreDirCtrlBuffers:          %wZ Failed to allocate MDL.\n",
-                        &volCtx->Name) );
+            CSG_TRACE1( DIRCTRL_NO_MDL,
+                        volCtx );
+
+            COUNT_STAT( AllocationFailures, 1 );
 
            leave;
         }
 
-        //
-        //  setup the MDL for the non-paged pool we just allocated
-        //
-
-        MmBuildMdlForNonPagedPool( newMdl );
-
         //
         //  We are ready to swap buffers, get a pre2Post context structure.
         //  We need it to pass the volume context and the allocate memory
         //  buffer to the post operation callback.
         //
 
-        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+        p2pCtx = AllocatePre2PostContext();
 
         if (p2pCtx == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreDirCtrlBuffers:          %wZ Failed to allocate pre2Post context structure\n",
-                        &volCtx->Name) );
+            CSG_TRACE1( DIRCTRL_NO_CONTEXT,
+                        volCtx );
+
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        //
+        //  Entries without a file id are looked up by name, on from the
+        //  directory's, which can only be had here.
+        //
+
+        p2pCtx->DirectoryHash = 0;
+
+        if ((volCtx->ProtectedIds != NULL) &&
+            volCtx->ProtectedIdsUsed &&
+            !csgDirWalkHasFileId( iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass )) {
+
+            p2pCtx->DirectoryHash = csgDirCtrlDirectoryHash( Data );
+        }
+
+        //
+        //  A users buffer the postOperation callback could only reach at
+        //  a safe IRQL is locked while we are in the issuer's context.
+        //
+
+        config = ConfigReadLock( &configCookie );
+
+        if (config->LockUserBuffers) {
+
+            LockUserBufferForPostOp( Data, iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress );
+        }
+
+        ConfigReadUnlock( configCookie );
+
         //
         //  Log that we are swapping
         //
 
-        LOG_PRINT( LOGFL_DIRCTRL,
-                   ("csg!csgPreDirCtrlBuffers:          %wZ newB=%p newMdl=%p oldB=%p oldMdl=%p len=%d\n",
-                    &volCtx->Name,
+        CSG_TRACE6( DIRCTRL_SWAP,
+                    volCtx,
                     newBuf,
                     newMdl,
                     iopb->Parameters.DirectoryControl.QueryDirectory.DirectoryBuffer,
                     iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress,
-                    iopb->Parameters.DirectoryControl.QueryDirectory.Length) );
+                    iopb->Parameters.DirectoryControl.QueryDirectory.Length );
+
+        COUNT_STAT( DirCtrlOperations, 1 );
+        COUNT_STAT( DirCtrlBytes, iopb->Parameters.DirectoryControl.QueryDirectory.Length );
 
         //
         //  Update the buffer pointers and MDL address
@@ -172,7 +271,11 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwapDesc = swapDesc;
+        p2pCtx->StreamCtx = NULL;
+        p2pCtx->SwappedLength = iopb->Parameters.DirectoryControl.QueryDirectory.Length;
         p2pCtx->VolCtx = volCtx;
+        p2pCtx->StartTime = startTime;
 
         *CompletionContext = p2pCtx;
 
@@ -190,14 +293,16 @@ Return Value:
 
         if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
 
-            if (newBuf != NULL) {
+            if (newMdl != NULL) {
 
-                ExFreePool( newBuf );
+                csgSwapDescKeepMdl( swapDesc, newMdl );
             }
 
-            if (newMdl != NULL) {
+            if (swapDesc != NULL) {
 
-                IoFreeMdl( newMdl );
+                csgBufCacheFree( SwapBufferCache,
+                                 swapDesc,
+                                 iopb->Parameters.DirectoryControl.QueryDirectory.Length );
             }
 
             if (volCtx != NULL) {
@@ -255,6 +360,8 @@ Return Value:
 
     ASSERT(!FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING));
 
+    KeepSwappedMdl( Data, p2pCtx );
+
     try {
 
         //
@@ -265,16 +372,23 @@ Return Value:
         if (!NT_SUCCESS(Data->IoStatus.Status) ||
             (Data->IoStatus.Information == 0)) {
 
-            LOG_PRINT( LOGFL_DIRCTRL,
-                       ("csg!csgPostDirCtrlBuffers:         %wZ newB=%p No data read, status=%x, info=%x\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE4( DIRCTRL_NO_DATA,
+                        p2pCtx->VolCtx,
                         p2pCtx->SwappedBuffer,
-                        Data->IoStatus.Status,
-                        Data->IoStatus.Information) );
+                        (ULONG)Data->IoStatus.Status,
+                        Data->IoStatus.Information );
 
             leave;
         }
 
+        //
+        //  Take the headers off the sizes of the protected files listed
+        //  while the entries are still in our buffer, whichever way they
+        //  are copied back below.
+        //
+
+        csgDirCtrlPatchSizes( Data, p2pCtx );
+
         //
         //  We need to copy the read data back into the users buffer.  Note
         //  that the parameters passed in are for the users original buffers
@@ -295,10 +409,9 @@ Return Value:
 
             if (origBuf == NULL) {
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPostDirCtrlBuffers:         %wZ Failed to get system address for MDL: %p\n",
-                            &p2pCtx->VolCtx->Name,
-                            iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress) );
+                CSG_TRACE2( DIRCTRL_NO_SYSADDR,
+                            p2pCtx->VolCtx,
+                            iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress );
 
                 //
                 //  If we failed to get a SYSTEM address, mark that the
@@ -310,6 +423,8 @@ Return Value:
                 leave;
             }
 
+            COUNT_STAT( PostMdlCompletions, 1 );
+
         } else if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_SYSTEM_BUFFER) ||
                    FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_FAST_IO_OPERATION)) {
 
@@ -323,6 +438,15 @@ Return Value:
 
             origBuf = iopb->Parameters.DirectoryControl.QueryDirectory.DirectoryBuffer;
 
+            if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_FAST_IO_OPERATION)) {
+
+                COUNT_STAT( PostFastIoCompletions, 1 );
+
+            } else {
+
+                COUNT_STAT( PostSystemBufferCompletions, 1 );
+            }
+
         } else {
 
             //
@@ -347,6 +471,8 @@ Return Value:
 
                 cleanupAllocatedBuffer = FALSE;
 
+                COUNT_STAT( SafePostings, 1 );
+
             } else {
 
                 //
@@ -358,9 +484,10 @@ Return Value:
                 //  a MDL.
                 //
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPostDirCtrlBuffers:         %wZ Unable to post to a safe IRQL\n",
-                            &p2pCtx->VolCtx->Name) );
+                CSG_TRACE1( DIRCTRL_NOT_SAFE,
+                            p2pCtx->VolCtx );
+
+                COUNT_STAT( SafePostFailures, 1 );
 
                 Data->IoStatus.Status = STATUS_UNSUCCESSFUL;
                 Data->IoStatus.Information = 0;
@@ -374,29 +501,23 @@ Return Value:
         //  so we are in the proper context.  Copy the data handling an
         //  exception.
         //
-        //  NOTE:  Due to a bug in FASTFAT where it is returning the wrong
-        //         length in the information field (it is sort) we are always
-        //         going to copy the original buffer length.
-        //
 
         try {
 
             RtlCopyMemory( origBuf,
                            p2pCtx->SwappedBuffer,
-                           /*Data->IoStatus.Information*/
-                           iopb->Parameters.DirectoryControl.QueryDirectory.Length );
+                           csgDirCtrlCopyLength( Data, p2pCtx ) );
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
             Data->IoStatus.Status = GetExceptionCode();
             Data->IoStatus.Information = 0;
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPostDirCtrlBuffers:         %wZ Invalid user buffer, oldB=%p, status=%x, info=%x\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE4( DIRCTRL_BAD_BUFFER,
+                        p2pCtx->VolCtx,
                         origBuf,
-                        Data->IoStatus.Status,
-                        Data->IoStatus.Information) );
+                        (ULONG)Data->IoStatus.Status,
+                        Data->IoStatus.Information );
         }
 
     } finally {
@@ -409,17 +530,17 @@ Return Value:
 
         if (cleanupAllocatedBuffer) {
 
-            LOG_PRINT( LOGFL_DIRCTRL,
-                       ("csg!csgPostDirCtrlBuffers:         %wZ newB=%p info=%d Freeing\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE3( DIRCTRL_FREE,
+                        p2pCtx->VolCtx,
                         p2pCtx->SwappedBuffer,
-                        Data->IoStatus.Information) );
+                        Data->IoStatus.Information );
+
+            RecordPre2PostLatency( p2pCtx, CSG_LATENCY_DIRCTRL );
 
-            ExFreePool( p2pCtx->SwappedBuffer );
+            csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
             FltReleaseContext( p2pCtx->VolCtx );
 
-            ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                         p2pCtx );
+            FreePre2PostContext( p2pCtx );
         }
     }
 
@@ -477,11 +598,10 @@ Return Value:
 
     if (!NT_SUCCESS(status)) {
 
-        LOG_PRINT( LOGFL_ERRORS,
-                   ("csg!SwapPostDirCtrlBuffersWhenSafe: %wZ Could not lock user buffer, oldB=%p, status=%x\n",
-                    &p2pCtx->VolCtx->Name,
+        CSG_TRACE3( DIRCTRL_SAFE_NO_LOCK,
+                    p2pCtx->VolCtx,
                     iopb->Parameters.DirectoryControl.QueryDirectory.DirectoryBuffer,
-                    status) );
+                    (ULONG)status );
 
         //
         //  If we can't lock the buffer, fail the operation
@@ -501,10 +621,9 @@ Return Value:
 
         if (origBuf == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!SwapPostDirCtrlBuffersWhenSafe: %wZ Failed to get System address for MDL: %p\n",
-                        &p2pCtx->VolCtx->Name,
-                        iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress) );
+            CSG_TRACE2( DIRCTRL_SAFE_NO_SYSADDR,
+                        p2pCtx->VolCtx,
+                        iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress );
 
             //
             //  If we couldn't get a SYSTEM buffer address, fail the operation
@@ -518,15 +637,10 @@ Return Value:
             //
             //  Copy the data back to the original buffer
             //
-            //  NOTE:  Due to a bug in FASTFAT where it is returning the wrong
-            //         length in the information field (it is short) we are
-            //         always going to copy the original buffer length.
-            //
 
             RtlCopyMemory( origBuf,
                            p2pCtx->SwappedBuffer,
-                           /*Data->IoStatus.Information*/
-                           iopb->Parameters.DirectoryControl.QueryDirectory.Length );
+                           csgDirCtrlCopyLength( Data, p2pCtx ) );
         }
     }
 
@@ -534,17 +648,208 @@ Return Value:
     //  Free the memory we allocated and return
     //
 
-    LOG_PRINT( LOGFL_DIRCTRL,
-               ("csg!SwapPostDirCtrlBuffersWhenSafe: %wZ newB=%p info=%d Freeing\n",
-                &p2pCtx->VolCtx->Name,
+    CSG_TRACE3( DIRCTRL_SAFE_FREE,
+                p2pCtx->VolCtx,
                 p2pCtx->SwappedBuffer,
-                Data->IoStatus.Information) );
+                Data->IoStatus.Information );
 
-    ExFreePool( p2pCtx->SwappedBuffer );
+    RecordPre2PostLatency( p2pCtx, CSG_LATENCY_DIRCTRL );
+
+    csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
     FltReleaseContext( p2pCtx->VolCtx );
 
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    FreePre2PostContext( p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
+
+
+static BOOLEAN
+csgDirCtrlIsSwappedClass (
+    __in FILE_INFORMATION_CLASS FileInformationClass
+    )
+/*++
+
+Routine Description:
+
+    Tells whether a directory enumeration of this class is swapped: the
+    classes whose entries report a file's EndOfFile and AllocationSize,
+    which are the ones the walker can patch, so that no class is swapped
+    only to be copied back as it was.
+
+--*/
+{
+    return csgDirWalkHasSizes( (ULONG)FileInformationClass );
+}
+
+
+static ULONG
+csgDirCtrlCopyLength (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    )
+/*++
+
+Routine Description:
+
+    Returns how many bytes of a completed query to copy back to the users
+    buffer: what the file system says it returned.
+
+    FASTFAT (FAT and exFAT volumes) returns the wrong length in the
+    information field, too short, so there the whole buffer is copied.
+
+--*/
+{
+    ULONG length = Data->Iopb->Parameters.DirectoryControl.QueryDirectory.Length;
+
+    if ((p2pCtx->VolCtx->FileSystemType == FLT_FSTYPE_FAT) ||
+        (p2pCtx->VolCtx->FileSystemType == FLT_FSTYPE_EXFAT) ||
+        (Data->IoStatus.Information > length)) {
+
+        return length;
+    }
+
+    return (ULONG)Data->IoStatus.Information;
+}
+
+
+static VOID
+csgDirCtrlPatchSizes (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    )
+/*++
+
+Routine Description:
+
+    Reports the protected files in a completed query with their sizes
+    less their header, as the read path presents them, looking each entry
+    up in the volume's ProtectedIds rather than opening the file: by file
+    id, or in the classes without one by the hash of its full name.  Files
+    not opened since the driver loaded, or long enough ago to have been
+    forgotten, are still listed with their header.
+
+    May be called at DPC level.
+
+--*/
+{
+    PVOLUME_CONTEXT volCtx = p2pCtx->VolCtx;
+    CSG_DIR_LOOKUP lookup;
+    ULONG entries;
+    ULONG patched;
+
+    if ((volCtx->ProtectedIds == NULL) || !volCtx->ProtectedIdsUsed) {
+
+        return;
+    }
+
+    lookup.ProtectedIds = volCtx->ProtectedIds;
+    lookup.DirectoryHash = p2pCtx->DirectoryHash;
+
+    patched = csgDirWalkPatchSizes( p2pCtx->SwappedBuffer,
+                                    csgDirCtrlCopyLength( Data, p2pCtx ),
+                                    Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass,
+                                    csgDirCtrlHeaderSize,
+                                    &lookup,
+                                    &entries );
+
+    if (entries != 0) {
+
+        COUNT_STAT( DirEntriesWalked, entries );
+        COUNT_STAT( DirEntriesPatched, patched );
+    }
+}
+
+
+static ULONGLONG
+csgDirCtrlDirectoryHash (
+    __in PFLT_CALLBACK_DATA Data
+    )
+/*++
+
+Routine Description:
+
+    Hashes the normalized name of the directory being queried, and a
+    backslash unless it ends in one (the root's does), so that the names
+    of its entries hash on from it to their full names.
+
+Return Value:
+
+    The hash, or zero if the name cannot be had.
+
+--*/
+{
+    PFLT_FILE_NAME_INFORMATION nameInfo;
+    ULONGLONG hash;
+    USHORT chars;
+    NTSTATUS status;
+    static CONST WCHAR separator = L'\\';
+
+    status = FltGetFileNameInformation( Data,
+                                        FLT_FILE_NAME_NORMALIZED |
+                                            FLT_FILE_NAME_QUERY_DEFAULT,
+                                        &nameInfo );
+
+    if (!NT_SUCCESS( status )) {
+
+        return 0;
+    }
+
+    hash = csgDirWalkHashName( CSG_DIR_NAME_HASH_SEED,
+                               (CONST UCHAR *)nameInfo->Name.Buffer,
+                               nameInfo->Name.Length );
+
+    chars = nameInfo->Name.Length / sizeof(WCHAR);
+
+    if ((chars == 0) || (nameInfo->Name.Buffer[chars - 1] != separator)) {
+
+        hash = csgDirWalkHashName( hash, (CONST UCHAR *)&separator, sizeof(separator) );
+    }
+
+    FltReleaseFileNameInformation( nameInfo );
+
+    return hash;
+}
+
+
+static ULONG
+csgDirCtrlHeaderSize (
+    __in PVOID Context,
+    __in ULONGLONG FileId,
+    __in_bcount(FileNameLength) CONST UCHAR *FileName,
+    __in ULONG FileNameLength
+    )
+/*++
+
+Routine Description:
+
+    The lookup csgDirWalkPatchSizes makes for each file it lists: the
+    header size remembered in a volume's ProtectedIds for the file id, or
+    for the name when there is no id, or zero.
+
+--*/
+{
+    PCSG_DIR_LOOKUP lookup = Context;
+    CSG_KEYCACHE_ID id;
+    ULONG headerSize;
+
+    if (FileId != 0) {
+
+        ProtectedIdKey( &id, FileId );
+
+    } else if (lookup->DirectoryHash != 0) {
+
+        ProtectedNameKey( &id, csgDirWalkHashName( lookup->DirectoryHash, FileName, FileNameLength ) );
+
+    } else {
+
+        return 0;
+    }
+
+    if (!csgKeyCacheLookup( lookup->ProtectedIds, &id, &headerSize )) {
+
+        return 0;
+    }
+
+    return headerSize;
+}
@@ -0,0 +1,363 @@
+/*++
+
+Module Name:
+
+    csgDirWalk.c
+
+Abstract:
+
+    Patching the sizes of protected files in the results of a directory
+    query, in place, in one pass down the entries (see csgDirWalk.h).
+
+    Every directory information class starts with the fields of
+    FILE_DIRECTORY_INFORMATION, so EndOfFile, AllocationSize,
+    FileAttributes and FileNameLength are at the same offsets in all of
+    them; only where the file id and the name are differs.  The offsets
+    are the ones every Windows build uses, written out here so the walker
+    needs no kernel header.
+
+--*/
+
+#include "csgDirWalk.h"
+
+//
+//  FILE_INFORMATION_CLASS values of the classes the walker knows.
+//
+
+#define CSG_DIR_DIRECTORY           1
+#define CSG_DIR_FULL                2
+#define CSG_DIR_BOTH                3
+#define CSG_DIR_ID_BOTH             37
+#define CSG_DIR_ID_FULL             38
+#define CSG_DIR_ID_GLOBAL_TX        50
+#define CSG_DIR_ID_EXTD             60
+#define CSG_DIR_ID_EXTD_BOTH        63
+
+//
+//  Offsets common to all the classes.
+//
+
+#define CSG_DIR_NEXT_ENTRY_OFFSET   0
+#define CSG_DIR_END_OF_FILE         40
+#define CSG_DIR_ALLOCATION_SIZE     48
+#define CSG_DIR_FILE_ATTRIBUTES     56
+#define CSG_DIR_FILE_NAME_LENGTH    60
+
+#define CSG_DIR_ATTRIBUTE_DIRECTORY 0x00000010
+
+//
+//  FNV-1a, 64 bits.
+//
+
+#define CSG_DIR_NAME_HASH_PRIME     0x00000100000001b3ULL
+
+CSG_INLINE ULONG
+csgDirRead32 (
+    CONST UCHAR *Field
+    )
+{
+    ULONG value;
+
+    RtlCopyMemory( &value, Field, sizeof(value) );
+
+    return value;
+}
+
+CSG_INLINE ULONGLONG
+csgDirRead64 (
+    CONST UCHAR *Field
+    )
+{
+    ULONGLONG value;
+
+    RtlCopyMemory( &value, Field, sizeof(value) );
+
+    return value;
+}
+
+//
+//  Takes Size off a size field, down to zero.
+//
+
+CSG_INLINE VOID
+csgDirShrink (
+    PUCHAR Field,
+    ULONG Size
+    )
+{
+    LONGLONG value;
+
+    RtlCopyMemory( &value, Field, sizeof(value) );
+
+    value = (value > (LONGLONG)Size) ? value - Size : 0;
+
+    RtlCopyMemory( Field, &value, sizeof(value) );
+}
+
+//
+//  Where the file id is in an entry of a class, and how long it is: 8
+//  bytes, or 16 for a FILE_ID_128, or none.  Then where the name is,
+//  which is past the id; zero for a class the walker does not know.
+//
+
+static ULONG
+csgDirFileNameOffset (
+    __in ULONG InformationClass,
+    __out PULONG IdOffset,
+    __out PULONG IdLength
+    )
+{
+    *IdOffset = 0;
+    *IdLength = 0;
+
+    switch (InformationClass) {
+
+        case CSG_DIR_DIRECTORY:     return 64;
+        case CSG_DIR_FULL:          return 68;
+        case CSG_DIR_BOTH:          return 94;
+
+        default:
+
+            break;
+    }
+
+    *IdLength = sizeof(ULONGLONG);
+
+    switch (InformationClass) {
+
+        case CSG_DIR_ID_BOTH:       *IdOffset = 96; return 104;
+        case CSG_DIR_ID_FULL:       *IdOffset = 72; return 80;
+        case CSG_DIR_ID_GLOBAL_TX:  *IdOffset = 64; return 92;
+
+        default:
+
+            break;
+    }
+
+    *IdLength = 2 * sizeof(ULONGLONG);
+
+    switch (InformationClass) {
+
+        case CSG_DIR_ID_EXTD:       *IdOffset = 72; return 88;
+        case CSG_DIR_ID_EXTD_BOTH:  *IdOffset = 72; return 114;
+
+        default:
+
+            *IdLength = 0;
+            return 0;
+    }
+}
+
+
+BOOLEAN
+csgDirWalkHasFileId (
+    __in ULONG InformationClass
+    )
+/*++
+
+Routine Description:
+
+    Tells whether entries of a class carry a file id, or only a name.
+
+Arguments:
+
+    InformationClass - The FILE_INFORMATION_CLASS of the query.
+
+Return Value:
+
+    TRUE if its entries carry a file id.
+
+--*/
+{
+    ULONG idOffset;
+    ULONG idLength;
+
+    csgDirFileNameOffset( InformationClass, &idOffset, &idLength );
+
+    return (idLength != 0);
+}
+
+
+BOOLEAN
+csgDirWalkHasSizes (
+    __in ULONG InformationClass
+    )
+/*++
+
+Routine Description:
+
+    Tells whether entries of a class can be patched: whether they report
+    a file's sizes in a layout the walker knows.
+
+Arguments:
+
+    InformationClass - The FILE_INFORMATION_CLASS of the query.
+
+Return Value:
+
+    TRUE if its entries can be patched.
+
+--*/
+{
+    ULONG idOffset;
+    ULONG idLength;
+
+    return (csgDirFileNameOffset( InformationClass, &idOffset, &idLength ) != 0);
+}
+
+
+ULONGLONG
+csgDirWalkHashName (
+    __in ULONGLONG Hash,
+    __in_bcount(Length) CONST UCHAR *Name,
+    __in ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Continues the hash of a name with Length more bytes of it.  ASCII
+    letters are hashed as capitals, so that names that differ only in
+    their case hash alike.
+
+Arguments:
+
+    Hash - CSG_DIR_NAME_HASH_SEED, or the hash of the name so far.
+
+    Name - UTF-16, at any alignment.
+
+    Length - Bytes of Name.
+
+Return Value:
+
+    The hash of the name so far.
+
+--*/
+{
+    USHORT c;
+    ULONG i;
+
+    for (i = 0; i + sizeof(USHORT) <= Length; i += sizeof(USHORT)) {
+
+        RtlCopyMemory( &c, Name + i, sizeof(USHORT) );
+
+        if ((c >= 'a') && (c <= 'z')) {
+
+            c -= 'a' - 'A';
+        }
+
+        Hash = (Hash ^ c) * CSG_DIR_NAME_HASH_PRIME;
+    }
+
+    return Hash;
+}
+
+
+ULONG
+csgDirWalkPatchSizes (
+    __inout_bcount(Length) PUCHAR Buffer,
+    __in ULONG Length,
+    __in ULONG InformationClass,
+    __in PCSG_DIR_HEADER_ROUTINE HeaderSize,
+    __in PVOID Context,
+    __out_opt PULONG Entries
+    )
+/*++
+
+Routine Description:
+
+    Walks the entries a directory query returned and takes the header off
+    the sizes of those HeaderSize says are protected.
+
+    A 128 bit file id is looked up by its low half, which is the id
+    FileInternalInformation reports, when its high half is zero; an id
+    that does not fit in 64 bits is passed as zero, as is the id of a
+    class without one, and the file is looked up by its name alone.
+
+Arguments:
+
+    Buffer - The entries, as the file system returned them.
+
+    Length - Bytes of Buffer the file system filled in.
+
+    InformationClass - The FILE_INFORMATION_CLASS of the query.
+
+    HeaderSize - Looks a file up.
+
+    Context - Passed to HeaderSize.
+
+    Entries - Receives the number of entries walked, if not NULL.
+
+Return Value:
+
+    The number of entries patched.
+
+--*/
+{
+    PUCHAR entry;
+    ULONG offset = 0;
+    ULONG next;
+    ULONG idOffset;
+    ULONG idLength;
+    ULONG nameOffset;
+    ULONG nameLength;
+    ULONG headerSize;
+    ULONGLONG fileId;
+    ULONG walked = 0;
+    ULONG patched = 0;
+
+    nameOffset = csgDirFileNameOffset( InformationClass, &idOffset, &idLength );
+
+    if (nameOffset != 0) {
+
+        while (Length - offset >= nameOffset) {
+
+            entry = Buffer + offset;
+            nameLength = csgDirRead32( entry + CSG_DIR_FILE_NAME_LENGTH );
+
+            if (nameLength > Length - offset - nameOffset) {
+
+                break;
+            }
+
+            walked++;
+
+            if (!(csgDirRead32( entry + CSG_DIR_FILE_ATTRIBUTES ) & CSG_DIR_ATTRIBUTE_DIRECTORY)) {
+
+                fileId = 0;
+
+                if ((idLength == sizeof(ULONGLONG)) ||
+                    ((idLength != 0) && (csgDirRead64( entry + idOffset + sizeof(ULONGLONG) ) == 0))) {
+
+                    fileId = csgDirRead64( entry + idOffset );
+                }
+
+                headerSize = HeaderSize( Context, fileId, entry + nameOffset, nameLength );
+
+                if (headerSize != 0) {
+
+                    csgDirShrink( entry + CSG_DIR_END_OF_FILE, headerSize );
+                    csgDirShrink( entry + CSG_DIR_ALLOCATION_SIZE, headerSize );
+
+                    patched++;
+                }
+            }
+
+            next = csgDirRead32( entry + CSG_DIR_NEXT_ENTRY_OFFSET );
+
+            if ((next == 0) || (next >= Length - offset)) {
+
+                break;
+            }
+
+            offset += next;
+        }
+    }
+
+    if (Entries != NULL) {
+
+        *Entries = walked;
+    }
+
+    return patched;
+}
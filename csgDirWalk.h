@@ -0,0 +1,85 @@
+#ifndef __CSG_DIRWALK_H__
+#define __CSG_DIRWALK_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Directory entry walker
+*************************************************************************/
+
+//
+//  A protected file is larger on disk than its data by its header, and
+//  the file system lists it that way.  The walker goes once down the
+//  NextEntryOffset chain of a directory query's results and takes the
+//  header back off the EndOfFile and AllocationSize of every entry a
+//  lookup routine knows to be protected.
+//
+//  The lookup is given the entry's file id, in the classes that carry
+//  one (FileIdBothDirectoryInformation, FileIdFullDirectoryInformation,
+//  FileIdGlobalTxDirectoryInformation, FileIdExtdDirectoryInformation
+//  and FileIdExtdBothDirectoryInformation), and its name in all of them,
+//  so that FileDirectoryInformation, FileFullDirectoryInformation and
+//  FileBothDirectoryInformation, which is what FindFirstFile asks for,
+//  can be patched by name.  Entries of any other class are left as they
+//  are.  Directories are never looked up.
+//
+//  The walker depends on nothing but the entries' layout, which is fixed,
+//  and reads and writes them byte-wise, so it makes no assumption about
+//  their alignment and runs as well in user mode.  An entry that would
+//  run past the end of the buffer ends the walk.
+//
+//  Callable at any IRQL the lookup routine allows, on nonpaged buffers at
+//  DISPATCH_LEVEL.
+//
+
+//
+//  Files are looked up by name under a hash of their full name: the hash
+//  of the directory's, continued with a backslash unless it ends in one,
+//  then with the entry's name, is the hash of the entry's whole name
+//  hashed from CSG_DIR_NAME_HASH_SEED.
+//
+
+#define CSG_DIR_NAME_HASH_SEED      0xcbf29ce484222325ULL
+
+//
+//  Returns the header size of a protected file, zero for any other.
+//  FileId is zero when the entry has none that fits in 64 bits; the name
+//  is FileNameLength bytes of UTF-16, at any alignment.
+//
+
+typedef ULONG
+(*PCSG_DIR_HEADER_ROUTINE) (
+    __in PVOID Context,
+    __in ULONGLONG FileId,
+    __in_bcount(FileNameLength) CONST UCHAR *FileName,
+    __in ULONG FileNameLength
+    );
+
+BOOLEAN
+csgDirWalkHasFileId (
+    __in ULONG InformationClass
+    );
+
+BOOLEAN
+csgDirWalkHasSizes (
+    __in ULONG InformationClass
+    );
+
+ULONGLONG
+csgDirWalkHashName (
+    __in ULONGLONG Hash,
+    __in_bcount(Length) CONST UCHAR *Name,
+    __in ULONG Length
+    );
+
+ULONG
+csgDirWalkPatchSizes (
+    __inout_bcount(Length) PUCHAR Buffer,
+    __in ULONG Length,
+    __in ULONG InformationClass,
+    __in PCSG_DIR_HEADER_ROUTINE HeaderSize,
+    __in PVOID Context,
+    __out_opt PULONG Entries
+    );
+
+#endif // __CSG_DIRWALK_H__
@@ -0,0 +1,507 @@
+/*++
+
+Module Name:
+
+    csgFileInfo.c
+
+Abstract:
+
+    Keeping the header of a protected stream out of its sizes.  The file
+    system's end of file is HeaderSize past the end of the data (see
+    csgStream.c), so the sizes queried from it have the header taken off,
+    and the sizes set on it have the header put on.
+
+    The file pointer of a synchronous open is kept in offsets within the
+    data (see csgStream.c), so a protected stream's position is queried
+    and set here, against the file object, rather than by the file
+    system.
+
+    IRP_MJ_NETWORK_QUERY_OPEN asks a file's sizes through fast I/O
+    without opening it.  It is refused while files are protected, so that
+    the I/O manager opens the file and queries it the usual way instead.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "csgFileInfo.h"
+#include "csgGlobal.h"
+#include "csgStruct.h"
+#include "csgStream.h"
+
+static NTSTATUS
+csgFileInfoSetPosition (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in LONGLONG Position
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, csgFileInfoSetPosition)
+#pragma alloc_text(PAGE, csgPreQueryInformation)
+#pragma alloc_text(PAGE, csgPreSetInformation)
+#pragma alloc_text(PAGE, csgPreNetworkQueryOpen)
+#endif
+
+//
+//  Takes the header off a size, down to zero.
+//
+
+CSG_INLINE VOID
+csgFileInfoShrink (
+    __inout PLARGE_INTEGER Size,
+    __in ULONG HeaderSize
+    )
+{
+    Size->QuadPart = (Size->QuadPart > (LONGLONG)HeaderSize) ? Size->QuadPart - HeaderSize : 0;
+}
+
+
+static NTSTATUS
+csgFileInfoSetPosition (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in LONGLONG Position
+    )
+/*++
+
+Routine Description:
+
+    Sets the file pointer of an open of a protected stream, checking it
+    as the file system would: an open without intermediate buffering can
+    only be positioned on a sector.
+
+Arguments:
+
+    FltObjects - The objects of the set information.
+
+    Position - The offset within the data, not negative.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if the offset is not on a
+    sector and must be.
+
+--*/
+{
+    PFILE_OBJECT fileObject = FltObjects->FileObject;
+    PVOLUME_CONTEXT volCtx;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (FlagOn( fileObject->Flags, FO_NO_INTERMEDIATE_BUFFERING )) {
+
+        status = FltGetVolumeContext( FltObjects->Filter,
+                                      FltObjects->Volume,
+                                      &volCtx );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+
+        status = ((Position % volCtx->SectorSize) != 0) ? STATUS_INVALID_PARAMETER : STATUS_SUCCESS;
+
+        FltReleaseContext( volCtx );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+    }
+
+    fileObject->CurrentByteOffset.QuadPart = Position;
+
+    return STATUS_SUCCESS;
+}
+
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreQueryInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Asks for a post-operation callback on the queries that return the
+    sizes of a protected stream, and passes it the stream's header size.
+    A protected stream's position is answered here.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Receives the header size.
+
+Return Value:
+
+    FLT_PREOP_SUCCESS_WITH_CALLBACK - the query returns a protected
+        stream's sizes
+    FLT_PREOP_COMPLETE - the query was of a protected stream's position;
+        Data->IoStatus has the result
+    FLT_PREOP_SUCCESS_NO_CALLBACK - any other query
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+    FILE_INFORMATION_CLASS infoClass = iopb->Parameters.QueryFileInformation.FileInformationClass;
+    FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PFILE_POSITION_INFORMATION position;
+    PSTREAM_CONTEXT streamCtx;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    switch (infoClass) {
+
+        case FileAllInformation:
+        case FileStandardInformation:
+        case FileNetworkOpenInformation:
+        case FilePositionInformation:
+
+            break;
+
+        default:
+
+            return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    config = ConfigReadLock( &configCookie );
+
+    if (config->ProtectedExtensionCount != 0) {
+
+        status = FltGetStreamContext( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &streamCtx );
+
+        if (NT_SUCCESS( status )) {
+
+            if ((streamCtx->LoadStatus == STATUS_SUCCESS) &&
+                (infoClass == FilePositionInformation)) {
+
+                if (iopb->Parameters.QueryFileInformation.Length < sizeof(FILE_POSITION_INFORMATION)) {
+
+                    Data->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    Data->IoStatus.Information = 0;
+
+                } else {
+
+                    position = iopb->Parameters.QueryFileInformation.InfoBuffer;
+                    position->CurrentByteOffset = FltObjects->FileObject->CurrentByteOffset;
+
+                    Data->IoStatus.Status = STATUS_SUCCESS;
+                    Data->IoStatus.Information = sizeof(FILE_POSITION_INFORMATION);
+                }
+
+                retValue = FLT_PREOP_COMPLETE;
+
+            } else if (streamCtx->LoadStatus == STATUS_SUCCESS) {
+
+                *CompletionContext = (PVOID)(ULONG_PTR)streamCtx->Header.HeaderSize;
+                retValue = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+            }
+
+            FltReleaseContext( streamCtx );
+        }
+    }
+
+    ConfigReadUnlock( configCookie );
+
+    return retValue;
+}
+
+
+FLT_POSTOP_CALLBACK_STATUS
+csgPostQueryInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PVOID CompletionContext,
+    __in FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    Takes the header off the AllocationSize and EndOfFile a query of a
+    protected stream returned.  Each class has the two side by side.  A
+    FileAllInformation query that ran out of room for the name still has
+    its sizes, and its position is the file object's.
+
+    The buffer of a query is its system buffer, so this runs at any IRQL.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The header size.
+
+    Flags - Denotes whether the completion is successful or is being drained.
+
+Return Value:
+
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+    ULONG headerSize = (ULONG)(ULONG_PTR)CompletionContext;
+    PUCHAR buffer = iopb->Parameters.QueryFileInformation.InfoBuffer;
+    ULONG sizes;
+
+    if (FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING ) ||
+        (!NT_SUCCESS( Data->IoStatus.Status ) && (Data->IoStatus.Status != STATUS_BUFFER_OVERFLOW))) {
+
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    switch (iopb->Parameters.QueryFileInformation.FileInformationClass) {
+
+        case FileAllInformation:
+
+            sizes = FIELD_OFFSET( FILE_ALL_INFORMATION, StandardInformation.AllocationSize );
+            break;
+
+        case FileStandardInformation:
+
+            sizes = FIELD_OFFSET( FILE_STANDARD_INFORMATION, AllocationSize );
+            break;
+
+        case FileNetworkOpenInformation:
+
+            sizes = FIELD_OFFSET( FILE_NETWORK_OPEN_INFORMATION, AllocationSize );
+            break;
+
+        default:
+
+            return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    if (Data->IoStatus.Information >= sizes + 2 * sizeof(LARGE_INTEGER)) {
+
+        csgFileInfoShrink( (PLARGE_INTEGER)(buffer + sizes), headerSize );
+        csgFileInfoShrink( (PLARGE_INTEGER)(buffer + sizes) + 1, headerSize );
+    }
+
+    if ((iopb->Parameters.QueryFileInformation.FileInformationClass == FileAllInformation) &&
+        (Data->IoStatus.Information >= FIELD_OFFSET( FILE_ALL_INFORMATION, PositionInformation ) +
+                                       sizeof(FILE_POSITION_INFORMATION))) {
+
+        ((PFILE_ALL_INFORMATION)buffer)->PositionInformation.CurrentByteOffset =
+            FltObjects->FileObject->CurrentByteOffset;
+    }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreSetInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Sets the end of file, allocation or valid data length of a protected
+    stream with its header added (csgStreamSetSize), or its position on
+    the file object (csgFileInfoSetPosition), and completes the
+    operation.
+
+    Paging I/O sets, and the cache manager's AdvanceOnly ones, are in terms
+    of the file system's own sizes and pass through, as does anything the
+    file system is going to refuse anyway.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Unused.
+
+Return Value:
+
+    FLT_PREOP_COMPLETE - a protected stream's size or position was set;
+        Data->IoStatus.Status has the status
+    FLT_PREOP_SUCCESS_NO_CALLBACK - any other operation
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+    FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    FILE_INFORMATION_CLASS infoClass = iopb->Parameters.SetFileInformation.FileInformationClass;
+    PSTREAM_CONTEXT streamCtx = NULL;
+    LARGE_INTEGER size;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    PAGED_CODE();
+
+    switch (infoClass) {
+
+        case FileEndOfFileInformation:
+
+            if (iopb->Parameters.SetFileInformation.AdvanceOnly) {
+
+                return FLT_PREOP_SUCCESS_NO_CALLBACK;
+            }
+
+            break;
+
+        case FileAllocationInformation:
+        case FileValidDataLengthInformation:
+        case FilePositionInformation:
+
+            break;
+
+        default:
+
+            return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    //
+    //  All four classes are one LARGE_INTEGER.
+    //
+
+    if (FlagOn( iopb->IrpFlags, IRP_PAGING_IO ) ||
+        (iopb->Parameters.SetFileInformation.Length < sizeof(LARGE_INTEGER))) {
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    config = ConfigReadLock( &configCookie );
+
+    try {
+
+        if (config->ProtectedExtensionCount == 0) {
+
+            leave;
+        }
+
+        status = FltGetStreamContext( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &streamCtx );
+
+        if (!NT_SUCCESS( status )) {
+
+            streamCtx = NULL;
+            leave;
+        }
+
+        if (streamCtx->LoadStatus != STATUS_SUCCESS) {
+
+            leave;
+        }
+
+        RtlCopyMemory( &size,
+                       iopb->Parameters.SetFileInformation.InfoBuffer,
+                       sizeof(size) );
+
+        if ((size.QuadPart < 0) ||
+            (size.QuadPart > MAXLONGLONG - (LONGLONG)streamCtx->Header.HeaderSize)) {
+
+            leave;
+        }
+
+        if (infoClass == FilePositionInformation) {
+
+            Data->IoStatus.Status = csgFileInfoSetPosition( FltObjects, size.QuadPart );
+
+        } else {
+
+            Data->IoStatus.Status = csgStreamSetSize( FltObjects,
+                                                      streamCtx,
+                                                      infoClass,
+                                                      size.QuadPart );
+        }
+
+        Data->IoStatus.Information = 0;
+        retValue = FLT_PREOP_COMPLETE;
+
+    } finally {
+
+        if (streamCtx != NULL) {
+
+            FltReleaseContext( streamCtx );
+        }
+
+        ConfigReadUnlock( configCookie );
+    }
+
+    return retValue;
+}
+
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreNetworkQueryOpen(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Refuses the fast I/O query of a file's sizes while files are
+    protected: the file system would return a protected file's sizes with
+    its header on, and there is no stream context to tell it by.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Unused.
+
+    CompletionContext - Unused.
+
+Return Value:
+
+    FLT_PREOP_DISALLOW_FASTIO - files are protected
+    FLT_PREOP_SUCCESS_NO_CALLBACK - none are
+
+--*/
+{
+    FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    PAGED_CODE();
+
+    if (FLT_IS_FASTIO_OPERATION( Data )) {
+
+        config = ConfigReadLock( &configCookie );
+
+        if (config->ProtectedExtensionCount != 0) {
+
+            retValue = FLT_PREOP_DISALLOW_FASTIO;
+        }
+
+        ConfigReadUnlock( configCookie );
+    }
+
+    return retValue;
+}
@@ -0,0 +1,39 @@
+#ifndef __CSG_FILEINFO_H__
+#define __CSG_FILEINFO_H__
+
+
+#include "csgGlobal.h"
+#include "csgStruct.h"
+
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreQueryInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    );
+
+FLT_POSTOP_CALLBACK_STATUS
+csgPostQueryInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PVOID CompletionContext,
+    __in FLT_POST_OPERATION_FLAGS Flags
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreSetInformation(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+csgPreNetworkQueryOpen(
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __deref_out_opt PVOID *CompletionContext
+    );
+
+
+#endif // __CSG_FILEINFO_H__
@@ -13,6 +13,8 @@
 #define CONTEXT_TAG         'xcBS'
 #define NAME_TAG            'mnBS'
 #define PRE_2_POST_TAG      'ppBS'
+#define STATS_TAG           'tsBS'
+#define CONFIG_TAG          'fcBS'
 
 
 
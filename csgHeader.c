@@ -0,0 +1,280 @@
+/*++
+
+Module Name:
+
+    csgHeader.c
+
+Abstract:
+
+    Parsing and serializing the header at the start of a protected file
+    (see csgHeader.h for the layout).  The parser takes whatever was read
+    from the disk, so it trusts nothing in it: every field is checked
+    before it is used and nothing is read past the buffer.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgHeader.h"
+#include "csgProvider.h"
+#include "csgKeyWrap.h"
+
+#define CSG_HEADER_OFFSET_VERSION       8
+#define CSG_HEADER_OFFSET_ALGORITHM     12
+#define CSG_HEADER_OFFSET_SIZE          16
+#define CSG_HEADER_OFFSET_KEY_LENGTH    20
+#define CSG_HEADER_OFFSET_KEY           24
+#define CSG_HEADER_OFFSET_IV_SEED       (CSG_HEADER_OFFSET_KEY + CSG_HEADER_MAX_WRAPPED_KEY)
+#define CSG_HEADER_OFFSET_FILE_ID       (CSG_HEADER_OFFSET_IV_SEED + CSG_HEADER_IV_SEED_SIZE)
+
+CSG_INLINE ULONG
+csgHeaderGetUlong (
+    CONST UCHAR *p
+    )
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+CSG_INLINE VOID
+csgHeaderPutUlong (
+    UCHAR *p,
+    ULONG v
+    )
+{
+    p[0] = (UCHAR)v;
+    p[1] = (UCHAR)(v >> 8);
+    p[2] = (UCHAR)(v >> 16);
+    p[3] = (UCHAR)(v >> 24);
+}
+
+CSG_INLINE ULONGLONG
+csgHeaderGetUlonglong (
+    CONST UCHAR *p
+    )
+{
+    return (ULONGLONG)csgHeaderGetUlong( p ) | ((ULONGLONG)csgHeaderGetUlong( p + 4 ) << 32);
+}
+
+CSG_INLINE VOID
+csgHeaderPutUlonglong (
+    UCHAR *p,
+    ULONGLONG v
+    )
+{
+    csgHeaderPutUlong( p, (ULONG)v );
+    csgHeaderPutUlong( p + 4, (ULONG)(v >> 32) );
+}
+
+ULONG
+csgHeaderFileKeyLength (
+    __in ULONG Algorithm
+    )
+/*++
+
+Routine Description:
+
+    Returns the length of a file key for a cipher.
+
+Arguments:
+
+    Algorithm - A CSG_CIPHER_* value.
+
+Return Value:
+
+    The length in bytes, or zero for an unknown cipher.
+
+--*/
+{
+    switch (Algorithm) {
+
+    case CSG_CIPHER_XTS:
+        return CSG_XTS_KEY_SIZE;
+
+    case CSG_CIPHER_CTR:
+        return CSG_AES_MAX_KEY_SIZE;
+
+    default:
+        return 0;
+    }
+}
+
+//
+//  Checks what the parser and the serializer both insist on.
+//
+
+static NTSTATUS
+csgHeaderValidate (
+    PCCSG_HEADER Header
+    )
+{
+    if ((Header->Version != CSG_HEADER_VERSION_WRAPPED) &&
+        (Header->Version != CSG_HEADER_VERSION_DERIVED)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if ((Header->Algorithm != CSG_CIPHER_XTS) &&
+        (Header->Algorithm != CSG_CIPHER_CTR)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    //  A power of two, so a whole number of sectors on any volume whose
+    //  sectors are no larger.
+    //
+
+    if ((Header->HeaderSize < CSG_HEADER_MIN_SIZE) ||
+        (Header->HeaderSize > CSG_HEADER_MAX_SIZE) ||
+        ((Header->HeaderSize & (Header->HeaderSize - 1)) != 0)) {
+
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    if (Header->Version == CSG_HEADER_VERSION_DERIVED) {
+
+        if (Header->WrappedKeyLength != 0) {
+
+            return STATUS_FILE_CORRUPT_ERROR;
+        }
+
+    } else if (Header->WrappedKeyLength !=
+               csgHeaderFileKeyLength( Header->Algorithm ) + CSG_KEYWRAP_OVERHEAD) {
+
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+csgHeaderParse (
+    __in_bcount(Length) CONST UCHAR *Buffer,
+    __in SIZE_T Length,
+    __out PCSG_HEADER Header
+    )
+/*++
+
+Routine Description:
+
+    Parses a file header.
+
+Arguments:
+
+    Buffer - The start of the file.
+
+    Length - Bytes in Buffer.  Only the fixed part of the header is looked
+        at; the padding after it is not checked.
+
+    Header - Receives the parsed header.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_FILE_CORRUPT_ERROR - not a header, or a damaged one.
+    STATUS_NOT_SUPPORTED - a header from a later version, or for an
+        unknown cipher.
+
+--*/
+{
+    NTSTATUS status;
+
+    RtlZeroMemory( Header, sizeof(CSG_HEADER) );
+
+    if ((Length < CSG_HEADER_FIXED_SIZE) ||
+        !RtlEqualMemory( Buffer, CSG_HEADER_MAGIC, CSG_HEADER_MAGIC_SIZE )) {
+
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    Header->Version = csgHeaderGetUlong( Buffer + CSG_HEADER_OFFSET_VERSION );
+    Header->Algorithm = csgHeaderGetUlong( Buffer + CSG_HEADER_OFFSET_ALGORITHM );
+    Header->HeaderSize = csgHeaderGetUlong( Buffer + CSG_HEADER_OFFSET_SIZE );
+    Header->WrappedKeyLength = csgHeaderGetUlong( Buffer + CSG_HEADER_OFFSET_KEY_LENGTH );
+
+    status = csgHeaderValidate( Header );
+
+    if (!NT_SUCCESS( status )) {
+
+        RtlZeroMemory( Header, sizeof(CSG_HEADER) );
+        return status;
+    }
+
+    RtlCopyMemory( Header->WrappedKey,
+                   Buffer + CSG_HEADER_OFFSET_KEY,
+                   CSG_HEADER_MAX_WRAPPED_KEY );
+
+    RtlCopyMemory( Header->IvSeed,
+                   Buffer + CSG_HEADER_OFFSET_IV_SEED,
+                   CSG_HEADER_IV_SEED_SIZE );
+
+    if (Header->Version == CSG_HEADER_VERSION_DERIVED) {
+
+        Header->FileId = csgHeaderGetUlonglong( Buffer + CSG_HEADER_OFFSET_FILE_ID );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+csgHeaderSerialize (
+    __in PCCSG_HEADER Header,
+    __out_bcount(Length) UCHAR *Buffer,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    Lays out a file header, padding included.
+
+Arguments:
+
+    Header - The header.
+
+    Buffer - Receives Header->HeaderSize bytes.
+
+    Length - Size of Buffer, at least Header->HeaderSize.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - Header is not one csgHeaderParse would
+        accept, or Buffer is too small for it.
+
+--*/
+{
+    if (!NT_SUCCESS( csgHeaderValidate( Header ) ) ||
+        (Length < Header->HeaderSize)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory( Buffer, Header->HeaderSize );
+
+    RtlCopyMemory( Buffer, CSG_HEADER_MAGIC, CSG_HEADER_MAGIC_SIZE );
+
+    csgHeaderPutUlong( Buffer + CSG_HEADER_OFFSET_VERSION, Header->Version );
+    csgHeaderPutUlong( Buffer + CSG_HEADER_OFFSET_ALGORITHM, Header->Algorithm );
+    csgHeaderPutUlong( Buffer + CSG_HEADER_OFFSET_SIZE, Header->HeaderSize );
+    csgHeaderPutUlong( Buffer + CSG_HEADER_OFFSET_KEY_LENGTH, Header->WrappedKeyLength );
+
+    RtlCopyMemory( Buffer + CSG_HEADER_OFFSET_KEY,
+                   Header->WrappedKey,
+                   CSG_HEADER_MAX_WRAPPED_KEY );
+
+    RtlCopyMemory( Buffer + CSG_HEADER_OFFSET_IV_SEED,
+                   Header->IvSeed,
+                   CSG_HEADER_IV_SEED_SIZE );
+
+    if (Header->Version == CSG_HEADER_VERSION_DERIVED) {
+
+        csgHeaderPutUlonglong( Buffer + CSG_HEADER_OFFSET_FILE_ID, Header->FileId );
+    }
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#ifndef __CSG_HEADER_H__
+#define __CSG_HEADER_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    On-disk header of a protected file
+*************************************************************************/
+
+//
+//  Every protected file starts with a header, and the file's data follows
+//  it.  The header is padded to a whole number of sectors, and to at least
+//  4K, so noncached I/O to the data stays sector aligned after the data
+//  offsets are shifted past it.
+//
+//  Layout, all integers little endian:
+//
+//      0   Magic           8 bytes, CSG_HEADER_MAGIC
+//      8   Version         ULONG, a CSG_HEADER_VERSION_* value
+//     12   Algorithm       ULONG, a CSG_CIPHER_* value
+//     16   HeaderSize      ULONG, bytes from the start of the file to the data
+//     20   WrappedKeyLength ULONG
+//     24   WrappedKey      CSG_HEADER_MAX_WRAPPED_KEY bytes, the file key
+//                          wrapped (csgKeyWrap.h) under the configured
+//                          wrapping key, zero padded
+//     96   IvSeed          CSG_HEADER_IV_SEED_SIZE random bytes
+//    112   FileId          ULONGLONG, version 2 only
+//    120   zero up to HeaderSize
+//
+//  A version 1 header carries its file key, wrapped.  A version 2 header
+//  carries none (WrappedKeyLength and WrappedKey are zero): the file key
+//  is derived from the configured master key, the file id the file had
+//  when the header was written and the IV seed (see csgStream.c).  The
+//  id is kept in the header so the key survives the file being copied or
+//  restored to another id.
+//
+
+#define CSG_HEADER_MAGIC            "CSGHDR\x1a\x00"
+#define CSG_HEADER_MAGIC_SIZE       8
+
+#define CSG_HEADER_VERSION_WRAPPED  1
+#define CSG_HEADER_VERSION_DERIVED  2
+
+#define CSG_HEADER_MIN_SIZE         0x1000
+#define CSG_HEADER_MAX_SIZE         0x10000
+
+#define CSG_HEADER_MAX_WRAPPED_KEY  72
+#define CSG_HEADER_IV_SEED_SIZE     16
+
+#define CSG_HEADER_FIXED_SIZE       (24 + CSG_HEADER_MAX_WRAPPED_KEY + CSG_HEADER_IV_SEED_SIZE + 8)
+
+typedef struct _CSG_HEADER {
+
+    ULONG Version;
+
+    ULONG Algorithm;
+
+    ULONG HeaderSize;
+
+    ULONG WrappedKeyLength;
+
+    UCHAR WrappedKey[CSG_HEADER_MAX_WRAPPED_KEY];
+
+    UCHAR IvSeed[CSG_HEADER_IV_SEED_SIZE];
+
+    ULONGLONG FileId;
+
+} CSG_HEADER, *PCSG_HEADER;
+
+typedef CONST CSG_HEADER *PCCSG_HEADER;
+
+//
+//  Header size for a new file on a volume with the given sector size.
+//
+
+CSG_INLINE ULONG
+csgHeaderSize (
+    __in ULONG SectorSize
+    )
+{
+    return (SectorSize > CSG_HEADER_MIN_SIZE) ? SectorSize : CSG_HEADER_MIN_SIZE;
+}
+
+//
+//  Length of the file key, before wrapping, for a cipher.  An XTS file key
+//  is both AES keys; a CTR one is the AES key only, the nonce comes from
+//  IvSeed.  Zero for an unknown cipher.
+//
+
+ULONG
+csgHeaderFileKeyLength (
+    __in ULONG Algorithm
+    );
+
+NTSTATUS
+csgHeaderParse (
+    __in_bcount(Length) CONST UCHAR *Buffer,
+    __in SIZE_T Length,
+    __out PCSG_HEADER Header
+    );
+
+NTSTATUS
+csgHeaderSerialize (
+    __in PCCSG_HEADER Header,
+    __out_bcount(Length) UCHAR *Buffer,
+    __in SIZE_T Length
+    );
+
+#endif // __CSG_HEADER_H__
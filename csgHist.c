@@ -0,0 +1,312 @@
+/*++
+
+Module Name:
+
+    csgHist.c
+
+Abstract:
+
+    Log-linear histograms with one shard per processor.
+
+    Recording is two interlocked operations on the current processor's
+    shard, which no other processor writes, so they do not contend.
+    Snapshots add the shards up while recording goes on; a snapshot may
+    miss values recorded during it, and its Sum may be a little ahead of
+    or behind its buckets.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgHist.h"
+
+#define CSG_HIST_CACHE_LINE     64
+
+#define CSG_HIST_TAG            'hlBS'
+
+typedef struct CSG_ALIGN(CSG_HIST_CACHE_LINE) _CSG_HIST_SHARD {
+
+    volatile LONGLONG Sum;
+
+    volatile LONGLONG Buckets[CSG_HIST_BUCKETS];
+
+} CSG_HIST_SHARD, *PCSG_HIST_SHARD;
+
+struct _CSG_HIST {
+
+    ULONG ShardCount;
+
+    PCSG_HIST_SHARD Shards;
+
+    //
+    //  Where the allocation for this structure really starts.
+    //
+
+    PVOID Allocation;
+};
+
+
+NTSTATUS
+csgHistCreate (
+    __out PCSG_HIST *Hist
+    )
+/*++
+
+Routine Description:
+
+    Creates an empty histogram with a shard per processor.
+
+Arguments:
+
+    Hist - Receives the histogram.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    PCSG_HIST hist;
+    ULONG shardCount = csgCpuCount();
+    SIZE_T size;
+    PVOID allocation;
+
+    *Hist = NULL;
+
+    size = CSG_HIST_CACHE_LINE +
+           sizeof(CSG_HIST) +
+           CSG_HIST_CACHE_LINE +
+           shardCount * sizeof(CSG_HIST_SHARD);
+
+    allocation = csgAllocateNonPaged( size, CSG_HIST_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    hist = (PCSG_HIST)(((ULONG_PTR)allocation + CSG_HIST_CACHE_LINE - 1) &
+                       ~(ULONG_PTR)(CSG_HIST_CACHE_LINE - 1));
+
+    hist->Allocation = allocation;
+    hist->ShardCount = shardCount;
+    hist->Shards = (PCSG_HIST_SHARD)(((ULONG_PTR)(hist + 1) + CSG_HIST_CACHE_LINE - 1) &
+                                     ~(ULONG_PTR)(CSG_HIST_CACHE_LINE - 1));
+
+    *Hist = hist;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgHistDestroy (
+    __in PCSG_HIST Hist
+    )
+/*++
+
+Routine Description:
+
+    Frees a histogram.  No other call may be in progress or follow.
+
+Arguments:
+
+    Hist - The histogram to destroy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgFreeNonPaged( Hist->Allocation, CSG_HIST_TAG );
+}
+
+
+VOID
+csgHistRecord (
+    __in PCSG_HIST Hist,
+    __in ULONGLONG Value
+    )
+/*++
+
+Routine Description:
+
+    Counts one value.  Callable at any IRQL up to HIGH_LEVEL.
+
+Arguments:
+
+    Hist - The histogram.
+
+    Value - The value to count.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_HIST_SHARD shard = &Hist->Shards[csgCurrentCpu() % Hist->ShardCount];
+
+    csgInterlockedIncrement64( &shard->Buckets[csgHistBucket( Value )] );
+    csgInterlockedAdd64( &shard->Sum, (LONGLONG)Value );
+}
+
+
+VOID
+csgHistSnapshot (
+    __in PCSG_HIST Hist,
+    __out PCSG_HIST_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    Merges the shards of a histogram.
+
+Arguments:
+
+    Hist - The histogram.
+
+    Snapshot - Receives the merged counts.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_HIST_SHARD shard;
+    ULONGLONG count;
+    ULONG i;
+    ULONG b;
+
+    RtlZeroMemory( Snapshot, sizeof(CSG_HIST_SNAPSHOT) );
+
+    for (i = 0; i < Hist->ShardCount; i++) {
+
+        shard = &Hist->Shards[i];
+
+        Snapshot->Sum += (ULONGLONG)shard->Sum;
+
+        for (b = 0; b < CSG_HIST_BUCKETS; b++) {
+
+            count = (ULONGLONG)shard->Buckets[b];
+
+            Snapshot->Buckets[b] += count;
+            Snapshot->Count += count;
+        }
+    }
+}
+
+
+ULONGLONG
+csgHistBucketLimit (
+    __in ULONG Bucket
+    )
+/*++
+
+Routine Description:
+
+    Returns the largest value that falls in a bucket.  The last bucket
+    also takes every value too large for any bucket; its nominal limit,
+    2^CSG_HIST_MAX_SHIFT - 1, is returned for it.
+
+Arguments:
+
+    Bucket - The bucket, below CSG_HIST_BUCKETS.
+
+Return Value:
+
+    The bucket's largest value.
+
+--*/
+{
+    ULONG shift;
+    ULONGLONG base;
+
+    if (Bucket < CSG_HIST_SUB_COUNT) {
+
+        return Bucket;
+    }
+
+    shift = (Bucket >> CSG_HIST_SUB_BITS) - 1;
+    base = (ULONGLONG)(CSG_HIST_SUB_COUNT + (Bucket & (CSG_HIST_SUB_COUNT - 1))) << shift;
+
+    return base + ((ULONGLONG)1 << shift) - 1;
+}
+
+
+ULONGLONG
+csgHistPercentile (
+    __in PCCSG_HIST_SNAPSHOT Snapshot,
+    __in ULONG PartsPerMillion
+    )
+/*++
+
+Routine Description:
+
+    Returns the value at or below which the given share of the recorded
+    values fall, rounded up to the limit of its bucket.
+
+Arguments:
+
+    Snapshot - Merged counts from csgHistSnapshot.
+
+    PartsPerMillion - The share, 500000 for the median, 999000 for the
+        99.9th percentile, 1000000 for the largest value.
+
+Return Value:
+
+    The percentile, or zero if nothing was recorded.
+
+--*/
+{
+    ULONGLONG rank;
+    ULONGLONG seen = 0;
+    ULONG b;
+
+    if (Snapshot->Count == 0) {
+
+        return 0;
+    }
+
+    if (PartsPerMillion > 1000000) {
+
+        PartsPerMillion = 1000000;
+    }
+
+    //
+    //  The rank of the value we want, counting from 1, rounded up.
+    //  Split so the product cannot overflow.
+    //
+
+    rank = (Snapshot->Count / 1000000) * PartsPerMillion +
+           ((Snapshot->Count % 1000000) * PartsPerMillion + 999999) / 1000000;
+
+    if (rank == 0) {
+
+        rank = 1;
+    }
+
+    for (b = 0; b < CSG_HIST_BUCKETS; b++) {
+
+        seen += Snapshot->Buckets[b];
+
+        if (seen >= rank) {
+
+            return csgHistBucketLimit( b );
+        }
+    }
+
+    //
+    //  Only reachable if the buckets add up to less than Count.
+    //
+
+    return csgHistBucketLimit( CSG_HIST_BUCKETS - 1 );
+}
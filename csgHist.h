@@ -0,0 +1,101 @@
+#ifndef __CSG_HIST_H__
+#define __CSG_HIST_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Log-linear latency histograms
+*************************************************************************/
+
+//
+//  Values are split by power of two, and every power of two into
+//  CSG_HIST_SUB_COUNT equal buckets, so a bucket is never wider than 1/16
+//  of the values in it (HDR histogram style, one significant hex digit).
+//  Values below CSG_HIST_SUB_COUNT get a bucket each; values of
+//  2^CSG_HIST_MAX_SHIFT and up are counted in the last bucket.
+//
+//  Each processor records into a shard of its own; readers merge the
+//  shards into a snapshot.
+//
+
+#define CSG_HIST_SUB_BITS       4
+#define CSG_HIST_SUB_COUNT      (1 << CSG_HIST_SUB_BITS)
+#define CSG_HIST_MAX_SHIFT      32
+
+#define CSG_HIST_BUCKETS        ((CSG_HIST_MAX_SHIFT - CSG_HIST_SUB_BITS + 1) * CSG_HIST_SUB_COUNT)
+
+typedef struct _CSG_HIST_SNAPSHOT {
+
+    ULONGLONG Count;
+
+    //
+    //  Sum of the recorded values, for the mean.
+    //
+
+    ULONGLONG Sum;
+
+    ULONGLONG Buckets[CSG_HIST_BUCKETS];
+
+} CSG_HIST_SNAPSHOT, *PCSG_HIST_SNAPSHOT;
+
+typedef CONST CSG_HIST_SNAPSHOT *PCCSG_HIST_SNAPSHOT;
+
+typedef struct _CSG_HIST CSG_HIST, *PCSG_HIST;
+
+CSG_INLINE ULONG
+csgHistBucket (
+    ULONGLONG Value
+    )
+{
+    ULONG shift;
+
+    if (Value < CSG_HIST_SUB_COUNT) {
+
+        return (ULONG)Value;
+    }
+
+    if (Value >> CSG_HIST_MAX_SHIFT) {
+
+        return CSG_HIST_BUCKETS - 1;
+    }
+
+    shift = csgHighestBit32( (ULONG)Value ) - CSG_HIST_SUB_BITS;
+
+    return ((shift + 1) << CSG_HIST_SUB_BITS) +
+           ((ULONG)(Value >> shift) & (CSG_HIST_SUB_COUNT - 1));
+}
+
+NTSTATUS
+csgHistCreate (
+    __out PCSG_HIST *Hist
+    );
+
+VOID
+csgHistDestroy (
+    __in PCSG_HIST Hist
+    );
+
+VOID
+csgHistRecord (
+    __in PCSG_HIST Hist,
+    __in ULONGLONG Value
+    );
+
+VOID
+csgHistSnapshot (
+    __in PCSG_HIST Hist,
+    __out PCSG_HIST_SNAPSHOT Snapshot
+    );
+
+ULONGLONG
+csgHistBucketLimit (
+    __in ULONG Bucket
+    );
+
+ULONGLONG
+csgHistPercentile (
+    __in PCCSG_HIST_SNAPSHOT Snapshot,
+    __in ULONG PartsPerMillion
+    );
+
+#endif // __CSG_HIST_H__
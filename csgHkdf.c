@@ -0,0 +1,391 @@
+/*++
+
+Module Name:
+
+    csgHkdf.c
+
+Abstract:
+
+    SHA-256 (FIPS 180-4), HMAC-SHA256 (RFC 2104) and HKDF on top of them
+    (RFC 5869).  Used to derive per-file keys from the configured master
+    key.  A derivation is a few compressions, done when a file is opened
+    and its key is not in the key cache, so this is written for clarity
+    over speed.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgHkdf.h"
+
+static CONST ULONG csgSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define CSG_SHA256_ROTR(_x, _n)     (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+static VOID
+csgSha256Compress (
+    __inout PCSG_SHA256 Sha,
+    __in_bcount(CSG_SHA256_BLOCK_SIZE) CONST UCHAR *Block
+    )
+{
+    ULONG w[64];
+    ULONG a, b, c, d, e, f, g, h;
+    ULONG t1, t2;
+    ULONG i;
+
+    for (i = 0; i < 16; i++) {
+
+        w[i] = ((ULONG)Block[4 * i] << 24) | ((ULONG)Block[4 * i + 1] << 16) |
+               ((ULONG)Block[4 * i + 2] << 8) | (ULONG)Block[4 * i + 3];
+    }
+
+    for (i = 16; i < 64; i++) {
+
+        t1 = CSG_SHA256_ROTR( w[i - 2], 17 ) ^ CSG_SHA256_ROTR( w[i - 2], 19 ) ^ (w[i - 2] >> 10);
+        t2 = CSG_SHA256_ROTR( w[i - 15], 7 ) ^ CSG_SHA256_ROTR( w[i - 15], 18 ) ^ (w[i - 15] >> 3);
+
+        w[i] = w[i - 16] + t2 + w[i - 7] + t1;
+    }
+
+    a = Sha->State[0];
+    b = Sha->State[1];
+    c = Sha->State[2];
+    d = Sha->State[3];
+    e = Sha->State[4];
+    f = Sha->State[5];
+    g = Sha->State[6];
+    h = Sha->State[7];
+
+    for (i = 0; i < 64; i++) {
+
+        t1 = h + (CSG_SHA256_ROTR( e, 6 ) ^ CSG_SHA256_ROTR( e, 11 ) ^ CSG_SHA256_ROTR( e, 25 )) +
+             ((e & f) ^ (~e & g)) + csgSha256K[i] + w[i];
+        t2 = (CSG_SHA256_ROTR( a, 2 ) ^ CSG_SHA256_ROTR( a, 13 ) ^ CSG_SHA256_ROTR( a, 22 )) +
+             ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    Sha->State[0] += a;
+    Sha->State[1] += b;
+    Sha->State[2] += c;
+    Sha->State[3] += d;
+    Sha->State[4] += e;
+    Sha->State[5] += f;
+    Sha->State[6] += g;
+    Sha->State[7] += h;
+
+    //
+    //  The schedule holds key material when this hashes an HMAC key.
+    //
+
+    csgSecureZeroMemory( w, sizeof(w) );
+}
+
+
+VOID
+csgSha256Init (
+    __out PCSG_SHA256 Sha
+    )
+{
+    Sha->State[0] = 0x6a09e667;
+    Sha->State[1] = 0xbb67ae85;
+    Sha->State[2] = 0x3c6ef372;
+    Sha->State[3] = 0xa54ff53a;
+    Sha->State[4] = 0x510e527f;
+    Sha->State[5] = 0x9b05688c;
+    Sha->State[6] = 0x1f83d9ab;
+    Sha->State[7] = 0x5be0cd19;
+
+    Sha->Length = 0;
+    Sha->Used = 0;
+}
+
+
+VOID
+csgSha256Update (
+    __inout PCSG_SHA256 Sha,
+    __in_bcount(Length) CONST VOID *Data,
+    __in SIZE_T Length
+    )
+{
+    CONST UCHAR *p = (CONST UCHAR *)Data;
+    SIZE_T chunk;
+
+    Sha->Length += Length;
+
+    while (Length > 0) {
+
+        if (Sha->Used == 0 && Length >= CSG_SHA256_BLOCK_SIZE) {
+
+            csgSha256Compress( Sha, p );
+
+            p += CSG_SHA256_BLOCK_SIZE;
+            Length -= CSG_SHA256_BLOCK_SIZE;
+            continue;
+        }
+
+        chunk = CSG_SHA256_BLOCK_SIZE - Sha->Used;
+
+        if (chunk > Length) {
+
+            chunk = Length;
+        }
+
+        RtlCopyMemory( Sha->Block + Sha->Used, p, chunk );
+
+        Sha->Used += (ULONG)chunk;
+        p += chunk;
+        Length -= chunk;
+
+        if (Sha->Used == CSG_SHA256_BLOCK_SIZE) {
+
+            csgSha256Compress( Sha, Sha->Block );
+            Sha->Used = 0;
+        }
+    }
+}
+
+
+VOID
+csgSha256Final (
+    __inout PCSG_SHA256 Sha,
+    __out_bcount(CSG_SHA256_DIGEST_SIZE) UCHAR *Digest
+    )
+{
+    ULONGLONG bits = Sha->Length * 8;
+    ULONG i;
+
+    Sha->Block[Sha->Used++] = 0x80;
+
+    if (Sha->Used > CSG_SHA256_BLOCK_SIZE - 8) {
+
+        RtlZeroMemory( Sha->Block + Sha->Used, CSG_SHA256_BLOCK_SIZE - Sha->Used );
+        csgSha256Compress( Sha, Sha->Block );
+        Sha->Used = 0;
+    }
+
+    RtlZeroMemory( Sha->Block + Sha->Used, CSG_SHA256_BLOCK_SIZE - 8 - Sha->Used );
+
+    for (i = 0; i < 8; i++) {
+
+        Sha->Block[CSG_SHA256_BLOCK_SIZE - 1 - i] = (UCHAR)(bits >> (8 * i));
+    }
+
+    csgSha256Compress( Sha, Sha->Block );
+
+    for (i = 0; i < 8; i++) {
+
+        Digest[4 * i] = (UCHAR)(Sha->State[i] >> 24);
+        Digest[4 * i + 1] = (UCHAR)(Sha->State[i] >> 16);
+        Digest[4 * i + 2] = (UCHAR)(Sha->State[i] >> 8);
+        Digest[4 * i + 3] = (UCHAR)Sha->State[i];
+    }
+
+    csgSecureZeroMemory( Sha, sizeof(CSG_SHA256) );
+}
+
+//
+//  HMAC-SHA256 over the concatenation of Count pieces.  Keys longer than a
+//  block are hashed first.
+//
+
+static VOID
+csgHmacSha256 (
+    __in_bcount(KeyLength) CONST UCHAR *Key,
+    __in SIZE_T KeyLength,
+    __in_ecount(Count) PCCSG_HKDF_INFO Pieces,
+    __in ULONG Count,
+    __out_bcount(CSG_SHA256_DIGEST_SIZE) UCHAR *Mac
+    )
+{
+    CSG_SHA256 sha;
+    UCHAR pad[CSG_SHA256_BLOCK_SIZE];
+    UCHAR inner[CSG_SHA256_DIGEST_SIZE];
+    ULONG i;
+
+    RtlZeroMemory( pad, sizeof(pad) );
+
+    if (KeyLength > CSG_SHA256_BLOCK_SIZE) {
+
+        csgSha256Init( &sha );
+        csgSha256Update( &sha, Key, KeyLength );
+        csgSha256Final( &sha, pad );
+
+    } else if (KeyLength > 0) {
+
+        RtlCopyMemory( pad, Key, KeyLength );
+    }
+
+    for (i = 0; i < CSG_SHA256_BLOCK_SIZE; i++) {
+
+        pad[i] ^= 0x36;
+    }
+
+    csgSha256Init( &sha );
+    csgSha256Update( &sha, pad, sizeof(pad) );
+
+    for (i = 0; i < Count; i++) {
+
+        csgSha256Update( &sha, Pieces[i].Data, Pieces[i].Length );
+    }
+
+    csgSha256Final( &sha, inner );
+
+    for (i = 0; i < CSG_SHA256_BLOCK_SIZE; i++) {
+
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+
+    csgSha256Init( &sha );
+    csgSha256Update( &sha, pad, sizeof(pad) );
+    csgSha256Update( &sha, inner, sizeof(inner) );
+    csgSha256Final( &sha, Mac );
+
+    csgSecureZeroMemory( pad, sizeof(pad) );
+    csgSecureZeroMemory( inner, sizeof(inner) );
+}
+
+
+VOID
+csgHkdfExtract (
+    __in_bcount(SaltLength) CONST UCHAR *Salt,
+    __in SIZE_T SaltLength,
+    __in_bcount(KeyLength) CONST UCHAR *Key,
+    __in SIZE_T KeyLength,
+    __out_bcount(CSG_SHA256_DIGEST_SIZE) UCHAR *Prk
+    )
+/*++
+
+Routine Description:
+
+    HKDF-Extract: PRK = HMAC-Hash( salt, IKM ).
+
+Arguments:
+
+    Salt - The salt, or NULL for none.
+
+    SaltLength - Bytes in Salt.
+
+    Key - The input keying material.
+
+    KeyLength - Bytes in Key.
+
+    Prk - Receives the pseudorandom key.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CSG_HKDF_INFO ikm;
+
+    ikm.Data = Key;
+    ikm.Length = KeyLength;
+
+    //
+    //  No salt and a salt of zeros give the same HMAC key.
+    //
+
+    csgHmacSha256( Salt, (Salt != NULL) ? SaltLength : 0, &ikm, 1, Prk );
+}
+
+
+NTSTATUS
+csgHkdfExpand (
+    __in_bcount(CSG_SHA256_DIGEST_SIZE) CONST UCHAR *Prk,
+    __in_ecount(InfoCount) PCCSG_HKDF_INFO Info,
+    __in ULONG InfoCount,
+    __out_bcount(Length) UCHAR *Output,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    HKDF-Expand: T(i) = HMAC-Hash( PRK, T(i-1) | info | i ), the output
+    being the first Length bytes of T(1) | T(2) | ...
+
+Arguments:
+
+    Prk - The pseudorandom key from csgHkdfExtract.
+
+    Info - The pieces of the context and application specific
+        information.
+
+    InfoCount - Number of pieces, at most 8.
+
+    Output - Receives the output keying material.
+
+    Length - Bytes to produce, at most CSG_HKDF_MAX_OUTPUT.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - too much output or too many pieces.
+
+--*/
+{
+    CSG_HKDF_INFO pieces[8 + 2];
+    UCHAR block[CSG_SHA256_DIGEST_SIZE];
+    UCHAR counter;
+    SIZE_T chunk;
+    ULONG i;
+
+    if ((Length > CSG_HKDF_MAX_OUTPUT) || (InfoCount > 8)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  The previous block comes first; T(0) is empty.
+    //
+
+    pieces[0].Data = block;
+    pieces[0].Length = 0;
+
+    for (i = 0; i < InfoCount; i++) {
+
+        pieces[1 + i] = Info[i];
+    }
+
+    pieces[1 + InfoCount].Data = &counter;
+    pieces[1 + InfoCount].Length = 1;
+
+    for (counter = 1; Length > 0; counter++) {
+
+        csgHmacSha256( Prk, CSG_SHA256_DIGEST_SIZE, pieces, InfoCount + 2, block );
+
+        chunk = (Length < sizeof(block)) ? Length : sizeof(block);
+
+        RtlCopyMemory( Output, block, chunk );
+
+        Output += chunk;
+        Length -= chunk;
+
+        pieces[0].Length = sizeof(block);
+    }
+
+    csgSecureZeroMemory( block, sizeof(block) );
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#ifndef __CSG_HKDF_H__
+#define __CSG_HKDF_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    HKDF with HMAC-SHA256 (RFC 5869)
+*************************************************************************/
+
+#define CSG_SHA256_BLOCK_SIZE   64
+#define CSG_SHA256_DIGEST_SIZE  32
+
+//
+//  HKDF-Expand can produce at most 255 blocks of output.
+//
+
+#define CSG_HKDF_MAX_OUTPUT     (255 * CSG_SHA256_DIGEST_SIZE)
+
+typedef struct _CSG_SHA256 {
+
+    ULONG State[8];
+
+    ULONGLONG Length;
+
+    UCHAR Block[CSG_SHA256_BLOCK_SIZE];
+
+    ULONG Used;
+
+} CSG_SHA256, *PCSG_SHA256;
+
+VOID
+csgSha256Init (
+    __out PCSG_SHA256 Sha
+    );
+
+VOID
+csgSha256Update (
+    __inout PCSG_SHA256 Sha,
+    __in_bcount(Length) CONST VOID *Data,
+    __in SIZE_T Length
+    );
+
+VOID
+csgSha256Final (
+    __inout PCSG_SHA256 Sha,
+    __out_bcount(CSG_SHA256_DIGEST_SIZE) UCHAR *Digest
+    );
+
+//
+//  HKDF-Extract: a pseudorandom key from input keying material and an
+//  optional salt.  A missing salt is a block of zeros, as the RFC says.
+//
+
+VOID
+csgHkdfExtract (
+    __in_bcount(SaltLength) CONST UCHAR *Salt,
+    __in SIZE_T SaltLength,
+    __in_bcount(KeyLength) CONST UCHAR *Key,
+    __in SIZE_T KeyLength,
+    __out_bcount(CSG_SHA256_DIGEST_SIZE) UCHAR *Prk
+    );
+
+//
+//  HKDF-Expand: Length bytes of output keying material for Info.  Info
+//  is taken as the concatenation of InfoCount pieces, so callers need not
+//  build it in a buffer of their own.
+//
+
+typedef struct _CSG_HKDF_INFO {
+
+    CONST VOID *Data;
+
+    SIZE_T Length;
+
+} CSG_HKDF_INFO, *PCSG_HKDF_INFO;
+
+typedef CONST CSG_HKDF_INFO *PCCSG_HKDF_INFO;
+
+NTSTATUS
+csgHkdfExpand (
+    __in_bcount(CSG_SHA256_DIGEST_SIZE) CONST UCHAR *Prk,
+    __in_ecount(InfoCount) PCCSG_HKDF_INFO Info,
+    __in ULONG InfoCount,
+    __out_bcount(Length) UCHAR *Output,
+    __in SIZE_T Length
+    );
+
+#endif // __CSG_HKDF_H__
@@ -0,0 +1,664 @@
+/*++
+
+Module Name:
+
+    csgKeyCache.c
+
+Abstract:
+
+    A bounded cache of expanded file keys, so opening a file whose key
+    was derived recently costs no key derivation and no key expansion
+    (see csgKeyCache.h).
+
+    The cache is split into a power of two of shards, at least as many as
+    there are processors, so lookups of different files rarely meet on a
+    lock.  Each shard owns a fixed array of entries, a hash table chaining
+    the ones in use and a list of them from most to least recently used.
+    Nothing is allocated after creation; an insert into a full shard
+    reuses its least recently used entry.
+
+    Lookups copy the value out under the shard lock rather than hand out
+    a reference, so an entry can be evicted and wiped at any time.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgKeyCache.h"
+
+#define CSG_KEYCACHE_CACHE_LINE     64
+
+#define CSG_KEYCACHE_MAX_SHARDS     64
+#define CSG_KEYCACHE_MAX_CAPACITY   0x10000
+
+#define CSG_KEYCACHE_TAG            'ckBS'
+
+typedef struct _CSG_KEYCACHE_ENTRY {
+
+    struct _CSG_KEYCACHE_ENTRY *HashNext;
+
+    //
+    //  The shard's LRU list, or the free list through Older.
+    //
+
+    struct _CSG_KEYCACHE_ENTRY *Newer;
+
+    struct _CSG_KEYCACHE_ENTRY *Older;
+
+    CSG_KEYCACHE_ID Id;
+
+    //
+    //  ValueSize bytes follow, aligned up to 16.
+    //
+
+} CSG_KEYCACHE_ENTRY, *PCSG_KEYCACHE_ENTRY;
+
+#define CSG_KEYCACHE_VALUE_OFFSET   ((sizeof(CSG_KEYCACHE_ENTRY) + 15) & ~(SIZE_T)15)
+
+typedef struct CSG_ALIGN(CSG_KEYCACHE_CACHE_LINE) _CSG_KEYCACHE_SHARD {
+
+    CSG_LOCK Lock;
+
+    PCSG_KEYCACHE_ENTRY *Buckets;
+
+    ULONG BucketMask;
+
+    ULONG Count;
+
+    PCSG_KEYCACHE_ENTRY Newest;
+
+    PCSG_KEYCACHE_ENTRY Oldest;
+
+    PCSG_KEYCACHE_ENTRY Free;
+
+    //
+    //  Updated under the lock.
+    //
+
+    ULONGLONG Hits;
+
+    ULONGLONG Misses;
+
+    ULONGLONG Inserts;
+
+    ULONGLONG Evictions;
+
+} CSG_KEYCACHE_SHARD, *PCSG_KEYCACHE_SHARD;
+
+struct _CSG_KEYCACHE {
+
+    //
+    //  Where the allocation for the cache really starts; the shards,
+    //  their buckets and their entries follow this structure.
+    //
+
+    PVOID Allocation;
+
+    SIZE_T AllocationSize;
+
+    SIZE_T ValueSize;
+
+    SIZE_T EntrySize;
+
+    ULONG ShardCount;
+
+    ULONG ShardCapacity;
+
+    PCSG_KEYCACHE_SHARD Shards;
+};
+
+CSG_INLINE ULONGLONG
+csgKeyCacheHash (
+    ULONGLONG FileId
+    )
+{
+    //
+    //  File ids are often small and sequential; mix them up before
+    //  picking a shard and a bucket (splitmix64's finalizer).
+    //
+
+    FileId ^= FileId >> 30;
+    FileId *= 0xbf58476d1ce4e5b9ULL;
+    FileId ^= FileId >> 27;
+    FileId *= 0x94d049bb133111ebULL;
+    FileId ^= FileId >> 31;
+
+    return FileId;
+}
+
+CSG_INLINE PUCHAR
+csgKeyCacheValue (
+    PCSG_KEYCACHE_ENTRY Entry
+    )
+{
+    return (PUCHAR)Entry + CSG_KEYCACHE_VALUE_OFFSET;
+}
+
+CSG_INLINE ULONG
+csgKeyCacheRoundUp (
+    ULONG Value
+    )
+{
+    ULONG power = 1;
+
+    while (power < Value) {
+
+        power *= 2;
+    }
+
+    return power;
+}
+
+//
+//  LRU list maintenance; the shard lock is held.
+//
+
+static VOID
+csgKeyCacheUnlinkLru (
+    PCSG_KEYCACHE_SHARD Shard,
+    PCSG_KEYCACHE_ENTRY Entry
+    )
+{
+    if (Entry->Newer != NULL) {
+
+        Entry->Newer->Older = Entry->Older;
+
+    } else {
+
+        Shard->Newest = Entry->Older;
+    }
+
+    if (Entry->Older != NULL) {
+
+        Entry->Older->Newer = Entry->Newer;
+
+    } else {
+
+        Shard->Oldest = Entry->Newer;
+    }
+}
+
+static VOID
+csgKeyCacheInsertNewest (
+    PCSG_KEYCACHE_SHARD Shard,
+    PCSG_KEYCACHE_ENTRY Entry
+    )
+{
+    Entry->Newer = NULL;
+    Entry->Older = Shard->Newest;
+
+    if (Shard->Newest != NULL) {
+
+        Shard->Newest->Newer = Entry;
+
+    } else {
+
+        Shard->Oldest = Entry;
+    }
+
+    Shard->Newest = Entry;
+}
+
+//
+//  Takes an entry out of the shard and wipes it; the shard lock is held.
+//
+
+static VOID
+csgKeyCacheRemove (
+    PCSG_KEYCACHE Cache,
+    PCSG_KEYCACHE_SHARD Shard,
+    PCSG_KEYCACHE_ENTRY Entry,
+    ULONG Bucket
+    )
+{
+    PCSG_KEYCACHE_ENTRY *link = &Shard->Buckets[Bucket];
+
+    while (*link != Entry) {
+
+        link = &(*link)->HashNext;
+    }
+
+    *link = Entry->HashNext;
+
+    csgKeyCacheUnlinkLru( Shard, Entry );
+
+    csgSecureZeroMemory( Entry, Cache->EntrySize );
+
+    Shard->Count--;
+}
+
+
+NTSTATUS
+csgKeyCacheCreate (
+    __in ULONG Capacity,
+    __in SIZE_T ValueSize,
+    __out PCSG_KEYCACHE *Cache
+    )
+/*++
+
+Routine Description:
+
+    Creates a key cache, with all the memory it will ever use.
+
+Arguments:
+
+    Capacity - How many keys the cache holds, at most 65536.  Rounded up
+        so every shard gets the same share.
+
+    ValueSize - Size of the value (an expanded key) kept for each.
+
+    Cache - Receives the cache.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - no capacity, or too much.
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    PCSG_KEYCACHE cache;
+    PCSG_KEYCACHE_SHARD shard;
+    PCSG_KEYCACHE_ENTRY entry;
+    ULONG shardCount;
+    ULONG shardCapacity;
+    ULONG bucketCount;
+    SIZE_T entrySize;
+    SIZE_T size;
+    PVOID allocation;
+    PUCHAR next;
+    ULONG i;
+    ULONG j;
+
+    *Cache = NULL;
+
+    if ((Capacity == 0) || (Capacity > CSG_KEYCACHE_MAX_CAPACITY) || (ValueSize == 0)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  A shard per processor, but never so many that a shard would hold
+    //  fewer than a few entries.
+    //
+
+    shardCount = csgKeyCacheRoundUp( csgCpuCount() );
+
+    if (shardCount > CSG_KEYCACHE_MAX_SHARDS) {
+
+        shardCount = CSG_KEYCACHE_MAX_SHARDS;
+    }
+
+    while ((shardCount > 1) && (Capacity / shardCount < 4)) {
+
+        shardCount /= 2;
+    }
+
+    shardCapacity = (Capacity + shardCount - 1) / shardCount;
+    bucketCount = csgKeyCacheRoundUp( shardCapacity );
+
+    entrySize = (CSG_KEYCACHE_VALUE_OFFSET + ValueSize + CSG_KEYCACHE_CACHE_LINE - 1) &
+                ~(SIZE_T)(CSG_KEYCACHE_CACHE_LINE - 1);
+
+    size = CSG_KEYCACHE_CACHE_LINE +
+           sizeof(CSG_KEYCACHE) +
+           CSG_KEYCACHE_CACHE_LINE +
+           shardCount * sizeof(CSG_KEYCACHE_SHARD) +
+           (SIZE_T)shardCount * bucketCount * sizeof(PCSG_KEYCACHE_ENTRY) +
+           CSG_KEYCACHE_CACHE_LINE +
+           (SIZE_T)shardCount * shardCapacity * entrySize;
+
+    allocation = csgAllocateNonPaged( size, CSG_KEYCACHE_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    cache = (PCSG_KEYCACHE)(((ULONG_PTR)allocation + CSG_KEYCACHE_CACHE_LINE - 1) &
+                            ~(ULONG_PTR)(CSG_KEYCACHE_CACHE_LINE - 1));
+
+    cache->Allocation = allocation;
+    cache->AllocationSize = size;
+    cache->ValueSize = ValueSize;
+    cache->EntrySize = entrySize;
+    cache->ShardCount = shardCount;
+    cache->ShardCapacity = shardCapacity;
+    cache->Shards = (PCSG_KEYCACHE_SHARD)(((ULONG_PTR)(cache + 1) + CSG_KEYCACHE_CACHE_LINE - 1) &
+                                          ~(ULONG_PTR)(CSG_KEYCACHE_CACHE_LINE - 1));
+
+    next = (PUCHAR)(cache->Shards + shardCount);
+
+    for (i = 0; i < shardCount; i++) {
+
+        shard = &cache->Shards[i];
+
+        csgLockInit( &shard->Lock );
+
+        shard->Buckets = (PCSG_KEYCACHE_ENTRY *)next;
+        shard->BucketMask = bucketCount - 1;
+
+        next += bucketCount * sizeof(PCSG_KEYCACHE_ENTRY);
+    }
+
+    next = (PUCHAR)(((ULONG_PTR)next + CSG_KEYCACHE_CACHE_LINE - 1) &
+                    ~(ULONG_PTR)(CSG_KEYCACHE_CACHE_LINE - 1));
+
+    for (i = 0; i < shardCount; i++) {
+
+        shard = &cache->Shards[i];
+
+        for (j = 0; j < shardCapacity; j++) {
+
+            entry = (PCSG_KEYCACHE_ENTRY)next;
+            entry->Older = shard->Free;
+            shard->Free = entry;
+
+            next += entrySize;
+        }
+    }
+
+    *Cache = cache;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgKeyCacheDestroy (
+    __in PCSG_KEYCACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Wipes and frees a key cache.  No other call may be in progress or
+    follow.
+
+Arguments:
+
+    Cache - The cache to destroy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PVOID allocation = Cache->Allocation;
+
+    csgSecureZeroMemory( allocation, Cache->AllocationSize );
+
+    csgFreeNonPaged( allocation, CSG_KEYCACHE_TAG );
+}
+
+
+BOOLEAN
+csgKeyCacheLookup (
+    __in PCSG_KEYCACHE Cache,
+    __in PCCSG_KEYCACHE_ID Id,
+    __out_bcount(ValueSize) PVOID Value
+    )
+/*++
+
+Routine Description:
+
+    Looks a key up and, if it is cached, copies it out and makes it the
+    shard's most recently used.
+
+Arguments:
+
+    Cache - The cache.
+
+    Id - What the key must match, all of it.
+
+    Value - Receives the cached value on a hit; untouched on a miss.
+
+Return Value:
+
+    TRUE on a hit.
+
+--*/
+{
+    ULONGLONG hash = csgKeyCacheHash( Id->FileId );
+    PCSG_KEYCACHE_SHARD shard = &Cache->Shards[hash & (Cache->ShardCount - 1)];
+    PCSG_KEYCACHE_ENTRY entry;
+    CSG_LOCK_STATE lockState;
+
+    csgLockAcquire( &shard->Lock, &lockState );
+
+    for (entry = shard->Buckets[(hash >> 32) & shard->BucketMask];
+         entry != NULL;
+         entry = entry->HashNext) {
+
+        if (RtlEqualMemory( &entry->Id, Id, sizeof(CSG_KEYCACHE_ID) )) {
+
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+
+        shard->Misses++;
+
+        csgLockRelease( &shard->Lock, lockState );
+
+        return FALSE;
+    }
+
+    if (entry != shard->Newest) {
+
+        csgKeyCacheUnlinkLru( shard, entry );
+        csgKeyCacheInsertNewest( shard, entry );
+    }
+
+    RtlCopyMemory( Value, csgKeyCacheValue( entry ), Cache->ValueSize );
+
+    shard->Hits++;
+
+    csgLockRelease( &shard->Lock, lockState );
+
+    return TRUE;
+}
+
+
+VOID
+csgKeyCacheInsert (
+    __in PCSG_KEYCACHE Cache,
+    __in PCCSG_KEYCACHE_ID Id,
+    __in_bcount(ValueSize) CONST VOID *Value
+    )
+/*++
+
+Routine Description:
+
+    Caches a key as the shard's most recently used.  An entry for the
+    same file id that does not match the rest of Id is stale (the file id
+    was reused, or the configuration changed) and is replaced; otherwise
+    a full shard gives up its least recently used entry.
+
+Arguments:
+
+    Cache - The cache.
+
+    Id - What later lookups must match.
+
+    Value - The value to keep; ValueSize bytes are copied.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONGLONG hash = csgKeyCacheHash( Id->FileId );
+    PCSG_KEYCACHE_SHARD shard = &Cache->Shards[hash & (Cache->ShardCount - 1)];
+    ULONG bucket = (ULONG)(hash >> 32) & shard->BucketMask;
+    PCSG_KEYCACHE_ENTRY entry;
+    CSG_LOCK_STATE lockState;
+
+    csgLockAcquire( &shard->Lock, &lockState );
+
+    for (entry = shard->Buckets[bucket]; entry != NULL; entry = entry->HashNext) {
+
+        if (entry->Id.FileId == Id->FileId) {
+
+            break;
+        }
+    }
+
+    if (entry != NULL) {
+
+        if (RtlEqualMemory( &entry->Id, Id, sizeof(CSG_KEYCACHE_ID) )) {
+
+            //
+            //  Two opens missed at once and both derived the key.
+            //
+
+            if (entry != shard->Newest) {
+
+                csgKeyCacheUnlinkLru( shard, entry );
+                csgKeyCacheInsertNewest( shard, entry );
+            }
+
+            csgLockRelease( &shard->Lock, lockState );
+
+            return;
+        }
+
+        csgKeyCacheRemove( Cache, shard, entry, bucket );
+
+    } else if (shard->Free != NULL) {
+
+        entry = shard->Free;
+        shard->Free = entry->Older;
+
+    } else {
+
+        entry = shard->Oldest;
+
+        csgKeyCacheRemove( Cache,
+                           shard,
+                           entry,
+                           (ULONG)(csgKeyCacheHash( entry->Id.FileId ) >> 32) & shard->BucketMask );
+
+        shard->Evictions++;
+    }
+
+    entry->Id = *Id;
+
+    RtlCopyMemory( csgKeyCacheValue( entry ), Value, Cache->ValueSize );
+
+    entry->HashNext = shard->Buckets[bucket];
+    shard->Buckets[bucket] = entry;
+
+    csgKeyCacheInsertNewest( shard, entry );
+
+    shard->Count++;
+    shard->Inserts++;
+
+    csgLockRelease( &shard->Lock, lockState );
+}
+
+
+VOID
+csgKeyCacheFlush (
+    __in PCSG_KEYCACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Wipes every cached key, as when the keys they were derived from go
+    away.  Counters are kept.
+
+Arguments:
+
+    Cache - The cache.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_KEYCACHE_SHARD shard;
+    PCSG_KEYCACHE_ENTRY entry;
+    CSG_LOCK_STATE lockState;
+    ULONG i;
+
+    for (i = 0; i < Cache->ShardCount; i++) {
+
+        shard = &Cache->Shards[i];
+
+        csgLockAcquire( &shard->Lock, &lockState );
+
+        while (shard->Oldest != NULL) {
+
+            entry = shard->Oldest;
+
+            csgKeyCacheRemove( Cache,
+                               shard,
+                               entry,
+                               (ULONG)(csgKeyCacheHash( entry->Id.FileId ) >> 32) & shard->BucketMask );
+
+            entry->Older = shard->Free;
+            shard->Free = entry;
+        }
+
+        csgLockRelease( &shard->Lock, lockState );
+    }
+}
+
+
+VOID
+csgKeyCacheQueryStats (
+    __in PCSG_KEYCACHE Cache,
+    __out PCSG_KEYCACHE_STATS Stats
+    )
+/*++
+
+Routine Description:
+
+    Sums the shards' counters.  Each shard is read under its lock, but the
+    shards are not read at one instant.
+
+Arguments:
+
+    Cache - The cache.
+
+    Stats - Receives the counters.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_KEYCACHE_SHARD shard;
+    CSG_LOCK_STATE lockState;
+    ULONG i;
+
+    RtlZeroMemory( Stats, sizeof(CSG_KEYCACHE_STATS) );
+
+    Stats->Capacity = Cache->ShardCount * Cache->ShardCapacity;
+
+    for (i = 0; i < Cache->ShardCount; i++) {
+
+        shard = &Cache->Shards[i];
+
+        csgLockAcquire( &shard->Lock, &lockState );
+
+        Stats->Hits += shard->Hits;
+        Stats->Misses += shard->Misses;
+        Stats->Inserts += shard->Inserts;
+        Stats->Evictions += shard->Evictions;
+        Stats->Entries += shard->Count;
+
+        csgLockRelease( &shard->Lock, lockState );
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef __CSG_KEYCACHE_H__
+#define __CSG_KEYCACHE_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Cache of expanded file keys
+*************************************************************************/
+
+//
+//  Opening a file whose key is derived (csgStream.c) costs an HKDF and an
+//  AES key expansion, which a build or a package install, opening
+//  thousands of small files again and again, would pay on every open.
+//  The cache keeps the expanded key of the files opened last, so only
+//  the header read is left.
+//
+//  Entries are found by file id and must match the rest of the
+//  CSG_KEYCACHE_ID too: a file id reused by another file, or a key
+//  derived under an older configuration, is a miss.  The cache is split
+//  into shards by file id, each with a lock, a hash table and an LRU
+//  list of its own and a fixed share of the entries, allocated up front.
+//  An insert into a full shard evicts its least recently used entry.
+//  Whatever leaves the cache is wiped.
+//
+//  All routines may be called at DISPATCH_LEVEL or below, except create
+//  and destroy.
+//
+
+typedef struct _CSG_KEYCACHE_ID {
+
+    ULONGLONG FileId;
+
+    //
+    //  The configuration the key was derived under.
+    //
+
+    ULONG Generation;
+
+    ULONG Algorithm;
+
+    //
+    //  Random per file (the header's IV seed), so two files with the same
+    //  id never share an entry.
+    //
+
+    UCHAR Salt[16];
+
+} CSG_KEYCACHE_ID, *PCSG_KEYCACHE_ID;
+
+typedef CONST CSG_KEYCACHE_ID *PCCSG_KEYCACHE_ID;
+
+typedef struct _CSG_KEYCACHE_STATS {
+
+    ULONGLONG Hits;
+
+    ULONGLONG Misses;
+
+    ULONGLONG Inserts;
+
+    ULONGLONG Evictions;
+
+    ULONG Entries;
+
+    ULONG Capacity;
+
+} CSG_KEYCACHE_STATS, *PCSG_KEYCACHE_STATS;
+
+typedef struct _CSG_KEYCACHE CSG_KEYCACHE, *PCSG_KEYCACHE;
+
+NTSTATUS
+csgKeyCacheCreate (
+    __in ULONG Capacity,
+    __in SIZE_T ValueSize,
+    __out PCSG_KEYCACHE *Cache
+    );
+
+VOID
+csgKeyCacheDestroy (
+    __in PCSG_KEYCACHE Cache
+    );
+
+BOOLEAN
+csgKeyCacheLookup (
+    __in PCSG_KEYCACHE Cache,
+    __in PCCSG_KEYCACHE_ID Id,
+    __out_bcount(ValueSize) PVOID Value
+    );
+
+VOID
+csgKeyCacheInsert (
+    __in PCSG_KEYCACHE Cache,
+    __in PCCSG_KEYCACHE_ID Id,
+    __in_bcount(ValueSize) CONST VOID *Value
+    );
+
+VOID
+csgKeyCacheFlush (
+    __in PCSG_KEYCACHE Cache
+    );
+
+VOID
+csgKeyCacheQueryStats (
+    __in PCSG_KEYCACHE Cache,
+    __out PCSG_KEYCACHE_STATS Stats
+    );
+
+#endif // __CSG_KEYCACHE_H__
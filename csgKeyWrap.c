@@ -0,0 +1,211 @@
+/*++
+
+Module Name:
+
+    csgKeyWrap.c
+
+Abstract:
+
+    AES key wrap as specified by RFC 3394, with the default initial value.
+    Used to store per-file keys in the file header under the configured
+    wrapping key.  Unwrapping checks the integrity value, so a header
+    written under another wrapping key, or damaged, is refused rather than
+    yielding a wrong key.
+
+    Wrapping is rare (once per file open), so this is written for clarity
+    over speed.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgKeyWrap.h"
+
+//
+//  The default initial value, RFC 3394 2.2.3.1.
+//
+
+static CONST UCHAR csgKeyWrapIv[CSG_KEYWRAP_SEMIBLOCK] = {
+    0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6
+};
+
+//
+//  A ^= t, with t as a big endian 64 bit number.
+//
+
+CSG_INLINE VOID
+csgKeyWrapXorCounter (
+    UCHAR A[CSG_KEYWRAP_SEMIBLOCK],
+    ULONGLONG t
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < CSG_KEYWRAP_SEMIBLOCK; i++) {
+
+        A[CSG_KEYWRAP_SEMIBLOCK - 1 - i] ^= (UCHAR)(t >> (8 * i));
+    }
+}
+
+
+NTSTATUS
+csgKeyWrap (
+    __in PCCSG_AES_KEY Kek,
+    __in_bcount(Length) CONST UCHAR *Key,
+    __in SIZE_T Length,
+    __out_bcount(Length + CSG_KEYWRAP_OVERHEAD) UCHAR *Wrapped
+    )
+/*++
+
+Routine Description:
+
+    Wraps a key.
+
+Arguments:
+
+    Kek - The key encryption key.
+
+    Key - The key to wrap.
+
+    Length - Length of Key, a multiple of 8 and at least 16.
+
+    Wrapped - Receives Length + 8 bytes.  May not overlap Key.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - bad Length.
+
+--*/
+{
+    UCHAR block[CSG_AES_BLOCK_SIZE];
+    SIZE_T n = Length / CSG_KEYWRAP_SEMIBLOCK;
+    SIZE_T i;
+    ULONG j;
+
+    if ((Length % CSG_KEYWRAP_SEMIBLOCK) != 0 || n < 2) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlCopyMemory( Wrapped, csgKeyWrapIv, CSG_KEYWRAP_SEMIBLOCK );
+    RtlCopyMemory( Wrapped + CSG_KEYWRAP_SEMIBLOCK, Key, Length );
+
+    for (j = 0; j < 6; j++) {
+
+        for (i = 1; i <= n; i++) {
+
+            RtlCopyMemory( block, Wrapped, CSG_KEYWRAP_SEMIBLOCK );
+            RtlCopyMemory( block + CSG_KEYWRAP_SEMIBLOCK,
+                           Wrapped + i * CSG_KEYWRAP_SEMIBLOCK,
+                           CSG_KEYWRAP_SEMIBLOCK );
+
+            csgAesEncryptBlock( Kek, block, block );
+
+            csgKeyWrapXorCounter( block, n * j + i );
+
+            RtlCopyMemory( Wrapped, block, CSG_KEYWRAP_SEMIBLOCK );
+            RtlCopyMemory( Wrapped + i * CSG_KEYWRAP_SEMIBLOCK,
+                           block + CSG_KEYWRAP_SEMIBLOCK,
+                           CSG_KEYWRAP_SEMIBLOCK );
+        }
+    }
+
+    csgSecureZeroMemory( block, sizeof(block) );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+csgKeyUnwrap (
+    __in PCCSG_AES_KEY Kek,
+    __in_bcount(WrappedLength) CONST UCHAR *Wrapped,
+    __in SIZE_T WrappedLength,
+    __out_bcount(WrappedLength - CSG_KEYWRAP_OVERHEAD) UCHAR *Key
+    )
+/*++
+
+Routine Description:
+
+    Unwraps a key and checks its integrity.
+
+Arguments:
+
+    Kek - The key encryption key.
+
+    Wrapped - The wrapped key.
+
+    WrappedLength - Length of Wrapped, a multiple of 8 and at least 24.
+
+    Key - Receives WrappedLength - 8 bytes.  May not overlap Wrapped.  Zeroed
+        if the integrity check fails.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - bad WrappedLength.
+    STATUS_UNSUCCESSFUL - the integrity check failed: wrong key encryption
+        key, or damaged data.
+
+--*/
+{
+    UCHAR block[CSG_AES_BLOCK_SIZE];
+    UCHAR A[CSG_KEYWRAP_SEMIBLOCK];
+    SIZE_T n = WrappedLength / CSG_KEYWRAP_SEMIBLOCK - 1;
+    SIZE_T i;
+    ULONG j;
+    UCHAR diff;
+
+    if ((WrappedLength % CSG_KEYWRAP_SEMIBLOCK) != 0 || WrappedLength < 3 * CSG_KEYWRAP_SEMIBLOCK) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlCopyMemory( A, Wrapped, CSG_KEYWRAP_SEMIBLOCK );
+    RtlCopyMemory( Key, Wrapped + CSG_KEYWRAP_SEMIBLOCK, n * CSG_KEYWRAP_SEMIBLOCK );
+
+    for (j = 6; j-- > 0; ) {
+
+        for (i = n; i >= 1; i--) {
+
+            RtlCopyMemory( block, A, CSG_KEYWRAP_SEMIBLOCK );
+            csgKeyWrapXorCounter( block, n * j + i );
+            RtlCopyMemory( block + CSG_KEYWRAP_SEMIBLOCK,
+                           Key + (i - 1) * CSG_KEYWRAP_SEMIBLOCK,
+                           CSG_KEYWRAP_SEMIBLOCK );
+
+            csgAesDecryptBlock( Kek, block, block );
+
+            RtlCopyMemory( A, block, CSG_KEYWRAP_SEMIBLOCK );
+            RtlCopyMemory( Key + (i - 1) * CSG_KEYWRAP_SEMIBLOCK,
+                           block + CSG_KEYWRAP_SEMIBLOCK,
+                           CSG_KEYWRAP_SEMIBLOCK );
+        }
+    }
+
+    csgSecureZeroMemory( block, sizeof(block) );
+
+    //
+    //  Compare without an early exit; the check should not leak how much
+    //  of the integrity value matched.
+    //
+
+    diff = 0;
+
+    for (i = 0; i < CSG_KEYWRAP_SEMIBLOCK; i++) {
+
+        diff |= A[i] ^ csgKeyWrapIv[i];
+    }
+
+    if (diff != 0) {
+
+        csgSecureZeroMemory( Key, n * CSG_KEYWRAP_SEMIBLOCK );
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
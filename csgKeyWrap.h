@@ -0,0 +1,35 @@
+#ifndef __CSG_KEYWRAP_H__
+#define __CSG_KEYWRAP_H__
+
+#include "csgAes.h"
+
+/*************************************************************************
+    AES key wrap (RFC 3394)
+*************************************************************************/
+
+//
+//  Keys are wrapped in 64 bit semiblocks, at least two of them; the
+//  wrapped form is one semiblock longer.
+//
+
+#define CSG_KEYWRAP_SEMIBLOCK   8
+
+#define CSG_KEYWRAP_OVERHEAD    CSG_KEYWRAP_SEMIBLOCK
+
+NTSTATUS
+csgKeyWrap (
+    __in PCCSG_AES_KEY Kek,
+    __in_bcount(Length) CONST UCHAR *Key,
+    __in SIZE_T Length,
+    __out_bcount(Length + CSG_KEYWRAP_OVERHEAD) UCHAR *Wrapped
+    );
+
+NTSTATUS
+csgKeyUnwrap (
+    __in PCCSG_AES_KEY Kek,
+    __in_bcount(WrappedLength) CONST UCHAR *Wrapped,
+    __in SIZE_T WrappedLength,
+    __out_bcount(WrappedLength - CSG_KEYWRAP_OVERHEAD) UCHAR *Key
+    );
+
+#endif // __CSG_KEYWRAP_H__
@@ -0,0 +1,580 @@
+#ifndef __CSG_PORT_H__
+#define __CSG_PORT_H__
+
+/*++
+
+Module Name:
+
+    csgPort.h
+
+Abstract:
+
+    Platform layer for the modules that do not depend on FltMgr (cipher
+    engine and friends).  In the driver build this is a thin veneer over
+    the kernel headers.  When CSG_USER_MODE is defined the same modules
+    build as plain C against the C runtime, so they can be exercised and
+    benchmarked in user mode on any platform.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#ifdef CSG_USER_MODE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef VOID
+#define VOID void
+#endif
+
+#ifndef CONST
+#define CONST const
+#endif
+
+typedef char        CHAR, *PCHAR;
+typedef uint8_t     UCHAR, *PUCHAR;
+typedef uint16_t    USHORT, *PUSHORT;
+typedef uint32_t    ULONG, *PULONG;
+typedef int32_t     LONG, *PLONG;
+typedef uint64_t    ULONGLONG, *PULONGLONG;
+typedef int64_t     LONGLONG, *PLONGLONG;
+typedef size_t      SIZE_T, *PSIZE_T;
+typedef uintptr_t   ULONG_PTR, *PULONG_PTR;
+typedef uint8_t     BOOLEAN, *PBOOLEAN;
+typedef void        *PVOID;
+typedef int32_t     NTSTATUS;
+
+#define TRUE    1
+#define FALSE   0
+
+#define MAXULONG    0xffffffffUL
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_FILE_CORRUPT_ERROR       ((NTSTATUS)0xC0000102L)
+
+#define NT_SUCCESS(_s)  (((NTSTATUS)(_s)) >= 0)
+
+#define ASSERT(_e)      assert(_e)
+
+#define RtlCopyMemory(_d, _s, _l)   memcpy((_d), (_s), (_l))
+#define RtlZeroMemory(_d, _l)       memset((_d), 0, (_l))
+#define RtlEqualMemory(_a, _b, _l)  (memcmp((_a), (_b), (_l)) == 0)
+
+#define UNREFERENCED_PARAMETER(_p)  ((void)(_p))
+
+//
+//  The SAL annotations used by the portable modules.
+//
+
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __out_opt
+#define __inout_opt
+#define __in_bcount(_n)
+#define __out_bcount(_n)
+#define __inout_bcount(_n)
+#define __in_ecount(_n)
+#define __out_ecount(_n)
+#define __inout_ecount(_n)
+
+#else
+
+#include <fltKernel.h>
+
+#endif
+
+/*************************************************************************
+    Compiler and architecture helpers
+*************************************************************************/
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CSG_ARCH_AMD64  1
+#endif
+
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+
+#define CSG_INLINE          static __forceinline
+#define CSG_ALIGN(_n)       __declspec(align(_n))
+#define CSG_TARGET(_isa)
+
+#else
+
+#define CSG_INLINE          static inline __attribute__((always_inline))
+#define CSG_ALIGN(_n)       __attribute__((aligned(_n)))
+#define CSG_TARGET(_isa)    __attribute__((target(_isa)))
+
+#endif
+
+#ifdef CSG_ARCH_AMD64
+#include <immintrin.h>
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+#endif
+
+//
+//  Index of the highest set bit of a nonzero value.
+//
+
+#if defined(_MSC_VER)
+
+CSG_INLINE ULONG
+csgHighestBit32 (
+    ULONG Value
+    )
+{
+    unsigned long index;
+
+    _BitScanReverse( &index, Value );
+
+    return index;
+}
+
+#else
+
+#define csgHighestBit32(_v)     ((ULONG)(31 - __builtin_clz( (_v) )))
+
+#endif
+
+//
+//  Wipe key material in a way the optimizer will not remove.
+//
+
+#ifdef CSG_USER_MODE
+
+CSG_INLINE VOID
+csgSecureZeroMemory (
+    PVOID Buffer,
+    SIZE_T Length
+    )
+{
+    volatile UCHAR *p = (volatile UCHAR *)Buffer;
+
+    while (Length--) {
+
+        *p++ = 0;
+    }
+}
+
+#else
+
+#define csgSecureZeroMemory(_b, _l)     RtlSecureZeroMemory((_b), (_l))
+
+#endif
+
+//
+//  Kernel code must save the extended (YMM/ZMM) register state before it
+//  touches AVX registers.  User mode needs nothing.
+//
+
+#define CSG_XSTATE_MASK_AVX     (1ULL << 2)
+#define CSG_XSTATE_MASK_AVX512  ((1ULL << 5) | (1ULL << 6) | (1ULL << 7))
+
+#ifdef CSG_USER_MODE
+
+typedef struct _CSG_XSTATE_SAVE {
+
+    ULONG Unused;
+
+} CSG_XSTATE_SAVE;
+
+#define csgSaveExtendedState(_mask, _save)  ((VOID)(_save), STATUS_SUCCESS)
+#define csgRestoreExtendedState(_save)      ((VOID)(_save))
+
+#else
+
+typedef XSTATE_SAVE CSG_XSTATE_SAVE;
+
+#define csgSaveExtendedState(_mask, _save)  KeSaveExtendedProcessorState( (_mask), (_save) )
+#define csgRestoreExtendedState(_save)      KeRestoreExtendedProcessorState( (_save) )
+
+#endif
+
+/*************************************************************************
+    Processors, locks and counters
+*************************************************************************/
+
+//
+//  CSG_LOCK is a spin lock that may be taken at DISPATCH_LEVEL.  Acquire
+//  fills in a CSG_LOCK_STATE that must be handed back to Release.
+//
+
+#ifdef CSG_USER_MODE
+
+typedef struct _CSG_LOCK {
+
+    volatile LONG Locked;
+
+} CSG_LOCK, *PCSG_LOCK;
+
+typedef UCHAR CSG_LOCK_STATE;
+
+#if defined(_MSC_VER)
+
+#define csgLockTryAcquire(_l)   (_InterlockedExchange( (volatile long *)&(_l)->Locked, 1 ) == 0)
+#define csgLockClear(_l)        _InterlockedExchange( (volatile long *)&(_l)->Locked, 0 )
+#define csgLockIsHeld(_l)       ((_l)->Locked != 0)
+#define csgInterlockedIncrement64(_p)   _InterlockedIncrement64( (_p) )
+#define csgInterlockedAdd64(_p, _v)     _InterlockedExchangeAdd64( (_p), (_v) )
+#define csgInterlockedIncrement(_p)     _InterlockedIncrement( (volatile long *)(_p) )
+#define csgInterlockedDecrement(_p)     _InterlockedDecrement( (volatile long *)(_p) )
+#define csgInterlockedCompareExchange(_p, _v, _c)                           \
+                                        _InterlockedCompareExchange( (volatile long *)(_p), (_v), (_c) )
+
+#else
+
+#define csgLockTryAcquire(_l)   (__atomic_exchange_n( &(_l)->Locked, 1, __ATOMIC_ACQUIRE ) == 0)
+#define csgLockClear(_l)        __atomic_store_n( &(_l)->Locked, 0, __ATOMIC_RELEASE )
+#define csgLockIsHeld(_l)       (__atomic_load_n( &(_l)->Locked, __ATOMIC_RELAXED ) != 0)
+#define csgInterlockedIncrement64(_p)   __atomic_add_fetch( (_p), 1, __ATOMIC_RELAXED )
+#define csgInterlockedAdd64(_p, _v)     __atomic_fetch_add( (_p), (_v), __ATOMIC_RELAXED )
+#define csgInterlockedIncrement(_p)     __atomic_add_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define csgInterlockedDecrement(_p)     __atomic_sub_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define csgInterlockedCompareExchange(_p, _v, _c)                           \
+                                        __sync_val_compare_and_swap( (_p), (_c), (_v) )
+
+#endif
+
+#define csgLockInit(_l)         ((_l)->Locked = 0)
+
+CSG_INLINE VOID
+csgLockAcquire (
+    PCSG_LOCK Lock,
+    CSG_LOCK_STATE *State
+    )
+{
+    *State = 0;
+
+    while (!csgLockTryAcquire( Lock )) {
+
+        while (csgLockIsHeld( Lock )) {
+
+#ifdef CSG_ARCH_AMD64
+            _mm_pause();
+#endif
+        }
+    }
+}
+
+#define csgLockRelease(_l, _s)  ((VOID)(_s), csgLockClear( _l ))
+
+//
+//  Implemented in csgCpu.c.
+//
+
+ULONG
+csgCpuCount (
+    VOID
+    );
+
+ULONG
+csgCurrentCpu (
+    VOID
+    );
+
+#else
+
+typedef struct _CSG_LOCK {
+
+    KSPIN_LOCK Lock;
+
+} CSG_LOCK, *PCSG_LOCK;
+
+typedef KIRQL CSG_LOCK_STATE;
+
+#define csgLockInit(_l)                 KeInitializeSpinLock( &(_l)->Lock )
+#define csgLockAcquire(_l, _s)          KeAcquireSpinLock( &(_l)->Lock, (_s) )
+#define csgLockRelease(_l, _s)          KeReleaseSpinLock( &(_l)->Lock, (_s) )
+#define csgInterlockedIncrement64(_p)   InterlockedIncrement64( (_p) )
+#define csgInterlockedAdd64(_p, _v)     InterlockedExchangeAdd64( (_p), (_v) )
+#define csgInterlockedIncrement(_p)     InterlockedIncrement( (volatile LONG *)(_p) )
+#define csgInterlockedDecrement(_p)     InterlockedDecrement( (volatile LONG *)(_p) )
+#define csgInterlockedCompareExchange(_p, _v, _c)                           \
+                                        InterlockedCompareExchange( (volatile LONG *)(_p), (_v), (_c) )
+
+#define csgCpuCount()       KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS )
+#define csgCurrentCpu()     KeGetCurrentProcessorNumberEx( NULL )
+
+#endif
+
+/*************************************************************************
+    Ordered access and timestamps
+*************************************************************************/
+
+//
+//  For data published to readers that take no lock: the writer fences
+//  between its stores, then releases a flag or pointer; the reader
+//  acquires the flag or pointer before it looks at the data and fences
+//  before it checks the flag again.  On x86 and x64 only the compiler can
+//  reorder stores, so the fences cost nothing there.
+//
+
+#ifdef CSG_USER_MODE
+
+#define csgStoreFence()             __atomic_thread_fence( __ATOMIC_RELEASE )
+#define csgLoadFence()              __atomic_thread_fence( __ATOMIC_ACQUIRE )
+#define csgStoreRelease32(_p, _v)   __atomic_store_n( (_p), (_v), __ATOMIC_RELEASE )
+#define csgLoadAcquire32(_p)        __atomic_load_n( (_p), __ATOMIC_ACQUIRE )
+#define csgStoreReleasePointer(_p, _v)  __atomic_store_n( (_p), (_v), __ATOMIC_RELEASE )
+#define csgLoadAcquirePointer(_p)   __atomic_load_n( (_p), __ATOMIC_ACQUIRE )
+
+#else
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define csgStoreFence()             KeMemoryBarrierWithoutFence()
+#define csgLoadFence()              KeMemoryBarrierWithoutFence()
+#else
+#define csgStoreFence()             KeMemoryBarrier()
+#define csgLoadFence()              KeMemoryBarrier()
+#endif
+
+#define csgStoreRelease32(_p, _v)   (csgStoreFence(), *(volatile ULONG *)(_p) = (_v))
+#define csgLoadAcquire32(_p)        csgLoadAcquire32Fn( (volatile ULONG *)(_p) )
+#define csgStoreReleasePointer(_p, _v)  (csgStoreFence(), *(PVOID volatile *)(_p) = (_v))
+#define csgLoadAcquirePointer(_p)   csgLoadAcquirePointerFn( (PVOID volatile *)(_p) )
+
+CSG_INLINE ULONG
+csgLoadAcquire32Fn (
+    volatile ULONG *Pointer
+    )
+{
+    ULONG value = *Pointer;
+
+    csgLoadFence();
+
+    return value;
+}
+
+CSG_INLINE PVOID
+csgLoadAcquirePointerFn (
+    PVOID volatile *Pointer
+    )
+{
+    PVOID value = *Pointer;
+
+    csgLoadFence();
+
+    return value;
+}
+
+#endif
+
+//
+//  A full fence: unlike the two above it also keeps a load from moving
+//  ahead of an earlier store, which x86 and x64 otherwise allow.
+//
+
+#ifdef CSG_USER_MODE
+
+#define csgMemoryBarrier()          __atomic_thread_fence( __ATOMIC_SEQ_CST )
+
+#else
+
+#define csgMemoryBarrier()          KeMemoryBarrier()
+
+#endif
+
+//
+//  Gives up the processor for about Milliseconds.  Only where waiting is
+//  allowed: below DISPATCH_LEVEL in kernel mode.
+//
+
+#ifdef CSG_USER_MODE
+
+#include <time.h>
+
+CSG_INLINE VOID
+csgDelay (
+    ULONG Milliseconds
+    )
+{
+    struct timespec delay;
+
+    delay.tv_sec = Milliseconds / 1000;
+    delay.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+
+    nanosleep( &delay, NULL );
+}
+
+#else
+
+CSG_INLINE VOID
+csgDelay (
+    ULONG Milliseconds
+    )
+{
+    LARGE_INTEGER interval;
+
+    interval.QuadPart = -10000LL * Milliseconds;
+
+    KeDelayExecutionThread( KernelMode, FALSE, &interval );
+}
+
+#endif
+
+//
+//  A cheap, monotonic timestamp in unspecified units: the time stamp
+//  counter on x64, the performance counter or the monotonic clock
+//  elsewhere.  Only differences between two readings mean anything.
+//
+
+#if defined(CSG_ARCH_AMD64)
+
+#define csgReadTimestamp()          ((ULONGLONG)__rdtsc())
+
+#elif defined(CSG_USER_MODE)
+
+#include <time.h>
+
+CSG_INLINE ULONGLONG
+csgReadTimestamp (
+    VOID
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+#else
+
+#define csgReadTimestamp()          ((ULONGLONG)KeQueryPerformanceCounter( NULL ).QuadPart)
+
+#endif
+
+/*************************************************************************
+    Nonpaged memory and MDLs
+*************************************************************************/
+
+//
+//  In user mode there is no MDL.  The portable modules only pass PMDLs
+//  around, and the routines below are left to whoever links them; a test
+//  harness supplies mocks that track what was built and freed.
+//
+
+#ifdef CSG_USER_MODE
+
+typedef struct _MDL MDL, *PMDL;
+
+#include <stdlib.h>
+
+#define csgAllocateNonPaged(_size, _tag)    malloc( (_size) )
+#define csgFreeNonPaged(_p, _tag)           free( (_p) )
+
+PMDL
+csgMdlAllocate (
+    PVOID VirtualAddress,
+    ULONG Length
+    );
+
+VOID
+csgMdlBuildForNonPagedPool (
+    PMDL Mdl
+    );
+
+VOID
+csgMdlBuildPartial (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    );
+
+VOID
+csgMdlPrepareForReuse (
+    PMDL Mdl
+    );
+
+VOID
+csgMdlFree (
+    PMDL Mdl
+    );
+
+#else
+
+#define csgAllocateNonPaged(_size, _tag)    ExAllocatePoolWithTag( NonPagedPool, (_size), (_tag) )
+#define csgFreeNonPaged(_p, _tag)           ExFreePoolWithTag( (_p), (_tag) )
+
+#define csgMdlAllocate(_va, _len)           IoAllocateMdl( (_va), (_len), FALSE, FALSE, NULL )
+#define csgMdlBuildForNonPagedPool(_mdl)    MmBuildMdlForNonPagedPool( (_mdl) )
+#define csgMdlBuildPartial(_src, _dst, _va, _len)                           \
+                                            IoBuildPartialMdl( (_src), (_dst), (_va), (_len) )
+#define csgMdlPrepareForReuse(_mdl)         MmPrepareMdlForReuse( (_mdl) )
+#define csgMdlFree(_mdl)                    IoFreeMdl( (_mdl) )
+
+#endif
+
+#ifdef CSG_ARCH_AMD64
+
+//
+//  Execute CPUID for the given leaf and sub-leaf.  Regs receives EAX, EBX,
+//  ECX and EDX in that order.
+//
+
+CSG_INLINE VOID
+csgCpuid (
+    ULONG Leaf,
+    ULONG SubLeaf,
+    ULONG Regs[4]
+    )
+{
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuidex( info, (int)Leaf, (int)SubLeaf );
+
+    Regs[0] = (ULONG)info[0];
+    Regs[1] = (ULONG)info[1];
+    Regs[2] = (ULONG)info[2];
+    Regs[3] = (ULONG)info[3];
+#else
+    unsigned int a, b, c, d;
+
+    __cpuid_count( Leaf, SubLeaf, a, b, c, d );
+
+    Regs[0] = a;
+    Regs[1] = b;
+    Regs[2] = c;
+    Regs[3] = d;
+#endif
+}
+
+//
+//  Read XCR0 to find out which register state the OS saves on context
+//  switches.  Only valid when CPUID reports OSXSAVE.
+//
+
+#if defined(_MSC_VER)
+#define csgReadXcr0()   ((ULONGLONG)_xgetbv( 0 ))
+#else
+static inline ULONGLONG
+csgReadXcr0 (
+    VOID
+    )
+{
+    ULONG lo, hi;
+
+    __asm__ __volatile__ ( "xgetbv" : "=a" (lo), "=d" (hi) : "c" (0) );
+
+    return ((ULONGLONG)hi << 32) | lo;
+}
+#endif
+
+#endif // CSG_ARCH_AMD64
+
+#endif // __CSG_PORT_H__
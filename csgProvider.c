@@ -0,0 +1,157 @@
+/*++
+
+Module Name:
+
+    csgProvider.c
+
+Abstract:
+
+    The table of cipher providers and the routine that picks one.
+
+    The driver selects a provider once, when it loads, from the features
+    csgCpuQueryFeatures reports.  The read and write paths then call the
+    provider's transform through a single pointer, so no I/O pays for a
+    feature check.  Passing a reduced feature mask forces a lower tier;
+    that is how the portable providers get exercised on hardware that
+    would never pick them.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgProvider.h"
+
+/*************************************************************************
+    Transform routines
+*************************************************************************/
+
+#define CSG_PROVIDER_XTS_ROUTINE(_name, _routine)                               \
+static VOID                                                                     \
+_name (                                                                         \
+    __in CONST VOID *Key,                                                       \
+    __in ULONGLONG DataUnit,                                                    \
+    __in ULONG DataUnitSize,                                                    \
+    __in_bcount(Length) CONST UCHAR *Src,                                       \
+    __out_bcount(Length) UCHAR *Dst,                                            \
+    __in SIZE_T Length                                                          \
+    )                                                                           \
+{                                                                               \
+    _routine( (PCCSG_XTS_KEY)Key, DataUnit, DataUnitSize, Src, Dst, Length );   \
+}
+
+//
+//  CTR counts in AES blocks from the start of the file.
+//
+
+#define CSG_PROVIDER_CTR_ROUTINE(_name, _routine)                               \
+static VOID                                                                     \
+_name (                                                                         \
+    __in CONST VOID *Key,                                                       \
+    __in ULONGLONG DataUnit,                                                    \
+    __in ULONG DataUnitSize,                                                    \
+    __in_bcount(Length) CONST UCHAR *Src,                                       \
+    __out_bcount(Length) UCHAR *Dst,                                            \
+    __in SIZE_T Length                                                          \
+    )                                                                           \
+{                                                                               \
+    _routine( (PCCSG_CTR_KEY)Key,                                               \
+              DataUnit * (DataUnitSize / CSG_AES_BLOCK_SIZE),                   \
+              Src,                                                              \
+              Dst,                                                              \
+              Length );                                                         \
+}
+
+CSG_PROVIDER_XTS_ROUTINE( csgXtsEncryptGenericRoutine, csgXtsEncryptGeneric )
+CSG_PROVIDER_XTS_ROUTINE( csgXtsDecryptGenericRoutine, csgXtsDecryptGeneric )
+CSG_PROVIDER_CTR_ROUTINE( csgCtrGenericRoutine, csgCtrCryptGeneric )
+
+#ifdef CSG_ARCH_AMD64
+CSG_PROVIDER_XTS_ROUTINE( csgXtsEncryptAesNiRoutine, csgXtsEncryptAesNi )
+CSG_PROVIDER_XTS_ROUTINE( csgXtsDecryptAesNiRoutine, csgXtsDecryptAesNi )
+CSG_PROVIDER_CTR_ROUTINE( csgCtrAesNiRoutine, csgCtrCryptAesNi )
+CSG_PROVIDER_CTR_ROUTINE( csgCtrVaes256Routine, csgCtrCryptVaes256 )
+CSG_PROVIDER_CTR_ROUTINE( csgCtrVaes512Routine, csgCtrCryptVaes512 )
+#endif
+
+/*************************************************************************
+    Provider table
+*************************************************************************/
+
+//
+//  Best first within each cipher; the first entry whose features are all
+//  present wins.
+//
+
+static CONST CSG_PROVIDER csgProviders[] = {
+
+#ifdef CSG_ARCH_AMD64
+    { CSG_CIPHER_XTS,
+      CSG_CPU_AESNI,
+      { "aes-xts/aesni", TRUE, csgXtsEncryptAesNiRoutine, csgXtsDecryptAesNiRoutine } },
+#endif
+
+    { CSG_CIPHER_XTS,
+      0,
+      { "aes-xts/ct", TRUE, csgXtsEncryptGenericRoutine, csgXtsDecryptGenericRoutine } },
+
+#ifdef CSG_ARCH_AMD64
+    { CSG_CIPHER_CTR,
+      CSG_CPU_AESNI | CSG_CPU_VAES | CSG_CPU_AVX512,
+      { "aes-ctr/vaes512", FALSE, csgCtrVaes512Routine, csgCtrVaes512Routine } },
+
+    { CSG_CIPHER_CTR,
+      CSG_CPU_AESNI | CSG_CPU_VAES | CSG_CPU_AVX2,
+      { "aes-ctr/vaes256", FALSE, csgCtrVaes256Routine, csgCtrVaes256Routine } },
+
+    { CSG_CIPHER_CTR,
+      CSG_CPU_AESNI,
+      { "aes-ctr/aesni", FALSE, csgCtrAesNiRoutine, csgCtrAesNiRoutine } },
+#endif
+
+    { CSG_CIPHER_CTR,
+      0,
+      { "aes-ctr/ct", FALSE, csgCtrGenericRoutine, csgCtrGenericRoutine } },
+};
+
+
+PCCSG_TRANSFORM
+csgProviderSelect (
+    __in ULONG Cipher,
+    __in ULONG Features
+    )
+/*++
+
+Routine Description:
+
+    Picks the best provider of a cipher that only needs the given
+    features.
+
+Arguments:
+
+    Cipher - CSG_CIPHER_* value.
+
+    Features - CSG_CPU_* features the provider may use.  Normally what
+        csgCpuQueryFeatures reports; pass less to force a lower tier.
+        Passing features the processor lacks is a bug.
+
+Return Value:
+
+    The provider's transform, or NULL if the cipher is unknown.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(csgProviders) / sizeof(csgProviders[0]); i++) {
+
+        if (csgProviders[i].Cipher == Cipher &&
+            (csgProviders[i].Features & ~Features) == 0) {
+
+            return &csgProviders[i].Transform;
+        }
+    }
+
+    return NULL;
+}
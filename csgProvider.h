@@ -0,0 +1,55 @@
+#ifndef __CSG_PROVIDER_H__
+#define __CSG_PROVIDER_H__
+
+#include "csgTransform.h"
+#include "csgCpu.h"
+#include "csgXts.h"
+#include "csgCtr.h"
+
+/*************************************************************************
+    Cipher providers
+*************************************************************************/
+
+//
+//  Ciphers a policy can ask for.  XTS suits general file data.  CTR is
+//  faster on large transfers, but reuses keystream when a block is
+//  rewritten, so it is meant for write-once bulk data such as media and
+//  backups, and the driver only lets such streams grow (see csgCtr.h).
+//
+
+#define CSG_CIPHER_XTS  0
+#define CSG_CIPHER_CTR  1
+
+//
+//  A provider is one implementation of a cipher, packaged as a transform.
+//  Each cipher has a portable provider that needs no features, so a
+//  selection always succeeds for a known cipher.
+//
+
+typedef struct _CSG_PROVIDER {
+
+    //
+    //  CSG_CIPHER_* value this provider implements.
+    //
+
+    ULONG Cipher;
+
+    //
+    //  CSG_CPU_* features it needs.
+    //
+
+    ULONG Features;
+
+    CSG_TRANSFORM Transform;
+
+} CSG_PROVIDER, *PCSG_PROVIDER;
+
+typedef CONST CSG_PROVIDER *PCCSG_PROVIDER;
+
+PCCSG_TRANSFORM
+csgProviderSelect (
+    __in ULONG Cipher,
+    __in ULONG Features
+    );
+
+#endif // __CSG_PROVIDER_H__
@@ -0,0 +1,304 @@
+/*++
+
+Module Name:
+
+    csgRcu.c
+
+Abstract:
+
+    Read-copy-update grace periods, after the classic SRCU scheme.
+
+    Readers count themselves in one of two epochs, on the current
+    processor's shard: a lock count on entry and an unlock count on exit,
+    both only ever incremented, so a reader that moves to another
+    processor in between is still accounted for once the shards are added
+    up.  An epoch has no readers left when its unlocks, summed first, equal
+    its locks, summed after.
+
+    csgRcuSynchronize waits for the idle epoch to drain, switches readers
+    to it, and waits for the epoch they were using to drain.  The first
+    wait catches a reader that picked its epoch before the previous switch
+    but was counted only after that switch's wait had finished.  Without
+    it, such a reader could still hold an object the next grace period
+    frees.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.  Readers at
+    any IRQL up to DISPATCH_LEVEL; csgRcuSynchronize at PASSIVE_LEVEL or
+    APC_LEVEL.
+
+--*/
+
+#include "csgRcu.h"
+
+#define CSG_RCU_CACHE_LINE      64
+
+#define CSG_RCU_TAG             'ucBS'
+
+//
+//  How long csgRcuSynchronize sleeps between looks at the counters.
+//
+
+#define CSG_RCU_POLL_MS         1
+
+typedef struct CSG_ALIGN(CSG_RCU_CACHE_LINE) _CSG_RCU_SHARD {
+
+    volatile LONGLONG Locks[2];
+
+    volatile LONGLONG Unlocks[2];
+
+} CSG_RCU_SHARD, *PCSG_RCU_SHARD;
+
+struct _CSG_RCU {
+
+    //
+    //  The epoch new readers join, zero or one.
+    //
+
+    volatile ULONG Epoch;
+
+    ULONG ShardCount;
+
+    PCSG_RCU_SHARD Shards;
+
+    //
+    //  Where the allocation for this structure really starts.
+    //
+
+    PVOID Allocation;
+};
+
+
+NTSTATUS
+csgRcuCreate (
+    __out PCSG_RCU *Rcu
+    )
+/*++
+
+Routine Description:
+
+    Creates a grace period domain with a shard per processor.
+
+Arguments:
+
+    Rcu - Receives the domain.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    PCSG_RCU rcu;
+    ULONG shardCount = csgCpuCount();
+    SIZE_T size;
+    PVOID allocation;
+
+    *Rcu = NULL;
+
+    size = CSG_RCU_CACHE_LINE +
+           sizeof(CSG_RCU) +
+           CSG_RCU_CACHE_LINE +
+           shardCount * sizeof(CSG_RCU_SHARD);
+
+    allocation = csgAllocateNonPaged( size, CSG_RCU_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    rcu = (PCSG_RCU)(((ULONG_PTR)allocation + CSG_RCU_CACHE_LINE - 1) &
+                     ~(ULONG_PTR)(CSG_RCU_CACHE_LINE - 1));
+
+    rcu->Allocation = allocation;
+    rcu->ShardCount = shardCount;
+    rcu->Shards = (PCSG_RCU_SHARD)(((ULONG_PTR)(rcu + 1) + CSG_RCU_CACHE_LINE - 1) &
+                                   ~(ULONG_PTR)(CSG_RCU_CACHE_LINE - 1));
+
+    *Rcu = rcu;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgRcuDestroy (
+    __in PCSG_RCU Rcu
+    )
+/*++
+
+Routine Description:
+
+    Frees a domain.  No reader may be inside it.
+
+Arguments:
+
+    Rcu - The domain to destroy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgFreeNonPaged( Rcu->Allocation, CSG_RCU_TAG );
+}
+
+
+ULONG
+csgRcuReadLock (
+    __in PCSG_RCU Rcu
+    )
+/*++
+
+Routine Description:
+
+    Enters a read section.  Pointers protected by the domain may be loaded
+    once this returns.
+
+Arguments:
+
+    Rcu - The domain.
+
+Return Value:
+
+    A cookie for csgRcuReadUnlock.
+
+--*/
+{
+    ULONG epoch = csgLoadAcquire32( &Rcu->Epoch ) & 1;
+
+    csgInterlockedIncrement64( &Rcu->Shards[csgCurrentCpu() % Rcu->ShardCount].Locks[epoch] );
+
+    //
+    //  The count must be visible before any protected pointer is loaded.
+    //
+
+    csgMemoryBarrier();
+
+    return epoch;
+}
+
+
+VOID
+csgRcuReadUnlock (
+    __in PCSG_RCU Rcu,
+    __in ULONG Cookie
+    )
+/*++
+
+Routine Description:
+
+    Leaves a read section.  Nothing loaded inside it may be used after.
+
+Arguments:
+
+    Rcu - The domain.
+
+    Cookie - What csgRcuReadLock returned.
+
+Return Value:
+
+    None
+
+--*/
+{
+    //
+    //  Every access inside the section comes before the count.  A release
+    //  fence is enough: it also orders earlier loads before later stores.
+    //
+
+    csgStoreFence();
+
+    csgInterlockedIncrement64( &Rcu->Shards[csgCurrentCpu() % Rcu->ShardCount].Unlocks[Cookie] );
+}
+
+
+static BOOLEAN
+csgRcuEpochIdle (
+    PCSG_RCU Rcu,
+    ULONG Epoch
+    )
+{
+    LONGLONG locks = 0;
+    LONGLONG unlocks = 0;
+    ULONG i;
+
+    for (i = 0; i < Rcu->ShardCount; i++) {
+
+        unlocks += Rcu->Shards[i].Unlocks[Epoch];
+    }
+
+    //
+    //  A reader whose unlock was counted above had its lock counted
+    //  before that, so it cannot be missing from the locks.
+    //
+
+    csgMemoryBarrier();
+
+    for (i = 0; i < Rcu->ShardCount; i++) {
+
+        locks += Rcu->Shards[i].Locks[Epoch];
+    }
+
+    return (locks == unlocks);
+}
+
+
+static VOID
+csgRcuWaitForEpoch (
+    PCSG_RCU Rcu,
+    ULONG Epoch
+    )
+{
+    while (!csgRcuEpochIdle( Rcu, Epoch )) {
+
+        csgDelay( CSG_RCU_POLL_MS );
+    }
+}
+
+
+VOID
+csgRcuSynchronize (
+    __in PCSG_RCU Rcu
+    )
+/*++
+
+Routine Description:
+
+    Waits until every read section that began before the call has ended.
+    May sleep.  Calls must not overlap.
+
+Arguments:
+
+    Rcu - The domain.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG epoch = Rcu->Epoch & 1;
+
+    //
+    //  Whatever the caller published is visible before we look at the
+    //  counters; a reader counted too late to be waited for will see it.
+    //
+
+    csgMemoryBarrier();
+
+    csgRcuWaitForEpoch( Rcu, epoch ^ 1 );
+
+    csgStoreRelease32( &Rcu->Epoch, epoch ^ 1 );
+    csgMemoryBarrier();
+
+    csgRcuWaitForEpoch( Rcu, epoch );
+
+    csgMemoryBarrier();
+}
@@ -0,0 +1,51 @@
+#ifndef __CSG_RCU_H__
+#define __CSG_RCU_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Read-copy-update with sleepable readers
+*************************************************************************/
+
+//
+//  Readers of a published pointer bracket their use of it with
+//  csgRcuReadLock and csgRcuReadUnlock, which take no lock and touch only
+//  counters of the current processor.  A read section may last as long
+//  as it likes, sleep, and end on another processor; it must end on the
+//  same thread or on one the section was handed to.
+//
+//  A writer publishes a new object with csgStoreReleasePointer, calls
+//  csgRcuSynchronize, and may then free the old object: every reader that
+//  could have seen it has finished.  Writers must be serialized by the
+//  caller.
+//
+
+typedef struct _CSG_RCU CSG_RCU, *PCSG_RCU;
+
+NTSTATUS
+csgRcuCreate (
+    __out PCSG_RCU *Rcu
+    );
+
+VOID
+csgRcuDestroy (
+    __in PCSG_RCU Rcu
+    );
+
+ULONG
+csgRcuReadLock (
+    __in PCSG_RCU Rcu
+    );
+
+VOID
+csgRcuReadUnlock (
+    __in PCSG_RCU Rcu,
+    __in ULONG Cookie
+    );
+
+VOID
+csgRcuSynchronize (
+    __in PCSG_RCU Rcu
+    );
+
+#endif // __CSG_RCU_H__
@@ -1,8 +1,45 @@
 #include "csgRead.h"
 #include "csgGlobal.h"
 #include "csgStruct.h"
+#include "csgStream.h"
 
-extern NPAGED_LOOKASIDE_LIST Pre2PostContextList;
+extern PCSG_BUFCACHE SwapBufferCache;
+
+//
+//  The least a read is split into when it is deciphered in chunks; below
+//  this, handing a chunk to another processor costs more than it saves.
+//
+
+#define READ_MIN_CHUNK          (256 * 1024)
+
+//
+//  Chunks a split read gets for each thread that can take one, so that
+//  a thread that gets to the read late still finds some.
+//
+
+#define READ_CHUNKS_PER_THREAD  4
+
+static VOID
+csgTransformToUserBuffer (
+    __in PPRE_2_POST_CONTEXT p2pCtx,
+    __out_bcount(Offset + Length) PVOID OrigBuf,
+    __in ULONG_PTR Offset,
+    __in ULONG_PTR Length
+    );
+
+static ULONG
+csgReadChunkCount (
+    __inout PPRE_2_POST_CONTEXT p2pCtx,
+    __in ULONG_PTR Length
+    );
+
+static BOOLEAN
+csgReadDecipherInChunks (
+    __inout PFLT_CALLBACK_DATA Data,
+    __inout PPRE_2_POST_CONTEXT p2pCtx,
+    __in PVOID OrigBuf,
+    __in ULONG ChunkCount
+    );
 
 FLT_PREOP_CALLBACK_STATUS
 csgPreReadBuffers(
@@ -33,20 +70,47 @@ Return Value:
 
     FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
     FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
+    FLT_PREOP_COMPLETE - the read has no offset to key the cipher on, or
+        starts at or past the end of a protected stream's data;
+        Data->IoStatus.Status has the status
 
 --*/
 {
     PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PCSG_SWAP_DESC swapDesc = NULL;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
+    PSTREAM_CONTEXT streamCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     NTSTATUS status;
+    ULONGLONG startTime = csgReadTimestamp();
+    ULONGLONG stageStart;
     ULONG readLen = iopb->Parameters.Read.Length;
+    LONGLONG fileSize;
+    PCCSG_TRANSFORM transform = &csgCopyTransform;
+    CONST VOID *transformKey = NULL;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+
+    config = ConfigReadLock( &configCookie );
 
     try {
 
+        //
+        //  Record the operation for capture before anything decides to
+        //  leave it alone.
+        //
+
+        CSG_TRACE6( IO_READ,
+                    FltObjects->FileObject,
+                    iopb->Parameters.Read.ByteOffset.QuadPart,
+                    readLen,
+                    iopb->IrpFlags,
+                    Data->Flags,
+                    PsGetCurrentThreadId() );
+
         //
         //  If they are trying to read ZERO bytes, then don't do anything and
         //  we don't need a post-operation callback.
@@ -57,6 +121,71 @@ Return Value:
             leave;
         }
 
+        //
+        //  When only some files are protected, those carry our stream
+        //  context and everything else passes through untouched.  The
+        //  context holds the key, so we keep it until the post-operation.
+        //
+
+        if (config->ProtectedExtensionCount != 0) {
+
+            status = FltGetStreamContext( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &streamCtx );
+
+            if (!NT_SUCCESS( status )) {
+
+                streamCtx = NULL;
+                leave;
+            }
+
+            if (streamCtx->LoadStatus != STATUS_SUCCESS) {
+
+                leave;
+            }
+
+            //
+            //  The file system's end of file is HeaderSize past the end of
+            //  the data, so cached and fast I/O reads must stop at the end
+            //  of the data themselves.  Noncached reads are shifted by
+            //  HeaderSize and stop at the right place.
+            //
+
+            if (!FlagOn( iopb->IrpFlags, IRP_NOCACHE | IRP_PAGING_IO ) &&
+                (iopb->Parameters.Read.ByteOffset.QuadPart >= 0)) {
+
+                fileSize = streamCtx->FileSize;
+
+                if (iopb->Parameters.Read.ByteOffset.QuadPart >= fileSize) {
+
+                    Data->IoStatus.Status = STATUS_END_OF_FILE;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (fileSize - iopb->Parameters.Read.ByteOffset.QuadPart < readLen) {
+
+                    readLen = (ULONG)(fileSize - iopb->Parameters.Read.ByteOffset.QuadPart);
+                    iopb->Parameters.Read.Length = readLen;
+                    FltSetCallbackDataDirty( Data );
+                }
+            }
+        }
+
+        //
+        //  In noncached only mode cached and fast I/O is left alone; the
+        //  data gets swapped when the cache manager or memory manager
+        //  moves it to or from the disk.
+        //
+
+        if (config->NoncachedOnly &&
+            (!FLT_IS_IRP_OPERATION( Data ) ||
+             !FlagOn( iopb->IrpFlags, IRP_NOCACHE | IRP_PAGING_IO ))) {
+
+            leave;
+        }
+
         //
         //  Get our volume context so we can display our volume name in the
         //  debug output.
@@ -68,9 +197,8 @@ Return Value:
 
         if (!NT_SUCCESS(status)) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreReadBuffers:             Error getting volume context, status=%x\n",
-                        status) );
+            CSG_TRACE1( READ_NO_VOLCTX,
+                        (ULONG)status );
 
             leave;
         }
@@ -85,28 +213,64 @@ Return Value:
         if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
 
             readLen = (ULONG)ROUND_TO_SIZE(readLen,volCtx->SectorSize);
+
+            //
+            //  Noncached data comes straight off the disk, so it is
+            //  enciphered and we decipher it in the post-operation.  The
+            //  cipher is keyed on the position (the XTS tweak or the CTR
+            //  counter), so we must know where the read comes from.
+            //
+
+            if ((streamCtx != NULL) || config->CipherEnabled) {
+
+                if (iopb->Parameters.Read.ByteOffset.QuadPart < 0) {
+
+                    CSG_TRACE1( READ_NO_OFFSET,
+                                volCtx );
+
+                    Data->IoStatus.Status = STATUS_INVALID_PARAMETER;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (streamCtx != NULL) {
+
+                    transform = streamCtx->Transform;
+                    transformKey = &streamCtx->Key;
+
+                } else {
+
+                    transform = config->CipherTransform;
+                    transformKey = config->CipherTransformKey;
+                }
+            }
         }
 
         //
-        //  Allocate nonPaged memory for the buffer we are swapping to.
-        //  If we fail to get the memory, just don't swap buffers on this
-        //  operation.
+        //  Get a nonPaged buffer to swap to from our cache.  If we fail to
+        //  get the memory, just don't swap buffers on this operation.
         //
 
-        newBuf = ExAllocatePoolWithTag( NonPagedPool,
-                                        readLen,
-                                        BUFFER_SWAP_TAG );
+        stageStart = StageTimestamp();
+
+        swapDesc = csgBufCacheAllocate( SwapBufferCache, readLen );
+
+        RecordStageCost( CSG_STAGE_READ_ALLOCATE, stageStart );
+
+        if (swapDesc == NULL) {
 
-        if (newBuf == NULL) {
+            CSG_TRACE2( READ_NO_BUFFER,
+                        volCtx,
+                        readLen );
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreReadBuffers:             %wZ Failed to allocate %d bytes of memory\n",
-                        &volCtx->Name,
-                        readLen) );
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        newBuf = swapDesc->Buffer;
+
         //
         //  We only need to build a MDL for IRP operations.  We don't need to
         //  do this for a FASTIO operation since the FASTIO interface has no
@@ -116,30 +280,28 @@ Return Value:
         if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_IRP_OPERATION)) {
 
             //
-            //  Allocate a MDL for the new allocated memory.  If we fail
-            //  the MDL allocation then we won't swap buffer for this operation
+            //  The descriptor already describes the buffer; the MDL for
+            //  this I/O is a partial copy of that, which the
+            //  post-operation callback takes back for the descriptor's
+            //  next I/O.  If we fail the MDL allocation then we won't swap
+            //  buffer for this operation
             //
 
-            newMdl = IoAllocateMdl( newBuf,
-                                    readLen,
-                                    FALSE,
-                                    FALSE,
-                                    NULL );
+            stageStart = StageTimestamp();
+
+            newMdl = csgSwapDescBuildMdl( swapDesc, readLen );
+
+            RecordStageCost( CSG_STAGE_READ_MDL, stageStart );
 
             if (newMdl == NULL) {
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPreReadBuffers:             %wZ Failed to allocate MDL\n",
-                            &volCtx->Name) );
+                CSG_TRACE1( READ_NO_MDL,
+                            volCtx );
+
+                COUNT_STAT( AllocationFailures, 1 );
 
                 leave;
             }
-
-            //
-            //  setup the MDL for the non-paged pool we just allocated
-            //
-
-            MmBuildMdlForNonPagedPool( newMdl );
         }
 
         //
@@ -148,29 +310,42 @@ Return Value:
         //  buffer to the post operation callback.
         //
 
-        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+        p2pCtx = AllocatePre2PostContext();
 
         if (p2pCtx == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreReadBuffers:             %wZ Failed to allocate pre2Post context structure\n",
-                        &volCtx->Name) );
+            CSG_TRACE1( READ_NO_CONTEXT,
+                        volCtx );
+
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        //
+        //  A users buffer the postOperation callback could only reach at
+        //  a safe IRQL is locked while we are in the issuer's context.
+        //
+
+        if (config->LockUserBuffers) {
+
+            LockUserBufferForPostOp( Data, iopb->Parameters.Read.MdlAddress );
+        }
+
         //
         //  Log that we are swapping
         //
 
-        LOG_PRINT( LOGFL_READ,
-                   ("csg!csgPreReadBuffers:             %wZ newB=%p newMdl=%p oldB=%p oldMdl=%p len=%d\n",
-                    &volCtx->Name,
+        CSG_TRACE6( READ_SWAP,
+                    volCtx,
                     newBuf,
                     newMdl,
                     iopb->Parameters.Read.ReadBuffer,
                     iopb->Parameters.Read.MdlAddress,
-                    readLen) );
+                    readLen );
+
+        COUNT_STAT( ReadOperations, 1 );
+        COUNT_STAT( ReadBytes, readLen );
 
         //
         //  Update the buffer pointers and MDL address, mark we have changed
@@ -186,7 +361,29 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwapDesc = swapDesc;
+        p2pCtx->SwappedLength = readLen;
         p2pCtx->VolCtx = volCtx;
+        p2pCtx->StartTime = startTime;
+        p2pCtx->Transform = transform;
+        p2pCtx->TransformKey = transformKey;
+        p2pCtx->StreamCtx = streamCtx;
+        p2pCtx->DataUnit = (ULONGLONG)iopb->Parameters.Read.ByteOffset.QuadPart / volCtx->SectorSize;
+        p2pCtx->ConfigCookie = configCookie;
+        p2pCtx->ParallelReadThreshold = config->ParallelReadThreshold;
+        p2pCtx->HeaderSize = 0;
+
+        //
+        //  A protected stream's data starts after its header.  The cipher
+        //  works on offsets within the data, so shift only what the file
+        //  system sees, and only once the data unit is known.
+        //
+
+        if ((streamCtx != NULL) && FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
+
+            p2pCtx->HeaderSize = streamCtx->Header.HeaderSize;
+            iopb->Parameters.Read.ByteOffset.QuadPart += p2pCtx->HeaderSize;
+        }
 
         *CompletionContext = p2pCtx;
 
@@ -204,20 +401,27 @@ Return Value:
 
         if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
 
-            if (newBuf != NULL) {
+            if (newMdl != NULL) {
 
-                ExFreePool( newBuf );
+                csgSwapDescKeepMdl( swapDesc, newMdl );
             }
 
-            if (newMdl != NULL) {
+            if (swapDesc != NULL) {
 
-                IoFreeMdl( newMdl );
+                csgBufCacheFree( SwapBufferCache, swapDesc, readLen );
             }
 
             if (volCtx != NULL) {
 
                 FltReleaseContext( volCtx );
             }
+
+            if (streamCtx != NULL) {
+
+                FltReleaseContext( streamCtx );
+            }
+
+            ConfigReadUnlock( configCookie );
         }
     }
 
@@ -262,6 +466,8 @@ Return Value:
     FLT_POSTOP_CALLBACK_STATUS retValue = FLT_POSTOP_FINISHED_PROCESSING;
     PPRE_2_POST_CONTEXT p2pCtx = CompletionContext;
     BOOLEAN cleanupAllocatedBuffer = TRUE;
+    BOOLEAN split = FALSE;
+    ULONG chunkCount;
 
     //
     //  This system won't draining an operation with swapped buffers, verify
@@ -270,6 +476,14 @@ Return Value:
 
     ASSERT(!FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING));
 
+    KeepSwappedMdl( Data, p2pCtx );
+
+    //
+    //  The file system moved the file pointer past the shifted offset.
+    //
+
+    csgStreamSetFilePosition( Data, p2pCtx );
+
     try {
 
         //
@@ -280,12 +494,11 @@ Return Value:
         if (!NT_SUCCESS(Data->IoStatus.Status) ||
             (Data->IoStatus.Information == 0)) {
 
-            LOG_PRINT( LOGFL_READ,
-                       ("csg!csgPostReadBuffers:            %wZ newB=%p No data read, status=%x, info=%x\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE4( READ_NO_DATA,
+                        p2pCtx->VolCtx,
                         p2pCtx->SwappedBuffer,
-                        Data->IoStatus.Status,
-                        Data->IoStatus.Information) );
+                        (ULONG)Data->IoStatus.Status,
+                        Data->IoStatus.Information );
 
             leave;
         }
@@ -310,10 +523,9 @@ Return Value:
 
             if (origBuf == NULL) {
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPostReadBuffers:            %wZ Failed to get system address for MDL: %p\n",
-                            &p2pCtx->VolCtx->Name,
-                            iopb->Parameters.Read.MdlAddress) );
+                CSG_TRACE2( READ_NO_SYSADDR,
+                            p2pCtx->VolCtx,
+                            iopb->Parameters.Read.MdlAddress );
 
                 //
                 //  If we failed to get a SYSTEM address, mark that the read
@@ -325,6 +537,8 @@ Return Value:
                 leave;
             }
 
+            COUNT_STAT( PostMdlCompletions, 1 );
+
         } else if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_SYSTEM_BUFFER) ||
                    FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_FAST_IO_OPERATION)) {
 
@@ -338,6 +552,15 @@ Return Value:
 
             origBuf = iopb->Parameters.Read.ReadBuffer;
 
+            if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_FAST_IO_OPERATION)) {
+
+                COUNT_STAT( PostFastIoCompletions, 1 );
+
+            } else {
+
+                COUNT_STAT( PostSystemBufferCompletions, 1 );
+            }
+
         } else {
 
             //
@@ -347,6 +570,8 @@ Return Value:
             //  try and get to a safe IRQL so we can do the processing.
             //
 
+            p2pCtx->PostedTime = StageTimestamp();
+
             if (FltDoCompletionProcessingWhenSafe( Data,
                                                    FltObjects,
                                                    CompletionContext,
@@ -362,6 +587,8 @@ Return Value:
 
                 cleanupAllocatedBuffer = FALSE;
 
+                COUNT_STAT( SafePostings, 1 );
+
             } else {
 
                 //
@@ -373,9 +600,10 @@ Return Value:
                 //  a MDL.
                 //
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPostReadBuffers:            %wZ Unable to post to a safe IRQL\n",
-                            &p2pCtx->VolCtx->Name) );
+                CSG_TRACE1( READ_NOT_SAFE,
+                            p2pCtx->VolCtx );
+
+                COUNT_STAT( SafePostFailures, 1 );
 
                 Data->IoStatus.Status = STATUS_UNSUCCESSFUL;
                 Data->IoStatus.Information = 0;
@@ -384,6 +612,35 @@ Return Value:
             leave;
         }
 
+        //
+        //  A large read off the disk is deciphered in chunks, by this
+        //  thread and the crypto workers at once.  The users buffer must
+        //  then be at a system address, which a FASTIO buffer is not.
+        //
+
+        if (!FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_FAST_IO_OPERATION)) {
+
+            chunkCount = csgReadChunkCount( p2pCtx, Data->IoStatus.Information );
+
+            if (chunkCount > 1) {
+
+                split = TRUE;
+
+                if (!csgReadDecipherInChunks( Data, p2pCtx, origBuf, chunkCount )) {
+
+                    //
+                    //  A worker still has chunks to finish; the one that
+                    //  finishes the last cleans up and completes the read.
+                    //
+
+                    cleanupAllocatedBuffer = FALSE;
+                    retValue = FLT_POSTOP_MORE_PROCESSING_REQUIRED;
+                }
+
+                leave;
+            }
+        }
+
         //
         //  We either have a system buffer or this is a fastio operation
         //  so we are in the proper context.  Copy the data handling an
@@ -392,9 +649,10 @@ Return Value:
 
         try {
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            csgTransformToUserBuffer( p2pCtx,
+                                      origBuf,
+                                      0,
+                                      Data->IoStatus.Information );
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
@@ -405,11 +663,10 @@ Return Value:
             Data->IoStatus.Status = GetExceptionCode();
             Data->IoStatus.Information = 0;
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPostReadBuffers:            %wZ Invalid user buffer, oldB=%p, status=%x\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE3( READ_BAD_BUFFER,
+                        p2pCtx->VolCtx,
                         origBuf,
-                        Data->IoStatus.Status) );
+                        (ULONG)Data->IoStatus.Status );
         }
 
     } finally {
@@ -422,17 +679,37 @@ Return Value:
 
         if (cleanupAllocatedBuffer) {
 
-            LOG_PRINT( LOGFL_READ,
-                       ("csg!csgPostReadBuffers:            %wZ newB=%p info=%d Freeing\n",
-                        &p2pCtx->VolCtx->Name,
+            CSG_TRACE3( READ_FREE,
+                        p2pCtx->VolCtx,
                         p2pCtx->SwappedBuffer,
-                        Data->IoStatus.Information) );
+                        Data->IoStatus.Information );
+
+            RecordPre2PostLatency( p2pCtx, CSG_LATENCY_READ );
 
-            ExFreePool( p2pCtx->SwappedBuffer );
+            csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
             FltReleaseContext( p2pCtx->VolCtx );
 
-            ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                         p2pCtx );
+            if (p2pCtx->StreamCtx != NULL) {
+
+                FltReleaseContext( p2pCtx->StreamCtx );
+            }
+
+            ConfigReadUnlock( p2pCtx->ConfigCookie );
+
+            if (!split) {
+
+                FreePre2PostContext( p2pCtx );
+            }
+        }
+
+        //
+        //  A split read's context goes when the last of the workers that
+        //  were asked to help lets go of it.
+        //
+
+        if (split) {
+
+            csgWorkJobRelease( &p2pCtx->Job );
         }
     }
 
@@ -481,6 +758,8 @@ Return Value:
     UNREFERENCED_PARAMETER( Flags );
     ASSERT(Data->IoStatus.Information != 0);
 
+    RecordStageCost( CSG_STAGE_READ_POST_WAIT, p2pCtx->PostedTime );
+
     //
     //  This is some sort of user buffer without a MDL, lock the user buffer
     //  so we can access it.  This will create a MDL for it.
@@ -490,11 +769,10 @@ Return Value:
 
     if (!NT_SUCCESS(status)) {
 
-        LOG_PRINT( LOGFL_ERRORS,
-                   ("csg!SwapPostReadBuffersWhenSafe:    %wZ Could not lock user buffer, oldB=%p, status=%x\n",
-                    &p2pCtx->VolCtx->Name,
+        CSG_TRACE3( READ_SAFE_NO_LOCK,
+                    p2pCtx->VolCtx,
                     iopb->Parameters.Read.ReadBuffer,
-                    status) );
+                    (ULONG)status );
 
         //
         //  If we can't lock the buffer, fail the operation
@@ -514,10 +792,9 @@ Return Value:
 
         if (origBuf == NULL) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!SwapPostReadBuffersWhenSafe:    %wZ Failed to get system address for MDL: %p\n",
-                        &p2pCtx->VolCtx->Name,
-                        iopb->Parameters.Read.MdlAddress) );
+            CSG_TRACE2( READ_SAFE_NO_SYSADDR,
+                        p2pCtx->VolCtx,
+                        iopb->Parameters.Read.MdlAddress );
 
             //
             //  If we couldn't get a SYSTEM buffer address, fail the operation
@@ -534,9 +811,10 @@ Return Value:
             //  buffer address.
             //
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            csgTransformToUserBuffer( p2pCtx,
+                                      origBuf,
+                                      0,
+                                      Data->IoStatus.Information );
         }
     }
 
@@ -544,19 +822,311 @@ Return Value:
     //  Free allocated memory and release the volume context
     //
 
-    LOG_PRINT( LOGFL_READ,
-               ("csg!SwapPostReadBuffersWhenSafe:    %wZ newB=%p info=%d Freeing\n",
-                &p2pCtx->VolCtx->Name,
+    CSG_TRACE3( READ_SAFE_FREE,
+                p2pCtx->VolCtx,
                 p2pCtx->SwappedBuffer,
-                Data->IoStatus.Information) );
+                Data->IoStatus.Information );
+
+    RecordPre2PostLatency( p2pCtx, CSG_LATENCY_READ );
 
-    ExFreePool( p2pCtx->SwappedBuffer );
+    csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
     FltReleaseContext( p2pCtx->VolCtx );
 
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    if (p2pCtx->StreamCtx != NULL) {
+
+        FltReleaseContext( p2pCtx->StreamCtx );
+    }
+
+    ConfigReadUnlock( p2pCtx->ConfigCookie );
+
+    FreePre2PostContext( p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
 
 
+static VOID
+csgTransformToUserBuffer (
+    __in PPRE_2_POST_CONTEXT p2pCtx,
+    __out_bcount(Offset + Length) PVOID OrigBuf,
+    __in ULONG_PTR Offset,
+    __in ULONG_PTR Length
+    )
+/*++
+
+Routine Description:
+
+    Moves the data read into our swapped buffer back to the users buffer,
+    deciphering it on the way when it came from disk.  This is the only
+    pass over either buffer.
+
+    A cipher works on whole sectors but the read may have returned a
+    partial last sector (at end of file).  That sector is deciphered in
+    place in the swapped buffer, which was sized to whole sectors in the
+    pre-operation, and only the bytes that were read are copied out.
+
+Arguments:
+
+    p2pCtx - The state passed from the pre-operation.
+
+    OrigBuf - The users buffer.  The caller handles any exception raised
+        while accessing it.
+
+    Offset - Where in the read to start, a multiple of the sector size.
+
+    Length - Number of bytes to move from Offset: to the end of what the
+        read returned, or a whole number of sectors short of it.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCCSG_TRANSFORM transform = p2pCtx->Transform;
+    ULONG sectorSize = p2pCtx->VolCtx->SectorSize;
+    ULONGLONG dataUnit = p2pCtx->DataUnit + Offset / sectorSize;
+    PUCHAR swapped = (PUCHAR)p2pCtx->SwappedBuffer + Offset;
+    PUCHAR user = (PUCHAR)OrigBuf + Offset;
+    ULONG_PTR whole = Length;
+    ULONGLONG transformStart = csgReadTimestamp();
+
+    ASSERT( (Offset % sectorSize) == 0 );
+
+    if (transform->WholeUnits) {
+
+        whole = Length - (Length % sectorSize);
+    }
+
+    transform->Decrypt( p2pCtx->TransformKey,
+                        dataUnit,
+                        sectorSize,
+                        swapped,
+                        user,
+                        whole );
+
+    if (whole < Length) {
+
+        transform->Decrypt( p2pCtx->TransformKey,
+                            dataUnit + whole / sectorSize,
+                            sectorSize,
+                            swapped + whole,
+                            swapped + whole,
+                            sectorSize );
+
+        RtlCopyMemory( user + whole,
+                       swapped + whole,
+                       Length - whole );
+    }
+
+    RecordTransformCost( CSG_STAGE_READ_TRANSFORM, transform, Length, transformStart );
+}
+
+
+static ULONG
+csgReadChunkCount (
+    __inout PPRE_2_POST_CONTEXT p2pCtx,
+    __in ULONG_PTR Length
+    )
+/*++
+
+Routine Description:
+
+    Decides whether a read is deciphered in chunks and into how many.  A
+    read is split only when it is at least the configuration's
+    ParallelReadThreshold and there are crypto workers to share it with.
+    It gets READ_CHUNKS_PER_THREAD chunks for each thread that could take
+    one, fewer if that would make them smaller than READ_MIN_CHUNK, each
+    a whole number of sectors.
+
+Arguments:
+
+    p2pCtx - The state passed from the pre-operation.  ChunkLength is set
+        when the read is split.
+
+    Length - Number of bytes the read returned.
+
+Return Value:
+
+    The number of chunks; 1 if the read is deciphered in one piece.
+
+--*/
+{
+    ULONG_PTR chunks;
+    ULONG_PTR chunkLength;
+    ULONG threads;
+
+    if ((CryptoWorkPool == NULL) ||
+        (p2pCtx->Transform == &csgCopyTransform) ||
+        (p2pCtx->ParallelReadThreshold == 0) ||
+        (Length < p2pCtx->ParallelReadThreshold)) {
+
+        return 1;
+    }
+
+    threads = csgWorkPoolConcurrency( CryptoWorkPool );
+
+    if (threads < 2) {
+
+        return 1;
+    }
+
+    chunks = Length / READ_MIN_CHUNK;
+
+    if (chunks > (ULONG_PTR)threads * READ_CHUNKS_PER_THREAD) {
+
+        chunks = (ULONG_PTR)threads * READ_CHUNKS_PER_THREAD;
+    }
+
+    if (chunks < 2) {
+
+        return 1;
+    }
+
+    chunkLength = ROUND_TO_SIZE( (Length + chunks - 1) / chunks, p2pCtx->VolCtx->SectorSize );
+
+    p2pCtx->ChunkLength = (ULONG)chunkLength;
+
+    return (ULONG)((Length + chunkLength - 1) / chunkLength);
+}
+
+
+static VOID
+csgReadDecipherChunk (
+    __in PVOID Context,
+    __in ULONG Chunk
+    )
+/*++
+
+Routine Description:
+
+    Job routine for a split read: deciphers one chunk into the users
+    buffer.  The last chunk takes the partial sector at the end, if any.
+
+--*/
+{
+    PPRE_2_POST_CONTEXT p2pCtx = Context;
+    ULONG_PTR offset = (ULONG_PTR)Chunk * p2pCtx->ChunkLength;
+    ULONG_PTR length = p2pCtx->Data->IoStatus.Information - offset;
+
+    if (length > p2pCtx->ChunkLength) {
+
+        length = p2pCtx->ChunkLength;
+    }
+
+    csgTransformToUserBuffer( p2pCtx,
+                              p2pCtx->OriginalBuffer,
+                              offset,
+                              length );
+}
+
+
+static VOID
+csgReadDecipherComplete (
+    __in PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Job routine run by the crypto worker that finished the last chunk of
+    a read whose post-operation callback returned without waiting for it:
+    releases what the read held and completes it.  The pre2Post context
+    itself goes when the job is released.
+
+--*/
+{
+    PPRE_2_POST_CONTEXT p2pCtx = Context;
+    PFLT_CALLBACK_DATA data = p2pCtx->Data;
+
+    CSG_TRACE3( READ_FREE,
+                p2pCtx->VolCtx,
+                p2pCtx->SwappedBuffer,
+                data->IoStatus.Information );
+
+    RecordPre2PostLatency( p2pCtx, CSG_LATENCY_READ );
+
+    csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
+    FltReleaseContext( p2pCtx->VolCtx );
+
+    if (p2pCtx->StreamCtx != NULL) {
+
+        FltReleaseContext( p2pCtx->StreamCtx );
+    }
+
+    ConfigReadUnlock( p2pCtx->ConfigCookie );
+
+    FltCompletePendedPostOperation( data );
+}
+
+
+static VOID
+csgReadReleaseContext (
+    __in PVOID Context
+    )
+{
+    FreePre2PostContext( Context );
+}
+
+
+static BOOLEAN
+csgReadDecipherInChunks (
+    __inout PFLT_CALLBACK_DATA Data,
+    __inout PPRE_2_POST_CONTEXT p2pCtx,
+    __in PVOID OrigBuf,
+    __in ULONG ChunkCount
+    )
+/*++
+
+Routine Description:
+
+    Deciphers a read in chunks, on this thread and the crypto workers of
+    its node at once.  This thread takes chunks until none are left, so
+    the read is never slower for want of a free worker.
+
+    The caller releases the job once it is done with the context, which
+    frees the context once no worker holds it either.
+
+Arguments:
+
+    Data - The read.
+
+    p2pCtx - The state passed from the pre-operation, with ChunkLength
+        set by csgReadChunkCount.
+
+    OrigBuf - The users buffer, at a system address.
+
+    ChunkCount - The number of chunks.
+
+Return Value:
+
+    TRUE if the read is deciphered; the caller cleans up and finishes the
+    post-operation.  FALSE if a worker is still at it, in which case the
+    caller must not touch Data or release anything the read holds, and
+    returns FLT_POSTOP_MORE_PROCESSING_REQUIRED.
+
+--*/
+{
+    PCSG_WORK_JOB job = &p2pCtx->Job;
+
+    CSG_TRACE5( READ_SPLIT,
+                p2pCtx->VolCtx,
+                p2pCtx->SwappedBuffer,
+                Data->IoStatus.Information,
+                ChunkCount,
+                p2pCtx->ChunkLength );
+
+    COUNT_STAT( ParallelReads, 1 );
+    COUNT_STAT( ParallelChunks, ChunkCount );
+
+    p2pCtx->Data = Data;
+    p2pCtx->OriginalBuffer = OrigBuf;
+
+    job->ChunkRoutine = csgReadDecipherChunk;
+    job->CompleteRoutine = csgReadDecipherComplete;
+    job->ReleaseRoutine = csgReadReleaseContext;
+    job->Context = p2pCtx;
+    job->ChunkCount = ChunkCount;
+
+    return csgWorkPoolRunJob( CryptoWorkPool, job );
+}
@@ -0,0 +1,227 @@
+#ifndef __CSG_STATS_H__
+#define __CSG_STATS_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Shared statistics section
+*************************************************************************/
+
+//
+//  The driver keeps its counters in a section that csgctl maps read only
+//  (see csgControl.h), so a reader polls them with plain loads.  The
+//  section starts with a CSG_STATS header; CpuCount blocks of CpuSize
+//  bytes follow at CpuOffset, one per processor.  Readers go by the
+//  header's offsets and sizes, not by the structures below, so counters
+//  can be added at the end of CSG_STATS_CPU without breaking them.
+//
+//  Each counter only grows and is only written by the driver with
+//  interlocked adds.  A reader sums the blocks and takes differences
+//  between two polls; a poll racing an update sees the counter either
+//  before or after it.
+//
+
+#define CSG_STATS_MAGIC         0x53475343      // 'CSGS'
+#define CSG_STATS_VERSION       1
+
+#define CSG_STATS_CACHE_LINE    64
+
+typedef struct _CSG_STATS {
+
+    ULONG Magic;
+
+    ULONG Version;
+
+    ULONG CpuCount;
+
+    ULONG CpuOffset;
+
+    ULONG CpuSize;
+
+    ULONG Reserved;
+
+    //
+    //  Timestamp units per second, for CipherTicks.
+    //
+
+    ULONGLONG TimestampFrequency;
+
+} CSG_STATS, *PCSG_STATS;
+
+typedef CONST CSG_STATS *PCCSG_STATS;
+
+typedef struct CSG_ALIGN(CSG_STATS_CACHE_LINE) _CSG_STATS_CPU {
+
+    //
+    //  Operations whose buffers were swapped, and the bytes swapped.
+    //
+
+    ULONGLONG ReadOperations;
+
+    ULONGLONG ReadBytes;
+
+    ULONGLONG WriteOperations;
+
+    ULONGLONG WriteBytes;
+
+    ULONGLONG DirCtrlOperations;
+
+    ULONGLONG DirCtrlBytes;
+
+    //
+    //  Operations left unswapped because a swap buffer, MDL or pre2Post
+    //  context could not be allocated.
+    //
+
+    ULONGLONG AllocationFailures;
+
+    //
+    //  Post-operation work moved to a safe IRQL, and times that was
+    //  needed but not possible.
+    //
+
+    ULONGLONG SafePostings;
+
+    ULONGLONG SafePostFailures;
+
+    //
+    //  Bytes enciphered or deciphered, and the timestamp units spent on
+    //  them; their ratio is the cipher throughput.
+    //
+
+    ULONGLONG CipherBytes;
+
+    ULONGLONG CipherTicks;
+
+    //
+    //  Opens of files with derived keys that found the expanded key in
+    //  the file key cache, and that had to derive it.
+    //
+
+    ULONGLONG KeyCacheHits;
+
+    ULONGLONG KeyCacheMisses;
+
+    //
+    //  Writes pended while a crypto worker enciphered them, and writes
+    //  large enough to be but enciphered inline because the workers'
+    //  queue was full.
+    //
+
+    ULONGLONG OffloadedWrites;
+
+    ULONGLONG OffloadQueueFull;
+
+    //
+    //  Reads deciphered in chunks by their issuer and the crypto workers
+    //  together, and the chunks they were split into.
+    //
+
+    ULONGLONG ParallelReads;
+
+    ULONGLONG ParallelChunks;
+
+    //
+    //  Read and directory query postOperation callbacks that finished
+    //  where they ran, by where the users buffer was: behind a MDL, in a
+    //  system buffer, or in a FASTIO caller's context.  With SafePostings
+    //  these are every such callback that had data to copy.
+    //
+
+    ULONGLONG PostMdlCompletions;
+
+    ULONGLONG PostSystemBufferCompletions;
+
+    ULONGLONG PostFastIoCompletions;
+
+    //
+    //  Users buffers locked in the preOperation callback (LockUserBuffers),
+    //  and locks that failed and left the postOperation callback to post.
+    //
+
+    ULONGLONG UserBuffersLocked;
+
+    ULONGLONG UserBufferLockFailures;
+
+    //
+    //  Entries of directory queries walked for protected files, and the
+    //  ones listed without their header as a result.
+    //
+
+    ULONGLONG DirEntriesWalked;
+
+    ULONGLONG DirEntriesPatched;
+
+} CSG_STATS_CPU, *PCSG_STATS_CPU;
+
+typedef CONST CSG_STATS_CPU *PCCSG_STATS_CPU;
+
+//
+//  Size of a section for CpuCount processors.
+//
+
+CSG_INLINE SIZE_T
+csgStatsSize (
+    ULONG CpuCount
+    )
+{
+    return ((sizeof(CSG_STATS) + CSG_STATS_CACHE_LINE - 1) & ~(SIZE_T)(CSG_STATS_CACHE_LINE - 1)) +
+           (SIZE_T)CpuCount * sizeof(CSG_STATS_CPU);
+}
+
+//
+//  Fills in the header of a zeroed section of csgStatsSize( CpuCount )
+//  bytes.
+//
+
+CSG_INLINE VOID
+csgStatsInitialize (
+    PCSG_STATS Stats,
+    ULONG CpuCount,
+    ULONGLONG TimestampFrequency
+    )
+{
+    Stats->Magic = CSG_STATS_MAGIC;
+    Stats->Version = CSG_STATS_VERSION;
+    Stats->CpuCount = CpuCount;
+    Stats->CpuOffset = (ULONG)((sizeof(CSG_STATS) + CSG_STATS_CACHE_LINE - 1) &
+                               ~(SIZE_T)(CSG_STATS_CACHE_LINE - 1));
+    Stats->CpuSize = sizeof(CSG_STATS_CPU);
+    Stats->TimestampFrequency = TimestampFrequency;
+}
+
+//
+//  For readers: checks a mapped section of Size bytes before any of it is
+//  trusted.
+//
+
+CSG_INLINE BOOLEAN
+csgStatsValidate (
+    PCCSG_STATS Stats,
+    SIZE_T Size
+    )
+{
+    if (Size < sizeof(CSG_STATS) ||
+        Stats->Magic != CSG_STATS_MAGIC ||
+        Stats->Version != CSG_STATS_VERSION ||
+        Stats->CpuCount == 0 ||
+        Stats->CpuSize < sizeof(CSG_STATS_CPU) ||
+        Stats->CpuOffset < sizeof(CSG_STATS)) {
+
+        return FALSE;
+    }
+
+    return (Stats->CpuOffset <= Size &&
+            (Size - Stats->CpuOffset) / Stats->CpuSize >= Stats->CpuCount);
+}
+
+CSG_INLINE PCSG_STATS_CPU
+csgStatsCpu (
+    PCSG_STATS Stats,
+    ULONG Cpu
+    )
+{
+    return (PCSG_STATS_CPU)((PUCHAR)Stats + Stats->CpuOffset + (SIZE_T)Cpu * Stats->CpuSize);
+}
+
+#endif // __CSG_STATS_H__
@@ -0,0 +1,859 @@
+/*++
+
+Module Name:
+
+    csgStream.c
+
+Abstract:
+
+    Loading the header of a protected stream into its stream context: the
+    header is read with one noncached read, the file key unwrapped or
+    derived and then expanded, and the transform for its cipher selected.
+    A stream that is still empty gets a new header with a fresh file key
+    instead.
+
+    A derived file key is HKDF-Expand( PRK, info, L ), PRK being what the
+    configuration extracted from the master key and info the label
+    CSG_STREAM_KEY_LABEL, the cipher (ULONG), the file id the header
+    records (ULONGLONG, both little endian) and the header's IV seed.
+    Derived keys are kept expanded in FileKeyCache, by file id, so a file
+    opened again soon after costs only the header read.
+
+    Every stream found or made protected has its header size remembered
+    in the volume's ProtectedIds under its file id and under the hash of
+    its name, for directory listings.
+
+    The file system's end of file of a protected stream is kept HeaderSize
+    past the end of its data.  Writes that extend the data move it before
+    they reach the file system, and size changes are passed down with
+    HeaderSize added, so that the paging writes of the last of the data,
+    shifted by HeaderSize, always fall within the file.  Those are also
+    where a CTR stream is kept to growing: writes that would rewrite its
+    data and size changes that would cut it are refused (see csgCtr.h).
+
+    The file pointer of a synchronous open is kept in offsets within the
+    data, as its caller sees them.  The file system moves it past the
+    shifted offset of each noncached transfer, so the post-operation
+    callbacks put it back (csgStreamSetFilePosition).
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include <bcrypt.h>
+
+#include "csgStream.h"
+
+#define CSG_STREAM_KEY_LABEL    "CipherStreamGuard file key"
+
+static NTSTATUS
+csgStreamCreateHeader (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PCCSG_CONFIG Config,
+    __in ULONG SectorSize,
+    __out PCSG_HEADER Header,
+    __out_bcount(CSG_XTS_KEY_SIZE) PUCHAR FileKey,
+    __out PVOID Buffer
+    );
+
+static NTSTATUS
+csgStreamSetKey (
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCUCHAR FileKey
+    );
+
+static NTSTATUS
+csgStreamSetDerivedKey (
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCCSG_CONFIG Config
+    );
+
+static VOID
+csgStreamRemember (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PVOLUME_CONTEXT VolCtx,
+    __in PSTREAM_CONTEXT StreamCtx
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, csgStreamLoadHeader)
+#pragma alloc_text(PAGE, csgStreamCreateHeader)
+#pragma alloc_text(PAGE, csgStreamSetKey)
+#pragma alloc_text(PAGE, csgStreamSetDerivedKey)
+#pragma alloc_text(PAGE, csgStreamRemember)
+#pragma alloc_text(PAGE, csgStreamExtend)
+#pragma alloc_text(PAGE, csgStreamSetSize)
+#endif
+
+
+NTSTATUS
+csgStreamLoadHeader (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Fills in a new stream context from the stream's header.  The header is
+    read below us, noncached, so it never passes through our own read path
+    and never lands in the cache.
+
+    An empty stream opened for writing gets a new header.  Anything else
+    without a valid header (a file from before it was protected, say) is
+    left alone.
+
+Arguments:
+
+    FltObjects - The objects of the create that attached the context.
+
+    StreamCtx - The context to fill in.
+
+    Config - The configuration with the keys and cipher policy.
+
+Return Value:
+
+    STATUS_SUCCESS - the stream is protected and StreamCtx is ready.
+    Otherwise the stream is not protected.
+
+--*/
+{
+    PVOLUME_CONTEXT volCtx = NULL;
+    PVOID buffer = NULL;
+    LARGE_INTEGER offset;
+    FILE_STANDARD_INFORMATION standard;
+    ULONG headerSize;
+    ULONG bytesRead = 0;
+    UCHAR fileKey[CSG_XTS_KEY_SIZE];
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    try {
+
+        status = FltGetVolumeContext( FltObjects->Filter,
+                                      FltObjects->Volume,
+                                      &volCtx );
+
+        if (!NT_SUCCESS( status )) {
+
+            leave;
+        }
+
+        headerSize = csgHeaderSize( volCtx->SectorSize );
+
+        buffer = FltAllocatePoolAlignedWithTag( FltObjects->Instance,
+                                                NonPagedPool,
+                                                headerSize,
+                                                BUFFER_SWAP_TAG );
+
+        if (buffer == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        offset.QuadPart = 0;
+
+        status = FltReadFile( FltObjects->Instance,
+                              FltObjects->FileObject,
+                              &offset,
+                              headerSize,
+                              buffer,
+                              FLTFL_IO_OPERATION_NON_CACHED |
+                                  FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                              &bytesRead,
+                              NULL,
+                              NULL );
+
+        if ((status == STATUS_END_OF_FILE) ||
+            (NT_SUCCESS( status ) && (bytesRead == 0))) {
+
+            //
+            //  An empty stream.  It can only be given a header by an open
+            //  that may write to it.
+            //
+
+            if (!FltObjects->FileObject->WriteAccess) {
+
+                status = STATUS_NOT_FOUND;
+                leave;
+            }
+
+            status = csgStreamCreateHeader( FltObjects,
+                                            Config,
+                                            volCtx->SectorSize,
+                                            &StreamCtx->Header,
+                                            fileKey,
+                                            buffer );
+
+        } else if (NT_SUCCESS( status )) {
+
+            status = csgHeaderParse( buffer, bytesRead, &StreamCtx->Header );
+
+            if (!NT_SUCCESS( status )) {
+
+                leave;
+            }
+
+            //
+            //  A header written on a volume with larger sectors than this
+            //  one is fine, but not the other way round: the data would
+            //  not start on a sector boundary.
+            //
+
+            if ((StreamCtx->Header.HeaderSize > headerSize) ||
+                ((StreamCtx->Header.HeaderSize % volCtx->SectorSize) != 0)) {
+
+                status = STATUS_NOT_SUPPORTED;
+                leave;
+            }
+
+            if (StreamCtx->Header.Version == CSG_HEADER_VERSION_WRAPPED) {
+
+                if (!Config->WrappingKeyPresent) {
+
+                    status = STATUS_NOT_SUPPORTED;
+                    leave;
+                }
+
+                status = csgKeyUnwrap( &Config->WrappingKey,
+                                       StreamCtx->Header.WrappedKey,
+                                       StreamCtx->Header.WrappedKeyLength,
+                                       fileKey );
+            }
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            leave;
+        }
+
+        //
+        //  The data is what the file system has past the header.
+        //
+
+        status = FltQueryInformationFile( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &standard,
+                                          sizeof(standard),
+                                          FileStandardInformation,
+                                          NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            leave;
+        }
+
+        StreamCtx->FileSize = max( standard.EndOfFile.QuadPart - (LONGLONG)StreamCtx->Header.HeaderSize, 0 );
+
+        if (StreamCtx->Header.Version == CSG_HEADER_VERSION_DERIVED) {
+
+            status = csgStreamSetDerivedKey( StreamCtx, Config );
+
+        } else {
+
+            status = csgStreamSetKey( StreamCtx, fileKey );
+        }
+
+        if (NT_SUCCESS( status ) && (volCtx->ProtectedIds != NULL)) {
+
+            csgStreamRemember( FltObjects, volCtx, StreamCtx );
+        }
+
+    } finally {
+
+        RtlSecureZeroMemory( fileKey, sizeof(fileKey) );
+
+        if (buffer != NULL) {
+
+            FltFreePoolAlignedWithTag( FltObjects->Instance, buffer, BUFFER_SWAP_TAG );
+        }
+
+        if (volCtx != NULL) {
+
+            FltReleaseContext( volCtx );
+        }
+    }
+
+    return status;
+}
+
+
+static NTSTATUS
+csgStreamCreateHeader (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PCCSG_CONFIG Config,
+    __in ULONG SectorSize,
+    __out PCSG_HEADER Header,
+    __out_bcount(CSG_XTS_KEY_SIZE) PUCHAR FileKey,
+    __out PVOID Buffer
+    )
+/*++
+
+Routine Description:
+
+    Writes a header for the configured cipher to the start of an empty
+    stream.  With a master key configured, the file key is derived from
+    it, this file's id and a new IV seed; otherwise it is a new random
+    key, wrapped into the header.
+
+Arguments:
+
+    FltObjects - The objects of the create.
+
+    Config - The configuration with the keys and cipher policy.
+
+    SectorSize - The volume's sector size.
+
+    Header - Receives the new header.
+
+    FileKey - Receives the new file key if it is wrapped; untouched if it
+        is derived, which csgStreamSetDerivedKey does from Header.
+
+    Buffer - Sector aligned scratch space of the header's size.
+
+Return Value:
+
+    The status of the operation.
+
+--*/
+{
+    FILE_INTERNAL_INFORMATION internal;
+    LARGE_INTEGER offset;
+    ULONG keyLength;
+    ULONG bytesWritten;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Header, sizeof(CSG_HEADER) );
+
+    Header->Algorithm = Config->CipherAlgorithm;
+    Header->HeaderSize = csgHeaderSize( SectorSize );
+
+    keyLength = csgHeaderFileKeyLength( Header->Algorithm );
+
+    status = BCryptGenRandom( NULL,
+                              Header->IvSeed,
+                              sizeof(Header->IvSeed),
+                              BCRYPT_USE_SYSTEM_PREFERRED_RNG );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    if (Config->MasterKeyPresent) {
+
+        status = FltQueryInformationFile( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &internal,
+                                          sizeof(internal),
+                                          FileInternalInformation,
+                                          NULL );
+
+        Header->Version = CSG_HEADER_VERSION_DERIVED;
+
+        if (NT_SUCCESS( status )) {
+
+            Header->FileId = (ULONGLONG)internal.IndexNumber.QuadPart;
+        }
+
+    } else {
+
+        Header->Version = CSG_HEADER_VERSION_WRAPPED;
+        Header->WrappedKeyLength = keyLength + CSG_KEYWRAP_OVERHEAD;
+
+        status = BCryptGenRandom( NULL,
+                                  FileKey,
+                                  keyLength,
+                                  BCRYPT_USE_SYSTEM_PREFERRED_RNG );
+
+        if (NT_SUCCESS( status )) {
+
+            status = csgKeyWrap( &Config->WrappingKey,
+                                 FileKey,
+                                 keyLength,
+                                 Header->WrappedKey );
+        }
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        status = csgHeaderSerialize( Header, Buffer, Header->HeaderSize );
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    offset.QuadPart = 0;
+
+    status = FltWriteFile( FltObjects->Instance,
+                           FltObjects->FileObject,
+                           &offset,
+                           Header->HeaderSize,
+                           Buffer,
+                           FLTFL_IO_OPERATION_NON_CACHED |
+                               FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                           &bytesWritten,
+                           NULL,
+                           NULL );
+
+    CSG_TRACE2( STREAM_NEW_HEADER,
+                FltObjects->FileObject,
+                (ULONG)status );
+
+    return status;
+}
+
+
+static NTSTATUS
+csgStreamSetKey (
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCUCHAR FileKey
+    )
+/*++
+
+Routine Description:
+
+    Expands a stream's file key and selects the transform for its cipher.
+    A CTR key takes its nonce from the header's IV seed.
+
+Arguments:
+
+    StreamCtx - The context, with its header filled in.
+
+    FileKey - The unwrapped file key.
+
+Return Value:
+
+    The status of the operation.
+
+--*/
+{
+    UCHAR ctrKey[CSG_CTR_KEY_SIZE];
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    StreamCtx->Transform = csgProviderSelect( StreamCtx->Header.Algorithm,
+                                              g_Global.CpuFeatures );
+
+    if (StreamCtx->Transform == NULL) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (StreamCtx->Header.Algorithm == CSG_CIPHER_XTS) {
+
+        return csgXtsSetKey( &StreamCtx->Key.Xts, FileKey );
+    }
+
+    RtlCopyMemory( ctrKey, FileKey, CSG_AES_MAX_KEY_SIZE );
+    RtlCopyMemory( ctrKey + CSG_AES_MAX_KEY_SIZE,
+                   StreamCtx->Header.IvSeed,
+                   CSG_CTR_KEY_SIZE - CSG_AES_MAX_KEY_SIZE );
+
+    status = csgCtrSetKey( &StreamCtx->Key.Ctr, ctrKey );
+
+    RtlSecureZeroMemory( ctrKey, sizeof(ctrKey) );
+
+    return status;
+}
+
+
+static NTSTATUS
+csgStreamSetDerivedKey (
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCCSG_CONFIG Config
+    )
+/*++
+
+Routine Description:
+
+    Sets up a stream whose header derives its file key: the expanded key
+    comes from the file key cache if it is there, and is otherwise
+    derived, expanded and cached.
+
+Arguments:
+
+    StreamCtx - The context, with its header filled in.
+
+    Config - The configuration with the master key.
+
+Return Value:
+
+    The status of the operation.
+
+--*/
+{
+    CSG_KEYCACHE_ID id;
+    CSG_HKDF_INFO info[3];
+    UCHAR context[sizeof(ULONG) + sizeof(ULONGLONG)];
+    UCHAR fileKey[CSG_XTS_KEY_SIZE];
+    ULONG i;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (!Config->MasterKeyPresent) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    RtlZeroMemory( &id, sizeof(id) );
+
+    id.FileId = StreamCtx->Header.FileId;
+    id.Generation = Config->MasterKeyGeneration;
+    id.Algorithm = StreamCtx->Header.Algorithm;
+
+    RtlCopyMemory( id.Salt, StreamCtx->Header.IvSeed, sizeof(id.Salt) );
+
+    if ((FileKeyCache != NULL) &&
+        csgKeyCacheLookup( FileKeyCache, &id, &StreamCtx->Key )) {
+
+        COUNT_STAT( KeyCacheHits, 1 );
+
+        StreamCtx->Transform = csgProviderSelect( StreamCtx->Header.Algorithm,
+                                                  g_Global.CpuFeatures );
+
+        return (StreamCtx->Transform != NULL) ? STATUS_SUCCESS : STATUS_NOT_SUPPORTED;
+    }
+
+    COUNT_STAT( KeyCacheMisses, 1 );
+
+    for (i = 0; i < sizeof(ULONG); i++) {
+
+        context[i] = (UCHAR)(StreamCtx->Header.Algorithm >> (8 * i));
+    }
+
+    for (i = 0; i < sizeof(ULONGLONG); i++) {
+
+        context[sizeof(ULONG) + i] = (UCHAR)(StreamCtx->Header.FileId >> (8 * i));
+    }
+
+    info[0].Data = CSG_STREAM_KEY_LABEL;
+    info[0].Length = sizeof(CSG_STREAM_KEY_LABEL) - 1;
+    info[1].Data = context;
+    info[1].Length = sizeof(context);
+    info[2].Data = StreamCtx->Header.IvSeed;
+    info[2].Length = sizeof(StreamCtx->Header.IvSeed);
+
+    status = csgHkdfExpand( Config->MasterKeyPrk,
+                            info,
+                            RTL_NUMBER_OF( info ),
+                            fileKey,
+                            csgHeaderFileKeyLength( StreamCtx->Header.Algorithm ) );
+
+    if (NT_SUCCESS( status )) {
+
+        status = csgStreamSetKey( StreamCtx, fileKey );
+    }
+
+    RtlSecureZeroMemory( fileKey, sizeof(fileKey) );
+
+    if (NT_SUCCESS( status ) && (FileKeyCache != NULL)) {
+
+        csgKeyCacheInsert( FileKeyCache, &id, &StreamCtx->Key );
+    }
+
+    return status;
+}
+
+
+static VOID
+csgStreamRemember (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __in PVOLUME_CONTEXT VolCtx,
+    __in PSTREAM_CONTEXT StreamCtx
+    )
+/*++
+
+Routine Description:
+
+    Remembers a protected stream's header size under its name and under
+    its file id, the one it has now rather than the one its header may
+    record.  A stream whose id cannot be had is listed with its header in
+    the classes that carry one.
+
+    A name is remembered as the stream was opened by it.  After a rename
+    the file is listed with its header under its new name until it is
+    opened again, and a file later given its old name without being
+    opened through the driver may be listed without one, until the entry
+    ages out of ProtectedIds.
+
+Arguments:
+
+    FltObjects - The objects of the create.
+
+    VolCtx - The volume context, with ProtectedIds.
+
+    StreamCtx - The stream, its header loaded.
+
+Return Value:
+
+    None
+
+--*/
+{
+    FILE_INTERNAL_INFORMATION internal;
+    CSG_KEYCACHE_ID id;
+    ULONG headerSize = StreamCtx->Header.HeaderSize;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (StreamCtx->NameHash != 0) {
+
+        ProtectedNameKey( &id, StreamCtx->NameHash );
+
+        csgKeyCacheInsert( VolCtx->ProtectedIds, &id, &headerSize );
+    }
+
+    status = FltQueryInformationFile( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &internal,
+                                      sizeof(internal),
+                                      FileInternalInformation,
+                                      NULL );
+
+    if (NT_SUCCESS( status ) && (internal.IndexNumber.QuadPart != 0)) {
+
+        ProtectedIdKey( &id, (ULONGLONG)internal.IndexNumber.QuadPart );
+
+        csgKeyCacheInsert( VolCtx->ProtectedIds, &id, &headerSize );
+    }
+
+    if (!VolCtx->ProtectedIdsUsed) {
+
+        VolCtx->ProtectedIdsUsed = TRUE;
+    }
+}
+
+
+NTSTATUS
+csgStreamExtend (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __inout PLARGE_INTEGER ByteOffset,
+    __in ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Readies a protected stream for a write that is not paging I/O.  A
+    write to the end of file is given the offset where the data ends.  A
+    write past the end of the data first moves the file system's end of
+    file to HeaderSize past its end, as the file system would have moved
+    it to its end, and the data's size with it.
+
+    A CTR stream's data only grows (see csgCtr.h): a write that starts
+    before its end is refused.  The check is made under SizeLock, so two
+    appends racing for the same offset cannot both have it.
+
+    Other writes that stay within the data do not take SizeLock.
+
+Arguments:
+
+    FltObjects - The objects of the write.
+
+    StreamCtx - The stream's context.
+
+    ByteOffset - The write's offset; replaced if it is the end of file.
+
+    Length - The write's length.
+
+Return Value:
+
+    The status of the operation; the write must fail if it is not success.
+    STATUS_ACCESS_DENIED if the stream is a CTR stream and the write would
+    rewrite its data.
+
+--*/
+{
+    FILE_END_OF_FILE_INFORMATION endOfFile;
+    BOOLEAN toEndOfFile;
+    BOOLEAN appendOnly;
+    LONGLONG end;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    toEndOfFile = (ByteOffset->LowPart == FILE_WRITE_TO_END_OF_FILE) &&
+                  (ByteOffset->HighPart == -1);
+
+    appendOnly = (StreamCtx->Header.Algorithm == CSG_CIPHER_CTR);
+
+    if (!toEndOfFile && !appendOnly && (ByteOffset->QuadPart + Length <= StreamCtx->FileSize)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    FltAcquirePushLockExclusive( &StreamCtx->SizeLock );
+
+    if (toEndOfFile) {
+
+        ByteOffset->QuadPart = StreamCtx->FileSize;
+    }
+
+    if (appendOnly && (ByteOffset->QuadPart < StreamCtx->FileSize)) {
+
+        FltReleasePushLock( &StreamCtx->SizeLock );
+
+        return STATUS_ACCESS_DENIED;
+    }
+
+    end = ByteOffset->QuadPart + Length;
+
+    if (end > StreamCtx->FileSize) {
+
+        endOfFile.EndOfFile.QuadPart = end + StreamCtx->Header.HeaderSize;
+
+        status = FltSetInformationFile( FltObjects->Instance,
+                                        FltObjects->FileObject,
+                                        &endOfFile,
+                                        sizeof(endOfFile),
+                                        FileEndOfFileInformation );
+
+        if (NT_SUCCESS( status )) {
+
+            StreamCtx->FileSize = end;
+        }
+    }
+
+    FltReleasePushLock( &StreamCtx->SizeLock );
+
+    return status;
+}
+
+
+NTSTATUS
+csgStreamSetSize (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in FILE_INFORMATION_CLASS InformationClass,
+    __in LONGLONG Size
+    )
+/*++
+
+Routine Description:
+
+    Sets the end of file, allocation or valid data length of a protected
+    stream, as its opens see it, by setting it HeaderSize further on in the
+    file system.  An allocation below the end of the data cuts the data
+    short, as it does the file.
+
+    A CTR stream's data is never cut (see csgCtr.h), since what was
+    written past the new end would be enciphered again with the same
+    keystream when the stream grew back.
+
+Arguments:
+
+    FltObjects - The objects of the set information.
+
+    StreamCtx - The stream's context.
+
+    InformationClass - FileEndOfFileInformation, FileAllocationInformation
+        or FileValidDataLengthInformation.
+
+    Size - The size the caller asked for.
+
+Return Value:
+
+    The file system's status, or STATUS_ACCESS_DENIED if the stream is a
+    CTR stream and its data would be cut.
+
+--*/
+{
+    LARGE_INTEGER value;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    //  All three classes are one LARGE_INTEGER.
+    //
+
+    value.QuadPart = Size + StreamCtx->Header.HeaderSize;
+
+    FltAcquirePushLockExclusive( &StreamCtx->SizeLock );
+
+    if ((StreamCtx->Header.Algorithm == CSG_CIPHER_CTR) &&
+        (InformationClass != FileValidDataLengthInformation) &&
+        (Size < StreamCtx->FileSize)) {
+
+        FltReleasePushLock( &StreamCtx->SizeLock );
+
+        return STATUS_ACCESS_DENIED;
+    }
+
+    status = FltSetInformationFile( FltObjects->Instance,
+                                    FltObjects->FileObject,
+                                    &value,
+                                    sizeof(value),
+                                    InformationClass );
+
+    if (NT_SUCCESS( status )) {
+
+        if ((InformationClass == FileEndOfFileInformation) ||
+            ((InformationClass == FileAllocationInformation) && (Size < StreamCtx->FileSize))) {
+
+            StreamCtx->FileSize = Size;
+        }
+    }
+
+    FltReleasePushLock( &StreamCtx->SizeLock );
+
+    return status;
+}
+
+
+VOID
+csgStreamSetFilePosition (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    )
+/*++
+
+Routine Description:
+
+    Sets the file pointer of a synchronous open to just past what a read
+    or write of a protected stream transferred, in offsets within the
+    data.  The file system moved it past the offset it was sent, which
+    was HeaderSize further on.  Paging I/O never moves the file pointer.
+
+    Called from the post-operation callbacks, at any IRQL.
+
+Arguments:
+
+    Data - The read or write, with the parameters it was issued with.
+
+    p2pCtx - Its pre2Post context; DataUnit is where it started and
+        HeaderSize how far it was shifted.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PFILE_OBJECT fileObject = Data->Iopb->TargetFileObject;
+
+    if ((p2pCtx->HeaderSize == 0) ||
+        !NT_SUCCESS( Data->IoStatus.Status ) ||
+        FlagOn( Data->Iopb->IrpFlags, IRP_PAGING_IO ) ||
+        !FlagOn( fileObject->Flags, FO_SYNCHRONOUS_IO )) {
+
+        return;
+    }
+
+    fileObject->CurrentByteOffset.QuadPart = (LONGLONG)(p2pCtx->DataUnit * p2pCtx->VolCtx->SectorSize) +
+                                             (LONGLONG)Data->IoStatus.Information;
+}
@@ -0,0 +1,39 @@
+#ifndef __CSG_STREAM_H__
+#define __CSG_STREAM_H__
+
+
+#include "csgGlobal.h"
+#include "csgStruct.h"
+
+
+NTSTATUS
+csgStreamLoadHeader (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in PCCSG_CONFIG Config
+    );
+
+NTSTATUS
+csgStreamExtend (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __inout PLARGE_INTEGER ByteOffset,
+    __in ULONG Length
+    );
+
+NTSTATUS
+csgStreamSetSize (
+    __in PCFLT_RELATED_OBJECTS FltObjects,
+    __inout PSTREAM_CONTEXT StreamCtx,
+    __in FILE_INFORMATION_CLASS InformationClass,
+    __in LONGLONG Size
+    );
+
+VOID
+csgStreamSetFilePosition (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx
+    );
+
+
+#endif // __CSG_STREAM_H__
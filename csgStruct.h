@@ -5,10 +5,32 @@
 #include <dontuse.h>
 #include <suppress.h>
 
+#include "csgProvider.h"
+#include "csgBufCache.h"
+#include "csgSwapDesc.h"
+#include "csgHeader.h"
+#include "csgKeyWrap.h"
+#include "csgKeyCache.h"
+#include "csgHkdf.h"
+#include "csgTrace.h"
+#include "csgHist.h"
+#include "csgStats.h"
+#include "csgRcu.h"
+#include "csgWorkPool.h"
+
 /*************************************************************************
     Local structures
 *************************************************************************/
 
+//
+//  Operations whose latency is kept per volume.
+//
+
+#define CSG_LATENCY_READ        0
+#define CSG_LATENCY_WRITE       1
+#define CSG_LATENCY_DIRCTRL     2
+#define CSG_LATENCY_OPERATIONS  3
+
 //
 //  This is a volume context, one of these are attached to each volume
 //  we monitor.  This is used to get a "DOS" name for debug display.
@@ -28,14 +50,119 @@ typedef struct _VOLUME_CONTEXT {
 
     ULONG SectorSize;
 
+    //
+    //  The file system on the volume.  Some need their results handled
+    //  differently (see csgDirCtrl.c).
+    //
+
+    FLT_FILESYSTEM_TYPE FileSystemType;
+
+    //
+    //  The header size of the volume's protected files opened last, by
+    //  file id and by name, so directory listings can report their sizes
+    //  without the header (see csgDirCtrl.c).  NULL when ProtectedIdEntries is zero,
+    //  and on FAT and exFAT, whose file ids are where the file's directory
+    //  entry is and go to the next file created there.
+    //
+
+    PCSG_KEYCACHE ProtectedIds;
+
+    //
+    //  Set once the first protected file is remembered; until then there
+    //  is nothing to look up.
+    //
+
+    volatile BOOLEAN ProtectedIdsUsed;
+
+    //
+    //  Time from pre-operation to the end of post-operation processing of
+    //  every swapped operation, in timestamp units (csgReadTimestamp), per
+    //  CSG_LATENCY_* operation.
+    //
+
+    PCSG_HIST Latency[CSG_LATENCY_OPERATIONS];
+
 } VOLUME_CONTEXT, *PVOLUME_CONTEXT;
 
+//
+//  An expanded file key, for whichever cipher the header names.  This is
+//  also what the file key cache (csgKeyCache.h) keeps.
+//
+
+typedef union _CSG_FILE_KEY {
+
+    CSG_XTS_KEY Xts;
+
+    CSG_CTR_KEY Ctr;
+
+} CSG_FILE_KEY, *PCSG_FILE_KEY;
+
+//
+//  This is a stream context.  One is attached, when the stream is opened,
+//  to every stream the driver protects and to no other; its presence is
+//  what marks a stream protected (see csgPostCreate).  It caches the
+//  stream's header and expanded file key for all later I/O.
+//
+
+typedef struct _STREAM_CONTEXT {
+
+    //
+    //  The open that attaches the context loads the header; opens racing
+    //  it wait on Loaded.  LoadStatus is STATUS_PENDING until then, and
+    //  nothing below it may be used unless it ends up STATUS_SUCCESS.  A
+    //  context whose load failed is deleted.
+    //
+
+    KEVENT Loaded;
+
+    volatile NTSTATUS LoadStatus;
+
+    //
+    //  The parsed header.  HeaderSize is where the data starts, so it is
+    //  added to every noncached offset.
+    //
+
+    CSG_HEADER Header;
+
+    //
+    //  The transform for the header's cipher and the file key it uses.
+    //
+
+    PCCSG_TRANSFORM Transform;
+
+    CSG_FILE_KEY Key;
+
+    //
+    //  The size of the data, which is what the stream's opens see as its
+    //  end of file.  The file system's end of file is kept exactly
+    //  HeaderSize past it, so the shifted paging writes that carry the
+    //  last of the data are not cut short.  Whatever moves the file
+    //  system's end of file moves FileSize with it, under SizeLock
+    //  exclusive (see csgStreamExtend and csgStreamSetSize).
+    //
+
+    EX_PUSH_LOCK SizeLock;
+
+    volatile LONGLONG FileSize;
+
+    //
+    //  The hash of the normalized name the stream was opened by
+    //  (csgDirWalkHashName), remembered with its file id once its header
+    //  is loaded (see csgDirCtrl.c).  Zero if the name could not be had.
+    //
+
+    ULONGLONG NameHash;
+
+} STREAM_CONTEXT, *PSTREAM_CONTEXT;
+
 //
 //  This is a context structure that is used to pass state from our
-//  pre-operation callback to our post-operation callback.
+//  pre-operation callback to our post-operation callback.  It is cache
+//  line aligned (and its size a multiple of one) so two operations in
+//  flight on different processors never share a line.
 //
 
-typedef struct _PRE_2_POST_CONTEXT {
+typedef struct DECLSPEC_CACHEALIGN _PRE_2_POST_CONTEXT {
 
     //
     //  Pointer to our volume context structure.  We always get the context
@@ -46,6 +173,14 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOLUME_CONTEXT VolCtx;
 
+    //
+    //  Reads of a protected stream, and writes to one enciphered by the
+    //  crypto workers, hold its context until the data has been through
+    //  the cipher with the key in it.  NULL otherwise.
+    //
+
+    PSTREAM_CONTEXT StreamCtx;
+
     //
     //  Since the post-operation parameters always receive the "original"
     //  parameters passed to the operation, we need to pass our new destination
@@ -54,8 +189,294 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOID SwappedBuffer;
 
+    //
+    //  The swap buffer cache descriptor SwappedBuffer belongs to, and the
+    //  length it was allocated with; both are needed to return it.
+    //
+
+    PCSG_SWAP_DESC SwapDesc;
+
+    ULONG SwappedLength;
+
+    //
+    //  The transform applied when the data is moved between the users
+    //  buffer and SwappedBuffer, and the key it uses.  DataUnit is the
+    //  number of the first sector transferred.
+    //
+
+    PCCSG_TRANSFORM Transform;
+
+    CONST VOID *TransformKey;
+
+    ULONGLONG DataUnit;
+
+    //
+    //  How far the file system's offset was moved past the caller's: a
+    //  protected stream's HeaderSize for noncached I/O, zero otherwise.
+    //
+
+    ULONG HeaderSize;
+
+    //
+    //  Reads stay in a configuration read section until the data has been
+    //  deciphered, since the key may be the configuration's; this is its
+    //  cookie.  So do writes the crypto workers encipher.  Unused by other
+    //  operations.
+    //
+
+    ULONG ConfigCookie;
+
+    //
+    //  A write pended for the crypto workers: the operation, the users
+    //  buffer at a system address, the MDL to swap in with SwappedBuffer,
+    //  and the work item that carries the context to a worker.
+    //
+
+    PFLT_CALLBACK_DATA Data;
+
+    PVOID OriginalBuffer;
+
+    PMDL SwappedMdl;
+
+    CSG_WORK_ITEM WorkItem;
+
+    //
+    //  A read deciphered in chunks: the job that shares them out, the
+    //  bytes in each chunk, and the configuration's ParallelReadThreshold
+    //  for the post-operation to decide with.  The read uses Data and
+    //  OriginalBuffer as the pended write does.
+    //
+
+    CSG_WORK_JOB Job;
+
+    ULONG ChunkLength;
+
+    ULONG ParallelReadThreshold;
+
+    //
+    //  A directory query in a class without file ids: the hash of the
+    //  directory's normalized name and a backslash, which the names of
+    //  its entries are hashed on from.  Zero when there is nothing to
+    //  look up by name.
+    //
+
+    ULONGLONG DirectoryHash;
+
+    //
+    //  csgReadTimestamp at the start of the preOperation callback.
+    //
+
+    ULONGLONG StartTime;
+
+    //
+    //  StageTimestamp when the post-operation callback asked to be called
+    //  again at a safe IRQL.
+    //
+
+    ULONGLONG PostedTime;
+
 } PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
 
+//
+//  Pre2Post contexts come from a lookaside list per processor so the list
+//  heads stay in the local cache.  A context goes back to the list of the
+//  processor that frees it, which need not be the one that allocated it.
+//
+
+extern PNPAGED_LOOKASIDE_LIST Pre2PostContextLists;
+extern ULONG Pre2PostContextListCount;
+
+FORCEINLINE
+PPRE_2_POST_CONTEXT
+AllocatePre2PostContext (
+    VOID
+    )
+{
+    return ExAllocateFromNPagedLookasideList(
+               &Pre2PostContextLists[csgCurrentCpu() % Pre2PostContextListCount] );
+}
+
+FORCEINLINE
+VOID
+FreePre2PostContext (
+    __in PPRE_2_POST_CONTEXT Context
+    )
+{
+    ExFreeToNPagedLookasideList(
+        &Pre2PostContextLists[csgCurrentCpu() % Pre2PostContextListCount],
+        Context );
+}
+
+//
+//  Called as the last use of a context, before its volume context is
+//  released: counts the time since the preOperation callback started.
+//
+
+FORCEINLINE
+VOID
+RecordPre2PostLatency (
+    __in PPRE_2_POST_CONTEXT Context,
+    __in ULONG Operation
+    )
+{
+    csgHistRecord( Context->VolCtx->Latency[Operation],
+                   csgReadTimestamp() - Context->StartTime );
+}
+
+//
+//  Called by the postOperation callbacks of swapped IRP operations before
+//  anything else: keeps the partial MDL swapped in, which the filter
+//  manager would free, for the descriptor's next I/O (csgSwapDesc.c).
+//  Fast I/O has none.
+//
+
+FORCEINLINE
+VOID
+KeepSwappedMdl (
+    __in PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT Context
+    )
+{
+    PMDL mdl = FltGetSwappedBufferMdlAddress( Data );
+
+    if (mdl != NULL) {
+
+        FltRetainSwappedBufferMdlAddress( Data );
+        csgSwapDescKeepMdl( Context->SwapDesc, mdl );
+    }
+}
+
+//
+//  The configuration read from the driver's parameters.  Once published
+//  a configuration never changes: a reload builds a new one, swaps
+//  g_Global.Config to point at it and frees the old one after a grace
+//  period (csgRcu.h, csgConfig.c).  Code that looks at it brackets its
+//  use with ConfigReadLock and ConfigReadUnlock.
+//
+
+typedef struct _CSG_CONFIG {
+
+    //
+    //  Counts reloads; the configuration read at load is version 1.
+    //
+
+    ULONG Version;
+
+    //
+    //  The DebugFlags parameter.  The flags in effect are in
+    //  g_Global.DebugFlags, which publishing a configuration sets; being a
+    //  single word, it needs no grace period.
+    //
+
+    ULONG DebugFlags;
+
+    //
+    //  Set by the NoncachedOnly parameter.  Only noncached and paging I/O
+    //  is swapped (and, with a key, transformed); cached and fast I/O
+    //  pass straight through.  The cache then holds plaintext and only
+    //  what goes to or comes from the disk pays for a copy.
+    //
+
+    BOOLEAN NoncachedOnly;
+
+    //
+    //  Set when a volume key was configured.  Without one the driver only
+    //  swaps buffers and the data goes to disk unchanged.
+    //
+
+    BOOLEAN CipherEnabled;
+
+    //
+    //  Extensions, without the dot, of the files the driver protects, from
+    //  the ProtectedExtensions parameter.  With no list every file is
+    //  protected and streams are not classified at all.  Paged; only
+    //  looked at when files are opened.
+    //
+
+    PUNICODE_STRING ProtectedExtensions;
+
+    ULONG ProtectedExtensionCount;
+
+    //
+    //  Key encryption key for the file keys in protected files' headers,
+    //  from the WrappingKey parameter.  Without one no stream is protected.
+    //
+
+    BOOLEAN WrappingKeyPresent;
+
+    CSG_AES_KEY WrappingKey;
+
+    //
+    //  HKDF pseudorandom key extracted from the MasterKey parameter.  With
+    //  one, new files get headers whose file key is derived from it rather
+    //  than wrapped (csgHeader.h), and files with such headers can be
+    //  opened.  The generation changes only when the master key does; it
+    //  tells the file key cache which derivations are still good.
+    //
+
+    BOOLEAN MasterKeyPresent;
+
+    ULONG MasterKeyGeneration;
+
+    UCHAR MasterKeyPrk[CSG_SHA256_DIGEST_SIZE];
+
+    //
+    //  Cipher policy, one of the CSG_CIPHER_* values, and the provider's
+    //  transform and expanded key it selects for all noncached reads and
+    //  writes.
+    //
+
+    ULONG CipherAlgorithm;
+
+    PCCSG_TRANSFORM CipherTransform;
+
+    CONST VOID *CipherTransformKey;
+
+    //
+    //  Expanded keys.  Only the one the policy selects is set.
+    //
+
+    CSG_XTS_KEY XtsKey;
+
+    CSG_CTR_KEY CtrKey;
+
+    //
+    //  Bound on the swap buffers each size class keeps in the cache, per-CPU
+    //  magazines and depot together, from the SwapCacheBytes parameter.
+    //
+
+    SIZE_T SwapCacheBytes;
+
+    //
+    //  Writes of at least this many bytes are enciphered by CryptoWorkPool
+    //  while the write is pended, from the OffloadThreshold parameter.
+    //  Zero keeps every write on its issuer's thread.
+    //
+
+    ULONG OffloadThreshold;
+
+    //
+    //  Noncached reads that return at least this many bytes are deciphered
+    //  in chunks by CryptoWorkPool and the thread completing the read at
+    //  once, from the ParallelReadThreshold parameter.  Zero deciphers
+    //  every read on one thread.
+    //
+
+    ULONG ParallelReadThreshold;
+
+    //
+    //  Set by the LockUserBuffers parameter.  Reads and directory queries
+    //  into a users buffer with no MDL have it locked in the
+    //  preOperation callback, so the postOperation callback finishes from
+    //  the MDL wherever it runs instead of posting to a safe IRQL.
+    //
+
+    BOOLEAN LockUserBuffers;
+
+} CSG_CONFIG, *PCSG_CONFIG;
+
+typedef CONST CSG_CONFIG *PCCSG_CONFIG;
+
 typedef struct _CSG_GLOBAL_DATA {
 
     //
@@ -63,11 +484,285 @@ typedef struct _CSG_GLOBAL_DATA {
     //
 
     ULONG DebugFlags;
-    
+
+    //
+    //  Set by the StageTiming parameter, and may be flipped at any time
+    //  while the driver runs.  When set, the swap paths time their stages
+    //  into StageCost.
+    //
+
+    volatile BOOLEAN StageTiming;
+
+    //
+    //  CSG_CPU_* features the cipher providers may use: what the processor
+    //  supports, less anything masked off by the CpuFeatureMask parameter.
+    //
+
+    ULONG CpuFeatures;
+
+    //
+    //  csgReadTimestamp units per second, measured at load.
+    //
+
+    ULONGLONG TimestampFrequency;
+
+    //
+    //  Size of each trace ring, from the TraceRecordsPerCpu parameter.
+    //  A capture (LOGFL_CAPTURE) wants more than the default so the rings
+    //  do not wrap between two reads.
+    //
+
+    ULONG TraceRecordsPerCpu;
+
+    //
+    //  How many expanded file keys FileKeyCache holds, from the
+    //  KeyCacheEntries parameter; zero for no cache.
+    //
+
+    ULONG KeyCacheEntries;
+
+    //
+    //  How many protected files each volume's ProtectedIds holds, from the
+    //  ProtectedIdEntries parameter; zero for none.
+    //
+
+    ULONG ProtectedIdEntries;
+
+    //
+    //  Workers CryptoWorkPool runs on each NUMA node, from the
+    //  CryptoWorkers parameter, and how much each node's queue holds, from
+    //  CryptoQueueDepth.  No workers, no pool.
+    //
+
+    ULONG CryptoWorkers;
+
+    ULONG CryptoQueueDepth;
+
+    //
+    //  The current configuration, and the grace period domain its readers
+    //  are counted in.
+    //
+
+    PCSG_CONFIG volatile Config;
+
+    PCSG_RCU ConfigRcu;
+
 } CSG_GLOBAL_DATA, *PCSG_GLOBAL_DATA;
 
 extern CSG_GLOBAL_DATA g_Global;
 
+//
+//  A read section on the configuration.  It may be held across waits,
+//  and from a preOperation callback to its postOperation callback, on
+//  any thread, as long as the cookie travels with it.
+//
+
+FORCEINLINE
+PCCSG_CONFIG
+ConfigReadLock (
+    __out PULONG Cookie
+    )
+{
+    *Cookie = csgRcuReadLock( g_Global.ConfigRcu );
+
+    return (PCCSG_CONFIG)csgLoadAcquirePointer( &g_Global.Config );
+}
+
+FORCEINLINE
+VOID
+ConfigReadUnlock (
+    __in ULONG Cookie
+    )
+{
+    csgRcuReadUnlock( g_Global.ConfigRcu, Cookie );
+}
+
+//
+//  Stages of the read and write paths whose cost is kept, each in a
+//  histogram of timestamp units.  POST_WAIT is the time a read spends
+//  between its post-operation callback and the routine
+//  FltDoCompletionProcessingWhenSafe runs at a safe IRQL.
+//
+
+#define CSG_STAGE_READ_ALLOCATE     0
+#define CSG_STAGE_READ_MDL          1
+#define CSG_STAGE_READ_TRANSFORM    2
+#define CSG_STAGE_READ_POST_WAIT    3
+#define CSG_STAGE_WRITE_ALLOCATE    4
+#define CSG_STAGE_WRITE_MDL         5
+#define CSG_STAGE_WRITE_TRANSFORM   6
+#define CSG_STAGE_COUNT             7
+
+extern PCSG_HIST StageCost[CSG_STAGE_COUNT];
+
+//
+//  A stage starts with StageTimestamp and ends with RecordStageCost.  A
+//  start taken while timing was off is zero and is not recorded, so the
+//  switch may flip between the two.
+//
+
+FORCEINLINE
+ULONGLONG
+StageTimestamp (
+    VOID
+    )
+{
+    return g_Global.StageTiming ? csgReadTimestamp() : 0;
+}
+
+FORCEINLINE
+VOID
+RecordStageCost (
+    __in ULONG Stage,
+    __in ULONGLONG Start
+    )
+{
+    if (Start != 0) {
+
+        csgHistRecord( StageCost[Stage], csgReadTimestamp() - Start );
+    }
+}
+
+//
+//  Counters published in the statistics section (csgStats.h, csgComm.c),
+//  one block per processor.  StatsCpuCount is the driver's own copy; the
+//  header in the section is never read back.
+//
+
+extern PCSG_STATS_CPU StatsCpu;
+extern ULONG StatsCpuCount;
+
+//
+//  Expanded keys of the files with derived keys opened last (csgKeyCache.h,
+//  csgStream.c).  NULL when KeyCacheEntries is zero.
+//
+
+extern PCSG_KEYCACHE FileKeyCache;
+
+//
+//  Workers that encipher large writes off their issuers' threads
+//  (csgWorkPool.h, csgWrite.c).  NULL when CryptoWorkers is zero.
+//
+
+extern PCSG_WORKPOOL CryptoWorkPool;
+
+FORCEINLINE
+PCSG_STATS_CPU
+CurrentCpuStats (
+    VOID
+    )
+{
+    return &StatsCpu[csgCurrentCpu() % StatsCpuCount];
+}
+
+#define COUNT_STAT( _field, _value )                                \
+    csgInterlockedAdd64( (volatile LONGLONG *)&CurrentCpuStats()->_field, \
+                         (LONGLONG)(_value) )
+
+//
+//  Locks the users buffer of a read or directory query that has neither
+//  a MDL nor a system buffer, in the preOperation callback, where we are
+//  in the issuer's context.  The MDL is the operation's from then on, so
+//  the postOperation callback can reach the buffer at DPC level.  A lock
+//  that fails leaves the operation as it was.
+//
+
+FORCEINLINE
+VOID
+LockUserBufferForPostOp (
+    __inout PFLT_CALLBACK_DATA Data,
+    __in_opt PMDL MdlAddress
+    )
+{
+    NTSTATUS status;
+
+    if (!FLT_IS_IRP_OPERATION( Data ) ||
+        (MdlAddress != NULL) ||
+        FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_SYSTEM_BUFFER)) {
+
+        return;
+    }
+
+    status = FltLockUserBuffer( Data );
+
+    if (NT_SUCCESS( status )) {
+
+        COUNT_STAT( UserBuffersLocked, 1 );
+
+    } else {
+
+        COUNT_STAT( UserBufferLockFailures, 1 );
+    }
+}
+
+//
+//  What a protected file's header size is kept under in the volume's
+//  ProtectedIds: its file id, and nothing else.
+//
+
+FORCEINLINE
+VOID
+ProtectedIdKey (
+    __out PCSG_KEYCACHE_ID Id,
+    __in ULONGLONG FileId
+    )
+{
+    RtlZeroMemory( Id, sizeof(CSG_KEYCACHE_ID) );
+
+    Id->FileId = FileId;
+}
+
+//
+//  And under the hash of its name (csgDirWalkHashName), for the
+//  directory classes without file ids, told from a file id by a
+//  Generation of one.
+//
+
+FORCEINLINE
+VOID
+ProtectedNameKey (
+    __out PCSG_KEYCACHE_ID Id,
+    __in ULONGLONG NameHash
+    )
+{
+    RtlZeroMemory( Id, sizeof(CSG_KEYCACHE_ID) );
+
+    Id->FileId = NameHash;
+    Id->Generation = 1;
+}
+
+//
+//  Ends a transform stage begun at Start, which unlike StageTimestamp is
+//  always taken: the cipher throughput counters need it whether or not
+//  stage timing is on.  Plain copies are not counted as cipher work.
+//
+
+FORCEINLINE
+VOID
+RecordTransformCost (
+    __in ULONG Stage,
+    __in PCCSG_TRANSFORM Transform,
+    __in ULONG_PTR Length,
+    __in ULONGLONG Start
+    )
+{
+    ULONGLONG ticks = csgReadTimestamp() - Start;
+    PCSG_STATS_CPU stats;
+
+    if (Transform != &csgCopyTransform) {
+
+        stats = CurrentCpuStats();
+
+        csgInterlockedAdd64( (volatile LONGLONG *)&stats->CipherBytes, (LONGLONG)Length );
+        csgInterlockedAdd64( (volatile LONGLONG *)&stats->CipherTicks, (LONGLONG)ticks );
+    }
+
+    if (g_Global.StageTiming) {
+
+        csgHistRecord( StageCost[Stage], ticks );
+    }
+}
+
 /*************************************************************************
     Debug tracing information
 *************************************************************************/
@@ -83,6 +778,8 @@ extern CSG_GLOBAL_DATA g_Global;
 #define LOGFL_WRITE     0x00000004  // if set, display WRITE operation info
 #define LOGFL_DIRCTRL   0x00000008  // if set, display DIRCTRL operation info
 #define LOGFL_VOLCTX    0x00000010  // if set, display VOLCTX operation info
+#define LOGFL_CREATE    0x00000020  // if set, display CREATE operation info
+#define LOGFL_CAPTURE   0x00000040  // if set, trace every read, write and dirctrl for capture
 
 #define csg_print_form "[csg] [%d:%d] [%s:%u]: ", PsGetCurrentProcessId(), PsGetCurrentThreadId(), __FUNCTION__, __LINE__
 
@@ -94,4 +791,45 @@ extern CSG_GLOBAL_DATA g_Global;
         }                                                      \
     } while(0)
 
+//
+//  The I/O paths record binary events in per-processor rings (csgTrace.h)
+//  instead: LOG_PRINT formats and goes through the debugger transport,
+//  which costs more than the operation being logged.  Each event has a
+//  level and a LOGFL_* flag in csgTraceEvents.h.  Events above
+//  CSG_TRACE_LEVEL compile to nothing; the others are recorded when their
+//  flag is set in DebugFlags.
+//
+
+extern PCSG_TRACE TraceRing;
+
+enum {
+#define CSG_TRACE_EVENT( _name, _level, _flag, _format )    \
+    CSG_TRACE_LEVEL_##_name = (_level),                     \
+    CSG_TRACE_FLAG_##_name = (_flag),
+#include "csgTraceEvents.h"
+#undef CSG_TRACE_EVENT
+    CSG_TRACE_ENUM_END
+};
+
+#define CSG_TRACE_ARG( _a )     ((ULONGLONG)(ULONG_PTR)(_a))
+
+#define CSG_TRACE( _name, _a0, _a1, _a2, _a3, _a4, _a5 )                         \
+    do {                                                                        \
+        if (CSG_TRACE_LEVEL_##_name <= CSG_TRACE_LEVEL &&                       \
+            FlagOn(g_Global.DebugFlags, CSG_TRACE_FLAG_##_name)) {              \
+            csgTraceWrite( TraceRing, CSG_TRACE_##_name,                        \
+                           CSG_TRACE_ARG( _a0 ), CSG_TRACE_ARG( _a1 ),          \
+                           CSG_TRACE_ARG( _a2 ), CSG_TRACE_ARG( _a3 ),          \
+                           CSG_TRACE_ARG( _a4 ), CSG_TRACE_ARG( _a5 ) );        \
+        }                                                                       \
+    } while(0)
+
+#define CSG_TRACE0( _n )                            CSG_TRACE( _n, 0, 0, 0, 0, 0, 0 )
+#define CSG_TRACE1( _n, _a )                        CSG_TRACE( _n, _a, 0, 0, 0, 0, 0 )
+#define CSG_TRACE2( _n, _a, _b )                    CSG_TRACE( _n, _a, _b, 0, 0, 0, 0 )
+#define CSG_TRACE3( _n, _a, _b, _c )                CSG_TRACE( _n, _a, _b, _c, 0, 0, 0 )
+#define CSG_TRACE4( _n, _a, _b, _c, _d )            CSG_TRACE( _n, _a, _b, _c, _d, 0, 0 )
+#define CSG_TRACE5( _n, _a, _b, _c, _d, _e )        CSG_TRACE( _n, _a, _b, _c, _d, _e, 0 )
+#define CSG_TRACE6( _n, _a, _b, _c, _d, _e, _f )    CSG_TRACE( _n, _a, _b, _c, _d, _e, _f )
+
 #endif // __CSG_STRUCT_H__
@@ -0,0 +1,240 @@
+/*++
+
+Module Name:
+
+    csgSwapDesc.c
+
+Abstract:
+
+    Swap buffer descriptors: a nonpaged buffer and an MDL describing it,
+    built together when the swap buffer cache first allocates the buffer
+    and torn down together when the cache gives it back to the pool.
+
+    The MDL a filter puts in the callback data belongs to the I/O; the
+    filter manager frees it once the operation completes.  So the
+    descriptor's own MDL is never handed out.  Each operation instead gets
+    a partial MDL built from it, which is a copy of the page frame numbers
+    already looked up, not another walk of the page tables.
+
+    The post-operation callbacks keep that partial MDL from the filter
+    manager and give it back to the descriptor, which builds it again
+    for its next I/O.  A descriptor's I/Os therefore allocate an MDL only
+    the first time, or after one was not given back; what each I/O still
+    pays is the copy of the page frame numbers it uses.
+
+    A partial MDL of nonpaged pool has no system mapping of its own, so
+    nothing goes wrong if the filter manager frees one after the
+    descriptor has gone back to the cache, or even back to the pool.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgSwapDesc.h"
+
+#define CSG_SWAPDESC_TAG(_ctx)  ((ULONG)(ULONG_PTR)(_ctx))
+
+
+PVOID
+csgSwapDescCreate (
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Allocates a swap buffer with its descriptor and builds the MDL for it.
+
+Arguments:
+
+    Size - Size of the buffer, a swap buffer cache size class.
+
+    Context - The pool tag to allocate with.
+
+Return Value:
+
+    The descriptor, or NULL.
+
+--*/
+{
+    PCSG_SWAP_DESC desc;
+
+    if (Size > MAXULONG) {
+
+        return NULL;
+    }
+
+    desc = csgAllocateNonPaged( sizeof(CSG_SWAP_DESC), CSG_SWAPDESC_TAG( Context ) );
+
+    if (desc == NULL) {
+
+        return NULL;
+    }
+
+    desc->CacheLink = NULL;
+    desc->Capacity = (ULONG)Size;
+    desc->Mdl = NULL;
+    desc->IoMdl = NULL;
+
+    desc->Buffer = csgAllocateNonPaged( Size, CSG_SWAPDESC_TAG( Context ) );
+
+    if (desc->Buffer == NULL) {
+
+        goto csgSwapDescCreateCleanup;
+    }
+
+    desc->Mdl = csgMdlAllocate( desc->Buffer, desc->Capacity );
+
+    if (desc->Mdl == NULL) {
+
+        goto csgSwapDescCreateCleanup;
+    }
+
+    csgMdlBuildForNonPagedPool( desc->Mdl );
+
+    return desc;
+
+csgSwapDescCreateCleanup:
+
+    if (desc->Buffer != NULL) {
+
+        csgFreeNonPaged( desc->Buffer, CSG_SWAPDESC_TAG( Context ) );
+    }
+
+    csgFreeNonPaged( desc, CSG_SWAPDESC_TAG( Context ) );
+
+    return NULL;
+}
+
+
+VOID
+csgSwapDescDestroy (
+    __in PVOID Descriptor,
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Frees a descriptor from csgSwapDescCreate, its MDLs and its buffer.
+
+Arguments:
+
+    Descriptor - The descriptor.
+
+    Size - Unused; the descriptor knows its capacity.
+
+    Context - The pool tag it was allocated with.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCSG_SWAP_DESC desc = Descriptor;
+
+    UNREFERENCED_PARAMETER( Size );
+
+    if (desc->IoMdl != NULL) {
+
+        csgMdlFree( desc->IoMdl );
+    }
+
+    csgMdlFree( desc->Mdl );
+    csgFreeNonPaged( desc->Buffer, CSG_SWAPDESC_TAG( Context ) );
+    csgFreeNonPaged( desc, CSG_SWAPDESC_TAG( Context ) );
+}
+
+
+PMDL
+csgSwapDescBuildMdl (
+    __inout PCSG_SWAP_DESC Descriptor,
+    __in ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Builds an MDL for the first Length bytes of the descriptor's buffer,
+    to be handed to the file system with the swapped buffer.  The MDL
+    the last I/O gave back is built again if there is one; otherwise
+    one is allocated, large enough to be built again for any length.
+
+Arguments:
+
+    Descriptor - The descriptor.
+
+    Length - Bytes of the buffer the I/O uses; at most its capacity.
+
+Return Value:
+
+    A partial MDL the I/O owns from here on, until it is given back with
+    csgSwapDescKeepMdl, or NULL if none could be allocated.
+
+--*/
+{
+    PMDL mdl = Descriptor->IoMdl;
+
+    ASSERT( Length <= Descriptor->Capacity );
+
+    if (mdl != NULL) {
+
+        Descriptor->IoMdl = NULL;
+
+        csgMdlPrepareForReuse( mdl );
+
+    } else {
+
+        mdl = csgMdlAllocate( Descriptor->Buffer, Descriptor->Capacity );
+
+        if (mdl == NULL) {
+
+            return NULL;
+        }
+    }
+
+    csgMdlBuildPartial( Descriptor->Mdl, mdl, Descriptor->Buffer, Length );
+
+    return mdl;
+}
+
+
+VOID
+csgSwapDescKeepMdl (
+    __inout PCSG_SWAP_DESC Descriptor,
+    __in PMDL Mdl
+    )
+/*++
+
+Routine Description:
+
+    Gives the descriptor back the MDL csgSwapDescBuildMdl gave an I/O,
+    once the I/O is done with it, for the descriptor's next I/O.  Call it
+    before the descriptor goes back to the cache.
+
+Arguments:
+
+    Descriptor - The descriptor the MDL was built from.
+
+    Mdl - The MDL.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT( Mdl != Descriptor->Mdl );
+
+    if (Descriptor->IoMdl != NULL) {
+
+        csgMdlFree( Descriptor->IoMdl );
+    }
+
+    Descriptor->IoMdl = Mdl;
+}
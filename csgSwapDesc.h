@@ -0,0 +1,78 @@
+#ifndef __CSG_SWAPDESC_H__
+#define __CSG_SWAPDESC_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Swap buffer descriptors
+*************************************************************************/
+
+//
+//  A swap buffer together with an MDL built once for all of it.  The
+//  swap buffer cache holds descriptors rather than bare buffers, so the
+//  page frame numbers are looked up when the buffer is first allocated and
+//  never again.
+//
+
+typedef struct _CSG_SWAP_DESC {
+
+    //
+    //  Belongs to the swap buffer cache while the descriptor sits in it.
+    //  Must be the first field.
+    //
+
+    PVOID CacheLink;
+
+    PVOID Buffer;
+
+    ULONG Capacity;
+
+    //
+    //  Describes all Capacity bytes of Buffer.  Never handed to anyone
+    //  else; I/O gets a partial MDL built from it.
+    //
+
+    PMDL Mdl;
+
+    //
+    //  The partial MDL the last I/O was given, taken back when it
+    //  completed, allocated for all of Buffer so that it can be built
+    //  again for any length.  NULL while an I/O has it, and until the
+    //  first I/O.
+    //
+
+    PMDL IoMdl;
+
+} CSG_SWAP_DESC, *PCSG_SWAP_DESC;
+
+//
+//  These two have the signatures of the swap buffer cache's allocate and
+//  free callbacks; Size is the size class, Context the pool tag.
+//
+
+PVOID
+csgSwapDescCreate (
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    );
+
+VOID
+csgSwapDescDestroy (
+    __in PVOID Descriptor,
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    );
+
+PMDL
+csgSwapDescBuildMdl (
+    __inout PCSG_SWAP_DESC Descriptor,
+    __in ULONG Length
+    );
+
+VOID
+csgSwapDescKeepMdl (
+    __inout PCSG_SWAP_DESC Descriptor,
+    __in PMDL Mdl
+    );
+
+#endif // __CSG_SWAPDESC_H__
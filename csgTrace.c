@@ -0,0 +1,337 @@
+/*++
+
+Module Name:
+
+    csgTrace.c
+
+Abstract:
+
+    Per-processor rings of binary trace records.
+
+    A writer claims a slot by incrementing its ring's head, clears the
+    slot's sequence, fills in the record and then publishes the sequence.
+    Claiming is the only interlocked operation, and two writers on one
+    processor (one preempted, or interrupted) get different slots.  A
+    writer so slow that the ring wraps all the way around it can leave a
+    torn record behind; the reader cannot always tell, which is the price
+    of never blocking a writer.
+
+    The reader checks a slot's sequence before and after copying it and
+    keeps the copy only if both match the position it expected.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgTrace.h"
+
+#define CSG_TRACE_CACHE_LINE    64
+
+#define CSG_TRACE_TAG           'rtBS'
+
+typedef struct CSG_ALIGN(CSG_TRACE_CACHE_LINE) _CSG_TRACE_RING {
+
+    volatile LONGLONG Head;
+
+    PCSG_TRACE_RECORD Records;
+
+} CSG_TRACE_RING, *PCSG_TRACE_RING;
+
+struct _CSG_TRACE {
+
+    ULONG RingCount;
+
+    ULONG Mask;
+
+    PCSG_TRACE_RING Rings;
+
+    //
+    //  Where the allocation for this structure really starts.
+    //
+
+    PVOID Allocation;
+};
+
+
+NTSTATUS
+csgTraceCreate (
+    __in ULONG RecordsPerCpu,
+    __out PCSG_TRACE *Trace
+    )
+/*++
+
+Routine Description:
+
+    Creates a trace with one ring per processor.
+
+Arguments:
+
+    RecordsPerCpu - Records each ring holds; rounded up to a power of two.
+
+    Trace - Receives the trace.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER
+    STATUS_INSUFFICIENT_RESOURCES
+
+--*/
+{
+    PCSG_TRACE trace;
+    ULONG ringCount = csgCpuCount();
+    ULONG records = 1;
+    SIZE_T size;
+    PVOID allocation;
+    PCSG_TRACE_RECORD next;
+    ULONG i;
+
+    *Trace = NULL;
+
+    if (RecordsPerCpu == 0 || RecordsPerCpu > 0x10000) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while (records < RecordsPerCpu) {
+
+        records <<= 1;
+    }
+
+    //
+    //  The structure, then the rings, then the records, each on a cache
+    //  line of its own.
+    //
+
+    size = CSG_TRACE_CACHE_LINE +
+           sizeof(CSG_TRACE) +
+           CSG_TRACE_CACHE_LINE +
+           ringCount * sizeof(CSG_TRACE_RING) +
+           (SIZE_T)ringCount * records * sizeof(CSG_TRACE_RECORD);
+
+    allocation = csgAllocateNonPaged( size, CSG_TRACE_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    trace = (PCSG_TRACE)(((ULONG_PTR)allocation + CSG_TRACE_CACHE_LINE - 1) &
+                         ~(ULONG_PTR)(CSG_TRACE_CACHE_LINE - 1));
+
+    trace->Allocation = allocation;
+    trace->RingCount = ringCount;
+    trace->Mask = records - 1;
+    trace->Rings = (PCSG_TRACE_RING)(((ULONG_PTR)(trace + 1) + CSG_TRACE_CACHE_LINE - 1) &
+                                     ~(ULONG_PTR)(CSG_TRACE_CACHE_LINE - 1));
+
+    next = (PCSG_TRACE_RECORD)(trace->Rings + ringCount);
+
+    for (i = 0; i < ringCount; i++) {
+
+        trace->Rings[i].Records = next;
+        next += records;
+    }
+
+    *Trace = trace;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgTraceDestroy (
+    __in PCSG_TRACE Trace
+    )
+/*++
+
+Routine Description:
+
+    Frees a trace.  No other call may be in progress or follow.
+
+Arguments:
+
+    Trace - The trace to destroy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgFreeNonPaged( Trace->Allocation, CSG_TRACE_TAG );
+}
+
+
+VOID
+csgTraceWrite (
+    __in PCSG_TRACE Trace,
+    __in USHORT Event,
+    __in ULONGLONG Arg0,
+    __in ULONGLONG Arg1,
+    __in ULONGLONG Arg2,
+    __in ULONGLONG Arg3,
+    __in ULONGLONG Arg4,
+    __in ULONGLONG Arg5
+    )
+/*++
+
+Routine Description:
+
+    Appends a record to the current processor's ring.  Callable at any
+    IRQL up to HIGH_LEVEL.
+
+Arguments:
+
+    Trace - The trace.
+
+    Event - A CSG_TRACE_* event id.
+
+    Arg0 through Arg5 - The event's arguments; unused ones are zero.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG cpu = csgCurrentCpu();
+    PCSG_TRACE_RING ring = &Trace->Rings[cpu % Trace->RingCount];
+    LONGLONG ticket;
+    PCSG_TRACE_RECORD record;
+
+    ticket = csgInterlockedIncrement64( &ring->Head ) - 1;
+    record = &ring->Records[(ULONG)ticket & Trace->Mask];
+
+    //
+    //  Readers must see the slot as unfinished before any of it changes.
+    //
+
+    record->Sequence = 0;
+    csgStoreFence();
+
+    record->Event = Event;
+    record->Cpu = (USHORT)cpu;
+    record->Timestamp = csgReadTimestamp();
+    record->Args[0] = Arg0;
+    record->Args[1] = Arg1;
+    record->Args[2] = Arg2;
+    record->Args[3] = Arg3;
+    record->Args[4] = Arg4;
+    record->Args[5] = Arg5;
+
+    csgStoreRelease32( &record->Sequence, (ULONG)ticket + 1 );
+}
+
+
+ULONG
+csgTraceRingCount (
+    __in PCSG_TRACE Trace
+    )
+/*++
+
+Routine Description:
+
+    Reports how many rings (processors) the trace has.
+
+Arguments:
+
+    Trace - The trace.
+
+Return Value:
+
+    The ring count.
+
+--*/
+{
+    return Trace->RingCount;
+}
+
+
+ULONG
+csgTraceSnapshot (
+    __in PCSG_TRACE Trace,
+    __in ULONG Ring,
+    __out_ecount(MaxRecords) PCSG_TRACE_RECORD Records,
+    __in ULONG MaxRecords
+    )
+/*++
+
+Routine Description:
+
+    Copies the newest complete records of one ring, oldest first.  Writers
+    are not held off; records they overwrite or are still writing are left
+    out.
+
+Arguments:
+
+    Trace - The trace.
+
+    Ring - Which ring, below csgTraceRingCount.
+
+    Records - Receives the records.
+
+    MaxRecords - Room in Records.
+
+Return Value:
+
+    The number of records copied.
+
+--*/
+{
+    PCSG_TRACE_RING ring;
+    LONGLONG head;
+    LONGLONG position;
+    ULONG count = 0;
+    ULONG expected;
+    PCSG_TRACE_RECORD record;
+
+    if (Ring >= Trace->RingCount) {
+
+        return 0;
+    }
+
+    ring = &Trace->Rings[Ring];
+    head = ring->Head;
+
+    position = head - (LONGLONG)Trace->Mask - 1;
+
+    if (position < 0) {
+
+        position = 0;
+    }
+
+    if (head - position > (LONGLONG)MaxRecords) {
+
+        position = head - MaxRecords;
+    }
+
+    for (; position < head; position++) {
+
+        record = &ring->Records[(ULONG)position & Trace->Mask];
+        expected = (ULONG)position + 1;
+
+        if (expected == 0 ||
+            csgLoadAcquire32( &record->Sequence ) != expected) {
+
+            continue;
+        }
+
+        RtlCopyMemory( &Records[count], record, sizeof(CSG_TRACE_RECORD) );
+
+        csgLoadFence();
+
+        if (csgLoadAcquire32( &record->Sequence ) != expected) {
+
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
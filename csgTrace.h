@@ -0,0 +1,110 @@
+#ifndef __CSG_TRACE_H__
+#define __CSG_TRACE_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Binary trace rings
+*************************************************************************/
+
+//
+//  Every processor has a ring of fixed size records.  Writing one takes
+//  an interlocked increment and a cache line of stores: no lock, no
+//  formatting, no call into the debugger transport.  When a ring is full
+//  the oldest records are overwritten.  A reader copies records out while
+//  writers carry on, and drops any record that changed under it.
+//
+//  Records carry an event id and raw arguments; the format strings live
+//  in csgTraceEvents.h and are applied by the decoder (csgctl).
+//
+
+#define CSG_TRACE_LEVEL_ERROR       1
+#define CSG_TRACE_LEVEL_WARNING     2
+#define CSG_TRACE_LEVEL_INFO        3
+#define CSG_TRACE_LEVEL_VERBOSE     4
+
+//
+//  Events above this level are not compiled in.
+//
+
+#ifndef CSG_TRACE_LEVEL
+#if DBG
+#define CSG_TRACE_LEVEL             CSG_TRACE_LEVEL_VERBOSE
+#else
+#define CSG_TRACE_LEVEL             CSG_TRACE_LEVEL_INFO
+#endif
+#endif
+
+#define CSG_TRACE_MAX_ARGS          6
+
+typedef enum _CSG_TRACE_EVENT_ID {
+
+    CSG_TRACE_NONE = 0,
+
+#define CSG_TRACE_EVENT( _name, _level, _flag, _format )    CSG_TRACE_##_name,
+#include "csgTraceEvents.h"
+#undef CSG_TRACE_EVENT
+
+    CSG_TRACE_EVENT_COUNT
+
+} CSG_TRACE_EVENT_ID;
+
+//
+//  One record, one cache line.  Sequence is the record's position in its
+//  ring plus one, truncated to 32 bits; it is zero while the record is
+//  being written.
+//
+
+typedef struct _CSG_TRACE_RECORD {
+
+    ULONG Sequence;
+
+    USHORT Event;
+
+    USHORT Cpu;
+
+    ULONGLONG Timestamp;
+
+    ULONGLONG Args[CSG_TRACE_MAX_ARGS];
+
+} CSG_TRACE_RECORD, *PCSG_TRACE_RECORD;
+
+typedef struct _CSG_TRACE CSG_TRACE, *PCSG_TRACE;
+
+NTSTATUS
+csgTraceCreate (
+    __in ULONG RecordsPerCpu,
+    __out PCSG_TRACE *Trace
+    );
+
+VOID
+csgTraceDestroy (
+    __in PCSG_TRACE Trace
+    );
+
+VOID
+csgTraceWrite (
+    __in PCSG_TRACE Trace,
+    __in USHORT Event,
+    __in ULONGLONG Arg0,
+    __in ULONGLONG Arg1,
+    __in ULONGLONG Arg2,
+    __in ULONGLONG Arg3,
+    __in ULONGLONG Arg4,
+    __in ULONGLONG Arg5
+    );
+
+ULONG
+csgTraceRingCount (
+    __in PCSG_TRACE Trace
+    );
+
+ULONG
+csgTraceSnapshot (
+    __in PCSG_TRACE Trace,
+    __in ULONG Ring,
+    __out_ecount(MaxRecords) PCSG_TRACE_RECORD Records,
+    __in ULONG MaxRecords
+    );
+
+#endif // __CSG_TRACE_H__
@@ -0,0 +1,152 @@
+/*++
+
+Module Name:
+
+    csgTraceEvents.h
+
+Abstract:
+
+    The trace events the driver records, one line each:
+
+        CSG_TRACE_EVENT( Name, Level, Flag, Format )
+
+    Name becomes CSG_TRACE_<Name>, the event id stored in the record.
+    Level is a CSG_TRACE_LEVEL_* value; events above CSG_TRACE_LEVEL are
+    compiled out.  Flag is the LOGFL_* bit in DebugFlags that enables the
+    event at run time.  Format is what the decoder prints the arguments
+    with; every argument is a ULONGLONG, so only %llx and %llu belong in
+    it.  Pointers are recorded as their values: a volume shows up as its
+    context address, not its name.
+
+    Events are only ever appended to this list, so a decoder built from
+    an older copy still names every event it knows.
+
+Environment:
+
+    Kernel mode and user mode.  This file is included more than once and
+    has no include guard.
+
+--*/
+
+//
+//  Read path
+//
+
+CSG_TRACE_EVENT( READ_NO_VOLCTX,            CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "Error getting volume context, status=%llx" )
+CSG_TRACE_EVENT( READ_NO_OFFSET,            CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Noncached read without an explicit offset" )
+CSG_TRACE_EVENT( READ_NO_BUFFER,            CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate %llu bytes of memory" )
+CSG_TRACE_EVENT( READ_NO_MDL,               CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate MDL" )
+CSG_TRACE_EVENT( READ_NO_CONTEXT,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate pre2Post context structure" )
+CSG_TRACE_EVENT( READ_SWAP,                 CSG_TRACE_LEVEL_VERBOSE,    LOGFL_READ,
+                 "vol=%llx newB=%llx newMdl=%llx oldB=%llx oldMdl=%llx len=%llu" )
+CSG_TRACE_EVENT( READ_NO_DATA,              CSG_TRACE_LEVEL_VERBOSE,    LOGFL_READ,
+                 "vol=%llx newB=%llx No data read, status=%llx, info=%llx" )
+CSG_TRACE_EVENT( READ_NO_SYSADDR,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to get system address for MDL: %llx" )
+CSG_TRACE_EVENT( READ_NOT_SAFE,             CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Unable to post to a safe IRQL" )
+CSG_TRACE_EVENT( READ_BAD_BUFFER,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Invalid user buffer, oldB=%llx, status=%llx" )
+CSG_TRACE_EVENT( READ_FREE,                 CSG_TRACE_LEVEL_VERBOSE,    LOGFL_READ,
+                 "vol=%llx newB=%llx info=%llu Freeing" )
+CSG_TRACE_EVENT( READ_SAFE_NO_LOCK,         CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Could not lock user buffer, oldB=%llx, status=%llx" )
+CSG_TRACE_EVENT( READ_SAFE_NO_SYSADDR,      CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to get system address for MDL: %llx" )
+CSG_TRACE_EVENT( READ_SAFE_FREE,            CSG_TRACE_LEVEL_VERBOSE,    LOGFL_READ,
+                 "vol=%llx newB=%llx info=%llu Freeing" )
+
+//
+//  Write path
+//
+
+CSG_TRACE_EVENT( WRITE_NO_VOLCTX,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "Error getting volume context, status=%llx" )
+CSG_TRACE_EVENT( WRITE_NO_OFFSET,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Noncached write without an explicit offset" )
+CSG_TRACE_EVENT( WRITE_NO_BUFFER,           CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate %llu bytes of memory" )
+CSG_TRACE_EVENT( WRITE_NO_MDL,              CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate MDL" )
+CSG_TRACE_EVENT( WRITE_NO_SYSADDR,          CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to get system address for MDL: %llx" )
+CSG_TRACE_EVENT( WRITE_BAD_BUFFER,          CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Invalid user buffer, oldB=%llx, status=%llx" )
+CSG_TRACE_EVENT( WRITE_NO_CONTEXT,          CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate pre2Post context structure" )
+CSG_TRACE_EVENT( WRITE_SWAP,                CSG_TRACE_LEVEL_VERBOSE,    LOGFL_WRITE,
+                 "vol=%llx newB=%llx newMdl=%llx oldB=%llx len=%llu xform=%llx" )
+CSG_TRACE_EVENT( WRITE_FREE,                CSG_TRACE_LEVEL_VERBOSE,    LOGFL_WRITE,
+                 "vol=%llx newB=%llx info=%llu Freeing" )
+
+//
+//  Directory control path
+//
+
+CSG_TRACE_EVENT( DIRCTRL_NO_VOLCTX,         CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "Error getting volume context, status=%llx" )
+CSG_TRACE_EVENT( DIRCTRL_NO_BUFFER,         CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate %llu bytes of memory" )
+CSG_TRACE_EVENT( DIRCTRL_NO_MDL,            CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate MDL" )
+CSG_TRACE_EVENT( DIRCTRL_NO_CONTEXT,        CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to allocate pre2Post context structure" )
+CSG_TRACE_EVENT( DIRCTRL_SWAP,              CSG_TRACE_LEVEL_VERBOSE,    LOGFL_DIRCTRL,
+                 "vol=%llx newB=%llx newMdl=%llx oldB=%llx oldMdl=%llx len=%llu" )
+CSG_TRACE_EVENT( DIRCTRL_NO_DATA,           CSG_TRACE_LEVEL_VERBOSE,    LOGFL_DIRCTRL,
+                 "vol=%llx newB=%llx No data read, status=%llx, info=%llx" )
+CSG_TRACE_EVENT( DIRCTRL_NO_SYSADDR,        CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to get system address for MDL: %llx" )
+CSG_TRACE_EVENT( DIRCTRL_NOT_SAFE,          CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Unable to post to a safe IRQL" )
+CSG_TRACE_EVENT( DIRCTRL_BAD_BUFFER,        CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Invalid user buffer, oldB=%llx, status=%llx, info=%llx" )
+CSG_TRACE_EVENT( DIRCTRL_FREE,              CSG_TRACE_LEVEL_VERBOSE,    LOGFL_DIRCTRL,
+                 "vol=%llx newB=%llx info=%llu Freeing" )
+CSG_TRACE_EVENT( DIRCTRL_SAFE_NO_LOCK,      CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Could not lock user buffer, oldB=%llx, status=%llx" )
+CSG_TRACE_EVENT( DIRCTRL_SAFE_NO_SYSADDR,   CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "vol=%llx Failed to get system address for MDL: %llx" )
+CSG_TRACE_EVENT( DIRCTRL_SAFE_FREE,         CSG_TRACE_LEVEL_VERBOSE,    LOGFL_DIRCTRL,
+                 "vol=%llx newB=%llx info=%llu Freeing" )
+
+//
+//  Create and protected streams
+//
+
+CSG_TRACE_EVENT( CREATE_NO_KEY,             CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "FileObject=%llx not protected, no WrappingKey or MasterKey" )
+CSG_TRACE_EVENT( CREATE_NO_CONTEXT,         CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "Error allocating stream context, status=%llx" )
+CSG_TRACE_EVENT( CREATE_SET_FAILED,         CSG_TRACE_LEVEL_ERROR,      LOGFL_ERRORS,
+                 "Error setting stream context, status=%llx" )
+CSG_TRACE_EVENT( CREATE_PROTECTED,          CSG_TRACE_LEVEL_INFO,       LOGFL_CREATE,
+                 "FileObject=%llx protected=%llu, status=%llx" )
+CSG_TRACE_EVENT( STREAM_NEW_HEADER,         CSG_TRACE_LEVEL_INFO,       LOGFL_CREATE,
+                 "FileObject=%llx new header, status=%llx" )
+
+//
+//  I/O capture: every read, write and directory query as it reaches the
+//  pre-operation callback, swapped or not.  csgctl capture turns these
+//  into a replayable file (csgctl/csgcapture.h).  flags is Data->Flags;
+//  for directory queries its upper half is the SL_* operation flags.
+//
+
+CSG_TRACE_EVENT( IO_READ,                   CSG_TRACE_LEVEL_INFO,       LOGFL_CAPTURE,
+                 "FileObject=%llx offset=%llx len=%llu irpFlags=%llx flags=%llx thread=%llx" )
+CSG_TRACE_EVENT( IO_WRITE,                  CSG_TRACE_LEVEL_INFO,       LOGFL_CAPTURE,
+                 "FileObject=%llx offset=%llx len=%llu irpFlags=%llx flags=%llx thread=%llx" )
+CSG_TRACE_EVENT( IO_DIRCTRL,                CSG_TRACE_LEVEL_INFO,       LOGFL_CAPTURE,
+                 "FileObject=%llx minor=%llu class=%llu len=%llu flags=%llx thread=%llx" )
+
+//
+//  Crypto workers
+//
+
+CSG_TRACE_EVENT( READ_SPLIT,                CSG_TRACE_LEVEL_VERBOSE,    LOGFL_READ,
+                 "vol=%llx newB=%llx info=%llu chunks=%llu chunkLen=%llu" )
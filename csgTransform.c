@@ -0,0 +1,43 @@
+/*++
+
+Module Name:
+
+    csgTransform.c
+
+Abstract:
+
+    The transforms the buffer swap paths apply between the users buffer and
+    the swapped buffer.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgTransform.h"
+
+static VOID
+csgCopyTransformRoutine (
+    __in CONST VOID *Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *Src,
+    __out_bcount(Length) UCHAR *Dst,
+    __in SIZE_T Length
+    )
+{
+    UNREFERENCED_PARAMETER( Key );
+    UNREFERENCED_PARAMETER( DataUnit );
+    UNREFERENCED_PARAMETER( DataUnitSize );
+
+    RtlCopyMemory( Dst, Src, Length );
+}
+
+CONST CSG_TRANSFORM csgCopyTransform = {
+
+    "copy",
+    FALSE,
+    csgCopyTransformRoutine,
+    csgCopyTransformRoutine
+};
@@ -0,0 +1,66 @@
+#ifndef __CSG_TRANSFORM_H__
+#define __CSG_TRANSFORM_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Buffer transforms
+*************************************************************************/
+
+//
+//  A transform moves data between the users buffer and our swapped buffer
+//  in a single pass, enciphering on the way to disk and deciphering on the
+//  way back.  Source and destination are separate buffers, which lets the
+//  swap paths read the users buffer once instead of copying it and then
+//  enciphering the copy.
+//
+//  DataUnit and DataUnitSize locate the data on disk: DataUnit is the
+//  number of the first sector transferred and DataUnitSize the sector size.
+//  Transforms that ignore the position (the copy transform) accept any
+//  length; the others need a whole number of data units.
+//
+
+typedef VOID
+(*PCSG_TRANSFORM_ROUTINE) (
+    __in CONST VOID *Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *Src,
+    __out_bcount(Length) UCHAR *Dst,
+    __in SIZE_T Length
+    );
+
+typedef struct _CSG_TRANSFORM {
+
+    //
+    //  Name for debug display.
+    //
+
+    CONST CHAR *Name;
+
+    //
+    //  TRUE if Length must be a multiple of DataUnitSize.
+    //
+
+    BOOLEAN WholeUnits;
+
+    PCSG_TRANSFORM_ROUTINE Encrypt;
+
+    PCSG_TRANSFORM_ROUTINE Decrypt;
+
+} CSG_TRANSFORM, *PCSG_TRANSFORM;
+
+typedef CONST CSG_TRANSFORM *PCCSG_TRANSFORM;
+
+//
+//  Plain copy in both directions.  Used for I/O we do not encipher, and as
+//  the baseline the cipher transforms are measured against.
+//
+
+extern CONST CSG_TRANSFORM csgCopyTransform;
+
+//
+//  The cipher transforms come from the provider table, see csgProvider.h.
+//
+
+#endif // __CSG_TRANSFORM_H__
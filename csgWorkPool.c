@@ -0,0 +1,1188 @@
+/*++
+
+Module Name:
+
+    csgWorkPool.c
+
+Abstract:
+
+    The crypto worker pool (see csgWorkPool.h).
+
+    Each node's queue is a bounded multi-producer, multi-consumer ring
+    after Dmitry Vyukov's: every cell carries a sequence number that says
+    whether it is free for the enqueue at its position or holds the item
+    for the dequeue there, and producers and consumers each claim a
+    position with one compare-exchange on their own index.  Neither side
+    ever waits for the other, and the two indexes sit on separate cache
+    lines.
+
+    A worker that finds its queue empty for a while counts itself among
+    the node's sleepers and looks at the queue once more before it waits
+    on the node's semaphore.  A submitter looks at the sleepers after its
+    enqueue and, if there is one, takes it off the count and releases the
+    semaphore once.  Both look only after a full fence, so one of the two
+    always sees the other: either the worker finds the item or the
+    submitter finds the worker.  A worker that finds an item on its second
+    look takes itself off the count again, unless a submitter already
+    has, in which case it takes the wake up that submitter is sending.
+
+    Before it counts itself a sleeper a worker pops once from each other
+    node's queue, starting with the next node so the thieves of a node
+    spread out.  A stolen item is counted as executed on the node it was
+    queued to, which keeps each node's submitted count whole.
+
+    A job's chunks are claimed by an interlocked increment of its next
+    chunk and finished by an interlocked decrement of the chunks left;
+    the participant whose decrement reaches zero finished the job.  The
+    job also counts the references to it, one for the submitter and one
+    for each helper queued, since a helper may get to the job long after
+    the last chunk is done.
+
+Environment:
+
+    Kernel mode, or user mode on Linux when built with CSG_USER_MODE.
+
+--*/
+
+#if defined(CSG_USER_MODE)
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+#include "csgWorkPool.h"
+
+#define CSG_WORKPOOL_CACHE_LINE     64
+
+#define CSG_WORKPOOL_TAG            'pwBS'
+
+#define CSG_WORKPOOL_MAX_NODES      64
+#define CSG_WORKPOOL_MAX_WORKERS    64
+#define CSG_WORKPOOL_MAX_DEPTH      0x10000
+
+//
+//  How many times an idle worker looks at its queue before it sleeps.
+//
+
+#define CSG_WORKPOOL_SPIN           256
+
+/*************************************************************************
+    Platform
+*************************************************************************/
+
+#ifdef CSG_USER_MODE
+
+typedef sem_t CSG_WORK_SEMAPHORE;
+
+typedef cpu_set_t CSG_WORK_AFFINITY;
+
+#define csgWorkSemaphoreInit(_s)        sem_init( (_s), 0, 0 )
+#define csgWorkSemaphoreRelease(_s, _n) { ULONG _i; for (_i = 0; _i < (_n); _i++) sem_post( (_s) ); }
+#define csgWorkSemaphoreDelete(_s)      sem_destroy( (_s) )
+
+CSG_INLINE VOID
+csgWorkSemaphoreWait (
+    CSG_WORK_SEMAPHORE *Semaphore
+    )
+{
+    //
+    //  Only a signal ends the wait early.
+    //
+
+    while (sem_wait( Semaphore ) != 0) {
+
+        continue;
+    }
+}
+
+#ifdef CSG_ARCH_AMD64
+#define csgWorkPause()                  _mm_pause()
+#else
+#define csgWorkPause()                  ((VOID)0)
+#endif
+
+#else
+
+typedef KSEMAPHORE CSG_WORK_SEMAPHORE;
+
+typedef GROUP_AFFINITY CSG_WORK_AFFINITY;
+
+#define csgWorkSemaphoreInit(_s)        KeInitializeSemaphore( (_s), 0, MAXLONG )
+#define csgWorkSemaphoreRelease(_s, _n) KeReleaseSemaphore( (_s), IO_NO_INCREMENT, (_n), FALSE )
+#define csgWorkSemaphoreWait(_s)        KeWaitForSingleObject( (_s), Executive, KernelMode, FALSE, NULL )
+#define csgWorkSemaphoreDelete(_s)      ((VOID)(_s))
+
+#define csgWorkPause()                  YieldProcessor()
+
+#endif
+
+/*************************************************************************
+    Structures
+*************************************************************************/
+
+typedef struct _CSG_WORK_CELL {
+
+    volatile ULONG Sequence;
+
+    PCSG_WORK_ITEM Item;
+
+} CSG_WORK_CELL, *PCSG_WORK_CELL;
+
+typedef struct _CSG_WORK_NODE CSG_WORK_NODE, *PCSG_WORK_NODE;
+
+typedef struct _CSG_WORK_THREAD {
+
+    PCSG_WORK_NODE Node;
+
+#ifdef CSG_USER_MODE
+    pthread_t Thread;
+#else
+    PETHREAD Thread;
+#endif
+
+    BOOLEAN Started;
+
+} CSG_WORK_THREAD, *PCSG_WORK_THREAD;
+
+struct CSG_ALIGN(CSG_WORKPOOL_CACHE_LINE) _CSG_WORK_NODE {
+
+    //
+    //  Moved by the submitters.
+    //
+
+    volatile ULONG Tail;
+
+    volatile LONG Sleepers;
+
+    volatile LONGLONG Rejected;
+
+    //
+    //  Moved by the workers.
+    //
+
+    CSG_ALIGN(CSG_WORKPOOL_CACHE_LINE) volatile ULONG Head;
+
+    volatile LONGLONG Executed;
+
+    volatile LONGLONG Wakeups;
+
+    volatile LONGLONG Stolen;
+
+    //
+    //  Set at creation.
+    //
+
+    CSG_ALIGN(CSG_WORKPOOL_CACHE_LINE) ULONG Mask;
+
+    PCSG_WORK_CELL Cells;
+
+    PCSG_WORKPOOL Pool;
+
+    ULONG Number;
+
+    CSG_WORK_AFFINITY Affinity;
+
+    ULONG WorkerCount;
+
+    PCSG_WORK_THREAD Workers;
+
+    CSG_WORK_SEMAPHORE Wake;
+};
+
+struct _CSG_WORKPOOL {
+
+    volatile BOOLEAN Stopping;
+
+    ULONG NodeCount;
+
+    PCSG_WORK_NODE Nodes;
+
+#ifdef CSG_USER_MODE
+
+    //
+    //  The node of each processor.
+    //
+
+    ULONG CpuCount;
+
+    PUCHAR CpuNode;
+
+#endif
+
+    //
+    //  Where the allocation for this structure really starts.
+    //
+
+    PVOID Allocation;
+};
+
+/*************************************************************************
+    Topology and threads
+*************************************************************************/
+
+#ifdef CSG_USER_MODE
+
+static ULONG
+csgWorkPoolNodeCount (
+    VOID
+    )
+{
+    CHAR path[64];
+    ULONG count = 1;
+    ULONG node;
+
+    for (node = 1; node < CSG_WORKPOOL_MAX_NODES; node++) {
+
+        snprintf( path, sizeof(path), "/sys/devices/system/node/node%u", node );
+
+        if (access( path, F_OK ) == 0) {
+
+            count = node + 1;
+        }
+    }
+
+    return count;
+}
+
+
+static ULONG
+csgWorkPoolNodeAffinity (
+    __in ULONG Node,
+    __out CSG_WORK_AFFINITY *Affinity,
+    __inout_ecount(CpuCount) PUCHAR CpuNode,
+    __in ULONG CpuCount
+    )
+/*++
+
+Routine Description:
+
+    Finds the processors of a node, from sysfs.  Without sysfs every
+    processor is taken to be on node 0.
+
+--*/
+{
+    CHAR path[96];
+    ULONG count = 0;
+    ULONG cpu;
+
+    CPU_ZERO( Affinity );
+
+    for (cpu = 0; cpu < CpuCount; cpu++) {
+
+        snprintf( path, sizeof(path), "/sys/devices/system/node/node%u/cpu%u", Node, cpu );
+
+        if ((access( path, F_OK ) == 0) ||
+            ((Node == 0) && (access( "/sys/devices/system/node/node0", F_OK ) != 0))) {
+
+            CPU_SET( cpu, Affinity );
+            CpuNode[cpu] = (UCHAR)Node;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+CSG_INLINE ULONG
+csgWorkPoolCurrentNode (
+    __in PCSG_WORKPOOL Pool
+    )
+{
+    return Pool->CpuNode[csgCurrentCpu() % Pool->CpuCount];
+}
+
+#else
+
+#define csgWorkPoolNodeCount()      ((ULONG)KeQueryHighestNodeNumber() + 1)
+
+static ULONG
+csgWorkPoolNodeAffinity (
+    __in ULONG Node,
+    __out CSG_WORK_AFFINITY *Affinity
+    )
+{
+    ULONG count = 0;
+    KAFFINITY mask;
+
+    KeQueryNodeActiveAffinity( (USHORT)Node, Affinity, NULL );
+
+    for (mask = Affinity->Mask; mask != 0; mask &= mask - 1) {
+
+        count++;
+    }
+
+    return count;
+}
+
+
+CSG_INLINE ULONG
+csgWorkPoolCurrentNode (
+    __in PCSG_WORKPOOL Pool
+    )
+{
+    ULONG node = KeGetCurrentNodeNumber();
+
+    return (node < Pool->NodeCount) ? node : 0;
+}
+
+#endif
+
+static VOID
+csgWorkPoolWorker (
+    __in PCSG_WORK_NODE Node
+    );
+
+#ifdef CSG_USER_MODE
+
+static PVOID
+csgWorkPoolThreadStart (
+    __in PVOID Context
+    )
+{
+    PCSG_WORK_THREAD thread = Context;
+
+    pthread_setaffinity_np( pthread_self(), sizeof(cpu_set_t), &thread->Node->Affinity );
+
+    csgWorkPoolWorker( thread->Node );
+
+    return NULL;
+}
+
+
+static NTSTATUS
+csgWorkPoolStartThread (
+    __inout PCSG_WORK_THREAD Thread
+    )
+{
+    if (pthread_create( &Thread->Thread, NULL, csgWorkPoolThreadStart, Thread ) != 0) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Thread->Started = TRUE;
+
+    return STATUS_SUCCESS;
+}
+
+
+static VOID
+csgWorkPoolJoinThread (
+    __in PCSG_WORK_THREAD Thread
+    )
+{
+    pthread_join( Thread->Thread, NULL );
+}
+
+#else
+
+static KSTART_ROUTINE csgWorkPoolThreadStart;
+
+static VOID
+csgWorkPoolThreadStart (
+    __in PVOID Context
+    )
+{
+    PCSG_WORK_THREAD thread = Context;
+
+    KeSetSystemGroupAffinityThread( &thread->Node->Affinity, NULL );
+
+    csgWorkPoolWorker( thread->Node );
+
+    PsTerminateSystemThread( STATUS_SUCCESS );
+}
+
+
+static NTSTATUS
+csgWorkPoolStartThread (
+    __inout PCSG_WORK_THREAD Thread
+    )
+{
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE handle;
+    NTSTATUS status;
+
+    InitializeObjectAttributes( &attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL );
+
+    status = PsCreateSystemThread( &handle,
+                                   THREAD_ALL_ACCESS,
+                                   &attributes,
+                                   NULL,
+                                   NULL,
+                                   csgWorkPoolThreadStart,
+                                   Thread );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    //
+    //  Referencing a handle we just created cannot fail.
+    //
+
+    status = ObReferenceObjectByHandle( handle,
+                                        THREAD_ALL_ACCESS,
+                                        *PsThreadType,
+                                        KernelMode,
+                                        (PVOID *)&Thread->Thread,
+                                        NULL );
+
+    ASSERT( NT_SUCCESS( status ) );
+
+    ZwClose( handle );
+
+    Thread->Started = NT_SUCCESS( status );
+
+    return status;
+}
+
+
+static VOID
+csgWorkPoolJoinThread (
+    __in PCSG_WORK_THREAD Thread
+    )
+{
+    KeWaitForSingleObject( Thread->Thread, Executive, KernelMode, FALSE, NULL );
+
+    ObDereferenceObject( Thread->Thread );
+}
+
+#endif
+
+/*************************************************************************
+    Queue
+*************************************************************************/
+
+static BOOLEAN
+csgWorkQueuePush (
+    __inout PCSG_WORK_NODE Node,
+    __in PCSG_WORK_ITEM Item
+    )
+{
+    PCSG_WORK_CELL cell;
+    ULONG position = Node->Tail;
+    LONG difference;
+
+    for (;;) {
+
+        cell = &Node->Cells[position & Node->Mask];
+        difference = (LONG)(csgLoadAcquire32( &cell->Sequence ) - position);
+
+        if (difference == 0) {
+
+            ULONG seen = (ULONG)csgInterlockedCompareExchange( &Node->Tail, position + 1, position );
+
+            if (seen == position) {
+
+                break;
+            }
+
+            position = seen;
+
+        } else if (difference < 0) {
+
+            //
+            //  The cell still holds the item from a lap ago: full.
+            //
+
+            return FALSE;
+
+        } else {
+
+            position = Node->Tail;
+        }
+    }
+
+    cell->Item = Item;
+
+    csgStoreRelease32( &cell->Sequence, position + 1 );
+
+    return TRUE;
+}
+
+
+static PCSG_WORK_ITEM
+csgWorkQueuePop (
+    __inout PCSG_WORK_NODE Node
+    )
+{
+    PCSG_WORK_CELL cell;
+    PCSG_WORK_ITEM item;
+    ULONG position = Node->Head;
+    LONG difference;
+
+    for (;;) {
+
+        cell = &Node->Cells[position & Node->Mask];
+        difference = (LONG)(csgLoadAcquire32( &cell->Sequence ) - (position + 1));
+
+        if (difference == 0) {
+
+            ULONG seen = (ULONG)csgInterlockedCompareExchange( &Node->Head, position + 1, position );
+
+            if (seen == position) {
+
+                break;
+            }
+
+            position = seen;
+
+        } else if (difference < 0) {
+
+            //
+            //  Not filled yet: empty.
+            //
+
+            return NULL;
+
+        } else {
+
+            position = Node->Head;
+        }
+    }
+
+    item = cell->Item;
+
+    csgStoreRelease32( &cell->Sequence, position + Node->Mask + 1 );
+
+    return item;
+}
+
+
+CSG_INLINE BOOLEAN
+csgWorkPoolTakeSleeper (
+    __inout PCSG_WORK_NODE Node
+    )
+{
+    LONG sleepers;
+
+    for (;;) {
+
+        sleepers = Node->Sleepers;
+
+        if (sleepers <= 0) {
+
+            return FALSE;
+        }
+
+        if (csgInterlockedCompareExchange( &Node->Sleepers, sleepers - 1, sleepers ) == sleepers) {
+
+            return TRUE;
+        }
+    }
+}
+
+static PCSG_WORK_ITEM
+csgWorkPoolSteal (
+    __in PCSG_WORK_NODE Node,
+    __out PCSG_WORK_NODE *Owner
+    )
+/*++
+
+Routine Description:
+
+    Takes an item from another node's queue, if any has one.
+
+--*/
+{
+    PCSG_WORKPOOL pool = Node->Pool;
+    PCSG_WORK_NODE victim;
+    PCSG_WORK_ITEM item;
+    ULONG i;
+
+    for (i = 1; i < pool->NodeCount; i++) {
+
+        victim = &pool->Nodes[(Node->Number + i) % pool->NodeCount];
+
+        item = csgWorkQueuePop( victim );
+
+        if (item != NULL) {
+
+            *Owner = victim;
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+/*************************************************************************
+    Workers
+*************************************************************************/
+
+static VOID
+csgWorkPoolWorker (
+    __in PCSG_WORK_NODE Node
+    )
+/*++
+
+Routine Description:
+
+    A worker's loop: runs what its node's queue holds, and what it can
+    steal from the others when that is empty, until the pool stops and
+    the queue is empty.
+
+--*/
+{
+    PCSG_WORKPOOL pool = Node->Pool;
+    PCSG_WORK_NODE owner;
+    PCSG_WORK_ITEM item;
+    ULONG spin;
+
+    for (;;) {
+
+        owner = Node;
+
+        item = csgWorkQueuePop( Node );
+
+        for (spin = 0; (item == NULL) && (spin < CSG_WORKPOOL_SPIN); spin++) {
+
+            csgWorkPause();
+
+            item = csgWorkQueuePop( Node );
+        }
+
+        if (item == NULL) {
+
+            item = csgWorkPoolSteal( Node, &owner );
+
+            if (item != NULL) {
+
+                csgInterlockedIncrement64( &Node->Stolen );
+            }
+        }
+
+        if (item == NULL) {
+
+            if (pool->Stopping) {
+
+                break;
+            }
+
+            //
+            //  The interlocked increment is a full fence before the second
+            //  look.
+            //
+
+            csgInterlockedIncrement( &Node->Sleepers );
+
+            item = csgWorkQueuePop( Node );
+
+            if ((item == NULL) && !pool->Stopping) {
+
+                csgWorkSemaphoreWait( &Node->Wake );
+                csgInterlockedIncrement64( &Node->Wakeups );
+                continue;
+            }
+
+            if (!csgWorkPoolTakeSleeper( Node )) {
+
+                csgWorkSemaphoreWait( &Node->Wake );
+            }
+
+            if (item == NULL) {
+
+                continue;
+            }
+        }
+
+        //
+        //  The item belongs to its routine from here on.
+        //
+
+        item->Routine( item->Context );
+
+        csgInterlockedIncrement64( &owner->Executed );
+    }
+}
+
+/*************************************************************************
+    Interface
+*************************************************************************/
+
+NTSTATUS
+csgWorkPoolCreate (
+    __in ULONG WorkersPerNode,
+    __in ULONG QueueDepth,
+    __out PCSG_WORKPOOL *Pool
+    )
+/*++
+
+Routine Description:
+
+    Creates a worker pool and starts its threads.
+
+Arguments:
+
+    WorkersPerNode - Workers for each node, at most 64; a node with fewer
+        processors gets one for each of them.
+
+    QueueDepth - Items each node's queue holds, rounded up to a power of
+        two, at most 65536.
+
+    Pool - Receives the pool.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER
+    STATUS_INSUFFICIENT_RESOURCES
+    Or whatever starting a thread failed with.
+
+--*/
+{
+    PCSG_WORKPOOL pool;
+    PCSG_WORK_NODE node;
+    ULONG nodeCount = csgWorkPoolNodeCount();
+    ULONG depth = 2;
+    SIZE_T size;
+    PVOID allocation;
+    PUCHAR next;
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
+    ULONG j;
+
+    *Pool = NULL;
+
+    if ((WorkersPerNode == 0) || (WorkersPerNode > CSG_WORKPOOL_MAX_WORKERS) ||
+        (QueueDepth == 0) || (QueueDepth > CSG_WORKPOOL_MAX_DEPTH)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while (depth < QueueDepth) {
+
+        depth *= 2;
+    }
+
+    if (nodeCount > CSG_WORKPOOL_MAX_NODES) {
+
+        nodeCount = CSG_WORKPOOL_MAX_NODES;
+    }
+
+    size = CSG_WORKPOOL_CACHE_LINE +
+           sizeof(CSG_WORKPOOL) +
+           CSG_WORKPOOL_CACHE_LINE +
+           nodeCount * sizeof(CSG_WORK_NODE) +
+           (SIZE_T)nodeCount * depth * sizeof(CSG_WORK_CELL) +
+           (SIZE_T)nodeCount * WorkersPerNode * sizeof(CSG_WORK_THREAD);
+
+#ifdef CSG_USER_MODE
+    size += csgCpuCount();
+#endif
+
+    allocation = csgAllocateNonPaged( size, CSG_WORKPOOL_TAG );
+
+    if (allocation == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( allocation, size );
+
+    pool = (PCSG_WORKPOOL)(((ULONG_PTR)allocation + CSG_WORKPOOL_CACHE_LINE - 1) &
+                           ~(ULONG_PTR)(CSG_WORKPOOL_CACHE_LINE - 1));
+
+    pool->Allocation = allocation;
+    pool->NodeCount = nodeCount;
+    pool->Nodes = (PCSG_WORK_NODE)(((ULONG_PTR)(pool + 1) + CSG_WORKPOOL_CACHE_LINE - 1) &
+                                   ~(ULONG_PTR)(CSG_WORKPOOL_CACHE_LINE - 1));
+
+    next = (PUCHAR)(pool->Nodes + nodeCount);
+
+#ifdef CSG_USER_MODE
+    pool->CpuCount = csgCpuCount();
+    pool->CpuNode = (PUCHAR)allocation + size - pool->CpuCount;
+#endif
+
+    for (i = 0; i < nodeCount; i++) {
+
+        ULONG processors;
+
+        node = &pool->Nodes[i];
+
+        node->Pool = pool;
+        node->Number = i;
+        node->Mask = depth - 1;
+
+        node->Cells = (PCSG_WORK_CELL)next;
+        next += depth * sizeof(CSG_WORK_CELL);
+
+        for (j = 0; j < depth; j++) {
+
+            node->Cells[j].Sequence = j;
+        }
+
+        node->Workers = (PCSG_WORK_THREAD)next;
+        next += WorkersPerNode * sizeof(CSG_WORK_THREAD);
+
+#ifdef CSG_USER_MODE
+        processors = csgWorkPoolNodeAffinity( i, &node->Affinity, pool->CpuNode, pool->CpuCount );
+#else
+        processors = csgWorkPoolNodeAffinity( i, &node->Affinity );
+#endif
+
+        //
+        //  A node with memory and no processors gets no workers; nothing
+        //  runs there to submit to it.
+        //
+
+        node->WorkerCount = (processors < WorkersPerNode) ? processors : WorkersPerNode;
+
+        csgWorkSemaphoreInit( &node->Wake );
+    }
+
+    for (i = 0; (i < nodeCount) && NT_SUCCESS( status ); i++) {
+
+        node = &pool->Nodes[i];
+
+        for (j = 0; j < node->WorkerCount; j++) {
+
+            node->Workers[j].Node = node;
+
+            status = csgWorkPoolStartThread( &node->Workers[j] );
+
+            if (!NT_SUCCESS( status )) {
+
+                break;
+            }
+        }
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        csgWorkPoolDestroy( pool );
+        return status;
+    }
+
+    *Pool = pool;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgWorkPoolDestroy (
+    __in PCSG_WORKPOOL Pool
+    )
+/*++
+
+Routine Description:
+
+    Stops the workers, once they have run everything that was submitted,
+    and frees the pool.  Nothing may be submitted once this is called.
+
+--*/
+{
+    PCSG_WORK_NODE node;
+    ULONG i;
+    ULONG j;
+
+    Pool->Stopping = TRUE;
+
+    csgMemoryBarrier();
+
+    //
+    //  One wake up for each worker is enough: a worker waits at most once
+    //  after it could have seen Stopping.
+    //
+
+    for (i = 0; i < Pool->NodeCount; i++) {
+
+        node = &Pool->Nodes[i];
+
+        if (node->WorkerCount != 0) {
+
+            csgWorkSemaphoreRelease( &node->Wake, node->WorkerCount );
+        }
+    }
+
+    for (i = 0; i < Pool->NodeCount; i++) {
+
+        node = &Pool->Nodes[i];
+
+        for (j = 0; j < node->WorkerCount; j++) {
+
+            if (node->Workers[j].Started) {
+
+                csgWorkPoolJoinThread( &node->Workers[j] );
+            }
+        }
+
+        csgWorkSemaphoreDelete( &node->Wake );
+    }
+
+    csgFreeNonPaged( Pool->Allocation, CSG_WORKPOOL_TAG );
+}
+
+
+BOOLEAN
+csgWorkPoolSubmit (
+    __in PCSG_WORKPOOL Pool,
+    __inout PCSG_WORK_ITEM Item
+    )
+/*++
+
+Routine Description:
+
+    Queues an item to the workers of the caller's node.
+
+Arguments:
+
+    Pool - The pool.
+
+    Item - Routine and context to run.  It must stay in place until the
+        routine is called.
+
+Return Value:
+
+    TRUE if the item was queued.  FALSE if the node's queue was full, in
+    which case the caller does the work itself.
+
+--*/
+{
+    PCSG_WORK_NODE node = &Pool->Nodes[csgWorkPoolCurrentNode( Pool )];
+
+    if ((node->WorkerCount == 0) || !csgWorkQueuePush( node, Item )) {
+
+        csgInterlockedIncrement64( &node->Rejected );
+
+        return FALSE;
+    }
+
+    csgMemoryBarrier();
+
+    if ((node->Sleepers > 0) && csgWorkPoolTakeSleeper( node )) {
+
+        csgWorkSemaphoreRelease( &node->Wake, 1 );
+    }
+
+    return TRUE;
+}
+
+
+ULONG
+csgWorkPoolConcurrency (
+    __in PCSG_WORKPOOL Pool
+    )
+/*++
+
+Routine Description:
+
+    Returns how many could run a job submitted from the caller's node at
+    once: the node's workers and the caller.
+
+--*/
+{
+    return Pool->Nodes[csgWorkPoolCurrentNode( Pool )].WorkerCount + 1;
+}
+
+
+static BOOLEAN
+csgWorkJobRunChunks (
+    __inout PCSG_WORK_JOB Job
+    )
+/*++
+
+Routine Description:
+
+    Runs chunks of a job until none are left to take.
+
+Return Value:
+
+    TRUE if the caller finished the job's last chunk.
+
+--*/
+{
+    LONG chunk;
+    BOOLEAN finished = FALSE;
+
+    for (;;) {
+
+        chunk = csgInterlockedIncrement( &Job->NextChunk ) - 1;
+
+        if ((ULONG)chunk >= Job->ChunkCount) {
+
+            break;
+        }
+
+        Job->ChunkRoutine( Job->Context, (ULONG)chunk );
+
+        if (csgInterlockedDecrement( &Job->ChunksLeft ) == 0) {
+
+            finished = TRUE;
+        }
+    }
+
+    return finished;
+}
+
+
+static VOID
+csgWorkJobHelp (
+    __in PVOID Context
+    )
+{
+    PCSG_WORK_JOB job = Context;
+
+    if (csgWorkJobRunChunks( job )) {
+
+        job->CompleteRoutine( job->Context );
+    }
+
+    csgWorkJobRelease( job );
+}
+
+
+BOOLEAN
+csgWorkPoolRunJob (
+    __in PCSG_WORKPOOL Pool,
+    __inout PCSG_WORK_JOB Job
+    )
+/*++
+
+Routine Description:
+
+    Runs a job's chunks on the caller and on as many of its node's workers
+    as there are chunks for, one fewer than the chunks at most.  Returns
+    once no chunk is left to take, which may be before the workers have
+    finished the ones they took.
+
+    Either way the caller calls csgWorkJobRelease once it is done with
+    the job.
+
+Arguments:
+
+    Pool - The pool.
+
+    Job - The job, with its routines, Context and ChunkCount filled in.
+
+Return Value:
+
+    TRUE if every chunk was finished when this returns, in which case the
+    caller completes the job itself and CompleteRoutine is not called.
+    FALSE if a worker is still running a chunk; the worker that finishes
+    the last calls CompleteRoutine.
+
+--*/
+{
+    PCSG_WORK_NODE node = &Pool->Nodes[csgWorkPoolCurrentNode( Pool )];
+    ULONG helpers = node->WorkerCount;
+    ULONG queued;
+    ULONG wake = 0;
+
+    ASSERT( Job->ChunkCount != 0 );
+
+    if (helpers > Job->ChunkCount - 1) {
+
+        helpers = Job->ChunkCount - 1;
+    }
+
+    Job->NextChunk = 0;
+    Job->ChunksLeft = (LONG)Job->ChunkCount;
+    Job->References = 1;
+
+    csgWorkItemInitialize( &Job->Helper, csgWorkJobHelp, Job );
+
+    //
+    //  The same item goes on the queue once for each helper; nothing
+    //  writes to an item on its way through the queue.
+    //
+
+    for (queued = 0; queued < helpers; queued++) {
+
+        csgInterlockedIncrement( &Job->References );
+
+        if (!csgWorkQueuePush( node, &Job->Helper )) {
+
+            csgInterlockedDecrement( &Job->References );
+            csgInterlockedIncrement64( &node->Rejected );
+            break;
+        }
+    }
+
+    if (queued != 0) {
+
+        csgMemoryBarrier();
+
+        while ((wake < queued) && (node->Sleepers > 0) && csgWorkPoolTakeSleeper( node )) {
+
+            wake++;
+        }
+
+        if (wake != 0) {
+
+            csgWorkSemaphoreRelease( &node->Wake, wake );
+        }
+    }
+
+    return csgWorkJobRunChunks( Job );
+}
+
+
+VOID
+csgWorkJobRelease (
+    __inout PCSG_WORK_JOB Job
+    )
+/*++
+
+Routine Description:
+
+    Lets go of a job, calling its release routine if nobody else still
+    holds it.
+
+--*/
+{
+    if ((csgInterlockedDecrement( &Job->References ) == 0) &&
+        (Job->ReleaseRoutine != NULL)) {
+
+        Job->ReleaseRoutine( Job->Context );
+    }
+}
+
+
+VOID
+csgWorkPoolQueryStats (
+    __in PCSG_WORKPOOL Pool,
+    __out PCSG_WORKPOOL_STATS Stats
+    )
+/*++
+
+Routine Description:
+
+    Adds up the nodes' counters.  Items still queued count as submitted.
+
+--*/
+{
+    PCSG_WORK_NODE node;
+    ULONG head;
+    ULONG i;
+
+    RtlZeroMemory( Stats, sizeof(CSG_WORKPOOL_STATS) );
+
+    Stats->Nodes = Pool->NodeCount;
+
+    for (i = 0; i < Pool->NodeCount; i++) {
+
+        node = &Pool->Nodes[i];
+
+        //
+        //  The head first: the tail read after it is never behind it.
+        //
+
+        head = node->Head;
+
+        csgLoadFence();
+
+        Stats->Rejected += node->Rejected;
+        Stats->Executed += node->Executed;
+        Stats->Wakeups += node->Wakeups;
+        Stats->Stolen += node->Stolen;
+        Stats->Submitted += node->Executed + (ULONG)(node->Tail - head);
+        Stats->Workers += node->WorkerCount;
+    }
+}
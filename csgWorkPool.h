@@ -0,0 +1,186 @@
+#ifndef __CSG_WORKPOOL_H__
+#define __CSG_WORKPOOL_H__
+
+#include "csgPort.h"
+
+/*************************************************************************
+    Crypto worker pool
+*************************************************************************/
+
+//
+//  Threads that take enciphering off the threads that issue the I/O.  A
+//  large write transformed inline holds its issuer, often at APC_LEVEL,
+//  for as long as the cipher takes; the swap paths instead hand such
+//  work to the pool and pend the operation.
+//
+//  The pool has a set of workers for each NUMA node, bound to the node's
+//  processors, and a bounded queue for each node that work is submitted
+//  to from that node, so the data stays in the node's caches and memory.
+//  The queues take no lock.  Submitting to a full queue fails rather
+//  than wait; the caller does the work itself, which is what bounds the
+//  pool.
+//
+//  Idle workers spin on their queue for a moment before they sleep, and a
+//  submission wakes a sleeping worker only when there is one, so a busy
+//  pool costs its submitters no more than an interlocked operation.
+//
+//  A worker that finds its own node's queue empty looks at the other
+//  nodes' queues before it sleeps and takes what it finds there, so work
+//  piled up on one node does not wait while another node's workers idle.
+//
+//  A job splits one piece of work, such as deciphering a large read,
+//  into chunks that its submitter and the workers of its node run at the
+//  same time.  Nobody is handed a chunk: each participant takes the next
+//  one not yet taken until none are left, so a participant that starts
+//  late or runs slowly simply takes fewer, and the submitter takes all
+//  of them if no worker gets to the job in time.
+//
+//  Create and destroy at PASSIVE_LEVEL; submit and run jobs at
+//  DISPATCH_LEVEL or below.  Work items run at PASSIVE_LEVEL in a system
+//  thread.
+//
+
+typedef VOID
+(*PCSG_WORK_ROUTINE) (
+    __in PVOID Context
+    );
+
+//
+//  Lives in the caller's structure until its routine runs.
+//
+
+typedef struct _CSG_WORK_ITEM {
+
+    PCSG_WORK_ROUTINE Routine;
+
+    PVOID Context;
+
+} CSG_WORK_ITEM, *PCSG_WORK_ITEM;
+
+typedef VOID
+(*PCSG_CHUNK_ROUTINE) (
+    __in PVOID Context,
+    __in ULONG Chunk
+    );
+
+//
+//  Lives in the caller's structure until its release routine runs.  The
+//  caller fills in the routines, Context and ChunkCount; the rest belongs
+//  to the pool.
+//
+
+typedef struct _CSG_WORK_JOB {
+
+    //
+    //  Runs each chunk, from 0 to ChunkCount - 1, once.
+    //
+
+    PCSG_CHUNK_ROUTINE ChunkRoutine;
+
+    //
+    //  Runs on the worker that finishes the last chunk, when that is not
+    //  the submitter.
+    //
+
+    PCSG_WORK_ROUTINE CompleteRoutine;
+
+    //
+    //  Runs once neither the submitter nor any worker will look at the
+    //  job again; may be NULL.
+    //
+
+    PCSG_WORK_ROUTINE ReleaseRoutine;
+
+    PVOID Context;
+
+    ULONG ChunkCount;
+
+    volatile LONG NextChunk;
+
+    volatile LONG ChunksLeft;
+
+    volatile LONG References;
+
+    //
+    //  Queued once for each worker asked to help.
+    //
+
+    CSG_WORK_ITEM Helper;
+
+} CSG_WORK_JOB, *PCSG_WORK_JOB;
+
+typedef struct _CSG_WORKPOOL_STATS {
+
+    ULONGLONG Submitted;
+
+    //
+    //  Submissions refused because their node's queue was full.
+    //
+
+    ULONGLONG Rejected;
+
+    ULONGLONG Executed;
+
+    //
+    //  Times a worker was woken from its sleep.
+    //
+
+    ULONGLONG Wakeups;
+
+    //
+    //  Items a worker took from another node's queue.
+    //
+
+    ULONGLONG Stolen;
+
+    ULONG Nodes;
+
+    ULONG Workers;
+
+} CSG_WORKPOOL_STATS, *PCSG_WORKPOOL_STATS;
+
+typedef struct _CSG_WORKPOOL CSG_WORKPOOL, *PCSG_WORKPOOL;
+
+NTSTATUS
+csgWorkPoolCreate (
+    __in ULONG WorkersPerNode,
+    __in ULONG QueueDepth,
+    __out PCSG_WORKPOOL *Pool
+    );
+
+VOID
+csgWorkPoolDestroy (
+    __in PCSG_WORKPOOL Pool
+    );
+
+BOOLEAN
+csgWorkPoolSubmit (
+    __in PCSG_WORKPOOL Pool,
+    __inout PCSG_WORK_ITEM Item
+    );
+
+ULONG
+csgWorkPoolConcurrency (
+    __in PCSG_WORKPOOL Pool
+    );
+
+BOOLEAN
+csgWorkPoolRunJob (
+    __in PCSG_WORKPOOL Pool,
+    __inout PCSG_WORK_JOB Job
+    );
+
+VOID
+csgWorkJobRelease (
+    __inout PCSG_WORK_JOB Job
+    );
+
+VOID
+csgWorkPoolQueryStats (
+    __in PCSG_WORKPOOL Pool,
+    __out PCSG_WORKPOOL_STATS Stats
+    );
+
+#define csgWorkItemInitialize(_i, _r, _c)   ((_i)->Routine = (_r), (_i)->Context = (_c))
+
+#endif // __CSG_WORKPOOL_H__
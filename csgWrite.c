@@ -1,8 +1,154 @@
 #include "csgWrite.h"
 #include "csgGlobal.h"
 #include "csgStruct.h"
+#include "csgStream.h"
+
+extern PCSG_BUFCACHE SwapBufferCache;
+
+static VOID
+csgWriteSetSwappedBuffer (
+    __inout PFLT_CALLBACK_DATA Data,
+    __in PPRE_2_POST_CONTEXT p2pCtx,
+    __in_opt PMDL NewMdl
+    )
+/*++
+
+Routine Description:
+
+    Points the write at the swap buffer, which now holds the data to go
+    to the file system, and counts it.
+
+Arguments:
+
+    Data - The write.
+
+    p2pCtx - Its pre2Post context, with the swap buffer, transform and
+        the header size to shift the write by.
+
+    NewMdl - The MDL describing the swap buffer, NULL for fast I/O.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+
+    CSG_TRACE6( WRITE_SWAP,
+                p2pCtx->VolCtx,
+                p2pCtx->SwappedBuffer,
+                NewMdl,
+                iopb->Parameters.Write.WriteBuffer,
+                p2pCtx->SwappedLength,
+                p2pCtx->Transform );
+
+    COUNT_STAT( WriteOperations, 1 );
+    COUNT_STAT( WriteBytes, p2pCtx->SwappedLength );
+
+    iopb->Parameters.Write.WriteBuffer = p2pCtx->SwappedBuffer;
+    iopb->Parameters.Write.MdlAddress = NewMdl;
+
+    //
+    //  A protected stream's data starts after its header.  The data
+    //  was enciphered at its offset within the data; only the file
+    //  system sees the shifted one.
+    //
+
+    iopb->Parameters.Write.ByteOffset.QuadPart += p2pCtx->HeaderSize;
+
+    FltSetCallbackDataDirty( Data );
+}
+
+
+static VOID
+csgWriteEncipherWorker (
+    __in PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Crypto worker routine for a write csgPreWriteBuffers pended: enciphers
+    the users data into the swap buffer and lets the write go on to the
+    file system, or fails it.  Everything the preOperation callback held
+    for the write is now ours to release.
+
+Arguments:
+
+    Context - The write's pre2Post context.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PPRE_2_POST_CONTEXT p2pCtx = Context;
+    PFLT_CALLBACK_DATA data = p2pCtx->Data;
+    PVOLUME_CONTEXT volCtx = p2pCtx->VolCtx;
+    ULONGLONG transformStart = csgReadTimestamp();
+    NTSTATUS status = STATUS_SUCCESS;
+
+    //
+    //  The users buffer is locked and mapped, but keep the same guard as
+    //  the inline path.
+    //
+
+    try {
+
+        p2pCtx->Transform->Encrypt( p2pCtx->TransformKey,
+                                    p2pCtx->DataUnit,
+                                    volCtx->SectorSize,
+                                    p2pCtx->OriginalBuffer,
+                                    p2pCtx->SwappedBuffer,
+                                    p2pCtx->SwappedLength );
+
+        RecordTransformCost( CSG_STAGE_WRITE_TRANSFORM,
+                             p2pCtx->Transform,
+                             p2pCtx->SwappedLength,
+                             transformStart );
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        status = GetExceptionCode();
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        csgWriteSetSwappedBuffer( data, p2pCtx, p2pCtx->SwappedMdl );
+    }
+
+    if (p2pCtx->StreamCtx != NULL) {
+
+        FltReleaseContext( p2pCtx->StreamCtx );
+        p2pCtx->StreamCtx = NULL;
+    }
+
+    ConfigReadUnlock( p2pCtx->ConfigCookie );
+
+    if (!NT_SUCCESS( status )) {
+
+        CSG_TRACE3( WRITE_BAD_BUFFER,
+                    volCtx,
+                    p2pCtx->OriginalBuffer,
+                    (ULONG)status );
+
+        csgSwapDescKeepMdl( p2pCtx->SwapDesc, p2pCtx->SwappedMdl );
+        csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
+        FltReleaseContext( volCtx );
+        FreePre2PostContext( p2pCtx );
+
+        data->IoStatus.Status = status;
+        data->IoStatus.Information = 0;
+
+        FltCompletePendedPreOperation( data, FLT_PREOP_COMPLETE, NULL );
+        return;
+    }
+
+    FltCompletePendedPreOperation( data, FLT_PREOP_SUCCESS_WITH_CALLBACK, p2pCtx );
+}
 
-extern NPAGED_LOOKASIDE_LIST Pre2PostContextList;
 
 FLT_PREOP_CALLBACK_STATUS
 csgPreWriteBuffers(
@@ -33,21 +179,53 @@ Return Value:
 
     FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
     FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
-    FLT_PREOP_COMPLETE -
+    FLT_PREOP_PENDING - a crypto worker enciphers the data and completes
+        the callback
+    FLT_PREOP_COMPLETE - the write was failed: it has no offset to key the
+        cipher on, the protected stream could not be extended for it or
+        is a CTR stream it would rewrite, its buffer could not be mapped
+        or read, or enciphering it failed; Data->IoStatus.Status has the
+        error
 --*/
 {
     PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PCSG_SWAP_DESC swapDesc = NULL;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
-    PPRE_2_POST_CONTEXT p2pCtx;
+    PSTREAM_CONTEXT streamCtx = NULL;
+    PPRE_2_POST_CONTEXT p2pCtx = NULL;
     PVOID origBuf;
     NTSTATUS status;
+    ULONGLONG startTime = csgReadTimestamp();
+    ULONGLONG stageStart;
+    ULONGLONG transformStart;
     ULONG writeLen = iopb->Parameters.Write.Length;
+    LARGE_INTEGER offset;
+    PCCSG_TRANSFORM transform = &csgCopyTransform;
+    CONST VOID *transformKey = NULL;
+    PCCSG_CONFIG config;
+    ULONG configCookie;
+    BOOLEAN offload = FALSE;
+
+    config = ConfigReadLock( &configCookie );
 
     try {
 
+        //
+        //  Record the operation for capture before anything decides to
+        //  leave it alone.
+        //
+
+        CSG_TRACE6( IO_WRITE,
+                    FltObjects->FileObject,
+                    iopb->Parameters.Write.ByteOffset.QuadPart,
+                    writeLen,
+                    iopb->IrpFlags,
+                    Data->Flags,
+                    PsGetCurrentThreadId() );
+
         //
         //  If they are trying to write ZERO bytes, then don't do anything and
         //  we don't need a post-operation callback.
@@ -58,6 +236,71 @@ Return Value:
             leave;
         }
 
+        //
+        //  When only some files are protected, those carry our stream
+        //  context and everything else passes through untouched.
+        //
+
+        if (config->ProtectedExtensionCount != 0) {
+
+            status = FltGetStreamContext( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &streamCtx );
+
+            if (!NT_SUCCESS( status )) {
+
+                streamCtx = NULL;
+                leave;
+            }
+
+            if (streamCtx->LoadStatus != STATUS_SUCCESS) {
+
+                leave;
+            }
+
+            //
+            //  A write that extends the data must move the file system's
+            //  end of file past the header as well.  Paging writes never
+            //  extend the file.
+            //
+
+            if (!FlagOn( iopb->IrpFlags, IRP_PAGING_IO )) {
+
+                offset = iopb->Parameters.Write.ByteOffset;
+
+                status = csgStreamExtend( FltObjects,
+                                          streamCtx,
+                                          &iopb->Parameters.Write.ByteOffset,
+                                          writeLen );
+
+                if (!NT_SUCCESS( status )) {
+
+                    Data->IoStatus.Status = status;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (iopb->Parameters.Write.ByteOffset.QuadPart != offset.QuadPart) {
+
+                    FltSetCallbackDataDirty( Data );
+                }
+            }
+        }
+
+        //
+        //  In noncached only mode cached and fast I/O is left alone; the
+        //  data gets swapped when the cache manager or memory manager
+        //  moves it to or from the disk.
+        //
+
+        if (config->NoncachedOnly &&
+            (!FLT_IS_IRP_OPERATION( Data ) ||
+             !FlagOn( iopb->IrpFlags, IRP_NOCACHE | IRP_PAGING_IO ))) {
+
+            leave;
+        }
+
         //
         //  Get our volume context so we can display our volume name in the
         //  debug output.
@@ -69,9 +312,8 @@ Return Value:
 
         if (!NT_SUCCESS(status)) {
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreWriteBuffers:            Error getting volume context, status=%x\n",
-                        status) );
+            CSG_TRACE1( WRITE_NO_VOLCTX,
+                        (ULONG)status );
 
             leave;
         }
@@ -86,28 +328,64 @@ Return Value:
         if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
 
             writeLen = (ULONG)ROUND_TO_SIZE(writeLen,volCtx->SectorSize);
+
+            //
+            //  Noncached data is what lands on disk, so this is where it
+            //  gets enciphered.  The cipher is keyed on the position, so
+            //  we must know where the write goes; refuse writes relative to
+            //  end of file rather than let plaintext through.
+            //
+
+            if ((streamCtx != NULL) || config->CipherEnabled) {
+
+                if (iopb->Parameters.Write.ByteOffset.QuadPart < 0) {
+
+                    CSG_TRACE1( WRITE_NO_OFFSET,
+                                volCtx );
+
+                    Data->IoStatus.Status = STATUS_INVALID_PARAMETER;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (streamCtx != NULL) {
+
+                    transform = streamCtx->Transform;
+                    transformKey = &streamCtx->Key;
+
+                } else {
+
+                    transform = config->CipherTransform;
+                    transformKey = config->CipherTransformKey;
+                }
+            }
         }
 
         //
-        //  Allocate nonPaged memory for the buffer we are swapping to.
-        //  If we fail to get the memory, just don't swap buffers on this
-        //  operation.
+        //  Get a nonPaged buffer to swap to from our cache.  If we fail to
+        //  get the memory, just don't swap buffers on this operation.
         //
 
-        newBuf = ExAllocatePoolWithTag( NonPagedPool,
-                                        writeLen,
-                                        BUFFER_SWAP_TAG );
+        stageStart = StageTimestamp();
+
+        swapDesc = csgBufCacheAllocate( SwapBufferCache, writeLen );
 
-        if (newBuf == NULL) {
+        RecordStageCost( CSG_STAGE_WRITE_ALLOCATE, stageStart );
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreWriteBuffers:            %wZ Failed to allocate %d bytes of memory.\n",
-                        &volCtx->Name,
-                        writeLen) );
+        if (swapDesc == NULL) {
+
+            CSG_TRACE2( WRITE_NO_BUFFER,
+                        volCtx,
+                        writeLen );
+
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        newBuf = swapDesc->Buffer;
+
         //
         //  We only need to build a MDL for IRP operations.  We don't need to
         //  do this for a FASTIO operation because it is a waste of time since
@@ -118,30 +396,52 @@ Return Value:
         if (FlagOn(Data->Flags,FLTFL_CALLBACK_DATA_IRP_OPERATION)) {
 
             //
-            //  Allocate a MDL for the new allocated memory.  If we fail
-            //  the MDL allocation then we won't swap buffer for this operation
+            //  The descriptor already describes the buffer; the MDL for
+            //  this I/O is a partial copy of that, which the
+            //  post-operation callback takes back for the descriptor's
+            //  next I/O.  If we fail the MDL allocation then we won't swap
+            //  buffer for this operation
             //
 
-            newMdl = IoAllocateMdl( newBuf,
-                                    writeLen,
-                                    FALSE,
-                                    FALSE,
-                                    NULL );
+            stageStart = StageTimestamp();
+
+            newMdl = csgSwapDescBuildMdl( swapDesc, writeLen );
+
+            RecordStageCost( CSG_STAGE_WRITE_MDL, stageStart );
 
             if (newMdl == NULL) {
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPreWriteBuffers:            %wZ Failed to allocate MDL.\n",
-                            &volCtx->Name) );
+                CSG_TRACE1( WRITE_NO_MDL,
+                            volCtx );
+
+                COUNT_STAT( AllocationFailures, 1 );
 
                 leave;
             }
+        }
 
-            //
-            //  setup the MDL for the non-paged pool we just allocated
-            //
+        //
+        //  Large enciphered writes go to the crypto workers, and the write
+        //  is pended meanwhile, rather than hold the thread that issued it
+        //  for as long as the cipher takes.  Only IRP operations can be
+        //  pended, and a worker needs the users buffer at a system
+        //  address, so lock it if nobody has; if that fails the data is
+        //  enciphered here.
+        //
+
+        if ((CryptoWorkPool != NULL) &&
+            (transform != &csgCopyTransform) &&
+            (config->OffloadThreshold != 0) &&
+            (writeLen >= config->OffloadThreshold) &&
+            FLT_IS_IRP_OPERATION( Data )) {
+
+            offload = TRUE;
 
-            MmBuildMdlForNonPagedPool( newMdl );
+            if ((iopb->Parameters.Write.MdlAddress == NULL) &&
+                !FlagOn( Data->Flags, FLTFL_CALLBACK_DATA_SYSTEM_BUFFER )) {
+
+                offload = NT_SUCCESS( FltLockUserBuffer( Data ) );
+            }
         }
 
         //
@@ -155,10 +455,9 @@ Return Value:
 
             if (origBuf == NULL) {
 
-                LOG_PRINT( LOGFL_ERRORS,
-                           ("csg!csgPreWriteBuffers:            %wZ Failed to get system address for MDL: %p\n",
-                            &volCtx->Name,
-                            iopb->Parameters.Write.MdlAddress) );
+                CSG_TRACE2( WRITE_NO_SYSADDR,
+                            volCtx,
+                            iopb->Parameters.Write.MdlAddress );
 
                 //
                 //  If we could not get a system address for the users buffer,
@@ -181,75 +480,123 @@ Return Value:
         }
 
         //
-        //  Copy the memory, we must do this inside the try/except because we
-        //  may be using a users buffer address
+        //  Get a pre2Post context structure.  We need it to pass the volume
+        //  context and the allocate memory buffer to the post operation
+        //  callback, and to a crypto worker.  Getting it before the data
+        //  is moved means a failure wastes no cipher work.
         //
 
-        try {
+        p2pCtx = AllocatePre2PostContext();
 
-            RtlCopyMemory( newBuf,
-                           origBuf,
-                           writeLen );
-
-        } except (EXCEPTION_EXECUTE_HANDLER) {
-
-            //
-            //  The copy failed, return an error, failing the operation.
-            //
+        if (p2pCtx == NULL) {
 
-            Data->IoStatus.Status = GetExceptionCode();
-            Data->IoStatus.Information = 0;
-            retValue = FLT_PREOP_COMPLETE;
+            CSG_TRACE1( WRITE_NO_CONTEXT,
+                        volCtx );
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreWriteBuffers:            %wZ Invalid user buffer, oldB=%p, status=%x\n",
-                        &volCtx->Name,
-                        origBuf,
-                        Data->IoStatus.Status) );
+            COUNT_STAT( AllocationFailures, 1 );
 
             leave;
         }
 
+        p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwapDesc = swapDesc;
+        p2pCtx->StreamCtx = NULL;
+        p2pCtx->SwappedLength = writeLen;
+        p2pCtx->VolCtx = volCtx;
+        p2pCtx->StartTime = startTime;
+        p2pCtx->Transform = transform;
+
         //
-        //  We are ready to swap buffers, get a pre2Post context structure.
-        //  We need it to pass the volume context and the allocate memory
-        //  buffer to the post operation callback.
+        //  Where the data goes, within the data and on the file system,
+        //  is settled here for both the inline and the offloaded path.
         //
 
-        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+        p2pCtx->DataUnit = (ULONGLONG)iopb->Parameters.Write.ByteOffset.QuadPart / volCtx->SectorSize;
+        p2pCtx->HeaderSize = 0;
 
-        if (p2pCtx == NULL) {
+        if ((streamCtx != NULL) && FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
+
+            p2pCtx->HeaderSize = streamCtx->Header.HeaderSize;
+        }
 
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("csg!csgPreWriteBuffers:            %wZ Failed to allocate pre2Post context structure\n",
-                        &volCtx->Name) );
+        if (offload) {
 
-            leave;
+            //
+            //  The worker takes over the buffer, MDL, contexts and the
+            //  configuration read section, so the key stays good until
+            //  the data is enciphered.  Once it is submitted the write may
+            //  complete at any moment; touch nothing of it.
+            //
+
+            p2pCtx->TransformKey = transformKey;
+            p2pCtx->StreamCtx = streamCtx;
+            p2pCtx->ConfigCookie = configCookie;
+            p2pCtx->Data = Data;
+            p2pCtx->OriginalBuffer = origBuf;
+            p2pCtx->SwappedMdl = newMdl;
+
+            csgWorkItemInitialize( &p2pCtx->WorkItem, csgWriteEncipherWorker, p2pCtx );
+
+            if (csgWorkPoolSubmit( CryptoWorkPool, &p2pCtx->WorkItem )) {
+
+                COUNT_STAT( OffloadedWrites, 1 );
+
+                retValue = FLT_PREOP_PENDING;
+                leave;
+            }
+
+            //
+            //  The queue is full; the workers are busy enough.
+            //
+
+            COUNT_STAT( OffloadQueueFull, 1 );
+
+            p2pCtx->StreamCtx = NULL;
         }
 
         //
-        //  Set new buffers
+        //  Move the data into the swapped buffer, enciphering it on the way
+        //  if it is going to disk.  This is the only pass over the users
+        //  buffer.  We must do this inside the try/except because we may be
+        //  using a users buffer address.
         //
 
-        LOG_PRINT( LOGFL_WRITE,
-                   ("csg!csgPreWriteBuffers:            %wZ newB=%p newMdl=%p oldB=%p oldMdl=%p len=%d\n",
-                    &volCtx->Name,
-                    newBuf,
-                    newMdl,
-                    iopb->Parameters.Write.WriteBuffer,
-                    iopb->Parameters.Write.MdlAddress,
-                    writeLen) );
+        transformStart = csgReadTimestamp();
+
+        try {
+
+            transform->Encrypt( transformKey,
+                                p2pCtx->DataUnit,
+                                volCtx->SectorSize,
+                                origBuf,
+                                newBuf,
+                                writeLen );
+
+            RecordTransformCost( CSG_STAGE_WRITE_TRANSFORM, transform, writeLen, transformStart );
+
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+
+            //
+            //  The copy failed, return an error, failing the operation.
+            //
+
+            Data->IoStatus.Status = GetExceptionCode();
+            Data->IoStatus.Information = 0;
+            retValue = FLT_PREOP_COMPLETE;
+
+            CSG_TRACE3( WRITE_BAD_BUFFER,
+                        volCtx,
+                        origBuf,
+                        (ULONG)Data->IoStatus.Status );
 
-        iopb->Parameters.Write.WriteBuffer = newBuf;
-        iopb->Parameters.Write.MdlAddress = newMdl;
-        FltSetCallbackDataDirty( Data );
+            leave;
+        }
 
         //
-        //  Pass state to our post-operation callback.
+        //  Set new buffers, and pass state to our post-operation callback.
         //
 
-        p2pCtx->SwappedBuffer = newBuf;
-        p2pCtx->VolCtx = volCtx;
+        csgWriteSetSwappedBuffer( Data, p2pCtx, newMdl );
 
         *CompletionContext = p2pCtx;
 
@@ -261,21 +608,29 @@ Return Value:
 
     } finally {
 
+        //
+        //  A pended write, with all it holds, is the crypto worker's now.
         //
         //  If we don't want a post-operation callback, then free the buffer
         //  or MDL if it was allocated.
         //
 
-        if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
+        if ((retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) &&
+            (retValue != FLT_PREOP_PENDING)) {
 
-            if (newBuf != NULL) {
+            if (p2pCtx != NULL) {
 
-                ExFreePool( newBuf );
+                FreePre2PostContext( p2pCtx );
             }
 
             if (newMdl != NULL) {
 
-                IoFreeMdl( newMdl );
+                csgSwapDescKeepMdl( swapDesc, newMdl );
+            }
+
+            if (swapDesc != NULL) {
+
+                csgBufCacheFree( SwapBufferCache, swapDesc, writeLen );
             }
 
             if (volCtx != NULL) {
@@ -283,6 +638,21 @@ Return Value:
                 FltReleaseContext( volCtx );
             }
         }
+
+        //
+        //  Otherwise the data is already enciphered, so neither the stream
+        //  context nor the configuration is needed past this point.
+        //
+
+        if (retValue != FLT_PREOP_PENDING) {
+
+            if (streamCtx != NULL) {
+
+                FltReleaseContext( streamCtx );
+            }
+
+            ConfigReadUnlock( configCookie );
+        }
     }
 
     return retValue;
@@ -313,21 +683,29 @@ Return Value:
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( Flags );
 
-    LOG_PRINT( LOGFL_WRITE,
-               ("csg!csgPostWriteBuffers:           %wZ newB=%p info=%d Freeing\n",
-                &p2pCtx->VolCtx->Name,
+    KeepSwappedMdl( Data, p2pCtx );
+
+    //
+    //  The file system moved the file pointer past the shifted offset.
+    //
+
+    csgStreamSetFilePosition( Data, p2pCtx );
+
+    CSG_TRACE3( WRITE_FREE,
+                p2pCtx->VolCtx,
                 p2pCtx->SwappedBuffer,
-                Data->IoStatus.Information) );
+                Data->IoStatus.Information );
 
     //
-    //  Free allocate POOL and volume context
+    //  Free the swap buffer and volume context
     //
 
-    ExFreePool( p2pCtx->SwappedBuffer );
+    RecordPre2PostLatency( p2pCtx, CSG_LATENCY_WRITE );
+
+    csgBufCacheFree( SwapBufferCache, p2pCtx->SwapDesc, p2pCtx->SwappedLength );
     FltReleaseContext( p2pCtx->VolCtx );
 
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    FreePre2PostContext( p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
\ No newline at end of file
@@ -0,0 +1,555 @@
+/*++
+
+Module Name:
+
+    csgXts.c
+
+Abstract:
+
+    AES-XTS (IEEE 1619) encryption of whole data units.  A data unit is one
+    volume sector and its tweak is the sector number, so every sector is
+    enciphered independently and can be read or written on its own.
+
+    Two implementations are provided.  The AES-NI one keeps eight blocks in
+    flight so the AESENC latency is hidden behind independent work, and
+    derives the per-block tweaks with SSE2 shifts.  The portable one hands
+    four blocks at a time to the constant-time cipher in csgAes.c and is
+    used on processors without AES instructions and on non-x64 builds.
+    csgProvider.c decides which one a volume uses; nothing here looks at
+    the processor.
+
+    Ciphertext stealing is not implemented; data units are always a
+    multiple of the AES block size.
+
+Environment:
+
+    Kernel mode, or user mode when built with CSG_USER_MODE.
+
+--*/
+
+#include "csgXts.h"
+
+//
+//  Number of blocks the AES-NI path keeps in flight.
+//
+
+#define CSG_XTS_LANES   8
+
+//
+//  Number of blocks the portable path gives the bitsliced cipher at once.
+//
+
+#define CSG_XTS_CT_BLOCKS   4
+
+/*************************************************************************
+    Portable implementation
+*************************************************************************/
+
+//
+//  Multiply the tweak by the primitive element alpha of GF(2^128), using
+//  the little-endian convention of IEEE 1619.
+//
+
+CSG_INLINE VOID
+csgXtsMulAlpha (
+    UCHAR T[CSG_AES_BLOCK_SIZE]
+    )
+{
+    UCHAR carry = T[15] >> 7;
+    ULONG i;
+
+    for (i = 15; i > 0; i--) {
+
+        T[i] = (UCHAR)((T[i] << 1) | (T[i - 1] >> 7));
+    }
+
+    T[0] = (UCHAR)((T[0] << 1) ^ (0x87 & (0 - carry)));
+}
+
+CSG_INLINE VOID
+csgXtsInitialTweak (
+    PCCSG_XTS_KEY Key,
+    ULONGLONG DataUnit,
+    UCHAR T[CSG_AES_BLOCK_SIZE]
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 8; i++) {
+
+        T[i] = (UCHAR)(DataUnit >> (8 * i));
+        T[i + 8] = 0;
+    }
+
+    csgAesEncryptBlock( &Key->TweakKey, T, T );
+}
+
+static VOID
+csgXtsCryptGeneric (
+    PCCSG_XTS_KEY Key,
+    BOOLEAN Encrypt,
+    ULONGLONG DataUnit,
+    ULONG DataUnitSize,
+    CONST UCHAR *In,
+    UCHAR *Out,
+    SIZE_T Length
+    )
+{
+    UCHAR t[CSG_XTS_CT_BLOCKS * CSG_AES_BLOCK_SIZE];
+    UCHAR x[CSG_XTS_CT_BLOCKS * CSG_AES_BLOCK_SIZE];
+    SIZE_T done;
+    ULONG off;
+    ULONG n;
+    ULONG i;
+
+    for (done = 0; done < Length; done += DataUnitSize, DataUnit++) {
+
+        csgXtsInitialTweak( Key, DataUnit, t );
+
+        for (off = 0; off < DataUnitSize; off += n) {
+
+            //
+            //  Lay out the tweaks of the next few blocks so the bitsliced
+            //  cipher can take them in one pass.
+            //
+
+            n = DataUnitSize - off;
+
+            if (n > sizeof(x)) {
+
+                n = sizeof(x);
+            }
+
+            for (i = CSG_AES_BLOCK_SIZE; i < n; i += CSG_AES_BLOCK_SIZE) {
+
+                RtlCopyMemory( t + i, t + i - CSG_AES_BLOCK_SIZE, CSG_AES_BLOCK_SIZE );
+                csgXtsMulAlpha( t + i );
+            }
+
+            for (i = 0; i < n; i++) {
+
+                x[i] = In[done + off + i] ^ t[i];
+            }
+
+            if (Encrypt) {
+
+                csgAesEncryptBlocks( &Key->DataKey, x, x, n / CSG_AES_BLOCK_SIZE );
+
+            } else {
+
+                csgAesDecryptBlocks( &Key->DataKey, x, x, n / CSG_AES_BLOCK_SIZE );
+            }
+
+            for (i = 0; i < n; i++) {
+
+                Out[done + off + i] = x[i] ^ t[i];
+            }
+
+            RtlCopyMemory( t, t + n - CSG_AES_BLOCK_SIZE, CSG_AES_BLOCK_SIZE );
+            csgXtsMulAlpha( t );
+        }
+    }
+
+    csgSecureZeroMemory( t, sizeof(t) );
+    csgSecureZeroMemory( x, sizeof(x) );
+}
+
+/*************************************************************************
+    AES-NI implementation
+*************************************************************************/
+
+#ifdef CSG_ARCH_AMD64
+
+//
+//  Tweak doubling on an XMM register.  Each dword is shifted left by one
+//  and the bit shifted out of it is carried into the next dword; the bit
+//  shifted out of the top dword folds back in as the reduction 0x87.
+//
+
+CSG_INLINE CSG_TARGET("sse2") __m128i
+csgXtsMulAlphaSse (
+    __m128i T
+    )
+{
+    __m128i carry;
+
+    carry = _mm_srai_epi32( T, 31 );
+    carry = _mm_shuffle_epi32( carry, 0x93 );
+    carry = _mm_and_si128( carry, _mm_set_epi32( 1, 1, 1, 0x87 ) );
+
+    return _mm_xor_si128( _mm_slli_epi32( T, 1 ), carry );
+}
+
+CSG_INLINE CSG_TARGET("aes") __m128i
+csgXtsEncryptBlockAesNi (
+    __m128i B,
+    CONST __m128i *Rk
+    )
+{
+    ULONG r;
+
+    B = _mm_xor_si128( B, Rk[0] );
+
+    for (r = 1; r < CSG_AES_MAX_ROUNDS; r++) {
+
+        B = _mm_aesenc_si128( B, Rk[r] );
+    }
+
+    return _mm_aesenclast_si128( B, Rk[CSG_AES_MAX_ROUNDS] );
+}
+
+CSG_INLINE CSG_TARGET("aes") __m128i
+csgXtsDecryptBlockAesNi (
+    __m128i B,
+    CONST __m128i *Rk
+    )
+{
+    ULONG r;
+
+    B = _mm_xor_si128( B, Rk[0] );
+
+    for (r = 1; r < CSG_AES_MAX_ROUNDS; r++) {
+
+        B = _mm_aesdec_si128( B, Rk[r] );
+    }
+
+    return _mm_aesdeclast_si128( B, Rk[CSG_AES_MAX_ROUNDS] );
+}
+
+//
+//  Helpers for the eight lane loop.  _l is the lane number.
+//
+
+#define CSG_XTS_FOR_LANES(_m)   _m(0) _m(1) _m(2) _m(3) _m(4) _m(5) _m(6) _m(7)
+
+#define CSG_XTS_NEXT_TWEAK(_l)  t##_l = t; t = csgXtsMulAlphaSse( t );
+
+#define CSG_XTS_LOAD(_l)                                                        \
+    b##_l = _mm_xor_si128( _mm_loadu_si128( (CONST __m128i *)(In + 16 * (_l)) ), \
+                           _mm_xor_si128( t##_l, k ) );
+
+#define CSG_XTS_ENC(_l)         b##_l = _mm_aesenc_si128( b##_l, k );
+#define CSG_XTS_ENCLAST(_l)     b##_l = _mm_aesenclast_si128( b##_l, k );
+#define CSG_XTS_DEC(_l)         b##_l = _mm_aesdec_si128( b##_l, k );
+#define CSG_XTS_DECLAST(_l)     b##_l = _mm_aesdeclast_si128( b##_l, k );
+
+#define CSG_XTS_STORE(_l)                                                       \
+    _mm_storeu_si128( (__m128i *)(Out + 16 * (_l)), _mm_xor_si128( b##_l, t##_l ) );
+
+CSG_TARGET("aes") VOID
+csgXtsEncryptAesNi (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    AES-NI version of csgXtsEncryptGeneric.  Only call this when the
+    processor supports AES-NI.
+
+Arguments:
+
+    See csgXtsEncryptGeneric.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CONST __m128i *rk = (CONST __m128i *)Key->DataKey.EncRoundKeys;
+    CONST __m128i *tk = (CONST __m128i *)Key->TweakKey.EncRoundKeys;
+    __m128i t, k;
+    __m128i t0, t1, t2, t3, t4, t5, t6, t7;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+    CONST UCHAR *unitEnd;
+    SIZE_T done;
+    ULONG r;
+
+    for (done = 0; done < Length; done += DataUnitSize, DataUnit++) {
+
+        t = csgXtsEncryptBlockAesNi( _mm_set_epi64x( 0, (LONGLONG)DataUnit ), tk );
+        unitEnd = In + DataUnitSize;
+
+        while ((SIZE_T)(unitEnd - In) >= CSG_XTS_LANES * CSG_AES_BLOCK_SIZE) {
+
+            CSG_XTS_FOR_LANES( CSG_XTS_NEXT_TWEAK )
+
+            k = rk[0];
+            CSG_XTS_FOR_LANES( CSG_XTS_LOAD )
+
+            for (r = 1; r < CSG_AES_MAX_ROUNDS; r++) {
+
+                k = rk[r];
+                CSG_XTS_FOR_LANES( CSG_XTS_ENC )
+            }
+
+            k = rk[CSG_AES_MAX_ROUNDS];
+            CSG_XTS_FOR_LANES( CSG_XTS_ENCLAST )
+
+            CSG_XTS_FOR_LANES( CSG_XTS_STORE )
+
+            In += CSG_XTS_LANES * CSG_AES_BLOCK_SIZE;
+            Out += CSG_XTS_LANES * CSG_AES_BLOCK_SIZE;
+        }
+
+        while (In < unitEnd) {
+
+            b0 = _mm_xor_si128( _mm_loadu_si128( (CONST __m128i *)In ), t );
+            b0 = _mm_xor_si128( csgXtsEncryptBlockAesNi( b0, rk ), t );
+            _mm_storeu_si128( (__m128i *)Out, b0 );
+
+            t = csgXtsMulAlphaSse( t );
+            In += CSG_AES_BLOCK_SIZE;
+            Out += CSG_AES_BLOCK_SIZE;
+        }
+    }
+}
+
+CSG_TARGET("aes") VOID
+csgXtsDecryptAesNi (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    AES-NI version of csgXtsDecryptGeneric.  Only call this when the
+    processor supports AES-NI.
+
+Arguments:
+
+    See csgXtsDecryptGeneric.
+
+Return Value:
+
+    None
+
+--*/
+{
+    CONST __m128i *rk = (CONST __m128i *)Key->DataKey.DecRoundKeys;
+    CONST __m128i *tk = (CONST __m128i *)Key->TweakKey.EncRoundKeys;
+    __m128i t, k;
+    __m128i t0, t1, t2, t3, t4, t5, t6, t7;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+    CONST UCHAR *unitEnd;
+    SIZE_T done;
+    ULONG r;
+
+    for (done = 0; done < Length; done += DataUnitSize, DataUnit++) {
+
+        t = csgXtsEncryptBlockAesNi( _mm_set_epi64x( 0, (LONGLONG)DataUnit ), tk );
+        unitEnd = In + DataUnitSize;
+
+        while ((SIZE_T)(unitEnd - In) >= CSG_XTS_LANES * CSG_AES_BLOCK_SIZE) {
+
+            CSG_XTS_FOR_LANES( CSG_XTS_NEXT_TWEAK )
+
+            k = rk[0];
+            CSG_XTS_FOR_LANES( CSG_XTS_LOAD )
+
+            for (r = 1; r < CSG_AES_MAX_ROUNDS; r++) {
+
+                k = rk[r];
+                CSG_XTS_FOR_LANES( CSG_XTS_DEC )
+            }
+
+            k = rk[CSG_AES_MAX_ROUNDS];
+            CSG_XTS_FOR_LANES( CSG_XTS_DECLAST )
+
+            CSG_XTS_FOR_LANES( CSG_XTS_STORE )
+
+            In += CSG_XTS_LANES * CSG_AES_BLOCK_SIZE;
+            Out += CSG_XTS_LANES * CSG_AES_BLOCK_SIZE;
+        }
+
+        while (In < unitEnd) {
+
+            b0 = _mm_xor_si128( _mm_loadu_si128( (CONST __m128i *)In ), t );
+            b0 = _mm_xor_si128( csgXtsDecryptBlockAesNi( b0, rk ), t );
+            _mm_storeu_si128( (__m128i *)Out, b0 );
+
+            t = csgXtsMulAlphaSse( t );
+            In += CSG_AES_BLOCK_SIZE;
+            Out += CSG_AES_BLOCK_SIZE;
+        }
+    }
+}
+
+#endif // CSG_ARCH_AMD64
+
+/*************************************************************************
+    Interface
+*************************************************************************/
+
+NTSTATUS
+csgXtsSetKey (
+    __out PCSG_XTS_KEY Key,
+    __in_bcount(CSG_XTS_KEY_SIZE) CONST UCHAR *KeyBytes
+    )
+/*++
+
+Routine Description:
+
+    Expands an XTS-AES-256 key.  The first 32 bytes are the data key and
+    the last 32 bytes the tweak key.
+
+Arguments:
+
+    Key - Receives the expanded key.
+
+    KeyBytes - The 64 byte raw key.
+
+Return Value:
+
+    STATUS_SUCCESS
+    STATUS_INVALID_PARAMETER - the two halves of the key are identical,
+        which IEEE 1619 forbids.
+
+--*/
+{
+    ULONG diff = 0;
+    ULONG i;
+
+    for (i = 0; i < CSG_AES_MAX_KEY_SIZE; i++) {
+
+        diff |= KeyBytes[i] ^ KeyBytes[i + CSG_AES_MAX_KEY_SIZE];
+    }
+
+    if (diff == 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory( Key, sizeof(CSG_XTS_KEY) );
+
+    csgAesSetKey( &Key->DataKey, KeyBytes, CSG_AES_MAX_KEY_SIZE );
+    csgAesSetKey( &Key->TweakKey, KeyBytes + CSG_AES_MAX_KEY_SIZE, CSG_AES_MAX_KEY_SIZE );
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+csgXtsClearKey (
+    __inout PCSG_XTS_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    Wipes an expanded XTS key.
+
+Arguments:
+
+    Key - The key to wipe.
+
+Return Value:
+
+    None
+
+--*/
+{
+    csgSecureZeroMemory( Key, sizeof(CSG_XTS_KEY) );
+}
+
+
+VOID
+csgXtsEncryptGeneric (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    Encrypts a run of consecutive data units.  In and Out may be the same
+    buffer, but must not otherwise overlap.
+
+Arguments:
+
+    Key - The expanded key.
+
+    DataUnit - Number of the first data unit, used as its tweak.  Each
+        following data unit uses the next number.
+
+    DataUnitSize - Size of a data unit in bytes.  Must be a non-zero
+        multiple of the AES block size.
+
+    In - The plaintext.
+
+    Out - Receives the ciphertext.
+
+    Length - Number of bytes to encrypt.  Must be a multiple of
+        DataUnitSize.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(DataUnitSize != 0 && (DataUnitSize % CSG_AES_BLOCK_SIZE) == 0);
+    ASSERT((Length % DataUnitSize) == 0);
+
+    csgXtsCryptGeneric( Key, TRUE, DataUnit, DataUnitSize, In, Out, Length );
+}
+
+
+VOID
+csgXtsDecryptGeneric (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    Decrypts a run of consecutive data units.  In and Out may be the same
+    buffer, but must not otherwise overlap.
+
+Arguments:
+
+    Key - The expanded key.
+
+    DataUnit - Number of the first data unit, used as its tweak.
+
+    DataUnitSize - Size of a data unit in bytes.  Must be a non-zero
+        multiple of the AES block size.
+
+    In - The ciphertext.
+
+    Out - Receives the plaintext.
+
+    Length - Number of bytes to decrypt.  Must be a multiple of
+        DataUnitSize.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(DataUnitSize != 0 && (DataUnitSize % CSG_AES_BLOCK_SIZE) == 0);
+    ASSERT((Length % DataUnitSize) == 0);
+
+    csgXtsCryptGeneric( Key, FALSE, DataUnit, DataUnitSize, In, Out, Length );
+}
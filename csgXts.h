@@ -0,0 +1,87 @@
+#ifndef __CSG_XTS_H__
+#define __CSG_XTS_H__
+
+#include "csgAes.h"
+
+/*************************************************************************
+    AES-XTS (IEEE 1619) sector cipher
+*************************************************************************/
+
+//
+//  XTS-AES-256 takes two independent AES-256 keys: Key1 encrypts the data,
+//  Key2 encrypts the tweak (the data unit number).
+//
+
+#define CSG_XTS_KEY_SIZE    (2 * CSG_AES_MAX_KEY_SIZE)
+
+typedef struct _CSG_XTS_KEY {
+
+    CSG_AES_KEY DataKey;
+
+    CSG_AES_KEY TweakKey;
+
+} CSG_XTS_KEY, *PCSG_XTS_KEY;
+
+typedef CONST CSG_XTS_KEY *PCCSG_XTS_KEY;
+
+NTSTATUS
+csgXtsSetKey (
+    __out PCSG_XTS_KEY Key,
+    __in_bcount(CSG_XTS_KEY_SIZE) CONST UCHAR *KeyBytes
+    );
+
+VOID
+csgXtsClearKey (
+    __inout PCSG_XTS_KEY Key
+    );
+
+//
+//  One entry point per implementation.  The caller picks one once (see
+//  csgProvider.h); the generic ones work everywhere.
+//
+
+VOID
+csgXtsEncryptGeneric (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+VOID
+csgXtsDecryptGeneric (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+#ifdef CSG_ARCH_AMD64
+
+VOID
+csgXtsEncryptAesNi (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+VOID
+csgXtsDecryptAesNi (
+    __in PCCSG_XTS_KEY Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    );
+
+#endif // CSG_ARCH_AMD64
+
+#endif // __CSG_XTS_H__
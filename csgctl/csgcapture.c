@@ -0,0 +1,426 @@
+/*++
+
+Module Name:
+
+    csgcapture.c
+
+Abstract:
+
+    Collects the IO_* trace events of a capture and writes them out as a
+    capture file (csgCapture.h).
+
+Environment:
+
+    User mode.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csgTrace.h"
+#include "csgCapture.h"
+#include "csgcapture.h"
+
+//
+//  The kernel's values for the flags a capture keeps; csgctl does not
+//  see the kernel headers.
+//
+
+#define CAPTURE_IRP_MJ_READ                 0x03
+#define CAPTURE_IRP_MJ_WRITE                0x04
+#define CAPTURE_IRP_MJ_DIRECTORY_CONTROL    0x0c
+
+#define CAPTURE_IRP_NOCACHE                 0x00000001
+#define CAPTURE_IRP_PAGING_IO               0x00000002
+
+#define CAPTURE_FLTFL_FAST_IO_OPERATION     0x00000002
+#define CAPTURE_FLTFL_SYSTEM_BUFFER         0x00000008
+
+//
+//  Open addressing table numbering the file objects and threads of a
+//  capture in the order they first appear.
+//
+
+typedef struct _CAPTURE_IDS {
+
+    ULONGLONG *Keys;
+
+    ULONG *Ids;
+
+    SIZE_T Mask;
+
+    ULONG Count;
+
+} CAPTURE_IDS;
+
+
+static int
+IdsCreate (
+    CAPTURE_IDS *Ids,
+    SIZE_T Entries
+    )
+{
+    SIZE_T size = 16;
+
+    while (size < 2 * Entries) {
+
+        size *= 2;
+    }
+
+    Ids->Keys = (ULONGLONG *)calloc( size, sizeof(ULONGLONG) );
+    Ids->Ids = (ULONG *)malloc( size * sizeof(ULONG) );
+    Ids->Mask = size - 1;
+    Ids->Count = 0;
+
+    if (Ids->Keys == NULL || Ids->Ids == NULL) {
+
+        free( Ids->Keys );
+        free( Ids->Ids );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static VOID
+IdsDelete (
+    CAPTURE_IDS *Ids
+    )
+{
+    free( Ids->Keys );
+    free( Ids->Ids );
+}
+
+
+//
+//  Zero marks a free slot, so keys are stored plus one; a file object or
+//  thread id is never all ones.
+//
+
+static ULONG
+IdsLookup (
+    CAPTURE_IDS *Ids,
+    ULONGLONG Key
+    )
+{
+    SIZE_T slot = (SIZE_T)((Key + 1) * 0x9e3779b97f4a7c15ULL >> 32) & Ids->Mask;
+
+    while (Ids->Keys[slot] != 0) {
+
+        if (Ids->Keys[slot] == Key + 1) {
+
+            return Ids->Ids[slot];
+        }
+
+        slot = (slot + 1) & Ids->Mask;
+    }
+
+    Ids->Keys[slot] = Key + 1;
+    Ids->Ids[slot] = Ids->Count;
+
+    return Ids->Count++;
+}
+
+
+static int
+CompareRecords (
+    CONST VOID *A,
+    CONST VOID *B
+    )
+{
+    CONST CSG_TRACE_RECORD *a = (CONST CSG_TRACE_RECORD *)A;
+    CONST CSG_TRACE_RECORD *b = (CONST CSG_TRACE_RECORD *)B;
+
+    if (a->Timestamp != b->Timestamp) {
+
+        return (a->Timestamp < b->Timestamp) ? -1 : 1;
+    }
+
+    if (a->Cpu != b->Cpu) {
+
+        return (a->Cpu < b->Cpu) ? -1 : 1;
+    }
+
+    return (a->Sequence < b->Sequence) ? -1 : (a->Sequence > b->Sequence);
+}
+
+
+VOID
+CaptureInitialize (
+    PCSGCTL_CAPTURE Capture
+    )
+{
+    memset( Capture, 0, sizeof(CSGCTL_CAPTURE) );
+}
+
+
+VOID
+CaptureDelete (
+    PCSGCTL_CAPTURE Capture
+    )
+{
+    free( Capture->Records );
+    free( Capture->Started );
+    free( Capture->LastSequence );
+
+    CaptureInitialize( Capture );
+}
+
+
+int
+CaptureAdd (
+    PCSGCTL_CAPTURE Capture,
+    ULONG Ring,
+    CONST CSG_TRACE_RECORD *Records,
+    SIZE_T Count
+    )
+{
+    ULONG last;
+    SIZE_T i;
+
+    if (Ring >= Capture->RingCount) {
+
+        BOOLEAN *started;
+        ULONG *sequence;
+
+        started = (BOOLEAN *)realloc( Capture->Started, (Ring + 1) * sizeof(BOOLEAN) );
+
+        if (started == NULL) {
+
+            return 1;
+        }
+
+        Capture->Started = started;
+
+        sequence = (ULONG *)realloc( Capture->LastSequence, (Ring + 1) * sizeof(ULONG) );
+
+        if (sequence == NULL) {
+
+            return 1;
+        }
+
+        Capture->LastSequence = sequence;
+
+        memset( &Capture->Started[Capture->RingCount], 0,
+                (Ring + 1 - Capture->RingCount) * sizeof(BOOLEAN) );
+        memset( &Capture->LastSequence[Capture->RingCount], 0,
+                (Ring + 1 - Capture->RingCount) * sizeof(ULONG) );
+
+        Capture->RingCount = Ring + 1;
+    }
+
+    last = Capture->LastSequence[Ring];
+
+    for (i = 0; i < Count; i++) {
+
+        //
+        //  Sequence numbers wrap at 32 bits; compare by difference.
+        //
+
+        if ((LONG)(Records[i].Sequence - last) <= 0) {
+
+            continue;
+        }
+
+        if (Capture->Started[Ring]) {
+
+            Capture->Lost += Records[i].Sequence - last - 1;
+
+            if (Records[i].Event == CSG_TRACE_IO_READ ||
+                Records[i].Event == CSG_TRACE_IO_WRITE ||
+                Records[i].Event == CSG_TRACE_IO_DIRCTRL) {
+
+                if (Capture->Count == Capture->Capacity) {
+
+                    CSG_TRACE_RECORD *grown;
+                    SIZE_T capacity = Capture->Capacity ? 2 * Capture->Capacity : 4096;
+
+                    grown = (CSG_TRACE_RECORD *)realloc( Capture->Records,
+                                                         capacity * sizeof(CSG_TRACE_RECORD) );
+
+                    if (grown == NULL) {
+
+                        return 1;
+                    }
+
+                    Capture->Records = grown;
+                    Capture->Capacity = capacity;
+                }
+
+                Capture->Records[Capture->Count++] = Records[i];
+            }
+        }
+
+        last = Records[i].Sequence;
+    }
+
+    Capture->LastSequence[Ring] = last;
+    Capture->Started[Ring] = TRUE;
+
+    return 0;
+}
+
+
+static VOID
+ConvertRecord (
+    CONST CSG_TRACE_RECORD *Trace,
+    CSG_CAPTURE_RECORD *Record
+    )
+{
+    ULONGLONG irpFlags;
+    ULONGLONG dataFlags;
+
+    memset( Record, 0, sizeof(CSG_CAPTURE_RECORD) );
+
+    if (Trace->Event == CSG_TRACE_IO_DIRCTRL) {
+
+        Record->MajorFunction = CAPTURE_IRP_MJ_DIRECTORY_CONTROL;
+        Record->MinorFunction = (UCHAR)Trace->Args[1];
+        Record->InformationClass = (UCHAR)Trace->Args[2];
+        Record->Length = (ULONG)Trace->Args[3];
+        Record->OperationFlags = (UCHAR)(Trace->Args[4] >> 32);
+        irpFlags = 0;
+        dataFlags = Trace->Args[4] & 0xffffffff;
+
+    } else {
+
+        Record->MajorFunction = (Trace->Event == CSG_TRACE_IO_READ) ?
+                                CAPTURE_IRP_MJ_READ : CAPTURE_IRP_MJ_WRITE;
+        Record->Offset = (LONGLONG)Trace->Args[1];
+        Record->Length = (ULONG)Trace->Args[2];
+        irpFlags = Trace->Args[3];
+        dataFlags = Trace->Args[4];
+    }
+
+    if (irpFlags & CAPTURE_IRP_NOCACHE) {
+
+        Record->Flags |= CSG_CAPTURE_NOCACHE;
+    }
+
+    if (irpFlags & CAPTURE_IRP_PAGING_IO) {
+
+        Record->Flags |= CSG_CAPTURE_PAGING;
+    }
+
+    if (dataFlags & CAPTURE_FLTFL_FAST_IO_OPERATION) {
+
+        Record->Flags |= CSG_CAPTURE_FAST_IO;
+    }
+
+    if (dataFlags & CAPTURE_FLTFL_SYSTEM_BUFFER) {
+
+        Record->Flags |= CSG_CAPTURE_SYSTEM_BUFFER;
+    }
+}
+
+
+int
+CaptureWrite (
+    PCSGCTL_CAPTURE Capture,
+    CONST CHAR *Path,
+    ULONGLONG TimestampFrequency
+    )
+{
+    CSG_CAPTURE_HEADER header;
+    CSG_CAPTURE_RECORD record;
+    CAPTURE_IDS files;
+    CAPTURE_IDS threads;
+    FILE *file;
+    SIZE_T i;
+    ULONG thread;
+    int result = 1;
+
+    qsort( Capture->Records, Capture->Count, sizeof(CSG_TRACE_RECORD), CompareRecords );
+
+    if (IdsCreate( &files, Capture->Count ) != 0) {
+
+        fprintf( stderr, "csgctl: out of memory\n" );
+        return 1;
+    }
+
+    if (IdsCreate( &threads, Capture->Count ) != 0) {
+
+        fprintf( stderr, "csgctl: out of memory\n" );
+        IdsDelete( &files );
+        return 1;
+    }
+
+    file = fopen( Path, "wb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "csgctl: cannot create %s\n", Path );
+        goto Cleanup;
+    }
+
+    //
+    //  The header goes in last, once the files and threads are counted.
+    //
+
+    memset( &header, 0, sizeof(header) );
+
+    if (fwrite( &header, sizeof(header), 1, file ) != 1) {
+
+        goto WriteError;
+    }
+
+    for (i = 0; i < Capture->Count; i++) {
+
+        ConvertRecord( &Capture->Records[i], &record );
+
+        record.Time = Capture->Records[i].Timestamp - Capture->Records[0].Timestamp;
+        record.File = IdsLookup( &files, Capture->Records[i].Args[0] );
+
+        thread = IdsLookup( &threads, Capture->Records[i].Args[5] );
+
+        if (thread > 0xffff) {
+
+            fprintf( stderr, "csgctl: more than 65536 threads in the capture\n" );
+            fclose( file );
+            goto Cleanup;
+        }
+
+        record.Thread = (USHORT)thread;
+
+        if (fwrite( &record, sizeof(record), 1, file ) != 1) {
+
+            goto WriteError;
+        }
+    }
+
+    header.Magic = CSG_CAPTURE_MAGIC;
+    header.Version = CSG_CAPTURE_VERSION;
+    header.RecordSize = sizeof(CSG_CAPTURE_RECORD);
+    header.FileCount = files.Count;
+    header.ThreadCount = threads.Count;
+    header.RecordCount = Capture->Count;
+    header.TimestampFrequency = TimestampFrequency;
+
+    if (fseek( file, 0, SEEK_SET ) != 0 ||
+        fwrite( &header, sizeof(header), 1, file ) != 1 ||
+        fflush( file ) != 0) {
+
+        goto WriteError;
+    }
+
+    result = 0;
+
+WriteError:
+
+    if (result != 0) {
+
+        fprintf( stderr, "csgctl: cannot write %s\n", Path );
+    }
+
+    fclose( file );
+
+Cleanup:
+
+    IdsDelete( &threads );
+    IdsDelete( &files );
+
+    return result;
+}
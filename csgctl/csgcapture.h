@@ -0,0 +1,70 @@
+#ifndef __CSGCAPTURE_H__
+#define __CSGCAPTURE_H__
+
+//
+//  Builds a capture file (csgCapture.h) out of trace records read from
+//  the driver's rings again and again while the capture runs.  A ring is
+//  read whole every time, so the records seen before are dropped by
+//  sequence number; a gap in the numbers means the ring wrapped between
+//  two reads and records were lost.
+//
+//  The first records handed in for a ring only mark where the capture
+//  starts: read every ring once before turning LOGFL_CAPTURE on.
+//
+//  Shared by csgctl and the simulation.  Include after windows.h or
+//  csgPort.h.  Routines returning int return zero on success.
+//
+
+typedef struct _CSGCTL_CAPTURE {
+
+    //
+    //  The IO_* records collected so far.
+    //
+
+    CSG_TRACE_RECORD *Records;
+
+    SIZE_T Count;
+
+    SIZE_T Capacity;
+
+    //
+    //  Per ring: whether it was read before, and the last sequence number
+    //  taken from it.
+    //
+
+    ULONG RingCount;
+
+    BOOLEAN *Started;
+
+    ULONG *LastSequence;
+
+    ULONGLONG Lost;
+
+} CSGCTL_CAPTURE, *PCSGCTL_CAPTURE;
+
+VOID
+CaptureInitialize (
+    PCSGCTL_CAPTURE Capture
+    );
+
+VOID
+CaptureDelete (
+    PCSGCTL_CAPTURE Capture
+    );
+
+int
+CaptureAdd (
+    PCSGCTL_CAPTURE Capture,
+    ULONG Ring,
+    CONST CSG_TRACE_RECORD *Records,
+    SIZE_T Count
+    );
+
+int
+CaptureWrite (
+    PCSGCTL_CAPTURE Capture,
+    CONST CHAR *Path,
+    ULONGLONG TimestampFrequency
+    );
+
+#endif // __CSGCAPTURE_H__
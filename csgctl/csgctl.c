@@ -0,0 +1,782 @@
+/*++
+
+Module Name:
+
+    csgctl.c
+
+Abstract:
+
+    User mode companion of the csg filter.
+
+        csgctl [-f segment] stats [interval [count]]
+
+    shows the counters of the statistics section (csgStats.h): the totals
+    since the driver loaded, or with an interval in seconds, the rates over
+    each interval, count times or until interrupted.  The section is mapped
+    once and then read directly.  -f reads a segment file in the same
+    layout instead of asking the driver; it is how the reader is tried out
+    away from Windows, where csgctl builds with
+
+        cc -DCSG_USER_MODE -I.. csgctl.c csgcapture.c csgctlPosix.c
+
+        csgctl trace [file]
+
+    decodes trace records (csgTrace.h), copied out of the driver's rings,
+    or from a file holding records back to back as csgTraceSnapshot copies
+    them out.  Records are printed in timestamp order with the formats from
+    csgTraceEvents.h; the timestamp column is relative to the first record.
+
+        csgctl capture <file> [seconds]
+
+    records every read, write and directory query that reaches the filter
+    for seconds (10 by default) into a capture file (csgCapture.h), which
+    the simulation's csgreplay sends through the driver again.  The driver
+    traces them while LOGFL_CAPTURE is set; capture sets DebugFlags to
+    LOGFL_ERRORS | LOGFL_CAPTURE for the duration, reads the rings every
+    CAPTURE_POLL_MS and then reloads the configuration, which restores the
+    configured flags.  Records lost to a ring wrapping between two reads
+    are counted; the TraceRecordsPerCpu parameter makes the rings larger.
+
+        csgctl timing on|off
+        csgctl flags <hex>
+
+    switch stage timing and set the driver's DebugFlags.
+
+        csgctl reload
+
+    has the driver read its parameters again and put them in effect.  The
+    driver refuses parameters that change ProtectedExtensions, the cipher
+    or a key until it is restarted.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csgTrace.h"
+#include "csgStats.h"
+#include "csgctl.h"
+#include "csgcapture.h"
+
+//
+//  Room for the largest ring csgTraceCreate makes.
+//
+
+#define TRACE_READ_RECORDS      0x10000
+
+//
+//  How often a capture reads the rings.
+//
+
+#define CAPTURE_POLL_MS         10
+
+//
+//  The DebugFlags a capture runs with, as csgStruct.h defines them.
+//
+
+#define LOGFL_ERRORS            0x00000001
+#define LOGFL_CAPTURE           0x00000040
+
+typedef struct _CSGCTL_EVENT {
+
+    CONST CHAR *Name;
+
+    CONST CHAR *Format;
+
+} CSGCTL_EVENT;
+
+static CONST CSGCTL_EVENT Events[CSG_TRACE_EVENT_COUNT] = {
+
+    { "NONE", "" },
+
+#define CSG_TRACE_EVENT( _name, _level, _flag, _format )    { #_name, _format },
+#include "csgTraceEvents.h"
+#undef CSG_TRACE_EVENT
+};
+
+
+static int
+CompareRecords (
+    CONST VOID *A,
+    CONST VOID *B
+    )
+{
+    CONST CSG_TRACE_RECORD *a = (CONST CSG_TRACE_RECORD *)A;
+    CONST CSG_TRACE_RECORD *b = (CONST CSG_TRACE_RECORD *)B;
+
+    if (a->Timestamp != b->Timestamp) {
+
+        return (a->Timestamp < b->Timestamp) ? -1 : 1;
+    }
+
+    if (a->Cpu != b->Cpu) {
+
+        return (a->Cpu < b->Cpu) ? -1 : 1;
+    }
+
+    return (a->Sequence < b->Sequence) ? -1 : (a->Sequence > b->Sequence);
+}
+
+
+static VOID
+PrintRecord (
+    CONST CSG_TRACE_RECORD *Record,
+    ULONGLONG Base
+    )
+{
+    printf( "%14llu %3u %10u ",
+            (unsigned long long)(Record->Timestamp - Base),
+            (unsigned)Record->Cpu,
+            (unsigned)Record->Sequence );
+
+    if (Record->Event == CSG_TRACE_NONE || Record->Event >= CSG_TRACE_EVENT_COUNT) {
+
+        printf( "event %u: %llx %llx %llx %llx %llx %llx\n",
+                (unsigned)Record->Event,
+                (unsigned long long)Record->Args[0],
+                (unsigned long long)Record->Args[1],
+                (unsigned long long)Record->Args[2],
+                (unsigned long long)Record->Args[3],
+                (unsigned long long)Record->Args[4],
+                (unsigned long long)Record->Args[5] );
+        return;
+    }
+
+    printf( "%-24s ", Events[Record->Event].Name );
+
+    //
+    //  Every format takes at most CSG_TRACE_MAX_ARGS ULONGLONGs; printf
+    //  ignores the ones it does not use.
+    //
+
+    printf( Events[Record->Event].Format,
+            (unsigned long long)Record->Args[0],
+            (unsigned long long)Record->Args[1],
+            (unsigned long long)Record->Args[2],
+            (unsigned long long)Record->Args[3],
+            (unsigned long long)Record->Args[4],
+            (unsigned long long)Record->Args[5] );
+
+    printf( "\n" );
+}
+
+
+static VOID
+PrintRecords (
+    PCSG_TRACE_RECORD Records,
+    size_t Count
+    )
+{
+    size_t i;
+
+    if (Count == 0) {
+
+        return;
+    }
+
+    qsort( Records, Count, sizeof(CSG_TRACE_RECORD), CompareRecords );
+
+    printf( "%14s %3s %10s %-24s\n", "ticks", "cpu", "seq", "event" );
+
+    for (i = 0; i < Count; i++) {
+
+        PrintRecord( &Records[i], Records[0].Timestamp );
+    }
+}
+
+
+static int
+DecodeTrace (
+    CONST CHAR *Path
+    )
+{
+    FILE *file;
+    PCSG_TRACE_RECORD records = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    file = fopen( Path, "rb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "csgctl: cannot open %s\n", Path );
+        return 1;
+    }
+
+    for (;;) {
+
+        if (count == capacity) {
+
+            PCSG_TRACE_RECORD grown;
+
+            capacity = capacity ? 2 * capacity : 4096;
+            grown = (PCSG_TRACE_RECORD)realloc( records, capacity * sizeof(CSG_TRACE_RECORD) );
+
+            if (grown == NULL) {
+
+                fprintf( stderr, "csgctl: out of memory\n" );
+                free( records );
+                fclose( file );
+                return 1;
+            }
+
+            records = grown;
+        }
+
+        if (fread( &records[count], sizeof(CSG_TRACE_RECORD), 1, file ) != 1) {
+
+            break;
+        }
+
+        count++;
+    }
+
+    fclose( file );
+
+    PrintRecords( records, count );
+
+    free( records );
+
+    return 0;
+}
+
+
+static int
+ReadTrace (
+    VOID
+    )
+{
+    PCSG_TRACE_RECORD records = NULL;
+    size_t count = 0;
+    SIZE_T returned;
+    ULONG ring;
+    int result = 0;
+
+    for (ring = 0; ; ring++) {
+
+        PCSG_TRACE_RECORD grown;
+
+        grown = (PCSG_TRACE_RECORD)realloc( records,
+                                            (count + TRACE_READ_RECORDS) * sizeof(CSG_TRACE_RECORD) );
+
+        if (grown == NULL) {
+
+            fprintf( stderr, "csgctl: out of memory\n" );
+            result = 1;
+            break;
+        }
+
+        records = grown;
+
+        result = CtlReadTrace( ring,
+                               &records[count],
+                               TRACE_READ_RECORDS * sizeof(CSG_TRACE_RECORD),
+                               &returned );
+
+        if (result != 0) {
+
+            break;
+        }
+
+        count += returned / sizeof(CSG_TRACE_RECORD);
+    }
+
+    //
+    //  Running out of rings is how the loop ends.
+    //
+
+    if (result == 1 && ring != 0) {
+
+        result = 0;
+    }
+
+    if (result == 0) {
+
+        PrintRecords( records, count );
+    }
+
+    free( records );
+
+    return (result != 0);
+}
+
+
+//
+//  Reads every ring once into Capture.
+//
+
+static int
+PollRings (
+    PCSGCTL_CAPTURE Capture,
+    PCSG_TRACE_RECORD Buffer
+    )
+{
+    SIZE_T returned;
+    ULONG ring;
+    int result;
+
+    for (ring = 0; ; ring++) {
+
+        result = CtlReadTrace( ring,
+                               Buffer,
+                               TRACE_READ_RECORDS * sizeof(CSG_TRACE_RECORD),
+                               &returned );
+
+        if (result != 0) {
+
+            break;
+        }
+
+        if (CaptureAdd( Capture, ring, Buffer, returned / sizeof(CSG_TRACE_RECORD) ) != 0) {
+
+            fprintf( stderr, "csgctl: out of memory\n" );
+            return 1;
+        }
+    }
+
+    return (result != 1 || ring == 0);
+}
+
+
+static int
+Capture (
+    CONST CHAR *Path,
+    ULONG Seconds
+    )
+{
+    CSGCTL_CAPTURE capture;
+    PCSG_TRACE_RECORD buffer;
+    PCCSG_STATS stats;
+    SIZE_T size;
+    ULONG polls;
+    ULONG n;
+    int result;
+
+    stats = (PCCSG_STATS)CtlMapStatistics( &size );
+
+    if (stats == NULL) {
+
+        return 1;
+    }
+
+    if (!csgStatsValidate( stats, size )) {
+
+        fprintf( stderr, "csgctl: the statistics section has an unknown layout\n" );
+        return 1;
+    }
+
+    buffer = (PCSG_TRACE_RECORD)malloc( TRACE_READ_RECORDS * sizeof(CSG_TRACE_RECORD) );
+
+    if (buffer == NULL) {
+
+        fprintf( stderr, "csgctl: out of memory\n" );
+        return 1;
+    }
+
+    CaptureInitialize( &capture );
+
+    //
+    //  What is in the rings now predates the capture.
+    //
+
+    result = PollRings( &capture, buffer );
+
+    if (result == 0) {
+
+        result = CtlSetDebugFlags( LOGFL_ERRORS | LOGFL_CAPTURE );
+    }
+
+    if (result == 0) {
+
+        polls = Seconds * 1000 / CAPTURE_POLL_MS;
+
+        for (n = 0; n < polls && result == 0; n++) {
+
+            CtlSleep( CAPTURE_POLL_MS );
+
+            result = PollRings( &capture, buffer );
+        }
+
+        //
+        //  Put the configured flags back even when a read failed, then
+        //  collect what was traced before they took effect.
+        //
+
+        if (CtlReloadConfig() != 0) {
+
+            result = 1;
+        }
+
+        if (result == 0) {
+
+            result = PollRings( &capture, buffer );
+        }
+    }
+
+    if (result == 0) {
+
+        result = CaptureWrite( &capture, Path, stats->TimestampFrequency );
+    }
+
+    if (result == 0) {
+
+        printf( "%llu operations captured, %llu trace records lost\n",
+                (unsigned long long)capture.Count,
+                (unsigned long long)capture.Lost );
+    }
+
+    CaptureDelete( &capture );
+    free( buffer );
+
+    return result;
+}
+
+
+//
+//  Sum of the per-processor blocks of the statistics section.
+//
+
+typedef struct _CSGCTL_TOTALS {
+
+    ULONGLONG ReadOperations;
+    ULONGLONG ReadBytes;
+    ULONGLONG WriteOperations;
+    ULONGLONG WriteBytes;
+    ULONGLONG DirCtrlOperations;
+    ULONGLONG DirCtrlBytes;
+    ULONGLONG AllocationFailures;
+    ULONGLONG SafePostings;
+    ULONGLONG SafePostFailures;
+    ULONGLONG CipherBytes;
+    ULONGLONG CipherTicks;
+    ULONGLONG KeyCacheHits;
+    ULONGLONG KeyCacheMisses;
+    ULONGLONG OffloadedWrites;
+    ULONGLONG OffloadQueueFull;
+    ULONGLONG ParallelReads;
+    ULONGLONG ParallelChunks;
+    ULONGLONG PostMdlCompletions;
+    ULONGLONG PostSystemBufferCompletions;
+    ULONGLONG PostFastIoCompletions;
+    ULONGLONG UserBuffersLocked;
+    ULONGLONG UserBufferLockFailures;
+    ULONGLONG DirEntriesWalked;
+    ULONGLONG DirEntriesPatched;
+
+} CSGCTL_TOTALS;
+
+
+static VOID
+SumStatistics (
+    PCCSG_STATS Stats,
+    CSGCTL_TOTALS *Totals
+    )
+{
+    PCCSG_STATS_CPU cpu;
+    ULONG i;
+
+    memset( Totals, 0, sizeof(CSGCTL_TOTALS) );
+
+    for (i = 0; i < Stats->CpuCount; i++) {
+
+        cpu = csgStatsCpu( (PCSG_STATS)Stats, i );
+
+        Totals->ReadOperations += cpu->ReadOperations;
+        Totals->ReadBytes += cpu->ReadBytes;
+        Totals->WriteOperations += cpu->WriteOperations;
+        Totals->WriteBytes += cpu->WriteBytes;
+        Totals->DirCtrlOperations += cpu->DirCtrlOperations;
+        Totals->DirCtrlBytes += cpu->DirCtrlBytes;
+        Totals->AllocationFailures += cpu->AllocationFailures;
+        Totals->SafePostings += cpu->SafePostings;
+        Totals->SafePostFailures += cpu->SafePostFailures;
+        Totals->CipherBytes += cpu->CipherBytes;
+        Totals->CipherTicks += cpu->CipherTicks;
+        Totals->KeyCacheHits += cpu->KeyCacheHits;
+        Totals->KeyCacheMisses += cpu->KeyCacheMisses;
+        Totals->OffloadedWrites += cpu->OffloadedWrites;
+        Totals->OffloadQueueFull += cpu->OffloadQueueFull;
+        Totals->ParallelReads += cpu->ParallelReads;
+        Totals->ParallelChunks += cpu->ParallelChunks;
+        Totals->PostMdlCompletions += cpu->PostMdlCompletions;
+        Totals->PostSystemBufferCompletions += cpu->PostSystemBufferCompletions;
+        Totals->PostFastIoCompletions += cpu->PostFastIoCompletions;
+        Totals->UserBuffersLocked += cpu->UserBuffersLocked;
+        Totals->UserBufferLockFailures += cpu->UserBufferLockFailures;
+        Totals->DirEntriesWalked += cpu->DirEntriesWalked;
+        Totals->DirEntriesPatched += cpu->DirEntriesPatched;
+    }
+}
+
+
+//
+//  Cipher throughput in MB/s: bytes over the time spent on them.
+//
+
+static double
+CipherRate (
+    ULONGLONG Bytes,
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    )
+{
+    if (Ticks == 0) {
+
+        return 0.0;
+    }
+
+    return (double)Bytes * (double)Frequency / (double)Ticks / 1e6;
+}
+
+
+//
+//  Read and directory query completions that finished where they ran
+//  rather than at a safe IRQL, in percent.
+//
+
+static double
+InlineRate (
+    CONST CSGCTL_TOTALS *Current,
+    CONST CSGCTL_TOTALS *Previous
+    )
+{
+    ULONGLONG finished = (Current->PostMdlCompletions - Previous->PostMdlCompletions) +
+                         (Current->PostSystemBufferCompletions - Previous->PostSystemBufferCompletions) +
+                         (Current->PostFastIoCompletions - Previous->PostFastIoCompletions);
+    ULONGLONG posted = Current->SafePostings - Previous->SafePostings;
+
+    if (finished + posted == 0) {
+
+        return 0.0;
+    }
+
+    return 100.0 * (double)finished / (double)(finished + posted);
+}
+
+
+//
+//  Opens of files with derived keys that found the key cached, in percent.
+//
+
+static double
+HitRate (
+    ULONGLONG Hits,
+    ULONGLONG Misses
+    )
+{
+    if (Hits + Misses == 0) {
+
+        return 0.0;
+    }
+
+    return 100.0 * (double)Hits / (double)(Hits + Misses);
+}
+
+
+static int
+ShowStatistics (
+    ULONG Interval,
+    ULONG Count
+    )
+{
+    PCCSG_STATS stats;
+    SIZE_T size;
+    CSGCTL_TOTALS previous;
+    CSGCTL_TOTALS current;
+    double seconds = Interval;
+    ULONG n;
+
+    stats = (PCCSG_STATS)CtlMapStatistics( &size );
+
+    if (stats == NULL) {
+
+        return 1;
+    }
+
+    if (!csgStatsValidate( stats, size )) {
+
+        fprintf( stderr, "csgctl: the statistics section has an unknown layout\n" );
+        return 1;
+    }
+
+    SumStatistics( stats, &current );
+
+    if (Interval == 0) {
+
+        printf( "reads            %llu (%llu bytes)\n",
+                (unsigned long long)current.ReadOperations,
+                (unsigned long long)current.ReadBytes );
+        printf( "writes           %llu (%llu bytes)\n",
+                (unsigned long long)current.WriteOperations,
+                (unsigned long long)current.WriteBytes );
+        printf( "dirctrl          %llu (%llu bytes)\n",
+                (unsigned long long)current.DirCtrlOperations,
+                (unsigned long long)current.DirCtrlBytes );
+        printf( "dir entries      %llu (%llu protected)\n",
+                (unsigned long long)current.DirEntriesWalked,
+                (unsigned long long)current.DirEntriesPatched );
+        printf( "alloc failures   %llu\n",
+                (unsigned long long)current.AllocationFailures );
+        printf( "safe postings    %llu (%llu failed)\n",
+                (unsigned long long)current.SafePostings,
+                (unsigned long long)current.SafePostFailures );
+        printf( "inline finishes  %llu from MDL, %llu system buffer, %llu fast I/O\n",
+                (unsigned long long)current.PostMdlCompletions,
+                (unsigned long long)current.PostSystemBufferCompletions,
+                (unsigned long long)current.PostFastIoCompletions );
+        printf( "locked buffers   %llu (%llu failed)\n",
+                (unsigned long long)current.UserBuffersLocked,
+                (unsigned long long)current.UserBufferLockFailures );
+        printf( "cipher           %llu bytes at %.1f MB/s\n",
+                (unsigned long long)current.CipherBytes,
+                CipherRate( current.CipherBytes, current.CipherTicks, stats->TimestampFrequency ) );
+        printf( "key cache        %llu hits, %llu misses (%.1f%%)\n",
+                (unsigned long long)current.KeyCacheHits,
+                (unsigned long long)current.KeyCacheMisses,
+                HitRate( current.KeyCacheHits, current.KeyCacheMisses ) );
+        printf( "offloaded writes %llu (%llu inline, queue full)\n",
+                (unsigned long long)current.OffloadedWrites,
+                (unsigned long long)current.OffloadQueueFull );
+        printf( "split reads      %llu (%llu chunks)\n",
+                (unsigned long long)current.ParallelReads,
+                (unsigned long long)current.ParallelChunks );
+        return 0;
+    }
+
+    printf( "%9s %9s %9s %9s %9s %7s %7s %7s %7s %11s %7s %9s %7s\n",
+            "reads/s", "rd MB/s", "writes/s", "wr MB/s", "dirctl/s",
+            "nomem", "posted", "nopost", "inline%", "cipher MB/s", "key hit%", "offload/s", "split/s" );
+
+    for (n = 0; Count == 0 || n < Count; n++) {
+
+        previous = current;
+
+        CtlSleep( Interval * 1000 );
+
+        SumStatistics( stats, &current );
+
+        printf( "%9.0f %9.1f %9.0f %9.1f %9.0f %7llu %7llu %7llu %7.1f %11.1f %7.1f %9.0f %7.0f\n",
+                (current.ReadOperations - previous.ReadOperations) / seconds,
+                (current.ReadBytes - previous.ReadBytes) / seconds / 1e6,
+                (current.WriteOperations - previous.WriteOperations) / seconds,
+                (current.WriteBytes - previous.WriteBytes) / seconds / 1e6,
+                (current.DirCtrlOperations - previous.DirCtrlOperations) / seconds,
+                (unsigned long long)(current.AllocationFailures - previous.AllocationFailures),
+                (unsigned long long)(current.SafePostings - previous.SafePostings),
+                (unsigned long long)(current.SafePostFailures - previous.SafePostFailures),
+                InlineRate( &current, &previous ),
+                CipherRate( current.CipherBytes - previous.CipherBytes,
+                            current.CipherTicks - previous.CipherTicks,
+                            stats->TimestampFrequency ),
+                HitRate( current.KeyCacheHits - previous.KeyCacheHits,
+                         current.KeyCacheMisses - previous.KeyCacheMisses ),
+                (current.OffloadedWrites - previous.OffloadedWrites) / seconds,
+                (current.ParallelReads - previous.ParallelReads) / seconds );
+
+        fflush( stdout );
+    }
+
+    return 0;
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgctl [-f segment] stats [interval [count]]\n"
+             "       csgctl trace [file]\n"
+             "       csgctl capture <file> [seconds]\n"
+             "       csgctl timing on|off\n"
+             "       csgctl flags <hex>\n"
+             "       csgctl reload\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    CONST CHAR *segment = NULL;
+    CONST CHAR *command;
+    int result;
+
+    if (argc >= 3 && strcmp( argv[1], "-f" ) == 0) {
+
+        segment = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc < 2) {
+
+        Usage();
+        return 2;
+    }
+
+    command = argv[1];
+
+    //
+    //  Decoding a file needs no driver.
+    //
+
+    if (strcmp( command, "trace" ) == 0 && argc == 3) {
+
+        return DecodeTrace( argv[2] );
+    }
+
+    if (!((strcmp( command, "stats" ) == 0 && argc <= 4) ||
+          (strcmp( command, "trace" ) == 0 && argc == 2) ||
+          (strcmp( command, "capture" ) == 0 && (argc == 3 || argc == 4)) ||
+          (strcmp( command, "timing" ) == 0 && argc == 3) ||
+          (strcmp( command, "flags" ) == 0 && argc == 3) ||
+          (strcmp( command, "reload" ) == 0 && argc == 2))) {
+
+        Usage();
+        return 2;
+    }
+
+    if (CtlOpen( segment ) != 0) {
+
+        return 1;
+    }
+
+    if (strcmp( command, "stats" ) == 0) {
+
+        result = ShowStatistics( argc > 2 ? (ULONG)strtoul( argv[2], NULL, 10 ) : 0,
+                                 argc > 3 ? (ULONG)strtoul( argv[3], NULL, 10 ) : 0 );
+
+    } else if (strcmp( command, "trace" ) == 0) {
+
+        result = ReadTrace();
+
+    } else if (strcmp( command, "capture" ) == 0) {
+
+        result = Capture( argv[2], argc > 3 ? (ULONG)strtoul( argv[3], NULL, 10 ) : 10 );
+
+    } else if (strcmp( command, "timing" ) == 0) {
+
+        result = CtlSetStageTiming( strcmp( argv[2], "on" ) == 0 );
+
+    } else if (strcmp( command, "reload" ) == 0) {
+
+        result = CtlReloadConfig();
+
+    } else {
+
+        result = CtlSetDebugFlags( (ULONG)strtoul( argv[2], NULL, 16 ) );
+    }
+
+    CtlClose();
+
+    return result;
+}
@@ -0,0 +1,60 @@
+#ifndef __CSGCTL_H__
+#define __CSGCTL_H__
+
+//
+//  How csgctl reaches the driver: through the control port on Windows
+//  (csgctlWin.c), or, on other systems, only to a statistics segment in a
+//  file laid out as csgStats.h describes (csgctlPosix.c).  Include after
+//  windows.h or csgPort.h.
+//
+//  Routines returning int return zero on success.
+//
+
+int
+CtlOpen (
+    CONST CHAR *Segment
+    );
+
+VOID
+CtlClose (
+    VOID
+    );
+
+CONST VOID *
+CtlMapStatistics (
+    SIZE_T *Size
+    );
+
+int
+CtlSetStageTiming (
+    ULONG On
+    );
+
+int
+CtlSetDebugFlags (
+    ULONG Flags
+    );
+
+int
+CtlReloadConfig (
+    VOID
+    );
+
+//
+//  Returns 1 when Ring is past the last ring.
+//
+
+int
+CtlReadTrace (
+    ULONG Ring,
+    VOID *Records,
+    SIZE_T Size,
+    SIZE_T *Returned
+    );
+
+VOID
+CtlSleep (
+    ULONG Milliseconds
+    );
+
+#endif // __CSGCTL_H__
@@ -0,0 +1,176 @@
+/*++
+
+Module Name:
+
+    csgctlPosix.c
+
+Abstract:
+
+    csgctl's transport where there is no driver: the statistics segment is
+    a file, mapped read only, that something else keeps up to date in the
+    csgStats.h layout.  Used to exercise the reader away from Windows.
+    There is no control port, so the other commands fail.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "csgPort.h"
+#include "csgctl.h"
+
+static CONST VOID *Segment;
+static SIZE_T SegmentSize;
+
+
+static int
+NoDriver (
+    VOID
+    )
+{
+    fprintf( stderr, "csgctl: no driver on this system\n" );
+    return 1;
+}
+
+
+int
+CtlOpen (
+    CONST CHAR *Path
+    )
+{
+    struct stat info;
+    VOID *view;
+    int fd;
+
+    if (Path == NULL) {
+
+        fprintf( stderr, "csgctl: no driver on this system, name a segment with -f\n" );
+        return 1;
+    }
+
+    fd = open( Path, O_RDONLY );
+
+    if (fd < 0) {
+
+        fprintf( stderr, "csgctl: cannot open %s\n", Path );
+        return 1;
+    }
+
+    if (fstat( fd, &info ) != 0 || info.st_size == 0) {
+
+        fprintf( stderr, "csgctl: %s is empty\n", Path );
+        close( fd );
+        return 1;
+    }
+
+    view = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+
+    close( fd );
+
+    if (view == MAP_FAILED) {
+
+        fprintf( stderr, "csgctl: cannot map %s\n", Path );
+        return 1;
+    }
+
+    Segment = view;
+    SegmentSize = (SIZE_T)info.st_size;
+
+    return 0;
+}
+
+
+VOID
+CtlClose (
+    VOID
+    )
+{
+    if (Segment != NULL) {
+
+        munmap( (VOID *)Segment, SegmentSize );
+        Segment = NULL;
+    }
+}
+
+
+CONST VOID *
+CtlMapStatistics (
+    SIZE_T *Size
+    )
+{
+    *Size = SegmentSize;
+
+    return Segment;
+}
+
+
+int
+CtlSetStageTiming (
+    ULONG On
+    )
+{
+    UNREFERENCED_PARAMETER( On );
+
+    return NoDriver();
+}
+
+
+int
+CtlSetDebugFlags (
+    ULONG Flags
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    return NoDriver();
+}
+
+
+int
+CtlReloadConfig (
+    VOID
+    )
+{
+    return NoDriver();
+}
+
+
+int
+CtlReadTrace (
+    ULONG Ring,
+    VOID *Records,
+    SIZE_T Size,
+    SIZE_T *Returned
+    )
+{
+    UNREFERENCED_PARAMETER( Ring );
+    UNREFERENCED_PARAMETER( Records );
+    UNREFERENCED_PARAMETER( Size );
+    UNREFERENCED_PARAMETER( Returned );
+
+    NoDriver();
+
+    return -1;
+}
+
+
+VOID
+CtlSleep (
+    ULONG Milliseconds
+    )
+{
+    struct timespec delay;
+
+    delay.tv_sec = Milliseconds / 1000;
+    delay.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+
+    nanosleep( &delay, NULL );
+}
@@ -0,0 +1,192 @@
+/*++
+
+Module Name:
+
+    csgctlWin.c
+
+Abstract:
+
+    csgctl's transport on Windows: the driver's control port.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#include <stdio.h>
+
+#include <windows.h>
+#include <fltUser.h>
+
+#include "csgctl.h"
+#include "csgControl.h"
+
+static HANDLE Port = INVALID_HANDLE_VALUE;
+
+
+static HRESULT
+SendControl (
+    ULONG Command,
+    ULONG Argument,
+    VOID *Output,
+    DWORD OutputSize,
+    DWORD *Returned
+    )
+{
+    CSG_CONTROL_MESSAGE message;
+    DWORD returned = 0;
+
+    message.Command = Command;
+    message.Argument = Argument;
+
+    return FilterSendMessage( Port,
+                              &message,
+                              sizeof(message),
+                              Output,
+                              OutputSize,
+                              Returned ? Returned : &returned );
+}
+
+
+int
+CtlOpen (
+    CONST CHAR *Segment
+    )
+{
+    HRESULT hr;
+
+    if (Segment != NULL) {
+
+        fprintf( stderr, "csgctl: -f is only for systems without the driver\n" );
+        return 1;
+    }
+
+    hr = FilterConnectCommunicationPort( CSG_CONTROL_PORT_NAME,
+                                         0,
+                                         NULL,
+                                         0,
+                                         NULL,
+                                         &Port );
+
+    if (FAILED( hr )) {
+
+        fprintf( stderr, "csgctl: cannot connect to the driver (0x%08lx)\n", (unsigned long)hr );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+VOID
+CtlClose (
+    VOID
+    )
+{
+    if (Port != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( Port );
+        Port = INVALID_HANDLE_VALUE;
+    }
+}
+
+
+CONST VOID *
+CtlMapStatistics (
+    SIZE_T *Size
+    )
+{
+    CSG_CONTROL_MAP_REPLY reply;
+    DWORD returned;
+    HRESULT hr;
+
+    hr = SendControl( CSG_CONTROL_MAP_STATISTICS, 0, &reply, sizeof(reply), &returned );
+
+    if (FAILED( hr ) || returned < sizeof(reply)) {
+
+        fprintf( stderr, "csgctl: cannot map the statistics (0x%08lx)\n", (unsigned long)hr );
+        return NULL;
+    }
+
+    *Size = (SIZE_T)reply.Size;
+
+    return (CONST VOID *)(ULONG_PTR)reply.Address;
+}
+
+
+int
+CtlSetStageTiming (
+    ULONG On
+    )
+{
+    return FAILED( SendControl( CSG_CONTROL_SET_STAGE_TIMING, On, NULL, 0, NULL ) );
+}
+
+
+int
+CtlSetDebugFlags (
+    ULONG Flags
+    )
+{
+    return FAILED( SendControl( CSG_CONTROL_SET_DEBUG_FLAGS, Flags, NULL, 0, NULL ) );
+}
+
+
+int
+CtlReloadConfig (
+    VOID
+    )
+{
+    HRESULT hr;
+
+    hr = SendControl( CSG_CONTROL_RELOAD_CONFIG, 0, NULL, 0, NULL );
+
+    if (FAILED( hr )) {
+
+        fprintf( stderr, "csgctl: cannot reload the configuration (0x%08lx)\n", (unsigned long)hr );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int
+CtlReadTrace (
+    ULONG Ring,
+    VOID *Records,
+    SIZE_T Size,
+    SIZE_T *Returned
+    )
+{
+    DWORD returned = 0;
+    HRESULT hr;
+
+    hr = SendControl( CSG_CONTROL_READ_TRACE, Ring, Records, (DWORD)Size, &returned );
+
+    if (hr == HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS )) {
+
+        return 1;
+    }
+
+    if (FAILED( hr )) {
+
+        fprintf( stderr, "csgctl: cannot read trace ring %lu (0x%08lx)\n",
+                 (unsigned long)Ring, (unsigned long)hr );
+        return -1;
+    }
+
+    *Returned = returned;
+
+    return 0;
+}
+
+
+VOID
+CtlSleep (
+    ULONG Milliseconds
+    )
+{
+    Sleep( Milliseconds );
+}
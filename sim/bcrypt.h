@@ -0,0 +1,35 @@
+/*++
+
+Module Name:
+
+    bcrypt.h
+
+Abstract:
+
+    Stand-in for the CNG header; the simulation implements only the
+    system random number generator.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#ifndef __CSG_SIM_BCRYPT_H__
+#define __CSG_SIM_BCRYPT_H__
+
+#include <fltKernel.h>
+
+typedef PVOID BCRYPT_ALG_HANDLE;
+
+#define BCRYPT_USE_SYSTEM_PREFERRED_RNG     0x00000002
+
+NTSTATUS
+BCryptGenRandom (
+    BCRYPT_ALG_HANDLE Algorithm,
+    PUCHAR Buffer,
+    ULONG BufferSize,
+    ULONG Flags
+    );
+
+#endif // __CSG_SIM_BCRYPT_H__
@@ -0,0 +1,814 @@
+/*++
+
+Module Name:
+
+    csgcache.c
+
+Abstract:
+
+    Stress checks the swap buffer cache (csgBufCache.h) from many threads
+    at once, with trims, aging and changes of its bound going on
+    underneath them.
+
+        csgcache [-t threads] [-i operations] [-o outstanding] [-f every]
+
+    Each thread keeps a few buffers of random sizes, some too large for
+    any class, and frees and replaces one at random each operation.  A
+    thread stamps every buffer it holds at both ends and checks the
+    stamps before freeing it, so a buffer handed to two threads at once,
+    or written by the cache while held, is caught.  Meanwhile another
+    thread trims the cache, ages it, lowers and raises its bound, and
+    queries its counters.  The allocator behind the cache checks that
+    every object comes back once, with the size it went out with, and
+    fails an allocation now and then so that the cache has to trim and
+    retry.
+
+    Once the threads are done, the cache's counters must account for
+    every allocation exactly; the buffers it keeps must be the allocator's
+    live objects, within the bound it was last given; aging an idle cache
+    must drain it; and destroying it must leave nothing allocated.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.  Built with -fsanitize=thread as well, the
+    cache's locking is checked too; the races it should report are the
+    two reads the cache makes without a lock on purpose, of a class's
+    magazine limit in csgBufCacheAllocate and of the counters in
+    csgBufCacheQueryStats, and nothing else.
+
+        -t      threads, twice the processors unless told, at most 64
+        -i      operations per thread, 200000 unless told
+        -o      buffers each thread holds, 8 unless told
+        -f      fail one allocation in this many, 1000 unless told; 0
+                never to
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgcache.c ../csgBufCache.c \
+           ../csgCpu.c -lpthread -o csgcache
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgBufCache.h"
+
+#define CACHE_MAX_THREADS       64
+#define CACHE_MAX_OUTSTANDING   64
+
+//
+//  Bytes stamped at each end of a held buffer.
+//
+
+#define CACHE_STAMP_BYTES       64
+
+//
+//  The bounds the churn thread switches between: the driver's default,
+//  one that leaves the large classes no magazines, and one too small for
+//  even a magazine's worth of the smallest class.
+//
+
+static const SIZE_T ClassBytes[] = { 8 * 1024 * 1024, 1024 * 1024, 16 * 1024 };
+
+#define CACHE_COUNT(_a)         (sizeof(_a) / sizeof((_a)[0]))
+#define CACHE_MIN(_a, _b)       (((_a) < (_b)) ? (_a) : (_b))
+#define CACHE_MAX(_a, _b)       (((_a) > (_b)) ? (_a) : (_b))
+
+/*************************************************************************
+    Allocator
+*************************************************************************/
+
+#define MOCK_LIVE               0x4576694c
+#define MOCK_FREED              0x65657246
+
+//
+//  Goes in front of every object the allocator hands out.  The size
+//  keeps the object 16 byte aligned.
+//
+
+typedef struct _MOCK_HEADER {
+
+    ULONG Magic;
+
+    ULONG Padding;
+
+    SIZE_T Size;
+
+} MOCK_HEADER, *PMOCK_HEADER;
+
+static volatile LONGLONG MockAttempts;
+static volatile LONGLONG MockAllocations;
+static volatile LONGLONG MockFrees;
+static volatile LONGLONG MockInjected;
+static volatile LONG MockErrors;
+
+//
+//  Fail one allocation in this many, or none if zero.
+//
+
+static ULONG MockFailEvery = 1000;
+
+//
+//  Set on a thread whose last allocation was failed, so the cache's one
+//  retry after a trim is never failed too.
+//
+
+static __thread BOOLEAN MockJustFailed;
+
+static ULONG Failures;
+
+
+static VOID
+MockError (
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    fprintf( stderr, "csgcache: " );
+
+    va_start( arguments, Format );
+    vfprintf( stderr, Format, arguments );
+    va_end( arguments );
+
+    fprintf( stderr, "\n" );
+
+    __atomic_fetch_add( &MockErrors, 1, __ATOMIC_RELAXED );
+}
+
+
+static PVOID
+MockAllocate (
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    )
+{
+    PMOCK_HEADER header;
+    LONGLONG attempt;
+
+    UNREFERENCED_PARAMETER( Context );
+
+    attempt = __atomic_add_fetch( &MockAttempts, 1, __ATOMIC_RELAXED );
+
+    if (MockFailEvery != 0 && attempt % MockFailEvery == 0 && !MockJustFailed) {
+
+        __atomic_fetch_add( &MockInjected, 1, __ATOMIC_RELAXED );
+        MockJustFailed = TRUE;
+        return NULL;
+    }
+
+    MockJustFailed = FALSE;
+
+    header = malloc( sizeof(MOCK_HEADER) + Size );
+
+    if (header == NULL) {
+
+        return NULL;
+    }
+
+    __atomic_fetch_add( &MockAllocations, 1, __ATOMIC_RELAXED );
+
+    header->Magic = MOCK_LIVE;
+    header->Size = Size;
+
+    return header + 1;
+}
+
+
+static VOID
+MockFree (
+    __in PVOID Buffer,
+    __in SIZE_T Size,
+    __in_opt PVOID Context
+    )
+{
+    PMOCK_HEADER header = (PMOCK_HEADER)Buffer - 1;
+
+    UNREFERENCED_PARAMETER( Context );
+
+    if (header->Magic != MOCK_LIVE) {
+
+        MockError( "%p freed twice, or never allocated", Buffer );
+        return;
+    }
+
+    if (header->Size != Size) {
+
+        MockError( "%p allocated with %zu bytes, freed with %zu", Buffer, header->Size, Size );
+    }
+
+    header->Magic = MOCK_FREED;
+
+    __atomic_fetch_add( &MockFrees, 1, __ATOMIC_RELAXED );
+
+    free( header );
+}
+
+
+static LONGLONG
+MockLive (
+    VOID
+    )
+{
+    return __atomic_load_n( &MockAllocations, __ATOMIC_RELAXED ) -
+           __atomic_load_n( &MockFrees, __ATOMIC_RELAXED );
+}
+
+/*************************************************************************
+    Checks
+*************************************************************************/
+
+typedef struct _CACHE_HELD {
+
+    PUCHAR Buffer;
+
+    SIZE_T Size;
+
+    //
+    //  The thread's index and the operation that got the buffer.
+    //
+
+    ULONGLONG Stamp;
+
+} CACHE_HELD, *PCACHE_HELD;
+
+typedef struct _CACHE_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+    ULONGLONG Random;
+
+    CACHE_HELD Held[CACHE_MAX_OUTSTANDING];
+
+    //
+    //  Requests of each class, and too large for any.
+    //
+
+    ULONGLONG Requests[CSG_BUFCACHE_CLASSES];
+
+    ULONGLONG Oversize;
+
+    ULONG Corrupted;
+
+    ULONG Short;
+
+    ULONG Empty;
+
+} CACHE_THREAD, *PCACHE_THREAD;
+
+static PCSG_BUFCACHE Cache;
+static ULONG Operations = 200000;
+static ULONG Outstanding = 8;
+static volatile BOOLEAN Stop;
+
+static ULONGLONG Trims;
+static ULONGLONG Ages;
+static ULONGLONG Bounds;
+
+
+static ULONG
+NextRandom (
+    __inout PULONGLONG Random
+    )
+{
+    *Random ^= *Random << 13;
+    *Random ^= *Random >> 7;
+    *Random ^= *Random << 17;
+
+    return (ULONG)(*Random >> 32);
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+static ULONG
+ClassOf (
+    __in SIZE_T Size
+    )
+{
+    ULONG cls = 0;
+
+    while (((SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + cls)) < Size) {
+
+        cls++;
+    }
+
+    return cls;
+}
+
+
+static SIZE_T
+RandomSize (
+    __inout PCACHE_THREAD Thread
+    )
+/*++
+
+Routine Description:
+
+    Mostly small sizes, as the swap paths see them, with a few up to the
+    largest class and one in 64 too large for any.
+
+--*/
+{
+    ULONG choice = NextRandom( &Thread->Random ) % 64;
+
+    if (choice == 0) {
+
+        return CSG_BUFCACHE_MAX_SIZE + 1 + NextRandom( &Thread->Random ) % CSG_BUFCACHE_MAX_SIZE;
+
+    } else if (choice < 8) {
+
+        return 1 + NextRandom( &Thread->Random ) % CSG_BUFCACHE_MAX_SIZE;
+
+    } else {
+
+        return 1 + NextRandom( &Thread->Random ) % (64 * 1024);
+    }
+}
+
+
+static UCHAR
+StampByte (
+    __in PCACHE_HELD Held,
+    __in SIZE_T Index
+    )
+{
+    return (UCHAR)(Held->Stamp >> (8 * (Index % sizeof(Held->Stamp))));
+}
+
+
+static VOID
+Stamp (
+    __inout PCACHE_HELD Held
+    )
+{
+    SIZE_T bytes = CACHE_MIN( Held->Size, (SIZE_T)CACHE_STAMP_BYTES );
+    SIZE_T i;
+
+    for (i = 0; i < bytes; i++) {
+
+        Held->Buffer[i] = StampByte( Held, i );
+        Held->Buffer[Held->Size - bytes + i] = StampByte( Held, Held->Size - bytes + i );
+    }
+}
+
+
+static BOOLEAN
+CheckStamp (
+    __in PCACHE_HELD Held
+    )
+{
+    SIZE_T bytes = CACHE_MIN( Held->Size, (SIZE_T)CACHE_STAMP_BYTES );
+    SIZE_T i;
+
+    for (i = 0; i < bytes; i++) {
+
+        if (Held->Buffer[i] != StampByte( Held, i ) ||
+            Held->Buffer[Held->Size - bytes + i] != StampByte( Held, Held->Size - bytes + i )) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+Release (
+    __inout PCACHE_THREAD Thread,
+    __inout PCACHE_HELD Held
+    )
+{
+    if (!CheckStamp( Held )) {
+
+        Thread->Corrupted++;
+    }
+
+    csgBufCacheFree( Cache, Held->Buffer, Held->Size );
+
+    Held->Buffer = NULL;
+}
+
+
+static PVOID
+CacheThread (
+    __in PVOID Parameter
+    )
+{
+    PCACHE_THREAD thread = Parameter;
+    PCACHE_HELD held;
+    PMOCK_HEADER header;
+    ULONG i;
+
+    for (i = 0; i < Operations; i++) {
+
+        held = &thread->Held[NextRandom( &thread->Random ) % Outstanding];
+
+        if (held->Buffer != NULL) {
+
+            Release( thread, held );
+        }
+
+        held->Size = RandomSize( thread );
+        held->Buffer = csgBufCacheAllocate( Cache, held->Size );
+
+        if (held->Size > CSG_BUFCACHE_MAX_SIZE) {
+
+            thread->Oversize++;
+
+        } else {
+
+            thread->Requests[ClassOf( held->Size )]++;
+        }
+
+        if (held->Buffer == NULL) {
+
+            thread->Empty++;
+            continue;
+        }
+
+        header = (PMOCK_HEADER)held->Buffer - 1;
+
+        if (header->Size < held->Size) {
+
+            thread->Short++;
+        }
+
+        held->Stamp = ((ULONGLONG)thread->Index << 32) | i;
+
+        Stamp( held );
+    }
+
+    for (i = 0; i < Outstanding; i++) {
+
+        if (thread->Held[i].Buffer != NULL) {
+
+            Release( thread, &thread->Held[i] );
+        }
+    }
+
+    return NULL;
+}
+
+
+static PVOID
+ChurnThread (
+    __in PVOID Parameter
+    )
+/*++
+
+Routine Description:
+
+    Does to the cache, over and over until told to stop, what its owner
+    does: trims it, ages it, and changes its bound.
+
+--*/
+{
+    CSG_BUFCACHE_STATS stats;
+    ULONGLONG random = 0x9e3779b97f4a7c15ULL;
+    ULONG choice;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    while (!__atomic_load_n( &Stop, __ATOMIC_ACQUIRE )) {
+
+        choice = NextRandom( &random ) % 4;
+
+        if (choice == 0) {
+
+            csgBufCacheTrim( Cache );
+            Trims++;
+
+        } else if (choice == 1) {
+
+            csgBufCacheAge( Cache );
+            Ages++;
+
+        } else if (choice == 2) {
+
+            csgBufCacheSetClassBytes( Cache, ClassBytes[NextRandom( &random ) % CACHE_COUNT( ClassBytes )] );
+            Bounds++;
+
+        } else {
+
+            csgBufCacheQueryStats( Cache, &stats );
+        }
+
+        usleep( 100 );
+    }
+
+    return NULL;
+}
+
+
+static VOID
+CheckBound (
+    __in SIZE_T Bytes
+    )
+/*++
+
+Routine Description:
+
+    Gives the idle cache a bound and checks that no class keeps more than
+    it allows: the bound's worth of buffers, or a magazine's worth, eight,
+    if that is more.
+
+--*/
+{
+    CSG_BUFCACHE_STATS stats;
+    SIZE_T allowed;
+    SIZE_T size;
+    ULONG worst = 0;
+    ULONG cls;
+    BOOLEAN within = TRUE;
+
+    csgBufCacheSetClassBytes( Cache, Bytes );
+    csgBufCacheQueryStats( Cache, &stats );
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        size = (SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + cls);
+        allowed = CACHE_MAX( Bytes / size, (SIZE_T)8 );
+
+        if (stats.Cached[cls] > allowed) {
+
+            within = FALSE;
+            worst = cls;
+        }
+    }
+
+    Report( within,
+            "bound of %zu bytes a class kept%s",
+            Bytes,
+            within ? "" : ", exceeded" );
+
+    if (!within) {
+
+        printf( "       class of %zu bytes keeps %u buffers\n",
+                (SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + worst),
+                stats.Cached[worst] );
+    }
+}
+
+
+static ULONGLONG
+CachedTotal (
+    VOID
+    )
+{
+    CSG_BUFCACHE_STATS stats;
+    ULONGLONG total = 0;
+    ULONG cls;
+
+    csgBufCacheQueryStats( Cache, &stats );
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        total += stats.Cached[cls];
+    }
+
+    return total;
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgcache [-t threads] [-i operations] [-o outstanding] [-f every]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    PCACHE_THREAD threads;
+    CSG_BUFCACHE_STATS stats;
+    pthread_t churn;
+    struct timespec start;
+    struct timespec end;
+    ULONGLONG requests[CSG_BUFCACHE_CLASSES] = { 0 };
+    ULONGLONG oversize = 0;
+    ULONGLONG served;
+    ULONGLONG hits = 0;
+    ULONG threadCount = 0;
+    ULONG corrupted = 0;
+    ULONG shortBuffers = 0;
+    ULONG empty = 0;
+    BOOLEAN counted = TRUE;
+    double seconds;
+    ULONG i;
+    ULONG cls;
+    int option;
+    NTSTATUS status;
+
+    while ((option = getopt( argc, argv, "t:i:o:f:" )) != -1) {
+
+        switch (option) {
+
+            case 't':   threadCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'i':   Operations = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'o':   Outstanding = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'f':   MockFailEvery = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (threadCount == 0) {
+
+        threadCount = CACHE_MIN( 2 * csgCpuCount(), CACHE_MAX_THREADS );
+    }
+
+    if (optind != argc ||
+        threadCount > CACHE_MAX_THREADS ||
+        Outstanding == 0 || Outstanding > CACHE_MAX_OUTSTANDING) {
+
+        Usage();
+        return 2;
+    }
+
+    status = csgBufCacheCreate( ClassBytes[0], MockAllocate, MockFree, NULL, &Cache );
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgcache: cannot create the cache: %08x\n", (unsigned)status );
+        return 1;
+    }
+
+    threads = calloc( threadCount, sizeof(CACHE_THREAD) );
+
+    if (threads == NULL || pthread_create( &churn, NULL, ChurnThread, NULL ) != 0) {
+
+        fprintf( stderr, "csgcache: cannot start the threads\n" );
+        return 1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for (i = 0; i < threadCount; i++) {
+
+        threads[i].Index = i;
+        threads[i].Random = 0x2545f4914f6cdd1dULL * (i + 1);
+
+        if (pthread_create( &threads[i].Thread, NULL, CacheThread, &threads[i] ) != 0) {
+
+            fprintf( stderr, "csgcache: cannot start thread %u\n", i );
+            return 1;
+        }
+    }
+
+    for (i = 0; i < threadCount; i++) {
+
+        pthread_join( threads[i].Thread, NULL );
+
+        for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+            requests[cls] += threads[i].Requests[cls];
+        }
+
+        oversize += threads[i].Oversize;
+        corrupted += threads[i].Corrupted;
+        shortBuffers += threads[i].Short;
+        empty += threads[i].Empty;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    __atomic_store_n( &Stop, TRUE, __ATOMIC_RELEASE );
+    pthread_join( churn, NULL );
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    Report( corrupted == 0 && shortBuffers == 0 && empty == 0,
+            "%u threads, %u operations each, %u held: %u buffers written while held, %u too short, %u not had",
+            threadCount,
+            Operations,
+            Outstanding,
+            corrupted,
+            shortBuffers,
+            empty );
+
+    //
+    //  The counters are kept under the locks, so once the threads are done
+    //  they are exact: every request of a class is a hit or a miss.
+    //
+
+    csgBufCacheQueryStats( Cache, &stats );
+
+    for (cls = 0; cls < CSG_BUFCACHE_CLASSES; cls++) {
+
+        served = stats.Hits[cls] + stats.Misses[cls];
+        hits += stats.Hits[cls];
+
+        if (served != requests[cls]) {
+
+            printf( "       class of %zu bytes: %llu requests, %llu hits and misses\n",
+                    (SIZE_T)1 << (CSG_BUFCACHE_MIN_SHIFT + cls),
+                    (unsigned long long)requests[cls],
+                    (unsigned long long)served );
+
+            counted = FALSE;
+        }
+    }
+
+    Report( counted && stats.Oversize == oversize,
+            "counters account for every request, %.1f%% hits, %llu oversize, %.0f operations per second",
+            100.0 * hits / CACHE_MAX( threadCount * (ULONGLONG)Operations - oversize, 1ULL ),
+            (unsigned long long)stats.Oversize,
+            threadCount * (double)Operations / seconds );
+
+    Report( (ULONGLONG)MockLive() == CachedTotal(),
+            "%lld objects live, %llu cached, after %llu trims, %llu agings, %llu bounds and %lld failed allocations",
+            MockLive(),
+            CachedTotal(),
+            (unsigned long long)Trims,
+            (unsigned long long)Ages,
+            (unsigned long long)Bounds,
+            __atomic_load_n( &MockInjected, __ATOMIC_RELAXED ) );
+
+    for (i = 0; i < CACHE_COUNT( ClassBytes ); i++) {
+
+        CheckBound( ClassBytes[i] );
+    }
+
+    //
+    //  Unused, each aging sends the magazines down and halves what the
+    //  depots held throughout; a class the largest bound allows no more
+    //  than 2048 buffers of is gone in a dozen.
+    //
+
+    for (i = 0; i < 16; i++) {
+
+        csgBufCacheAge( Cache );
+    }
+
+    Report( CachedTotal() == 0 && MockLive() == 0,
+            "aging an idle cache drains it: %llu cached, %lld live",
+            CachedTotal(),
+            MockLive() );
+
+    csgBufCacheDestroy( Cache );
+
+    Report( MockLive() == 0 && MockErrors == 0,
+            "%lld objects allocated, %lld still live after destroy, %d misused",
+            __atomic_load_n( &MockAllocations, __ATOMIC_RELAXED ),
+            MockLive(),
+            MockErrors );
+
+    free( threads );
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,858 @@
+/*++
+
+Module Name:
+
+    csgdesc.c
+
+Abstract:
+
+    Checks the lifecycle of swap buffer descriptors (csgSwapDesc.h), and
+    of the swap buffer cache that holds them, against mock MDLs.
+
+        csgdesc [-i ios] [-o outstanding]
+
+    The MDL routines csgPort.h leaves to user mode are supplied here.
+    They keep every MDL ever allocated, freed ones too, so that an MDL
+    freed twice, or used after it was freed, is caught rather than
+    corrupting the heap; they check that a partial MDL is built only from
+    an MDL that describes pages, only for a range inside it, only into an
+    MDL allocated for at least that range, and, once built, not again
+    until it has been prepared for reuse; and they count the pages looked
+    up for nonpaged pool.
+
+    A descriptor of each size class must come with an MDL describing all
+    of its buffer, and give out partial MDLs of any length up to its
+    capacity, none of them its own MDL and none looking a page up again.
+    Given back after each use, the one partial MDL it allocated must do
+    for all of them.
+
+    Then I/Os of random lengths, some too large for any class, are played
+    through the cache the way the swap paths do it: a descriptor is taken
+    from the cache and a partial MDL built from it; when the I/O
+    completes, the post-operation callback mostly gives the MDL back to
+    the descriptor before the descriptor goes back to the cache.  Now and
+    then it does not, and the MDL is freed afterwards, as the filter
+    manager frees it, and the cache is now and then trimmed in between,
+    so that a partial MDL outlives the descriptor it was built from.  No
+    two I/Os in flight may share a descriptor, pages must be looked up
+    only for descriptors the cache had to allocate, and an I/O may
+    allocate an MDL only if its descriptor is new or its last MDL was not
+    given back.  Failing the MDL allocations must leave nothing behind,
+    and once the cache is destroyed every MDL must have been freed exactly
+    once.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.  Built with -fsanitize=address, the buffers
+    the failure paths should free are checked for leaks too.
+
+        -i      I/Os to play, 100000 unless told
+        -o      I/Os in flight at once, 16 unless told
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgdesc.c ../csgSwapDesc.c \
+           ../csgBufCache.c ../csgCpu.c -lpthread -o csgdesc
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csgSwapDesc.h"
+#include "csgBufCache.h"
+
+#define DESC_PAGE_SIZE          4096
+#define DESC_MAX_OUTSTANDING    256
+
+#define DESC_COUNT(_a)          (sizeof(_a) / sizeof((_a)[0]))
+
+//
+//  The descriptors' context is their pool tag, which user mode does not
+//  use.
+//
+
+#define DESC_CONTEXT            NULL
+
+//
+//  What each class keeps at most, as the driver's default SwapCacheBytes
+//  would have it.
+//
+
+#define DESC_CLASS_BYTES        (8 * 1024 * 1024)
+
+/*************************************************************************
+    Mock MDLs
+*************************************************************************/
+
+#define MOCK_MDL_LIVE           0x4c64644d
+#define MOCK_MDL_FREED          0x65657246
+
+struct _MDL {
+
+    ULONG Magic;
+
+    //
+    //  Every MDL ever allocated, newest first.
+    //
+
+    PMDL Next;
+
+    PUCHAR VirtualAddress;
+
+    //
+    //  The length it was allocated for, and the length it describes.
+    //
+
+    ULONG Allocated;
+
+    ULONG Length;
+
+    //
+    //  Describes pages: built for nonpaged pool, or as a partial MDL.
+    //
+
+    BOOLEAN Built;
+
+    BOOLEAN Partial;
+};
+
+static PMDL MockMdls;
+
+//
+//  Allocations, counted from one; the allocation of this number fails.
+//
+
+static ULONG MockAllocations;
+static ULONG MockFailAllocation;
+
+static LONG MockLive;
+static ULONG MockFullBuilds;
+static ULONG MockPartialBuilds;
+static ULONGLONG MockPagesLookedUp;
+static ULONG MockErrors;
+
+static ULONG Failures;
+
+static ULONGLONG Random = 0x2545f4914f6cdd1dULL;
+
+
+static VOID
+MockError (
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    fprintf( stderr, "csgdesc: " );
+
+    va_start( arguments, Format );
+    vfprintf( stderr, Format, arguments );
+    va_end( arguments );
+
+    fprintf( stderr, "\n" );
+
+    MockErrors++;
+}
+
+
+static BOOLEAN
+MockIsLive (
+    __in PMDL Mdl,
+    __in const char *Routine
+    )
+{
+    if (Mdl == NULL) {
+
+        MockError( "%s of a NULL MDL", Routine );
+        return FALSE;
+    }
+
+    if (Mdl->Magic == MOCK_MDL_FREED) {
+
+        MockError( "%s of an MDL already freed", Routine );
+        return FALSE;
+    }
+
+    if (Mdl->Magic != MOCK_MDL_LIVE) {
+
+        MockError( "%s of something not an MDL", Routine );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+PMDL
+csgMdlAllocate (
+    PVOID VirtualAddress,
+    ULONG Length
+    )
+{
+    PMDL mdl;
+
+    if (++MockAllocations == MockFailAllocation) {
+
+        return NULL;
+    }
+
+    mdl = calloc( 1, sizeof(MDL) );
+
+    if (mdl == NULL) {
+
+        return NULL;
+    }
+
+    mdl->Magic = MOCK_MDL_LIVE;
+    mdl->VirtualAddress = VirtualAddress;
+    mdl->Allocated = Length;
+    mdl->Length = Length;
+    mdl->Next = MockMdls;
+    MockMdls = mdl;
+
+    MockLive++;
+
+    return mdl;
+}
+
+
+VOID
+csgMdlBuildForNonPagedPool (
+    PMDL Mdl
+    )
+{
+    ULONG_PTR first;
+    ULONG_PTR last;
+
+    if (!MockIsLive( Mdl, "MmBuildMdlForNonPagedPool" )) {
+
+        return;
+    }
+
+    if (Mdl->Built) {
+
+        MockError( "MmBuildMdlForNonPagedPool of an MDL already built" );
+    }
+
+    first = (ULONG_PTR)Mdl->VirtualAddress / DESC_PAGE_SIZE;
+    last = ((ULONG_PTR)Mdl->VirtualAddress + Mdl->Length - 1) / DESC_PAGE_SIZE;
+
+    Mdl->Built = TRUE;
+
+    MockFullBuilds++;
+    MockPagesLookedUp += last - first + 1;
+}
+
+
+VOID
+csgMdlBuildPartial (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    )
+{
+    PUCHAR start = VirtualAddress;
+
+    if (!MockIsLive( SourceMdl, "IoBuildPartialMdl source" ) ||
+        !MockIsLive( TargetMdl, "IoBuildPartialMdl target" )) {
+
+        return;
+    }
+
+    if (!SourceMdl->Built) {
+
+        MockError( "partial MDL of an MDL that describes no pages" );
+    }
+
+    if ((Length == 0) ||
+        (start < SourceMdl->VirtualAddress) ||
+        (start + Length > SourceMdl->VirtualAddress + SourceMdl->Length)) {
+
+        MockError( "partial MDL of %u bytes outside its source", Length );
+    }
+
+    if ((TargetMdl->VirtualAddress != start) || (TargetMdl->Allocated < Length)) {
+
+        MockError( "partial MDL built into an MDL allocated for another range" );
+    }
+
+    if (TargetMdl->Built) {
+
+        MockError( "partial MDL built into an MDL already built" );
+    }
+
+    TargetMdl->Built = TRUE;
+    TargetMdl->Partial = TRUE;
+    TargetMdl->Length = Length;
+
+    MockPartialBuilds++;
+}
+
+
+VOID
+csgMdlPrepareForReuse (
+    PMDL Mdl
+    )
+{
+    if (!MockIsLive( Mdl, "MmPrepareMdlForReuse" )) {
+
+        return;
+    }
+
+    if (Mdl->Built && !Mdl->Partial) {
+
+        MockError( "MmPrepareMdlForReuse of an MDL built for nonpaged pool" );
+    }
+
+    Mdl->Built = FALSE;
+    Mdl->Partial = FALSE;
+}
+
+
+VOID
+csgMdlFree (
+    PMDL Mdl
+    )
+{
+    if (!MockIsLive( Mdl, "IoFreeMdl" )) {
+
+        return;
+    }
+
+    Mdl->Magic = MOCK_MDL_FREED;
+
+    MockLive--;
+}
+
+
+static VOID
+MockRelease (
+    VOID
+    )
+{
+    PMDL mdl;
+
+    while (MockMdls != NULL) {
+
+        mdl = MockMdls;
+        MockMdls = mdl->Next;
+
+        free( mdl );
+    }
+}
+
+
+/*************************************************************************
+    Checks
+*************************************************************************/
+
+static ULONG
+NextRandom (
+    VOID
+    )
+{
+    Random ^= Random << 13;
+    Random ^= Random >> 7;
+    Random ^= Random << 17;
+
+    return (ULONG)(Random >> 32);
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+static BOOLEAN
+CheckIoMdl (
+    __in PCSG_SWAP_DESC Descriptor,
+    __in PMDL Mdl,
+    __in ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Checks an MDL a descriptor gave out for an I/O of Length bytes.
+
+--*/
+{
+    if (Mdl == NULL) {
+
+        fprintf( stderr, "csgdesc: no MDL for %u bytes\n", Length );
+        return FALSE;
+    }
+
+    if (Mdl == Descriptor->Mdl) {
+
+        fprintf( stderr, "csgdesc: the descriptor's own MDL given out\n" );
+        return FALSE;
+    }
+
+    if (!Mdl->Partial ||
+        (Mdl->VirtualAddress != Descriptor->Buffer) ||
+        (Mdl->Length != Length)) {
+
+        fprintf( stderr, "csgdesc: the MDL for %u bytes does not describe them\n", Length );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+CheckClasses (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates a descriptor of each size class, and has each give out MDLs
+    of lengths from one byte to its capacity, each given back after use.
+
+--*/
+{
+    static CONST ULONG lengths[] = { 1, 511, 512, 4095, 4096, 4097, 65536, 65537, 1048575, 1048576 };
+    PCSG_SWAP_DESC desc;
+    ULONGLONG pages;
+    ULONGLONG spanned;
+    ULONGLONG created;
+    ULONG allocations;
+    PMDL mdl;
+    ULONG shift;
+    ULONG size;
+    ULONG given;
+    BOOLEAN passed;
+    ULONG i;
+
+    for (shift = CSG_BUFCACHE_MIN_SHIFT; shift <= CSG_BUFCACHE_MAX_SHIFT; shift++) {
+
+        size = 1UL << shift;
+        pages = MockPagesLookedUp;
+        allocations = MockAllocations;
+
+        desc = csgSwapDescCreate( size, DESC_CONTEXT );
+
+        if (desc == NULL) {
+
+            Report( FALSE, "descriptor of %u bytes created", size );
+            continue;
+        }
+
+        passed = (desc->Capacity == size) &&
+                 (desc->Buffer != NULL) &&
+                 (desc->Mdl != NULL) &&
+                 desc->Mdl->Built &&
+                 !desc->Mdl->Partial &&
+                 (desc->Mdl->VirtualAddress == desc->Buffer) &&
+                 (desc->Mdl->Length == size);
+
+        created = MockPagesLookedUp - pages;
+        given = 0;
+
+        for (i = 0; i < DESC_COUNT( lengths ); i++) {
+
+            if (lengths[i] > size) {
+
+                continue;
+            }
+
+            mdl = csgSwapDescBuildMdl( desc, lengths[i] );
+
+            passed = CheckIoMdl( desc, mdl, lengths[i] ) && passed;
+
+            //
+            //  The buffer is writable through what the MDL describes.
+            //
+
+            if (mdl != NULL) {
+
+                memset( mdl->VirtualAddress, (int)i, lengths[i] );
+                csgSwapDescKeepMdl( desc, mdl );
+            }
+
+            given++;
+        }
+
+        //
+        //  The pages the buffer spans, once, when it was created.
+        //
+
+        spanned = ((ULONG_PTR)desc->Buffer + size - 1) / DESC_PAGE_SIZE -
+                  (ULONG_PTR)desc->Buffer / DESC_PAGE_SIZE + 1;
+
+        passed = passed && (created == spanned) && (MockPagesLookedUp - pages == created);
+
+        //
+        //  Its own MDL, and one for all the I/Os.
+        //
+
+        passed = passed && (MockAllocations - allocations == 2);
+
+        Report( passed,
+                "descriptor of %u bytes, %llu pages looked up, %u MDLs given out, %u allocated",
+                size,
+                (unsigned long long)(MockPagesLookedUp - pages),
+                given,
+                MockAllocations - allocations );
+
+        csgSwapDescDestroy( desc, size, DESC_CONTEXT );
+    }
+}
+
+
+static VOID
+CheckFailures (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Fails the MDL allocation of csgSwapDescCreate and of
+    csgSwapDescBuildMdl, which must then still give out an MDL given
+    back to it.
+
+--*/
+{
+    PCSG_SWAP_DESC desc;
+    LONG live = MockLive;
+    BOOLEAN passed;
+    PMDL mdl;
+
+    MockFailAllocation = MockAllocations + 1;
+
+    desc = csgSwapDescCreate( 65536, DESC_CONTEXT );
+
+    passed = (desc == NULL) && (MockLive == live);
+
+    if (desc != NULL) {
+
+        csgSwapDescDestroy( desc, 65536, DESC_CONTEXT );
+    }
+
+    desc = csgSwapDescCreate( 65536, DESC_CONTEXT );
+
+    if (desc != NULL) {
+
+        MockFailAllocation = MockAllocations + 1;
+
+        passed = passed && (csgSwapDescBuildMdl( desc, 4096 ) == NULL);
+
+        mdl = csgSwapDescBuildMdl( desc, 4096 );
+
+        if (mdl != NULL) {
+
+            csgSwapDescKeepMdl( desc, mdl );
+        }
+
+        MockFailAllocation = MockAllocations + 1;
+
+        mdl = csgSwapDescBuildMdl( desc, 8192 );
+
+        passed = passed && CheckIoMdl( desc, mdl, 8192 );
+
+        if (mdl != NULL) {
+
+            csgSwapDescKeepMdl( desc, mdl );
+        }
+
+        csgSwapDescDestroy( desc, 65536, DESC_CONTEXT );
+
+    } else {
+
+        passed = FALSE;
+    }
+
+    MockFailAllocation = 0;
+
+    passed = passed && (MockLive == live);
+
+    Report( passed, "MDL allocation failures leave no MDL behind" );
+}
+
+
+typedef struct _DESC_IO {
+
+    PCSG_SWAP_DESC Descriptor;
+
+    PMDL Mdl;
+
+    ULONG Length;
+
+} DESC_IO, *PDESC_IO;
+
+
+static ULONG
+RandomLength (
+    VOID
+    )
+{
+    ULONG r = NextRandom();
+
+    //
+    //  Mostly up to 64 KB, some up to 1 MB, a few larger than any class.
+    //
+
+    switch (r % 16) {
+
+        case 0:     return CSG_BUFCACHE_MAX_SIZE + 1 + NextRandom() % CSG_BUFCACHE_MAX_SIZE;
+        case 1:
+        case 2:
+        case 3:     return 1 + NextRandom() % CSG_BUFCACHE_MAX_SIZE;
+        default:    return 1 + NextRandom() % 65536;
+    }
+}
+
+
+static VOID
+CheckCache (
+    __in ULONG Ios,
+    __in ULONG Outstanding
+    )
+/*++
+
+Routine Description:
+
+    Plays Ios I/Os through a swap buffer cache of descriptors, Outstanding
+    of them in flight at once.
+
+--*/
+{
+    DESC_IO inFlight[DESC_MAX_OUTSTANDING];
+    CSG_BUFCACHE_STATS stats;
+    PCSG_BUFCACHE cache;
+    PDESC_IO io;
+    ULONGLONG allocated;
+    ULONG fullBuilds;
+    ULONG partialBuilds;
+    ULONG allocations;
+    ULONG dropped = 0;
+    ULONG wrong = 0;
+    ULONG trims = 0;
+    ULONG n;
+    ULONG i;
+    ULONG c;
+
+    RtlZeroMemory( inFlight, sizeof(inFlight) );
+
+    if (!NT_SUCCESS( csgBufCacheCreate( DESC_CLASS_BYTES,
+                                        csgSwapDescCreate,
+                                        csgSwapDescDestroy,
+                                        DESC_CONTEXT,
+                                        &cache ) )) {
+
+        Report( FALSE, "swap buffer cache created" );
+        return;
+    }
+
+    fullBuilds = MockFullBuilds;
+    partialBuilds = MockPartialBuilds;
+    allocations = MockAllocations;
+
+    for (n = 0; n < Ios + Outstanding; n++) {
+
+        io = &inFlight[n % Outstanding];
+
+        //
+        //  Completion: the post-operation callback gives the MDL and
+        //  then the descriptor back.  One in eight leaves the MDL to the
+        //  filter manager, which frees it later.
+        //
+
+        if (io->Descriptor != NULL) {
+
+            if (NextRandom() % 8 != 0) {
+
+                csgSwapDescKeepMdl( io->Descriptor, io->Mdl );
+                io->Mdl = NULL;
+            }
+
+            csgBufCacheFree( cache, io->Descriptor, io->Length );
+
+            if (NextRandom() % 64 == 0) {
+
+                csgBufCacheTrim( cache );
+                trims++;
+            }
+
+            if (io->Mdl != NULL) {
+
+                csgMdlFree( io->Mdl );
+                dropped++;
+            }
+
+            io->Descriptor = NULL;
+        }
+
+        if (n >= Ios) {
+
+            continue;
+        }
+
+        io->Length = RandomLength();
+        io->Descriptor = csgBufCacheAllocate( cache, io->Length );
+
+        if (io->Descriptor == NULL) {
+
+            fprintf( stderr, "csgdesc: no descriptor for %u bytes\n", io->Length );
+            wrong++;
+            continue;
+        }
+
+        if (io->Descriptor->Capacity < io->Length) {
+
+            fprintf( stderr, "csgdesc: a descriptor of %u bytes for %u\n",
+                     io->Descriptor->Capacity, io->Length );
+            wrong++;
+        }
+
+        for (i = 0; i < Outstanding; i++) {
+
+            if ((&inFlight[i] != io) && (inFlight[i].Descriptor == io->Descriptor)) {
+
+                fprintf( stderr, "csgdesc: a descriptor given to two I/Os at once\n" );
+                wrong++;
+            }
+        }
+
+        io->Mdl = csgSwapDescBuildMdl( io->Descriptor, io->Length );
+
+        if (!CheckIoMdl( io->Descriptor, io->Mdl, io->Length )) {
+
+            wrong++;
+        }
+
+        if (io->Mdl == NULL) {
+
+            csgBufCacheFree( cache, io->Descriptor, io->Length );
+            io->Descriptor = NULL;
+        }
+    }
+
+    csgBufCacheQueryStats( cache, &stats );
+
+    allocated = stats.Oversize;
+
+    for (c = 0; c < CSG_BUFCACHE_CLASSES; c++) {
+
+        allocated += stats.Misses[c];
+    }
+
+    //
+    //  Each descriptor allocated its own MDL; past that, an I/O needs a
+    //  new MDL only for a new descriptor or after one was not given back.
+    //
+
+    allocations = MockAllocations - allocations - (ULONG)allocated;
+
+    Report( (wrong == 0) &&
+            (MockPartialBuilds - partialBuilds == Ios) &&
+            (MockFullBuilds - fullBuilds == allocated) &&
+            (allocations <= allocated + dropped),
+            "%u I/Os, %u descriptors allocated, %u MDLs for I/O allocated, %u left to the filter manager, %u trims, %u wrong",
+            Ios,
+            MockFullBuilds - fullBuilds,
+            allocations,
+            dropped,
+            trims,
+            wrong );
+
+    csgBufCacheDestroy( cache );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgdesc [-i ios] [-o outstanding]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    ULONG ios = 100000;
+    ULONG outstanding = 16;
+    int option;
+
+    while ((option = getopt( argc, argv, "i:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'i':   ios = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'o':   outstanding = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || outstanding == 0 || outstanding > DESC_MAX_OUTSTANDING) {
+
+        Usage();
+        return 2;
+    }
+
+    CheckClasses();
+    CheckFailures();
+    CheckCache( ios, outstanding );
+
+    Report( (MockLive == 0) && (MockErrors == 0),
+            "%u MDLs allocated, %d still live, %u misused",
+            MockAllocations,
+            MockLive,
+            MockErrors );
+
+    MockRelease();
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,646 @@
+/*++
+
+Module Name:
+
+    csghist.c
+
+Abstract:
+
+    Checks the latency histograms (csgHist.h): where values fall, how far
+    a percentile can be from the exact one, and that shards written by
+    many threads at once merge into exact counts.
+
+        csghist [-t threads] [-i values] [-n values]
+
+    Bucket bounds: every value up to 2^20, and random values above, must
+    fall in a bucket whose limits hold it; buckets must follow each other
+    without gaps; a bucket must be no wider than 1/16 of its smallest
+    value, or one value wide below 16; and values of 2^32 and up must all
+    go to the last bucket.
+
+    Percentiles: three values far apart, and sets of values spread
+    evenly, log-uniformly and in a few spikes, are recorded and sorted,
+    and each percentile read from the histogram must be no lower than the
+    exact one and no more than 1/16 above it.  Count and Sum must be
+    exact.
+
+    Merging: threads record values that depend only on the thread and
+    the value's number, some too large for any bucket, while another
+    thread takes snapshots and checks that no count ever goes back.  Once they are done the snapshot must
+    hold exactly the counts and sum that recording the same values on one
+    thread gives.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.
+
+        -t      threads recording at once, twice the processors unless
+                told, at most 64
+        -i      values each of them records, 1000000 unless told
+        -n      values in each percentile set, 100000 unless told
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csghist.c ../csgHist.c ../csgCpu.c \
+           -lpthread -o csghist
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csgHist.h"
+
+#define HIST_MAX_THREADS        64
+
+#define HIST_COUNT(_a)          (sizeof(_a) / sizeof((_a)[0]))
+#define HIST_MIN(_a, _b)        (((_a) < (_b)) ? (_a) : (_b))
+#define HIST_MAX(_a, _b)        (((_a) > (_b)) ? (_a) : (_b))
+
+//
+//  Every value below this is checked against its bucket.
+//
+
+#define HIST_EXHAUSTIVE         (1 << 20)
+
+//
+//  The percentiles checked, in parts per million.
+//
+
+static const ULONG Percentiles[] = {
+
+    1, 10000, 250000, 333333, 500000, 666667, 900000, 990000, 999000,
+    999900, 1000000
+};
+
+typedef struct _HIST_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+} HIST_THREAD, *PHIST_THREAD;
+
+static PCSG_HIST Hist;
+
+static ULONG Values = 1000000;
+
+static volatile BOOLEAN Stop;
+
+static ULONG Failures;
+
+
+static ULONGLONG
+NextRandom (
+    __inout PULONGLONG Random
+    )
+{
+    *Random ^= *Random << 13;
+    *Random ^= *Random >> 7;
+    *Random ^= *Random << 17;
+
+    return *Random;
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+static BOOLEAN
+InBucket (
+    __in ULONGLONG Value
+    )
+/*++
+
+Routine Description:
+
+    Checks that a value below 2^CSG_HIST_MAX_SHIFT lies within the limits
+    of its bucket.
+
+--*/
+{
+    ULONG bucket = csgHistBucket( Value );
+
+    if (bucket >= CSG_HIST_BUCKETS ||
+        Value > csgHistBucketLimit( bucket ) ||
+        (bucket > 0 && Value <= csgHistBucketLimit( bucket - 1 ))) {
+
+        printf( "       %llu went to bucket %u\n", (unsigned long long)Value, bucket );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+CheckBuckets (
+    VOID
+    )
+{
+    ULONGLONG random = 0x2545f4914f6cdd1dULL;
+    ULONGLONG value;
+    ULONGLONG low;
+    ULONGLONG width;
+    BOOLEAN passed = TRUE;
+    ULONG b;
+    ULONG i;
+
+    //
+    //  Each bucket starts one past the last one's limit and is narrow
+    //  enough for the 1/16 bound.
+    //
+
+    for (b = 0; b < CSG_HIST_BUCKETS && passed; b++) {
+
+        low = (b == 0) ? 0 : csgHistBucketLimit( b - 1 ) + 1;
+        width = csgHistBucketLimit( b ) + 1 - low;
+
+        if (csgHistBucket( low ) != b ||
+            csgHistBucket( csgHistBucketLimit( b ) ) != b ||
+            width == 0 ||
+            (low < CSG_HIST_SUB_COUNT && width != 1) ||
+            (low >= CSG_HIST_SUB_COUNT && width > low / CSG_HIST_SUB_COUNT)) {
+
+            printf( "       bucket %u: %llu to %llu\n",
+                    b,
+                    (unsigned long long)low,
+                    (unsigned long long)csgHistBucketLimit( b ) );
+
+            passed = FALSE;
+        }
+    }
+
+    Report( passed && csgHistBucketLimit( CSG_HIST_BUCKETS - 1 ) == ((ULONGLONG)1 << CSG_HIST_MAX_SHIFT) - 1,
+            "%u buckets follow each other, each at most 1/%u of its values wide",
+            CSG_HIST_BUCKETS,
+            CSG_HIST_SUB_COUNT );
+
+    passed = TRUE;
+
+    for (value = 0; value < HIST_EXHAUSTIVE && passed; value++) {
+
+        passed = InBucket( value );
+    }
+
+    for (i = 0; i < 1000000 && passed; i++) {
+
+        value = NextRandom( &random ) >> (64 - CSG_HIST_MAX_SHIFT + (i % CSG_HIST_MAX_SHIFT));
+
+        passed = InBucket( value );
+    }
+
+    Report( passed, "every value up to 2^20 and 10^6 random ones lie within their bucket" );
+
+    passed = TRUE;
+
+    for (i = 0; i < 64 - CSG_HIST_MAX_SHIFT; i++) {
+
+        if (csgHistBucket( (ULONGLONG)1 << (CSG_HIST_MAX_SHIFT + i) ) != CSG_HIST_BUCKETS - 1 ||
+            csgHistBucket( ((ULONGLONG)2 << (CSG_HIST_MAX_SHIFT + i)) - 1 ) != CSG_HIST_BUCKETS - 1) {
+
+            passed = FALSE;
+        }
+    }
+
+    Report( passed, "values of 2^%u and up go to the last bucket", CSG_HIST_MAX_SHIFT );
+}
+
+
+static int
+CompareValues (
+    const void *A,
+    const void *B
+    )
+{
+    ULONGLONG a = *(const ULONGLONG *)A;
+    ULONGLONG b = *(const ULONGLONG *)B;
+
+    return (a < b) ? -1 : (a > b);
+}
+
+
+static VOID
+CheckSet (
+    __in const char *Name,
+    __inout ULONGLONG *Set,
+    __in ULONG Count
+    )
+/*++
+
+Routine Description:
+
+    Records a set of values in a histogram of its own and checks every
+    percentile in Percentiles against the sorted set.
+
+--*/
+{
+    PCSG_HIST hist;
+    PCSG_HIST_SNAPSHOT snapshot;
+    ULONGLONG sum = 0;
+    ULONGLONG exact;
+    ULONGLONG reported;
+    ULONGLONG rank;
+    BOOLEAN passed = TRUE;
+    ULONG i;
+
+    snapshot = malloc( sizeof(CSG_HIST_SNAPSHOT) );
+
+    if (snapshot == NULL || !NT_SUCCESS( csgHistCreate( &hist ) )) {
+
+        fprintf( stderr, "csghist: out of memory\n" );
+        exit( 1 );
+    }
+
+    for (i = 0; i < Count; i++) {
+
+        csgHistRecord( hist, Set[i] );
+        sum += Set[i];
+    }
+
+    csgHistSnapshot( hist, snapshot );
+
+    qsort( Set, Count, sizeof(ULONGLONG), CompareValues );
+
+    for (i = 0; i < HIST_COUNT( Percentiles ); i++) {
+
+        //
+        //  The rank csgHistPercentile looks for: a share of the values,
+        //  rounded up, and at least the first.
+        //
+
+        rank = ((ULONGLONG)Count * Percentiles[i] + 999999) / 1000000;
+
+        if (rank == 0) {
+
+            rank = 1;
+        }
+
+        exact = Set[rank - 1];
+        reported = csgHistPercentile( snapshot, Percentiles[i] );
+
+        if (reported < exact || reported > exact + exact / CSG_HIST_SUB_COUNT) {
+
+            printf( "       %s, %u ppm: %llu exactly, %llu reported\n",
+                    Name,
+                    Percentiles[i],
+                    (unsigned long long)exact,
+                    (unsigned long long)reported );
+
+            passed = FALSE;
+        }
+    }
+
+    Report( passed && snapshot->Count == Count && snapshot->Sum == sum,
+            "%s: %u values, percentiles from %u to %u ppm within 1/%u above the exact ones",
+            Name,
+            Count,
+            Percentiles[0],
+            Percentiles[HIST_COUNT( Percentiles ) - 1],
+            CSG_HIST_SUB_COUNT );
+
+    csgHistDestroy( hist );
+    free( snapshot );
+}
+
+
+static VOID
+CheckPercentiles (
+    __in ULONG Count
+    )
+{
+    PCSG_HIST hist;
+    CSG_HIST_SNAPSHOT empty;
+    ULONGLONG random = 0x9e3779b97f4a7c15ULL;
+    ULONGLONG *set;
+    ULONG i;
+
+    set = malloc( HIST_MAX( Count, 3 ) * sizeof(ULONGLONG) );
+
+    if (set == NULL || !NT_SUCCESS( csgHistCreate( &hist ) )) {
+
+        fprintf( stderr, "csghist: out of memory\n" );
+        exit( 1 );
+    }
+
+    csgHistSnapshot( hist, &empty );
+
+    Report( empty.Count == 0 && csgHistPercentile( &empty, 500000 ) == 0,
+            "an empty histogram reports zero" );
+
+    csgHistDestroy( hist );
+
+    //
+    //  Each value its own third, so that a rank rounded the wrong way
+    //  reads the wrong one.
+    //
+
+    set[0] = 100000;
+    set[1] = 10;
+    set[2] = 1000;
+
+    CheckSet( "three values", set, 3 );
+
+    for (i = 0; i < Count; i++) {
+
+        set[i] = NextRandom( &random ) % 100000;
+    }
+
+    CheckSet( "uniform below 10^5", set, Count );
+
+    //
+    //  Spread over every power of two a histogram can tell apart, as
+    //  latencies from cache hits to stalled disks are.
+    //
+
+    for (i = 0; i < Count; i++) {
+
+        set[i] = NextRandom( &random ) >> (64 - CSG_HIST_MAX_SHIFT + (NextRandom( &random ) % CSG_HIST_MAX_SHIFT));
+    }
+
+    CheckSet( "log-uniform below 2^32", set, Count );
+
+    //
+    //  A few values many times over, at the edges of buckets.
+    //
+
+    for (i = 0; i < Count; i++) {
+
+        switch (NextRandom( &random ) % 4) {
+
+            case 0:     set[i] = 15; break;
+            case 1:     set[i] = 16; break;
+            case 2:     set[i] = csgHistBucketLimit( 200 ); break;
+            default:    set[i] = csgHistBucketLimit( 200 ) + 1; break;
+        }
+    }
+
+    CheckSet( "spikes at bucket edges", set, Count );
+
+    free( set );
+}
+
+
+static ULONGLONG
+ValueOf (
+    __in ULONG Thread,
+    __in ULONG Index
+    )
+{
+    ULONGLONG random = 0x2545f4914f6cdd1dULL * (((ULONGLONG)Thread << 32) + Index + 1);
+
+    //
+    //  Below 2^40, so that the last bucket takes some.
+    //
+
+    return NextRandom( &random ) >> (24 + Index % 40);
+}
+
+
+static PVOID
+RecordThread (
+    __in PVOID Parameter
+    )
+{
+    PHIST_THREAD thread = Parameter;
+    ULONG i;
+
+    for (i = 0; i < Values; i++) {
+
+        csgHistRecord( Hist, ValueOf( thread->Index, i ) );
+    }
+
+    return NULL;
+}
+
+
+static PVOID
+SnapshotThread (
+    __in PVOID Parameter
+    )
+/*++
+
+Routine Description:
+
+    Takes snapshots until told to stop, counting those in which a bucket
+    or the total went back since the one before.
+
+--*/
+{
+    PCSG_HIST_SNAPSHOT snapshots;
+    PCSG_HIST_SNAPSHOT last;
+    PCSG_HIST_SNAPSHOT next;
+    PULONG wentBack = Parameter;
+    ULONG b;
+
+    snapshots = calloc( 2, sizeof(CSG_HIST_SNAPSHOT) );
+
+    if (snapshots == NULL) {
+
+        fprintf( stderr, "csghist: out of memory\n" );
+        exit( 1 );
+    }
+
+    last = &snapshots[0];
+    next = &snapshots[1];
+
+    while (!__atomic_load_n( &Stop, __ATOMIC_ACQUIRE )) {
+
+        csgHistSnapshot( Hist, next );
+
+        for (b = 0; b < CSG_HIST_BUCKETS; b++) {
+
+            if (next->Buckets[b] < last->Buckets[b]) {
+
+                break;
+            }
+        }
+
+        if (b < CSG_HIST_BUCKETS || next->Count < last->Count) {
+
+            (*wentBack)++;
+        }
+
+        last = next;
+        next = (next == &snapshots[0]) ? &snapshots[1] : &snapshots[0];
+    }
+
+    free( snapshots );
+
+    return NULL;
+}
+
+
+static VOID
+CheckMerge (
+    __in ULONG ThreadCount
+    )
+{
+    PHIST_THREAD threads;
+    PCSG_HIST_SNAPSHOT merged;
+    PCSG_HIST_SNAPSHOT expected;
+    PCSG_HIST single;
+    pthread_t snapshotter;
+    ULONG wentBack = 0;
+    ULONG i;
+    ULONG t;
+
+    threads = calloc( ThreadCount, sizeof(HIST_THREAD) );
+    merged = malloc( sizeof(CSG_HIST_SNAPSHOT) );
+    expected = malloc( sizeof(CSG_HIST_SNAPSHOT) );
+
+    if (threads == NULL || merged == NULL || expected == NULL ||
+        !NT_SUCCESS( csgHistCreate( &Hist ) ) ||
+        !NT_SUCCESS( csgHistCreate( &single ) )) {
+
+        fprintf( stderr, "csghist: out of memory\n" );
+        exit( 1 );
+    }
+
+    if (pthread_create( &snapshotter, NULL, SnapshotThread, &wentBack ) != 0) {
+
+        fprintf( stderr, "csghist: cannot start the snapshot thread\n" );
+        exit( 1 );
+    }
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        threads[t].Index = t;
+
+        if (pthread_create( &threads[t].Thread, NULL, RecordThread, &threads[t] ) != 0) {
+
+            fprintf( stderr, "csghist: cannot start thread %u\n", t );
+            exit( 1 );
+        }
+    }
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        pthread_join( threads[t].Thread, NULL );
+    }
+
+    __atomic_store_n( &Stop, TRUE, __ATOMIC_RELEASE );
+    pthread_join( snapshotter, NULL );
+
+    csgHistSnapshot( Hist, merged );
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        for (i = 0; i < Values; i++) {
+
+            csgHistRecord( single, ValueOf( t, i ) );
+        }
+    }
+
+    csgHistSnapshot( single, expected );
+
+    Report( wentBack == 0 &&
+            merged->Count == (ULONGLONG)ThreadCount * Values &&
+            memcmp( merged, expected, sizeof(CSG_HIST_SNAPSHOT) ) == 0,
+            "%u threads of %u values: merged count %llu, %s buckets and sum, %u snapshots went back",
+            ThreadCount,
+            Values,
+            (unsigned long long)merged->Count,
+            (memcmp( merged, expected, sizeof(CSG_HIST_SNAPSHOT) ) == 0) ? "exact" : "wrong",
+            wentBack );
+
+    csgHistDestroy( single );
+    csgHistDestroy( Hist );
+
+    free( expected );
+    free( merged );
+    free( threads );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csghist [-t threads] [-i values] [-n values]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    ULONG threadCount = 0;
+    ULONG setCount = 100000;
+    int option;
+
+    while ((option = getopt( argc, argv, "t:i:n:" )) != -1) {
+
+        switch (option) {
+
+            case 't':   threadCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'i':   Values = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'n':   setCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (threadCount == 0) {
+
+        threadCount = HIST_MIN( 2 * csgCpuCount(), HIST_MAX_THREADS );
+    }
+
+    if (optind != argc || threadCount > HIST_MAX_THREADS || setCount == 0) {
+
+        Usage();
+        return 2;
+    }
+
+    CheckBuckets();
+
+    CheckPercentiles( setCount );
+
+    CheckMerge( threadCount );
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,1017 @@
+/*++
+
+Module Name:
+
+    csgkat.c
+
+Abstract:
+
+    Checks the ciphers against known answers and against reference
+    implementations of their modes.
+
+        csgkat [-f features] [-r rounds]
+
+    AES-256 is checked one block at a time, both ways, against the
+    examples of FIPS-197 and SP 800-38A.  On that block cipher, XTS
+    (IEEE 1619) and the driver's CTR are then built here the way the
+    standards describe them, a block at a time, and every provider of
+    every cipher this processor can run (each CPU tier reachable by
+    masking features, down to the portable ones) is checked against
+    them through its transform: enciphered out of place from an odd
+    address and in place, at both sector sizes, for lengths of one data
+    unit up to 256 KB (and, for CTR, lengths that end mid block), at data
+    units whose block counters carry past 32 bits, under random keys;
+    and deciphered back, both ways, to the plaintext.  XTS is also
+    checked against the first and last blocks of IEEE 1619 vector 10,
+    and CTR against the first block of SP 800-38A F.5.5, whose counter
+    block the driver's layout can express.
+
+    Key wrap is checked against the examples of RFC 3394 that wrap 128
+    and 256 bit keys under a 256 bit KEK, and it must unwrap what it
+    wrapped, and refuse a wrapped key with any bit of it flipped.
+
+    SHA-256 is checked against the one and two block examples of FIPS
+    180-2, hashed whole and a byte at a time, and HKDF against test cases
+    1 and 3 of RFC 5869, with the info of case 1 given in two pieces the
+    way the driver gives it; Expand must refuse more output than the RFC
+    allows.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.
+
+        -f      CSG_CPU_* features the providers may use, as the
+                driver's CpuFeatureMask
+        -r      random keys each provider is checked under, 4 unless
+                told
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgkat.c ../csgAes.c ../csgXts.c \
+           ../csgCtr.c ../csgProvider.c ../csgCpu.c ../csgTransform.c \
+           ../csgKeyWrap.c ../csgHkdf.c -o csgkat
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csgProvider.h"
+#include "csgKeyWrap.h"
+#include "csgHkdf.h"
+
+#define KAT_MAX_LENGTH          (256 * 1024)
+#define KAT_MAX_PROVIDERS       16
+
+#define KAT_COUNT(_a)           (sizeof(_a) / sizeof((_a)[0]))
+
+static CONST ULONG SectorSizes[] = { 512, 4096 };
+
+//
+//  Lengths in data units, and for CTR the bytes past them.
+//
+
+static CONST ULONG UnitCounts[] = { 1, 2, 3, 8, 31, 64 };
+
+static CONST ULONG CtrTails[] = { 0, 1, 15, 17, 100 };
+
+//
+//  First data units: zero, then the last ones whose block counters stay
+//  within 32 bits at 512 and 4096 byte sectors, so the longer runs carry
+//  past them, then one well above.
+//
+
+static CONST ULONGLONG DataUnits[] = { 0, 0x7fffffe, 0xfffffe, 0x123456789a };
+
+//
+//  The known answers, in hex.
+//
+
+typedef struct _KAT_BLOCK {
+
+    const char *Name;
+    const char *Key;
+    const char *Plain;
+    const char *Cipher;
+
+} KAT_BLOCK, *PKAT_BLOCK;
+
+static CONST KAT_BLOCK AesVectors[] = {
+
+    { "FIPS-197 C.3",
+      "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+      "00112233445566778899aabbccddeeff",
+      "8ea2b7ca516745bfeafc49904b496089" },
+
+    { "SP 800-38A F.1.5 block 1",
+      "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+      "6bc1bee22e409f96e93d7e117393172a",
+      "f3eed1bdb5d2a03c064b5a7e3db181f8" },
+
+    { "SP 800-38A F.1.5 block 2",
+      "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+      "ae2d8a571e03ac9c9eb76fac45af8e51",
+      "591ccb10d410ed26dc5ba74a31362870" }
+};
+
+//
+//  IEEE 1619 vector 10: Key1 || Key2, data unit 0xff of 512 bytes, whose
+//  plaintext is the bytes 0 to 255 twice.
+//
+
+#define XTS_VECTOR_KEY          "27182818284590452353602874713526624977572470936999595749669676273141592653589793238462643383279502884197169399375105820974944592"
+#define XTS_VECTOR_DATA_UNIT    0xff
+#define XTS_VECTOR_FIRST        "1c3b3a102f770386e4836c99e370cf9bea00803f5e482357a4ae12d414a3e63b"
+#define XTS_VECTOR_LAST         "773dad38014bd2092fa755c824bb5e54c4f36ffda9fcea70b9c6e693e148c151"
+
+//
+//  SP 800-38A F.5.5: its initial counter block f0f1...feff is block
+//  0xf7f6f5f4f3f2f1f0 under the nonce 0xfffefdfcfbfaf9f8 in the driver's
+//  LE64(block) || LE64(nonce) layout.  The next ones differ, since the
+//  example counts big endian.
+//
+
+#define CTR_VECTOR_KEY          "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4f8f9fafbfcfdfeff"
+#define CTR_VECTOR_BLOCK        0xf7f6f5f4f3f2f1f0ULL
+#define CTR_VECTOR_PLAIN        "6bc1bee22e409f96e93d7e117393172a"
+#define CTR_VECTOR_CIPHER       "601ec313775789a5b7a7f504bbf3d228"
+
+//
+//  RFC 3394 4.3 and 4.6, both under the KEK 000102...1f.
+//
+
+#define WRAP_VECTOR_KEK         "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+
+static CONST KAT_BLOCK WrapVectors[] = {
+
+    { "RFC 3394 4.3",
+      WRAP_VECTOR_KEK,
+      "00112233445566778899aabbccddeeff",
+      "64e8c3f9ce0f5ba263e9777905818a2a93c8191e7d6e8ae7" },
+
+    { "RFC 3394 4.6",
+      WRAP_VECTOR_KEK,
+      "00112233445566778899aabbccddeeff000102030405060708090a0b0c0d0e0f",
+      "28c9f404c4b810f4cbccb35cfb87f8263f5786e2d80ed326cbc7f0e71a99f43bfb988b9b7a02dd21" }
+};
+
+//
+//  FIPS 180-2 B.1 and B.2.
+//
+
+static CONST KAT_BLOCK Sha256Vectors[] = {
+
+    { "FIPS 180-2 B.1",
+      NULL,
+      "abc",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+
+    { "FIPS 180-2 B.2",
+      NULL,
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" }
+};
+
+//
+//  RFC 5869 A.1 and A.3.
+//
+
+typedef struct _KAT_HKDF {
+
+    const char *Name;
+    const char *Ikm;
+    const char *Salt;
+    const char *Info;
+    const char *Prk;
+    const char *Okm;
+
+} KAT_HKDF, *PKAT_HKDF;
+
+static CONST KAT_HKDF HkdfVectors[] = {
+
+    { "RFC 5869 A.1",
+      "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
+      "000102030405060708090a0b0c",
+      "f0f1f2f3f4f5f6f7f8f9",
+      "077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5",
+      "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865" },
+
+    { "RFC 5869 A.3",
+      "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
+      "",
+      "",
+      "19ef24a32c717b167f33a91d6f648bdf96596776afdb6377ac434c1c293ccb04",
+      "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d9d201395faa4b61a96c8" }
+};
+
+typedef struct _KAT_PROVIDER {
+
+    ULONG Cipher;
+
+    PCCSG_TRANSFORM Transform;
+
+} KAT_PROVIDER, *PKAT_PROVIDER;
+
+static KAT_PROVIDER Providers[KAT_MAX_PROVIDERS];
+static ULONG ProviderCount;
+
+static ULONGLONG Random = 0x9e3779b97f4a7c15ULL;
+
+static ULONG Failures;
+
+
+static ULONG
+NextRandom (
+    VOID
+    )
+{
+    Random ^= Random << 13;
+    Random ^= Random >> 7;
+    Random ^= Random << 17;
+
+    return (ULONG)(Random >> 32);
+}
+
+
+static VOID
+FillRandom (
+    __out_bcount(Length) PUCHAR Buffer,
+    __in SIZE_T Length
+    )
+{
+    SIZE_T i;
+
+    for (i = 0; i < Length; i++) {
+
+        Buffer[i] = (UCHAR)NextRandom();
+    }
+}
+
+
+static ULONG
+Unhex (
+    __in const char *Hex,
+    __out PUCHAR Bytes
+    )
+{
+    ULONG length = 0;
+    unsigned int byte;
+
+    while (Hex[0] != '\0' && Hex[1] != '\0' && sscanf( Hex, "%2x", &byte ) == 1) {
+
+        Bytes[length++] = (UCHAR)byte;
+        Hex += 2;
+    }
+
+    return length;
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+/*************************************************************************
+    Reference modes
+*************************************************************************/
+
+static VOID
+ReferenceXts (
+    __in PCCSG_XTS_KEY Key,
+    __in BOOLEAN Encrypt,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    XTS-AES as IEEE 1619 gives it: each data unit's tweak is its number,
+    little endian, enciphered with Key2; each block is XORed with the
+    tweak before and after the block cipher, and the tweak multiplied by
+    alpha in GF(2^128) from one block to the next.
+
+--*/
+{
+    UCHAR tweak[CSG_AES_BLOCK_SIZE];
+    UCHAR block[CSG_AES_BLOCK_SIZE];
+    SIZE_T offset;
+    ULONG carry;
+    ULONG next;
+    ULONG i;
+
+    for (offset = 0; offset < Length; offset++) {
+
+        if (offset % DataUnitSize == 0) {
+
+            RtlZeroMemory( tweak, sizeof(tweak) );
+
+            for (i = 0; i < 8; i++) {
+
+                tweak[i] = (UCHAR)((DataUnit + offset / DataUnitSize) >> (8 * i));
+            }
+
+            csgAesEncryptBlock( &Key->TweakKey, tweak, tweak );
+        }
+
+        if (offset % CSG_AES_BLOCK_SIZE != 0) {
+
+            continue;
+        }
+
+        for (i = 0; i < CSG_AES_BLOCK_SIZE; i++) {
+
+            block[i] = In[offset + i] ^ tweak[i];
+        }
+
+        if (Encrypt) {
+
+            csgAesEncryptBlock( &Key->DataKey, block, block );
+
+        } else {
+
+            csgAesDecryptBlock( &Key->DataKey, block, block );
+        }
+
+        for (i = 0; i < CSG_AES_BLOCK_SIZE; i++) {
+
+            Out[offset + i] = block[i] ^ tweak[i];
+        }
+
+        carry = 0;
+
+        for (i = 0; i < CSG_AES_BLOCK_SIZE; i++) {
+
+            next = tweak[i] >> 7;
+            tweak[i] = (UCHAR)((tweak[i] << 1) | carry);
+            carry = next;
+        }
+
+        if (carry != 0) {
+
+            tweak[0] ^= 0x87;
+        }
+    }
+}
+
+
+static VOID
+ReferenceCtr (
+    __in PCCSG_CTR_KEY Key,
+    __in ULONGLONG BlockIndex,
+    __in_bcount(Length) CONST UCHAR *In,
+    __out_bcount(Length) UCHAR *Out,
+    __in SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    CTR as csgCtr.c lays the counter out: the keystream block for block
+    BlockIndex of the file is the encipherment of LE64(BlockIndex) ||
+    LE64(Nonce).
+
+--*/
+{
+    UCHAR counter[CSG_AES_BLOCK_SIZE];
+    SIZE_T offset;
+    ULONG i;
+
+    for (offset = 0; offset < Length; offset++) {
+
+        if (offset % CSG_AES_BLOCK_SIZE == 0) {
+
+            for (i = 0; i < 8; i++) {
+
+                counter[i] = (UCHAR)((BlockIndex + offset / CSG_AES_BLOCK_SIZE) >> (8 * i));
+                counter[i + 8] = (UCHAR)(Key->Nonce >> (8 * i));
+            }
+
+            csgAesEncryptBlock( &Key->Key, counter, counter );
+        }
+
+        Out[offset] = In[offset] ^ counter[offset % CSG_AES_BLOCK_SIZE];
+    }
+}
+
+
+/*************************************************************************
+    Checks
+*************************************************************************/
+
+static VOID
+CheckAes (
+    VOID
+    )
+{
+    UCHAR key[CSG_AES_MAX_KEY_SIZE];
+    UCHAR plain[CSG_AES_BLOCK_SIZE];
+    UCHAR cipher[CSG_AES_BLOCK_SIZE];
+    UCHAR block[CSG_AES_BLOCK_SIZE];
+    CSG_AES_KEY aesKey;
+    BOOLEAN passed;
+    ULONG i;
+
+    for (i = 0; i < KAT_COUNT( AesVectors ); i++) {
+
+        Unhex( AesVectors[i].Key, key );
+        Unhex( AesVectors[i].Plain, plain );
+        Unhex( AesVectors[i].Cipher, cipher );
+
+        csgAesSetKey( &aesKey, key, sizeof(key) );
+
+        csgAesEncryptBlock( &aesKey, plain, block );
+        passed = (memcmp( block, cipher, sizeof(block) ) == 0);
+
+        csgAesDecryptBlock( &aesKey, cipher, block );
+        passed = passed && (memcmp( block, plain, sizeof(block) ) == 0);
+
+        csgAesEncryptBlocks( &aesKey, plain, block, 1 );
+        passed = passed && (memcmp( block, cipher, sizeof(block) ) == 0);
+
+        csgAesDecryptBlocks( &aesKey, cipher, block, 1 );
+        passed = passed && (memcmp( block, plain, sizeof(block) ) == 0);
+
+        Report( passed, "aes-256 %s", AesVectors[i].Name );
+
+        csgAesClearKey( &aesKey );
+    }
+}
+
+
+static VOID
+CheckKeyWrap (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Wraps the keys of the RFC 3394 examples and unwraps them back, then
+    flips each bit of the wrapped form in turn and expects every one of
+    them refused.
+
+--*/
+{
+    UCHAR kekBytes[CSG_AES_MAX_KEY_SIZE];
+    UCHAR key[CSG_XTS_KEY_SIZE];
+    UCHAR expected[CSG_XTS_KEY_SIZE + CSG_KEYWRAP_OVERHEAD];
+    UCHAR wrapped[CSG_XTS_KEY_SIZE + CSG_KEYWRAP_OVERHEAD];
+    UCHAR unwrapped[CSG_XTS_KEY_SIZE];
+    CSG_AES_KEY kek;
+    ULONG keyLength;
+    ULONG refused;
+    BOOLEAN passed;
+    ULONG i;
+    ULONG b;
+
+    for (i = 0; i < KAT_COUNT( WrapVectors ); i++) {
+
+        Unhex( WrapVectors[i].Key, kekBytes );
+        keyLength = Unhex( WrapVectors[i].Plain, key );
+        Unhex( WrapVectors[i].Cipher, expected );
+
+        csgAesSetKey( &kek, kekBytes, sizeof(kekBytes) );
+
+        passed = NT_SUCCESS( csgKeyWrap( &kek, key, keyLength, wrapped ) ) &&
+                 (memcmp( wrapped, expected, keyLength + CSG_KEYWRAP_OVERHEAD ) == 0);
+
+        passed = passed &&
+                 NT_SUCCESS( csgKeyUnwrap( &kek, expected, keyLength + CSG_KEYWRAP_OVERHEAD, unwrapped ) ) &&
+                 (memcmp( unwrapped, key, keyLength ) == 0);
+
+        refused = 0;
+
+        for (b = 0; b < 8 * (keyLength + CSG_KEYWRAP_OVERHEAD); b++) {
+
+            memcpy( wrapped, expected, keyLength + CSG_KEYWRAP_OVERHEAD );
+            wrapped[b / 8] ^= (UCHAR)(1 << (b % 8));
+
+            if (!NT_SUCCESS( csgKeyUnwrap( &kek, wrapped, keyLength + CSG_KEYWRAP_OVERHEAD, unwrapped ) )) {
+
+                refused++;
+            }
+        }
+
+        passed = passed && (refused == 8 * (keyLength + CSG_KEYWRAP_OVERHEAD));
+
+        Report( passed, "key wrap %s, %u of %u flipped bits refused",
+                WrapVectors[i].Name,
+                refused,
+                8 * (keyLength + CSG_KEYWRAP_OVERHEAD) );
+
+        csgAesClearKey( &kek );
+    }
+
+    //
+    //  A random file key of the size the driver wraps, under a random KEK.
+    //
+
+    FillRandom( kekBytes, sizeof(kekBytes) );
+    FillRandom( key, sizeof(key) );
+
+    csgAesSetKey( &kek, kekBytes, sizeof(kekBytes) );
+
+    passed = NT_SUCCESS( csgKeyWrap( &kek, key, sizeof(key), wrapped ) ) &&
+             NT_SUCCESS( csgKeyUnwrap( &kek, wrapped, sizeof(wrapped), unwrapped ) ) &&
+             (memcmp( unwrapped, key, sizeof(key) ) == 0);
+
+    Report( passed, "key wrap of a random %u byte key round trip", (ULONG)sizeof(key) );
+
+    csgAesClearKey( &kek );
+    csgSecureZeroMemory( key, sizeof(key) );
+    csgSecureZeroMemory( unwrapped, sizeof(unwrapped) );
+}
+
+
+static VOID
+CheckHkdf (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Hashes the FIPS 180-2 examples whole and a byte at a time, then runs
+    Extract and Expand on the RFC 5869 test cases.
+
+--*/
+{
+    UCHAR ikm[64];
+    UCHAR salt[64];
+    UCHAR info[64];
+    UCHAR expected[128];
+    UCHAR output[CSG_HKDF_MAX_OUTPUT + 1];
+    UCHAR prk[CSG_SHA256_DIGEST_SIZE];
+    CSG_HKDF_INFO pieces[2];
+    CSG_SHA256 sha;
+    const char *message;
+    ULONG ikmLength;
+    ULONG saltLength;
+    ULONG infoLength;
+    ULONG okmLength;
+    BOOLEAN passed;
+    ULONG i;
+    SIZE_T b;
+
+    for (i = 0; i < KAT_COUNT( Sha256Vectors ); i++) {
+
+        message = Sha256Vectors[i].Plain;
+        Unhex( Sha256Vectors[i].Cipher, expected );
+
+        csgSha256Init( &sha );
+        csgSha256Update( &sha, message, strlen( message ) );
+        csgSha256Final( &sha, output );
+
+        passed = (memcmp( output, expected, CSG_SHA256_DIGEST_SIZE ) == 0);
+
+        csgSha256Init( &sha );
+
+        for (b = 0; b < strlen( message ); b++) {
+
+            csgSha256Update( &sha, message + b, 1 );
+        }
+
+        csgSha256Final( &sha, output );
+
+        passed = passed && (memcmp( output, expected, CSG_SHA256_DIGEST_SIZE ) == 0);
+
+        Report( passed, "sha-256 %s", Sha256Vectors[i].Name );
+    }
+
+    for (i = 0; i < KAT_COUNT( HkdfVectors ); i++) {
+
+        ikmLength = Unhex( HkdfVectors[i].Ikm, ikm );
+        saltLength = Unhex( HkdfVectors[i].Salt, salt );
+        infoLength = Unhex( HkdfVectors[i].Info, info );
+
+        csgHkdfExtract( (saltLength != 0) ? salt : NULL, saltLength, ikm, ikmLength, prk );
+
+        Unhex( HkdfVectors[i].Prk, expected );
+        passed = (memcmp( prk, expected, sizeof(prk) ) == 0);
+
+        pieces[0].Data = info;
+        pieces[0].Length = infoLength / 2;
+        pieces[1].Data = info + infoLength / 2;
+        pieces[1].Length = infoLength - infoLength / 2;
+
+        okmLength = Unhex( HkdfVectors[i].Okm, expected );
+
+        passed = passed &&
+                 NT_SUCCESS( csgHkdfExpand( prk, pieces, (infoLength != 0) ? 2 : 0, output, okmLength ) ) &&
+                 (memcmp( output, expected, okmLength ) == 0);
+
+        Report( passed, "hkdf %s", HkdfVectors[i].Name );
+    }
+
+    passed = NT_SUCCESS( csgHkdfExpand( prk, NULL, 0, output, CSG_HKDF_MAX_OUTPUT ) ) &&
+             !NT_SUCCESS( csgHkdfExpand( prk, NULL, 0, output, CSG_HKDF_MAX_OUTPUT + 1 ) );
+
+    Report( passed, "hkdf expands to %u bytes and no further", CSG_HKDF_MAX_OUTPUT );
+}
+
+
+static VOID
+CheckVectors (
+    __in PKAT_PROVIDER Provider
+    )
+/*++
+
+Routine Description:
+
+    Runs a provider on the known answer of its cipher, both ways.
+
+--*/
+{
+    PCCSG_TRANSFORM transform = Provider->Transform;
+    UCHAR keyBytes[CSG_XTS_KEY_SIZE];
+    UCHAR plain[512];
+    UCHAR expected[32];
+    UCHAR output[512];
+    CSG_XTS_KEY xtsKey;
+    CSG_CTR_KEY ctrKey;
+    BOOLEAN passed;
+    ULONG i;
+
+    if (Provider->Cipher == CSG_CIPHER_XTS) {
+
+        Unhex( XTS_VECTOR_KEY, keyBytes );
+        csgXtsSetKey( &xtsKey, keyBytes );
+
+        for (i = 0; i < sizeof(plain); i++) {
+
+            plain[i] = (UCHAR)i;
+        }
+
+        transform->Encrypt( &xtsKey, XTS_VECTOR_DATA_UNIT, sizeof(plain), plain, output, sizeof(plain) );
+
+        Unhex( XTS_VECTOR_FIRST, expected );
+        passed = (memcmp( output, expected, 32 ) == 0);
+
+        Unhex( XTS_VECTOR_LAST, expected );
+        passed = passed && (memcmp( output + sizeof(plain) - 32, expected, 32 ) == 0);
+
+        transform->Decrypt( &xtsKey, XTS_VECTOR_DATA_UNIT, sizeof(plain), output, output, sizeof(plain) );
+        passed = passed && (memcmp( output, plain, sizeof(plain) ) == 0);
+
+        Report( passed, "%s IEEE 1619 vector 10", transform->Name );
+
+        csgXtsClearKey( &xtsKey );
+
+    } else {
+
+        Unhex( CTR_VECTOR_KEY, keyBytes );
+        csgCtrSetKey( &ctrKey, keyBytes );
+
+        Unhex( CTR_VECTOR_PLAIN, plain );
+        Unhex( CTR_VECTOR_CIPHER, expected );
+
+        //
+        //  A data unit of one block makes the data unit the block index.
+        //
+
+        transform->Encrypt( &ctrKey, CTR_VECTOR_BLOCK, CSG_AES_BLOCK_SIZE, plain, output, CSG_AES_BLOCK_SIZE );
+        passed = (memcmp( output, expected, CSG_AES_BLOCK_SIZE ) == 0);
+
+        transform->Decrypt( &ctrKey, CTR_VECTOR_BLOCK, CSG_AES_BLOCK_SIZE, output, output, CSG_AES_BLOCK_SIZE );
+        passed = passed && (memcmp( output, plain, CSG_AES_BLOCK_SIZE ) == 0);
+
+        Report( passed, "%s SP 800-38A F.5.5 block 1", transform->Name );
+
+        csgCtrClearKey( &ctrKey );
+    }
+}
+
+
+static const char *
+CheckLength (
+    __in PKAT_PROVIDER Provider,
+    __in CONST VOID *Key,
+    __in ULONGLONG DataUnit,
+    __in ULONG DataUnitSize,
+    __in SIZE_T Length,
+    __in PUCHAR Plain,
+    __in PUCHAR Expected,
+    __in PUCHAR Output
+    )
+/*++
+
+Routine Description:
+
+    Enciphers Length bytes of Plain, from an odd address, with the
+    reference mode and with the provider, out of place and in place, and
+    deciphers the result back both ways.
+
+    Plain, Expected and Output have a byte more than Length.
+
+Return Value:
+
+    NULL if the provider agreed with the reference, else what it got
+    wrong.
+
+--*/
+{
+    PCCSG_TRANSFORM transform = Provider->Transform;
+
+    if (Provider->Cipher == CSG_CIPHER_XTS) {
+
+        ReferenceXts( Key, TRUE, DataUnit, DataUnitSize, Plain + 1, Expected, Length );
+
+    } else {
+
+        ReferenceCtr( Key, DataUnit * (DataUnitSize / CSG_AES_BLOCK_SIZE), Plain + 1, Expected, Length );
+    }
+
+    transform->Encrypt( Key, DataUnit, DataUnitSize, Plain + 1, Output, Length );
+
+    if (memcmp( Output, Expected, Length ) != 0) {
+
+        return "enciphers differently";
+    }
+
+    memcpy( Output + 1, Plain + 1, Length );
+
+    transform->Encrypt( Key, DataUnit, DataUnitSize, Output + 1, Output + 1, Length );
+
+    if (memcmp( Output + 1, Expected, Length ) != 0) {
+
+        return "enciphers differently in place";
+    }
+
+    transform->Decrypt( Key, DataUnit, DataUnitSize, Expected, Output, Length );
+
+    if (memcmp( Output, Plain + 1, Length ) != 0) {
+
+        return "does not decipher back";
+    }
+
+    memcpy( Output + 1, Expected, Length );
+
+    transform->Decrypt( Key, DataUnit, DataUnitSize, Output + 1, Output + 1, Length );
+
+    if (memcmp( Output + 1, Plain + 1, Length ) != 0) {
+
+        return "does not decipher back in place";
+    }
+
+    return NULL;
+}
+
+
+static VOID
+CheckReference (
+    __in PKAT_PROVIDER Provider,
+    __in ULONG Rounds
+    )
+/*++
+
+Routine Description:
+
+    Checks a provider against the reference mode of its cipher under
+    Rounds random keys, at every sector size, length and first data unit.
+
+--*/
+{
+    UCHAR keyBytes[CSG_XTS_KEY_SIZE];
+    CSG_XTS_KEY xtsKey;
+    CSG_CTR_KEY ctrKey;
+    CONST VOID *key;
+    PUCHAR plain = malloc( KAT_MAX_LENGTH + 1 );
+    PUCHAR expected = malloc( KAT_MAX_LENGTH + 1 );
+    PUCHAR output = malloc( KAT_MAX_LENGTH + 1 );
+    const char *wrong;
+    ULONG checked = 0;
+    ULONG failed = 0;
+    ULONG tailCount;
+    SIZE_T length;
+    ULONG r, s, u, d, t;
+
+    if (plain == NULL || expected == NULL || output == NULL) {
+
+        fprintf( stderr, "csgkat: out of memory\n" );
+        exit( 1 );
+    }
+
+    tailCount = (Provider->Cipher == CSG_CIPHER_CTR) ? KAT_COUNT( CtrTails ) : 1;
+
+    for (r = 0; r < Rounds; r++) {
+
+        FillRandom( keyBytes, sizeof(keyBytes) );
+
+        if (Provider->Cipher == CSG_CIPHER_XTS) {
+
+            csgXtsSetKey( &xtsKey, keyBytes );
+            key = &xtsKey;
+
+        } else {
+
+            csgCtrSetKey( &ctrKey, keyBytes );
+            key = &ctrKey;
+        }
+
+        for (s = 0; s < KAT_COUNT( SectorSizes ); s++) {
+
+            for (u = 0; u < KAT_COUNT( UnitCounts ); u++) {
+
+                for (t = 0; t < tailCount; t++) {
+
+                    length = (SIZE_T)UnitCounts[u] * SectorSizes[s] + CtrTails[t];
+
+                    if (length > KAT_MAX_LENGTH) {
+
+                        continue;
+                    }
+
+                    FillRandom( plain, length + 1 );
+
+                    for (d = 0; d < KAT_COUNT( DataUnits ); d++) {
+
+                        checked++;
+
+                        wrong = CheckLength( Provider,
+                                             key,
+                                             DataUnits[d],
+                                             SectorSizes[s],
+                                             length,
+                                             plain,
+                                             expected,
+                                             output );
+
+                        if (wrong != NULL && failed++ == 0) {
+
+                            printf( "       %s %s first at data unit 0x%llx of %u bytes, %zu bytes\n",
+                                    Provider->Transform->Name,
+                                    wrong,
+                                    (unsigned long long)DataUnits[d],
+                                    SectorSizes[s],
+                                    length );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    Report( failed == 0,
+            "%s against the reference, %u runs, %u differed",
+            Provider->Transform->Name,
+            checked,
+            failed );
+
+    csgSecureZeroMemory( keyBytes, sizeof(keyBytes) );
+    csgXtsClearKey( &xtsKey );
+    csgCtrClearKey( &ctrKey );
+
+    free( plain );
+    free( expected );
+    free( output );
+}
+
+
+static VOID
+FindProviders (
+    __in ULONG Features
+    )
+/*++
+
+Routine Description:
+
+    Lists the providers reachable with subsets of Features, by taking
+    away the features the better tiers need one at a time.
+
+--*/
+{
+    static CONST ULONG tiers[] = {
+
+        CSG_CPU_ALL,
+        CSG_CPU_ALL & ~CSG_CPU_AVX512,
+        CSG_CPU_ALL & ~(CSG_CPU_AVX512 | CSG_CPU_VAES),
+        CSG_CPU_ALL & ~(CSG_CPU_AVX512 | CSG_CPU_VAES | CSG_CPU_AVX2),
+        0
+    };
+    static CONST ULONG ciphers[] = { CSG_CIPHER_XTS, CSG_CIPHER_CTR };
+    PCCSG_TRANSFORM transform;
+    ULONG c;
+    ULONG t;
+    ULONG i;
+
+    for (c = 0; c < KAT_COUNT( ciphers ); c++) {
+
+        for (t = 0; t < KAT_COUNT( tiers ); t++) {
+
+            transform = csgProviderSelect( ciphers[c], Features & tiers[t] );
+
+            for (i = 0; i < ProviderCount; i++) {
+
+                if (Providers[i].Transform == transform) {
+
+                    break;
+                }
+            }
+
+            if (transform != NULL && i == ProviderCount && ProviderCount < KAT_MAX_PROVIDERS) {
+
+                Providers[ProviderCount].Cipher = ciphers[c];
+                Providers[ProviderCount].Transform = transform;
+                ProviderCount++;
+            }
+        }
+    }
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgkat [-f features] [-r rounds]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    ULONG features = csgCpuQueryFeatures();
+    ULONG rounds = 4;
+    ULONG i;
+    int option;
+
+    while ((option = getopt( argc, argv, "f:r:" )) != -1) {
+
+        switch (option) {
+
+            case 'f':   features &= (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'r':   rounds = (ULONG)strtoul( optarg, NULL, 0 ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || rounds == 0) {
+
+        Usage();
+        return 2;
+    }
+
+    printf( "features 0x%x\n", features );
+
+    CheckAes();
+    CheckKeyWrap();
+    CheckHkdf();
+
+    FindProviders( features );
+
+    for (i = 0; i < ProviderCount; i++) {
+
+        CheckVectors( &Providers[i] );
+        CheckReference( &Providers[i], rounds );
+    }
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
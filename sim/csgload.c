@@ -0,0 +1,1012 @@
+/*++
+
+Module Name:
+
+    csgload.c
+
+Abstract:
+
+    Drives a synthetic load through the driver in the filter manager
+    simulation and reports how it scales with threads.
+
+        csgload [-k] [-a xts|ctr] [-n] [-l] [-s sector] [-w mix] [-r percent]
+                [-u percent] [-f size] [-d seconds] [-t threads,...]
+                [-o bytes] [-p bytes] [-q depth] [-x ext,...] [-b] [-g] [-v]
+                directory
+
+    Each thread has a file of its own, written whole before the runs.  A
+    run starts the threads together and has each send operations back to
+    back for the duration; every operation picks a size class of the mix
+    by weight, a read or a write, and cached or noncached.
+
+        -w      the mix: size:rand|seq=weight,...  Sizes take k and m.
+                Random offsets are multiples of the size; sequential ones
+                carry on where the thread's last operation of that class
+                ended, back to the start at the end of the file.  The
+                default, 4k:rand=60,64k:rand=30,1m:seq=10.
+        -r      percent of reads, 70 unless told
+        -u      percent of noncached operations, 0 unless told; the rest
+                are cached
+        -f      size of each thread's file, 4m unless told
+        -d      seconds per run, 5 unless told
+        -t      thread counts, one run for each, from 1 to 128; the
+                default, 1,2,4,8 and so on up to twice the processors
+        -a      cipher, XTS unless told.  CTR needs -x, and the driver
+                refuses writes before the end of the files it protects with
+                it (see csgCtr.h), so with -x dat and -k it needs -r 100
+        -n      the driver's NoncachedOnly
+        -l      the driver's LockUserBuffers
+        -s      the volume's sector size, 512 or 4096
+        -o      the driver's OffloadThreshold, 0 to encipher every write
+                inline
+        -p      the driver's ParallelReadThreshold, 0 to decipher every
+                read on one thread
+        -q      the driver's CryptoQueueDepth
+        -x      the driver's ProtectedExtensions; the files are named
+                csgload<n>.dat, so with dat they are protected and with any
+                other extension they are not
+        -b      no driver at all, the baseline the runs through it are
+                measured against
+        -g      the driver's StageTiming, and the stage costs of each run
+        -v      the driver's DbgPrint output
+
+    A line per run gives operations and megabytes per second, the 50th,
+    99th and 99.9th percentile latencies of reads and writes, and what the
+    driver asked of the allocators: pool allocations per operation under
+    the driver's tags, the share of swap buffer requests the buffer cache
+    served itself, and the requests too large for it; and the share of
+    operations the crypto workers enciphered while the write was pended,
+    the writes that found the workers' queue full, and the share of
+    operations that were reads deciphered in chunks with the workers.
+    What is read is not checked; csgsim does that.
+
+    What the driver costs a file it does not protect is the difference
+    between a run with -b and one with -x naming an extension the files do
+    not have: the throughput and latencies should match, and the driver
+    should allocate nothing.  With -b the driver's columns are zero.
+
+    With -g, a line per stage of the read and write paths that ran
+    follows, with how often it ran in the run and its mean, 50th and 99th
+    percentile cost in nanoseconds.  Without -k the transform stages are
+    the copy the driver makes of data it does not encipher, the baseline
+    for the stages enciphering with -k.
+
+    Built from the top of the tree as
+
+        cc -O2 -std=gnu11 -fshort-wchar -Wno-incompatible-pointer-types \
+           -Isim -I. sim/csgsimKernel.c sim/csgsimFlt.c sim/csgsimCapture.c \
+           sim/csgload.c csgctl/csgcapture.c csg*.c -lpthread -o csgload
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgsim.h"
+
+#include "../csgGlobal.h"
+#include "../csgStruct.h"
+#include "../csgHist.h"
+#include "../csgBufCache.h"
+#include "../csgStats.h"
+
+#define LOAD_MAX_THREADS        128
+#define LOAD_MAX_CLASSES        8
+#define LOAD_MAX_RUNS           16
+#define LOAD_FILL_CHUNK         (1024 * 1024)
+
+//
+//  The driver runs in this process; its buffer cache is asked for its
+//  counters, and its statistics read, directly.
+//
+
+extern PCSG_BUFCACHE SwapBufferCache;
+extern PCSG_STATS_CPU StatsCpu;
+extern ULONG StatsCpuCount;
+
+//
+//  The pool tags the driver allocates under on its I/O paths.
+//
+
+static CONST ULONG DriverTags[] = { BUFFER_SWAP_TAG, CONTEXT_TAG, NAME_TAG, PRE_2_POST_TAG };
+
+static CONST PCSTR StageNames[CSG_STAGE_COUNT] = {
+
+    "read allocate",
+    "read mdl",
+    "read transform",
+    "read post wait",
+    "write allocate",
+    "write mdl",
+    "write transform"
+};
+
+//
+//  The stage costs when the run started and when it ended.
+//
+
+static CSG_HIST_SNAPSHOT StageStart[CSG_STAGE_COUNT];
+static CSG_HIST_SNAPSHOT StageEnd[CSG_STAGE_COUNT];
+
+typedef struct _LOAD_CLASS {
+
+    ULONG Size;
+
+    BOOLEAN Sequential;
+
+    ULONG Weight;
+
+} LOAD_CLASS, *PLOAD_CLASS;
+
+typedef struct _LOAD_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+    PSIM_FILE File;
+
+    PUCHAR Buffer;
+
+    ULONGLONG Random;
+
+    //
+    //  Where each sequential class goes next.
+    //
+
+    LONGLONG Cursor[LOAD_MAX_CLASSES];
+
+    ULONGLONG Operations;
+
+    ULONGLONG Bytes;
+
+    ULONGLONG Failures;
+
+} LOAD_THREAD, *PLOAD_THREAD;
+
+static LOAD_CLASS Classes[LOAD_MAX_CLASSES];
+static ULONG ClassCount;
+static ULONG TotalWeight;
+static ULONG ReadPercent = 70;
+static ULONG NoncachedPercent;
+static LONGLONG FileSize = 4 * 1024 * 1024;
+static ULONG MaxSize;
+static BOOLEAN KeysSet;
+static LONG OffloadThreshold = -1;
+static LONG ParallelReadThreshold = -1;
+static BOOLEAN LockUserBuffers;
+static ULONG QueueDepth;
+static BOOLEAN StageTiming;
+static BOOLEAN Baseline;
+
+//
+//  Latency of the current run, in nanoseconds.
+//
+
+static PCSG_HIST ReadLatency;
+static PCSG_HIST WriteLatency;
+
+static pthread_barrier_t StartBarrier;
+static volatile BOOLEAN Stop;
+
+
+static ULONGLONG
+Nanoseconds (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (ULONGLONG)now.tv_sec * 1000000000ULL + (ULONGLONG)now.tv_nsec;
+}
+
+
+static ULONG
+NextRandom (
+    __inout PLOAD_THREAD Thread
+    )
+{
+    Thread->Random ^= Thread->Random << 13;
+    Thread->Random ^= Thread->Random >> 7;
+    Thread->Random ^= Thread->Random << 17;
+
+    return (ULONG)(Thread->Random >> 16);
+}
+
+
+static ULONG
+ParseSize (
+    __in PCSTR Text,
+    __out_opt PCSTR *End
+    )
+{
+    char *end;
+    ULONGLONG size = strtoull( Text, &end, 0 );
+
+    if (*end == 'k' || *end == 'K') {
+
+        size *= 1024;
+        end++;
+
+    } else if (*end == 'm' || *end == 'M') {
+
+        size *= 1024 * 1024;
+        end++;
+    }
+
+    if (End != NULL) {
+
+        *End = end;
+    }
+
+    return (size > MAXULONG) ? 0 : (ULONG)size;
+}
+
+
+static BOOLEAN
+ParseMix (
+    __in PCSTR Text
+    )
+/*++
+
+Routine Description:
+
+    Parses a mix, size:rand|seq=weight separated by commas, into Classes.
+    The weight may be left out and counts as one.
+
+--*/
+{
+    PLOAD_CLASS class;
+
+    ClassCount = 0;
+    TotalWeight = 0;
+
+    while (*Text != '\0') {
+
+        if (ClassCount == LOAD_MAX_CLASSES) {
+
+            return FALSE;
+        }
+
+        class = &Classes[ClassCount];
+        class->Size = ParseSize( Text, &Text );
+
+        if (class->Size == 0 || *Text++ != ':') {
+
+            return FALSE;
+        }
+
+        if (strncmp( Text, "rand", 4 ) == 0) {
+
+            class->Sequential = FALSE;
+
+        } else if (strncmp( Text, "seq", 3 ) == 0) {
+
+            class->Sequential = TRUE;
+
+        } else {
+
+            return FALSE;
+        }
+
+        Text += class->Sequential ? 3 : 4;
+        class->Weight = 1;
+
+        if (*Text == '=') {
+
+            class->Weight = (ULONG)strtoul( Text + 1, (char **)&Text, 10 );
+        }
+
+        if (*Text == ',') {
+
+            Text++;
+
+        } else if (*Text != '\0') {
+
+            return FALSE;
+        }
+
+        TotalWeight += class->Weight;
+        MaxSize = max( MaxSize, class->Size );
+        ClassCount++;
+    }
+
+    return ClassCount != 0 && TotalWeight != 0;
+}
+
+
+static VOID
+RunOperation (
+    __inout PLOAD_THREAD Thread
+    )
+{
+    PLOAD_CLASS class;
+    ULONG pick = NextRandom( Thread ) % TotalWeight;
+    ULONG c;
+    LONGLONG offset;
+    ULONG flags;
+    ULONG transferred = 0;
+    BOOLEAN read;
+    ULONGLONG start;
+    ULONGLONG elapsed;
+    NTSTATUS status;
+
+    for (c = 0; pick >= Classes[c].Weight; c++) {
+
+        pick -= Classes[c].Weight;
+    }
+
+    class = &Classes[c];
+
+    if (class->Sequential) {
+
+        if (Thread->Cursor[c] + class->Size > FileSize) {
+
+            Thread->Cursor[c] = 0;
+        }
+
+        offset = Thread->Cursor[c];
+        Thread->Cursor[c] += class->Size;
+
+    } else {
+
+        offset = (LONGLONG)(NextRandom( Thread ) % (ULONG)(FileSize / class->Size)) * class->Size;
+    }
+
+    read = (NextRandom( Thread ) % 100) < ReadPercent;
+    flags = ((NextRandom( Thread ) % 100) < NoncachedPercent) ? SIM_IO_NONCACHED : 0;
+
+    start = Nanoseconds();
+
+    if (read) {
+
+        status = SimRead( Thread->File, offset, class->Size, Thread->Buffer, flags, &transferred );
+
+    } else {
+
+        status = SimWrite( Thread->File, offset, class->Size, Thread->Buffer, flags, &transferred );
+    }
+
+    elapsed = Nanoseconds() - start;
+
+    csgHistRecord( read ? ReadLatency : WriteLatency, elapsed );
+
+    if (!NT_SUCCESS( status )) {
+
+        Thread->Failures++;
+    }
+
+    Thread->Operations++;
+    Thread->Bytes += transferred;
+}
+
+
+static PVOID
+LoadThread (
+    __in PVOID Parameter
+    )
+{
+    PLOAD_THREAD thread = Parameter;
+
+    pthread_barrier_wait( &StartBarrier );
+
+    while (!Stop) {
+
+        RunOperation( thread );
+    }
+
+    return NULL;
+}
+
+
+static int
+PrepareThreads (
+    __in PSIM_VOLUME Volume,
+    __in PLOAD_THREAD Threads,
+    __in ULONG ThreadCount
+    )
+/*++
+
+Routine Description:
+
+    Creates each thread's file and writes it whole, so reads find data.
+
+--*/
+{
+    CHAR name[32];
+    LONGLONG offset;
+    ULONG length;
+    ULONG i;
+    NTSTATUS status;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Index = i;
+        Threads[i].Random = 0x9e3779b97f4a7c15ULL * (i + 1);
+        Threads[i].Buffer = aligned_alloc( PAGE_SIZE, max( MaxSize, LOAD_FILL_CHUNK ) );
+
+        if (Threads[i].Buffer == NULL) {
+
+            return 1;
+        }
+
+        getrandom( Threads[i].Buffer, max( MaxSize, LOAD_FILL_CHUNK ), 0 );
+
+        snprintf( name, sizeof(name), "csgload%u.dat", i );
+
+        status = SimOpenFile( Volume,
+                              name,
+                              SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                              &Threads[i].File );
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgload: cannot create %s: %08x\n", name, (unsigned)status );
+            return 1;
+        }
+
+        for (offset = 0; offset < FileSize; offset += length) {
+
+            length = (ULONG)min( (LONGLONG)LOAD_FILL_CHUNK, FileSize - offset );
+
+            status = SimWrite( Threads[i].File, offset, length, Threads[i].Buffer, 0, NULL );
+
+            if (!NT_SUCCESS( status )) {
+
+                fprintf( stderr, "csgload: cannot fill %s: %08x\n", name, (unsigned)status );
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static ULONGLONG
+DriverAllocations (
+    VOID
+    )
+{
+    SIM_POOL_USAGE usage;
+    ULONGLONG allocations = 0;
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF( DriverTags ); i++) {
+
+        SimQueryPool( DriverTags[i], &usage );
+
+        allocations += usage.TotalAllocations;
+    }
+
+    return allocations;
+}
+
+
+static VOID
+SumCache (
+    __out PULONGLONG Hits,
+    __out PULONGLONG Misses,
+    __out PULONGLONG Oversize
+    )
+{
+    CSG_BUFCACHE_STATS stats;
+    ULONG i;
+
+    *Hits = 0;
+    *Misses = 0;
+    *Oversize = 0;
+
+    if (SwapBufferCache == NULL) {
+
+        return;
+    }
+
+    csgBufCacheQueryStats( SwapBufferCache, &stats );
+
+    for (i = 0; i < CSG_BUFCACHE_CLASSES; i++) {
+
+        *Hits += stats.Hits[i];
+        *Misses += stats.Misses[i];
+    }
+
+    *Oversize = stats.Oversize;
+}
+
+
+static VOID
+SumOffload (
+    __out PULONGLONG Offloaded,
+    __out PULONGLONG QueueFull,
+    __out PULONGLONG Split
+    )
+{
+    ULONG i;
+
+    *Offloaded = 0;
+    *QueueFull = 0;
+    *Split = 0;
+
+    for (i = 0; i < StatsCpuCount; i++) {
+
+        *Offloaded += StatsCpu[i].OffloadedWrites;
+        *QueueFull += StatsCpu[i].OffloadQueueFull;
+        *Split += StatsCpu[i].ParallelReads;
+    }
+}
+
+
+static VOID
+SnapshotStages (
+    __out_ecount(CSG_STAGE_COUNT) PCSG_HIST_SNAPSHOT Snapshots
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < CSG_STAGE_COUNT; i++) {
+
+        csgHistSnapshot( StageCost[i], &Snapshots[i] );
+    }
+}
+
+
+static VOID
+ShowStages (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Prints what each stage cost during the run: the difference between
+    the snapshots taken when it started and when it ended.
+
+--*/
+{
+    ULONGLONG frequency = g_Global.TimestampFrequency;
+    PCSG_HIST_SNAPSHOT run;
+    ULONG i;
+    ULONG b;
+
+    for (i = 0; i < CSG_STAGE_COUNT; i++) {
+
+        run = &StageEnd[i];
+
+        run->Count -= StageStart[i].Count;
+        run->Sum -= StageStart[i].Sum;
+
+        for (b = 0; b < CSG_HIST_BUCKETS; b++) {
+
+            run->Buckets[b] -= StageStart[i].Buckets[b];
+        }
+
+        if (run->Count == 0) {
+
+            continue;
+        }
+
+        printf( "        %-16s %10llu runs %9llu ns mean %9llu ns p50 %9llu ns p99\n",
+                StageNames[i],
+                (unsigned long long)run->Count,
+                (unsigned long long)csgTimestampToNanoseconds( run->Sum / run->Count, frequency ),
+                (unsigned long long)csgTimestampToNanoseconds( csgHistPercentile( run, 500000 ), frequency ),
+                (unsigned long long)csgTimestampToNanoseconds( csgHistPercentile( run, 990000 ), frequency ) );
+    }
+}
+
+
+static int
+Run (
+    __in PLOAD_THREAD Threads,
+    __in ULONG ThreadCount,
+    __in ULONG Seconds
+    )
+{
+    CSG_HIST_SNAPSHOT reads;
+    CSG_HIST_SNAPSHOT writes;
+    ULONGLONG allocations[2];
+    ULONGLONG hits[2];
+    ULONGLONG misses[2];
+    ULONGLONG oversize[2];
+    ULONGLONG offloaded[2];
+    ULONGLONG queueFull[2];
+    ULONGLONG split[2];
+    ULONGLONG operations = 0;
+    ULONGLONG bytes = 0;
+    ULONGLONG failures = 0;
+    ULONGLONG requests;
+    ULONGLONG start;
+    double seconds;
+    ULONG i;
+
+    if (!NT_SUCCESS( csgHistCreate( &ReadLatency ) ) ||
+        !NT_SUCCESS( csgHistCreate( &WriteLatency ) )) {
+
+        return 1;
+    }
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        Threads[i].Operations = 0;
+        Threads[i].Bytes = 0;
+        Threads[i].Failures = 0;
+    }
+
+    Stop = FALSE;
+    pthread_barrier_init( &StartBarrier, NULL, ThreadCount + 1 );
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        if (pthread_create( &Threads[i].Thread, NULL, LoadThread, &Threads[i] ) != 0) {
+
+            fprintf( stderr, "csgload: cannot start thread %u\n", i );
+            exit( 1 );
+        }
+    }
+
+    allocations[0] = DriverAllocations();
+    SumCache( &hits[0], &misses[0], &oversize[0] );
+    SumOffload( &offloaded[0], &queueFull[0], &split[0] );
+
+    if (StageTiming) {
+
+        SnapshotStages( StageStart );
+    }
+
+    pthread_barrier_wait( &StartBarrier );
+
+    start = Nanoseconds();
+
+    sleep( Seconds );
+
+    Stop = TRUE;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        pthread_join( Threads[i].Thread, NULL );
+
+        operations += Threads[i].Operations;
+        bytes += Threads[i].Bytes;
+        failures += Threads[i].Failures;
+    }
+
+    seconds = (Nanoseconds() - start) / 1e9;
+
+    allocations[1] = DriverAllocations();
+    SumCache( &hits[1], &misses[1], &oversize[1] );
+    SumOffload( &offloaded[1], &queueFull[1], &split[1] );
+
+    if (StageTiming) {
+
+        SnapshotStages( StageEnd );
+    }
+
+    pthread_barrier_destroy( &StartBarrier );
+
+    csgHistSnapshot( ReadLatency, &reads );
+    csgHistSnapshot( WriteLatency, &writes );
+
+    csgHistDestroy( ReadLatency );
+    csgHistDestroy( WriteLatency );
+
+    requests = (hits[1] - hits[0]) + (misses[1] - misses[0]) + (oversize[1] - oversize[0]);
+
+    printf( "%7u %10.0f %8.1f %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f %9.2f %7.1f %8llu %7.1f %7llu %7.1f\n",
+            ThreadCount,
+            operations / seconds,
+            bytes / seconds / 1e6,
+            csgHistPercentile( &reads, 500000 ) / 1e3,
+            csgHistPercentile( &reads, 990000 ) / 1e3,
+            csgHistPercentile( &reads, 999000 ) / 1e3,
+            csgHistPercentile( &writes, 500000 ) / 1e3,
+            csgHistPercentile( &writes, 990000 ) / 1e3,
+            csgHistPercentile( &writes, 999000 ) / 1e3,
+            operations ? (double)(allocations[1] - allocations[0]) / operations : 0.0,
+            requests ? 100.0 * (hits[1] - hits[0]) / requests : 0.0,
+            (unsigned long long)(oversize[1] - oversize[0]),
+            operations ? 100.0 * (offloaded[1] - offloaded[0]) / operations : 0.0,
+            (unsigned long long)(queueFull[1] - queueFull[0]),
+            operations ? 100.0 * (split[1] - split[0]) / operations : 0.0 );
+
+    if (StageTiming) {
+
+        ShowStages();
+    }
+
+    fflush( stdout );
+
+    if (failures != 0) {
+
+        fprintf( stderr, "csgload: %llu operations failed\n", (unsigned long long)failures );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static VOID
+SetParameters (
+    __in PCSTR Cipher,
+    __in BOOLEAN NoncachedOnly,
+    __in_opt PCSTR Extensions
+    )
+{
+    UCHAR key[64];
+    WCHAR multiSz[256];
+    ULONG count = 0;
+    BOOLEAN isCtr = (strcmp( Cipher, "ctr" ) == 0);
+
+    SimSetParameterDword( "DebugFlags", 0 );
+    SimSetParameterDword( "NoncachedOnly", NoncachedOnly );
+    SimSetParameterDword( "LockUserBuffers", LockUserBuffers );
+    SimSetParameterDword( "CipherAlgorithm", isCtr ? 1 : 0 );
+    SimSetParameterDword( "StageTiming", StageTiming );
+
+    if (OffloadThreshold >= 0) {
+
+        SimSetParameterDword( "OffloadThreshold", (ULONG)OffloadThreshold );
+    }
+
+    if (ParallelReadThreshold >= 0) {
+
+        SimSetParameterDword( "ParallelReadThreshold", (ULONG)ParallelReadThreshold );
+    }
+
+    if (QueueDepth != 0) {
+
+        SimSetParameterDword( "CryptoQueueDepth", QueueDepth );
+    }
+
+    if (KeysSet) {
+
+        getrandom( key, sizeof(key), 0 );
+        SimSetParameter( "CipherKey", REG_BINARY, key, isCtr ? 40 : 64 );
+
+        getrandom( key, 32, 0 );
+        SimSetParameter( "WrappingKey", REG_BINARY, key, 32 );
+
+        RtlSecureZeroMemory( key, sizeof(key) );
+    }
+
+    //
+    //  Extensions go in as a REG_MULTI_SZ.
+    //
+
+    if (Extensions != NULL) {
+
+        while (*Extensions != '\0' && count < RTL_NUMBER_OF( multiSz ) - 2) {
+
+            multiSz[count++] = (*Extensions == ',') ? UNICODE_NULL : (WCHAR)*Extensions;
+            Extensions++;
+        }
+
+        multiSz[count++] = UNICODE_NULL;
+        multiSz[count++] = UNICODE_NULL;
+
+        SimSetParameter( "ProtectedExtensions", REG_MULTI_SZ, multiSz, count * sizeof(WCHAR) );
+    }
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgload [-k] [-a xts|ctr] [-n] [-l] [-s sector] [-w mix] [-r percent]\n"
+             "               [-u percent] [-f size] [-d seconds] [-t threads,...]\n"
+             "               [-o bytes] [-p bytes] [-q depth] [-x ext,...] [-b] [-g] [-v]\n"
+             "               directory\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    PCSTR cipher = "xts";
+    PCSTR mix = "4k:rand=60,64k:rand=30,1m:seq=10";
+    PCSTR counts = NULL;
+    PCSTR extensions = NULL;
+    BOOLEAN noncachedOnly = FALSE;
+    ULONG sectorSize = 512;
+    ULONG seconds = 5;
+    ULONG runs[LOAD_MAX_RUNS];
+    ULONG runCount = 0;
+    ULONG maxThreads = 0;
+    PLOAD_THREAD threads;
+    PSIM_VOLUME volume;
+    ULONG failures = 0;
+    ULONG leaks;
+    ULONG i;
+    int option;
+    NTSTATUS status;
+
+    SimSetDebugOutput( FALSE );
+
+    while ((option = getopt( argc, argv, "ka:nls:w:r:u:f:d:t:o:p:q:x:bgv" )) != -1) {
+
+        switch (option) {
+
+            case 'k':   KeysSet = TRUE; break;
+            case 'a':   cipher = optarg; break;
+            case 'n':   noncachedOnly = TRUE; break;
+            case 'l':   LockUserBuffers = TRUE; break;
+            case 's':   sectorSize = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'w':   mix = optarg; break;
+            case 'r':   ReadPercent = (ULONG)strtoul( optarg, NULL, 10 ); break;
+            case 'u':   NoncachedPercent = (ULONG)strtoul( optarg, NULL, 10 ); break;
+            case 'f':   FileSize = ParseSize( optarg, NULL ); break;
+            case 'd':   seconds = (ULONG)strtoul( optarg, NULL, 10 ); break;
+            case 't':   counts = optarg; break;
+            case 'o':   OffloadThreshold = (LONG)ParseSize( optarg, NULL ); break;
+            case 'p':   ParallelReadThreshold = (LONG)ParseSize( optarg, NULL ); break;
+            case 'q':   QueueDepth = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'x':   extensions = optarg; break;
+            case 'b':   Baseline = TRUE; break;
+            case 'g':   StageTiming = TRUE; break;
+            case 'v':   SimSetDebugOutput( TRUE ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (counts != NULL) {
+
+        while (*counts != '\0' && runCount < LOAD_MAX_RUNS) {
+
+            runs[runCount] = (ULONG)strtoul( counts, (char **)&counts, 10 );
+
+            if (runs[runCount] == 0 || runs[runCount] > LOAD_MAX_THREADS ||
+                (*counts != ',' && *counts != '\0')) {
+
+                Usage();
+                return 2;
+            }
+
+            counts += (*counts == ',');
+            runCount++;
+        }
+
+    } else {
+
+        for (i = 1; i <= min( 2 * sysconf( _SC_NPROCESSORS_ONLN ), LOAD_MAX_THREADS ); i *= 2) {
+
+            runs[runCount++] = i;
+        }
+    }
+
+    for (i = 0; i < runCount; i++) {
+
+        maxThreads = max( maxThreads, runs[i] );
+    }
+
+    //
+    //  Noncached I/O has to be in whole sectors, which the sizes and the
+    //  offsets, multiples of the sizes, then are.
+    //
+
+    if (optind + 1 != argc ||
+        (strcmp( cipher, "xts" ) != 0 && strcmp( cipher, "ctr" ) != 0) ||
+        (sectorSize != 512 && sectorSize != 4096) ||
+        !ParseMix( mix ) ||
+        ReadPercent > 100 || NoncachedPercent > 100 ||
+        FileSize < MaxSize || seconds == 0 || runCount == 0 ||
+        OffloadThreshold < -1 || ParallelReadThreshold < -1 || QueueDepth > 0x10000 ||
+        (Baseline && (StageTiming || extensions != NULL)) ||
+        (!Baseline && strcmp( cipher, "ctr" ) == 0 && extensions == NULL)) {
+
+        Usage();
+        return 2;
+    }
+
+    for (i = 0; i < ClassCount; i++) {
+
+        if (Classes[i].Size % sectorSize != 0) {
+
+            fprintf( stderr, "csgload: %u is not a whole number of %u byte sectors\n",
+                     Classes[i].Size, sectorSize );
+            return 2;
+        }
+    }
+
+    SetParameters( cipher, noncachedOnly, extensions );
+
+    status = SimMountVolume( argv[optind], (USHORT)sectorSize, FLT_FSTYPE_NTFS, &volume );
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgload: cannot mount %s: %08x\n", argv[optind], (unsigned)status );
+        return 1;
+    }
+
+    if (!Baseline) {
+
+        status = SimLoadDriver();
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgload: DriverEntry failed: %08x\n", (unsigned)status );
+            return 1;
+        }
+    }
+
+    threads = calloc( maxThreads, sizeof(LOAD_THREAD) );
+
+    if (threads == NULL || PrepareThreads( volume, threads, maxThreads ) != 0) {
+
+        fprintf( stderr, "csgload: cannot set up the threads\n" );
+        return 1;
+    }
+
+    if (Baseline) {
+
+        printf( "mix %s, %u%% reads, %u%% noncached, %u byte sectors, no driver\n",
+                mix, ReadPercent, NoncachedPercent, sectorSize );
+
+    } else {
+
+        printf( "mix %s, %u%% reads, %u%% noncached, %u byte sectors, %s%s, %s\n",
+                mix, ReadPercent, NoncachedPercent, sectorSize, cipher, KeysSet ? "" : " (no key)",
+                extensions != NULL ? "protecting only the listed extensions" : "protecting every file" );
+    }
+
+    printf( "%7s %10s %8s %23s %23s %9s %7s %8s %15s %7s\n",
+            "", "", "", "read us", "write us", "pool", "cache", "", "offload", "split" );
+    printf( "%7s %10s %8s %7s %7s %7s %7s %7s %7s %9s %7s %8s %7s %7s %7s\n",
+            "threads", "ops/s", "MB/s", "p50", "p99", "p99.9", "p50", "p99", "p99.9",
+            "allocs/op", "hit %", "oversize", "ops %", "full", "ops %" );
+
+    for (i = 0; i < runCount; i++) {
+
+        failures += Run( threads, runs[i], seconds );
+    }
+
+    for (i = 0; i < maxThreads; i++) {
+
+        if (threads[i].File != NULL) {
+
+            SimCloseFile( threads[i].File );
+        }
+
+        free( threads[i].Buffer );
+    }
+
+    free( threads );
+
+    if (!Baseline) {
+
+        status = SimUnloadDriver();
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgload: unload failed: %08x\n", (unsigned)status );
+            failures++;
+        }
+    }
+
+    SimDismountVolume( volume );
+
+    leaks = SimReportLeaks( TRUE );
+
+    return (failures != 0 || leaks != 0);
+}
@@ -0,0 +1,507 @@
+/*++
+
+Module Name:
+
+    csgrcu.c
+
+Abstract:
+
+    Stress checks the read-copy-update grace periods (csgRcu.h) the way
+    the driver uses them for its configuration: readers load a published
+    object inside read sections while a writer keeps publishing new ones
+    and retiring the old once csgRcuSynchronize returns.
+
+        csgrcu [-r readers] [-p publishes] [-n]
+
+    Every object carries its version and values derived from it.  Once a
+    grace period has passed the writer poisons the object it replaced,
+    the way the driver wipes an old configuration's keys, but keeps it
+    allocated until the end, so that a reader still holding it sees the
+    poison rather than whatever reused the memory.  Readers check the
+    object when they load it and again before they leave the section;
+    some sections are held across a yield or a sleep, and on more than
+    one processor some end on another processor than they began on.
+
+    No reader may ever see a poisoned object, the versions a reader sees
+    must never go back, and every publish must have finished.  The time
+    each grace period took is reported.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.
+
+        -r      reader threads, 8 unless told, at most 64
+        -p      objects the writer publishes, 2000 unless told
+        -n      retire objects without waiting for a grace period; the
+                run must then fail, which shows the check can tell
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgrcu.c ../csgRcu.c ../csgCpu.c \
+           -lpthread -o csgrcu
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgRcu.h"
+
+#define RCU_MAX_READERS         64
+
+#define RCU_LIVE                0x6576694c
+#define RCU_POISONED            0x6e736950
+
+#define RCU_VALUES              6
+
+typedef struct _RCU_OBJECT {
+
+    volatile ULONG Magic;
+
+    ULONG Version;
+
+    volatile ULONGLONG Values[RCU_VALUES];
+
+} RCU_OBJECT, *PRCU_OBJECT;
+
+typedef struct _RCU_READER {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+    ULONGLONG Sections;
+
+    ULONGLONG Poisoned;
+
+    ULONGLONG WentBack;
+
+    ULONGLONG Moved;
+
+} RCU_READER, *PRCU_READER;
+
+static PCSG_RCU Rcu;
+
+static pthread_barrier_t Start;
+
+static PRCU_OBJECT volatile Current;
+
+static volatile BOOLEAN Stop;
+
+static ULONG Failures;
+
+
+static ULONGLONG
+Derive (
+    __in ULONG Version,
+    __in ULONG Index
+    )
+{
+    ULONGLONG value = ((ULONGLONG)Version << 32 | Index) * 0x9e3779b97f4a7c15ULL;
+
+    return value ^ (value >> 29);
+}
+
+
+static PRCU_OBJECT
+NewObject (
+    __in ULONG Version
+    )
+{
+    PRCU_OBJECT object = malloc( sizeof(RCU_OBJECT) );
+    ULONG i;
+
+    if (object == NULL) {
+
+        fprintf( stderr, "csgrcu: out of memory\n" );
+        exit( 1 );
+    }
+
+    object->Magic = RCU_LIVE;
+    object->Version = Version;
+
+    for (i = 0; i < RCU_VALUES; i++) {
+
+        object->Values[i] = Derive( Version, i );
+    }
+
+    return object;
+}
+
+
+static VOID
+Poison (
+    __inout PRCU_OBJECT Object
+    )
+{
+    ULONG i;
+
+    Object->Magic = RCU_POISONED;
+
+    for (i = 0; i < RCU_VALUES; i++) {
+
+        Object->Values[i] = 0;
+    }
+}
+
+
+static BOOLEAN
+Intact (
+    __in PRCU_OBJECT Object
+    )
+{
+    ULONG i;
+
+    if (Object->Magic != RCU_LIVE) {
+
+        return FALSE;
+    }
+
+    for (i = 0; i < RCU_VALUES; i++) {
+
+        if (Object->Values[i] != Derive( Object->Version, i )) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static ULONG
+NextRandom (
+    __inout PULONGLONG Random
+    )
+{
+    *Random ^= *Random << 13;
+    *Random ^= *Random >> 7;
+    *Random ^= *Random << 17;
+
+    return (ULONG)(*Random >> 32);
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+static VOID
+MoveOn (
+    __in PRCU_READER Reader
+    )
+/*++
+
+Routine Description:
+
+    Moves the calling reader to the next processor, so that its section
+    ends on another processor's shard than it began on.
+
+--*/
+{
+    cpu_set_t set;
+    ULONG cpuCount = csgCpuCount();
+
+    if (cpuCount < 2) {
+
+        return;
+    }
+
+    CPU_ZERO( &set );
+    CPU_SET( (csgCurrentCpu() + 1) % cpuCount, &set );
+
+    if (pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0) {
+
+        Reader->Moved++;
+    }
+}
+
+
+static PVOID
+ReaderThread (
+    __in PVOID Parameter
+    )
+{
+    PRCU_READER reader = Parameter;
+    PRCU_OBJECT object;
+    ULONGLONG random = 0x2545f4914f6cdd1dULL * (reader->Index + 1);
+    ULONG lastVersion = 0;
+    ULONG cookie;
+    ULONG choice;
+
+    pthread_barrier_wait( &Start );
+
+    while (!__atomic_load_n( &Stop, __ATOMIC_ACQUIRE )) {
+
+        cookie = csgRcuReadLock( Rcu );
+
+        object = csgLoadAcquirePointer( &Current );
+
+        if (!Intact( object )) {
+
+            reader->Poisoned++;
+
+        } else {
+
+            if (object->Version < lastVersion) {
+
+                reader->WentBack++;
+            }
+
+            lastVersion = object->Version;
+        }
+
+        //
+        //  Hold the object a while: mostly not at all, sometimes across
+        //  a yield or a sleep, or over a move to another processor.
+        //
+
+        choice = NextRandom( &random ) % 256;
+
+        if (choice == 0) {
+
+            usleep( 200 );
+
+        } else if (choice < 16) {
+
+            sched_yield();
+
+        } else if (choice < 20) {
+
+            MoveOn( reader );
+        }
+
+        if (!Intact( object )) {
+
+            reader->Poisoned++;
+        }
+
+        csgRcuReadUnlock( Rcu, cookie );
+
+        reader->Sections++;
+    }
+
+    return NULL;
+}
+
+
+static double
+Now (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr, "usage: csgrcu [-r readers] [-p publishes] [-n]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    PRCU_READER readers;
+    PRCU_OBJECT *retired;
+    PRCU_OBJECT next;
+    PRCU_OBJECT old;
+    ULONGLONG sections = 0;
+    ULONGLONG poisoned = 0;
+    ULONGLONG wentBack = 0;
+    ULONGLONG moved = 0;
+    ULONG readerCount = 8;
+    ULONG publishes = 2000;
+    BOOLEAN noGrace = FALSE;
+    double started;
+    double took;
+    double total = 0;
+    double longest = 0;
+    ULONG i;
+    int option;
+
+    while ((option = getopt( argc, argv, "r:p:n" )) != -1) {
+
+        switch (option) {
+
+            case 'r':   readerCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'p':   publishes = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'n':   noGrace = TRUE; break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || readerCount == 0 || readerCount > RCU_MAX_READERS || publishes == 0) {
+
+        Usage();
+        return 2;
+    }
+
+    readers = calloc( readerCount, sizeof(RCU_READER) );
+    retired = calloc( publishes + 1, sizeof(PRCU_OBJECT) );
+
+    if (readers == NULL || retired == NULL || !NT_SUCCESS( csgRcuCreate( &Rcu ) )) {
+
+        fprintf( stderr, "csgrcu: out of memory\n" );
+        return 1;
+    }
+
+    //
+    //  With no reader inside, a grace period must end at once.
+    //
+
+    started = Now();
+    csgRcuSynchronize( Rcu );
+    csgRcuSynchronize( Rcu );
+
+    Report( Now() - started < 1.0, "a grace period with no readers ends at once" );
+
+    Current = NewObject( 1 );
+
+    pthread_barrier_init( &Start, NULL, readerCount + 1 );
+
+    for (i = 0; i < readerCount; i++) {
+
+        readers[i].Index = i;
+
+        if (pthread_create( &readers[i].Thread, NULL, ReaderThread, &readers[i] ) != 0) {
+
+            fprintf( stderr, "csgrcu: cannot start reader %u\n", i );
+            return 1;
+        }
+    }
+
+    pthread_barrier_wait( &Start );
+
+    for (i = 0; i < publishes; i++) {
+
+        next = NewObject( i + 2 );
+        old = Current;
+
+        csgStoreReleasePointer( &Current, next );
+
+        started = Now();
+
+        if (!noGrace) {
+
+            csgRcuSynchronize( Rcu );
+        }
+
+        took = Now() - started;
+        total += took;
+
+        if (took > longest) {
+
+            longest = took;
+        }
+
+        Poison( old );
+        retired[i] = old;
+
+        //
+        //  Let the readers run between publishes, as they would between
+        //  two reloads, even on one processor.
+        //
+
+        sched_yield();
+    }
+
+    __atomic_store_n( &Stop, TRUE, __ATOMIC_RELEASE );
+
+    for (i = 0; i < readerCount; i++) {
+
+        pthread_join( readers[i].Thread, NULL );
+
+        sections += readers[i].Sections;
+        poisoned += readers[i].Poisoned;
+        wentBack += readers[i].WentBack;
+        moved += readers[i].Moved;
+    }
+
+    Report( poisoned == 0 && sections != 0,
+            "%u readers against %u publishes%s: %llu sections, %llu ended on another processor, %llu saw a retired object",
+            readerCount,
+            publishes,
+            noGrace ? " without grace periods" : "",
+            (unsigned long long)sections,
+            (unsigned long long)moved,
+            (unsigned long long)poisoned );
+
+    Report( wentBack == 0 && Current->Version == publishes + 1,
+            "readers saw versions only go forward, %llu went back; version %u published last",
+            (unsigned long long)wentBack,
+            Current->Version );
+
+    printf( "       grace periods took %.3f ms on average, %.3f ms at most\n",
+            total * 1e3 / publishes,
+            longest * 1e3 );
+
+    for (i = 0; i < publishes; i++) {
+
+        free( retired[i] );
+    }
+
+    free( Current );
+    free( retired );
+    free( readers );
+
+    pthread_barrier_destroy( &Start );
+
+    csgRcuDestroy( Rcu );
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,903 @@
+/*++
+
+Module Name:
+
+    csgreplay.c
+
+Abstract:
+
+    Replays a capture (csgCapture.h), taken by csgctl capture or csgsim
+    -c, through the driver in the filter manager simulation.
+
+        csgreplay [-k] [-n] [-s sector] [-r] [-p] [-t] [-c capture] [-v]
+                  capture directory
+
+    Each file of the capture becomes a file on the volume mounted from
+    directory, written first to the furthest offset the capture reaches;
+    files the capture only queried as directories are the volume's root.
+    The records are then sent through the driver's callbacks with the
+    offsets, lengths and flags they were captured with, one at a time in
+    capture order, so two replays of a capture send the driver the same
+    operations in the same order.  A capture holds no data: what is
+    written is a pattern of the file and offset, so every read is checked
+    against the pattern too.  Operations that cannot be sent as they were
+    captured, such as noncached I/O out of line with the volume's sectors,
+    are skipped and counted.  The driver enciphers with XTS: it allows CTR
+    only for files with keys of their own that are never rewritten (see
+    csgCtr.h), which a capture's writes cannot be held to.
+
+        -n      the driver's NoncachedOnly
+        -s      the volume's sector size, 512 or 4096
+        -r      at the speed they were captured, rather than back to back
+        -p      paging I/O too; by default it is left to the simulated
+                cache manager, which makes its own for the cached I/O
+        -t      each captured thread on a thread of its own; the order
+                across threads is then no longer fixed
+        -c      capture the replay, as csgsim -c does
+        -v      the driver's DbgPrint output
+
+    Times, counts and failures are reported per kind of operation.  The
+    exit status is nonzero if a read did not match, an operation failed
+    that should not have, or the pool leaked.
+
+    Built from the top of the tree as
+
+        cc -O2 -std=gnu11 -fshort-wchar -Wno-incompatible-pointer-types \
+           -Isim -I. sim/csgsimKernel.c sim/csgsimFlt.c sim/csgsimCapture.c \
+           sim/csgreplay.c csgctl/csgcapture.c csg*.c -lpthread -o csgreplay
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgsim.h"
+
+#include "../csgCapture.h"
+
+#define REPLAY_FILL_CHUNK       (64 * 1024)
+
+//
+//  The driver's DebugFlags bit for capture, from csgStruct.h.
+//
+
+#define LOGFL_CAPTURE           0x00000040
+
+typedef enum _REPLAY_KIND {
+
+    ReplayRead,
+    ReplayWrite,
+    ReplayDirectory,
+    ReplayKindCount
+
+} REPLAY_KIND;
+
+static CONST PCSTR KindNames[ReplayKindCount] = { "read", "write", "dirctrl" };
+
+typedef struct _REPLAY_TIMES {
+
+    ULONGLONG Operations;
+
+    ULONGLONG Bytes;
+
+    ULONGLONG Failures;
+
+    ULONGLONG Nanoseconds;
+
+    ULONGLONG MaxNanoseconds;
+
+} REPLAY_TIMES;
+
+typedef struct _REPLAY_FILE {
+
+    PSIM_FILE File;
+
+    //
+    //  One past the last byte a read or write of the capture touches.
+    //  Zero for a file only queried as a directory.
+    //
+
+    LONGLONG Extent;
+
+    BOOLEAN Directory;
+
+} REPLAY_FILE, *PREPLAY_FILE;
+
+typedef struct _REPLAY_THREAD {
+
+    pthread_t Thread;
+
+    //
+    //  The records this thread sends, by index into the capture.
+    //
+
+    ULONGLONG *Records;
+
+    ULONGLONG Count;
+
+    PUCHAR Buffer;
+
+    REPLAY_TIMES Times[ReplayKindCount];
+
+    ULONGLONG Skipped;
+
+    ULONGLONG Mismatches;
+
+    //
+    //  With -r, how late the operations went out, in total.
+    //
+
+    ULONGLONG LateNanoseconds;
+
+} REPLAY_THREAD, *PREPLAY_THREAD;
+
+static CONST CSG_CAPTURE_HEADER *Header;
+static CONST UCHAR *RecordBase;
+static PREPLAY_FILE Files;
+static ULONG MaxLength;
+static BOOLEAN RecordedSpeed;
+static BOOLEAN ReplayPaging;
+static BOOLEAN KeysSet;
+static ULONG SectorSize = 512;
+static struct timespec Start;
+
+
+static ULONGLONG
+Nanoseconds (
+    __in CONST struct timespec *Time
+    )
+{
+    return (ULONGLONG)Time->tv_sec * 1000000000ULL + (ULONGLONG)Time->tv_nsec;
+}
+
+
+static PCCSG_CAPTURE_RECORD
+Record (
+    __in ULONGLONG Index
+    )
+{
+    return (PCCSG_CAPTURE_RECORD)(RecordBase + Index * Header->RecordSize);
+}
+
+
+//
+//  What the replay writes at each offset of a file: eight bytes at a
+//  time, a mix of the file's number and the offset.
+//
+
+static VOID
+FillPattern (
+    __in ULONG File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __out PUCHAR Buffer
+    )
+{
+    ULONGLONG word = 0;
+    LONGLONG position;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+
+        position = Offset + i;
+
+        if (i == 0 || (position & 7) == 0) {
+
+            word = ((ULONGLONG)File << 40) ^ (ULONGLONG)(position >> 3);
+            word *= 0x9e3779b97f4a7c15ULL;
+            word ^= word >> 29;
+        }
+
+        Buffer[i] = (UCHAR)(word >> ((position & 7) * 8));
+    }
+}
+
+
+static BOOLEAN
+CheckPattern (
+    __in ULONG File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in PUCHAR Buffer,
+    __in PUCHAR Scratch
+    )
+{
+    LONGLONG extent = Files[File].Extent;
+
+    if (Offset >= extent) {
+
+        return TRUE;
+    }
+
+    if (Offset + Length > extent) {
+
+        Length = (ULONG)(extent - Offset);
+    }
+
+    FillPattern( File, Offset, Length, Scratch );
+
+    return memcmp( Buffer, Scratch, Length ) == 0;
+}
+
+
+static ULONG
+SimFlags (
+    __in PCCSG_CAPTURE_RECORD Record
+    )
+{
+    ULONG flags = 0;
+
+    if (FlagOn( Record->Flags, CSG_CAPTURE_PAGING )) {
+
+        flags |= SIM_IO_PAGING;
+
+    } else if (FlagOn( Record->Flags, CSG_CAPTURE_NOCACHE )) {
+
+        flags |= SIM_IO_NONCACHED;
+
+    } else if (FlagOn( Record->Flags, CSG_CAPTURE_FAST_IO )) {
+
+        flags |= SIM_IO_FAST;
+    }
+
+    if (FlagOn( Record->Flags, CSG_CAPTURE_SYSTEM_BUFFER )) {
+
+        flags |= SIM_IO_SYSTEM_BUFFER;
+    }
+
+    return flags;
+}
+
+
+static VOID
+ReplayRecord (
+    __inout PREPLAY_THREAD Thread,
+    __in PCCSG_CAPTURE_RECORD Record
+    )
+{
+    PREPLAY_FILE file = &Files[Record->File];
+    PUCHAR scratch = Thread->Buffer + MaxLength;
+    REPLAY_KIND kind;
+    struct timespec before;
+    struct timespec after;
+    ULONGLONG elapsed;
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    if (FlagOn( Record->Flags, CSG_CAPTURE_PAGING ) && !ReplayPaging) {
+
+        Thread->Skipped++;
+        return;
+    }
+
+    switch (Record->MajorFunction) {
+
+        case IRP_MJ_READ:               kind = ReplayRead; break;
+        case IRP_MJ_WRITE:              kind = ReplayWrite; break;
+        case IRP_MJ_DIRECTORY_CONTROL:  kind = ReplayDirectory; break;
+
+        default:
+
+            Thread->Skipped++;
+            return;
+    }
+
+    //
+    //  Noncached I/O captured on a volume with smaller sectors may not
+    //  line up with this one's.
+    //
+
+    if ((kind == ReplayDirectory) != file->Directory ||
+        (kind == ReplayDirectory && Record->MinorFunction != IRP_MN_QUERY_DIRECTORY) ||
+        (FlagOn( Record->Flags, CSG_CAPTURE_NOCACHE | CSG_CAPTURE_PAGING ) &&
+         ((Record->Offset | Record->Length) & (SectorSize - 1)) != 0)) {
+
+        Thread->Skipped++;
+        return;
+    }
+
+    if (RecordedSpeed) {
+
+        ULONGLONG due = Nanoseconds( &Start ) +
+                        (ULONGLONG)((double)Record->Time * 1e9 / (double)Header->TimestampFrequency);
+        struct timespec wake = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL );
+        clock_gettime( CLOCK_MONOTONIC, &before );
+
+        if (Nanoseconds( &before ) > due) {
+
+            Thread->LateNanoseconds += Nanoseconds( &before ) - due;
+        }
+
+    } else {
+
+        clock_gettime( CLOCK_MONOTONIC, &before );
+    }
+
+    switch (kind) {
+
+        case ReplayRead:
+
+            status = SimRead( file->File, Record->Offset, Record->Length,
+                              Thread->Buffer, SimFlags( Record ), &transferred );
+
+            if (NT_SUCCESS( status ) &&
+                !CheckPattern( Record->File, Record->Offset, transferred, Thread->Buffer, scratch )) {
+
+                fprintf( stderr, "csgreplay: file %u: read at %lld+%u does not match\n",
+                         Record->File, (long long)Record->Offset, Record->Length );
+                Thread->Mismatches++;
+            }
+
+            break;
+
+        case ReplayWrite:
+
+            FillPattern( Record->File, Record->Offset, Record->Length, Thread->Buffer );
+
+            status = SimWrite( file->File, Record->Offset, Record->Length,
+                               Thread->Buffer, SimFlags( Record ), &transferred );
+            break;
+
+        default:
+
+            status = SimQueryDirectory( file->File,
+                                        (FILE_INFORMATION_CLASS)Record->InformationClass,
+                                        NULL,
+                                        Record->OperationFlags & (SL_RESTART_SCAN | SL_RETURN_SINGLE_ENTRY),
+                                        Thread->Buffer,
+                                        Record->Length,
+                                        SimFlags( Record ),
+                                        &transferred );
+            break;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &after );
+
+    elapsed = Nanoseconds( &after ) - Nanoseconds( &before );
+
+    Thread->Times[kind].Operations++;
+    Thread->Times[kind].Bytes += transferred;
+    Thread->Times[kind].Nanoseconds += elapsed;
+
+    if (elapsed > Thread->Times[kind].MaxNanoseconds) {
+
+        Thread->Times[kind].MaxNanoseconds = elapsed;
+    }
+
+    //
+    //  Running off the end of a file or a directory listing is how those
+    //  end, not a failure.
+    //
+
+    if (!NT_SUCCESS( status ) &&
+        status != STATUS_END_OF_FILE &&
+        status != STATUS_NO_MORE_FILES &&
+        status != STATUS_BUFFER_OVERFLOW) {
+
+        fprintf( stderr, "csgreplay: file %u: %s at %lld+%u failed: %08x\n",
+                 Record->File, KindNames[kind], (long long)Record->Offset,
+                 Record->Length, (unsigned)status );
+        Thread->Times[kind].Failures++;
+    }
+}
+
+
+static PVOID
+ReplayThread (
+    __in PVOID Parameter
+    )
+{
+    PREPLAY_THREAD thread = Parameter;
+    ULONGLONG i;
+
+    for (i = 0; i < thread->Count; i++) {
+
+        ReplayRecord( thread, Record( thread->Records[i] ) );
+    }
+
+    return NULL;
+}
+
+
+static int
+MapCapture (
+    __in PCSTR Path
+    )
+{
+    struct stat info;
+    PVOID view;
+    int fd;
+
+    fd = open( Path, O_RDONLY );
+
+    if (fd < 0) {
+
+        fprintf( stderr, "csgreplay: cannot open %s\n", Path );
+        return 1;
+    }
+
+    if (fstat( fd, &info ) != 0 || (SIZE_T)info.st_size < sizeof(CSG_CAPTURE_HEADER)) {
+
+        fprintf( stderr, "csgreplay: %s is not a capture\n", Path );
+        close( fd );
+        return 1;
+    }
+
+    view = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+    close( fd );
+
+    if (view == MAP_FAILED) {
+
+        fprintf( stderr, "csgreplay: cannot map %s\n", Path );
+        return 1;
+    }
+
+    Header = view;
+    RecordBase = (CONST UCHAR *)view + sizeof(CSG_CAPTURE_HEADER);
+
+    //
+    //  Newer versions may grow the record; what this one knows of it
+    //  stays where it is.
+    //
+
+    if (Header->Magic != CSG_CAPTURE_MAGIC ||
+        Header->Version < CSG_CAPTURE_VERSION ||
+        Header->RecordSize < sizeof(CSG_CAPTURE_RECORD) ||
+        Header->TimestampFrequency == 0 ||
+        Header->RecordCount > ((ULONGLONG)info.st_size - sizeof(CSG_CAPTURE_HEADER)) / Header->RecordSize) {
+
+        fprintf( stderr, "csgreplay: %s is not a capture\n", Path );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int
+PrepareFiles (
+    __in PSIM_VOLUME Volume
+    )
+/*++
+
+Routine Description:
+
+    Sizes up every file of the capture from its records, then creates the
+    files and writes the pattern up to their extents, through the driver,
+    so reads find data where the captured system had some.
+
+--*/
+{
+    PCCSG_CAPTURE_RECORD record;
+    PUCHAR buffer;
+    CHAR name[32];
+    LONGLONG offset;
+    ULONG length;
+    ULONGLONG i;
+    ULONG f;
+    NTSTATUS status;
+
+    Files = calloc( Header->FileCount ? Header->FileCount : 1, sizeof(REPLAY_FILE) );
+
+    if (Files == NULL) {
+
+        return 1;
+    }
+
+    for (f = 0; f < Header->FileCount; f++) {
+
+        Files[f].Directory = TRUE;
+    }
+
+    for (i = 0; i < Header->RecordCount; i++) {
+
+        record = Record( i );
+
+        if (record->File >= Header->FileCount) {
+
+            fprintf( stderr, "csgreplay: record %llu names file %u of %u\n",
+                     (unsigned long long)i, record->File, Header->FileCount );
+            return 1;
+        }
+
+        MaxLength = max( MaxLength, record->Length );
+
+        if (record->MajorFunction == IRP_MJ_READ || record->MajorFunction == IRP_MJ_WRITE) {
+
+            Files[record->File].Directory = FALSE;
+            Files[record->File].Extent = max( Files[record->File].Extent,
+                                              record->Offset + (LONGLONG)record->Length );
+        }
+    }
+
+    MaxLength = (ULONG)ROUND_TO_PAGES( max( MaxLength, REPLAY_FILL_CHUNK ) );
+
+    buffer = aligned_alloc( PAGE_SIZE, REPLAY_FILL_CHUNK );
+
+    if (buffer == NULL) {
+
+        return 1;
+    }
+
+    for (f = 0; f < Header->FileCount; f++) {
+
+        if (Files[f].Directory) {
+
+            status = SimOpenFile( Volume, "", SIM_OPEN_READ | SIM_OPEN_DIRECTORY, &Files[f].File );
+
+        } else {
+
+            snprintf( name, sizeof(name), "csgreplay%u.dat", f );
+
+            status = SimOpenFile( Volume,
+                                  name,
+                                  SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                                  &Files[f].File );
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgreplay: cannot open file %u: %08x\n", f, (unsigned)status );
+            free( buffer );
+            return 1;
+        }
+
+        for (offset = 0; offset < Files[f].Extent; offset += length) {
+
+            length = (ULONG)min( (LONGLONG)REPLAY_FILL_CHUNK, Files[f].Extent - offset );
+
+            FillPattern( f, offset, length, buffer );
+
+            status = SimWrite( Files[f].File, offset, length, buffer, 0, NULL );
+
+            if (!NT_SUCCESS( status )) {
+
+                fprintf( stderr, "csgreplay: cannot fill file %u: %08x\n", f, (unsigned)status );
+                free( buffer );
+                return 1;
+            }
+        }
+    }
+
+    free( buffer );
+
+    return 0;
+}
+
+
+static VOID
+CloseFiles (
+    VOID
+    )
+{
+    ULONG f;
+
+    for (f = 0; f < Header->FileCount; f++) {
+
+        if (Files[f].File != NULL) {
+
+            SimCloseFile( Files[f].File );
+        }
+    }
+
+    free( Files );
+}
+
+
+static int
+AssignRecords (
+    __in PREPLAY_THREAD Threads,
+    __in ULONG ThreadCount
+    )
+{
+    ULONGLONG i;
+    ULONG t;
+
+    for (i = 0; i < Header->RecordCount; i++) {
+
+        Threads[ThreadCount > 1 ? Record( i )->Thread % ThreadCount : 0].Count++;
+    }
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        Threads[t].Records = malloc( (Threads[t].Count + 1) * sizeof(ULONGLONG) );
+        Threads[t].Buffer = aligned_alloc( PAGE_SIZE, 2 * (SIZE_T)MaxLength );
+        Threads[t].Count = 0;
+
+        if (Threads[t].Records == NULL || Threads[t].Buffer == NULL) {
+
+            return 1;
+        }
+    }
+
+    for (i = 0; i < Header->RecordCount; i++) {
+
+        t = ThreadCount > 1 ? Record( i )->Thread % ThreadCount : 0;
+
+        Threads[t].Records[Threads[t].Count++] = i;
+    }
+
+    return 0;
+}
+
+
+static VOID
+SetParameters (
+    __in BOOLEAN NoncachedOnly,
+    __in BOOLEAN Capture
+    )
+{
+    UCHAR key[64];
+
+    SimSetParameterDword( "DebugFlags", Capture ? LOGFL_CAPTURE : 0 );
+    SimSetParameterDword( "NoncachedOnly", NoncachedOnly );
+    SimSetParameterDword( "CipherAlgorithm", 0 );
+
+    if (Capture) {
+
+        SimSetParameterDword( "TraceRecordsPerCpu", 0x10000 );
+    }
+
+    if (KeysSet) {
+
+        getrandom( key, sizeof(key), 0 );
+        SimSetParameter( "CipherKey", REG_BINARY, key, 64 );
+
+        getrandom( key, 32, 0 );
+        SimSetParameter( "WrappingKey", REG_BINARY, key, 32 );
+
+        RtlSecureZeroMemory( key, sizeof(key) );
+    }
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgreplay [-k] [-n] [-s sector] [-r] [-p] [-t] [-c capture] [-v]\n"
+             "                 capture directory\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    PCSTR capture = NULL;
+    BOOLEAN noncachedOnly = FALSE;
+    BOOLEAN perThread = FALSE;
+    ULONG threadCount = 1;
+    PREPLAY_THREAD threads;
+    PSIM_VOLUME volume;
+    REPLAY_TIMES total[ReplayKindCount];
+    struct timespec end;
+    ULONGLONG skipped = 0;
+    ULONGLONG late = 0;
+    ULONGLONG operations = 0;
+    ULONGLONG failures = 0;
+    ULONGLONG mismatches = 0;
+    double seconds;
+    double captured;
+    ULONG leaks;
+    ULONG t;
+    ULONG k;
+    int option;
+    NTSTATUS status;
+
+    SimSetDebugOutput( FALSE );
+
+    while ((option = getopt( argc, argv, "kns:rptc:v" )) != -1) {
+
+        switch (option) {
+
+            case 'k':   KeysSet = TRUE; break;
+            case 'n':   noncachedOnly = TRUE; break;
+            case 's':   SectorSize = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'r':   RecordedSpeed = TRUE; break;
+            case 'p':   ReplayPaging = TRUE; break;
+            case 't':   perThread = TRUE; break;
+            case 'c':   capture = optarg; break;
+            case 'v':   SimSetDebugOutput( TRUE ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind + 2 != argc) {
+
+        Usage();
+        return 2;
+    }
+
+    if (MapCapture( argv[optind] ) != 0) {
+
+        return 1;
+    }
+
+    if (perThread && Header->ThreadCount > 1) {
+
+        threadCount = Header->ThreadCount;
+    }
+
+    SetParameters( noncachedOnly, capture != NULL );
+
+    status = SimMountVolume( argv[optind + 1], (USHORT)SectorSize, FLT_FSTYPE_NTFS, &volume );
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgreplay: cannot mount %s: %08x\n", argv[optind + 1], (unsigned)status );
+        return 1;
+    }
+
+    status = SimLoadDriver();
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgreplay: DriverEntry failed: %08x\n", (unsigned)status );
+        return 1;
+    }
+
+    threads = calloc( threadCount, sizeof(REPLAY_THREAD) );
+
+    if (threads == NULL ||
+        PrepareFiles( volume ) != 0 ||
+        AssignRecords( threads, threadCount ) != 0) {
+
+        fprintf( stderr, "csgreplay: cannot set up the replay\n" );
+        return 1;
+    }
+
+    //
+    //  The files are filled before the capture starts, so a capture of
+    //  the replay holds only what was replayed.
+    //
+
+    if (capture != NULL) {
+
+        status = SimStartCapture();
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgreplay: cannot start the capture: %08x\n", (unsigned)status );
+            return 1;
+        }
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &Start );
+
+    if (threadCount == 1) {
+
+        ReplayThread( &threads[0] );
+
+    } else {
+
+        for (t = 0; t < threadCount; t++) {
+
+            if (pthread_create( &threads[t].Thread, NULL, ReplayThread, &threads[t] ) != 0) {
+
+                fprintf( stderr, "csgreplay: cannot start thread %u\n", t );
+                return 1;
+            }
+        }
+
+        for (t = 0; t < threadCount; t++) {
+
+            pthread_join( threads[t].Thread, NULL );
+        }
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    if (capture != NULL) {
+
+        status = SimStopCapture( capture );
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgreplay: cannot write the capture: %08x\n", (unsigned)status );
+            failures++;
+        }
+    }
+
+    memset( total, 0, sizeof(total) );
+
+    for (t = 0; t < threadCount; t++) {
+
+        for (k = 0; k < ReplayKindCount; k++) {
+
+            total[k].Operations += threads[t].Times[k].Operations;
+            total[k].Bytes += threads[t].Times[k].Bytes;
+            total[k].Failures += threads[t].Times[k].Failures;
+            total[k].Nanoseconds += threads[t].Times[k].Nanoseconds;
+            total[k].MaxNanoseconds = max( total[k].MaxNanoseconds, threads[t].Times[k].MaxNanoseconds );
+        }
+
+        skipped += threads[t].Skipped;
+        mismatches += threads[t].Mismatches;
+        late += threads[t].LateNanoseconds;
+
+        free( threads[t].Records );
+        free( threads[t].Buffer );
+    }
+
+    free( threads );
+
+    seconds = (double)(Nanoseconds( &end ) - Nanoseconds( &Start )) / 1e9;
+    captured = Header->RecordCount ?
+               (double)Record( Header->RecordCount - 1 )->Time / (double)Header->TimestampFrequency : 0.0;
+
+    printf( "%8s %10s %12s %8s %10s %10s\n", "", "operations", "bytes", "failed", "mean us", "max us" );
+
+    for (k = 0; k < ReplayKindCount; k++) {
+
+        printf( "%8s %10llu %12llu %8llu %10.1f %10.1f\n",
+                KindNames[k],
+                (unsigned long long)total[k].Operations,
+                (unsigned long long)total[k].Bytes,
+                (unsigned long long)total[k].Failures,
+                total[k].Operations ? total[k].Nanoseconds / 1e3 / total[k].Operations : 0.0,
+                total[k].MaxNanoseconds / 1e3 );
+
+        operations += total[k].Operations;
+        failures += total[k].Failures;
+    }
+
+    printf( "%llu operations replayed in %.3f s (%.3f s captured), %.0f per second, %llu skipped\n",
+            (unsigned long long)operations, seconds, captured,
+            seconds > 0 ? operations / seconds : 0.0,
+            (unsigned long long)skipped );
+
+    if (RecordedSpeed && operations != 0) {
+
+        printf( "operations went out %.1f us late on average\n", late / 1e3 / operations );
+    }
+
+    CloseFiles();
+
+    status = SimUnloadDriver();
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgreplay: unload failed: %08x\n", (unsigned)status );
+        failures++;
+    }
+
+    SimDismountVolume( volume );
+
+    leaks = SimReportLeaks( TRUE );
+
+    if (mismatches != 0 || failures != 0 || leaks != 0) {
+
+        printf( "FAILED: %llu mismatches, %llu failures, %u leaks\n",
+                (unsigned long long)mismatches, (unsigned long long)failures, leaks );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,2080 @@
+/*++
+
+Module Name:
+
+    csgsim.c
+
+Abstract:
+
+    Runs the driver on Linux, in the filter manager simulation, against a
+    host directory.
+
+        csgsim [-k [-m]] [-a xts|ctr] [-n] [-l] [-x ext,...] [-s sector]
+               [-o bytes] [-p bytes] [-t threads] [-i iterations]
+               [-c capture] [-v] directory
+
+    Each thread writes and reads a file of its own through the driver,
+    cached, noncached, as paging I/O and as fast I/O, now and then
+    truncates it, and checks every read and size against a copy of what
+    it wrote.  The files are then opened again and read back whole,
+    cached and noncached, their sizes checked in directory listings of
+    each class, and with -k, which gives the driver random keys, their
+    contents on the host checked not to hold what was written.  Five more
+    files check that the last sector of a file survives a flush and a
+    close, that a file overwritten or truncated while open starts over,
+    that noncached reads and writes through the file pointer of a
+    synchronous open follow on from each other, that a reload that
+    would change the protected extensions or a key under an open file is
+    refused, and that a write the crypto workers encipher reads back.  With all the files closed, the driver's cache of swap buffers
+    is checked to shrink while idle and to empty when memory runs short.
+    The driver is then unloaded and the pool checked for leaks.
+    The exit status is nonzero if anything did not match.
+
+        -m      a MasterKey too, so new files get derived file keys
+        -a      cipher, XTS unless told.  The driver refuses CTR without
+                -x, which is checked instead of running.  With -k and an
+                -x naming dat, the files are CTR streams, which only grow
+                (see csgCtr.h): the threads write at the end of their
+                files, start them over by opening them to be overwritten
+                when they are full, and check that writes before the end
+                and truncations are refused
+        -n      the driver's NoncachedOnly
+        -l      the driver's LockUserBuffers
+        -x      the driver's ProtectedExtensions
+        -s      the volume's sector size, 512 or 4096
+        -o      the driver's OffloadThreshold; small enough, and with -k,
+                the crypto workers encipher most noncached writes
+        -p      the driver's ParallelReadThreshold; at 512K or less, and
+                with -k, the noncached read back is deciphered in chunks
+                by the crypto workers
+        -c      capture the I/O the driver sees into a file, for csgreplay
+        -v      the driver's DbgPrint output
+
+    Built from the top of the tree, with nothing but a C compiler, as
+
+        cc -O2 -std=gnu11 -fshort-wchar -Wno-incompatible-pointer-types \
+           -Isim -I. sim/csgsim*.c csgctl/csgcapture.c csg*.c -lpthread -o csgsim
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgsim.h"
+
+#include "../csgControl.h"
+#include "../csgGlobal.h"
+#include "../csgStats.h"
+
+#define SIM_FILE_SPAN           (1024 * 1024)
+#define SIM_MAX_IO              (128 * 1024)
+#define SIM_MAX_THREADS         64
+
+//
+//  The driver's DebugFlags bit for capture, from csgStruct.h.
+//
+
+#define LOGFL_CAPTURE           0x00000040
+
+typedef struct _SIM_THREAD {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+    PSIM_VOLUME Volume;
+
+    ULONG Iterations;
+
+    ULONG SectorSize;
+
+    CHAR Name[32];
+
+    //
+    //  What the file should hold, and how long the file system should
+    //  think it is.  Written marks the bytes that were written; the rest
+    //  are holes, which read back as whatever the disk's zeros decipher
+    //  to.
+    //
+
+    PUCHAR Shadow;
+
+    PUCHAR Written;
+
+    LONGLONG Size;
+
+    ULONG Mismatches;
+
+    ULONGLONG Operations;
+
+    ULONGLONG Random;
+
+} SIM_THREAD, *PSIM_THREAD;
+
+static BOOLEAN KeysSet;
+static BOOLEAN MasterKeySet;
+static BOOLEAN OffloadSet;
+static ULONG OffloadThreshold;
+static BOOLEAN ParallelReadSet;
+static ULONG ParallelReadThreshold;
+static BOOLEAN LockUserBuffers;
+
+//
+//  The files are CTR streams the driver lets only grow.
+//
+
+static BOOLEAN AppendOnly;
+
+//
+//  The CipherKey and ProtectedExtensions the driver was given, to put
+//  back after CheckReload has changed them.  Lengths in bytes, zero when
+//  there is none.
+//
+
+static UCHAR CipherKey[64];
+static ULONG CipherKeyLength;
+static WCHAR ExtensionList[256];
+static ULONG ExtensionListLength;
+
+
+static ULONG
+NextRandom (
+    __inout PSIM_THREAD Thread
+    )
+{
+    Thread->Random ^= Thread->Random << 13;
+    Thread->Random ^= Thread->Random >> 7;
+    Thread->Random ^= Thread->Random << 17;
+
+    return (ULONG)(Thread->Random >> 16);
+}
+
+
+static VOID
+Mismatch (
+    __inout PSIM_THREAD Thread,
+    __in PCSTR What,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in NTSTATUS Status
+    )
+{
+    fprintf( stderr,
+             "csgsim: %s: %s at %lld+%u, status %08x\n",
+             Thread->Name, What, (long long)Offset, Length, (unsigned)Status );
+
+    Thread->Mismatches++;
+}
+
+
+static VOID
+CheckRead (
+    __inout PSIM_THREAD Thread,
+    __in PCSTR What,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in PUCHAR Buffer,
+    __in ULONG BytesRead,
+    __in NTSTATUS Status
+    )
+/*++
+
+Routine Description:
+
+    Checks the bytes of a read that were written against the shadow.  A
+    read must end exactly at the end of file, however it was done, and
+    one starting at or past it must fail with STATUS_END_OF_FILE.
+
+--*/
+{
+    ULONG expected = (Offset >= Thread->Size) ? 0 : (ULONG)min( (LONGLONG)Length, Thread->Size - Offset );
+    ULONG i;
+
+    if (expected == 0) {
+
+        if (Status != STATUS_END_OF_FILE) {
+
+            Mismatch( Thread, What, Offset, Length, Status );
+        }
+
+        return;
+    }
+
+    if (!NT_SUCCESS( Status ) || BytesRead != expected) {
+
+        Mismatch( Thread, What, Offset, Length, Status );
+        return;
+    }
+
+    for (i = 0; i < BytesRead; i++) {
+
+        if (Thread->Written[Offset + i] && Buffer[i] != Thread->Shadow[Offset + i]) {
+
+            Mismatch( Thread, What, Offset + i, Length - i, Status );
+            break;
+        }
+    }
+}
+
+
+static VOID
+CheckSize (
+    __inout PSIM_THREAD Thread,
+    __in PCSTR What,
+    __in PSIM_FILE File
+    )
+/*++
+
+Routine Description:
+
+    Checks the end of file a query of the file returns against the size
+    written.
+
+--*/
+{
+    FILE_STANDARD_INFORMATION standard;
+    NTSTATUS status;
+
+    status = SimQueryInformation( File, FileStandardInformation, &standard, sizeof(standard), NULL );
+
+    if (!NT_SUCCESS( status ) || standard.EndOfFile.QuadPart != Thread->Size) {
+
+        Mismatch( Thread, What, standard.EndOfFile.QuadPart, 0, status );
+    }
+}
+
+
+static VOID
+Truncate (
+    __inout PSIM_THREAD Thread,
+    __in PSIM_FILE File,
+    __in LONGLONG Size
+    )
+/*++
+
+Routine Description:
+
+    Sets the end of file back to Size.  What was past it becomes a hole.
+    A CTR stream must refuse it, and keep its size.
+
+--*/
+{
+    FILE_END_OF_FILE_INFORMATION endOfFile;
+    NTSTATUS status;
+
+    endOfFile.EndOfFile.QuadPart = Size;
+
+    status = SimSetInformation( File, FileEndOfFileInformation, &endOfFile, sizeof(endOfFile) );
+
+    if (AppendOnly && Size < Thread->Size) {
+
+        if (status != STATUS_ACCESS_DENIED) {
+
+            Mismatch( Thread, "truncate of a CTR stream", Size, 0, status );
+        }
+
+        CheckSize( Thread, "size after refusing to truncate", File );
+        return;
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Thread, "truncate", Size, 0, status );
+        return;
+    }
+
+    if (Size < Thread->Size) {
+
+        RtlZeroMemory( Thread->Written + Size, (SIZE_T)(Thread->Size - Size) );
+    }
+
+    Thread->Size = Size;
+
+    CheckSize( Thread, "size after truncating", File );
+}
+
+
+static VOID
+Append (
+    __inout PSIM_THREAD Thread,
+    __in PSIM_FILE File,
+    __in PUCHAR Buffer,
+    __in ULONG Length,
+    __in ULONG Flags
+    )
+/*++
+
+Routine Description:
+
+    Writes to a CTR stream.  One write in eight goes before the end of
+    the data and must be refused; the rest go on at the end, noncached
+    ones at the first whole sector there.  Paging writes, which are never
+    refused and only rewrite, are sent noncached instead.
+
+--*/
+{
+    ULONG sector = Thread->SectorSize;
+    LONGLONG offset;
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    if (FlagOn( Flags, SIM_IO_PAGING )) {
+
+        Flags = (Flags & ~SIM_IO_PAGING) | SIM_IO_NONCACHED;
+    }
+
+    getrandom( Buffer, Length, 0 );
+
+    if (Thread->Size != 0 && NextRandom( Thread ) % 8 == 0) {
+
+        offset = NextRandom( Thread ) % Thread->Size;
+
+        if (FlagOn( Flags, SIM_IO_NONCACHED )) {
+
+            offset -= offset % sector;
+        }
+
+        status = SimWrite( File, offset, Length, Buffer, Flags, &transferred );
+
+        if (status != STATUS_ACCESS_DENIED) {
+
+            Mismatch( Thread, "rewrite of a CTR stream", offset, Length, status );
+        }
+
+        return;
+    }
+
+    offset = Thread->Size;
+
+    if (FlagOn( Flags, SIM_IO_NONCACHED )) {
+
+        offset += (sector - offset % sector) % sector;
+    }
+
+    if (offset + Length > SIM_FILE_SPAN) {
+
+        return;
+    }
+
+    status = SimWrite( File, offset, Length, Buffer, Flags, &transferred );
+
+    if (!NT_SUCCESS( status ) || transferred != Length) {
+
+        Mismatch( Thread, "append", offset, Length, status );
+        return;
+    }
+
+    RtlCopyMemory( Thread->Shadow + offset, Buffer, Length );
+    RtlFillMemory( Thread->Written + offset, Length, 1 );
+
+    Thread->Size = offset + Length;
+}
+
+
+static VOID
+RunOperation (
+    __inout PSIM_THREAD Thread,
+    __in PSIM_FILE File,
+    __in PUCHAR Buffer
+    )
+{
+    ULONG choice = NextRandom( Thread ) % 8;
+    ULONG sector = Thread->SectorSize;
+    LONGLONG offset;
+    ULONG length;
+    ULONG transferred = 0;
+    ULONG expected;
+    ULONG flags;
+    NTSTATUS status;
+
+    //
+    //  Now and then, cut the file somewhere short of its end.
+    //
+
+    if (NextRandom( Thread ) % 64 == 0) {
+
+        Truncate( Thread, File, (Thread->Size != 0) ? NextRandom( Thread ) % Thread->Size : 0 );
+        Thread->Operations++;
+        return;
+    }
+
+    if (choice < 4) {
+
+        //
+        //  Cached, at any offset and length.
+        //
+
+        offset = NextRandom( Thread ) % (SIM_FILE_SPAN - SIM_MAX_IO);
+        length = 1 + NextRandom( Thread ) % SIM_MAX_IO;
+        flags = (choice & 1) ? SIM_IO_FAST : 0;
+
+    } else {
+
+        //
+        //  Noncached or paging, whole sectors into an aligned buffer.
+        //
+
+        offset = (LONGLONG)(NextRandom( Thread ) % ((SIM_FILE_SPAN - SIM_MAX_IO) / sector)) * sector;
+        length = (1 + NextRandom( Thread ) % (SIM_MAX_IO / sector)) * sector;
+        flags = (choice < 6) ? SIM_IO_NONCACHED : SIM_IO_PAGING;
+
+        if ((choice & 1) != 0) {
+
+            flags |= SIM_IO_MDL;
+        }
+    }
+
+    if (NextRandom( Thread ) % 2 == 0) {
+
+        if (AppendOnly) {
+
+            Append( Thread, File, Buffer, length, flags );
+            Thread->Operations++;
+            return;
+        }
+
+        //
+        //  Cached and noncached writes extend the file to their end.
+        //  Paging writes are cut at the end of file, as the memory
+        //  manager's never reach past it.
+        //
+
+        getrandom( Buffer, length, 0 );
+
+        if (FlagOn( flags, SIM_IO_PAGING )) {
+
+            expected = (offset >= Thread->Size) ? 0 : (ULONG)min( (LONGLONG)length, Thread->Size - offset );
+
+        } else {
+
+            expected = length;
+        }
+
+        status = SimWrite( File, offset, length, Buffer, flags, &transferred );
+
+        if (!NT_SUCCESS( status ) || transferred != expected) {
+
+            Mismatch( Thread, "write", offset, length, status );
+            return;
+        }
+
+        if (expected != 0) {
+
+            RtlCopyMemory( Thread->Shadow + offset, Buffer, expected );
+            RtlFillMemory( Thread->Written + offset, expected, 1 );
+
+            Thread->Size = max( Thread->Size, offset + expected );
+        }
+
+    } else {
+
+        status = SimRead( File, offset, length, Buffer, flags, &transferred );
+
+        CheckRead( Thread, "read", offset, length, Buffer, transferred, status );
+    }
+
+    Thread->Operations++;
+}
+
+
+static VOID
+ReadBack (
+    __inout PSIM_THREAD Thread,
+    __in PSIM_FILE File,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Checks the size of a file and reads it back whole, cached, then
+    straight off the disk in one read, large enough for the driver to
+    decipher in chunks.  A read from its end must find nothing.
+
+--*/
+{
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    CheckSize( Thread, "size read back", File );
+
+    status = SimRead( File, 0, SIM_FILE_SPAN, Buffer, 0, &transferred );
+
+    CheckRead( Thread, "read back", 0, SIM_FILE_SPAN, Buffer, transferred, status );
+
+    status = SimRead( File, 0, SIM_FILE_SPAN, Buffer, SIM_IO_NONCACHED | SIM_IO_MDL, &transferred );
+
+    CheckRead( Thread, "noncached read back", 0, SIM_FILE_SPAN, Buffer, transferred, status );
+
+    status = SimRead( File, Thread->Size, 1, Buffer, 0, &transferred );
+
+    CheckRead( Thread, "read from the end", Thread->Size, 1, Buffer, transferred, status );
+}
+
+
+static PVOID
+RunThread (
+    __in PVOID Parameter
+    )
+{
+    PSIM_THREAD thread = Parameter;
+    PSIM_FILE file;
+    PUCHAR buffer;
+    ULONG i;
+    NTSTATUS status;
+
+    buffer = aligned_alloc( PAGE_SIZE, SIM_FILE_SPAN );
+
+    if (buffer == NULL) {
+
+        Mismatch( thread, "out of memory", 0, 0, STATUS_INSUFFICIENT_RESOURCES );
+        return NULL;
+    }
+
+    status = SimOpenFile( thread->Volume,
+                          thread->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( thread, "create", 0, 0, status );
+        free( buffer );
+        return NULL;
+    }
+
+    for (i = 0; i < thread->Iterations; i++) {
+
+        //
+        //  A full CTR stream starts over when opened to be overwritten,
+        //  under a new file key.
+        //
+
+        if (AppendOnly && thread->Size > SIM_FILE_SPAN - SIM_MAX_IO) {
+
+            SimCloseFile( file );
+
+            status = SimOpenFile( thread->Volume,
+                                  thread->Name,
+                                  SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                                  &file );
+
+            if (!NT_SUCCESS( status )) {
+
+                Mismatch( thread, "overwrite", 0, 0, status );
+                free( buffer );
+                return NULL;
+            }
+
+            RtlZeroMemory( thread->Written, (SIZE_T)thread->Size );
+            thread->Size = 0;
+        }
+
+        RunOperation( thread, file, buffer );
+    }
+
+    CheckSize( thread, "size", file );
+
+    SimCloseFile( file );
+
+    //
+    //  Opened again, the file is read from its header.
+    //
+
+    status = SimOpenFile( thread->Volume, thread->Name, SIM_OPEN_READ, &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( thread, "open", 0, 0, status );
+        free( buffer );
+        return NULL;
+    }
+
+    ReadBack( thread, file, buffer );
+
+    status = SimWrite( file, 0, 1, buffer, 0, NULL );
+
+    if (status != STATUS_ACCESS_DENIED) {
+
+        Mismatch( thread, "write to a read only open", 0, 1, status );
+    }
+
+    SimCloseFile( file );
+    free( buffer );
+
+    return NULL;
+}
+
+
+static VOID
+WriteCached (
+    __inout PSIM_THREAD Thread,
+    __in PSIM_FILE File,
+    __in ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Writes Length random bytes at the start of a file through the cache.
+
+--*/
+{
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    getrandom( Thread->Shadow, Length, 0 );
+
+    status = SimWrite( File, 0, Length, Thread->Shadow, 0, &transferred );
+
+    if (!NT_SUCCESS( status ) || transferred != Length) {
+
+        Mismatch( Thread, "write", 0, Length, status );
+        return;
+    }
+
+    RtlFillMemory( Thread->Written, Length, 1 );
+
+    Thread->Size = max( Thread->Size, (LONGLONG)Length );
+}
+
+
+static VOID
+CheckLastSector (
+    __inout PSIM_THREAD Check,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Writes a file through the cache to a length partway into a sector,
+    flushes and closes it, and reads it back after opening it again.  The
+    last sector, with the end of the data in it, must come back whole.
+
+--*/
+{
+    PSIM_FILE file;
+    NTSTATUS status;
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "create", 0, 0, status );
+        return;
+    }
+
+    WriteCached( Check, file, 3 * PAGE_SIZE + Check->SectorSize / 2 + 1 );
+
+    status = SimFlushFile( file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "flush", 0, 0, status );
+    }
+
+    SimCloseFile( file );
+
+    status = SimOpenFile( Check->Volume, Check->Name, SIM_OPEN_READ, &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "open", 0, 0, status );
+        return;
+    }
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+}
+
+
+static VOID
+CheckOverwrite (
+    __inout PSIM_THREAD Check,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Overwrites a file while it is open, and then truncates it to nothing,
+    writing it each time through one handle and reading it back through
+    the other.  Each time the file must start over, header and all, and
+    still read back after it is opened again.  A CTR stream must refuse
+    the truncation, and is overwritten again instead.
+
+--*/
+{
+    PSIM_FILE first;
+    PSIM_FILE second;
+    NTSTATUS status;
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &first );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "create", 0, 0, status );
+        return;
+    }
+
+    WriteCached( Check, first, 2 * PAGE_SIZE + 77 );
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &second );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "overwrite", 0, 0, status );
+        SimCloseFile( first );
+        return;
+    }
+
+    RtlZeroMemory( Check->Written, (SIZE_T)Check->Size );
+    Check->Size = 0;
+
+    CheckSize( Check, "size overwritten", first );
+
+    WriteCached( Check, second, PAGE_SIZE + 5 );
+
+    ReadBack( Check, first, Buffer );
+
+    Truncate( Check, second, 0 );
+
+    if (AppendOnly) {
+
+        SimCloseFile( second );
+
+        status = SimOpenFile( Check->Volume,
+                              Check->Name,
+                              SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                              &second );
+
+        if (!NT_SUCCESS( status )) {
+
+            Mismatch( Check, "overwrite", 0, 0, status );
+            SimCloseFile( first );
+            return;
+        }
+
+        RtlZeroMemory( Check->Written, (SIZE_T)Check->Size );
+        Check->Size = 0;
+    }
+
+    WriteCached( Check, first, 5 * PAGE_SIZE + 300 );
+
+    ReadBack( Check, second, Buffer );
+
+    SimCloseFile( second );
+    SimCloseFile( first );
+
+    status = SimOpenFile( Check->Volume, Check->Name, SIM_OPEN_READ, &first );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "open", 0, 0, status );
+        return;
+    }
+
+    ReadBack( Check, first, Buffer );
+
+    SimCloseFile( first );
+}
+
+
+static VOID
+CheckPosition (
+    __inout PSIM_THREAD Check,
+    __in PCSTR What,
+    __in PSIM_FILE File,
+    __in LONGLONG Expected
+    )
+/*++
+
+Routine Description:
+
+    Checks the file pointer a query of the file returns, on its own and
+    as part of FileAllInformation, against where the last transfer ended.
+
+--*/
+{
+    FILE_POSITION_INFORMATION position;
+    ULONGLONG all[(sizeof(FILE_ALL_INFORMATION) + 512) / sizeof(ULONGLONG)];
+    NTSTATUS status;
+
+    position.CurrentByteOffset.QuadPart = -1;
+
+    status = SimQueryInformation( File, FilePositionInformation, &position, sizeof(position), NULL );
+
+    if (!NT_SUCCESS( status ) || position.CurrentByteOffset.QuadPart != Expected) {
+
+        Mismatch( Check, What, position.CurrentByteOffset.QuadPart, 0, status );
+    }
+
+    status = SimQueryInformation( File, FileAllInformation, all, sizeof(all), NULL );
+
+    position = ((PFILE_ALL_INFORMATION)all)->PositionInformation;
+
+    if ((!NT_SUCCESS( status ) && status != STATUS_BUFFER_OVERFLOW) ||
+        position.CurrentByteOffset.QuadPart != Expected) {
+
+        Mismatch( Check, What, position.CurrentByteOffset.QuadPart, 1, status );
+    }
+}
+
+
+static VOID
+CheckFilePointer (
+    __inout PSIM_THREAD Check,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Writes a file noncached in pieces at the file pointer of a
+    synchronous open, moves the pointer back to the start and reads it
+    back the same way.  Each transfer must start where the last one
+    ended, and the position queried must be where it ended in the data,
+    however far the file system's offsets are shifted past a header.
+    The file is then opened again and read back whole.
+
+--*/
+{
+    static CONST ULONG pieces[] = { 1, 3, 8, 2, 16 };
+    FILE_POSITION_INFORMATION position;
+    PSIM_FILE file;
+    LONGLONG offset = 0;
+    ULONG transferred;
+    ULONG length;
+    ULONG i;
+    NTSTATUS status;
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE |
+                              SIM_OPEN_SYNCHRONOUS,
+                          &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "create", 0, 0, status );
+        return;
+    }
+
+    CheckPosition( Check, "position when opened", file, 0 );
+
+    for (i = 0; i < RTL_NUMBER_OF( pieces ); i++) {
+
+        length = pieces[i] * Check->SectorSize;
+
+        getrandom( Check->Shadow + offset, length, 0 );
+        RtlCopyMemory( Buffer, Check->Shadow + offset, length );
+
+        transferred = 0;
+
+        status = SimWrite( file, SIM_USE_FILE_POINTER, length, Buffer, SIM_IO_NONCACHED, &transferred );
+
+        if (!NT_SUCCESS( status ) || transferred != length) {
+
+            Mismatch( Check, "write at the file pointer", offset, length, status );
+            SimCloseFile( file );
+            return;
+        }
+
+        RtlFillMemory( Check->Written + offset, length, 1 );
+
+        offset += length;
+        Check->Size = offset;
+
+        CheckPosition( Check, "position after a write", file, offset );
+    }
+
+    CheckSize( Check, "size written at the file pointer", file );
+
+    position.CurrentByteOffset.QuadPart = 0;
+
+    status = SimSetInformation( file, FilePositionInformation, &position, sizeof(position) );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "rewind", 0, 0, status );
+    }
+
+    CheckPosition( Check, "position after a rewind", file, 0 );
+
+    offset = 0;
+
+    for (i = 0; i < RTL_NUMBER_OF( pieces ); i++) {
+
+        length = pieces[i] * Check->SectorSize;
+        transferred = 0;
+
+        status = SimRead( file, SIM_USE_FILE_POINTER, length, Buffer, SIM_IO_NONCACHED, &transferred );
+
+        CheckRead( Check, "read at the file pointer", offset, length, Buffer, transferred, status );
+
+        offset += length;
+
+        CheckPosition( Check, "position after a read", file, offset );
+    }
+
+    //
+    //  At the end of the data there is nothing more to read, and the
+    //  pointer stays where it is.
+    //
+
+    status = SimRead( file, SIM_USE_FILE_POINTER, Check->SectorSize, Buffer, SIM_IO_NONCACHED, &transferred );
+
+    CheckRead( Check, "read at the file pointer at the end", offset, Check->SectorSize, Buffer, transferred, status );
+    CheckPosition( Check, "position after reading at the end", file, offset );
+
+    SimCloseFile( file );
+
+    status = SimOpenFile( Check->Volume, Check->Name, SIM_OPEN_READ, &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "open", 0, 0, status );
+        return;
+    }
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+}
+
+
+static VOID
+PutParametersBack (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Sets the CipherKey and ProtectedExtensions the driver was loaded with
+    again, removing them if there were none.
+
+--*/
+{
+    SimSetParameter( "CipherKey",
+                     REG_BINARY,
+                     (CipherKeyLength != 0) ? CipherKey : NULL,
+                     CipherKeyLength );
+
+    SimSetParameter( "ProtectedExtensions",
+                     REG_MULTI_SZ,
+                     (ExtensionListLength != 0) ? ExtensionList : NULL,
+                     ExtensionListLength );
+}
+
+
+static VOID
+CheckReload (
+    __inout PSIM_THREAD Check,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Writes a file and keeps it open while the driver is asked to reload
+    its configuration with another ProtectedExtensions list, another
+    CipherKey, and both.  Each reload must be refused and leave the
+    configuration as it was, so that the open file still reads back,
+    from the disk as well.  A reload with the same extensions in capitals
+    changes nothing and must go through.
+
+--*/
+{
+    static CONST struct {
+
+        PCSTR What;
+        BOOLEAN AddExtension;
+        BOOLEAN RemoveList;
+        BOOLEAN NewKey;
+
+    } changes[] = {
+
+        { "reload adding an extension",         TRUE,  FALSE, FALSE },
+        { "reload removing the list",           FALSE, TRUE,  FALSE },
+        { "reload with another key",            FALSE, FALSE, TRUE  },
+        { "reload with another list and key",   TRUE,  FALSE, TRUE  },
+    };
+    WCHAR list[RTL_NUMBER_OF( ExtensionList ) + 8];
+    UCHAR key[64];
+    ULONG listLength;
+    PSIM_FILE file;
+    ULONG i;
+    ULONG j;
+    NTSTATUS status;
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "create", 0, 0, status );
+        return;
+    }
+
+    WriteCached( Check, file, 6 * PAGE_SIZE + 123 );
+
+    status = SimFlushFile( file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "flush", 0, 0, status );
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF( changes ); i++) {
+
+        if (changes[i].RemoveList && ExtensionListLength == 0) {
+
+            continue;
+        }
+
+        if (changes[i].AddExtension) {
+
+            //
+            //  The list without its final terminator, then one more.
+            //
+
+            listLength = (ExtensionListLength != 0) ? ExtensionListLength / sizeof(WCHAR) - 1 : 0;
+
+            RtlCopyMemory( list, ExtensionList, listLength * sizeof(WCHAR) );
+            RtlCopyMemory( list + listLength, L"new\0", 5 * sizeof(WCHAR) );
+
+            SimSetParameter( "ProtectedExtensions", REG_MULTI_SZ, list, (listLength + 5) * sizeof(WCHAR) );
+        }
+
+        if (changes[i].RemoveList) {
+
+            SimSetParameter( "ProtectedExtensions", REG_MULTI_SZ, NULL, 0 );
+        }
+
+        if (changes[i].NewKey) {
+
+            getrandom( key, sizeof(key), 0 );
+            SimSetParameter( "CipherKey", REG_BINARY, key, (CipherKeyLength != 0) ? CipherKeyLength : 64 );
+        }
+
+        status = SimControl( CSG_CONTROL_RELOAD_CONFIG, 0, NULL, 0, NULL );
+
+        //
+        //  Under CTR a configuration without the list is refused sooner,
+        //  as it is at load.
+        //
+
+        if (NT_SUCCESS( status ) ||
+            ((status != STATUS_INVALID_DEVICE_STATE) && !changes[i].RemoveList)) {
+
+            Mismatch( Check, changes[i].What, 0, 0, status );
+        }
+
+        PutParametersBack();
+
+        ReadBack( Check, file, Buffer );
+    }
+
+    if (ExtensionListLength != 0) {
+
+        for (j = 0; j < ExtensionListLength / sizeof(WCHAR); j++) {
+
+            list[j] = (ExtensionList[j] >= L'a' && ExtensionList[j] <= L'z') ?
+                      ExtensionList[j] - L'a' + L'A' :
+                      ExtensionList[j];
+        }
+
+        SimSetParameter( "ProtectedExtensions", REG_MULTI_SZ, list, ExtensionListLength );
+
+        status = SimControl( CSG_CONTROL_RELOAD_CONFIG, 0, NULL, 0, NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            Mismatch( Check, "reload with the extensions in capitals", 0, 0, status );
+        }
+
+        PutParametersBack();
+    }
+
+    RtlSecureZeroMemory( key, sizeof(key) );
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+
+    status = SimOpenFile( Check->Volume, Check->Name, SIM_OPEN_READ, &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "open", 0, 0, status );
+        return;
+    }
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+}
+
+
+static VOID
+CheckOffload (
+    __inout PSIM_THREAD Check,
+    __out_bcount(SIM_FILE_SPAN) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    Writes a file noncached with a few sectors at its start and then one
+    write of at least the OffloadThreshold right after them, which the
+    crypto workers encipher when there is a key, and reads it back.  The
+    worker must encipher the write at its offset within the data and the
+    file system must get it past the header, as the inline path does.
+
+--*/
+{
+    SIM_COUNTERS before;
+    SIM_COUNTERS after;
+    PSIM_FILE file;
+    LONGLONG offset = 3 * Check->SectorSize;
+    ULONG threshold = OffloadSet ? OffloadThreshold : 256 * 1024;
+    ULONG length;
+    ULONG transferred;
+    NTSTATUS status;
+
+    length = (threshold != 0) ? threshold : 256 * 1024;
+    length = (length + Check->SectorSize - 1) & ~(Check->SectorSize - 1);
+
+    if (length > SIM_FILE_SPAN - offset) {
+
+        length = (ULONG)(SIM_FILE_SPAN - offset);
+    }
+
+    status = SimOpenFile( Check->Volume,
+                          Check->Name,
+                          SIM_OPEN_READ | SIM_OPEN_WRITE | SIM_OPEN_CREATE | SIM_OPEN_TRUNCATE,
+                          &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "create", 0, 0, status );
+        return;
+    }
+
+    getrandom( Check->Shadow, (size_t)(offset + length), 0 );
+
+    RtlCopyMemory( Buffer, Check->Shadow, (SIZE_T)offset );
+
+    status = SimWrite( file, 0, (ULONG)offset, Buffer, SIM_IO_NONCACHED, &transferred );
+
+    if (!NT_SUCCESS( status ) || transferred != offset) {
+
+        Mismatch( Check, "write before the offloaded one", 0, (ULONG)offset, status );
+        SimCloseFile( file );
+        return;
+    }
+
+    RtlFillMemory( Check->Written, (SIZE_T)offset, 1 );
+    Check->Size = offset;
+
+    RtlCopyMemory( Buffer, Check->Shadow + offset, length );
+
+    SimQueryCounters( &before );
+
+    status = SimWrite( file, offset, length, Buffer, SIM_IO_NONCACHED, &transferred );
+
+    SimQueryCounters( &after );
+
+    if (!NT_SUCCESS( status ) || transferred != length) {
+
+        Mismatch( Check, "offloaded write", offset, length, status );
+        SimCloseFile( file );
+        return;
+    }
+
+    RtlFillMemory( Check->Written + offset, length, 1 );
+    Check->Size = offset + length;
+
+    //
+    //  With a key, and the write as long as the threshold, it must have
+    //  been pended for a worker, or this checked the inline path again.
+    //
+
+    if (KeysSet && threshold != 0 && length >= threshold &&
+        after.PendedPreOperations == before.PendedPreOperations) {
+
+        Mismatch( Check, "write not offloaded", offset, length, STATUS_SUCCESS );
+    }
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+
+    status = SimOpenFile( Check->Volume, Check->Name, SIM_OPEN_READ, &file );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( Check, "open", 0, 0, status );
+        return;
+    }
+
+    ReadBack( Check, file, Buffer );
+
+    SimCloseFile( file );
+}
+
+
+static ULONG
+RunChecks (
+    __in PSIM_VOLUME Volume,
+    __in ULONG SectorSize
+    )
+/*++
+
+Routine Description:
+
+    Runs the checks of how a file's end survives, each on a file of its
+    own, after the threads are done.
+
+Return Value:
+
+    The number of mismatches.
+
+--*/
+{
+    SIM_THREAD check;
+    PUCHAR buffer;
+
+    RtlZeroMemory( &check, sizeof(check) );
+
+    check.Volume = Volume;
+    check.SectorSize = SectorSize;
+    check.Shadow = calloc( 1, SIM_FILE_SPAN );
+    check.Written = calloc( 1, SIM_FILE_SPAN );
+
+    buffer = aligned_alloc( PAGE_SIZE, SIM_FILE_SPAN );
+
+    if (check.Shadow == NULL || check.Written == NULL || buffer == NULL) {
+
+        check.Mismatches++;
+
+    } else {
+
+        snprintf( check.Name, sizeof(check.Name), "csgtail.dat" );
+
+        CheckLastSector( &check, buffer );
+
+        RtlZeroMemory( check.Written, SIM_FILE_SPAN );
+        check.Size = 0;
+
+        snprintf( check.Name, sizeof(check.Name), "csgover.dat" );
+
+        CheckOverwrite( &check, buffer );
+
+        RtlZeroMemory( check.Written, SIM_FILE_SPAN );
+        check.Size = 0;
+
+        snprintf( check.Name, sizeof(check.Name), "csgpos.dat" );
+
+        CheckFilePointer( &check, buffer );
+
+        RtlZeroMemory( check.Written, SIM_FILE_SPAN );
+        check.Size = 0;
+
+        snprintf( check.Name, sizeof(check.Name), "csgreload.dat" );
+
+        CheckReload( &check, buffer );
+
+        RtlZeroMemory( check.Written, SIM_FILE_SPAN );
+        check.Size = 0;
+
+        snprintf( check.Name, sizeof(check.Name), "csgoffload.dat" );
+
+        CheckOffload( &check, buffer );
+    }
+
+    free( check.Shadow );
+    free( check.Written );
+    free( buffer );
+
+    return check.Mismatches;
+}
+
+
+static ULONG
+CheckSwapCache (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    With no I/O going on, every swap buffer the driver has is one its
+    cache keeps.  Waits for aging to give some of them back, then
+    signals that nonpaged pool is short and waits for the cache to give
+    back the rest.  The driver ages its cache once a second, halving what
+    sat unused, so the two seconds it is given for the rest are enough to
+    trim it, not to age it away.
+
+Return Value:
+
+    The number of mismatches.
+
+--*/
+{
+    SIM_POOL_USAGE usage;
+    LONGLONG cached;
+    ULONG mismatches = 0;
+    ULONG tries;
+
+    SimQueryPool( BUFFER_SWAP_TAG, &usage );
+
+    cached = usage.Allocations;
+
+    for (tries = 0; (cached != 0) && (tries < 50); tries++) {
+
+        usleep( 100 * 1000 );
+
+        SimQueryPool( BUFFER_SWAP_TAG, &usage );
+
+        if (usage.Allocations < cached) {
+
+            break;
+        }
+    }
+
+    if ((cached != 0) && (usage.Allocations >= cached)) {
+
+        fprintf( stderr, "csgsim: %lld cached swap allocations not aged\n", (long long)cached );
+        mismatches++;
+    }
+
+    SimSetLowMemory( TRUE );
+
+    for (tries = 0; (usage.Allocations != 0) && (tries < 20); tries++) {
+
+        usleep( 100 * 1000 );
+
+        SimQueryPool( BUFFER_SWAP_TAG, &usage );
+    }
+
+    SimSetLowMemory( FALSE );
+
+    if (usage.Allocations != 0) {
+
+        fprintf( stderr, "csgsim: %lld swap allocations still cached with memory short\n", (long long)usage.Allocations );
+        mismatches++;
+    }
+
+    return mismatches;
+}
+
+
+static VOID
+CheckDirectory (
+    __in PSIM_VOLUME Volume,
+    __in PSIM_THREAD Threads,
+    __in ULONG ThreadCount,
+    __in FILE_INFORMATION_CLASS InformationClass
+    )
+/*++
+
+Routine Description:
+
+    Lists the files the threads wrote, a few entries per query, and
+    checks the sizes the driver reports for them.  Files with a header
+    must be listed without it, having all been opened since the driver
+    loaded, whether the class has file ids to look them up by or only
+    names.
+
+--*/
+{
+    UCHAR buffer[512];
+    PFILE_DIRECTORY_INFORMATION entry;
+    PWCHAR fileName;
+    PSIM_FILE directory;
+    ULONG queryFlags = SL_RESTART_SCAN;
+    ULONG nameOffset;
+    ULONG returned;
+    ULONG seen = 0;
+    CHAR name[64];
+    ULONG i;
+    NTSTATUS status;
+
+    switch (InformationClass) {
+
+        case FileDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_DIRECTORY_INFORMATION, FileName );
+            break;
+
+        case FileFullDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_FULL_DIR_INFORMATION, FileName );
+            break;
+
+        case FileBothDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_BOTH_DIR_INFORMATION, FileName );
+            break;
+
+        default:
+
+            nameOffset = FIELD_OFFSET( FILE_ID_BOTH_DIR_INFORMATION, FileName );
+            break;
+    }
+
+    status = SimOpenFile( Volume, "", SIM_OPEN_READ | SIM_OPEN_DIRECTORY, &directory );
+
+    if (!NT_SUCCESS( status )) {
+
+        Mismatch( &Threads[0], "open the root", 0, 0, status );
+        return;
+    }
+
+    for (;;) {
+
+        status = SimQueryDirectory( directory,
+                                    InformationClass,
+                                    "csgsim*.dat",
+                                    queryFlags,
+                                    buffer,
+                                    sizeof(buffer),
+                                    0,
+                                    &returned );
+
+        queryFlags = 0;
+
+        if (status == STATUS_NO_MORE_FILES) {
+
+            break;
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            Mismatch( &Threads[0], "query the root", 0, 0, status );
+            break;
+        }
+
+        entry = (PFILE_DIRECTORY_INFORMATION)buffer;
+
+        for (;;) {
+
+            //
+            //  The names are ASCII.
+            //
+
+            fileName = (PWCHAR)((PUCHAR)entry + nameOffset);
+
+            for (i = 0; i < entry->FileNameLength / sizeof(WCHAR) && i < sizeof(name) - 1; i++) {
+
+                name[i] = (CHAR)fileName[i];
+            }
+
+            name[i] = '\0';
+
+            for (i = 0; i < ThreadCount; i++) {
+
+                if (strcmp( name, Threads[i].Name ) == 0) {
+
+                    seen++;
+
+                    if (entry->EndOfFile.QuadPart != Threads[i].Size) {
+
+                        fprintf( stderr, "csgsim: %s is listed %lld bytes long, not %lld, in class %u\n",
+                                 name,
+                                 (long long)entry->EndOfFile.QuadPart,
+                                 (long long)Threads[i].Size,
+                                 (unsigned)InformationClass );
+
+                        Threads[i].Mismatches++;
+                    }
+                }
+            }
+
+            if (entry->NextEntryOffset == 0) {
+
+                break;
+            }
+
+            entry = (PFILE_DIRECTORY_INFORMATION)((PUCHAR)entry + entry->NextEntryOffset);
+        }
+    }
+
+    SimCloseFile( directory );
+
+    if (seen != ThreadCount) {
+
+        fprintf( stderr, "csgsim: %u of %u files listed in class %u\n",
+                 seen, ThreadCount, (unsigned)InformationClass );
+        Threads[0].Mismatches++;
+    }
+}
+
+
+static VOID
+CheckCiphertext (
+    __in PCSTR Directory,
+    __in PSIM_THREAD Thread
+    )
+/*++
+
+Routine Description:
+
+    With keys set, no 64 bytes of what was written may show up in the
+    host file.
+
+--*/
+{
+    CHAR path[4096];
+    PUCHAR contents;
+    LONGLONG offset;
+    ssize_t length;
+    int fd;
+
+    snprintf( path, sizeof(path), "%s/%s", Directory, Thread->Name );
+
+    fd = open( path, O_RDONLY );
+
+    if (fd < 0) {
+
+        Mismatch( Thread, "open on the host", 0, 0, STATUS_OBJECT_NAME_NOT_FOUND );
+        return;
+    }
+
+    contents = malloc( SIM_FILE_SPAN * 2 );
+    length = (contents != NULL) ? read( fd, contents, SIM_FILE_SPAN * 2 ) : -1;
+
+    close( fd );
+
+    for (offset = 0; length > 0 && offset + 64 <= Thread->Size; offset += PAGE_SIZE) {
+
+        static const UCHAR zeros[64];
+
+        if (Thread->Written[offset] &&
+            memcmp( Thread->Shadow + offset, zeros, 64 ) != 0 &&
+            memmem( contents, length, Thread->Shadow + offset, 64 ) != NULL) {
+
+            Mismatch( Thread, "plaintext on the host", offset, 64, STATUS_SUCCESS );
+            break;
+        }
+    }
+
+    free( contents );
+}
+
+
+static BOOLEAN
+ListsExtension (
+    __in_opt PCSTR List,
+    __in PCSTR Extension
+    )
+/*++
+
+Routine Description:
+
+    Whether a ProtectedExtensions list, as given to -x, names Extension.
+    As for the driver, the dot is optional and case does not matter.
+
+--*/
+{
+    SIZE_T length = strlen( Extension );
+
+    while (List != NULL && *List != '\0') {
+
+        List += (*List == '.');
+
+        if (strncasecmp( List, Extension, length ) == 0 &&
+            (List[length] == ',' || List[length] == '\0')) {
+
+            return TRUE;
+        }
+
+        List = strchr( List, ',' );
+
+        if (List != NULL) {
+
+            List++;
+        }
+    }
+
+    return FALSE;
+}
+
+
+static VOID
+SetParameters (
+    __in PCSTR Cipher,
+    __in BOOLEAN NoncachedOnly,
+    __in_opt PCSTR Extensions,
+    __in BOOLEAN Capture
+    )
+{
+    UCHAR key[32];
+    ULONG count = 0;
+    BOOLEAN isCtr = (strcmp( Cipher, "ctr" ) == 0);
+
+    //
+    //  A capture needs rings big enough to hold what the threads do
+    //  between two reads.
+    //
+
+    SimSetParameterDword( "DebugFlags", Capture ? LOGFL_CAPTURE : 0 );
+
+    if (Capture) {
+
+        SimSetParameterDword( "TraceRecordsPerCpu", 0x10000 );
+    }
+
+    SimSetParameterDword( "NoncachedOnly", NoncachedOnly );
+    SimSetParameterDword( "LockUserBuffers", LockUserBuffers );
+
+    if (OffloadSet) {
+
+        SimSetParameterDword( "OffloadThreshold", OffloadThreshold );
+    }
+
+    if (ParallelReadSet) {
+
+        SimSetParameterDword( "ParallelReadThreshold", ParallelReadThreshold );
+    }
+
+    SimSetParameterDword( "CipherAlgorithm", isCtr ? 1 : 0 );
+
+    if (KeysSet) {
+
+        CipherKeyLength = isCtr ? 40 : 64;
+
+        getrandom( CipherKey, CipherKeyLength, 0 );
+        SimSetParameter( "CipherKey", REG_BINARY, CipherKey, CipherKeyLength );
+
+        getrandom( key, 32, 0 );
+        SimSetParameter( "WrappingKey", REG_BINARY, key, 32 );
+
+        if (MasterKeySet) {
+
+            getrandom( key, 32, 0 );
+            SimSetParameter( "MasterKey", REG_BINARY, key, 32 );
+        }
+
+        RtlSecureZeroMemory( key, sizeof(key) );
+    }
+
+    //
+    //  Extensions go in as a REG_MULTI_SZ.
+    //
+
+    if (Extensions != NULL) {
+
+        while (*Extensions != '\0' && count < RTL_NUMBER_OF( ExtensionList ) - 2) {
+
+            ExtensionList[count++] = (*Extensions == ',') ? UNICODE_NULL : (WCHAR)*Extensions;
+            Extensions++;
+        }
+
+        ExtensionList[count++] = UNICODE_NULL;
+        ExtensionList[count++] = UNICODE_NULL;
+
+        ExtensionListLength = count * sizeof(WCHAR);
+
+        SimSetParameter( "ProtectedExtensions", REG_MULTI_SZ, ExtensionList, ExtensionListLength );
+    }
+}
+
+
+static VOID
+ShowStatistics (
+    VOID
+    )
+{
+    CSG_CONTROL_MAP_REPLY reply;
+    PCCSG_STATS stats;
+    PCCSG_STATS_CPU cpu;
+    ULONGLONG readBytes = 0;
+    ULONGLONG writeBytes = 0;
+    ULONGLONG cipherBytes = 0;
+    ULONGLONG keyCacheHits = 0;
+    ULONGLONG keyCacheMisses = 0;
+    ULONGLONG offloadedWrites = 0;
+    ULONGLONG offloadQueueFull = 0;
+    ULONGLONG parallelReads = 0;
+    ULONGLONG parallelChunks = 0;
+    ULONGLONG mdlCompletions = 0;
+    ULONGLONG systemBufferCompletions = 0;
+    ULONGLONG fastIoCompletions = 0;
+    ULONGLONG safePostings = 0;
+    ULONGLONG buffersLocked = 0;
+    ULONGLONG dirEntriesWalked = 0;
+    ULONGLONG dirEntriesPatched = 0;
+    ULONG i;
+
+    if (!NT_SUCCESS( SimControl( CSG_CONTROL_MAP_STATISTICS, 0, &reply, sizeof(reply), NULL ) )) {
+
+        fprintf( stderr, "csgsim: cannot map the statistics\n" );
+        return;
+    }
+
+    stats = (PCCSG_STATS)(ULONG_PTR)reply.Address;
+
+    if (csgStatsValidate( stats, (SIZE_T)reply.Size )) {
+
+        for (i = 0; i < stats->CpuCount; i++) {
+
+            cpu = (PCCSG_STATS_CPU)((PCUCHAR)stats + stats->CpuOffset + (SIZE_T)i * stats->CpuSize);
+
+            readBytes += cpu->ReadBytes;
+            writeBytes += cpu->WriteBytes;
+            cipherBytes += cpu->CipherBytes;
+            keyCacheHits += cpu->KeyCacheHits;
+            keyCacheMisses += cpu->KeyCacheMisses;
+            offloadedWrites += cpu->OffloadedWrites;
+            offloadQueueFull += cpu->OffloadQueueFull;
+            parallelReads += cpu->ParallelReads;
+            parallelChunks += cpu->ParallelChunks;
+            mdlCompletions += cpu->PostMdlCompletions;
+            systemBufferCompletions += cpu->PostSystemBufferCompletions;
+            fastIoCompletions += cpu->PostFastIoCompletions;
+            safePostings += cpu->SafePostings;
+            buffersLocked += cpu->UserBuffersLocked;
+            dirEntriesWalked += cpu->DirEntriesWalked;
+            dirEntriesPatched += cpu->DirEntriesPatched;
+        }
+
+        printf( "driver: %llu bytes read, %llu written, %llu ciphered\n",
+                (unsigned long long)readBytes,
+                (unsigned long long)writeBytes,
+                (unsigned long long)cipherBytes );
+
+        printf( "driver: reads and queries finished from a MDL %llu, a system buffer %llu, fast I/O %llu, "
+                "posted %llu; %llu users buffers locked\n",
+                (unsigned long long)mdlCompletions,
+                (unsigned long long)systemBufferCompletions,
+                (unsigned long long)fastIoCompletions,
+                (unsigned long long)safePostings,
+                (unsigned long long)buffersLocked );
+
+        if (keyCacheHits + keyCacheMisses != 0) {
+
+            printf( "driver: %llu derived file keys from the cache, %llu derived\n",
+                    (unsigned long long)keyCacheHits,
+                    (unsigned long long)keyCacheMisses );
+        }
+
+        if (offloadedWrites + offloadQueueFull != 0) {
+
+            printf( "driver: %llu writes enciphered by the crypto workers, %llu inline with their queue full\n",
+                    (unsigned long long)offloadedWrites,
+                    (unsigned long long)offloadQueueFull );
+        }
+
+        if (parallelReads != 0) {
+
+            printf( "driver: %llu reads deciphered in %llu chunks with the crypto workers\n",
+                    (unsigned long long)parallelReads,
+                    (unsigned long long)parallelChunks );
+        }
+
+        if (dirEntriesWalked != 0) {
+
+            printf( "driver: %llu of %llu directory entries listed without their header\n",
+                    (unsigned long long)dirEntriesPatched,
+                    (unsigned long long)dirEntriesWalked );
+        }
+    }
+
+    ZwUnmapViewOfSection( NtCurrentProcess(), (PVOID)(ULONG_PTR)reply.Address );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgsim [-k [-m]] [-a xts|ctr] [-n] [-l] [-x ext,...] [-s sector]\n"
+             "              [-o bytes] [-p bytes] [-t threads] [-i iterations]\n"
+             "              [-c capture] [-v] directory\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    PCSTR cipher = "xts";
+    PCSTR extensions = NULL;
+    PCSTR capture = NULL;
+    BOOLEAN noncachedOnly = FALSE;
+    ULONG sectorSize = 512;
+    ULONG threadCount = 4;
+    ULONG iterations = 2000;
+    PSIM_THREAD threads;
+    PSIM_VOLUME volume;
+    SIM_COUNTERS counters;
+    struct timespec start;
+    struct timespec end;
+    ULONGLONG operations = 0;
+    ULONG mismatches = 0;
+    ULONG leaks;
+    double seconds;
+    ULONG i;
+    int option;
+    NTSTATUS status;
+
+    SimSetDebugOutput( FALSE );
+
+    while ((option = getopt( argc, argv, "kma:nlx:s:o:p:t:i:c:v" )) != -1) {
+
+        switch (option) {
+
+            case 'k':   KeysSet = TRUE; break;
+            case 'm':   MasterKeySet = TRUE; break;
+            case 'a':   cipher = optarg; break;
+            case 'n':   noncachedOnly = TRUE; break;
+            case 'l':   LockUserBuffers = TRUE; break;
+            case 'x':   extensions = optarg; break;
+            case 's':   sectorSize = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'o':   OffloadSet = TRUE; OffloadThreshold = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'p':   ParallelReadSet = TRUE; ParallelReadThreshold = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 't':   threadCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'i':   iterations = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'c':   capture = optarg; break;
+            case 'v':   SimSetDebugOutput( TRUE ); break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (optind + 1 != argc ||
+        (strcmp( cipher, "xts" ) != 0 && strcmp( cipher, "ctr" ) != 0) ||
+        threadCount == 0 || threadCount > SIM_MAX_THREADS) {
+
+        Usage();
+        return 2;
+    }
+
+    AppendOnly = (strcmp( cipher, "ctr" ) == 0) && KeysSet && ListsExtension( extensions, "dat" );
+
+    SetParameters( cipher, noncachedOnly, extensions, capture != NULL );
+
+    status = SimMountVolume( argv[optind], (USHORT)sectorSize, FLT_FSTYPE_NTFS, &volume );
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgsim: cannot mount %s: %08x\n", argv[optind], (unsigned)status );
+        return 1;
+    }
+
+    status = SimLoadDriver();
+
+    //
+    //  Without file keys CTR would give every file the same keystream, so
+    //  the driver must refuse to load; that is all there is to check.
+    //
+
+    if (strcmp( cipher, "ctr" ) == 0 && extensions == NULL) {
+
+        if (status != STATUS_INVALID_PARAMETER) {
+
+            fprintf( stderr, "csgsim: DriverEntry took CTR without ProtectedExtensions: %08x\n", (unsigned)status );
+            mismatches++;
+
+            if (NT_SUCCESS( status ) && !NT_SUCCESS( SimUnloadDriver() )) {
+
+                mismatches++;
+            }
+        }
+
+        SimDismountVolume( volume );
+
+        leaks = SimReportLeaks( TRUE );
+
+        if (mismatches != 0 || leaks != 0) {
+
+            printf( "FAILED: %u mismatches, %u allocations leaked\n", mismatches, leaks );
+            return 1;
+        }
+
+        printf( "CTR without ProtectedExtensions refused\npassed\n" );
+
+        return 0;
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgsim: DriverEntry failed: %08x\n", (unsigned)status );
+        return 1;
+    }
+
+    if (capture != NULL) {
+
+        status = SimStartCapture();
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgsim: cannot start the capture: %08x\n", (unsigned)status );
+            return 1;
+        }
+    }
+
+    threads = calloc( threadCount, sizeof(SIM_THREAD) );
+
+    if (threads == NULL) {
+
+        return 1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for (i = 0; i < threadCount; i++) {
+
+        threads[i].Index = i;
+        threads[i].Volume = volume;
+        threads[i].Iterations = iterations;
+        threads[i].SectorSize = sectorSize;
+        threads[i].Shadow = calloc( 1, SIM_FILE_SPAN );
+        threads[i].Written = calloc( 1, SIM_FILE_SPAN );
+        threads[i].Random = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+        snprintf( threads[i].Name, sizeof(threads[i].Name), "csgsim%u.dat", i );
+
+        if (threads[i].Shadow == NULL || threads[i].Written == NULL ||
+            pthread_create( &threads[i].Thread, NULL, RunThread, &threads[i] ) != 0) {
+
+            fprintf( stderr, "csgsim: cannot start thread %u\n", i );
+            return 1;
+        }
+
+        //
+        //  Halfway through the starts, have the driver read its
+        //  parameters again while I/O is going on.
+        //
+
+        if (i == threadCount / 2) {
+
+            status = SimControl( CSG_CONTROL_RELOAD_CONFIG, 0, NULL, 0, NULL );
+
+            if (!NT_SUCCESS( status )) {
+
+                fprintf( stderr, "csgsim: reload failed: %08x\n", (unsigned)status );
+                mismatches++;
+            }
+        }
+    }
+
+    for (i = 0; i < threadCount; i++) {
+
+        pthread_join( threads[i].Thread, NULL );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    mismatches += RunChecks( volume, sectorSize );
+
+    CheckDirectory( volume, threads, threadCount, FileIdBothDirectoryInformation );
+    CheckDirectory( volume, threads, threadCount, FileBothDirectoryInformation );
+    CheckDirectory( volume, threads, threadCount, FileFullDirectoryInformation );
+    CheckDirectory( volume, threads, threadCount, FileDirectoryInformation );
+
+    mismatches += CheckSwapCache();
+
+    if (capture != NULL) {
+
+        status = SimStopCapture( capture );
+
+        if (!NT_SUCCESS( status )) {
+
+            fprintf( stderr, "csgsim: cannot write the capture: %08x\n", (unsigned)status );
+            mismatches++;
+        }
+    }
+
+    for (i = 0; i < threadCount; i++) {
+
+        if (KeysSet && extensions == NULL) {
+
+            CheckCiphertext( argv[optind], &threads[i] );
+        }
+
+        operations += threads[i].Operations;
+        mismatches += threads[i].Mismatches;
+    }
+
+    ShowStatistics();
+
+    SimQueryCounters( &counters );
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf( "%llu operations in %.3f s, %.0f per second\n",
+            (unsigned long long)operations, seconds, operations / seconds );
+
+    printf( "%lld paging reads, %lld paging writes, %lld completions at DISPATCH_LEVEL, %lld posted, %lld pended, %lld completions pended\n",
+            (long long)counters.PagingReads,
+            (long long)counters.PagingWrites,
+            (long long)counters.DispatchCompletions,
+            (long long)counters.PostedCompletions,
+            (long long)counters.PendedPreOperations,
+            (long long)counters.PendedPostOperations );
+
+    status = SimUnloadDriver();
+
+    if (!NT_SUCCESS( status )) {
+
+        fprintf( stderr, "csgsim: unload failed: %08x\n", (unsigned)status );
+        mismatches++;
+    }
+
+    SimDismountVolume( volume );
+
+    leaks = SimReportLeaks( TRUE );
+
+    for (i = 0; i < threadCount; i++) {
+
+        free( threads[i].Shadow );
+        free( threads[i].Written );
+    }
+
+    free( threads );
+
+    if (mismatches != 0 || leaks != 0) {
+
+        printf( "FAILED: %u mismatches, %u allocations leaked\n", mismatches, leaks );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,386 @@
+#ifndef __CSG_SIM_H__
+#define __CSG_SIM_H__
+
+/*++
+
+Module Name:
+
+    csgsim.h
+
+Abstract:
+
+    Interface of the user mode filter manager simulation.  A program
+    links the driver's unmodified sources with csgsimKernel.c and
+    csgsimFlt.c, sets the driver's parameters, mounts host directories as
+    volumes, loads the driver and sends I/O through it; every read, write
+    and directory query goes through the driver's callbacks the way the
+    filter manager would send it, to a small file system that keeps its
+    files in the mounted directory.
+
+    All routines return NTSTATUS values and may be called from any
+    number of threads.  I/O is synchronous: a routine returns once the
+    operation has completed, whatever the driver pended or posted on the
+    way.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#include <fltKernel.h>
+
+typedef struct _FLT_VOLUME SIM_VOLUME, *PSIM_VOLUME;
+typedef struct _SIM_FILE *PSIM_FILE;
+
+/*************************************************************************
+    Driver
+*************************************************************************/
+
+//
+//  Sets a value under the driver's service key, or removes it when Data
+//  is NULL.  The driver reads them at load and when its configuration is
+//  reloaded.
+//
+
+NTSTATUS
+SimSetParameter (
+    __in PCSTR Name,
+    __in ULONG Type,
+    __in_bcount_opt(Length) CONST VOID *Data,
+    __in ULONG Length
+    );
+
+NTSTATUS
+SimSetParameterDword (
+    __in PCSTR Name,
+    __in ULONG Value
+    );
+
+//
+//  Calls DriverEntry.  Volumes mounted at that point get instances when
+//  the driver starts filtering; volumes mounted later get theirs when
+//  they mount.
+//
+
+NTSTATUS
+SimLoadDriver (
+    VOID
+    );
+
+//
+//  Calls the driver's unload routine.  Files may stay open; they lose
+//  their stream contexts and are no longer filtered.
+//
+
+NTSTATUS
+SimUnloadDriver (
+    VOID
+    );
+
+//
+//  Sends a CSG_CONTROL_MESSAGE through the driver's control port, as
+//  csgctl would, connecting for the one message.
+//
+
+NTSTATUS
+SimControl (
+    __in ULONG Command,
+    __in ULONG Argument,
+    __out_bcount_opt(OutputLength) PVOID Output,
+    __in ULONG OutputLength,
+    __out_opt PULONG ReturnedLength
+    );
+
+/*************************************************************************
+    Volumes and files
+*************************************************************************/
+
+//
+//  Mounts the host directory Path as a volume with the given sector size
+//  (512 or 4096) and file system type.  Files are kept as host files of
+//  the same name, so what the driver wrote can be looked at afterwards.
+//
+
+NTSTATUS
+SimMountVolume (
+    __in PCSTR Path,
+    __in USHORT SectorSize,
+    __in FLT_FILESYSTEM_TYPE FileSystemType,
+    __out PSIM_VOLUME *Volume
+    );
+
+NTSTATUS
+SimDismountVolume (
+    __in PSIM_VOLUME Volume
+    );
+
+#define SIM_OPEN_READ       0x0001
+#define SIM_OPEN_WRITE      0x0002
+#define SIM_OPEN_CREATE     0x0004
+#define SIM_OPEN_TRUNCATE   0x0008
+#define SIM_OPEN_DIRECTORY  0x0010
+#define SIM_OPEN_SYNCHRONOUS 0x0020
+
+//
+//  Opens Path, relative to the volume's root and with / or \ between
+//  components; the create goes through the driver.  SIM_OPEN_SYNCHRONOUS
+//  gives the file object FO_SYNCHRONOUS_IO and so a file pointer, which
+//  the file system moves past each read and write that is not paging
+//  I/O.
+//
+
+NTSTATUS
+SimOpenFile (
+    __in PSIM_VOLUME Volume,
+    __in PCSTR Path,
+    __in ULONG Options,
+    __out PSIM_FILE *File
+    );
+
+VOID
+SimCloseFile (
+    __in PSIM_FILE File
+    );
+
+//
+//  The size the file system keeps for the file.
+//
+
+LONGLONG
+SimFileSize (
+    __in PSIM_FILE File
+    );
+
+/*************************************************************************
+    I/O
+*************************************************************************/
+
+//
+//  How an operation is sent.  With no flags it is a cached IRP with a
+//  user buffer, which the simulated cache manager turns into paging I/O
+//  of whole pages.  Noncached I/O must be sector aligned.
+//
+//  The post-operation callbacks of noncached and paging I/O run at
+//  DISPATCH_LEVEL, as they would when the disk completes them, and the
+//  rest at PASSIVE_LEVEL; SIM_IO_COMPLETE_PASSIVE and
+//  SIM_IO_COMPLETE_DISPATCH override that.
+//
+
+#define SIM_IO_NONCACHED            0x0001  // IRP_NOCACHE
+#define SIM_IO_PAGING               0x0002  // IRP_PAGING_IO, implies noncached and MDL
+#define SIM_IO_FAST                 0x0004  // fast I/O; cached only
+#define SIM_IO_SYSTEM_BUFFER        0x0008  // the buffer is a system buffer
+#define SIM_IO_MDL                  0x0010  // the buffer is described by an MDL
+#define SIM_IO_COMPLETE_PASSIVE     0x0020
+#define SIM_IO_COMPLETE_DISPATCH    0x0040
+
+//
+//  An Offset that reads or writes at the file pointer of a file opened
+//  SIM_OPEN_SYNCHRONOUS, as the I/O manager does for a ReadFile or
+//  WriteFile without one.
+//
+
+#define SIM_USE_FILE_POINTER        (-2LL)
+
+NTSTATUS
+SimRead (
+    __in PSIM_FILE File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Flags,
+    __out_opt PULONG BytesRead
+    );
+
+NTSTATUS
+SimWrite (
+    __in PSIM_FILE File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in_bcount(Length) CONST VOID *Buffer,
+    __in ULONG Flags,
+    __out_opt PULONG BytesWritten
+    );
+
+//
+//  IRP_MN_QUERY_DIRECTORY on a directory opened with SIM_OPEN_DIRECTORY.
+//  Pattern is a * and ? wildcard, NULL for all entries.  QueryFlags are
+//  SL_RESTART_SCAN and SL_RETURN_SINGLE_ENTRY; Flags are SIM_IO_*.
+//
+
+NTSTATUS
+SimQueryDirectory (
+    __in PSIM_FILE Directory,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __in_opt PCSTR Pattern,
+    __in ULONG QueryFlags,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __in ULONG Flags,
+    __out_opt PULONG BytesReturned
+    );
+
+//
+//  IRP_MJ_QUERY_INFORMATION and IRP_MJ_SET_INFORMATION.  The file system
+//  answers FileStandardInformation, FileNetworkOpenInformation,
+//  FileAllInformation, FileInternalInformation and
+//  FilePositionInformation, and sets FileEndOfFileInformation,
+//  FileAllocationInformation, FileValidDataLengthInformation and
+//  FilePositionInformation.
+//
+
+NTSTATUS
+SimQueryInformation (
+    __in PSIM_FILE File,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __out_opt PULONG BytesReturned
+    );
+
+NTSTATUS
+SimSetInformation (
+    __in PSIM_FILE File,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __in_bcount(Length) PVOID Buffer,
+    __in ULONG Length
+    );
+
+//
+//  IRP_MJ_FLUSH_BUFFERS.
+//
+
+NTSTATUS
+SimFlushFile (
+    __in PSIM_FILE File
+    );
+
+/*************************************************************************
+    Capture
+*************************************************************************/
+
+//
+//  Records the reads, writes and directory queries that reach the driver
+//  into a capture file (csgCapture.h), as csgctl capture does on Windows,
+//  for csgreplay to send through the driver again.  The driver must be
+//  loaded with LOGFL_CAPTURE in its DebugFlags parameter, and with a
+//  TraceRecordsPerCpu large enough that its rings do not wrap between two
+//  reads.  One capture at a time.
+//
+
+NTSTATUS
+SimStartCapture (
+    VOID
+    );
+
+NTSTATUS
+SimStopCapture (
+    __in PCSTR Path
+    );
+
+/*************************************************************************
+    Accounting
+*************************************************************************/
+
+typedef struct _SIM_COUNTERS {
+
+    //
+    //  Operations sent to the driver, by kind.
+    //
+
+    LONGLONG Creates;
+    LONGLONG Reads;
+    LONGLONG Writes;
+    LONGLONG DirectoryQueries;
+
+    //
+    //  Paging I/O the cache manager generated for cached operations.
+    //
+
+    LONGLONG PagingReads;
+    LONGLONG PagingWrites;
+
+    //
+    //  Post-operation callbacks run at DISPATCH_LEVEL, and how many of
+    //  them the driver moved to a worker.
+    //
+
+    LONGLONG DispatchCompletions;
+    LONGLONG PostedCompletions;
+
+    //
+    //  Operations the driver pended in its pre- or post-operation
+    //  callback.
+    //
+
+    LONGLONG PendedPreOperations;
+    LONGLONG PendedPostOperations;
+
+} SIM_COUNTERS, *PSIM_COUNTERS;
+
+VOID
+SimQueryCounters (
+    __out PSIM_COUNTERS Counters
+    );
+
+//
+//  Waits for work the driver posted to the worker thread.
+//
+
+VOID
+SimFlushWorkQueue (
+    VOID
+    );
+
+//
+//  Signals \KernelObjects\LowNonPagedPoolCondition, or clears it, as
+//  the memory manager does when nonpaged pool runs short and recovers.
+//
+
+VOID
+SimSetLowMemory (
+    __in BOOLEAN Low
+    );
+
+//
+//  Pool in use and allocations made since the process started, for one
+//  tag or, with Tag zero, for all of them.
+//
+
+typedef struct _SIM_POOL_USAGE {
+
+    LONGLONG Allocations;
+
+    LONGLONG Bytes;
+
+    LONGLONG TotalAllocations;
+
+} SIM_POOL_USAGE, *PSIM_POOL_USAGE;
+
+VOID
+SimQueryPool (
+    __in ULONG Tag,
+    __out PSIM_POOL_USAGE Usage
+    );
+
+//
+//  Prints the pool, by tag, and the objects still allocated.  Returns
+//  the number of pool allocations outstanding.
+//
+
+ULONG
+SimReportLeaks (
+    __in BOOLEAN Print
+    );
+
+//
+//  Turns the driver's DbgPrint output on or off.  On by default.
+//
+
+VOID
+SimSetDebugOutput (
+    __in BOOLEAN Enable
+    );
+
+#endif // __CSG_SIM_H__
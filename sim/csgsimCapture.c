@@ -0,0 +1,197 @@
+/*++
+
+Module Name:
+
+    csgsimCapture.c
+
+Abstract:
+
+    Captures the I/O sent through the simulated driver into a capture file
+    (csgCapture.h), as csgctl capture does against the real one: a thread
+    reads the driver's trace rings through the control port every
+    SIM_CAPTURE_POLL_MS and hands them to csgctl's collector.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "csgsimStruct.h"
+
+#include "../csgControl.h"
+#include "../csgStats.h"
+#include "../csgTrace.h"
+#include "../csgCapture.h"
+#include "../csgctl/csgcapture.h"
+
+#define SIM_CAPTURE_POLL_MS     1
+
+//
+//  Room for the largest ring csgTraceCreate makes.
+//
+
+#define SIM_CAPTURE_RECORDS     0x10000
+
+static CSGCTL_CAPTURE Capture;
+static PCSG_TRACE_RECORD CaptureBuffer;
+static pthread_t CaptureThread;
+static volatile BOOLEAN CaptureStopping;
+static NTSTATUS CaptureStatus;
+
+
+static NTSTATUS
+SimPollRings (
+    VOID
+    )
+{
+    ULONG returned;
+    ULONG ring;
+    NTSTATUS status;
+
+    for (ring = 0; ; ring++) {
+
+        status = SimControl( CSG_CONTROL_READ_TRACE,
+                             ring,
+                             CaptureBuffer,
+                             SIM_CAPTURE_RECORDS * sizeof(CSG_TRACE_RECORD),
+                             &returned );
+
+        if (status == STATUS_NO_MORE_ENTRIES) {
+
+            return STATUS_SUCCESS;
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+
+        if (CaptureAdd( &Capture, ring, CaptureBuffer, returned / sizeof(CSG_TRACE_RECORD) ) != 0) {
+
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+}
+
+
+static PVOID
+SimCaptureThread (
+    PVOID Context
+    )
+{
+    struct timespec interval = { 0, SIM_CAPTURE_POLL_MS * 1000000L };
+
+    UNREFERENCED_PARAMETER( Context );
+
+    while (!CaptureStopping && NT_SUCCESS( CaptureStatus )) {
+
+        nanosleep( &interval, NULL );
+
+        CaptureStatus = SimPollRings();
+    }
+
+    return NULL;
+}
+
+
+NTSTATUS
+SimStartCapture (
+    VOID
+    )
+{
+    NTSTATUS status;
+
+    CaptureBuffer = malloc( SIM_CAPTURE_RECORDS * sizeof(CSG_TRACE_RECORD) );
+
+    if (CaptureBuffer == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    CaptureInitialize( &Capture );
+
+    //
+    //  Whatever the rings hold now is not part of the capture.
+    //
+
+    status = SimPollRings();
+
+    if (NT_SUCCESS( status )) {
+
+        CaptureStopping = FALSE;
+        CaptureStatus = STATUS_SUCCESS;
+
+        if (pthread_create( &CaptureThread, NULL, SimCaptureThread, NULL ) != 0) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        CaptureDelete( &Capture );
+        free( CaptureBuffer );
+        CaptureBuffer = NULL;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+SimStopCapture (
+    __in PCSTR Path
+    )
+{
+    CSG_CONTROL_MAP_REPLY reply;
+    PCCSG_STATS stats;
+    NTSTATUS status;
+
+    CaptureStopping = TRUE;
+
+    pthread_join( CaptureThread, NULL );
+
+    status = CaptureStatus;
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimPollRings();
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimControl( CSG_CONTROL_MAP_STATISTICS, 0, &reply, sizeof(reply), NULL );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        stats = (PCCSG_STATS)(ULONG_PTR)reply.Address;
+
+        if (!csgStatsValidate( stats, (SIZE_T)reply.Size ) ||
+            CaptureWrite( &Capture, Path, stats->TimestampFrequency ) != 0) {
+
+            status = STATUS_UNSUCCESSFUL;
+        }
+
+        ZwUnmapViewOfSection( NtCurrentProcess(), (PVOID)(ULONG_PTR)reply.Address );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        printf( "capture: %llu operations in %s, %llu trace records lost\n",
+                (unsigned long long)Capture.Count,
+                Path,
+                (unsigned long long)Capture.Lost );
+    }
+
+    CaptureDelete( &Capture );
+    free( CaptureBuffer );
+    CaptureBuffer = NULL;
+
+    return status;
+}
@@ -0,0 +1,4292 @@
+/*++
+
+Module Name:
+
+    csgsimFlt.c
+
+Abstract:
+
+    The filter manager of the simulation, and the file system under it.
+
+    One filter may register.  Each mounted volume gets one instance of it,
+    and an operation on a file of that volume goes through the filter's
+    callbacks as the filter manager would send it: the pre-operation
+    callback, the file system, then the post-operation callback with the
+    original parameters restored.  Pending in either callback,
+    FltDoCompletionProcessingWhenSafe, swapped buffers and MDLs, and
+    volume and stream contexts work as they do in the kernel, and the
+    post-operation callbacks of noncached I/O run at DISPATCH_LEVEL.
+
+    The file system keeps each file of a volume in the host directory
+    the volume was mounted from, mapped into memory while it is open.
+    Cached I/O goes through a small cache manager that turns it into
+    paging I/O of whole pages, sent through the filter like any other
+    I/O.  The cache writes through and keeps nothing.  As in the real file
+    systems, cached and noncached writes extend the file, paging I/O is
+    cut at the end of file and never extends it, and noncached I/O moves
+    whole sectors, so the bytes of the last sector past the end of file
+    are kept on the disk.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgsimStruct.h"
+
+#include "../csgControl.h"
+
+DRIVER_INITIALIZE DriverEntry;
+
+//
+//  The driver's service key.  Any path reaches the same parameters.
+//
+
+#define SIM_REGISTRY_PATH       L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\csg"
+
+//
+//  Mapped files grow by at least this much.
+//
+
+#define SIM_MAP_GROWTH          (1024 * 1024)
+
+#define SIM_MAX_PATH            260
+
+//
+//  A closed file's host file is its size rounded up to a sector, so that
+//  its last sector is kept whole, and its size is kept in this extended
+//  attribute of the host file.
+//
+
+#define SIM_SIZE_ATTRIBUTE      "user.csgsim.size"
+
+/*************************************************************************
+    Structures
+*************************************************************************/
+
+struct _FLT_FILTER {
+
+    FLT_REGISTRATION Registration;
+
+    PFLT_PRE_OPERATION_CALLBACK PreOperation[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
+    PFLT_POST_OPERATION_CALLBACK PostOperation[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
+    BOOLEAN Filtering;
+
+    PFLT_PORT ServerPort;
+};
+
+//
+//  An instance lives in its volume and is reused by every attachment,
+//  so an operation that picked it up just before it was detached still
+//  points at valid memory.  Operations counts the operations in
+//  progress; detaching waits for it to drain.
+//
+
+struct _FLT_INSTANCE {
+
+    PFLT_FILTER Filter;
+
+    PFLT_VOLUME Volume;
+
+    volatile LONG Operations;
+};
+
+struct _FLT_VOLUME {
+
+    LIST_ENTRY Links;
+
+    ULONG Index;
+
+    int RootFd;
+
+    USHORT SectorSize;
+
+    FLT_FILESYSTEM_TYPE FileSystemType;
+
+    PDEVICE_OBJECT DiskDevice;
+
+    WCHAR DeviceName[32];
+
+    USHORT DeviceNameLength;
+
+    //
+    //  The attached instance, or NULL.
+    //
+
+    PFLT_INSTANCE volatile Instance;
+
+    struct _FLT_INSTANCE InstanceStorage;
+
+    //
+    //  Guards the open streams and the volume context.
+    //
+
+    pthread_mutex_t Lock;
+
+    LIST_ENTRY Streams;
+
+    PFLT_CONTEXT Context;
+};
+
+//
+//  A stream is an open host file, shared by all its opens.
+//
+
+typedef struct _SIM_STREAM {
+
+    LIST_ENTRY Links;
+
+    PFLT_VOLUME Volume;
+
+    dev_t Device;
+
+    ino_t Inode;
+
+    LONG OpenCount;
+
+    int Fd;
+
+    BOOLEAN IsDirectory;
+
+    //
+    //  The file is mapped at Map.  Capacity is how long the host file is
+    //  while open, which is at least FileSize.  I/O holds MapLock shared;
+    //  growing the mapping holds it exclusive.
+    //
+
+    pthread_rwlock_t MapLock;
+
+    PUCHAR Map;
+
+    SIZE_T Capacity;
+
+    //
+    //  The end of file.  Changes of it are serialized by SizeLock.
+    //
+
+    pthread_mutex_t SizeLock;
+
+    volatile LONGLONG FileSize;
+
+    //
+    //  Serializes the read-modify-write of cached writes, as the file
+    //  system's FCB resource would.
+    //
+
+    pthread_mutex_t CacheLock;
+
+    pthread_mutex_t ContextLock;
+
+    PFLT_CONTEXT Context;
+
+} SIM_STREAM, *PSIM_STREAM;
+
+typedef struct _SIM_FILE {
+
+    FILE_OBJECT FileObject;
+
+    PSIM_STREAM Stream;
+
+    PFLT_VOLUME Volume;
+
+    //
+    //  What the create did: FILE_CREATED, FILE_OPENED or FILE_OVERWRITTEN.
+    //
+
+    ULONG_PTR CreateInformation;
+
+    //
+    //  Enumeration state of a directory.
+    //
+
+    pthread_mutex_t DirectoryLock;
+
+    DIR *Directory;
+
+    CHAR Pattern[SIM_MAX_PATH];
+
+    BOOLEAN Enumerating;
+
+    WCHAR FileName[SIM_MAX_PATH];
+
+} SIM_FILE;
+
+//
+//  Every context is preceded by this header.  A context is linked into
+//  at most one Slot, under SlotLock; the link holds a reference.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SIM_CONTEXT {
+
+    PFLT_FILTER Filter;
+
+    const FLT_CONTEXT_REGISTRATION *Registration;
+
+    FLT_CONTEXT_TYPE Type;
+
+    volatile LONG ReferenceCount;
+
+    PFLT_CONTEXT *Slot;
+
+    pthread_mutex_t *SlotLock;
+
+    SIM_WORK_ITEM CleanupWork;
+
+} SIM_CONTEXT, *PSIM_CONTEXT;
+
+#define SIM_CONTEXT_HEADER(_c)  ((PSIM_CONTEXT)(_c) - 1)
+#define SIM_CONTEXT_BODY(_h)    ((PFLT_CONTEXT)((PSIM_CONTEXT)(_h) + 1))
+
+//
+//  An operation in flight.  It lives on the stack of the thread that
+//  sent it, which waits for it to complete.
+//
+
+typedef struct _SIM_IRP {
+
+    FLT_CALLBACK_DATA Data;
+
+    FLT_IO_PARAMETER_BLOCK Iopb;
+
+    FLT_RELATED_OBJECTS Objects;
+
+    //
+    //  The parameters as sent, restored for the post-operation callback.
+    //
+
+    FLT_PARAMETERS Original;
+
+    PSIM_FILE File;
+
+    ULONG Flags;
+
+    BOOLEAN InPreOperation;
+
+    FLT_PREOP_CALLBACK_STATUS PreStatus;
+
+    PVOID CompletionContext;
+
+    //
+    //  The MDL the filter swapped in, which completion frees unless the
+    //  post-operation callback retained it.
+    //
+
+    PMDL SwappedMdl;
+
+    BOOLEAN SwappedMdlRetained;
+
+    //
+    //  What FltCompletePendedPreOperation was given.  It may be called
+    //  before the pre-operation callback that pended returns.
+    //
+
+    FLT_PREOP_CALLBACK_STATUS PendedStatus;
+
+    PVOID PendedContext;
+
+    //
+    //  Signaled when a pended callback is completed.
+    //
+
+    KEVENT Completed;
+
+    PFLT_POST_OPERATION_CALLBACK SafePostCallback;
+
+    SIM_WORK_ITEM WorkItem;
+
+    //
+    //  The MDL FltLockUserBuffer built, freed when the operation
+    //  completes.
+    //
+
+    PMDL LockedMdl;
+
+} SIM_IRP, *PSIM_IRP;
+
+#define SIM_IRP_FROM_DATA(_d)   CONTAINING_RECORD( (_d), SIM_IRP, Data )
+
+//
+//  A connection to the control port.
+//
+
+struct _FLT_PORT {
+
+    PFLT_FILTER Filter;
+
+    BOOLEAN IsClient;
+
+    PFLT_CONNECT_NOTIFY ConnectNotify;
+
+    PFLT_DISCONNECT_NOTIFY DisconnectNotify;
+
+    PFLT_MESSAGE_NOTIFY MessageNotify;
+
+    PVOID Cookie;
+};
+
+typedef struct _SIM_DATA {
+
+    pthread_mutex_t Lock;
+
+    LIST_ENTRY Volumes;
+
+    ULONG NextVolumeIndex;
+
+    DRIVER_OBJECT DriverObject;
+
+    PFLT_FILTER Filter;
+
+    pthread_mutex_t PortLock;
+
+    SIM_COUNTERS Counters;
+
+} SIM_DATA;
+
+static SIM_DATA SimData = {
+
+    .Lock = PTHREAD_MUTEX_INITIALIZER,
+    .Volumes = { &SimData.Volumes, &SimData.Volumes },
+    .PortLock = PTHREAD_MUTEX_INITIALIZER
+};
+
+#define SimCount(_field)    InterlockedIncrement64( &SimData.Counters._field )
+
+//
+//  Returned by SimSendIrp when the filter refuses a fast I/O, which is
+//  then sent again as an IRP.
+//
+
+#define SIM_STATUS_FAST_IO_DISALLOWED   ((NTSTATUS)0xE0000001L)
+
+
+/*************************************************************************
+    Lists
+*************************************************************************/
+
+static VOID
+SimInsertTail (
+    __inout PLIST_ENTRY Head,
+    __inout PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = Head;
+    Entry->Blink = Head->Blink;
+    Head->Blink->Flink = Entry;
+    Head->Blink = Entry;
+}
+
+
+static VOID
+SimRemoveEntry (
+    __inout PLIST_ENTRY Entry
+    )
+{
+    Entry->Blink->Flink = Entry->Flink;
+    Entry->Flink->Blink = Entry->Blink;
+}
+
+
+/*************************************************************************
+    Contexts
+*************************************************************************/
+
+NTSTATUS
+FltAllocateContext (
+    PFLT_FILTER Filter,
+    FLT_CONTEXT_TYPE ContextType,
+    SIZE_T ContextSize,
+    POOL_TYPE PoolType,
+    PFLT_CONTEXT *ReturnedContext
+    )
+/*++
+
+Routine Description:
+
+    Allocates a context of a type and size the filter registered, with
+    one reference.  Like pool, its contents are left undefined; here
+    they are filled with a pattern so that relying on them shows.
+
+--*/
+{
+    const FLT_CONTEXT_REGISTRATION *registration;
+    PSIM_CONTEXT header;
+
+    UNREFERENCED_PARAMETER( PoolType );
+
+    for (registration = Filter->Registration.ContextRegistration;
+         registration != NULL && registration->ContextType != FLT_CONTEXT_END;
+         registration++) {
+
+        if (registration->ContextType == ContextType &&
+            registration->Size == ContextSize) {
+
+            break;
+        }
+    }
+
+    if (registration == NULL || registration->ContextType == FLT_CONTEXT_END) {
+
+        return STATUS_FLT_CONTEXT_ALLOCATION_NOT_FOUND;
+    }
+
+    header = ExAllocatePoolWithTag( NonPagedPool,
+                                    sizeof(SIM_CONTEXT) + ContextSize,
+                                    registration->PoolTag );
+
+    if (header == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( header, sizeof(SIM_CONTEXT) );
+    RtlFillMemory( header + 1, ContextSize, 0xcd );
+
+    header->Filter = Filter;
+    header->Registration = registration;
+    header->Type = ContextType;
+    header->ReferenceCount = 1;
+
+    *ReturnedContext = SIM_CONTEXT_BODY( header );
+
+    return STATUS_SUCCESS;
+}
+
+
+static VOID
+SimFreeContext (
+    __in PVOID Parameter
+    )
+{
+    PSIM_CONTEXT header = Parameter;
+
+    if (header->Registration->ContextCleanupCallback != NULL) {
+
+        header->Registration->ContextCleanupCallback( SIM_CONTEXT_BODY( header ),
+                                                      header->Type );
+    }
+
+    ExFreePoolWithTag( header, header->Registration->PoolTag );
+}
+
+
+VOID
+FltReferenceContext (
+    PFLT_CONTEXT Context
+    )
+{
+    InterlockedIncrement( &SIM_CONTEXT_HEADER( Context )->ReferenceCount );
+}
+
+
+VOID
+FltReleaseContext (
+    PFLT_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Drops a reference.  The last one frees the context, after its
+    cleanup callback; that is moved to the worker when the reference
+    goes at DISPATCH_LEVEL, since cleanup callbacks may be pageable.
+
+--*/
+{
+    PSIM_CONTEXT header = SIM_CONTEXT_HEADER( Context );
+    LONG count = InterlockedDecrement( &header->ReferenceCount );
+
+    if (count < 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "context released too often" );
+    }
+
+    if (count > 0) {
+
+        return;
+    }
+
+    if (header->Slot != NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "last reference to a context that is still linked" );
+    }
+
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimQueueWorkItem( &header->CleanupWork, SimFreeContext, header );
+
+    } else {
+
+        SimFreeContext( header );
+    }
+}
+
+
+static NTSTATUS
+SimSetContext (
+    __inout PFLT_CONTEXT *Slot,
+    __in pthread_mutex_t *SlotLock,
+    __in FLT_SET_CONTEXT_OPERATION Operation,
+    __in PFLT_CONTEXT NewContext,
+    __out_opt PFLT_CONTEXT *OldContext
+    )
+{
+    PSIM_CONTEXT header = SIM_CONTEXT_HEADER( NewContext );
+    PFLT_CONTEXT old;
+
+    if (OldContext != NULL) {
+
+        *OldContext = NULL;
+    }
+
+    pthread_mutex_lock( SlotLock );
+
+    if (header->Slot != NULL) {
+
+        pthread_mutex_unlock( SlotLock );
+        return STATUS_FLT_CONTEXT_ALREADY_LINKED;
+    }
+
+    old = *Slot;
+
+    if (old != NULL && Operation == FLT_SET_CONTEXT_KEEP_IF_EXISTS) {
+
+        if (OldContext != NULL) {
+
+            FltReferenceContext( old );
+            *OldContext = old;
+        }
+
+        pthread_mutex_unlock( SlotLock );
+        return STATUS_FLT_CONTEXT_ALREADY_DEFINED;
+    }
+
+    if (old != NULL) {
+
+        SIM_CONTEXT_HEADER( old )->Slot = NULL;
+        SIM_CONTEXT_HEADER( old )->SlotLock = NULL;
+    }
+
+    FltReferenceContext( NewContext );
+
+    header->Slot = Slot;
+    header->SlotLock = SlotLock;
+    *Slot = NewContext;
+
+    pthread_mutex_unlock( SlotLock );
+
+    //
+    //  The reference the old link held goes to the caller if it asked
+    //  for the old context.
+    //
+
+    if (old != NULL) {
+
+        if (OldContext != NULL) {
+
+            *OldContext = old;
+
+        } else {
+
+            FltReleaseContext( old );
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+static NTSTATUS
+SimGetContext (
+    __in PFLT_CONTEXT *Slot,
+    __in pthread_mutex_t *SlotLock,
+    __out PFLT_CONTEXT *Context
+    )
+{
+    PFLT_CONTEXT context;
+
+    pthread_mutex_lock( SlotLock );
+
+    context = *Slot;
+
+    if (context != NULL) {
+
+        FltReferenceContext( context );
+    }
+
+    pthread_mutex_unlock( SlotLock );
+
+    *Context = context;
+
+    return (context != NULL) ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+
+static VOID
+SimUnlinkContext (
+    __inout PFLT_CONTEXT *Slot,
+    __in pthread_mutex_t *SlotLock
+    )
+/*++
+
+Routine Description:
+
+    Deletes whatever context is linked into a slot, as the filter manager
+    does when the object it is attached to goes away.
+
+--*/
+{
+    PFLT_CONTEXT context;
+
+    pthread_mutex_lock( SlotLock );
+
+    context = *Slot;
+
+    if (context != NULL) {
+
+        *Slot = NULL;
+        SIM_CONTEXT_HEADER( context )->Slot = NULL;
+        SIM_CONTEXT_HEADER( context )->SlotLock = NULL;
+    }
+
+    pthread_mutex_unlock( SlotLock );
+
+    if (context != NULL) {
+
+        FltReleaseContext( context );
+    }
+}
+
+
+VOID
+FltDeleteContext (
+    PFLT_CONTEXT Context
+    )
+{
+    PSIM_CONTEXT header = SIM_CONTEXT_HEADER( Context );
+    pthread_mutex_t *slotLock = header->SlotLock;
+    BOOLEAN unlinked = FALSE;
+
+    if (slotLock == NULL) {
+
+        return;
+    }
+
+    pthread_mutex_lock( slotLock );
+
+    if (header->Slot != NULL && *header->Slot == Context) {
+
+        *header->Slot = NULL;
+        header->Slot = NULL;
+        header->SlotLock = NULL;
+        unlinked = TRUE;
+    }
+
+    pthread_mutex_unlock( slotLock );
+
+    if (unlinked) {
+
+        FltReleaseContext( Context );
+    }
+}
+
+
+NTSTATUS
+FltSetVolumeContext (
+    PFLT_VOLUME Volume,
+    FLT_SET_CONTEXT_OPERATION Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    )
+{
+    return SimSetContext( &Volume->Context, &Volume->Lock, Operation, NewContext, OldContext );
+}
+
+
+NTSTATUS
+FltGetVolumeContext (
+    PFLT_FILTER Filter,
+    PFLT_VOLUME Volume,
+    PFLT_CONTEXT *Context
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+
+    return SimGetContext( &Volume->Context, &Volume->Lock, Context );
+}
+
+
+NTSTATUS
+FltSetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    FLT_SET_CONTEXT_OPERATION Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    )
+{
+    PSIM_STREAM stream = FileObject->FsContext;
+
+    UNREFERENCED_PARAMETER( Instance );
+
+    return SimSetContext( &stream->Context, &stream->ContextLock, Operation, NewContext, OldContext );
+}
+
+
+NTSTATUS
+FltGetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PFLT_CONTEXT *Context
+    )
+{
+    PSIM_STREAM stream = FileObject->FsContext;
+
+    UNREFERENCED_PARAMETER( Instance );
+
+    return SimGetContext( &stream->Context, &stream->ContextLock, Context );
+}
+
+
+/*************************************************************************
+    Streams
+*************************************************************************/
+
+static NTSTATUS
+SimStreamGrow (
+    __inout PSIM_STREAM Stream,
+    __in ULONGLONG End
+    )
+/*++
+
+Routine Description:
+
+    Makes the host file and its mapping at least End bytes long.
+
+--*/
+{
+    SIZE_T capacity;
+    PVOID map;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pthread_rwlock_wrlock( &Stream->MapLock );
+
+    if (End > Stream->Capacity) {
+
+        capacity = max( (SIZE_T)End, Stream->Capacity * 2 );
+        capacity = ROUND_TO_SIZE( max( capacity, (SIZE_T)SIM_MAP_GROWTH ), PAGE_SIZE );
+
+        if (ftruncate( Stream->Fd, (off_t)capacity ) != 0) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+
+        } else {
+
+            if (Stream->Map != NULL) {
+
+                map = mremap( Stream->Map, Stream->Capacity, capacity, MREMAP_MAYMOVE );
+
+            } else {
+
+                map = mmap( NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, Stream->Fd, 0 );
+            }
+
+            if (map == MAP_FAILED) {
+
+                status = STATUS_INSUFFICIENT_RESOURCES;
+
+            } else {
+
+                Stream->Map = map;
+                Stream->Capacity = capacity;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock( &Stream->MapLock );
+
+    return status;
+}
+
+
+static NTSTATUS
+SimStreamRead (
+    __in PSIM_STREAM Stream,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __out PVOID Buffer,
+    __out PULONG BytesRead
+    )
+{
+    LONGLONG fileSize;
+    ULONG length;
+    ULONG copy;
+    ULONG mapped;
+
+    *BytesRead = 0;
+
+    if (Offset < 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pthread_rwlock_rdlock( &Stream->MapLock );
+
+    fileSize = Stream->FileSize;
+
+    if (Offset >= fileSize) {
+
+        pthread_rwlock_unlock( &Stream->MapLock );
+        return STATUS_END_OF_FILE;
+    }
+
+    length = (ULONG)min( (LONGLONG)Length, fileSize - Offset );
+
+    //
+    //  The last sector comes whole, with what is on the disk past the end
+    //  of file, but only the bytes up to the end of file are reported.
+    //
+
+    copy = (ULONG)min( (LONGLONG)Length,
+                       (LONGLONG)ROUND_TO_SIZE( Offset + length, Stream->Volume->SectorSize ) - Offset );
+
+    mapped = (ULONG)min( (LONGLONG)copy, (LONGLONG)Stream->Capacity - Offset );
+
+    RtlCopyMemory( Buffer, Stream->Map + Offset, mapped );
+    RtlZeroMemory( (PUCHAR)Buffer + mapped, copy - mapped );
+
+    pthread_rwlock_unlock( &Stream->MapLock );
+
+    *BytesRead = length;
+
+    return STATUS_SUCCESS;
+}
+
+
+static NTSTATUS
+SimStreamSetSize (
+    __inout PSIM_STREAM Stream,
+    __in LONGLONG Size,
+    __in BOOLEAN ExtendOnly
+    )
+/*++
+
+Routine Description:
+
+    Moves the end of file.  The sectors it extends the file over read as
+    zeros, as they would up to the valid data length; the bytes of the old
+    last sector past the old end of file are left as they are on the disk.
+
+--*/
+{
+    ULONG sectorSize = Stream->Volume->SectorSize;
+    LONGLONG fileSize;
+    LONGLONG zeroFrom;
+    LONGLONG zeroTo;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pthread_mutex_lock( &Stream->SizeLock );
+
+    fileSize = Stream->FileSize;
+
+    if (Size > fileSize) {
+
+        zeroFrom = (LONGLONG)ROUND_TO_SIZE( fileSize, sectorSize );
+        zeroTo = (LONGLONG)ROUND_TO_SIZE( Size, sectorSize );
+
+        if ((ULONGLONG)zeroTo > Stream->Capacity) {
+
+            status = SimStreamGrow( Stream, (ULONGLONG)zeroTo );
+        }
+
+        if (NT_SUCCESS( status )) {
+
+            if (zeroTo > zeroFrom) {
+
+                pthread_rwlock_rdlock( &Stream->MapLock );
+                RtlZeroMemory( Stream->Map + zeroFrom, (SIZE_T)(zeroTo - zeroFrom) );
+                pthread_rwlock_unlock( &Stream->MapLock );
+            }
+
+            InterlockedExchange64( &Stream->FileSize, Size );
+        }
+
+    } else if (Size < fileSize && !ExtendOnly) {
+
+        InterlockedExchange64( &Stream->FileSize, Size );
+    }
+
+    pthread_mutex_unlock( &Stream->SizeLock );
+
+    return status;
+}
+
+
+static NTSTATUS
+SimStreamWrite (
+    __in PSIM_STREAM Stream,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in CONST VOID *Buffer,
+    __in BOOLEAN Extend,
+    __out PULONG BytesWritten
+    )
+/*++
+
+Routine Description:
+
+    Writes to a stream.  A write that may extend the file first moves the
+    end of file to its end.  One that may not, paging I/O, is cut at the
+    end of file, though it still writes the last sector whole.
+
+--*/
+{
+    LONGLONG fileSize;
+    ULONG length;
+    ULONG copy;
+    NTSTATUS status;
+
+    *BytesWritten = 0;
+
+    if (Offset < 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Extend) {
+
+        status = SimStreamSetSize( Stream, Offset + Length, TRUE );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+    }
+
+    fileSize = Stream->FileSize;
+
+    if (Offset >= fileSize) {
+
+        return STATUS_SUCCESS;
+    }
+
+    length = (ULONG)min( (LONGLONG)Length, fileSize - Offset );
+
+    copy = (ULONG)min( (LONGLONG)Length,
+                       (LONGLONG)ROUND_TO_SIZE( Offset + length, Stream->Volume->SectorSize ) - Offset );
+
+    if ((ULONGLONG)(Offset + copy) > Stream->Capacity) {
+
+        status = SimStreamGrow( Stream, (ULONGLONG)(Offset + copy) );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+    }
+
+    pthread_rwlock_rdlock( &Stream->MapLock );
+
+    RtlCopyMemory( Stream->Map + Offset, Buffer, copy );
+
+    pthread_rwlock_unlock( &Stream->MapLock );
+
+    *BytesWritten = length;
+
+    return STATUS_SUCCESS;
+}
+
+
+static LONGLONG
+SimStoredSize (
+    __in int Fd,
+    __in const struct stat *Stat,
+    __in ULONG SectorSize
+    )
+/*++
+
+Routine Description:
+
+    The size of a closed file: the one stored when it was closed, if its
+    host file is still that rounded up to a sector, else the host file's.
+
+--*/
+{
+    LONGLONG size;
+
+    if (fgetxattr( Fd, SIM_SIZE_ATTRIBUTE, &size, sizeof(size) ) == sizeof(size) &&
+        size >= 0 &&
+        (LONGLONG)ROUND_TO_SIZE( size, SectorSize ) == (LONGLONG)Stat->st_size) {
+
+        return size;
+    }
+
+    return Stat->st_size;
+}
+
+
+static VOID
+SimStreamClose (
+    __inout PSIM_STREAM Stream
+    )
+/*++
+
+Routine Description:
+
+    Tears down a stream after its last close: its context goes, and the
+    host file is cut back to the file's size rounded up to a sector, with
+    the size stored beside it.  Where the host file system cannot store
+    it, the host file is cut to the size.  Called with the volume lock
+    held.
+
+--*/
+{
+    LONGLONG size = Stream->FileSize;
+    LONGLONG hostSize = size;
+
+    SimUnlinkContext( &Stream->Context, &Stream->ContextLock );
+
+    if (Stream->Map != NULL) {
+
+        munmap( Stream->Map, Stream->Capacity );
+    }
+
+    if (!Stream->IsDirectory) {
+
+        if (fsetxattr( Stream->Fd, SIM_SIZE_ATTRIBUTE, &size, sizeof(size), 0 ) == 0) {
+
+            hostSize = (LONGLONG)ROUND_TO_SIZE( size, Stream->Volume->SectorSize );
+        }
+
+        if (ftruncate( Stream->Fd, (off_t)hostSize ) != 0) {
+
+            fprintf( stderr, "csgsim: cannot set the size of a file\n" );
+        }
+    }
+
+    close( Stream->Fd );
+
+    pthread_rwlock_destroy( &Stream->MapLock );
+    pthread_mutex_destroy( &Stream->SizeLock );
+    pthread_mutex_destroy( &Stream->CacheLock );
+    pthread_mutex_destroy( &Stream->ContextLock );
+
+    free( Stream );
+}
+
+
+/*************************************************************************
+    Volumes and instances
+*************************************************************************/
+
+static PFLT_INSTANCE
+SimReferenceInstance (
+    __in PFLT_VOLUME Volume
+    )
+/*++
+
+Routine Description:
+
+    The volume's instance, counted as in use by one more operation, or
+    NULL if it has none.
+
+--*/
+{
+    PFLT_INSTANCE instance = __atomic_load_n( &Volume->Instance, __ATOMIC_ACQUIRE );
+
+    if (instance == NULL) {
+
+        return NULL;
+    }
+
+    InterlockedIncrement( &instance->Operations );
+
+    if (__atomic_load_n( &Volume->Instance, __ATOMIC_ACQUIRE ) != instance) {
+
+        InterlockedDecrement( &instance->Operations );
+        return NULL;
+    }
+
+    return instance;
+}
+
+
+static VOID
+SimDereferenceInstance (
+    __in PFLT_INSTANCE Instance
+    )
+{
+    InterlockedDecrement( &Instance->Operations );
+}
+
+
+static VOID
+SimInitializeObjects (
+    __out PFLT_RELATED_OBJECTS Objects,
+    __in PFLT_INSTANCE Instance,
+    __in_opt PFILE_OBJECT FileObject
+    )
+{
+    RtlZeroMemory( Objects, sizeof(FLT_RELATED_OBJECTS) );
+
+    Objects->Size = sizeof(FLT_RELATED_OBJECTS);
+    Objects->Filter = Instance->Filter;
+    Objects->Volume = Instance->Volume;
+    Objects->Instance = Instance;
+    Objects->FileObject = FileObject;
+}
+
+
+static VOID
+SimAttachInstance (
+    __inout PFLT_VOLUME Volume
+    )
+/*++
+
+Routine Description:
+
+    Offers the volume to the filter.  Called with SimData.Lock held.
+
+--*/
+{
+    PFLT_INSTANCE instance = &Volume->InstanceStorage;
+    PFLT_FILTER filter = SimData.Filter;
+    FLT_RELATED_OBJECTS objects;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    instance->Filter = filter;
+    instance->Volume = Volume;
+    instance->Operations = 0;
+
+    SimInitializeObjects( &objects, instance, NULL );
+
+    if (filter->Registration.InstanceSetupCallback != NULL) {
+
+        status = filter->Registration.InstanceSetupCallback( &objects,
+                                                             FLTFL_INSTANCE_SETUP_AUTOMATIC_ATTACHMENT,
+                                                             FILE_DEVICE_DISK_FILE_SYSTEM,
+                                                             Volume->FileSystemType );
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        //
+        //  The instance never was; anything it attached goes with it.
+        //
+
+        SimUnlinkContext( &Volume->Context, &Volume->Lock );
+        return;
+    }
+
+    __atomic_store_n( &Volume->Instance, instance, __ATOMIC_RELEASE );
+}
+
+
+static VOID
+SimDetachInstance (
+    __inout PFLT_VOLUME Volume,
+    __in FLT_INSTANCE_TEARDOWN_FLAGS Reason
+    )
+/*++
+
+Routine Description:
+
+    Tears down the volume's instance: the teardown callbacks, then the
+    contexts of the volume and its streams once no operation is left
+    in it.  Called with SimData.Lock held.
+
+--*/
+{
+    PFLT_INSTANCE instance = Volume->Instance;
+    PFLT_FILTER filter;
+    FLT_RELATED_OBJECTS objects;
+    PLIST_ENTRY entry;
+
+    if (instance == NULL) {
+
+        return;
+    }
+
+    filter = instance->Filter;
+
+    SimInitializeObjects( &objects, instance, NULL );
+
+    if (filter->Registration.InstanceTeardownStartCallback != NULL) {
+
+        filter->Registration.InstanceTeardownStartCallback( &objects, Reason );
+    }
+
+    __atomic_store_n( &Volume->Instance, NULL, __ATOMIC_RELEASE );
+
+    while (__atomic_load_n( &instance->Operations, __ATOMIC_ACQUIRE ) != 0) {
+
+        sched_yield();
+    }
+
+    if (filter->Registration.InstanceTeardownCompleteCallback != NULL) {
+
+        filter->Registration.InstanceTeardownCompleteCallback( &objects, Reason );
+    }
+
+    pthread_mutex_lock( &Volume->Lock );
+
+    for (entry = Volume->Streams.Flink; entry != &Volume->Streams; entry = entry->Flink) {
+
+        PSIM_STREAM stream = CONTAINING_RECORD( entry, SIM_STREAM, Links );
+
+        SimUnlinkContext( &stream->Context, &stream->ContextLock );
+    }
+
+    pthread_mutex_unlock( &Volume->Lock );
+
+    SimUnlinkContext( &Volume->Context, &Volume->Lock );
+}
+
+
+NTSTATUS
+SimMountVolume (
+    __in PCSTR Path,
+    __in USHORT SectorSize,
+    __in FLT_FILESYSTEM_TYPE FileSystemType,
+    __out PSIM_VOLUME *Volume
+    )
+{
+    PFLT_VOLUME volume;
+    CHAR name[32];
+
+    if (SectorSize < 512 || SectorSize > PAGE_SIZE || (SectorSize & (SectorSize - 1)) != 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    volume = calloc( 1, sizeof(*volume) );
+
+    if (volume == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    volume->RootFd = open( Path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if (volume->RootFd < 0) {
+
+        free( volume );
+        return STATUS_OBJECT_PATH_NOT_FOUND;
+    }
+
+    volume->DiskDevice = SimObCreateObject( SimObjectDevice, sizeof(DEVICE_OBJECT), NULL );
+
+    if (volume->DiskDevice == NULL) {
+
+        close( volume->RootFd );
+        free( volume );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    volume->DiskDevice->Volume = volume;
+    volume->SectorSize = SectorSize;
+    volume->FileSystemType = FileSystemType;
+
+    pthread_mutex_init( &volume->Lock, NULL );
+    volume->Streams.Flink = volume->Streams.Blink = &volume->Streams;
+
+    pthread_mutex_lock( &SimData.Lock );
+
+    volume->Index = SimData.NextVolumeIndex++;
+
+    snprintf( name, sizeof(name), "\\Device\\SimVolume%u", volume->Index );
+
+    volume->DeviceNameLength = (USHORT)(SimUtf8ToUtf16( name,
+                                                        strlen( name ),
+                                                        volume->DeviceName,
+                                                        RTL_NUMBER_OF( volume->DeviceName ) ) * sizeof(WCHAR));
+
+    SimInsertTail( &SimData.Volumes, &volume->Links );
+
+    if (SimData.Filter != NULL && SimData.Filter->Filtering) {
+
+        SimAttachInstance( volume );
+    }
+
+    pthread_mutex_unlock( &SimData.Lock );
+
+    *Volume = volume;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+SimDismountVolume (
+    __in PSIM_VOLUME Volume
+    )
+{
+    pthread_mutex_lock( &SimData.Lock );
+
+    if (Volume->Streams.Flink != &Volume->Streams) {
+
+        pthread_mutex_unlock( &SimData.Lock );
+        return STATUS_DEVICE_BUSY;
+    }
+
+    SimDetachInstance( Volume, 0 );
+    SimRemoveEntry( &Volume->Links );
+
+    pthread_mutex_unlock( &SimData.Lock );
+
+    ObDereferenceObject( Volume->DiskDevice );
+    close( Volume->RootFd );
+    pthread_mutex_destroy( &Volume->Lock );
+    free( Volume );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+FltGetVolumeProperties (
+    PFLT_VOLUME Volume,
+    PFLT_VOLUME_PROPERTIES VolumeProperties,
+    ULONG VolumePropertiesLength,
+    PULONG LengthReturned
+    )
+/*++
+
+Routine Description:
+
+    Describes the volume.  The names follow the structure in the
+    caller's buffer, as far as they fit.
+
+--*/
+{
+    PCWSTR driverName;
+    UNICODE_STRING source;
+    PUCHAR next = (PUCHAR)(VolumeProperties + 1);
+    PUCHAR end = (PUCHAR)VolumeProperties + VolumePropertiesLength;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    switch (Volume->FileSystemType) {
+
+        case FLT_FSTYPE_NTFS:   driverName = L"\\FileSystem\\Ntfs"; break;
+        case FLT_FSTYPE_FAT:    driverName = L"\\FileSystem\\fastfat"; break;
+        case FLT_FSTYPE_EXFAT:  driverName = L"\\FileSystem\\exfat"; break;
+        case FLT_FSTYPE_REFS:   driverName = L"\\FileSystem\\ReFS"; break;
+        default:                driverName = L"\\FileSystem\\SimFs"; break;
+    }
+
+    RtlInitUnicodeString( &source, driverName );
+
+    *LengthReturned = sizeof(FLT_VOLUME_PROPERTIES) + source.Length + Volume->DeviceNameLength;
+
+    if (VolumePropertiesLength < sizeof(FLT_VOLUME_PROPERTIES)) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlZeroMemory( VolumeProperties, sizeof(FLT_VOLUME_PROPERTIES) );
+
+    VolumeProperties->DeviceType = FILE_DEVICE_DISK_FILE_SYSTEM;
+    VolumeProperties->SectorSize = Volume->SectorSize;
+
+    if (next + source.Length <= end) {
+
+        RtlCopyMemory( next, source.Buffer, source.Length );
+        VolumeProperties->FileSystemDriverName.Buffer = (PWSTR)next;
+        VolumeProperties->FileSystemDriverName.Length = source.Length;
+        VolumeProperties->FileSystemDriverName.MaximumLength = source.Length;
+        next += source.Length;
+
+    } else {
+
+        status = STATUS_BUFFER_OVERFLOW;
+    }
+
+    if (next + Volume->DeviceNameLength <= end) {
+
+        RtlCopyMemory( next, Volume->DeviceName, Volume->DeviceNameLength );
+        VolumeProperties->RealDeviceName.Buffer = (PWSTR)next;
+        VolumeProperties->RealDeviceName.Length = Volume->DeviceNameLength;
+        VolumeProperties->RealDeviceName.MaximumLength = Volume->DeviceNameLength;
+
+    } else {
+
+        status = STATUS_BUFFER_OVERFLOW;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FltGetDiskDeviceObject (
+    PFLT_VOLUME Volume,
+    PDEVICE_OBJECT *DiskDeviceObject
+    )
+{
+    SimObReferenceObject( Volume->DiskDevice );
+
+    *DiskDeviceObject = Volume->DiskDevice;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+RtlVolumeDeviceToDosName (
+    PVOID VolumeDeviceObject,
+    PUNICODE_STRING DosName
+    )
+/*++
+
+Routine Description:
+
+    Volumes get drive letters from S: on, as long as there are letters.
+
+--*/
+{
+    PFLT_VOLUME volume = ((PDEVICE_OBJECT)VolumeDeviceObject)->Volume;
+
+    if (volume->Index > 'Z' - 'S') {
+
+        return STATUS_NOT_FOUND;
+    }
+
+    DosName->Buffer = ExAllocatePoolWithTag( PagedPool, 3 * sizeof(WCHAR), SIM_NAME_TAG );
+
+    if (DosName->Buffer == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DosName->Buffer[0] = (WCHAR)(L'S' + volume->Index);
+    DosName->Buffer[1] = L':';
+    DosName->Buffer[2] = UNICODE_NULL;
+    DosName->Length = 2 * sizeof(WCHAR);
+    DosName->MaximumLength = 3 * sizeof(WCHAR);
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Filter registration
+*************************************************************************/
+
+NTSTATUS
+FltRegisterFilter (
+    PDRIVER_OBJECT Driver,
+    const FLT_REGISTRATION *Registration,
+    PFLT_FILTER *RetFilter
+    )
+{
+    const FLT_OPERATION_REGISTRATION *operation;
+    PFLT_FILTER filter;
+
+    UNREFERENCED_PARAMETER( Driver );
+
+    PAGED_CODE();
+
+    if (Registration->Size != sizeof(FLT_REGISTRATION) ||
+        Registration->Version != FLT_REGISTRATION_VERSION) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    filter = ExAllocatePoolWithTag( NonPagedPool, sizeof(*filter), SIM_OBJECT_TAG );
+
+    if (filter == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( filter, sizeof(*filter) );
+
+    filter->Registration = *Registration;
+
+    for (operation = Registration->OperationRegistration;
+         operation != NULL && operation->MajorFunction != IRP_MJ_OPERATION_END;
+         operation++) {
+
+        if (operation->MajorFunction > IRP_MJ_MAXIMUM_FUNCTION) {
+
+            continue;
+        }
+
+        filter->PreOperation[operation->MajorFunction] = operation->PreOperation;
+        filter->PostOperation[operation->MajorFunction] = operation->PostOperation;
+    }
+
+    pthread_mutex_lock( &SimData.Lock );
+
+    if (SimData.Filter != NULL) {
+
+        pthread_mutex_unlock( &SimData.Lock );
+        ExFreePoolWithTag( filter, SIM_OBJECT_TAG );
+        return STATUS_FLT_CONTEXT_ALREADY_DEFINED;
+    }
+
+    SimData.Filter = filter;
+
+    pthread_mutex_unlock( &SimData.Lock );
+
+    *RetFilter = filter;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+FltStartFiltering (
+    PFLT_FILTER Filter
+    )
+{
+    PLIST_ENTRY entry;
+
+    PAGED_CODE();
+
+    pthread_mutex_lock( &SimData.Lock );
+
+    Filter->Filtering = TRUE;
+
+    for (entry = SimData.Volumes.Flink; entry != &SimData.Volumes; entry = entry->Flink) {
+
+        SimAttachInstance( CONTAINING_RECORD( entry, struct _FLT_VOLUME, Links ) );
+    }
+
+    pthread_mutex_unlock( &SimData.Lock );
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+FltUnregisterFilter (
+    PFLT_FILTER Filter
+    )
+/*++
+
+Routine Description:
+
+    Detaches the filter from every volume, deletes its contexts and waits
+    for their cleanup.
+
+--*/
+{
+    PLIST_ENTRY entry;
+
+    PAGED_CODE();
+
+    pthread_mutex_lock( &SimData.Lock );
+
+    for (entry = SimData.Volumes.Flink; entry != &SimData.Volumes; entry = entry->Flink) {
+
+        SimDetachInstance( CONTAINING_RECORD( entry, struct _FLT_VOLUME, Links ),
+                           FLTFL_INSTANCE_TEARDOWN_FILTER_UNLOAD );
+    }
+
+    Filter->Filtering = FALSE;
+    SimData.Filter = NULL;
+
+    pthread_mutex_unlock( &SimData.Lock );
+
+    SimFlushWorkQueue();
+
+    if (Filter->ServerPort != NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "filter unregistered with its communication port open" );
+    }
+
+    ExFreePoolWithTag( Filter, SIM_OBJECT_TAG );
+}
+
+
+NTSTATUS
+SimLoadDriver (
+    VOID
+    )
+{
+    UNICODE_STRING registryPath;
+
+    RtlInitUnicodeString( &registryPath, SIM_REGISTRY_PATH );
+
+    return DriverEntry( &SimData.DriverObject, &registryPath );
+}
+
+
+NTSTATUS
+SimUnloadDriver (
+    VOID
+    )
+{
+    PFLT_FILTER filter = SimData.Filter;
+    NTSTATUS status;
+
+    if (filter == NULL || filter->Registration.FilterUnloadCallback == NULL) {
+
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = filter->Registration.FilterUnloadCallback( FLTFL_FILTER_UNLOAD_MANDATORY );
+
+    SimFlushWorkQueue();
+
+    if (SimData.Filter != NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "driver unloaded without unregistering its filter" );
+    }
+
+    return status;
+}
+
+
+/*************************************************************************
+    Callback data
+*************************************************************************/
+
+static VOID
+SimIrpBuffer (
+    __in PFLT_PARAMETERS Parameters,
+    __in UCHAR MajorFunction,
+    __out PVOID **Buffer,
+    __out PMDL **MdlAddress,
+    __out PULONG *Length
+    )
+/*++
+
+Routine Description:
+
+    Where the buffer, its MDL and its length are in the parameters of
+    an operation.
+
+--*/
+{
+    switch (MajorFunction) {
+
+        case IRP_MJ_READ:
+
+            *Buffer = &Parameters->Read.ReadBuffer;
+            *MdlAddress = &Parameters->Read.MdlAddress;
+            *Length = &Parameters->Read.Length;
+            break;
+
+        case IRP_MJ_WRITE:
+
+            *Buffer = &Parameters->Write.WriteBuffer;
+            *MdlAddress = &Parameters->Write.MdlAddress;
+            *Length = &Parameters->Write.Length;
+            break;
+
+        case IRP_MJ_DIRECTORY_CONTROL:
+
+            *Buffer = &Parameters->DirectoryControl.QueryDirectory.DirectoryBuffer;
+            *MdlAddress = &Parameters->DirectoryControl.QueryDirectory.MdlAddress;
+            *Length = &Parameters->DirectoryControl.QueryDirectory.Length;
+            break;
+
+        default:
+
+            SimBugCheck( __FILE__, __LINE__, "operation has no buffer" );
+    }
+}
+
+
+static PVOID
+SimIrpSystemBuffer (
+    __in PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    The address the file system moves the data through: the MDL's if
+    there is one, else the buffer.
+
+--*/
+{
+    PVOID *buffer;
+    PMDL *mdl;
+    PULONG length;
+
+    SimIrpBuffer( &Irp->Iopb.Parameters, Irp->Iopb.MajorFunction, &buffer, &mdl, &length );
+
+    if (*mdl != NULL) {
+
+        return MmGetSystemAddressForMdlSafe( *mdl, NormalPagePriority );
+    }
+
+    return *buffer;
+}
+
+
+VOID
+FltSetCallbackDataDirty (
+    PFLT_CALLBACK_DATA Data
+    )
+{
+    SetFlag( Data->Flags, FLTFL_CALLBACK_DATA_DIRTY );
+}
+
+
+NTSTATUS
+FltLockUserBuffer (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+/*++
+
+Routine Description:
+
+    Makes sure the operation's buffer has a locked MDL.  The MDL goes
+    with the operation and is freed when it completes.
+
+--*/
+{
+    PSIM_IRP irp = SIM_IRP_FROM_DATA( CallbackData );
+    PVOID *buffer;
+    PMDL *mdlAddress;
+    PULONG length;
+    PMDL mdl;
+
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "FltLockUserBuffer at DISPATCH_LEVEL" );
+    }
+
+    SimIrpBuffer( &irp->Iopb.Parameters, irp->Iopb.MajorFunction, &buffer, &mdlAddress, &length );
+
+    if (*mdlAddress != NULL) {
+
+        return STATUS_SUCCESS;
+    }
+
+    mdl = IoAllocateMdl( *buffer, *length, FALSE, FALSE, NULL );
+
+    if (mdl == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MmProbeAndLockPages( mdl, KernelMode, IoWriteAccess );
+
+    *mdlAddress = mdl;
+    irp->LockedMdl = mdl;
+
+    //
+    //  Locking is not a change the filter made to the parameters; the MDL
+    //  stays when they are restored.
+    //
+
+    if (irp->InPreOperation) {
+
+        SimIrpBuffer( &irp->Original, irp->Iopb.MajorFunction, &buffer, &mdlAddress, &length );
+        *mdlAddress = mdl;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+PMDL
+FltGetSwappedBufferMdlAddress (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+/*++
+
+Routine Description:
+
+    Returns the MDL the filter swapped into the operation, for its
+    post-operation callback, or NULL if it swapped none in.
+
+--*/
+{
+    PSIM_IRP irp = SIM_IRP_FROM_DATA( CallbackData );
+
+    if (irp->InPreOperation) {
+
+        SimBugCheck( __FILE__, __LINE__, "FltGetSwappedBufferMdlAddress in a pre-operation callback" );
+    }
+
+    return irp->SwappedMdl;
+}
+
+
+VOID
+FltRetainSwappedBufferMdlAddress (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+/*++
+
+Routine Description:
+
+    Keeps completion from freeing the MDL the filter swapped in; the
+    filter frees it, or uses it again.
+
+--*/
+{
+    PSIM_IRP irp = SIM_IRP_FROM_DATA( CallbackData );
+
+    if (irp->InPreOperation || irp->SwappedMdl == NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "FltRetainSwappedBufferMdlAddress with no swapped MDL" );
+    }
+
+    irp->SwappedMdlRetained = TRUE;
+}
+
+
+static VOID
+SimSafePostWorker (
+    __in PVOID Context
+    )
+{
+    PSIM_IRP irp = Context;
+    FLT_POSTOP_CALLBACK_STATUS status;
+
+    status = irp->SafePostCallback( &irp->Data,
+                                    &irp->Objects,
+                                    irp->CompletionContext,
+                                    0 );
+
+    if (status == FLT_POSTOP_FINISHED_PROCESSING) {
+
+        KeSetEvent( &irp->Completed, IO_NO_INCREMENT, FALSE );
+    }
+}
+
+
+BOOLEAN
+FltDoCompletionProcessingWhenSafe (
+    PFLT_CALLBACK_DATA Data,
+    PCFLT_RELATED_OBJECTS FltObjects,
+    PVOID CompletionContext,
+    FLT_POST_OPERATION_FLAGS Flags,
+    PFLT_POST_OPERATION_CALLBACK SafePostCallback,
+    PFLT_POSTOP_CALLBACK_STATUS RetPostOperationStatus
+    )
+/*++
+
+Routine Description:
+
+    Runs SafePostCallback now if the caller is at APC_LEVEL or below,
+    else on the worker thread; paging I/O cannot be moved there and
+    fails instead.
+
+--*/
+{
+    PSIM_IRP irp = SIM_IRP_FROM_DATA( Data );
+
+    if (KeGetCurrentIrql() <= APC_LEVEL) {
+
+        *RetPostOperationStatus = SafePostCallback( Data, FltObjects, CompletionContext, Flags );
+        return TRUE;
+    }
+
+    if (FlagOn( Data->Iopb->IrpFlags, IRP_PAGING_IO ) || FLT_IS_FASTIO_OPERATION( Data )) {
+
+        return FALSE;
+    }
+
+    SimCount( PostedCompletions );
+
+    irp->SafePostCallback = SafePostCallback;
+    irp->CompletionContext = CompletionContext;
+
+    SimQueueWorkItem( &irp->WorkItem, SimSafePostWorker, irp );
+
+    *RetPostOperationStatus = FLT_POSTOP_MORE_PROCESSING_REQUIRED;
+
+    return TRUE;
+}
+
+
+VOID
+FltCompletePendedPreOperation (
+    PFLT_CALLBACK_DATA CallbackData,
+    FLT_PREOP_CALLBACK_STATUS CallbackStatus,
+    PVOID Context
+    )
+{
+    PSIM_IRP irp = SIM_IRP_FROM_DATA( CallbackData );
+
+    if (CallbackStatus == FLT_PREOP_PENDING) {
+
+        SimBugCheck( __FILE__, __LINE__, "pended operation completed as pending" );
+    }
+
+    irp->PendedStatus = CallbackStatus;
+    irp->PendedContext = Context;
+
+    KeSetEvent( &irp->Completed, IO_NO_INCREMENT, FALSE );
+}
+
+
+VOID
+FltCompletePendedPostOperation (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+{
+    KeSetEvent( &SIM_IRP_FROM_DATA( CallbackData )->Completed, IO_NO_INCREMENT, FALSE );
+}
+
+
+/*************************************************************************
+    Dispatch
+*************************************************************************/
+
+static VOID
+SimFileSystem (
+    __inout PSIM_IRP Irp
+    );
+
+
+static VOID
+SimInitializeIrp (
+    __out PSIM_IRP Irp,
+    __in PSIM_FILE File,
+    __in UCHAR MajorFunction,
+    __in ULONG Flags
+    )
+{
+    RtlZeroMemory( Irp, FIELD_OFFSET( SIM_IRP, Completed ) );
+
+    Irp->Data.Iopb = &Irp->Iopb;
+    Irp->Iopb.MajorFunction = MajorFunction;
+    Irp->Iopb.TargetFileObject = &File->FileObject;
+    Irp->File = File;
+    Irp->Flags = Flags;
+    Irp->LockedMdl = NULL;
+
+    if (FlagOn( Flags, SIM_IO_FAST )) {
+
+        Irp->Data.Flags = FLTFL_CALLBACK_DATA_FAST_IO_OPERATION;
+
+    } else {
+
+        Irp->Data.Flags = FLTFL_CALLBACK_DATA_IRP_OPERATION;
+
+        if (FlagOn( Flags, SIM_IO_NONCACHED )) {
+
+            Irp->Iopb.IrpFlags |= IRP_NOCACHE;
+        }
+
+        if (FlagOn( Flags, SIM_IO_PAGING )) {
+
+            Irp->Iopb.IrpFlags |= IRP_NOCACHE | IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO;
+        }
+    }
+
+    if (FlagOn( Flags, SIM_IO_SYSTEM_BUFFER )) {
+
+        Irp->Data.Flags |= FLTFL_CALLBACK_DATA_SYSTEM_BUFFER;
+    }
+
+    Irp->Data.RequestorMode = KernelMode;
+}
+
+
+static KIRQL
+SimCompletionIrql (
+    __in PSIM_IRP Irp,
+    __in KIRQL SendIrql
+    )
+{
+    if (FlagOn( Irp->Flags, SIM_IO_COMPLETE_DISPATCH )) {
+
+        return DISPATCH_LEVEL;
+    }
+
+    if (FlagOn( Irp->Flags, SIM_IO_COMPLETE_PASSIVE ) ||
+        Irp->PreStatus == FLT_PREOP_SYNCHRONIZE ||
+        !FLT_IS_IRP_OPERATION( &Irp->Data )) {
+
+        return SendIrql;
+    }
+
+    return FlagOn( Irp->Iopb.IrpFlags, IRP_NOCACHE | IRP_PAGING_IO ) ? DISPATCH_LEVEL : SendIrql;
+}
+
+
+static NTSTATUS
+SimSendIrp (
+    __inout PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    Sends an operation through the filter, if it has an instance on the
+    volume, to the file system, and waits for it to complete.
+
+Arguments:
+
+    Irp - The operation, set up by SimInitializeIrp and its caller.
+
+Return Value:
+
+    The operation's final status; Irp->Data.IoStatus has its
+    Information as well.
+
+--*/
+{
+    UCHAR major = Irp->Iopb.MajorFunction;
+    PFLT_INSTANCE instance = SimReferenceInstance( Irp->File->Volume );
+    PFLT_PRE_OPERATION_CALLBACK preOperation = NULL;
+    PFLT_POST_OPERATION_CALLBACK postOperation = NULL;
+    FLT_POSTOP_CALLBACK_STATUS postStatus;
+    KIRQL sendIrql = KeGetCurrentIrql();
+    KIRQL oldIrql;
+    PMDL swappedMdl = NULL;
+    PVOID *buffer;
+    PMDL *mdl;
+    PULONG length;
+    BOOLEAN hasBuffer = (major == IRP_MJ_READ ||
+                         major == IRP_MJ_WRITE ||
+                         major == IRP_MJ_DIRECTORY_CONTROL);
+
+    if (instance != NULL) {
+
+        preOperation = instance->Filter->PreOperation[major];
+        postOperation = instance->Filter->PostOperation[major];
+        SimInitializeObjects( &Irp->Objects, instance, &Irp->File->FileObject );
+        Irp->Iopb.TargetInstance = instance;
+    }
+
+    Irp->PreStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    if (preOperation != NULL || postOperation != NULL) {
+
+        Irp->Original = Irp->Iopb.Parameters;
+        Irp->PreStatus = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+
+        KeInitializeEvent( &Irp->Completed, NotificationEvent, FALSE );
+
+        if (preOperation != NULL) {
+
+            Irp->InPreOperation = TRUE;
+            Irp->PreStatus = preOperation( &Irp->Data, &Irp->Objects, &Irp->CompletionContext );
+            Irp->InPreOperation = FALSE;
+
+            if (KeGetCurrentIrql() != sendIrql) {
+
+                SimBugCheck( __FILE__, __LINE__, "pre-operation callback returned at another IRQL" );
+            }
+
+            if (Irp->PreStatus == FLT_PREOP_PENDING) {
+
+                SimCount( PendedPreOperations );
+
+                KeWaitForSingleObject( &Irp->Completed, Executive, KernelMode, FALSE, NULL );
+                KeClearEvent( &Irp->Completed );
+
+                Irp->PreStatus = Irp->PendedStatus;
+                Irp->CompletionContext = Irp->PendedContext;
+            }
+        }
+
+        if (!FlagOn( Irp->Data.Flags, FLTFL_CALLBACK_DATA_DIRTY ) &&
+            memcmp( &Irp->Original, &Irp->Iopb.Parameters, sizeof(FLT_PARAMETERS) ) != 0) {
+
+            SimBugCheck( __FILE__, __LINE__, "parameters changed without FltSetCallbackDataDirty" );
+        }
+
+        switch (Irp->PreStatus) {
+
+            case FLT_PREOP_COMPLETE:
+
+                postOperation = NULL;
+                break;
+
+            case FLT_PREOP_DISALLOW_FASTIO:
+
+                if (FLT_IS_FASTIO_OPERATION( &Irp->Data )) {
+
+                    SimDereferenceInstance( instance );
+                    return SIM_STATUS_FAST_IO_DISALLOWED;
+                }
+
+                postOperation = NULL;
+                break;
+
+            case FLT_PREOP_SUCCESS_NO_CALLBACK:
+
+                postOperation = NULL;
+                break;
+
+            case FLT_PREOP_SUCCESS_WITH_CALLBACK:
+            case FLT_PREOP_SYNCHRONIZE:
+
+                break;
+
+            default:
+
+                SimBugCheck( __FILE__, __LINE__, "bad pre-operation status" );
+        }
+    }
+
+    if (Irp->PreStatus != FLT_PREOP_COMPLETE) {
+
+        SimFileSystem( Irp );
+    }
+
+    //
+    //  The file system is done with the parameters the filter gave it.
+    //  Keep its MDL to free at completion, and give the post-operation
+    //  callback the parameters as they were sent.
+    //
+
+    if (FlagOn( Irp->Data.Flags, FLTFL_CALLBACK_DATA_DIRTY )) {
+
+        if (hasBuffer) {
+
+            SimIrpBuffer( &Irp->Iopb.Parameters, major, &buffer, &mdl, &length );
+            swappedMdl = *mdl;
+
+            SimIrpBuffer( &Irp->Original, major, &buffer, &mdl, &length );
+
+            if (swappedMdl == *mdl) {
+
+                swappedMdl = NULL;
+            }
+        }
+
+        Irp->Iopb.Parameters = Irp->Original;
+        ClearFlag( Irp->Data.Flags, FLTFL_CALLBACK_DATA_DIRTY );
+    }
+
+    Irp->SwappedMdl = swappedMdl;
+
+    if (postOperation != NULL) {
+
+        KIRQL completionIrql = SimCompletionIrql( Irp, sendIrql );
+
+        if (completionIrql == DISPATCH_LEVEL && sendIrql < DISPATCH_LEVEL) {
+
+            SimCount( DispatchCompletions );
+        }
+
+        KeRaiseIrql( completionIrql, &oldIrql );
+
+        postStatus = postOperation( &Irp->Data, &Irp->Objects, Irp->CompletionContext, 0 );
+
+        if (KeGetCurrentIrql() != completionIrql) {
+
+            SimBugCheck( __FILE__, __LINE__, "post-operation callback returned at another IRQL" );
+        }
+
+        KeLowerIrql( oldIrql );
+
+        if (postStatus == FLT_POSTOP_MORE_PROCESSING_REQUIRED) {
+
+            SimCount( PendedPostOperations );
+
+            KeWaitForSingleObject( &Irp->Completed, Executive, KernelMode, FALSE, NULL );
+        }
+    }
+
+    //
+    //  Completion frees the MDLs the filter left in the operation, but
+    //  not one the post-operation callback took back.
+    //
+
+    if (swappedMdl != NULL && !Irp->SwappedMdlRetained) {
+
+        if (FlagOn( swappedMdl->MdlFlags, MDL_PAGES_LOCKED ) &&
+            !FlagOn( swappedMdl->MdlFlags, MDL_PARTIAL )) {
+
+            MmUnlockPages( swappedMdl );
+        }
+
+        IoFreeMdl( swappedMdl );
+    }
+
+    if (Irp->LockedMdl != NULL) {
+
+        MmUnlockPages( Irp->LockedMdl );
+        IoFreeMdl( Irp->LockedMdl );
+    }
+
+    if (instance != NULL) {
+
+        SimDereferenceInstance( instance );
+    }
+
+    return Irp->Data.IoStatus.Status;
+}
+
+
+/*************************************************************************
+    File system
+*************************************************************************/
+
+static NTSTATUS
+SimPagingIo (
+    __in PSIM_FILE File,
+    __in UCHAR MajorFunction,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in PVOID Buffer,
+    __out PULONG Transferred
+    )
+/*++
+
+Routine Description:
+
+    Cache manager paging I/O of a nonpaged buffer, sent through the
+    filter at APC_LEVEL as the memory manager would send it.
+
+--*/
+{
+    SIM_IRP irp;
+    KIRQL oldIrql;
+    PMDL mdl;
+    NTSTATUS status;
+
+    mdl = IoAllocateMdl( Buffer, Length, FALSE, FALSE, NULL );
+
+    if (mdl == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MmBuildMdlForNonPagedPool( mdl );
+
+    SimInitializeIrp( &irp, File, MajorFunction, SIM_IO_PAGING );
+
+    if (MajorFunction == IRP_MJ_READ) {
+
+        SimCount( PagingReads );
+
+        irp.Iopb.Parameters.Read.Length = Length;
+        irp.Iopb.Parameters.Read.ByteOffset.QuadPart = Offset;
+        irp.Iopb.Parameters.Read.ReadBuffer = Buffer;
+        irp.Iopb.Parameters.Read.MdlAddress = mdl;
+
+    } else {
+
+        SimCount( PagingWrites );
+
+        irp.Iopb.Parameters.Write.Length = Length;
+        irp.Iopb.Parameters.Write.ByteOffset.QuadPart = Offset;
+        irp.Iopb.Parameters.Write.WriteBuffer = Buffer;
+        irp.Iopb.Parameters.Write.MdlAddress = mdl;
+    }
+
+    KeRaiseIrql( max( KeGetCurrentIrql(), APC_LEVEL ), &oldIrql );
+
+    status = SimSendIrp( &irp );
+
+    KeLowerIrql( oldIrql );
+
+    IoFreeMdl( mdl );
+
+    *Transferred = (ULONG)irp.Data.IoStatus.Information;
+
+    return status;
+}
+
+
+static VOID
+SimCacheIo (
+    __inout PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    A cached read or write.  The pages it touches are read with paging
+    I/O; a write then extends the file to its end if it goes past it,
+    modifies them and writes them back.  Writes to a stream are
+    serialized so that two of them do not read and write back the same
+    page over each other.
+
+--*/
+{
+    PSIM_STREAM stream = Irp->File->Stream;
+    BOOLEAN isWrite = (Irp->Iopb.MajorFunction == IRP_MJ_WRITE);
+    LONGLONG offset;
+    ULONG length;
+    PUCHAR userBuffer = SimIrpSystemBuffer( Irp );
+    LONGLONG start;
+    LONGLONG end;
+    ULONG span;
+    ULONG transferred = 0;
+    PUCHAR pages = NULL;
+    NTSTATUS status;
+
+    if (isWrite) {
+
+        offset = Irp->Iopb.Parameters.Write.ByteOffset.QuadPart;
+        length = Irp->Iopb.Parameters.Write.Length;
+
+        pthread_mutex_lock( &stream->CacheLock );
+
+        status = SimStreamSetSize( stream, offset + length, TRUE );
+
+        if (!NT_SUCCESS( status )) {
+
+            goto Exit;
+        }
+
+    } else {
+
+        offset = Irp->Iopb.Parameters.Read.ByteOffset.QuadPart;
+        length = Irp->Iopb.Parameters.Read.Length;
+
+        if (offset >= stream->FileSize) {
+
+            Irp->Data.IoStatus.Status = STATUS_END_OF_FILE;
+            return;
+        }
+
+        length = (ULONG)min( (LONGLONG)length, stream->FileSize - offset );
+    }
+
+    start = offset & ~(LONGLONG)(PAGE_SIZE - 1);
+    end = (LONGLONG)ROUND_TO_PAGES( offset + length );
+    span = (ULONG)(end - start);
+
+    pages = ExAllocatePoolWithTag( NonPagedPool, span, SIM_CACHE_TAG );
+
+    if (pages == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    status = SimPagingIo( Irp->File, IRP_MJ_READ, start, span, pages, &transferred );
+
+    if (status == STATUS_END_OF_FILE) {
+
+        transferred = 0;
+        status = STATUS_SUCCESS;
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        goto Exit;
+    }
+
+    RtlZeroMemory( pages + transferred, span - transferred );
+
+    if (isWrite) {
+
+        RtlCopyMemory( pages + (offset - start), userBuffer, length );
+
+        status = SimPagingIo( Irp->File, IRP_MJ_WRITE, start, span, pages, &transferred );
+
+    } else {
+
+        RtlCopyMemory( userBuffer, pages + (offset - start), length );
+    }
+
+Exit:
+
+    if (pages != NULL) {
+
+        ExFreePoolWithTag( pages, SIM_CACHE_TAG );
+    }
+
+    if (isWrite) {
+
+        pthread_mutex_unlock( &stream->CacheLock );
+    }
+
+    Irp->Data.IoStatus.Status = status;
+    Irp->Data.IoStatus.Information = NT_SUCCESS( status ) ? length : 0;
+}
+
+
+static VOID
+SimFsMoveFilePointer (
+    __inout PSIM_IRP Irp,
+    __in LONGLONG Offset
+    )
+/*++
+
+Routine Description:
+
+    Moves the file pointer of a synchronous open past what a read or
+    write transferred from Offset, as a file system does for everything
+    but paging I/O.
+
+--*/
+{
+    PFILE_OBJECT fileObject = &Irp->File->FileObject;
+
+    if (NT_SUCCESS( Irp->Data.IoStatus.Status ) &&
+        !FlagOn( Irp->Iopb.IrpFlags, IRP_PAGING_IO ) &&
+        FlagOn( fileObject->Flags, FO_SYNCHRONOUS_IO )) {
+
+        fileObject->CurrentByteOffset.QuadPart = Offset + (LONGLONG)Irp->Data.IoStatus.Information;
+    }
+}
+
+
+static VOID
+SimFsReadWrite (
+    __inout PSIM_IRP Irp
+    )
+{
+    PSIM_STREAM stream = Irp->File->Stream;
+    BOOLEAN isWrite = (Irp->Iopb.MajorFunction == IRP_MJ_WRITE);
+    LONGLONG offset;
+    ULONG length;
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    if (stream->IsDirectory) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        return;
+    }
+
+    if (isWrite) {
+
+        offset = Irp->Iopb.Parameters.Write.ByteOffset.QuadPart;
+        length = Irp->Iopb.Parameters.Write.Length;
+
+        if (!FlagOn( Irp->Iopb.IrpFlags, IRP_PAGING_IO ) &&
+            !Irp->File->FileObject.WriteAccess) {
+
+            Irp->Data.IoStatus.Status = STATUS_ACCESS_DENIED;
+            return;
+        }
+
+    } else {
+
+        offset = Irp->Iopb.Parameters.Read.ByteOffset.QuadPart;
+        length = Irp->Iopb.Parameters.Read.Length;
+    }
+
+    if (offset < 0) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    if (!FlagOn( Irp->Iopb.IrpFlags, IRP_NOCACHE | IRP_PAGING_IO )) {
+
+        SimCacheIo( Irp );
+        SimFsMoveFilePointer( Irp, offset );
+        return;
+    }
+
+    //
+    //  Noncached I/O moves whole sectors.
+    //
+
+    if ((offset & (Irp->File->Volume->SectorSize - 1)) != 0 ||
+        (length & (Irp->File->Volume->SectorSize - 1)) != 0) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    if (isWrite) {
+
+        status = SimStreamWrite( stream,
+                                 offset,
+                                 length,
+                                 SimIrpSystemBuffer( Irp ),
+                                 !FlagOn( Irp->Iopb.IrpFlags, IRP_PAGING_IO ),
+                                 &transferred );
+
+    } else {
+
+        status = SimStreamRead( stream, offset, length, SimIrpSystemBuffer( Irp ), &transferred );
+    }
+
+    Irp->Data.IoStatus.Status = status;
+    Irp->Data.IoStatus.Information = transferred;
+
+    SimFsMoveFilePointer( Irp, offset );
+}
+
+
+static LONGLONG
+SimNtTime (
+    __in const struct timespec *Time
+    )
+{
+    return ((LONGLONG)Time->tv_sec + 11644473600LL) * 10000000 + Time->tv_nsec / 100;
+}
+
+
+static LONGLONG
+SimOpenStreamSize (
+    __in PFLT_VOLUME Volume,
+    __in int DirectoryFd,
+    __in PCSTR Name,
+    __in const struct stat *Stat
+    )
+/*++
+
+Routine Description:
+
+    The size of a file as the file system has it.  For an open file that
+    is the stream's, since the host file is longer while it is mapped;
+    for a closed one, the size stored with it.
+
+--*/
+{
+    LONGLONG size = -1;
+    PLIST_ENTRY entry;
+    int fd;
+
+    pthread_mutex_lock( &Volume->Lock );
+
+    for (entry = Volume->Streams.Flink; entry != &Volume->Streams; entry = entry->Flink) {
+
+        PSIM_STREAM stream = CONTAINING_RECORD( entry, SIM_STREAM, Links );
+
+        if (stream->Device == Stat->st_dev && stream->Inode == Stat->st_ino) {
+
+            size = stream->FileSize;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &Volume->Lock );
+
+    if (size < 0) {
+
+        size = Stat->st_size;
+
+        fd = openat( DirectoryFd, Name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC );
+
+        if (fd >= 0) {
+
+            size = SimStoredSize( fd, Stat, Volume->SectorSize );
+            close( fd );
+        }
+    }
+
+    return size;
+}
+
+
+static VOID
+SimFsQueryDirectory (
+    __inout PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    IRP_MN_QUERY_DIRECTORY.  Returns the entries that fit from where the
+    last query stopped, each on an eight byte boundary.  If not even the
+    first fits, the status is STATUS_BUFFER_OVERFLOW and it is returned
+    by the next query.
+
+--*/
+{
+    PSIM_FILE file = Irp->File;
+    FILE_INFORMATION_CLASS infoClass = Irp->Iopb.Parameters.DirectoryControl.QueryDirectory.FileInformationClass;
+    ULONG length = Irp->Iopb.Parameters.DirectoryControl.QueryDirectory.Length;
+    PUCHAR buffer = SimIrpSystemBuffer( Irp );
+    PULONG previous = NULL;
+    ULONG used = 0;
+    ULONG count = 0;
+    ULONG nameOffset;
+    NTSTATUS status = STATUS_SUCCESS;
+    struct dirent *dirent;
+    WCHAR name[SIM_MAX_PATH];
+
+    switch (infoClass) {
+
+        case FileDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_DIRECTORY_INFORMATION, FileName );
+            break;
+
+        case FileFullDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_FULL_DIR_INFORMATION, FileName );
+            break;
+
+        case FileIdFullDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_ID_FULL_DIR_INFORMATION, FileName );
+            break;
+
+        case FileBothDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_BOTH_DIR_INFORMATION, FileName );
+            break;
+
+        case FileIdBothDirectoryInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_ID_BOTH_DIR_INFORMATION, FileName );
+            break;
+
+        case FileNamesInformation:
+
+            nameOffset = FIELD_OFFSET( FILE_NAMES_INFORMATION, FileName );
+            break;
+
+        default:
+
+            Irp->Data.IoStatus.Status = STATUS_INVALID_INFO_CLASS;
+            return;
+    }
+
+    if (!file->Stream->IsDirectory) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    pthread_mutex_lock( &file->DirectoryLock );
+
+    if (!file->Enumerating || FlagOn( Irp->Iopb.OperationFlags, SL_RESTART_SCAN )) {
+
+        rewinddir( file->Directory );
+        file->Enumerating = TRUE;
+    }
+
+    for (;;) {
+
+        long position = telldir( file->Directory );
+        ULONG nameLength;
+        ULONG entryOffset;
+        ULONG entryLength;
+        struct stat st;
+        PUCHAR entry;
+
+        dirent = readdir( file->Directory );
+
+        if (dirent == NULL) {
+
+            break;
+        }
+
+        if (file->Pattern[0] != '\0' &&
+            fnmatch( file->Pattern, dirent->d_name, FNM_CASEFOLD ) != 0) {
+
+            continue;
+        }
+
+        if (fstatat( dirfd( file->Directory ), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW ) != 0) {
+
+            continue;
+        }
+
+        nameLength = SimUtf8ToUtf16( dirent->d_name,
+                                     strlen( dirent->d_name ),
+                                     name,
+                                     RTL_NUMBER_OF( name ) ) * sizeof(WCHAR);
+
+        entryOffset = (ULONG)ROUND_TO_SIZE( used, sizeof(LONGLONG) );
+        entryLength = nameOffset + nameLength;
+
+        if ((ULONGLONG)entryOffset + entryLength > length) {
+
+            seekdir( file->Directory, position );
+
+            if (count == 0) {
+
+                status = STATUS_BUFFER_OVERFLOW;
+            }
+
+            break;
+        }
+
+        entry = buffer + entryOffset;
+        RtlZeroMemory( entry, nameOffset );
+
+        if (infoClass == FileNamesInformation) {
+
+            PFILE_NAMES_INFORMATION names = (PFILE_NAMES_INFORMATION)entry;
+
+            names->FileNameLength = nameLength;
+
+        } else {
+
+            //
+            //  The other classes all start like FILE_DIRECTORY_INFORMATION.
+            //
+
+            PFILE_DIRECTORY_INFORMATION info = (PFILE_DIRECTORY_INFORMATION)entry;
+
+            info->CreationTime.QuadPart = SimNtTime( &st.st_ctim );
+            info->LastAccessTime.QuadPart = SimNtTime( &st.st_atim );
+            info->LastWriteTime.QuadPart = SimNtTime( &st.st_mtim );
+            info->ChangeTime.QuadPart = SimNtTime( &st.st_ctim );
+
+            if (S_ISDIR( st.st_mode )) {
+
+                info->FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+
+            } else {
+
+                info->EndOfFile.QuadPart = SimOpenStreamSize( file->Volume,
+                                                               dirfd( file->Directory ),
+                                                               dirent->d_name,
+                                                               &st );
+                info->AllocationSize.QuadPart = ROUND_TO_SIZE( info->EndOfFile.QuadPart, PAGE_SIZE );
+                info->FileAttributes = FILE_ATTRIBUTE_ARCHIVE;
+            }
+
+            info->FileNameLength = nameLength;
+
+            if (infoClass == FileIdFullDirectoryInformation) {
+
+                ((PFILE_ID_FULL_DIR_INFORMATION)entry)->FileId.QuadPart = (LONGLONG)st.st_ino;
+
+            } else if (infoClass == FileIdBothDirectoryInformation) {
+
+                ((PFILE_ID_BOTH_DIR_INFORMATION)entry)->FileId.QuadPart = (LONGLONG)st.st_ino;
+            }
+        }
+
+        RtlCopyMemory( entry + nameOffset, name, nameLength );
+
+        if (previous != NULL) {
+
+            *previous = entryOffset - (ULONG)((PUCHAR)previous - buffer);
+        }
+
+        previous = (PULONG)entry;
+        used = entryOffset + entryLength;
+        count++;
+
+        if (FlagOn( Irp->Iopb.OperationFlags, SL_RETURN_SINGLE_ENTRY )) {
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &file->DirectoryLock );
+
+    if (count == 0 && status == STATUS_SUCCESS) {
+
+        status = STATUS_NO_MORE_FILES;
+    }
+
+    Irp->Data.IoStatus.Status = status;
+    Irp->Data.IoStatus.Information = used;
+}
+
+
+static VOID
+SimFsQueryInformation (
+    __inout PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    IRP_MJ_QUERY_INFORMATION of the standard, network open, all, internal
+    and position classes.  The allocation is the end of file rounded up
+    to a page, as in a directory listing.
+
+--*/
+{
+    PSIM_STREAM stream = Irp->File->Stream;
+    PFILE_OBJECT fileObject = &Irp->File->FileObject;
+    PUCHAR buffer = Irp->Iopb.Parameters.QueryFileInformation.InfoBuffer;
+    ULONG length = Irp->Iopb.Parameters.QueryFileInformation.Length;
+    FILE_BASIC_INFORMATION basic;
+    FILE_STANDARD_INFORMATION standard;
+    PFILE_NETWORK_OPEN_INFORMATION networkOpen;
+    PFILE_ALL_INFORMATION all;
+    ULONG nameOffset = FIELD_OFFSET( FILE_ALL_INFORMATION, NameInformation.FileName );
+    ULONG nameLength;
+    ULONG returned = 0;
+    struct stat st;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (fstat( stream->Fd, &st ) != 0) {
+
+        RtlZeroMemory( &st, sizeof(st) );
+    }
+
+    RtlZeroMemory( &basic, sizeof(basic) );
+    basic.CreationTime.QuadPart = SimNtTime( &st.st_ctim );
+    basic.LastAccessTime.QuadPart = SimNtTime( &st.st_atim );
+    basic.LastWriteTime.QuadPart = SimNtTime( &st.st_mtim );
+    basic.ChangeTime.QuadPart = SimNtTime( &st.st_ctim );
+    basic.FileAttributes = stream->IsDirectory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+
+    RtlZeroMemory( &standard, sizeof(standard) );
+    standard.EndOfFile.QuadPart = stream->IsDirectory ? 0 : stream->FileSize;
+    standard.AllocationSize.QuadPart = ROUND_TO_PAGES( standard.EndOfFile.QuadPart );
+    standard.NumberOfLinks = (ULONG)st.st_nlink;
+    standard.Directory = stream->IsDirectory;
+
+    switch (Irp->Iopb.Parameters.QueryFileInformation.FileInformationClass) {
+
+        case FileStandardInformation:
+
+            returned = sizeof(FILE_STANDARD_INFORMATION);
+
+            if (length < returned) {
+
+                status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            RtlCopyMemory( buffer, &standard, returned );
+            break;
+
+        case FileNetworkOpenInformation:
+
+            returned = sizeof(FILE_NETWORK_OPEN_INFORMATION);
+
+            if (length < returned) {
+
+                status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            networkOpen = (PFILE_NETWORK_OPEN_INFORMATION)buffer;
+            networkOpen->CreationTime = basic.CreationTime;
+            networkOpen->LastAccessTime = basic.LastAccessTime;
+            networkOpen->LastWriteTime = basic.LastWriteTime;
+            networkOpen->ChangeTime = basic.ChangeTime;
+            networkOpen->AllocationSize = standard.AllocationSize;
+            networkOpen->EndOfFile = standard.EndOfFile;
+            networkOpen->FileAttributes = basic.FileAttributes;
+            break;
+
+        case FileInternalInformation:
+
+            returned = sizeof(FILE_INTERNAL_INFORMATION);
+
+            if (length < returned) {
+
+                status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            ((PFILE_INTERNAL_INFORMATION)buffer)->IndexNumber.QuadPart = (LONGLONG)stream->Inode;
+            break;
+
+        case FilePositionInformation:
+
+            returned = sizeof(FILE_POSITION_INFORMATION);
+
+            if (length < returned) {
+
+                status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            ((PFILE_POSITION_INFORMATION)buffer)->CurrentByteOffset = fileObject->CurrentByteOffset;
+            break;
+
+        case FileAllInformation:
+
+            //
+            //  As much of the name as fits.
+            //
+
+            if (length < nameOffset) {
+
+                status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            all = (PFILE_ALL_INFORMATION)buffer;
+            RtlZeroMemory( all, nameOffset );
+
+            all->BasicInformation = basic;
+            all->StandardInformation = standard;
+            all->InternalInformation.IndexNumber.QuadPart = (LONGLONG)stream->Inode;
+            all->PositionInformation.CurrentByteOffset = fileObject->CurrentByteOffset;
+            all->NameInformation.FileNameLength = fileObject->FileName.Length;
+
+            nameLength = min( (ULONG)fileObject->FileName.Length, length - nameOffset );
+            RtlCopyMemory( all->NameInformation.FileName, fileObject->FileName.Buffer, nameLength );
+
+            returned = nameOffset + nameLength;
+
+            if (nameLength < fileObject->FileName.Length) {
+
+                status = STATUS_BUFFER_OVERFLOW;
+            }
+
+            break;
+
+        default:
+
+            status = STATUS_INVALID_INFO_CLASS;
+            break;
+    }
+
+    Irp->Data.IoStatus.Status = status;
+    Irp->Data.IoStatus.Information = (NT_SUCCESS( status ) || status == STATUS_BUFFER_OVERFLOW) ? returned : 0;
+}
+
+
+static VOID
+SimFsSetInformation (
+    __inout PSIM_IRP Irp
+    )
+/*++
+
+Routine Description:
+
+    IRP_MJ_SET_INFORMATION of the end of file, the allocation, the valid
+    data length and the position.  An allocation below the end of file
+    truncates the file to it.  An end of file set with AdvanceOnly, as
+    the cache manager's lazy writer sets it, never moves it back.  The
+    position needs no write access.
+
+--*/
+{
+    PSIM_STREAM stream = Irp->File->Stream;
+    ULONG length = Irp->Iopb.Parameters.SetFileInformation.Length;
+    FILE_INFORMATION_CLASS infoClass = Irp->Iopb.Parameters.SetFileInformation.FileInformationClass;
+    LONGLONG value;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (stream->IsDirectory) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        return;
+    }
+
+    if (!FlagOn( Irp->Iopb.IrpFlags, IRP_PAGING_IO ) &&
+        !Irp->File->FileObject.WriteAccess &&
+        infoClass != FilePositionInformation) {
+
+        Irp->Data.IoStatus.Status = STATUS_ACCESS_DENIED;
+        return;
+    }
+
+    //
+    //  All four classes are one LARGE_INTEGER.
+    //
+
+    if (length < sizeof(LARGE_INTEGER)) {
+
+        Irp->Data.IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+        return;
+    }
+
+    RtlCopyMemory( &value, Irp->Iopb.Parameters.SetFileInformation.InfoBuffer, sizeof(value) );
+
+    if (value < 0) {
+
+        Irp->Data.IoStatus.Status = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    switch (infoClass) {
+
+        case FileEndOfFileInformation:
+
+            status = SimStreamSetSize( stream,
+                                       value,
+                                       Irp->Iopb.Parameters.SetFileInformation.AdvanceOnly );
+            break;
+
+        case FileAllocationInformation:
+
+            if (value < stream->FileSize) {
+
+                status = SimStreamSetSize( stream, value, FALSE );
+            }
+
+            break;
+
+        case FileValidDataLengthInformation:
+
+            if (value > stream->FileSize) {
+
+                status = STATUS_INVALID_PARAMETER;
+            }
+
+            break;
+
+        case FilePositionInformation:
+
+            Irp->File->FileObject.CurrentByteOffset.QuadPart = value;
+            break;
+
+        default:
+
+            status = STATUS_INVALID_INFO_CLASS;
+            break;
+    }
+
+    Irp->Data.IoStatus.Status = status;
+}
+
+
+static VOID
+SimFileSystem (
+    __inout PSIM_IRP Irp
+    )
+{
+    switch (Irp->Iopb.MajorFunction) {
+
+        case IRP_MJ_CREATE:
+
+            //
+            //  The host file was opened, and overwritten if asked to be,
+            //  before the create was sent.
+            //
+
+            Irp->Data.IoStatus.Status = STATUS_SUCCESS;
+            Irp->Data.IoStatus.Information = Irp->File->CreateInformation;
+            break;
+
+        case IRP_MJ_READ:
+        case IRP_MJ_WRITE:
+
+            SimFsReadWrite( Irp );
+            break;
+
+        case IRP_MJ_QUERY_INFORMATION:
+
+            SimFsQueryInformation( Irp );
+            break;
+
+        case IRP_MJ_SET_INFORMATION:
+
+            SimFsSetInformation( Irp );
+            break;
+
+        case IRP_MJ_FLUSH_BUFFERS:
+
+            //
+            //  The cache keeps nothing to flush.
+            //
+
+            Irp->Data.IoStatus.Status = STATUS_SUCCESS;
+            break;
+
+        case IRP_MJ_DIRECTORY_CONTROL:
+
+            SimFsQueryDirectory( Irp );
+            break;
+
+        default:
+
+            Irp->Data.IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+    }
+}
+
+
+/*************************************************************************
+    Files
+*************************************************************************/
+
+static VOID
+SimReleaseStream (
+    __in PSIM_FILE File
+    )
+{
+    PFLT_VOLUME volume = File->Volume;
+    PSIM_STREAM stream = File->Stream;
+
+    pthread_mutex_lock( &volume->Lock );
+
+    if (--stream->OpenCount == 0) {
+
+        SimRemoveEntry( &stream->Links );
+        SimStreamClose( stream );
+    }
+
+    pthread_mutex_unlock( &volume->Lock );
+}
+
+
+NTSTATUS
+SimOpenFile (
+    __in PSIM_VOLUME Volume,
+    __in PCSTR Path,
+    __in ULONG Options,
+    __out PSIM_FILE *File
+    )
+{
+    CHAR hostPath[SIM_MAX_PATH];
+    PSIM_STREAM stream = NULL;
+    PSIM_FILE file;
+    PLIST_ENTRY entry;
+    struct stat st;
+    SIM_IRP irp;
+    NTSTATUS status;
+    ULONG nameLength;
+    ULONG_PTR createInformation = FILE_OPENED;
+    int flags;
+    int fd;
+    SIZE_T i;
+
+    if (strlen( Path ) >= sizeof(hostPath)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (i = 0; Path[i] != '\0'; i++) {
+
+        hostPath[i] = (Path[i] == '\\') ? '/' : Path[i];
+    }
+
+    hostPath[i] = '\0';
+
+    while (hostPath[0] == '/') {
+
+        memmove( hostPath, hostPath + 1, strlen( hostPath ) );
+    }
+
+    if (hostPath[0] == '\0') {
+
+        strcpy( hostPath, "." );
+    }
+
+    if (FlagOn( Options, SIM_OPEN_DIRECTORY )) {
+
+        flags = O_RDONLY | O_DIRECTORY;
+
+    } else {
+
+        flags = O_RDWR;
+    }
+
+    fd = -1;
+
+    if (FlagOn( Options, SIM_OPEN_CREATE ) && !FlagOn( Options, SIM_OPEN_DIRECTORY )) {
+
+        fd = openat( Volume->RootFd, hostPath, flags | O_CREAT | O_EXCL | O_CLOEXEC, 0644 );
+
+        if (fd >= 0) {
+
+            createInformation = FILE_CREATED;
+        }
+    }
+
+    if (fd < 0) {
+
+        fd = openat( Volume->RootFd, hostPath, flags | O_CLOEXEC, 0644 );
+
+        if (fd >= 0 && FlagOn( Options, SIM_OPEN_TRUNCATE )) {
+
+            createInformation = FILE_OVERWRITTEN;
+        }
+    }
+
+    if (fd < 0) {
+
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    if (fstat( fd, &st ) != 0) {
+
+        close( fd );
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    file = calloc( 1, sizeof(*file) );
+
+    if (file == NULL) {
+
+        close( fd );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    //  Opens of the same file share its stream.
+    //
+
+    pthread_mutex_lock( &Volume->Lock );
+
+    for (entry = Volume->Streams.Flink; entry != &Volume->Streams; entry = entry->Flink) {
+
+        PSIM_STREAM candidate = CONTAINING_RECORD( entry, SIM_STREAM, Links );
+
+        if (candidate->Device == st.st_dev && candidate->Inode == st.st_ino) {
+
+            stream = candidate;
+            break;
+        }
+    }
+
+    if (stream != NULL) {
+
+        close( fd );
+
+        if (FlagOn( Options, SIM_OPEN_TRUNCATE )) {
+
+            SimStreamSetSize( stream, 0, FALSE );
+        }
+
+    } else {
+
+        stream = calloc( 1, sizeof(*stream) );
+
+        if (stream == NULL) {
+
+            pthread_mutex_unlock( &Volume->Lock );
+            close( fd );
+            free( file );
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (FlagOn( Options, SIM_OPEN_TRUNCATE ) && ftruncate( fd, 0 ) == 0) {
+
+            st.st_size = 0;
+        }
+
+        stream->Volume = Volume;
+        stream->Device = st.st_dev;
+        stream->Inode = st.st_ino;
+        stream->Fd = fd;
+        stream->IsDirectory = S_ISDIR( st.st_mode );
+        stream->FileSize = stream->IsDirectory ? 0 : SimStoredSize( fd, &st, Volume->SectorSize );
+
+        pthread_rwlock_init( &stream->MapLock, NULL );
+        pthread_mutex_init( &stream->SizeLock, NULL );
+        pthread_mutex_init( &stream->CacheLock, NULL );
+        pthread_mutex_init( &stream->ContextLock, NULL );
+
+        if (!stream->IsDirectory && st.st_size > 0) {
+
+            stream->Map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+            if (stream->Map == MAP_FAILED) {
+
+                stream->Map = NULL;
+
+            } else {
+
+                stream->Capacity = st.st_size;
+            }
+        }
+
+        SimInsertTail( &Volume->Streams, &stream->Links );
+    }
+
+    stream->OpenCount++;
+
+    pthread_mutex_unlock( &Volume->Lock );
+
+    file->Stream = stream;
+    file->Volume = Volume;
+    file->CreateInformation = createInformation;
+
+    pthread_mutex_init( &file->DirectoryLock, NULL );
+
+    if (stream->IsDirectory) {
+
+        file->Directory = fdopendir( dup( stream->Fd ) );
+    }
+
+    //
+    //  The name the filter sees runs from the volume's root.
+    //
+
+    file->FileName[0] = L'\\';
+    nameLength = 1;
+
+    if (strcmp( hostPath, "." ) != 0) {
+
+        nameLength += SimUtf8ToUtf16( hostPath,
+                                      strlen( hostPath ),
+                                      &file->FileName[1],
+                                      RTL_NUMBER_OF( file->FileName ) - 1 );
+    }
+
+    for (i = 0; i < nameLength; i++) {
+
+        if (file->FileName[i] == L'/') {
+
+            file->FileName[i] = L'\\';
+        }
+    }
+
+    file->FileObject.Type = 5;
+    file->FileObject.Size = sizeof(FILE_OBJECT);
+    file->FileObject.DeviceObject = Volume->DiskDevice;
+    file->FileObject.FsContext = stream;
+    file->FileObject.FsContext2 = file;
+    file->FileObject.ReadAccess = TRUE;
+    file->FileObject.WriteAccess = BooleanFlagOn( Options, SIM_OPEN_WRITE );
+
+    if (FlagOn( Options, SIM_OPEN_SYNCHRONOUS )) {
+
+        SetFlag( file->FileObject.Flags, FO_SYNCHRONOUS_IO );
+    }
+    file->FileObject.FileName.Buffer = file->FileName;
+    file->FileObject.FileName.Length = (USHORT)(nameLength * sizeof(WCHAR));
+    file->FileObject.FileName.MaximumLength = sizeof(file->FileName);
+
+    SimCount( Creates );
+
+    SimInitializeIrp( &irp, file, IRP_MJ_CREATE, 0 );
+
+    irp.Iopb.Parameters.Create.Options = FlagOn( Options, SIM_OPEN_DIRECTORY ) ?
+                                         FILE_DIRECTORY_FILE : FILE_NON_DIRECTORY_FILE;
+
+    if (FlagOn( Options, SIM_OPEN_SYNCHRONOUS )) {
+
+        SetFlag( irp.Iopb.Parameters.Create.Options, FILE_SYNCHRONOUS_IO_NONALERT );
+    }
+
+    status = SimSendIrp( &irp );
+
+    if (!NT_SUCCESS( status )) {
+
+        SimCloseFile( file );
+        return status;
+    }
+
+    *File = file;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SimCloseFile (
+    __in PSIM_FILE File
+    )
+{
+    if (File->Directory != NULL) {
+
+        closedir( File->Directory );
+    }
+
+    SimReleaseStream( File );
+
+    pthread_mutex_destroy( &File->DirectoryLock );
+
+    free( File );
+}
+
+
+LONGLONG
+SimFileSize (
+    __in PSIM_FILE File
+    )
+{
+    return File->Stream->FileSize;
+}
+
+
+/*************************************************************************
+    I/O
+*************************************************************************/
+
+static NTSTATUS
+SimSendReadWrite (
+    __in PSIM_FILE File,
+    __in UCHAR MajorFunction,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in PVOID Buffer,
+    __in ULONG Flags,
+    __out_opt PULONG Transferred
+    )
+{
+    SIM_IRP irp;
+    PMDL mdl = NULL;
+    KIRQL oldIrql;
+    NTSTATUS status;
+
+    if (FlagOn( Flags, SIM_IO_FAST ) &&
+        FlagOn( Flags, SIM_IO_NONCACHED | SIM_IO_PAGING | SIM_IO_MDL )) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  The I/O manager fills in the file pointer of a synchronous open
+    //  before the operation is sent.
+    //
+
+    if (Offset == SIM_USE_FILE_POINTER) {
+
+        if (!FlagOn( File->FileObject.Flags, FO_SYNCHRONOUS_IO ) ||
+            FlagOn( Flags, SIM_IO_PAGING )) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Offset = File->FileObject.CurrentByteOffset.QuadPart;
+    }
+
+    //
+    //  Paging I/O always comes with an MDL.
+    //
+
+    if (FlagOn( Flags, SIM_IO_PAGING )) {
+
+        SetFlag( Flags, SIM_IO_MDL );
+    }
+
+    if (FlagOn( Flags, SIM_IO_MDL )) {
+
+        mdl = IoAllocateMdl( Buffer, Length, FALSE, FALSE, NULL );
+
+        if (mdl == NULL) {
+
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        MmProbeAndLockPages( mdl, KernelMode, IoWriteAccess );
+    }
+
+    for (;;) {
+
+        SimInitializeIrp( &irp, File, MajorFunction, Flags );
+
+        if (MajorFunction == IRP_MJ_READ) {
+
+            irp.Iopb.Parameters.Read.Length = Length;
+            irp.Iopb.Parameters.Read.ByteOffset.QuadPart = Offset;
+            irp.Iopb.Parameters.Read.ReadBuffer = Buffer;
+            irp.Iopb.Parameters.Read.MdlAddress = mdl;
+
+        } else {
+
+            irp.Iopb.Parameters.Write.Length = Length;
+            irp.Iopb.Parameters.Write.ByteOffset.QuadPart = Offset;
+            irp.Iopb.Parameters.Write.WriteBuffer = Buffer;
+            irp.Iopb.Parameters.Write.MdlAddress = mdl;
+        }
+
+        //
+        //  Paging I/O comes from the memory manager at APC_LEVEL.
+        //
+
+        KeRaiseIrql( FlagOn( Flags, SIM_IO_PAGING ) ? APC_LEVEL : PASSIVE_LEVEL, &oldIrql );
+
+        status = SimSendIrp( &irp );
+
+        KeLowerIrql( oldIrql );
+
+        if (status != SIM_STATUS_FAST_IO_DISALLOWED) {
+
+            break;
+        }
+
+        ClearFlag( Flags, SIM_IO_FAST );
+    }
+
+    if (mdl != NULL) {
+
+        MmUnlockPages( mdl );
+        IoFreeMdl( mdl );
+    }
+
+    if (Transferred != NULL) {
+
+        *Transferred = (ULONG)irp.Data.IoStatus.Information;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+SimRead (
+    __in PSIM_FILE File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Flags,
+    __out_opt PULONG BytesRead
+    )
+{
+    SimCount( Reads );
+
+    return SimSendReadWrite( File, IRP_MJ_READ, Offset, Length, Buffer, Flags, BytesRead );
+}
+
+
+NTSTATUS
+SimWrite (
+    __in PSIM_FILE File,
+    __in LONGLONG Offset,
+    __in ULONG Length,
+    __in_bcount(Length) CONST VOID *Buffer,
+    __in ULONG Flags,
+    __out_opt PULONG BytesWritten
+    )
+{
+    SimCount( Writes );
+
+    return SimSendReadWrite( File, IRP_MJ_WRITE, Offset, Length, (PVOID)Buffer, Flags, BytesWritten );
+}
+
+
+NTSTATUS
+SimQueryDirectory (
+    __in PSIM_FILE Directory,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __in_opt PCSTR Pattern,
+    __in ULONG QueryFlags,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __in ULONG Flags,
+    __out_opt PULONG BytesReturned
+    )
+{
+    UNICODE_STRING fileName;
+    WCHAR nameBuffer[SIM_MAX_PATH];
+    PMDL mdl = NULL;
+    SIM_IRP irp;
+    NTSTATUS status;
+
+    if (!Directory->Stream->IsDirectory) {
+
+        return STATUS_NOT_A_DIRECTORY;
+    }
+
+    SimCount( DirectoryQueries );
+
+    //
+    //  As in the file systems, the pattern of the first query of an
+    //  enumeration holds until it is restarted.
+    //
+
+    pthread_mutex_lock( &Directory->DirectoryLock );
+
+    if (!Directory->Enumerating || FlagOn( QueryFlags, SL_RESTART_SCAN )) {
+
+        snprintf( Directory->Pattern, sizeof(Directory->Pattern), "%s",
+                  (Pattern != NULL) ? Pattern : "" );
+    }
+
+    pthread_mutex_unlock( &Directory->DirectoryLock );
+
+    if (FlagOn( Flags, SIM_IO_MDL )) {
+
+        mdl = IoAllocateMdl( Buffer, Length, FALSE, FALSE, NULL );
+
+        if (mdl == NULL) {
+
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        MmProbeAndLockPages( mdl, KernelMode, IoWriteAccess );
+    }
+
+    SimInitializeIrp( &irp, Directory, IRP_MJ_DIRECTORY_CONTROL, Flags & ~SIM_IO_FAST );
+
+    irp.Iopb.MinorFunction = IRP_MN_QUERY_DIRECTORY;
+    irp.Iopb.OperationFlags = (UCHAR)QueryFlags;
+    irp.Iopb.Parameters.DirectoryControl.QueryDirectory.Length = Length;
+    irp.Iopb.Parameters.DirectoryControl.QueryDirectory.FileInformationClass = FileInformationClass;
+    irp.Iopb.Parameters.DirectoryControl.QueryDirectory.DirectoryBuffer = Buffer;
+    irp.Iopb.Parameters.DirectoryControl.QueryDirectory.MdlAddress = mdl;
+
+    if (Pattern != NULL) {
+
+        fileName.Buffer = nameBuffer;
+        fileName.Length = (USHORT)(SimUtf8ToUtf16( Pattern,
+                                                   strlen( Pattern ),
+                                                   nameBuffer,
+                                                   RTL_NUMBER_OF( nameBuffer ) ) * sizeof(WCHAR));
+        fileName.MaximumLength = sizeof(nameBuffer);
+
+        irp.Iopb.Parameters.DirectoryControl.QueryDirectory.FileName = &fileName;
+    }
+
+    status = SimSendIrp( &irp );
+
+    if (mdl != NULL) {
+
+        MmUnlockPages( mdl );
+        IoFreeMdl( mdl );
+    }
+
+    if (BytesReturned != NULL) {
+
+        *BytesReturned = (ULONG)irp.Data.IoStatus.Information;
+    }
+
+    return status;
+}
+
+
+/*************************************************************************
+    What the filter asks about files
+*************************************************************************/
+
+NTSTATUS
+FltIsDirectory (
+    PFILE_OBJECT FileObject,
+    PFLT_INSTANCE Instance,
+    PBOOLEAN IsDirectory
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    *IsDirectory = ((PSIM_STREAM)FileObject->FsContext)->IsDirectory;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+FltGetFileNameInformation (
+    PFLT_CALLBACK_DATA CallbackData,
+    FLT_FILE_NAME_OPTIONS NameOptions,
+    PFLT_FILE_NAME_INFORMATION *FileNameInformation
+    )
+/*++
+
+Routine Description:
+
+    The volume's device name followed by the path the file was opened
+    by.  Names are already normalized, there being no short names or
+    links.
+
+--*/
+{
+    PFILE_OBJECT fileObject = CallbackData->Iopb->TargetFileObject;
+    PSIM_FILE file = fileObject->FsContext2;
+    PFLT_FILE_NAME_INFORMATION information;
+    USHORT length = file->Volume->DeviceNameLength + fileObject->FileName.Length;
+    PWCHAR name;
+
+    UNREFERENCED_PARAMETER( NameOptions );
+
+    information = ExAllocatePoolWithTag( PagedPool,
+                                         sizeof(FLT_FILE_NAME_INFORMATION) + length,
+                                         SIM_NAME_TAG );
+
+    if (information == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( information, sizeof(FLT_FILE_NAME_INFORMATION) );
+
+    name = (PWCHAR)(information + 1);
+
+    RtlCopyMemory( name, file->Volume->DeviceName, file->Volume->DeviceNameLength );
+    RtlCopyMemory( (PUCHAR)name + file->Volume->DeviceNameLength,
+                   fileObject->FileName.Buffer,
+                   fileObject->FileName.Length );
+
+    information->Size = sizeof(FLT_FILE_NAME_INFORMATION);
+    information->Format = FLT_FILE_NAME_NORMALIZED;
+
+    information->Name.Buffer = name;
+    information->Name.Length = information->Name.MaximumLength = length;
+
+    information->Volume.Buffer = name;
+    information->Volume.Length = information->Volume.MaximumLength = file->Volume->DeviceNameLength;
+
+    *FileNameInformation = information;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+FltParseFileNameInformation (
+    PFLT_FILE_NAME_INFORMATION FileNameInformation
+    )
+{
+    PUNICODE_STRING name = &FileNameInformation->Name;
+    USHORT volumeChars = FileNameInformation->Volume.Length / sizeof(WCHAR);
+    USHORT chars = name->Length / sizeof(WCHAR);
+    USHORT finalStart = volumeChars;
+    USHORT i;
+
+    for (i = volumeChars; i < chars; i++) {
+
+        if (name->Buffer[i] == L'\\') {
+
+            finalStart = i + 1;
+        }
+    }
+
+    FileNameInformation->ParentDir.Buffer = name->Buffer + volumeChars;
+    FileNameInformation->ParentDir.Length = (USHORT)((finalStart - volumeChars) * sizeof(WCHAR));
+    FileNameInformation->ParentDir.MaximumLength = FileNameInformation->ParentDir.Length;
+
+    FileNameInformation->FinalComponent.Buffer = name->Buffer + finalStart;
+    FileNameInformation->FinalComponent.Length = (USHORT)((chars - finalStart) * sizeof(WCHAR));
+    FileNameInformation->FinalComponent.MaximumLength = FileNameInformation->FinalComponent.Length;
+
+    FileNameInformation->Extension.Buffer = NULL;
+    FileNameInformation->Extension.Length = 0;
+    FileNameInformation->Extension.MaximumLength = 0;
+
+    for (i = chars; i > finalStart; i--) {
+
+        if (name->Buffer[i - 1] == L'.') {
+
+            FileNameInformation->Extension.Buffer = name->Buffer + i;
+            FileNameInformation->Extension.Length = (USHORT)((chars - i) * sizeof(WCHAR));
+            FileNameInformation->Extension.MaximumLength = FileNameInformation->Extension.Length;
+            break;
+        }
+    }
+
+    FileNameInformation->NamesParsed = 0x0f;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+FltReleaseFileNameInformation (
+    PFLT_FILE_NAME_INFORMATION FileNameInformation
+    )
+{
+    ExFreePoolWithTag( FileNameInformation, SIM_NAME_TAG );
+}
+
+
+NTSTATUS
+SimQueryInformation (
+    __in PSIM_FILE File,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __out_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __out_opt PULONG BytesReturned
+    )
+{
+    SIM_IRP irp;
+    NTSTATUS status;
+
+    SimInitializeIrp( &irp, File, IRP_MJ_QUERY_INFORMATION, 0 );
+
+    irp.Iopb.Parameters.QueryFileInformation.Length = Length;
+    irp.Iopb.Parameters.QueryFileInformation.FileInformationClass = FileInformationClass;
+    irp.Iopb.Parameters.QueryFileInformation.InfoBuffer = Buffer;
+
+    status = SimSendIrp( &irp );
+
+    if (BytesReturned != NULL) {
+
+        *BytesReturned = (ULONG)irp.Data.IoStatus.Information;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+SimSetInformation (
+    __in PSIM_FILE File,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __in_bcount(Length) PVOID Buffer,
+    __in ULONG Length
+    )
+{
+    SIM_IRP irp;
+
+    SimInitializeIrp( &irp, File, IRP_MJ_SET_INFORMATION, 0 );
+
+    irp.Iopb.Parameters.SetFileInformation.Length = Length;
+    irp.Iopb.Parameters.SetFileInformation.FileInformationClass = FileInformationClass;
+    irp.Iopb.Parameters.SetFileInformation.InfoBuffer = Buffer;
+
+    return SimSendIrp( &irp );
+}
+
+
+NTSTATUS
+SimFlushFile (
+    __in PSIM_FILE File
+    )
+{
+    SIM_IRP irp;
+
+    SimInitializeIrp( &irp, File, IRP_MJ_FLUSH_BUFFERS, 0 );
+
+    return SimSendIrp( &irp );
+}
+
+
+/*************************************************************************
+    I/O the filter sends below itself
+*************************************************************************/
+
+static NTSTATUS
+SimFilterIo (
+    __in PFILE_OBJECT FileObject,
+    __in BOOLEAN IsWrite,
+    __in PLARGE_INTEGER ByteOffset,
+    __in ULONG Length,
+    __in PVOID Buffer,
+    __in FLT_IO_OPERATION_FLAGS Flags,
+    __out_opt PULONG Transferred,
+    __in_opt PFLT_COMPLETED_ASYNC_IO_CALLBACK CallbackRoutine
+    )
+/*++
+
+Routine Description:
+
+    FltReadFile and FltWriteFile go to the instances below the caller,
+    which here is the file system.  Synchronous only.  Unless told not
+    to, they move the file pointer of a synchronous open, as any other
+    read or write does.
+
+--*/
+{
+    PSIM_STREAM stream = FileObject->FsContext;
+    PSIM_FILE file = FileObject->FsContext2;
+    ULONG transferred = 0;
+    NTSTATUS status;
+
+    if (CallbackRoutine != NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "asynchronous FltReadFile/FltWriteFile is not simulated" );
+    }
+
+    if (stream->IsDirectory) {
+
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    if (FlagOn( Flags, FLTFL_IO_OPERATION_NON_CACHED ) &&
+        (((ULONG)ByteOffset->QuadPart | Length) & (file->Volume->SectorSize - 1)) != 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (IsWrite) {
+
+        status = SimStreamWrite( stream, ByteOffset->QuadPart, Length, Buffer, TRUE, &transferred );
+
+    } else {
+
+        status = SimStreamRead( stream, ByteOffset->QuadPart, Length, Buffer, &transferred );
+    }
+
+    if (NT_SUCCESS( status ) &&
+        !FlagOn( Flags, FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET | FLTFL_IO_OPERATION_PAGING ) &&
+        FlagOn( FileObject->Flags, FO_SYNCHRONOUS_IO )) {
+
+        FileObject->CurrentByteOffset.QuadPart = ByteOffset->QuadPart + transferred;
+    }
+
+    if (Transferred != NULL) {
+
+        *Transferred = transferred;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FltReadFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesRead,
+    PFLT_COMPLETED_ASYNC_IO_CALLBACK CallbackRoutine,
+    PVOID CallbackContext
+    )
+{
+    UNREFERENCED_PARAMETER( InitiatingInstance );
+    UNREFERENCED_PARAMETER( CallbackContext );
+
+    return SimFilterIo( FileObject, FALSE, ByteOffset, Length, Buffer, Flags, BytesRead, CallbackRoutine );
+}
+
+
+NTSTATUS
+FltWriteFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesWritten,
+    PFLT_COMPLETED_ASYNC_IO_CALLBACK CallbackRoutine,
+    PVOID CallbackContext
+    )
+{
+    UNREFERENCED_PARAMETER( InitiatingInstance );
+    UNREFERENCED_PARAMETER( CallbackContext );
+
+    return SimFilterIo( FileObject, TRUE, ByteOffset, Length, Buffer, Flags, BytesWritten, CallbackRoutine );
+}
+
+
+static NTSTATUS
+SimFilterInformation (
+    __in PFILE_OBJECT FileObject,
+    __in UCHAR MajorFunction,
+    __in FILE_INFORMATION_CLASS FileInformationClass,
+    __in PVOID FileInformation,
+    __in ULONG Length,
+    __out_opt PULONG LengthReturned
+    )
+/*++
+
+Routine Description:
+
+    FltQueryInformationFile and FltSetInformationFile go straight to the
+    file system, at PASSIVE_LEVEL only.
+
+--*/
+{
+    SIM_IRP irp;
+
+    if (KeGetCurrentIrql() != PASSIVE_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "file information sent above PASSIVE_LEVEL" );
+    }
+
+    SimInitializeIrp( &irp, FileObject->FsContext2, MajorFunction, 0 );
+
+    if (MajorFunction == IRP_MJ_QUERY_INFORMATION) {
+
+        irp.Iopb.Parameters.QueryFileInformation.Length = Length;
+        irp.Iopb.Parameters.QueryFileInformation.FileInformationClass = FileInformationClass;
+        irp.Iopb.Parameters.QueryFileInformation.InfoBuffer = FileInformation;
+
+    } else {
+
+        irp.Iopb.Parameters.SetFileInformation.Length = Length;
+        irp.Iopb.Parameters.SetFileInformation.FileInformationClass = FileInformationClass;
+        irp.Iopb.Parameters.SetFileInformation.InfoBuffer = FileInformation;
+    }
+
+    SimFileSystem( &irp );
+
+    if (LengthReturned != NULL) {
+
+        *LengthReturned = (ULONG)irp.Data.IoStatus.Information;
+    }
+
+    return irp.Data.IoStatus.Status;
+}
+
+
+NTSTATUS
+FltQueryInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass,
+    PULONG LengthReturned
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    return SimFilterInformation( FileObject,
+                                 IRP_MJ_QUERY_INFORMATION,
+                                 FileInformationClass,
+                                 FileInformation,
+                                 Length,
+                                 LengthReturned );
+}
+
+
+NTSTATUS
+FltSetInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    return SimFilterInformation( FileObject,
+                                 IRP_MJ_SET_INFORMATION,
+                                 FileInformationClass,
+                                 FileInformation,
+                                 Length,
+                                 NULL );
+}
+
+
+VOID
+FltInitializePushLock (
+    PEX_PUSH_LOCK PushLock
+    )
+{
+    pthread_rwlock_init( &PushLock->Lock, NULL );
+}
+
+
+VOID
+FltDeletePushLock (
+    PEX_PUSH_LOCK PushLock
+    )
+{
+    pthread_rwlock_destroy( &PushLock->Lock );
+}
+
+
+VOID
+FltAcquirePushLockExclusive (
+    PEX_PUSH_LOCK PushLock
+    )
+{
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "push lock acquired at DISPATCH_LEVEL" );
+    }
+
+    pthread_rwlock_wrlock( &PushLock->Lock );
+}
+
+
+VOID
+FltAcquirePushLockShared (
+    PEX_PUSH_LOCK PushLock
+    )
+{
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "push lock acquired at DISPATCH_LEVEL" );
+    }
+
+    pthread_rwlock_rdlock( &PushLock->Lock );
+}
+
+
+VOID
+FltReleasePushLock (
+    PEX_PUSH_LOCK PushLock
+    )
+{
+    pthread_rwlock_unlock( &PushLock->Lock );
+}
+
+
+PVOID
+FltAllocatePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( PoolType );
+
+    return SimAllocatePoolAligned( NumberOfBytes,
+                                   Tag,
+                                   max( (ULONG)Instance->Volume->SectorSize, SYSTEM_CACHE_ALIGNMENT_SIZE ) );
+}
+
+
+VOID
+FltFreePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    PVOID Buffer,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    ExFreePoolWithTag( Buffer, Tag );
+}
+
+
+/*************************************************************************
+    Communication ports
+*************************************************************************/
+
+NTSTATUS
+FltBuildDefaultSecurityDescriptor (
+    PSECURITY_DESCRIPTOR *SecurityDescriptor,
+    ACCESS_MASK DesiredAccess
+    )
+{
+    UNREFERENCED_PARAMETER( DesiredAccess );
+
+    *SecurityDescriptor = ExAllocatePoolWithTag( PagedPool, sizeof(ULONG), SIM_OBJECT_TAG );
+
+    return (*SecurityDescriptor != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+
+VOID
+FltFreeSecurityDescriptor (
+    PSECURITY_DESCRIPTOR SecurityDescriptor
+    )
+{
+    ExFreePoolWithTag( SecurityDescriptor, SIM_OBJECT_TAG );
+}
+
+
+NTSTATUS
+FltCreateCommunicationPort (
+    PFLT_FILTER Filter,
+    PFLT_PORT *ServerPort,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PVOID ServerPortCookie,
+    PFLT_CONNECT_NOTIFY ConnectNotifyCallback,
+    PFLT_DISCONNECT_NOTIFY DisconnectNotifyCallback,
+    PFLT_MESSAGE_NOTIFY MessageNotifyCallback,
+    LONG MaxConnections
+    )
+{
+    PFLT_PORT port;
+
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+    UNREFERENCED_PARAMETER( MaxConnections );
+
+    PAGED_CODE();
+
+    if (Filter->ServerPort != NULL) {
+
+        return STATUS_OBJECT_NAME_COLLISION;
+    }
+
+    port = ExAllocatePoolWithTag( PagedPool, sizeof(*port), SIM_OBJECT_TAG );
+
+    if (port == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( port, sizeof(*port) );
+
+    port->Filter = Filter;
+    port->ConnectNotify = ConnectNotifyCallback;
+    port->DisconnectNotify = DisconnectNotifyCallback;
+    port->MessageNotify = MessageNotifyCallback;
+    port->Cookie = ServerPortCookie;
+
+    Filter->ServerPort = port;
+    *ServerPort = port;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+FltCloseCommunicationPort (
+    PFLT_PORT ServerPort
+    )
+{
+    PAGED_CODE();
+
+    ServerPort->Filter->ServerPort = NULL;
+
+    ExFreePoolWithTag( ServerPort, SIM_OBJECT_TAG );
+}
+
+
+VOID
+FltCloseClientPort (
+    PFLT_FILTER Filter,
+    PFLT_PORT *ClientPort
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+
+    if (*ClientPort != NULL) {
+
+        ExFreePoolWithTag( *ClientPort, SIM_OBJECT_TAG );
+        *ClientPort = NULL;
+    }
+}
+
+
+NTSTATUS
+SimControl (
+    __in ULONG Command,
+    __in ULONG Argument,
+    __out_bcount_opt(OutputLength) PVOID Output,
+    __in ULONG OutputLength,
+    __out_opt PULONG ReturnedLength
+    )
+{
+    CSG_CONTROL_MESSAGE message;
+    PFLT_PORT server;
+    PFLT_PORT client;
+    PVOID connectionCookie = NULL;
+    ULONG returned = 0;
+    NTSTATUS status;
+
+    pthread_mutex_lock( &SimData.PortLock );
+
+    server = (SimData.Filter != NULL) ? SimData.Filter->ServerPort : NULL;
+
+    if (server == NULL) {
+
+        pthread_mutex_unlock( &SimData.PortLock );
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    client = ExAllocatePoolWithTag( PagedPool, sizeof(*client), SIM_OBJECT_TAG );
+
+    if (client == NULL) {
+
+        pthread_mutex_unlock( &SimData.PortLock );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( client, sizeof(*client) );
+    client->Filter = server->Filter;
+    client->IsClient = TRUE;
+
+    status = server->ConnectNotify( client, server->Cookie, NULL, 0, &connectionCookie );
+
+    if (!NT_SUCCESS( status )) {
+
+        ExFreePoolWithTag( client, SIM_OBJECT_TAG );
+        pthread_mutex_unlock( &SimData.PortLock );
+        return status;
+    }
+
+    message.Command = Command;
+    message.Argument = Argument;
+
+    status = server->MessageNotify( connectionCookie,
+                                    &message,
+                                    sizeof(message),
+                                    Output,
+                                    OutputLength,
+                                    &returned );
+
+    //
+    //  The driver closes its end of the connection in the disconnect
+    //  callback.
+    //
+
+    server->DisconnectNotify( connectionCookie );
+
+    pthread_mutex_unlock( &SimData.PortLock );
+
+    if (ReturnedLength != NULL) {
+
+        *ReturnedLength = returned;
+    }
+
+    return status;
+}
+
+
+/*************************************************************************
+    Accounting
+*************************************************************************/
+
+VOID
+SimQueryCounters (
+    __out PSIM_COUNTERS Counters
+    )
+{
+    *Counters = SimData.Counters;
+}
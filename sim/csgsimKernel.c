@@ -0,0 +1,2902 @@
+/*++
+
+Module Name:
+
+    csgsimKernel.c
+
+Abstract:
+
+    The kernel services of the simulation: pool with accounting by tag,
+    lookaside lists, MDLs, IRQL, spin locks, events, semaphores and fast
+    mutexes, timers, a registry holding the driver's parameters, sections,
+    system threads on a single NUMA node, and the object manager and
+    worker thread the filter manager part builds on.
+
+    Where the kernel would bugcheck on misuse -- freeing with the wrong
+    tag, mapping an MDL that is not locked, waiting at DISPATCH_LEVEL --
+    the simulation stops with a message instead.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bcrypt.h>
+
+#include "csgsimStruct.h"
+
+/*************************************************************************
+    Checks
+*************************************************************************/
+
+VOID
+SimBugCheck (
+    PCSTR File,
+    ULONG Line,
+    PCSTR Message
+    )
+/*++
+
+Routine Description:
+
+    Stops the simulation.  Called where the kernel would bugcheck.
+
+Arguments:
+
+    File, Line - Where the check failed.
+
+    Message - What failed.
+
+Return Value:
+
+    Does not return.
+
+--*/
+{
+    fprintf( stderr, "csgsim: BUGCHECK at %s:%u: %s\n", File, Line, Message );
+    fflush( stderr );
+
+    abort();
+}
+
+
+/*************************************************************************
+    IRQL
+*************************************************************************/
+
+//
+//  The IRQL of the calling thread.  Nothing masks preemption in user
+//  mode; the level is there to be checked.
+//
+
+static __thread KIRQL SimIrql = PASSIVE_LEVEL;
+
+
+KIRQL
+KeGetCurrentIrql (
+    VOID
+    )
+{
+    return SimIrql;
+}
+
+
+VOID
+KeRaiseIrql (
+    KIRQL NewIrql,
+    PKIRQL OldIrql
+    )
+{
+    if (NewIrql < SimIrql) {
+
+        SimBugCheck( __FILE__, __LINE__, "IRQL_NOT_GREATER_OR_EQUAL" );
+    }
+
+    *OldIrql = SimIrql;
+    SimIrql = NewIrql;
+}
+
+
+VOID
+KeLowerIrql (
+    KIRQL NewIrql
+    )
+{
+    if (NewIrql > SimIrql) {
+
+        SimBugCheck( __FILE__, __LINE__, "IRQL_NOT_LESS_OR_EQUAL" );
+    }
+
+    SimIrql = NewIrql;
+}
+
+
+VOID
+SimCheckPageable (
+    PCSTR File,
+    ULONG Line
+    )
+/*++
+
+Routine Description:
+
+    PAGED_CODE: pageable code may not run at DISPATCH_LEVEL or above.
+
+Arguments:
+
+    File, Line - Where the check is.
+
+Return Value:
+
+    None
+
+--*/
+{
+    if (SimIrql > APC_LEVEL) {
+
+        SimBugCheck( File, Line, "pageable code run at DISPATCH_LEVEL" );
+    }
+}
+
+
+/*************************************************************************
+    Debug output
+*************************************************************************/
+
+static BOOLEAN SimDebugOutput = TRUE;
+
+
+VOID
+SimSetDebugOutput (
+    __in BOOLEAN Enable
+    )
+{
+    SimDebugOutput = Enable;
+}
+
+
+ULONG
+DbgPrint (
+    PCSTR Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    Prints to stderr.  Takes what the kernel's DbgPrint takes that the
+    C library does not: %wZ for a PUNICODE_STRING, %ws for a PCWSTR and
+    the I64 size prefix.  Each conversion is handed to the C library on
+    its own, with its argument fetched at the size its prefix says.
+
+Arguments:
+
+    Format - The format.
+
+Return Value:
+
+    STATUS_SUCCESS
+
+--*/
+{
+    CHAR line[1024];
+    CHAR spec[32];
+    SIZE_T used = 0;
+    PCSTR p = Format;
+    va_list args;
+
+    if (!SimDebugOutput) {
+
+        return STATUS_SUCCESS;
+    }
+
+    va_start( args, Format );
+
+    while (*p != '\0' && used < sizeof(line) - 1) {
+
+        SIZE_T specLength = 0;
+        int longs = 0;
+        int written;
+
+        if (*p != '%') {
+
+            line[used++] = *p++;
+            continue;
+        }
+
+        spec[specLength++] = *p++;
+
+        while (*p != '\0' && strchr( "-+ #0123456789.", *p ) != NULL &&
+               specLength < sizeof(spec) - 4) {
+
+            spec[specLength++] = *p++;
+        }
+
+        if (p[0] == 'w' && (p[1] == 'Z' || p[1] == 's')) {
+
+            PCWSTR source;
+            ULONG count;
+
+            if (p[1] == 'Z') {
+
+                PCUNICODE_STRING string = va_arg( args, PCUNICODE_STRING );
+
+                source = (string != NULL) ? string->Buffer : NULL;
+                count = (string != NULL) ? string->Length / sizeof(WCHAR) : 0;
+
+            } else {
+
+                source = va_arg( args, PCWSTR );
+
+                count = 0;
+
+                while (source != NULL && source[count] != UNICODE_NULL) {
+
+                    count++;
+                }
+            }
+
+            if (source != NULL) {
+
+                used += SimUtf16ToUtf8( source,
+                                        count,
+                                        &line[used],
+                                        (ULONG)(sizeof(line) - 1 - used) );
+            }
+
+            p += 2;
+            continue;
+        }
+
+        if (p[0] == 'I' && p[1] == '6' && p[2] == '4') {
+
+            longs = 2;
+            p += 3;
+
+        } else {
+
+            while (*p == 'l' || *p == 'h' || *p == 'z') {
+
+                if (*p == 'l') {
+
+                    longs++;
+
+                } else if (*p == 'z') {
+
+                    longs = 2;
+                }
+
+                p++;
+            }
+        }
+
+        if (*p == '\0') {
+
+            break;
+        }
+
+        if (longs >= 2) {
+
+            spec[specLength++] = 'l';
+            spec[specLength++] = 'l';
+        }
+
+        spec[specLength++] = *p;
+        spec[specLength] = '\0';
+
+        switch (*p++) {
+
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+
+                if (longs >= 2) {
+
+                    written = snprintf( &line[used], sizeof(line) - used, spec,
+                                        va_arg( args, long long ) );
+
+                } else {
+
+                    //
+                    //  long is 32 bits in the kernel.
+                    //
+
+                    written = snprintf( &line[used], sizeof(line) - used, spec,
+                                        va_arg( args, int ) );
+                }
+                break;
+
+            case 's':
+
+                written = snprintf( &line[used], sizeof(line) - used, spec,
+                                    va_arg( args, PCSTR ) );
+                break;
+
+            case 'p':
+
+                written = snprintf( &line[used], sizeof(line) - used, spec,
+                                    va_arg( args, PVOID ) );
+                break;
+
+            case '%':
+
+                written = snprintf( &line[used], sizeof(line) - used, "%%" );
+                break;
+
+            default:
+
+                written = snprintf( &line[used], sizeof(line) - used, "%s", spec );
+                break;
+        }
+
+        if (written > 0) {
+
+            used = min( used + (SIZE_T)written, sizeof(line) - 1 );
+        }
+    }
+
+    va_end( args );
+
+    line[used] = '\0';
+
+    fputs( line, stderr );
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Pool
+*************************************************************************/
+
+//
+//  Every allocation is preceded by a header, a cache line long so the
+//  body keeps the alignment of the allocation.  Freed memory is filled
+//  with SIM_POOL_FREE_FILL to make use after free show.
+//
+
+#define SIM_POOL_MAGIC      0x4c4f4f50  // 'POOL'
+#define SIM_POOL_FREED      0x45455246  // 'FREE'
+#define SIM_POOL_FREE_FILL  0xdf
+
+typedef struct DECLSPEC_CACHEALIGN _SIM_POOL_HEADER {
+
+    ULONG Magic;
+
+    ULONG Tag;
+
+    SIZE_T Size;
+
+    PVOID Base;
+
+} SIM_POOL_HEADER, *PSIM_POOL_HEADER;
+
+//
+//  Outstanding allocations by tag, in an open addressed table that is
+//  never shrunk; a slot's tag is set once and never changes.
+//
+
+#define SIM_POOL_TAG_SLOTS  256
+
+typedef struct _SIM_POOL_TAG {
+
+    volatile ULONG Tag;
+
+    volatile LONGLONG Allocations;
+
+    volatile LONGLONG Bytes;
+
+    volatile LONGLONG TotalAllocations;
+
+} SIM_POOL_TAG, *PSIM_POOL_TAG;
+
+static SIM_POOL_TAG SimPoolTags[SIM_POOL_TAG_SLOTS];
+
+
+static PSIM_POOL_TAG
+SimPoolLookupTag (
+    __in ULONG Tag
+    )
+/*++
+
+Routine Description:
+
+    Finds the accounting slot of a tag, claiming one if it has none.
+
+Arguments:
+
+    Tag - The pool tag.
+
+Return Value:
+
+    The slot.
+
+--*/
+{
+    ULONG index;
+    ULONG probe;
+
+    if (Tag == 0) {
+
+        Tag = ' neN';
+    }
+
+    index = (Tag * 2654435761U) % SIM_POOL_TAG_SLOTS;
+
+    for (probe = 0; probe < SIM_POOL_TAG_SLOTS; probe++) {
+
+        PSIM_POOL_TAG slot = &SimPoolTags[(index + probe) % SIM_POOL_TAG_SLOTS];
+
+        if (slot->Tag == Tag) {
+
+            return slot;
+        }
+
+        if (slot->Tag == 0 &&
+            InterlockedCompareExchange( (volatile LONG *)&slot->Tag, (LONG)Tag, 0 ) == 0) {
+
+            return slot;
+        }
+
+        if (slot->Tag == Tag) {
+
+            return slot;
+        }
+    }
+
+    SimBugCheck( __FILE__, __LINE__, "too many pool tags" );
+}
+
+
+PVOID
+SimAllocatePoolAligned (
+    __in SIZE_T NumberOfBytes,
+    __in ULONG Tag,
+    __in ULONG Alignment
+    )
+/*++
+
+Routine Description:
+
+    Allocates pool whose body is aligned to Alignment, a power of two no
+    smaller than a cache line.
+
+Arguments:
+
+    NumberOfBytes - Size of the body.
+
+    Tag - Pool tag.
+
+    Alignment - Alignment of the body.
+
+Return Value:
+
+    The body, or NULL.
+
+--*/
+{
+    PSIM_POOL_HEADER header;
+    PSIM_POOL_TAG slot;
+    PVOID base;
+
+    if (NumberOfBytes == 0) {
+
+        NumberOfBytes = 1;
+    }
+
+    if (posix_memalign( &base, Alignment, Alignment + NumberOfBytes ) != 0) {
+
+        return NULL;
+    }
+
+    header = (PSIM_POOL_HEADER)((PUCHAR)base + Alignment) - 1;
+    header->Magic = SIM_POOL_MAGIC;
+    header->Tag = Tag;
+    header->Size = NumberOfBytes;
+    header->Base = base;
+
+    slot = SimPoolLookupTag( Tag );
+
+    InterlockedIncrement64( &slot->Allocations );
+    InterlockedIncrement64( &slot->TotalAllocations );
+    InterlockedExchangeAdd64( &slot->Bytes, (LONGLONG)NumberOfBytes );
+
+    return header + 1;
+}
+
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+/*++
+
+Routine Description:
+
+    Allocates pool.  Every pool type is cache aligned here.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( PoolType );
+
+    return SimAllocatePoolAligned( NumberOfBytes, Tag, SYSTEM_CACHE_ALIGNMENT_SIZE );
+}
+
+
+static VOID
+SimFreePool (
+    __in PVOID P,
+    __in ULONG Tag,
+    __in BOOLEAN CheckTag
+    )
+{
+    PSIM_POOL_HEADER header = (PSIM_POOL_HEADER)P - 1;
+    PSIM_POOL_TAG slot;
+
+    if (header->Magic != SIM_POOL_MAGIC) {
+
+        SimBugCheck( __FILE__, __LINE__,
+                     (header->Magic == SIM_POOL_FREED) ? "BAD_POOL_CALLER: double free" :
+                                                         "BAD_POOL_HEADER" );
+    }
+
+    if (CheckTag && header->Tag != Tag) {
+
+        SimBugCheck( __FILE__, __LINE__, "BAD_POOL_CALLER: freed with the wrong tag" );
+    }
+
+    slot = SimPoolLookupTag( header->Tag );
+
+    InterlockedDecrement64( &slot->Allocations );
+    InterlockedExchangeAdd64( &slot->Bytes, -(LONGLONG)header->Size );
+
+    memset( P, SIM_POOL_FREE_FILL, header->Size );
+    header->Magic = SIM_POOL_FREED;
+
+    free( header->Base );
+}
+
+
+VOID
+ExFreePoolWithTag (
+    PVOID P,
+    ULONG Tag
+    )
+{
+    SimFreePool( P, Tag, TRUE );
+}
+
+
+VOID
+ExFreePool (
+    PVOID P
+    )
+{
+    SimFreePool( P, 0, FALSE );
+}
+
+
+/*************************************************************************
+    Lookaside lists
+*************************************************************************/
+
+#define SIM_LOOKASIDE_DEPTH 256
+
+
+VOID
+ExInitializeNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PALLOCATE_FUNCTION Allocate,
+    PFREE_FUNCTION Free,
+    ULONG Flags,
+    SIZE_T Size,
+    ULONG Tag,
+    USHORT Depth
+    )
+/*++
+
+Routine Description:
+
+    Initializes a lookaside list: a locked stack of up to Depth free
+    entries in front of Allocate and Free.  The system picks the depth
+    when Depth is zero.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    pthread_mutex_init( &Lookaside->Lock, NULL );
+
+    Lookaside->Depth = (Depth != 0) ? Depth : SIM_LOOKASIDE_DEPTH;
+    Lookaside->Count = 0;
+    Lookaside->Size = Size;
+    Lookaside->Tag = Tag;
+    Lookaside->Allocate = Allocate;
+    Lookaside->Free = Free;
+
+    Lookaside->Entries = ExAllocatePoolWithTag( NonPagedPool,
+                                                Lookaside->Depth * sizeof(PVOID),
+                                                SIM_OBJECT_TAG );
+
+    if (Lookaside->Entries == NULL) {
+
+        Lookaside->Depth = 0;
+    }
+}
+
+
+static VOID
+SimLookasideFreeEntry (
+    __in PNPAGED_LOOKASIDE_LIST Lookaside,
+    __in PVOID Entry
+    )
+{
+    if (Lookaside->Free != NULL) {
+
+        Lookaside->Free( Entry );
+
+    } else {
+
+        ExFreePool( Entry );
+    }
+}
+
+
+VOID
+ExDeleteNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    while (Lookaside->Count > 0) {
+
+        SimLookasideFreeEntry( Lookaside, Lookaside->Entries[--Lookaside->Count] );
+    }
+
+    if (Lookaside->Entries != NULL) {
+
+        ExFreePoolWithTag( Lookaside->Entries, SIM_OBJECT_TAG );
+        Lookaside->Entries = NULL;
+    }
+
+    pthread_mutex_destroy( &Lookaside->Lock );
+}
+
+
+PVOID
+ExAllocateFromNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    PVOID entry = NULL;
+
+    pthread_mutex_lock( &Lookaside->Lock );
+
+    if (Lookaside->Count > 0) {
+
+        entry = Lookaside->Entries[--Lookaside->Count];
+    }
+
+    pthread_mutex_unlock( &Lookaside->Lock );
+
+    if (entry != NULL) {
+
+        return entry;
+    }
+
+    if (Lookaside->Allocate != NULL) {
+
+        return Lookaside->Allocate( NonPagedPool, Lookaside->Size, Lookaside->Tag );
+    }
+
+    return ExAllocatePoolWithTag( NonPagedPool, Lookaside->Size, Lookaside->Tag );
+}
+
+
+VOID
+ExFreeToNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PVOID Entry
+    )
+{
+    pthread_mutex_lock( &Lookaside->Lock );
+
+    if (Lookaside->Count < Lookaside->Depth) {
+
+        Lookaside->Entries[Lookaside->Count++] = Entry;
+        Entry = NULL;
+    }
+
+    pthread_mutex_unlock( &Lookaside->Lock );
+
+    if (Entry != NULL) {
+
+        SimLookasideFreeEntry( Lookaside, Entry );
+    }
+}
+
+
+/*************************************************************************
+    MDLs
+*************************************************************************/
+
+#define SIM_PAGE_ALIGN(_va)     ((PVOID)((ULONG_PTR)(_va) & ~(ULONG_PTR)(PAGE_SIZE - 1)))
+#define SIM_PAGE_OFFSET(_va)    ((ULONG)((ULONG_PTR)(_va) & (PAGE_SIZE - 1)))
+
+
+PMDL
+IoAllocateMdl (
+    PVOID VirtualAddress,
+    ULONG Length,
+    BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota,
+    PVOID Irp
+    )
+/*++
+
+Routine Description:
+
+    Allocates an MDL for a range.  It describes no pages until it is
+    built or locked.
+
+--*/
+{
+    PMDL mdl;
+
+    UNREFERENCED_PARAMETER( SecondaryBuffer );
+    UNREFERENCED_PARAMETER( ChargeQuota );
+
+    if (Irp != NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "IoAllocateMdl with an IRP is not simulated" );
+    }
+
+    mdl = ExAllocatePoolWithTag( NonPagedPool, sizeof(MDL), SIM_MDL_TAG );
+
+    if (mdl == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( mdl, sizeof(MDL) );
+
+    mdl->Size = sizeof(MDL);
+    mdl->StartVa = SIM_PAGE_ALIGN( VirtualAddress );
+    mdl->ByteOffset = SIM_PAGE_OFFSET( VirtualAddress );
+    mdl->ByteCount = Length;
+
+    return mdl;
+}
+
+
+VOID
+IoFreeMdl (
+    PMDL Mdl
+    )
+{
+    if (FlagOn( Mdl->MdlFlags, MDL_PAGES_LOCKED ) &&
+        !FlagOn( Mdl->MdlFlags, MDL_PARTIAL )) {
+
+        SimBugCheck( __FILE__, __LINE__, "MDL freed with its pages locked" );
+    }
+
+    ExFreePoolWithTag( Mdl, SIM_MDL_TAG );
+}
+
+
+VOID
+IoBuildPartialMdl (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Makes TargetMdl describe part of what SourceMdl describes.  A Length
+    of zero takes the rest of the source.
+
+--*/
+{
+    PUCHAR sourceStart = MmGetMdlVirtualAddress( SourceMdl );
+    PUCHAR start = VirtualAddress;
+
+    if (!FlagOn( SourceMdl->MdlFlags, MDL_PAGES_LOCKED | MDL_SOURCE_IS_NONPAGED_POOL | MDL_PARTIAL )) {
+
+        SimBugCheck( __FILE__, __LINE__, "partial MDL of an MDL that describes no pages" );
+    }
+
+    if (Length == 0) {
+
+        Length = (ULONG)(sourceStart + SourceMdl->ByteCount - start);
+    }
+
+    if (start < sourceStart ||
+        start + Length > sourceStart + SourceMdl->ByteCount) {
+
+        SimBugCheck( __FILE__, __LINE__, "partial MDL outside its source" );
+    }
+
+    if (FlagOn( TargetMdl->MdlFlags, MDL_PARTIAL )) {
+
+        SimBugCheck( __FILE__, __LINE__, "partial MDL built again without MmPrepareMdlForReuse" );
+    }
+
+    TargetMdl->StartVa = SIM_PAGE_ALIGN( start );
+    TargetMdl->ByteOffset = SIM_PAGE_OFFSET( start );
+    TargetMdl->ByteCount = Length;
+    TargetMdl->MappedSystemVa = start;
+    TargetMdl->MdlFlags = MDL_PARTIAL | MDL_MAPPED_TO_SYSTEM_VA |
+                          (SourceMdl->MdlFlags & MDL_SOURCE_IS_NONPAGED_POOL);
+}
+
+
+VOID
+MmPrepareMdlForReuse (
+    PMDL Mdl
+    )
+/*++
+
+Routine Description:
+
+    Undoes IoBuildPartialMdl, so the MDL can be built again.  The
+    simulation insists on it where the kernel would only leak the
+    mapping of a partial MDL that had been mapped.
+
+--*/
+{
+    if (!FlagOn( Mdl->MdlFlags, MDL_PARTIAL ) &&
+        FlagOn( Mdl->MdlFlags, MDL_PAGES_LOCKED | MDL_SOURCE_IS_NONPAGED_POOL )) {
+
+        SimBugCheck( __FILE__, __LINE__, "MmPrepareMdlForReuse of an MDL that is not partial" );
+    }
+
+    Mdl->MdlFlags &= ~(MDL_PARTIAL | MDL_PARTIAL_HAS_BEEN_MAPPED | MDL_MAPPED_TO_SYSTEM_VA |
+                       MDL_SOURCE_IS_NONPAGED_POOL);
+    Mdl->MappedSystemVa = NULL;
+}
+
+
+VOID
+MmBuildMdlForNonPagedPool (
+    PMDL Mdl
+    )
+{
+    Mdl->MappedSystemVa = MmGetMdlVirtualAddress( Mdl );
+    Mdl->MdlFlags |= MDL_SOURCE_IS_NONPAGED_POOL | MDL_MAPPED_TO_SYSTEM_VA;
+}
+
+
+VOID
+MmProbeAndLockPages (
+    PMDL Mdl,
+    KPROCESSOR_MODE AccessMode,
+    LOCK_OPERATION Operation
+    )
+{
+    UNREFERENCED_PARAMETER( AccessMode );
+    UNREFERENCED_PARAMETER( Operation );
+
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "MmProbeAndLockPages at DISPATCH_LEVEL" );
+    }
+
+    if (FlagOn( Mdl->MdlFlags, MDL_PAGES_LOCKED )) {
+
+        SimBugCheck( __FILE__, __LINE__, "MDL locked twice" );
+    }
+
+    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+}
+
+
+VOID
+MmUnlockPages (
+    PMDL Mdl
+    )
+{
+    if (!FlagOn( Mdl->MdlFlags, MDL_PAGES_LOCKED )) {
+
+        SimBugCheck( __FILE__, __LINE__, "MmUnlockPages of an MDL that is not locked" );
+    }
+
+    Mdl->MdlFlags &= ~(MDL_PAGES_LOCKED | MDL_MAPPED_TO_SYSTEM_VA);
+}
+
+
+PVOID
+MmGetSystemAddressForMdlSafe (
+    PMDL Mdl,
+    ULONG Priority
+    )
+{
+    UNREFERENCED_PARAMETER( Priority );
+
+    if (!FlagOn( Mdl->MdlFlags, MDL_PAGES_LOCKED | MDL_SOURCE_IS_NONPAGED_POOL | MDL_PARTIAL )) {
+
+        SimBugCheck( __FILE__, __LINE__, "system address of an MDL that describes no pages" );
+    }
+
+    Mdl->MappedSystemVa = MmGetMdlVirtualAddress( Mdl );
+    Mdl->MdlFlags |= MDL_MAPPED_TO_SYSTEM_VA;
+
+    return Mdl->MappedSystemVa;
+}
+
+
+/*************************************************************************
+    Processors
+*************************************************************************/
+
+ULONG
+KeQueryActiveProcessorCountEx (
+    USHORT GroupNumber
+    )
+{
+    long count = sysconf( _SC_NPROCESSORS_ONLN );
+
+    UNREFERENCED_PARAMETER( GroupNumber );
+
+    return (count > 0) ? (ULONG)count : 1;
+}
+
+
+ULONG
+KeGetCurrentProcessorNumberEx (
+    PPROCESSOR_NUMBER ProcNumber
+    )
+/*++
+
+Routine Description:
+
+    The processor the thread is on.  A thread may move at any time, so
+    this is as stale as it is in the kernel below DISPATCH_LEVEL.
+
+--*/
+{
+    static ULONG count;
+    int cpu = sched_getcpu();
+
+    if (count == 0) {
+
+        count = KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS );
+    }
+
+    if (cpu < 0) {
+
+        cpu = 0;
+    }
+
+    cpu = (int)((ULONG)cpu % count);
+
+    if (ProcNumber != NULL) {
+
+        ProcNumber->Group = 0;
+        ProcNumber->Number = (UCHAR)cpu;
+        ProcNumber->Reserved = 0;
+    }
+
+    return (ULONG)cpu;
+}
+
+
+USHORT
+KeQueryHighestNodeNumber (
+    VOID
+    )
+{
+    return 0;
+}
+
+
+USHORT
+KeGetCurrentNodeNumber (
+    VOID
+    )
+{
+    return 0;
+}
+
+
+VOID
+KeQueryNodeActiveAffinity (
+    USHORT NodeNumber,
+    PGROUP_AFFINITY Affinity,
+    PUSHORT Count
+    )
+/*++
+
+Routine Description:
+
+    Node 0 has every processor, up to the 64 a group holds.
+
+--*/
+{
+    ULONG processors = KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    RtlZeroMemory( Affinity, sizeof(GROUP_AFFINITY) );
+
+    if (NodeNumber == 0) {
+
+        Affinity->Mask = (processors >= 64) ? ~(KAFFINITY)0 : ((KAFFINITY)1 << processors) - 1;
+    }
+
+    if (Count != NULL) {
+
+        *Count = (NodeNumber == 0) ? (USHORT)min( processors, 64 ) : 0;
+    }
+}
+
+
+VOID
+KeSetSystemGroupAffinityThread (
+    PGROUP_AFFINITY Affinity,
+    PGROUP_AFFINITY PreviousAffinity
+    )
+{
+    cpu_set_t set;
+    ULONG cpu;
+
+    if (PreviousAffinity != NULL) {
+
+        KeQueryNodeActiveAffinity( 0, PreviousAffinity, NULL );
+    }
+
+    CPU_ZERO( &set );
+
+    for (cpu = 0; cpu < 64; cpu++) {
+
+        if (Affinity->Mask & ((KAFFINITY)1 << cpu)) {
+
+            CPU_SET( cpu, &set );
+        }
+    }
+
+    pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+}
+
+
+/*************************************************************************
+    Spin locks, events, semaphores, fast mutexes
+*************************************************************************/
+
+//
+//  A semaphore's event type.  Its state is its count.
+//
+
+#define SimSemaphoreType    ((EVENT_TYPE)2)
+
+VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    *SpinLock = 0;
+}
+
+
+VOID
+KeAcquireSpinLock (
+    PKSPIN_LOCK SpinLock,
+    PKIRQL OldIrql
+    )
+{
+    KeRaiseIrql( DISPATCH_LEVEL, OldIrql );
+
+    while (__atomic_exchange_n( SpinLock, 1, __ATOMIC_ACQUIRE ) != 0) {
+
+        while (__atomic_load_n( SpinLock, __ATOMIC_RELAXED ) != 0) {
+
+            SimYield();
+        }
+    }
+}
+
+
+VOID
+KeReleaseSpinLock (
+    PKSPIN_LOCK SpinLock,
+    KIRQL NewIrql
+    )
+{
+    if (__atomic_load_n( SpinLock, __ATOMIC_RELAXED ) == 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "SPIN_LOCK_NOT_OWNED" );
+    }
+
+    __atomic_store_n( SpinLock, 0, __ATOMIC_RELEASE );
+
+    KeLowerIrql( NewIrql );
+}
+
+
+VOID
+KeInitializeEvent (
+    PKEVENT Event,
+    EVENT_TYPE Type,
+    BOOLEAN State
+    )
+{
+    pthread_condattr_t attributes;
+
+    Event->Type = Type;
+    Event->State = State;
+
+    pthread_mutex_init( &Event->Lock, NULL );
+
+    pthread_condattr_init( &attributes );
+    pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC );
+    pthread_cond_init( &Event->Signaled, &attributes );
+    pthread_condattr_destroy( &attributes );
+}
+
+
+LONG
+KeSetEvent (
+    PKEVENT Event,
+    LONG Increment,
+    BOOLEAN Wait
+    )
+{
+    LONG previous;
+
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+
+    pthread_mutex_lock( &Event->Lock );
+
+    previous = Event->State;
+    Event->State = 1;
+
+    if (Event->Type == NotificationEvent) {
+
+        pthread_cond_broadcast( &Event->Signaled );
+
+    } else {
+
+        pthread_cond_signal( &Event->Signaled );
+    }
+
+    pthread_mutex_unlock( &Event->Lock );
+
+    return previous;
+}
+
+
+VOID
+KeClearEvent (
+    PKEVENT Event
+    )
+{
+    pthread_mutex_lock( &Event->Lock );
+    Event->State = 0;
+    pthread_mutex_unlock( &Event->Lock );
+}
+
+
+LONG
+KeReadStateEvent (
+    PKEVENT Event
+    )
+{
+    return __atomic_load_n( &Event->State, __ATOMIC_ACQUIRE );
+}
+
+
+VOID
+KeInitializeSemaphore (
+    PKSEMAPHORE Semaphore,
+    LONG Count,
+    LONG Limit
+    )
+{
+    KeInitializeEvent( &Semaphore->Header, NotificationEvent, FALSE );
+
+    Semaphore->Header.Type = SimSemaphoreType;
+    Semaphore->Header.State = Count;
+    Semaphore->Limit = Limit;
+}
+
+
+LONG
+KeReleaseSemaphore (
+    PKSEMAPHORE Semaphore,
+    LONG Increment,
+    LONG Adjustment,
+    BOOLEAN Wait
+    )
+{
+    LONG previous;
+
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+
+    pthread_mutex_lock( &Semaphore->Header.Lock );
+
+    previous = Semaphore->Header.State;
+
+    if (Adjustment <= 0 || Semaphore->Limit - previous < Adjustment) {
+
+        SimBugCheck( __FILE__, __LINE__, "STATUS_SEMAPHORE_LIMIT_EXCEEDED" );
+    }
+
+    Semaphore->Header.State = previous + Adjustment;
+
+    pthread_cond_broadcast( &Semaphore->Header.Signaled );
+    pthread_mutex_unlock( &Semaphore->Header.Lock );
+
+    return previous;
+}
+
+
+static VOID
+SimTimeoutToDeadline (
+    __in PLARGE_INTEGER Timeout,
+    __out struct timespec *Deadline
+    )
+/*++
+
+Routine Description:
+
+    Turns a kernel timeout into a CLOCK_MONOTONIC deadline.  Relative
+    (negative) timeouts are in 100ns units; absolute ones are taken as
+    already expired, since nothing here uses them.
+
+--*/
+{
+    LONGLONG interval = (Timeout->QuadPart < 0) ? -Timeout->QuadPart : 0;
+
+    clock_gettime( CLOCK_MONOTONIC, Deadline );
+
+    Deadline->tv_sec += interval / 10000000;
+    Deadline->tv_nsec += (long)(interval % 10000000) * 100;
+
+    if (Deadline->tv_nsec >= 1000000000) {
+
+        Deadline->tv_sec++;
+        Deadline->tv_nsec -= 1000000000;
+    }
+}
+
+
+NTSTATUS
+KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    )
+/*++
+
+Routine Description:
+
+    Waits for an event, a semaphore or a thread, all of which start with
+    an event.  Only a zero timeout may be waited with at DISPATCH_LEVEL.
+
+--*/
+{
+    PKEVENT event = Object;
+    struct timespec deadline;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER( WaitReason );
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+
+    if (KeGetCurrentIrql() > APC_LEVEL &&
+        (Timeout == NULL || Timeout->QuadPart != 0)) {
+
+        SimBugCheck( __FILE__, __LINE__, "wait at DISPATCH_LEVEL" );
+    }
+
+    if (Timeout != NULL) {
+
+        SimTimeoutToDeadline( Timeout, &deadline );
+    }
+
+    pthread_mutex_lock( &event->Lock );
+
+    while (event->State == 0) {
+
+        if (Timeout == NULL) {
+
+            pthread_cond_wait( &event->Signaled, &event->Lock );
+
+        } else if (pthread_cond_timedwait( &event->Signaled,
+                                           &event->Lock,
+                                           &deadline ) == ETIMEDOUT) {
+
+            status = STATUS_TIMEOUT;
+            break;
+        }
+    }
+
+    if (status == STATUS_SUCCESS && event->Type == SynchronizationEvent) {
+
+        event->State = 0;
+
+    } else if (status == STATUS_SUCCESS && event->Type == SimSemaphoreType) {
+
+        event->State--;
+    }
+
+    pthread_mutex_unlock( &event->Lock );
+
+    return status;
+}
+
+
+VOID
+ExInitializeFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    pthread_mutex_init( &FastMutex->Lock, NULL );
+    FastMutex->OldIrql = PASSIVE_LEVEL;
+}
+
+
+VOID
+ExAcquireFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    KIRQL oldIrql;
+
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "fast mutex acquired at DISPATCH_LEVEL" );
+    }
+
+    KeRaiseIrql( APC_LEVEL, &oldIrql );
+
+    pthread_mutex_lock( &FastMutex->Lock );
+
+    FastMutex->OldIrql = oldIrql;
+}
+
+
+VOID
+ExReleaseFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    KIRQL oldIrql = FastMutex->OldIrql;
+
+    pthread_mutex_unlock( &FastMutex->Lock );
+
+    KeLowerIrql( oldIrql );
+}
+
+
+/*************************************************************************
+    Time
+*************************************************************************/
+
+//
+//  The performance counter runs at 10MHz, as it does on most machines.
+//
+
+#define SIM_PERFORMANCE_FREQUENCY   10000000
+
+
+LARGE_INTEGER
+KeQueryPerformanceCounter (
+    PLARGE_INTEGER PerformanceFrequency
+    )
+{
+    struct timespec now;
+    LARGE_INTEGER counter;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    counter.QuadPart = (LONGLONG)now.tv_sec * SIM_PERFORMANCE_FREQUENCY +
+                       now.tv_nsec / (1000000000 / SIM_PERFORMANCE_FREQUENCY);
+
+    if (PerformanceFrequency != NULL) {
+
+        PerformanceFrequency->QuadPart = SIM_PERFORMANCE_FREQUENCY;
+    }
+
+    return counter;
+}
+
+
+VOID
+KeStallExecutionProcessor (
+    ULONG MicroSeconds
+    )
+{
+    LONGLONG end = KeQueryPerformanceCounter( NULL ).QuadPart +
+                   (LONGLONG)MicroSeconds * (SIM_PERFORMANCE_FREQUENCY / 1000000);
+
+    while (KeQueryPerformanceCounter( NULL ).QuadPart < end) {
+
+        SimYield();
+    }
+}
+
+
+NTSTATUS
+KeDelayExecutionThread (
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Interval
+    )
+{
+    LONGLONG interval = (Interval->QuadPart < 0) ? -Interval->QuadPart : 0;
+    struct timespec delay;
+
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+
+    if (KeGetCurrentIrql() > APC_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "delay at DISPATCH_LEVEL" );
+    }
+
+    delay.tv_sec = interval / 10000000;
+    delay.tv_nsec = (long)(interval % 10000000) * 100;
+
+    nanosleep( &delay, NULL );
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Processes and threads
+*************************************************************************/
+
+HANDLE
+PsGetCurrentProcessId (
+    VOID
+    )
+{
+    return (HANDLE)(ULONG_PTR)getpid();
+}
+
+
+HANDLE
+PsGetCurrentThreadId (
+    VOID
+    )
+{
+    return (HANDLE)(ULONG_PTR)syscall( SYS_gettid );
+}
+
+
+//
+//  A system thread.  Its exit event comes first, so waiting on the thread
+//  waits on it.  The thread holds a reference to itself until it exits.
+//
+
+typedef struct _SIM_SYSTEM_THREAD {
+
+    KEVENT Exited;
+
+    PKSTART_ROUTINE StartRoutine;
+
+    PVOID StartContext;
+
+} SIM_SYSTEM_THREAD, *PSIM_SYSTEM_THREAD;
+
+static POBJECT_TYPE SimThreadType;
+
+POBJECT_TYPE *PsThreadType = &SimThreadType;
+
+static __thread PSIM_SYSTEM_THREAD SimCurrentThread;
+
+//
+//  System threads not yet gone.  A thread signals its exit before it
+//  drops its reference to itself, so leaks are only counted once none
+//  is left.
+//
+
+static volatile LONG SimSystemThreads;
+
+
+static VOID
+SimExitThread (
+    __in PSIM_SYSTEM_THREAD Thread
+    )
+{
+    SimCurrentThread = NULL;
+
+    KeSetEvent( &Thread->Exited, IO_NO_INCREMENT, FALSE );
+
+    ObDereferenceObject( Thread );
+
+    InterlockedDecrement( &SimSystemThreads );
+}
+
+
+static PVOID
+SimThreadStart (
+    __in PVOID Parameter
+    )
+{
+    PSIM_SYSTEM_THREAD thread = Parameter;
+
+    SimCurrentThread = thread;
+
+    thread->StartRoutine( thread->StartContext );
+
+    SimExitThread( thread );
+
+    return NULL;
+}
+
+
+NTSTATUS
+PsCreateSystemThread (
+    PHANDLE ThreadHandle,
+    ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle,
+    PVOID ClientId,
+    PKSTART_ROUTINE StartRoutine,
+    PVOID StartContext
+    )
+{
+    PSIM_SYSTEM_THREAD thread;
+    pthread_attr_t attributes;
+    pthread_t posixThread;
+    int error;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+    UNREFERENCED_PARAMETER( ProcessHandle );
+    UNREFERENCED_PARAMETER( ClientId );
+
+    if (KeGetCurrentIrql() != PASSIVE_LEVEL) {
+
+        SimBugCheck( __FILE__, __LINE__, "IRQL_NOT_LESS_OR_EQUAL: PsCreateSystemThread above PASSIVE_LEVEL" );
+    }
+
+    thread = SimObCreateObject( SimObjectThread, sizeof(SIM_SYSTEM_THREAD), NULL );
+
+    if (thread == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeEvent( &thread->Exited, NotificationEvent, FALSE );
+
+    thread->StartRoutine = StartRoutine;
+    thread->StartContext = StartContext;
+
+    //
+    //  One reference for the handle, one for the thread.
+    //
+
+    SimObReferenceObject( thread );
+
+    InterlockedIncrement( &SimSystemThreads );
+
+    pthread_attr_init( &attributes );
+    pthread_attr_setdetachstate( &attributes, PTHREAD_CREATE_DETACHED );
+
+    error = pthread_create( &posixThread, &attributes, SimThreadStart, thread );
+
+    pthread_attr_destroy( &attributes );
+
+    if (error != 0) {
+
+        InterlockedDecrement( &SimSystemThreads );
+
+        ObDereferenceObject( thread );
+        ObDereferenceObject( thread );
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *ThreadHandle = SIM_OBJECT_TO_HEADER( thread );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+PsTerminateSystemThread (
+    NTSTATUS ExitStatus
+    )
+{
+    UNREFERENCED_PARAMETER( ExitStatus );
+
+    if (SimCurrentThread == NULL) {
+
+        SimBugCheck( __FILE__, __LINE__, "PsTerminateSystemThread outside a system thread" );
+    }
+
+    SimExitThread( SimCurrentThread );
+
+    pthread_exit( NULL );
+}
+
+
+KPROCESSOR_MODE
+ExGetPreviousMode (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Everything the harness sends comes from inside the process, so as
+    far as the driver can tell it comes from kernel mode.
+
+--*/
+{
+    return KernelMode;
+}
+
+
+VOID
+ProbeForRead (
+    PVOID Address,
+    SIZE_T Length,
+    ULONG Alignment
+    )
+{
+    UNREFERENCED_PARAMETER( Length );
+
+    if (((ULONG_PTR)Address & (Alignment - 1)) != 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "ProbeForRead of a misaligned buffer" );
+    }
+}
+
+
+VOID
+ProbeForWrite (
+    PVOID Address,
+    SIZE_T Length,
+    ULONG Alignment
+    )
+{
+    UNREFERENCED_PARAMETER( Length );
+
+    if (((ULONG_PTR)Address & (Alignment - 1)) != 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "ProbeForWrite of a misaligned buffer" );
+    }
+}
+
+
+/*************************************************************************
+    Strings
+*************************************************************************/
+
+ULONG
+SimUtf8ToUtf16 (
+    __in PCSTR Source,
+    __in SIZE_T SourceLength,
+    __out_ecount(DestinationCount) PWCHAR Destination,
+    __in ULONG DestinationCount
+    )
+{
+    PCUCHAR s = (PCUCHAR)Source;
+    PCUCHAR end = s + SourceLength;
+    ULONG count = 0;
+
+    while (s < end) {
+
+        ULONG c = *s++;
+        ULONG extra = 0;
+
+        if (c >= 0xf0) {
+
+            c &= 0x07;
+            extra = 3;
+
+        } else if (c >= 0xe0) {
+
+            c &= 0x0f;
+            extra = 2;
+
+        } else if (c >= 0xc0) {
+
+            c &= 0x1f;
+            extra = 1;
+        }
+
+        while (extra-- > 0 && s < end) {
+
+            c = (c << 6) | (*s++ & 0x3f);
+        }
+
+        if (c >= 0x10000) {
+
+            if (count + 2 > DestinationCount) {
+
+                break;
+            }
+
+            c -= 0x10000;
+            Destination[count++] = (WCHAR)(0xd800 | (c >> 10));
+            Destination[count++] = (WCHAR)(0xdc00 | (c & 0x3ff));
+
+        } else {
+
+            if (count + 1 > DestinationCount) {
+
+                break;
+            }
+
+            Destination[count++] = (WCHAR)c;
+        }
+    }
+
+    return count;
+}
+
+
+ULONG
+SimUtf16ToUtf8 (
+    __in PCWSTR Source,
+    __in ULONG SourceCount,
+    __out_ecount(DestinationCount) PCHAR Destination,
+    __in ULONG DestinationCount
+    )
+{
+    ULONG count = 0;
+    ULONG i;
+
+    for (i = 0; i < SourceCount; i++) {
+
+        ULONG c = Source[i];
+        UCHAR bytes[4];
+        ULONG length;
+
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < SourceCount) {
+
+            c = 0x10000 + ((c - 0xd800) << 10) + (Source[++i] - 0xdc00);
+        }
+
+        if (c < 0x80) {
+
+            bytes[0] = (UCHAR)c;
+            length = 1;
+
+        } else if (c < 0x800) {
+
+            bytes[0] = (UCHAR)(0xc0 | (c >> 6));
+            bytes[1] = (UCHAR)(0x80 | (c & 0x3f));
+            length = 2;
+
+        } else if (c < 0x10000) {
+
+            bytes[0] = (UCHAR)(0xe0 | (c >> 12));
+            bytes[1] = (UCHAR)(0x80 | ((c >> 6) & 0x3f));
+            bytes[2] = (UCHAR)(0x80 | (c & 0x3f));
+            length = 3;
+
+        } else {
+
+            bytes[0] = (UCHAR)(0xf0 | (c >> 18));
+            bytes[1] = (UCHAR)(0x80 | ((c >> 12) & 0x3f));
+            bytes[2] = (UCHAR)(0x80 | ((c >> 6) & 0x3f));
+            bytes[3] = (UCHAR)(0x80 | (c & 0x3f));
+            length = 4;
+        }
+
+        if (count + length > DestinationCount) {
+
+            break;
+        }
+
+        memcpy( &Destination[count], bytes, length );
+        count += length;
+    }
+
+    return count;
+}
+
+
+VOID
+RtlInitUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCWSTR SourceString
+    )
+{
+    SIZE_T length = 0;
+
+    if (SourceString != NULL) {
+
+        while (SourceString[length] != UNICODE_NULL) {
+
+            length++;
+        }
+    }
+
+    DestinationString->Length = (USHORT)(length * sizeof(WCHAR));
+    DestinationString->MaximumLength = (USHORT)((SourceString != NULL) ?
+                                                (length + 1) * sizeof(WCHAR) : 0);
+    DestinationString->Buffer = (PWSTR)SourceString;
+}
+
+
+VOID
+RtlCopyUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCUNICODE_STRING SourceString
+    )
+{
+    USHORT length = 0;
+
+    if (SourceString != NULL) {
+
+        length = min( SourceString->Length, DestinationString->MaximumLength );
+        RtlMoveMemory( DestinationString->Buffer, SourceString->Buffer, length );
+
+        if (length + sizeof(WCHAR) <= DestinationString->MaximumLength) {
+
+            DestinationString->Buffer[length / sizeof(WCHAR)] = UNICODE_NULL;
+        }
+    }
+
+    DestinationString->Length = length;
+}
+
+
+NTSTATUS
+RtlAppendUnicodeToString (
+    PUNICODE_STRING Destination,
+    PCWSTR Source
+    )
+{
+    UNICODE_STRING source;
+
+    RtlInitUnicodeString( &source, Source );
+
+    if (Destination->Length + source.Length > Destination->MaximumLength) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlMoveMemory( (PUCHAR)Destination->Buffer + Destination->Length,
+                   source.Buffer,
+                   source.Length );
+
+    Destination->Length += source.Length;
+
+    if (Destination->Length + sizeof(WCHAR) <= Destination->MaximumLength) {
+
+        Destination->Buffer[Destination->Length / sizeof(WCHAR)] = UNICODE_NULL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+static WCHAR
+SimUpcase (
+    __in WCHAR C
+    )
+{
+    return (C >= L'a' && C <= L'z') ? (WCHAR)(C - (L'a' - L'A')) : C;
+}
+
+
+BOOLEAN
+RtlEqualUnicodeString (
+    PCUNICODE_STRING String1,
+    PCUNICODE_STRING String2,
+    BOOLEAN CaseInSensitive
+    )
+/*++
+
+Routine Description:
+
+    Compares two strings.  Case is folded for ASCII only.
+
+--*/
+{
+    USHORT i;
+
+    if (String1->Length != String2->Length) {
+
+        return FALSE;
+    }
+
+    for (i = 0; i < String1->Length / sizeof(WCHAR); i++) {
+
+        WCHAR c1 = String1->Buffer[i];
+        WCHAR c2 = String2->Buffer[i];
+
+        if (CaseInSensitive) {
+
+            c1 = SimUpcase( c1 );
+            c2 = SimUpcase( c2 );
+        }
+
+        if (c1 != c2) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/*************************************************************************
+    Objects and handles
+*************************************************************************/
+
+static volatile LONG SimObjectCounts[SimObjectTypeCount];
+
+static PCSTR SimObjectTypeNames[SimObjectTypeCount] = {
+
+    "key",
+    "section",
+    "device",
+    "thread",
+    "event"
+};
+
+
+PVOID
+SimObCreateObject (
+    __in SIM_OBJECT_TYPE Type,
+    __in SIZE_T BodySize,
+    __in_opt PSIM_OBJECT_DELETE Delete
+    )
+{
+    PSIM_OBJECT_HEADER header;
+
+    header = ExAllocatePoolWithTag( NonPagedPool,
+                                    sizeof(SIM_OBJECT_HEADER) + BodySize,
+                                    SIM_OBJECT_TAG );
+
+    if (header == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( header, sizeof(SIM_OBJECT_HEADER) + BodySize );
+
+    header->PointerCount = 1;
+    header->Type = Type;
+    header->Delete = Delete;
+
+    InterlockedIncrement( &SimObjectCounts[Type] );
+
+    return SIM_HEADER_TO_OBJECT( header );
+}
+
+
+VOID
+SimObReferenceObject (
+    __in PVOID Object
+    )
+{
+    InterlockedIncrement( &SIM_OBJECT_TO_HEADER( Object )->PointerCount );
+}
+
+
+VOID
+ObDereferenceObject (
+    PVOID Object
+    )
+{
+    PSIM_OBJECT_HEADER header = SIM_OBJECT_TO_HEADER( Object );
+    LONG count = InterlockedDecrement( &header->PointerCount );
+
+    if (count < 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "REFERENCE_BY_POINTER: object dereferenced too often" );
+    }
+
+    if (count == 0) {
+
+        if (header->Delete != NULL) {
+
+            header->Delete( Object );
+        }
+
+        InterlockedDecrement( &SimObjectCounts[header->Type] );
+
+        ExFreePoolWithTag( header, SIM_OBJECT_TAG );
+    }
+}
+
+
+NTSTATUS
+ObReferenceObjectByHandle (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    PVOID *Object,
+    PVOID HandleInformation
+    )
+{
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectType );
+    UNREFERENCED_PARAMETER( AccessMode );
+    UNREFERENCED_PARAMETER( HandleInformation );
+
+    if (Handle == NULL) {
+
+        return STATUS_INVALID_HANDLE;
+    }
+
+    *Object = SIM_HEADER_TO_OBJECT( Handle );
+
+    SimObReferenceObject( *Object );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+ZwClose (
+    HANDLE Handle
+    )
+{
+    if (Handle == NULL) {
+
+        return STATUS_INVALID_HANDLE;
+    }
+
+    ObDereferenceObject( SIM_HEADER_TO_OBJECT( Handle ) );
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Named events
+*************************************************************************/
+
+//
+//  The low memory condition event, while someone has it open, and whether
+//  memory is short.  The event does not outlive its last handle, so that
+//  it is not reported as a leak; it takes the condition from
+//  SimLowMemory when it is opened again.
+//
+
+static pthread_mutex_t SimEventLock = PTHREAD_MUTEX_INITIALIZER;
+
+static PKEVENT SimLowMemoryEvent;
+
+static BOOLEAN SimLowMemory;
+
+
+static VOID
+SimDeleteEvent (
+    __in PVOID Object
+    )
+{
+    pthread_mutex_lock( &SimEventLock );
+
+    if (SimLowMemoryEvent == Object) {
+
+        SimLowMemoryEvent = NULL;
+    }
+
+    pthread_mutex_unlock( &SimEventLock );
+}
+
+
+PKEVENT
+IoCreateNotificationEvent (
+    PUNICODE_STRING EventName,
+    PHANDLE EventHandle
+    )
+/*++
+
+Routine Description:
+
+    Opens \KernelObjects\LowNonPagedPoolCondition, creating it if nobody
+    has it open.  Any other name fails.
+
+    A handle closed while another thread opens the event may find it
+    being deleted; the driver opens and closes it only at load and unload.
+
+--*/
+{
+    UNICODE_STRING lowMemoryName;
+    PKEVENT event;
+
+    RtlInitUnicodeString( &lowMemoryName, L"\\KernelObjects\\LowNonPagedPoolCondition" );
+
+    *EventHandle = NULL;
+
+    if (!RtlEqualUnicodeString( EventName, &lowMemoryName, TRUE )) {
+
+        return NULL;
+    }
+
+    pthread_mutex_lock( &SimEventLock );
+
+    event = SimLowMemoryEvent;
+
+    if (event != NULL) {
+
+        SimObReferenceObject( event );
+
+    } else {
+
+        event = SimObCreateObject( SimObjectEvent, sizeof(KEVENT), SimDeleteEvent );
+
+        if (event != NULL) {
+
+            KeInitializeEvent( event, NotificationEvent, SimLowMemory );
+            SimLowMemoryEvent = event;
+        }
+    }
+
+    pthread_mutex_unlock( &SimEventLock );
+
+    if (event != NULL) {
+
+        *EventHandle = SIM_OBJECT_TO_HEADER( event );
+    }
+
+    return event;
+}
+
+
+VOID
+SimSetLowMemory (
+    __in BOOLEAN Low
+    )
+{
+    pthread_mutex_lock( &SimEventLock );
+
+    SimLowMemory = Low;
+
+    if (SimLowMemoryEvent != NULL) {
+
+        if (Low) {
+
+            KeSetEvent( SimLowMemoryEvent, IO_NO_INCREMENT, FALSE );
+
+        } else {
+
+            KeClearEvent( SimLowMemoryEvent );
+        }
+    }
+
+    pthread_mutex_unlock( &SimEventLock );
+}
+
+
+/*************************************************************************
+    Registry
+*************************************************************************/
+
+//
+//  The one key there is: the driver's parameters, set by the harness.
+//
+
+typedef struct _SIM_PARAMETER {
+
+    struct _SIM_PARAMETER *Next;
+
+    WCHAR Name[64];
+
+    USHORT NameLength;
+
+    ULONG Type;
+
+    ULONG Length;
+
+    UCHAR Data[1];
+
+} SIM_PARAMETER, *PSIM_PARAMETER;
+
+static pthread_mutex_t SimParameterLock = PTHREAD_MUTEX_INITIALIZER;
+
+static PSIM_PARAMETER SimParameters;
+
+
+NTSTATUS
+SimSetParameter (
+    __in PCSTR Name,
+    __in ULONG Type,
+    __in_bcount_opt(Length) CONST VOID *Data,
+    __in ULONG Length
+    )
+{
+    PSIM_PARAMETER parameter = NULL;
+    PSIM_PARAMETER *link;
+    UNICODE_STRING name;
+    UNICODE_STRING existing;
+    WCHAR nameBuffer[64];
+
+    name.Length = (USHORT)(SimUtf8ToUtf16( Name, strlen( Name ), nameBuffer, 64 ) * sizeof(WCHAR));
+    name.MaximumLength = sizeof(nameBuffer);
+    name.Buffer = nameBuffer;
+
+    //
+    //  Parameters are plain heap memory: they are the harness's, not the
+    //  driver's, and outlive it.
+    //
+
+    if (Data != NULL) {
+
+        parameter = malloc( sizeof(SIM_PARAMETER) + Length );
+
+        if (parameter == NULL) {
+
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        memcpy( parameter->Name, nameBuffer, name.Length );
+        parameter->NameLength = name.Length;
+        parameter->Type = Type;
+        parameter->Length = Length;
+        memcpy( parameter->Data, Data, Length );
+    }
+
+    pthread_mutex_lock( &SimParameterLock );
+
+    for (link = &SimParameters; *link != NULL; link = &(*link)->Next) {
+
+        existing.Length = existing.MaximumLength = (*link)->NameLength;
+        existing.Buffer = (*link)->Name;
+
+        if (RtlEqualUnicodeString( &existing, &name, TRUE )) {
+
+            PSIM_PARAMETER old = *link;
+
+            *link = old->Next;
+            free( old );
+            break;
+        }
+    }
+
+    if (parameter != NULL) {
+
+        parameter->Next = SimParameters;
+        SimParameters = parameter;
+    }
+
+    pthread_mutex_unlock( &SimParameterLock );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+SimSetParameterDword (
+    __in PCSTR Name,
+    __in ULONG Value
+    )
+{
+    return SimSetParameter( Name, REG_DWORD, &Value, sizeof(Value) );
+}
+
+
+NTSTATUS
+ZwOpenKey (
+    PHANDLE KeyHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes
+    )
+/*++
+
+Routine Description:
+
+    Opens the driver's service key, whatever path is asked for.  The
+    handle is real, so one the driver does not close shows up as a leak.
+
+--*/
+{
+    PVOID key;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+
+    PAGED_CODE();
+
+    key = SimObCreateObject( SimObjectKey, 0, NULL );
+
+    if (key == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *KeyHandle = SIM_OBJECT_TO_HEADER( key );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+ZwQueryValueKey (
+    HANDLE KeyHandle,
+    PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    PVOID KeyValueInformation,
+    ULONG Length,
+    PULONG ResultLength
+    )
+/*++
+
+Routine Description:
+
+    Reads a parameter as KeyValuePartialInformation, with the registry's
+    rules for short buffers: STATUS_BUFFER_TOO_SMALL when not even the
+    fixed part fits, STATUS_BUFFER_OVERFLOW with the fixed part filled in
+    when the data does not.  Either way ResultLength says what is needed.
+
+--*/
+{
+    PKEY_VALUE_PARTIAL_INFORMATION information = KeyValueInformation;
+    ULONG fixedLength = FIELD_OFFSET( KEY_VALUE_PARTIAL_INFORMATION, Data );
+    PSIM_PARAMETER parameter;
+    UNICODE_STRING name;
+    NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+    PAGED_CODE();
+
+    if (KeyHandle == NULL) {
+
+        return STATUS_INVALID_HANDLE;
+    }
+
+    if (KeyValueInformationClass != KeyValuePartialInformation) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock( &SimParameterLock );
+
+    for (parameter = SimParameters; parameter != NULL; parameter = parameter->Next) {
+
+        name.Length = name.MaximumLength = parameter->NameLength;
+        name.Buffer = parameter->Name;
+
+        if (!RtlEqualUnicodeString( &name, ValueName, TRUE )) {
+
+            continue;
+        }
+
+        *ResultLength = fixedLength + parameter->Length;
+
+        if (Length < fixedLength) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        information->TitleIndex = 0;
+        information->Type = parameter->Type;
+        information->DataLength = parameter->Length;
+
+        if (Length < fixedLength + parameter->Length) {
+
+            status = STATUS_BUFFER_OVERFLOW;
+            break;
+        }
+
+        memcpy( information->Data, parameter->Data, parameter->Length );
+
+        status = STATUS_SUCCESS;
+        break;
+    }
+
+    pthread_mutex_unlock( &SimParameterLock );
+
+    return status;
+}
+
+
+/*************************************************************************
+    Sections
+*************************************************************************/
+
+//
+//  A pagefile backed section is shared anonymous memory.  Every view of
+//  it, in "system space" or in the "process", is the same mapping, held
+//  by a reference on the section.
+//
+
+typedef struct _SIM_SECTION {
+
+    LIST_ENTRY Links;
+
+    PVOID Base;
+
+    SIZE_T Size;
+
+} SIM_SECTION, *PSIM_SECTION;
+
+static pthread_mutex_t SimSectionLock = PTHREAD_MUTEX_INITIALIZER;
+
+static LIST_ENTRY SimSections = { &SimSections, &SimSections };
+
+
+static VOID
+SimDeleteSection (
+    __in PVOID Object
+    )
+{
+    PSIM_SECTION section = Object;
+
+    pthread_mutex_lock( &SimSectionLock );
+
+    section->Links.Blink->Flink = section->Links.Flink;
+    section->Links.Flink->Blink = section->Links.Blink;
+
+    pthread_mutex_unlock( &SimSectionLock );
+
+    munmap( section->Base, section->Size );
+}
+
+
+NTSTATUS
+ZwCreateSection (
+    PHANDLE SectionHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PLARGE_INTEGER MaximumSize,
+    ULONG SectionPageProtection,
+    ULONG AllocationAttributes,
+    HANDLE FileHandle
+    )
+{
+    PSIM_SECTION section;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+    UNREFERENCED_PARAMETER( SectionPageProtection );
+    UNREFERENCED_PARAMETER( AllocationAttributes );
+
+    PAGED_CODE();
+
+    if (FileHandle != NULL || MaximumSize == NULL || MaximumSize->QuadPart <= 0) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    section = SimObCreateObject( SimObjectSection, sizeof(SIM_SECTION), NULL );
+
+    if (section == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    section->Size = ROUND_TO_PAGES( MaximumSize->QuadPart );
+    section->Base = mmap( NULL,
+                          section->Size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS,
+                          -1,
+                          0 );
+
+    if (section->Base == MAP_FAILED) {
+
+        ObDereferenceObject( section );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pthread_mutex_lock( &SimSectionLock );
+
+    section->Links.Flink = &SimSections;
+    section->Links.Blink = SimSections.Blink;
+    SimSections.Blink->Flink = &section->Links;
+    SimSections.Blink = &section->Links;
+
+    pthread_mutex_unlock( &SimSectionLock );
+
+    SIM_OBJECT_TO_HEADER( section )->Delete = SimDeleteSection;
+
+    *SectionHandle = SIM_OBJECT_TO_HEADER( section );
+
+    return STATUS_SUCCESS;
+}
+
+
+static NTSTATUS
+SimMapSection (
+    __in PSIM_SECTION Section,
+    __out PVOID *MappedBase,
+    __inout PSIZE_T ViewSize
+    )
+{
+    SimObReferenceObject( Section );
+
+    *MappedBase = Section->Base;
+    *ViewSize = Section->Size;
+
+    return STATUS_SUCCESS;
+}
+
+
+static NTSTATUS
+SimUnmapSection (
+    __in PVOID MappedBase
+    )
+{
+    PSIM_SECTION section = NULL;
+    PLIST_ENTRY entry;
+
+    pthread_mutex_lock( &SimSectionLock );
+
+    for (entry = SimSections.Flink; entry != &SimSections; entry = entry->Flink) {
+
+        if (CONTAINING_RECORD( entry, SIM_SECTION, Links )->Base == MappedBase) {
+
+            section = CONTAINING_RECORD( entry, SIM_SECTION, Links );
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &SimSectionLock );
+
+    if (section == NULL) {
+
+        return STATUS_NOT_FOUND;
+    }
+
+    ObDereferenceObject( section );
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+MmMapViewInSystemSpace (
+    PVOID Section,
+    PVOID *MappedBase,
+    PSIZE_T ViewSize
+    )
+{
+    return SimMapSection( Section, MappedBase, ViewSize );
+}
+
+
+NTSTATUS
+MmUnmapViewInSystemSpace (
+    PVOID MappedBase
+    )
+{
+    return SimUnmapSection( MappedBase );
+}
+
+
+NTSTATUS
+ZwMapViewOfSection (
+    HANDLE SectionHandle,
+    HANDLE ProcessHandle,
+    PVOID *BaseAddress,
+    ULONG_PTR ZeroBits,
+    SIZE_T CommitSize,
+    PLARGE_INTEGER SectionOffset,
+    PSIZE_T ViewSize,
+    SECTION_INHERIT InheritDisposition,
+    ULONG AllocationType,
+    ULONG Win32Protect
+    )
+{
+    UNREFERENCED_PARAMETER( ProcessHandle );
+    UNREFERENCED_PARAMETER( ZeroBits );
+    UNREFERENCED_PARAMETER( CommitSize );
+    UNREFERENCED_PARAMETER( InheritDisposition );
+    UNREFERENCED_PARAMETER( AllocationType );
+    UNREFERENCED_PARAMETER( Win32Protect );
+
+    if (SectionOffset != NULL && SectionOffset->QuadPart != 0) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    return SimMapSection( SIM_HEADER_TO_OBJECT( SectionHandle ), BaseAddress, ViewSize );
+}
+
+
+NTSTATUS
+ZwUnmapViewOfSection (
+    HANDLE ProcessHandle,
+    PVOID BaseAddress
+    )
+{
+    UNREFERENCED_PARAMETER( ProcessHandle );
+
+    return SimUnmapSection( BaseAddress );
+}
+
+
+/*************************************************************************
+    Random numbers
+*************************************************************************/
+
+NTSTATUS
+BCryptGenRandom (
+    BCRYPT_ALG_HANDLE Algorithm,
+    PUCHAR Buffer,
+    ULONG BufferSize,
+    ULONG Flags
+    )
+{
+    ULONG done = 0;
+
+    UNREFERENCED_PARAMETER( Algorithm );
+    UNREFERENCED_PARAMETER( Flags );
+
+    while (done < BufferSize) {
+
+        ssize_t got = getrandom( Buffer + done, BufferSize - done, 0 );
+
+        if (got < 0) {
+
+            if (errno == EINTR) {
+
+                continue;
+            }
+
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        done += (ULONG)got;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Worker thread
+*************************************************************************/
+
+static pthread_once_t SimWorkerOnce = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t SimWorkLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t SimWorkQueued = PTHREAD_COND_INITIALIZER;
+
+static pthread_cond_t SimWorkDone = PTHREAD_COND_INITIALIZER;
+
+static LIST_ENTRY SimWorkQueue = { &SimWorkQueue, &SimWorkQueue };
+
+//
+//  Items queued or running.
+//
+
+static ULONG SimWorkPending;
+
+
+static PVOID
+SimWorkerThread (
+    __in PVOID Parameter
+    )
+{
+    UNREFERENCED_PARAMETER( Parameter );
+
+    pthread_mutex_lock( &SimWorkLock );
+
+    for (;;) {
+
+        PSIM_WORK_ITEM item;
+        PLIST_ENTRY entry;
+
+        while (SimWorkQueue.Flink == &SimWorkQueue) {
+
+            pthread_cond_wait( &SimWorkQueued, &SimWorkLock );
+        }
+
+        entry = SimWorkQueue.Flink;
+        entry->Flink->Blink = &SimWorkQueue;
+        SimWorkQueue.Flink = entry->Flink;
+
+        pthread_mutex_unlock( &SimWorkLock );
+
+        item = CONTAINING_RECORD( entry, SIM_WORK_ITEM, Links );
+        item->Routine( item->Context );
+
+        if (KeGetCurrentIrql() != PASSIVE_LEVEL) {
+
+            SimBugCheck( __FILE__, __LINE__, "work item returned above PASSIVE_LEVEL" );
+        }
+
+        pthread_mutex_lock( &SimWorkLock );
+
+        if (--SimWorkPending == 0) {
+
+            pthread_cond_broadcast( &SimWorkDone );
+        }
+    }
+
+    return NULL;
+}
+
+
+static VOID
+SimStartWorker (
+    VOID
+    )
+{
+    pthread_t thread;
+
+    if (pthread_create( &thread, NULL, SimWorkerThread, NULL ) != 0) {
+
+        SimBugCheck( __FILE__, __LINE__, "cannot start the worker thread" );
+    }
+
+    pthread_detach( thread );
+}
+
+
+VOID
+SimQueueWorkItem (
+    __inout PSIM_WORK_ITEM WorkItem,
+    __in PSIM_WORKER_ROUTINE Routine,
+    __in PVOID Context
+    )
+{
+    pthread_once( &SimWorkerOnce, SimStartWorker );
+
+    WorkItem->Routine = Routine;
+    WorkItem->Context = Context;
+
+    pthread_mutex_lock( &SimWorkLock );
+
+    WorkItem->Links.Flink = &SimWorkQueue;
+    WorkItem->Links.Blink = SimWorkQueue.Blink;
+    SimWorkQueue.Blink->Flink = &WorkItem->Links;
+    SimWorkQueue.Blink = &WorkItem->Links;
+
+    SimWorkPending++;
+
+    pthread_cond_signal( &SimWorkQueued );
+    pthread_mutex_unlock( &SimWorkLock );
+}
+
+
+VOID
+SimFlushWorkQueue (
+    VOID
+    )
+{
+    pthread_mutex_lock( &SimWorkLock );
+
+    while (SimWorkPending != 0) {
+
+        pthread_cond_wait( &SimWorkDone, &SimWorkLock );
+    }
+
+    pthread_mutex_unlock( &SimWorkLock );
+}
+
+
+/*************************************************************************
+    Accounting
+*************************************************************************/
+
+VOID
+SimQueryPool (
+    __in ULONG Tag,
+    __out PSIM_POOL_USAGE Usage
+    )
+/*++
+
+Routine Description:
+
+    Sums the pool accounting of a tag, or of every tag.
+
+Arguments:
+
+    Tag - The pool tag, or zero for all of them.
+
+    Usage - Receives the allocations and bytes outstanding and the
+        allocations made.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG i;
+
+    RtlZeroMemory( Usage, sizeof(SIM_POOL_USAGE) );
+
+    for (i = 0; i < SIM_POOL_TAG_SLOTS; i++) {
+
+        PSIM_POOL_TAG slot = &SimPoolTags[i];
+
+        if (slot->Tag == 0 || (Tag != 0 && slot->Tag != Tag)) {
+
+            continue;
+        }
+
+        Usage->Allocations += slot->Allocations;
+        Usage->Bytes += slot->Bytes;
+        Usage->TotalAllocations += slot->TotalAllocations;
+    }
+}
+
+
+ULONG
+SimReportLeaks (
+    __in BOOLEAN Print
+    )
+/*++
+
+Routine Description:
+
+    Counts, and optionally prints, the pool allocations and objects that
+    are still there.
+
+Arguments:
+
+    Print - Whether to print them.
+
+Return Value:
+
+    The number of pool allocations outstanding.
+
+--*/
+{
+    LONGLONG outstanding = 0;
+    ULONG i;
+
+    SimFlushWorkQueue();
+
+    while (SimSystemThreads != 0) {
+
+        sched_yield();
+    }
+
+    for (i = 0; i < SIM_POOL_TAG_SLOTS; i++) {
+
+        PSIM_POOL_TAG slot = &SimPoolTags[i];
+        CHAR tag[5];
+
+        if (slot->Tag == 0 || slot->Allocations == 0) {
+
+            continue;
+        }
+
+        outstanding += slot->Allocations;
+
+        if (Print) {
+
+            memcpy( tag, (CONST VOID *)&slot->Tag, 4 );
+            tag[4] = '\0';
+
+            fprintf( stderr,
+                     "csgsim: pool tag '%s': %lld allocations, %lld bytes outstanding (%lld made)\n",
+                     tag,
+                     (long long)slot->Allocations,
+                     (long long)slot->Bytes,
+                     (long long)slot->TotalAllocations );
+        }
+    }
+
+    for (i = 0; i < SimObjectTypeCount; i++) {
+
+        if (Print && SimObjectCounts[i] != 0) {
+
+            fprintf( stderr,
+                     "csgsim: %d %s objects outstanding\n",
+                     (int)SimObjectCounts[i],
+                     SimObjectTypeNames[i] );
+        }
+    }
+
+    return (ULONG)outstanding;
+}
@@ -0,0 +1,166 @@
+#ifndef __CSG_SIM_STRUCT_H__
+#define __CSG_SIM_STRUCT_H__
+
+/*++
+
+Module Name:
+
+    csgsimStruct.h
+
+Abstract:
+
+    What csgsimKernel.c and csgsimFlt.c share and the harness does not
+    see: the simulation's own pool tags, its object manager and its
+    worker thread.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#include "csgsim.h"
+
+//
+//  Pool tags of what the simulation allocates on the driver's behalf, so
+//  leaks of those show up next to the driver's own.
+//
+
+#define SIM_OBJECT_TAG      'bOmS'
+#define SIM_MDL_TAG         'dMmS'
+#define SIM_NAME_TAG        'mNmS'
+#define SIM_CONTEXT_TAG     'xCmS'
+#define SIM_CACHE_TAG       'cCmS'
+#define SIM_IRP_TAG         'pImS'
+
+//
+//  Where a spin lock spins.  Repeated here so the simulation does not
+//  depend on the driver's headers.
+//
+
+#define SimYield()          __builtin_ia32_pause()
+
+/*************************************************************************
+    Objects
+*************************************************************************/
+
+//
+//  Objects the driver may reference and dereference (sections, device
+//  objects, registry keys, threads, named events) carry this header in
+//  front of their body, as kernel objects do.  A handle is the address of
+//  the header; each handle holds one reference.
+//
+
+typedef enum _SIM_OBJECT_TYPE {
+
+    SimObjectKey,
+    SimObjectSection,
+    SimObjectDevice,
+    SimObjectThread,
+    SimObjectEvent,
+    SimObjectTypeCount
+
+} SIM_OBJECT_TYPE;
+
+typedef VOID (*PSIM_OBJECT_DELETE)( PVOID Object );
+
+typedef struct DECLSPEC_CACHEALIGN _SIM_OBJECT_HEADER {
+
+    volatile LONG PointerCount;
+
+    SIM_OBJECT_TYPE Type;
+
+    PSIM_OBJECT_DELETE Delete;
+
+} SIM_OBJECT_HEADER, *PSIM_OBJECT_HEADER;
+
+#define SIM_OBJECT_TO_HEADER(_o)    ((PSIM_OBJECT_HEADER)(_o) - 1)
+#define SIM_HEADER_TO_OBJECT(_h)    ((PVOID)((PSIM_OBJECT_HEADER)(_h) + 1))
+
+//
+//  Creates an object with one reference and a zeroed body.
+//
+
+PVOID
+SimObCreateObject (
+    __in SIM_OBJECT_TYPE Type,
+    __in SIZE_T BodySize,
+    __in_opt PSIM_OBJECT_DELETE Delete
+    );
+
+VOID
+SimObReferenceObject (
+    __in PVOID Object
+    );
+
+/*************************************************************************
+    Pool
+*************************************************************************/
+
+//
+//  ExAllocatePoolWithTag with a stronger alignment, for
+//  FltAllocatePoolAlignedWithTag.
+//
+
+PVOID
+SimAllocatePoolAligned (
+    __in SIZE_T NumberOfBytes,
+    __in ULONG Tag,
+    __in ULONG Alignment
+    );
+
+/*************************************************************************
+    Worker thread
+*************************************************************************/
+
+//
+//  The simulation has one system worker thread.  Work queued from
+//  DISPATCH_LEVEL runs on it at PASSIVE_LEVEL, in order.
+//
+
+typedef VOID (*PSIM_WORKER_ROUTINE)( PVOID Context );
+
+typedef struct _SIM_WORK_ITEM {
+
+    LIST_ENTRY Links;
+
+    PSIM_WORKER_ROUTINE Routine;
+
+    PVOID Context;
+
+} SIM_WORK_ITEM, *PSIM_WORK_ITEM;
+
+VOID
+SimQueueWorkItem (
+    __inout PSIM_WORK_ITEM WorkItem,
+    __in PSIM_WORKER_ROUTINE Routine,
+    __in PVOID Context
+    );
+
+/*************************************************************************
+    Strings
+*************************************************************************/
+
+//
+//  Converts between UTF-8 and the UTF-16 of UNICODE_STRINGs.  Both
+//  return the number of characters (units of the destination) written,
+//  which is cut short rather than overflow.
+//
+
+ULONG
+SimUtf8ToUtf16 (
+    __in PCSTR Source,
+    __in SIZE_T SourceLength,
+    __out_ecount(DestinationCount) PWCHAR Destination,
+    __in ULONG DestinationCount
+    );
+
+ULONG
+SimUtf16ToUtf8 (
+    __in PCWSTR Source,
+    __in ULONG SourceCount,
+    __out_ecount(DestinationCount) PCHAR Destination,
+    __in ULONG DestinationCount
+    );
+
+#endif // __CSG_SIM_STRUCT_H__
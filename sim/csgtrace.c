@@ -0,0 +1,668 @@
+/*++
+
+Module Name:
+
+    csgtrace.c
+
+Abstract:
+
+    Checks the binary trace rings (csgTrace.h): what a snapshot returns
+    from a ring written by one thread, and that snapshots taken while many
+    threads write never return a torn record.
+
+        csgtrace [-t threads] [-i records] [-r records] [-s readers]
+                 [-w file]
+
+    The first checks pin themselves to processor 0 and write records with
+    known contents to a small ring: a snapshot must return every record
+    still in the ring, oldest first, with consecutive sequence numbers and
+    the arguments they were written with; once the ring has wrapped only
+    the newest ring's worth; and with less room, only the newest that
+    fit.  Bad ring numbers and sizes must be refused.
+
+    Then the writer threads fill the rings while reader threads snapshot
+    them over and over.  Every record a writer makes can check itself:
+    its first argument names the writer and the record's number, and the
+    others are derived from it, so a record mixed from two writes does not
+    match.  A snapshot must hold only such records, in increasing sequence
+    order and, for each writer, in the order it wrote them.  Once the
+    writers are done every ring must be full and whole, and its newest
+    sequence numbers must add up to the records written.
+
+    A writer so slow that its ring wraps all the way around it can leave a
+    torn record behind (see csgTrace.c); with the driver's ring size that
+    takes a writer preempted in the middle of a record for as long as the
+    others need to write 1024.  The concurrent check reports what it saw,
+    and a tear there is a failure to look into, not noise.  On a single
+    processor a reader only meets a writer when one of them is preempted
+    mid-record, so a broken ring may take several runs, more records or
+    a smaller -r to show.
+
+    A line per check goes to standard output; the exit status is nonzero
+    if any of them failed.
+
+        -t      writer threads, twice the processors unless told, at
+                most 64
+        -i      records each writer writes, 1000000 unless told
+        -r      records each ring holds while writers run, 1024, the
+                driver's default, unless told
+        -s      reader threads, 2 unless told
+        -w      also write the known-answer records to file, back to back
+                as csgTraceSnapshot returns them, for csgctl trace to
+                decode
+
+    Built on Linux, from this directory, as
+
+        cc -O2 -DCSG_USER_MODE -I.. csgtrace.c ../csgTrace.c ../csgCpu.c \
+           -lpthread -o csgtrace
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csgTrace.h"
+
+#define TRACE_MAX_THREADS       64
+
+//
+//  The ring the known-answer checks use: asked for 100 records, it holds
+//  128.
+//
+
+#define TRACE_KNOWN_ASKED       100
+#define TRACE_KNOWN_RECORDS     128
+
+#define TRACE_COUNT(_a)         (sizeof(_a) / sizeof((_a)[0]))
+#define TRACE_MIN(_a, _b)       (((_a) < (_b)) ? (_a) : (_b))
+
+typedef struct _TRACE_WRITER {
+
+    pthread_t Thread;
+
+    ULONG Index;
+
+} TRACE_WRITER, *PTRACE_WRITER;
+
+typedef struct _TRACE_READER {
+
+    pthread_t Thread;
+
+    PCSG_TRACE_RECORD Records;
+
+    ULONGLONG Snapshots;
+
+    ULONGLONG Checked;
+
+    ULONGLONG Torn;
+
+    ULONGLONG Disordered;
+
+} TRACE_READER, *PTRACE_READER;
+
+static PCSG_TRACE Trace;
+
+static ULONG Records = 1000000;
+
+static ULONG RingRecords = 1024;
+
+static volatile BOOLEAN Stop;
+
+static ULONG Failures;
+
+
+static ULONGLONG
+Derive (
+    __in ULONGLONG Tag,
+    __in ULONG Index
+    )
+/*++
+
+Routine Description:
+
+    The argument Index of the record whose first argument is Tag.
+
+--*/
+{
+    ULONGLONG value = Tag + 0x9e3779b97f4a7c15ULL * Index;
+
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+
+    return value ^ (value >> 31);
+}
+
+
+static USHORT
+EventOf (
+    __in ULONGLONG Tag
+    )
+{
+    return (USHORT)(1 + (Tag >> 32) % (CSG_TRACE_EVENT_COUNT - 1));
+}
+
+
+static VOID
+WriteTagged (
+    __in PCSG_TRACE Trace,
+    __in ULONGLONG Tag
+    )
+{
+    csgTraceWrite( Trace,
+                   EventOf( Tag ),
+                   Tag,
+                   Derive( Tag, 1 ),
+                   Derive( Tag, 2 ),
+                   Derive( Tag, 3 ),
+                   Derive( Tag, 4 ),
+                   Derive( Tag, 5 ) );
+}
+
+
+static BOOLEAN
+Intact (
+    __in const CSG_TRACE_RECORD *Record
+    )
+{
+    ULONG i;
+
+    if (Record->Event != EventOf( Record->Args[0] )) {
+
+        return FALSE;
+    }
+
+    for (i = 1; i < CSG_TRACE_MAX_ARGS; i++) {
+
+        if (Record->Args[i] != Derive( Record->Args[0], i )) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+Report (
+    __in BOOLEAN Passed,
+    __in const char *Format,
+    ...
+    )
+{
+    va_list arguments;
+
+    printf( "%s ", Passed ? "passed" : "FAILED" );
+
+    va_start( arguments, Format );
+    vprintf( Format, arguments );
+    va_end( arguments );
+
+    printf( "\n" );
+
+    if (!Passed) {
+
+        Failures++;
+    }
+}
+
+
+static BOOLEAN
+CheckRecords (
+    __in const CSG_TRACE_RECORD *Copied,
+    __in ULONG Count,
+    __in ULONG FirstSequence
+    )
+/*++
+
+Routine Description:
+
+    Checks a snapshot of the known-answer ring: Count records, the first
+    with sequence number FirstSequence and the rest following it, each
+    with the arguments record number sequence - 1 was written with, on
+    processor 0, at times that never go back.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+
+        if (Copied[i].Sequence != FirstSequence + i ||
+            Copied[i].Args[0] != (ULONGLONG)(FirstSequence + i - 1) ||
+            Copied[i].Cpu != 0 ||
+            !Intact( &Copied[i] ) ||
+            (i > 0 && Copied[i].Timestamp < Copied[i - 1].Timestamp)) {
+
+            printf( "       record %u: sequence %u, argument %llu\n",
+                    i,
+                    Copied[i].Sequence,
+                    (unsigned long long)Copied[i].Args[0] );
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+CheckKnown (
+    __in_opt const char *Path
+    )
+/*++
+
+Routine Description:
+
+    The single threaded checks.  The caller is pinned to processor 0, so
+    every record goes to ring 0.
+
+--*/
+{
+    CSG_TRACE_RECORD copied[2 * TRACE_KNOWN_RECORDS];
+    PCSG_TRACE trace;
+    FILE *file;
+    ULONG count;
+    ULONG i;
+    NTSTATUS status;
+
+    status = csgTraceCreate( 0, &trace );
+
+    Report( status == STATUS_INVALID_PARAMETER && trace == NULL,
+            "a trace of no records is refused" );
+
+    status = csgTraceCreate( 0x10001, &trace );
+
+    Report( status == STATUS_INVALID_PARAMETER && trace == NULL,
+            "a trace of more than 65536 records per processor is refused" );
+
+    status = csgTraceCreate( TRACE_KNOWN_ASKED, &trace );
+
+    if (!NT_SUCCESS( status )) {
+
+        Report( FALSE, "cannot create a trace: %08x", (unsigned)status );
+        return;
+    }
+
+    count = csgTraceSnapshot( trace, 0, copied, TRACE_COUNT( copied ) );
+
+    Report( count == 0 && csgTraceRingCount( trace ) == csgCpuCount(),
+            "a new trace has a ring per processor, all empty" );
+
+    for (i = 0; i < TRACE_KNOWN_ASKED; i++) {
+
+        WriteTagged( trace, i );
+    }
+
+    count = csgTraceSnapshot( trace, 0, copied, TRACE_COUNT( copied ) );
+
+    Report( count == TRACE_KNOWN_ASKED && CheckRecords( copied, count, 1 ),
+            "a snapshot returns the %u records written, in order: %u returned",
+            TRACE_KNOWN_ASKED,
+            count );
+
+    for (i = TRACE_KNOWN_ASKED; i < 3 * TRACE_KNOWN_RECORDS + 17; i++) {
+
+        WriteTagged( trace, i );
+    }
+
+    count = csgTraceSnapshot( trace, 0, copied, TRACE_COUNT( copied ) );
+
+    Report( count == TRACE_KNOWN_RECORDS &&
+            CheckRecords( copied, count, 3 * TRACE_KNOWN_RECORDS + 17 - TRACE_KNOWN_RECORDS + 1 ),
+            "once the ring wraps, the newest %u records are returned: %u returned",
+            TRACE_KNOWN_RECORDS,
+            count );
+
+    if (Path != NULL) {
+
+        file = fopen( Path, "wb" );
+
+        if (file == NULL ||
+            fwrite( copied, sizeof(CSG_TRACE_RECORD), count, file ) != count ||
+            fclose( file ) != 0) {
+
+            Report( FALSE, "cannot write %s", Path );
+        }
+    }
+
+    count = csgTraceSnapshot( trace, 0, copied, 10 );
+
+    Report( count == 10 && CheckRecords( copied, count, 3 * TRACE_KNOWN_RECORDS + 17 - 10 + 1 ),
+            "with room for 10, the newest 10 are returned: %u returned",
+            count );
+
+    count = csgTraceSnapshot( trace, csgTraceRingCount( trace ), copied, TRACE_COUNT( copied ) );
+
+    Report( count == 0, "a ring past the last returns nothing" );
+
+    csgTraceDestroy( trace );
+}
+
+
+static PVOID
+WriterThread (
+    __in PVOID Parameter
+    )
+{
+    PTRACE_WRITER writer = Parameter;
+    ULONG i;
+
+    for (i = 0; i < Records; i++) {
+
+        WriteTagged( Trace, ((ULONGLONG)writer->Index << 32) | i );
+    }
+
+    return NULL;
+}
+
+
+static PVOID
+ReaderThread (
+    __in PVOID Parameter
+    )
+/*++
+
+Routine Description:
+
+    Snapshots every ring over and over until told to stop, and checks
+    each snapshot.
+
+--*/
+{
+    PTRACE_READER reader = Parameter;
+    LONGLONG last[TRACE_MAX_THREADS];
+    ULONG ringCount = csgTraceRingCount( Trace );
+    ULONG count;
+    ULONG ring;
+    ULONG writer;
+    ULONG i;
+
+    while (!__atomic_load_n( &Stop, __ATOMIC_ACQUIRE )) {
+
+        for (ring = 0; ring < ringCount; ring++) {
+
+            count = csgTraceSnapshot( Trace, ring, reader->Records, RingRecords );
+
+            for (i = 0; i < TRACE_MAX_THREADS; i++) {
+
+                last[i] = -1;
+            }
+
+            for (i = 0; i < count; i++) {
+
+                if (!Intact( &reader->Records[i] )) {
+
+                    reader->Torn++;
+                    continue;
+                }
+
+                writer = (ULONG)(reader->Records[i].Args[0] >> 32);
+
+                if (writer >= TRACE_MAX_THREADS ||
+                    (LONGLONG)(ULONG)reader->Records[i].Args[0] <= last[writer] ||
+                    (i > 0 && reader->Records[i].Sequence <= reader->Records[i - 1].Sequence)) {
+
+                    reader->Disordered++;
+                }
+
+                if (writer < TRACE_MAX_THREADS) {
+
+                    last[writer] = (ULONG)reader->Records[i].Args[0];
+                }
+            }
+
+            reader->Checked += count;
+            reader->Snapshots++;
+        }
+    }
+
+    return NULL;
+}
+
+
+static VOID
+CheckConcurrent (
+    __in ULONG WriterCount,
+    __in ULONG ReaderCount
+    )
+{
+    PTRACE_WRITER writers;
+    PTRACE_READER readers;
+    PCSG_TRACE_RECORD copied;
+    ULONGLONG snapshots = 0;
+    ULONGLONG checked = 0;
+    ULONGLONG torn = 0;
+    ULONGLONG disordered = 0;
+    ULONGLONG written = 0;
+    ULONG broken = 0;
+    ULONG count;
+    ULONG ring;
+    ULONG i;
+    NTSTATUS status;
+
+    status = csgTraceCreate( RingRecords, &Trace );
+
+    if (!NT_SUCCESS( status )) {
+
+        Report( FALSE, "cannot create a trace of %u records per processor: %08x",
+                RingRecords,
+                (unsigned)status );
+        return;
+    }
+
+    writers = calloc( WriterCount, sizeof(TRACE_WRITER) );
+    readers = calloc( ReaderCount, sizeof(TRACE_READER) );
+    copied = calloc( RingRecords, sizeof(CSG_TRACE_RECORD) );
+
+    if (writers == NULL || readers == NULL || copied == NULL) {
+
+        fprintf( stderr, "csgtrace: out of memory\n" );
+        exit( 1 );
+    }
+
+    for (i = 0; i < ReaderCount; i++) {
+
+        readers[i].Records = calloc( RingRecords, sizeof(CSG_TRACE_RECORD) );
+
+        if (readers[i].Records == NULL ||
+            pthread_create( &readers[i].Thread, NULL, ReaderThread, &readers[i] ) != 0) {
+
+            fprintf( stderr, "csgtrace: cannot start reader %u\n", i );
+            exit( 1 );
+        }
+    }
+
+    for (i = 0; i < WriterCount; i++) {
+
+        writers[i].Index = i;
+
+        if (pthread_create( &writers[i].Thread, NULL, WriterThread, &writers[i] ) != 0) {
+
+            fprintf( stderr, "csgtrace: cannot start writer %u\n", i );
+            exit( 1 );
+        }
+    }
+
+    for (i = 0; i < WriterCount; i++) {
+
+        pthread_join( writers[i].Thread, NULL );
+    }
+
+    __atomic_store_n( &Stop, TRUE, __ATOMIC_RELEASE );
+
+    for (i = 0; i < ReaderCount; i++) {
+
+        pthread_join( readers[i].Thread, NULL );
+
+        snapshots += readers[i].Snapshots;
+        checked += readers[i].Checked;
+        torn += readers[i].Torn;
+        disordered += readers[i].Disordered;
+
+        free( readers[i].Records );
+    }
+
+    Report( torn == 0 && disordered == 0 && checked != 0,
+            "%u writers of %u records, %u readers: %llu snapshots, %llu records, %llu torn, %llu out of order",
+            WriterCount,
+            Records,
+            ReaderCount,
+            (unsigned long long)snapshots,
+            (unsigned long long)checked,
+            (unsigned long long)torn,
+            (unsigned long long)disordered );
+
+    //
+    //  With the writers done, a ring's newest sequence number is how many
+    //  records went into it, and every slot holds a finished record.
+    //
+
+    for (ring = 0; ring < csgTraceRingCount( Trace ); ring++) {
+
+        count = csgTraceSnapshot( Trace, ring, copied, RingRecords );
+
+        if (count == 0) {
+
+            continue;
+        }
+
+        written += copied[count - 1].Sequence;
+
+        if (count != TRACE_MIN( copied[count - 1].Sequence, RingRecords )) {
+
+            broken++;
+        }
+
+        for (i = 0; i < count; i++) {
+
+            if (!Intact( &copied[i] ) ||
+                copied[i].Sequence != copied[count - 1].Sequence - (count - 1 - i)) {
+
+                broken++;
+                break;
+            }
+        }
+    }
+
+    Report( broken == 0 && written == (ULONGLONG)WriterCount * Records,
+            "afterwards the rings are whole and hold the newest of %llu records",
+            (unsigned long long)written );
+
+    free( copied );
+    free( readers );
+    free( writers );
+
+    csgTraceDestroy( Trace );
+}
+
+
+static VOID
+Usage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: csgtrace [-t threads] [-i records] [-r records] [-s readers]\n"
+             "                [-w file]\n" );
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    cpu_set_t set;
+    cpu_set_t saved;
+    const char *path = NULL;
+    ULONG writerCount = 0;
+    ULONG readerCount = 2;
+    int option;
+
+    while ((option = getopt( argc, argv, "t:i:r:s:w:" )) != -1) {
+
+        switch (option) {
+
+            case 't':   writerCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'i':   Records = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'r':   RingRecords = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 's':   readerCount = (ULONG)strtoul( optarg, NULL, 0 ); break;
+            case 'w':   path = optarg; break;
+
+            default:
+
+                Usage();
+                return 2;
+        }
+    }
+
+    if (writerCount == 0) {
+
+        writerCount = TRACE_MIN( 2 * csgCpuCount(), TRACE_MAX_THREADS );
+    }
+
+    //
+    //  The sequence numbers the last check adds up are 32 bits wide.
+    //
+
+    if (optind != argc ||
+        writerCount > TRACE_MAX_THREADS ||
+        readerCount == 0 ||
+        RingRecords == 0 || RingRecords > 0x10000 ||
+        (ULONGLONG)writerCount * Records >= 0x80000000ULL) {
+
+        Usage();
+        return 2;
+    }
+
+    //
+    //  A ring holds a power of two records.
+    //
+
+    while ((RingRecords & (RingRecords - 1)) != 0) {
+
+        RingRecords += RingRecords & (0 - RingRecords);
+    }
+
+    sched_getaffinity( 0, sizeof(saved), &saved );
+
+    CPU_ZERO( &set );
+    CPU_SET( 0, &set );
+
+    if (sched_setaffinity( 0, sizeof(set), &set ) != 0) {
+
+        fprintf( stderr, "csgtrace: cannot run on processor 0\n" );
+        return 1;
+    }
+
+    CheckKnown( path );
+
+    sched_setaffinity( 0, sizeof(saved), &saved );
+
+    CheckConcurrent( writerCount, readerCount );
+
+    if (Failures != 0) {
+
+        printf( "FAILED: %u checks\n", Failures );
+        return 1;
+    }
+
+    printf( "passed\n" );
+
+    return 0;
+}
@@ -0,0 +1,11 @@
+/*++
+
+Module Name:
+
+    dontuse.h
+
+Abstract:
+
+    Empty stand-in for the WDK header of the same name.
+
+--*/
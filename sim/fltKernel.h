@@ -0,0 +1,2223 @@
+/*++
+
+Module Name:
+
+    fltKernel.h
+
+Abstract:
+
+    The simulation's stand-in for the WDK headers.  It declares the part of
+    the kernel and filter manager interfaces the driver uses, with the
+    same names, and the same layouts wherever the driver looks inside a
+    structure, so that the driver's sources compile unchanged into a user
+    mode program.  csgsimKernel.c and csgsimFlt.c implement it.
+
+    Only what the driver needs is here.  A driver change that uses
+    something new fails to link until the simulation learns it.
+
+    Requires GCC or Clang on a 64-bit Linux target, and -fshort-wchar so
+    that L"" strings are UTF-16 as they are in the kernel.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#ifndef __CSG_SIM_FLTKERNEL_H__
+#define __CSG_SIM_FLTKERNEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+//
+//  Pool tags are multi-character constants, and the sources carry
+//  pragmas for the Windows toolchain.
+//
+
+#pragma GCC diagnostic ignored "-Wmultichar"
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+
+/*************************************************************************
+    Base types
+*************************************************************************/
+
+#define VOID    void
+#define CONST   const
+
+typedef char            CHAR, *PCHAR, CCHAR;
+typedef const char      *PCSTR, *PCCH;
+typedef int16_t         SHORT, *PSHORT, CSHORT;
+typedef uint8_t         UCHAR, *PUCHAR;
+typedef const UCHAR     *PCUCHAR;
+typedef uint16_t        USHORT, *PUSHORT;
+typedef int32_t         LONG, *PLONG;
+typedef uint32_t        ULONG, *PULONG;
+typedef int64_t         LONGLONG, *PLONGLONG;
+typedef uint64_t        ULONGLONG, *PULONGLONG;
+typedef intptr_t        LONG_PTR, *PLONG_PTR;
+typedef uintptr_t       ULONG_PTR, *PULONG_PTR;
+typedef size_t          SIZE_T, *PSIZE_T;
+typedef uint8_t         BOOLEAN, *PBOOLEAN;
+typedef void            *PVOID, **PPVOID;
+typedef PVOID           HANDLE, *PHANDLE;
+typedef int32_t         NTSTATUS;
+typedef ULONG           ACCESS_MASK;
+typedef ULONG           DEVICE_TYPE;
+typedef UCHAR           KIRQL, *PKIRQL;
+typedef CCHAR           KPROCESSOR_MODE;
+
+typedef wchar_t         WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR     *PCWSTR;
+
+_Static_assert( sizeof(WCHAR) == 2, "build with -fshort-wchar" );
+
+#define TRUE    1
+#define FALSE   0
+
+#define MAXUSHORT   0xffff
+#define MAXULONG    0xffffffffUL
+#define MAXLONG     0x7fffffffL
+#define MAXLONGLONG 0x7fffffffffffffffLL
+
+typedef union _LARGE_INTEGER {
+
+    struct {
+
+        ULONG LowPart;
+
+        LONG HighPart;
+    };
+
+    LONGLONG QuadPart;
+
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+
+    struct {
+
+        ULONG LowPart;
+
+        ULONG HighPart;
+    };
+
+    ULONGLONG QuadPart;
+
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+
+    USHORT Length;
+
+    USHORT MaximumLength;
+
+    PWSTR Buffer;
+
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+#define UNICODE_NULL    ((WCHAR)0)
+
+typedef struct _LIST_ENTRY {
+
+    struct _LIST_ENTRY *Flink;
+
+    struct _LIST_ENTRY *Blink;
+
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _IO_STATUS_BLOCK {
+
+    NTSTATUS Status;
+
+    ULONG_PTR Information;
+
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+/*************************************************************************
+    Status codes
+*************************************************************************/
+
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_REPARSE                      ((NTSTATUS)0x00000104L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_FILES                ((NTSTATUS)0x80000006L)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_HANDLE               ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_END_OF_FILE                  ((NTSTATUS)0xC0000011L)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_NAME_COLLISION        ((NTSTATUS)0xC0000035L)
+#define STATUS_OBJECT_PATH_NOT_FOUND        ((NTSTATUS)0xC000003AL)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_FILE_IS_A_DIRECTORY          ((NTSTATUS)0xC00000BAL)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_FILE_CORRUPT_ERROR           ((NTSTATUS)0xC0000102L)
+#define STATUS_NOT_A_DIRECTORY              ((NTSTATUS)0xC0000103L)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_INVALID_BUFFER_SIZE          ((NTSTATUS)0xC0000206L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_ACCESS_VIOLATION             ((NTSTATUS)0xC0000005L)
+#define STATUS_INVALID_INFO_CLASS           ((NTSTATUS)0xC0000003L)
+#define STATUS_INFO_LENGTH_MISMATCH         ((NTSTATUS)0xC0000004L)
+#define STATUS_SHARING_VIOLATION            ((NTSTATUS)0xC0000043L)
+#define STATUS_DEVICE_BUSY                  ((NTSTATUS)0x80000011L)
+#define STATUS_FLT_CONTEXT_ALLOCATION_NOT_FOUND ((NTSTATUS)0xC01C0016L)
+#define STATUS_DATA_ERROR                   ((NTSTATUS)0xC000003EL)
+#define STATUS_FLT_CONTEXT_ALREADY_DEFINED  ((NTSTATUS)0xC01C0002L)
+#define STATUS_FLT_DO_NOT_ATTACH            ((NTSTATUS)0xC01C000FL)
+#define STATUS_FLT_CONTEXT_ALREADY_LINKED   ((NTSTATUS)0xC01C001BL)
+#define STATUS_FLT_DELETING_OBJECT          ((NTSTATUS)0xC01C000BL)
+
+#define NT_SUCCESS(_s)  (((NTSTATUS)(_s)) >= 0)
+
+/*************************************************************************
+    Compiler support
+*************************************************************************/
+
+//
+//  Structured exception handling.  Nothing faults in the simulation, so
+//  an except block never runs; leave jumps to the function's finally
+//  block, of which there may be one per function, as in the sources.
+//
+
+#define try                         if (1)
+#define leave                       goto __csg_sim_leave
+#define finally                     __csg_sim_leave: __attribute__((unused));
+#define except(_filter)             else if (_filter)
+
+#define EXCEPTION_EXECUTE_HANDLER   1
+#define EXCEPTION_CONTINUE_SEARCH   0
+
+#define GetExceptionCode()          STATUS_ACCESS_VIOLATION
+
+//
+//  Source annotations.
+//
+
+#define __in
+#define __in_opt
+#define __out
+#define __out_opt
+#define __inout
+#define __inout_opt
+#define __deref_out
+#define __deref_out_opt
+#define __in_bcount(_n)
+#define __in_bcount_opt(_n)
+#define __in_ecount(_n)
+#define __out_bcount(_n)
+#define __out_bcount_opt(_n)
+#define __out_bcount_part_opt(_n, _p)
+#define __out_ecount(_n)
+#define __inout_bcount(_n)
+#define __inout_ecount(_n)
+
+#define FORCEINLINE                 static inline __attribute__((always_inline))
+#define DECLSPEC_ALIGN(_n)          __attribute__((aligned(_n)))
+#define DECLSPEC_CACHEALIGN         DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE)
+
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 64
+
+#define UNREFERENCED_PARAMETER(_p)  ((void)(_p))
+
+#define FIELD_OFFSET(_type, _field) ((LONG)offsetof(_type, _field))
+#define CONTAINING_RECORD(_address, _type, _field)                          \
+            ((_type *)((PCHAR)(_address) - offsetof(_type, _field)))
+#define RTL_NUMBER_OF(_a)           (sizeof(_a) / sizeof((_a)[0]))
+#define ARRAYSIZE(_a)               RTL_NUMBER_OF(_a)
+
+#ifndef max
+#define max(_a, _b)                 (((_a) > (_b)) ? (_a) : (_b))
+#endif
+
+#ifndef min
+#define min(_a, _b)                 (((_a) < (_b)) ? (_a) : (_b))
+#endif
+
+#define FlagOn(_f, _b)              ((_f) & (_b))
+#define BooleanFlagOn(_f, _b)       ((BOOLEAN)(((_f) & (_b)) != 0))
+#define SetFlag(_f, _b)             ((_f) |= (_b))
+#define ClearFlag(_f, _b)           ((_f) &= ~(_b))
+
+#define PAGE_SIZE                   4096
+#define PAGE_SHIFT                  12
+
+#define ROUND_TO_SIZE(_length, _alignment)                                  \
+            ((((ULONG_PTR)(_length)) + ((_alignment) - 1)) & ~(ULONG_PTR)((_alignment) - 1))
+#define ROUND_TO_PAGES(_size)       ROUND_TO_SIZE( (_size), PAGE_SIZE )
+#define BYTES_TO_PAGES(_size)       (((_size) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+
+/*************************************************************************
+    Checks
+*************************************************************************/
+
+//
+//  A failed check stops the simulation the way a bugcheck stops the
+//  machine: with a message saying where.
+//
+
+__attribute__((noreturn))
+VOID
+SimBugCheck (
+    PCSTR File,
+    ULONG Line,
+    PCSTR Message
+    );
+
+#define ASSERT(_e)                                                          \
+            ((_e) ? (VOID)0 : SimBugCheck( __FILE__, __LINE__, #_e ))
+#define NT_ASSERT(_e)               ASSERT(_e)
+
+#define DBG                         1
+
+//
+//  Pageable code is checked to run below DISPATCH_LEVEL, which is what
+//  the pager would enforce.
+//
+
+VOID
+SimCheckPageable (
+    PCSTR File,
+    ULONG Line
+    );
+
+#define PAGED_CODE()                SimCheckPageable( __FILE__, __LINE__ )
+
+//
+//  DbgPrint is not checked as a printf format: it also takes %wZ, and the
+//  sources print HANDLEs with %d as the kernel allows.
+//
+
+ULONG
+DbgPrint (
+    PCSTR Format,
+    ...
+    );
+
+/*************************************************************************
+    Memory
+*************************************************************************/
+
+#define RtlCopyMemory(_d, _s, _l)       memcpy( (_d), (_s), (_l) )
+#define RtlMoveMemory(_d, _s, _l)       memmove( (_d), (_s), (_l) )
+#define RtlZeroMemory(_d, _l)           memset( (_d), 0, (_l) )
+#define RtlFillMemory(_d, _l, _f)       memset( (_d), (_f), (_l) )
+#define RtlEqualMemory(_a, _b, _l)      (memcmp( (_a), (_b), (_l) ) == 0)
+
+FORCEINLINE
+PVOID
+RtlSecureZeroMemory (
+    PVOID Buffer,
+    SIZE_T Length
+    )
+{
+    volatile UCHAR *p = (volatile UCHAR *)Buffer;
+
+    while (Length--) {
+
+        *p++ = 0;
+    }
+
+    return Buffer;
+}
+
+typedef enum _POOL_TYPE {
+
+    NonPagedPool = 0,
+    PagedPool = 1,
+    NonPagedPoolCacheAligned = 4,
+    NonPagedPoolNx = 512
+
+} POOL_TYPE;
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    );
+
+VOID
+ExFreePoolWithTag (
+    PVOID P,
+    ULONG Tag
+    );
+
+VOID
+ExFreePool (
+    PVOID P
+    );
+
+typedef PVOID (*PALLOCATE_FUNCTION)( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+typedef VOID (*PFREE_FUNCTION)( PVOID Buffer );
+
+//
+//  A lookaside list is a locked free list in front of its allocate and
+//  free routines.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _NPAGED_LOOKASIDE_LIST {
+
+    pthread_mutex_t Lock;
+
+    PVOID *Entries;
+
+    ULONG Depth;
+
+    ULONG Count;
+
+    SIZE_T Size;
+
+    ULONG Tag;
+
+    PALLOCATE_FUNCTION Allocate;
+
+    PFREE_FUNCTION Free;
+
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST;
+
+VOID
+ExInitializeNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PALLOCATE_FUNCTION Allocate,
+    PFREE_FUNCTION Free,
+    ULONG Flags,
+    SIZE_T Size,
+    ULONG Tag,
+    USHORT Depth
+    );
+
+VOID
+ExDeleteNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    );
+
+PVOID
+ExAllocateFromNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    );
+
+VOID
+ExFreeToNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PVOID Entry
+    );
+
+//
+//  MDLs.  Every address is a system address, so an MDL only records the
+//  range it describes.
+//
+
+typedef struct _MDL {
+
+    struct _MDL *Next;
+
+    CSHORT Size;
+
+    CSHORT MdlFlags;
+
+    struct _EPROCESS *Process;
+
+    PVOID MappedSystemVa;
+
+    PVOID StartVa;
+
+    ULONG ByteCount;
+
+    ULONG ByteOffset;
+
+} MDL, *PMDL;
+
+#define MDL_MAPPED_TO_SYSTEM_VA     0x0001
+#define MDL_PAGES_LOCKED            0x0002
+#define MDL_SOURCE_IS_NONPAGED_POOL 0x0004
+#define MDL_PARTIAL                 0x0010
+#define MDL_PARTIAL_HAS_BEEN_MAPPED 0x0020
+
+#define MmGetMdlVirtualAddress(_mdl)                                        \
+            ((PVOID)((PCHAR)(_mdl)->StartVa + (_mdl)->ByteOffset))
+#define MmGetMdlByteCount(_mdl)     ((_mdl)->ByteCount)
+#define MmGetMdlByteOffset(_mdl)    ((_mdl)->ByteOffset)
+
+typedef enum _MM_PAGE_PRIORITY {
+
+    LowPagePriority = 0,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+
+} MM_PAGE_PRIORITY;
+
+typedef enum _LOCK_OPERATION {
+
+    IoReadAccess,
+    IoWriteAccess,
+    IoModifyAccess
+
+} LOCK_OPERATION;
+
+PMDL
+IoAllocateMdl (
+    PVOID VirtualAddress,
+    ULONG Length,
+    BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota,
+    PVOID Irp
+    );
+
+VOID
+IoFreeMdl (
+    PMDL Mdl
+    );
+
+VOID
+IoBuildPartialMdl (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    );
+
+VOID
+MmPrepareMdlForReuse (
+    PMDL Mdl
+    );
+
+VOID
+MmBuildMdlForNonPagedPool (
+    PMDL Mdl
+    );
+
+VOID
+MmProbeAndLockPages (
+    PMDL Mdl,
+    KPROCESSOR_MODE AccessMode,
+    LOCK_OPERATION Operation
+    );
+
+VOID
+MmUnlockPages (
+    PMDL Mdl
+    );
+
+PVOID
+MmGetSystemAddressForMdlSafe (
+    PMDL Mdl,
+    ULONG Priority
+    );
+
+/*************************************************************************
+    Processors, IRQL, synchronization
+*************************************************************************/
+
+#define PASSIVE_LEVEL   0
+#define APC_LEVEL       1
+#define DISPATCH_LEVEL  2
+
+#define ALL_PROCESSOR_GROUPS    0xffff
+
+typedef struct _PROCESSOR_NUMBER {
+
+    USHORT Group;
+
+    UCHAR Number;
+
+    UCHAR Reserved;
+
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+//
+//  Each simulated thread has its own IRQL.  Raising it does not stop
+//  preemption, so nothing here depends on it; it is tracked so that
+//  PAGED_CODE and the filter manager can check it.
+//
+
+KIRQL
+KeGetCurrentIrql (
+    VOID
+    );
+
+VOID
+KeRaiseIrql (
+    KIRQL NewIrql,
+    PKIRQL OldIrql
+    );
+
+VOID
+KeLowerIrql (
+    KIRQL NewIrql
+    );
+
+ULONG
+KeQueryActiveProcessorCountEx (
+    USHORT GroupNumber
+    );
+
+ULONG
+KeGetCurrentProcessorNumberEx (
+    PPROCESSOR_NUMBER ProcNumber
+    );
+
+//
+//  The simulation is one NUMA node holding every processor.
+//
+
+typedef ULONG_PTR KAFFINITY;
+
+typedef struct _GROUP_AFFINITY {
+
+    KAFFINITY Mask;
+
+    USHORT Group;
+
+    USHORT Reserved[3];
+
+} GROUP_AFFINITY, *PGROUP_AFFINITY;
+
+USHORT
+KeQueryHighestNodeNumber (
+    VOID
+    );
+
+USHORT
+KeGetCurrentNodeNumber (
+    VOID
+    );
+
+VOID
+KeQueryNodeActiveAffinity (
+    USHORT NodeNumber,
+    PGROUP_AFFINITY Affinity,
+    PUSHORT Count
+    );
+
+VOID
+KeSetSystemGroupAffinityThread (
+    PGROUP_AFFINITY Affinity,
+    PGROUP_AFFINITY PreviousAffinity
+    );
+
+#define KeMemoryBarrier()               __atomic_thread_fence( __ATOMIC_SEQ_CST )
+#define KeMemoryBarrierWithoutFence()   __asm__ __volatile__( "" ::: "memory" )
+#define YieldProcessor()                __builtin_ia32_pause()
+
+typedef volatile LONG KSPIN_LOCK, *PKSPIN_LOCK;
+
+VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK SpinLock
+    );
+
+VOID
+KeAcquireSpinLock (
+    PKSPIN_LOCK SpinLock,
+    PKIRQL OldIrql
+    );
+
+VOID
+KeReleaseSpinLock (
+    PKSPIN_LOCK SpinLock,
+    KIRQL NewIrql
+    );
+
+typedef enum _EVENT_TYPE {
+
+    NotificationEvent,
+    SynchronizationEvent
+
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON {
+
+    Executive
+
+} KWAIT_REASON;
+
+enum {
+
+    KernelMode,
+    UserMode
+};
+
+#define IO_NO_INCREMENT 0
+
+typedef struct _KEVENT {
+
+    EVENT_TYPE Type;
+
+    LONG State;
+
+    pthread_mutex_t Lock;
+
+    pthread_cond_t Signaled;
+
+} KEVENT, *PKEVENT;
+
+VOID
+KeInitializeEvent (
+    PKEVENT Event,
+    EVENT_TYPE Type,
+    BOOLEAN State
+    );
+
+LONG
+KeSetEvent (
+    PKEVENT Event,
+    LONG Increment,
+    BOOLEAN Wait
+    );
+
+VOID
+KeClearEvent (
+    PKEVENT Event
+    );
+
+LONG
+KeReadStateEvent (
+    PKEVENT Event
+    );
+
+//
+//  Only the memory condition events are known by name (see
+//  SimSetLowMemory).
+//
+
+PKEVENT
+IoCreateNotificationEvent (
+    PUNICODE_STRING EventName,
+    PHANDLE EventHandle
+    );
+
+//
+//  A semaphore is an event whose state is its count.
+//
+
+typedef struct _KSEMAPHORE {
+
+    KEVENT Header;
+
+    LONG Limit;
+
+} KSEMAPHORE, *PKSEMAPHORE;
+
+VOID
+KeInitializeSemaphore (
+    PKSEMAPHORE Semaphore,
+    LONG Count,
+    LONG Limit
+    );
+
+LONG
+KeReleaseSemaphore (
+    PKSEMAPHORE Semaphore,
+    LONG Increment,
+    LONG Adjustment,
+    BOOLEAN Wait
+    );
+
+//
+//  Events, semaphores and threads can be waited on.
+//
+
+NTSTATUS
+KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    );
+
+NTSTATUS
+KeDelayExecutionThread (
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Interval
+    );
+
+VOID
+KeStallExecutionProcessor (
+    ULONG MicroSeconds
+    );
+
+LARGE_INTEGER
+KeQueryPerformanceCounter (
+    PLARGE_INTEGER PerformanceFrequency
+    );
+
+typedef struct _FAST_MUTEX {
+
+    pthread_mutex_t Lock;
+
+    KIRQL OldIrql;
+
+} FAST_MUTEX, *PFAST_MUTEX;
+
+VOID
+ExInitializeFastMutex (
+    PFAST_MUTEX FastMutex
+    );
+
+VOID
+ExAcquireFastMutex (
+    PFAST_MUTEX FastMutex
+    );
+
+VOID
+ExReleaseFastMutex (
+    PFAST_MUTEX FastMutex
+    );
+
+//
+//  A push lock is a reader/writer lock; acquiring one also disables
+//  normal kernel APCs, which the simulation has none of.
+//
+
+typedef struct _EX_PUSH_LOCK {
+
+    pthread_rwlock_t Lock;
+
+} EX_PUSH_LOCK, *PEX_PUSH_LOCK;
+
+//
+//  Extended processor state needs no saving in user mode.
+//
+
+typedef struct _XSTATE_SAVE {
+
+    ULONG Unused;
+
+} XSTATE_SAVE, *PXSTATE_SAVE;
+
+#define KeSaveExtendedProcessorState(_mask, _save)  ((VOID)(_save), STATUS_SUCCESS)
+#define KeRestoreExtendedProcessorState(_save)      ((VOID)(_save))
+
+//
+//  Interlocked operations, all full barriers as in the kernel.
+//
+
+#define InterlockedIncrement(_p)                __atomic_add_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define InterlockedDecrement(_p)                __atomic_sub_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define InterlockedExchange(_p, _v)             __atomic_exchange_n( (_p), (_v), __ATOMIC_SEQ_CST )
+#define InterlockedExchangeAdd(_p, _v)          __atomic_fetch_add( (_p), (_v), __ATOMIC_SEQ_CST )
+#define InterlockedIncrement64(_p)              __atomic_add_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define InterlockedDecrement64(_p)              __atomic_sub_fetch( (_p), 1, __ATOMIC_SEQ_CST )
+#define InterlockedExchangeAdd64(_p, _v)        __atomic_fetch_add( (_p), (_v), __ATOMIC_SEQ_CST )
+#define InterlockedExchange64(_p, _v)           __atomic_exchange_n( (_p), (_v), __ATOMIC_SEQ_CST )
+#define InterlockedExchangePointer(_p, _v)      __atomic_exchange_n( (_p), (_v), __ATOMIC_SEQ_CST )
+
+FORCEINLINE
+LONG
+InterlockedCompareExchange (
+    LONG volatile *Destination,
+    LONG Exchange,
+    LONG Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, FALSE,
+                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+FORCEINLINE
+LONGLONG
+InterlockedCompareExchange64 (
+    LONGLONG volatile *Destination,
+    LONGLONG Exchange,
+    LONGLONG Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, FALSE,
+                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+FORCEINLINE
+PVOID
+InterlockedCompareExchangePointer (
+    PVOID volatile *Destination,
+    PVOID Exchange,
+    PVOID Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, FALSE,
+                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+/*************************************************************************
+    Objects, processes, strings
+*************************************************************************/
+
+typedef struct _DRIVER_OBJECT {
+
+    CSHORT Type;
+
+    CSHORT Size;
+
+    PVOID DriverStart;
+
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _DEVICE_OBJECT {
+
+    CSHORT Type;
+
+    USHORT Size;
+
+    LONG ReferenceCount;
+
+    PVOID Volume;
+
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _EPROCESS *PEPROCESS;
+typedef struct _ETHREAD *PETHREAD;
+
+#define FO_NO_INTERMEDIATE_BUFFERING    0x00000008
+#define FO_SYNCHRONOUS_IO               0x00000002
+#define FO_VOLUME_OPEN                  0x00400000
+
+typedef struct _FILE_OBJECT {
+
+    CSHORT Type;
+
+    CSHORT Size;
+
+    PDEVICE_OBJECT DeviceObject;
+
+    PVOID FsContext;
+
+    PVOID FsContext2;
+
+    BOOLEAN ReadAccess;
+
+    BOOLEAN WriteAccess;
+
+    BOOLEAN DeleteAccess;
+
+    ULONG Flags;
+
+    UNICODE_STRING FileName;
+
+    LARGE_INTEGER CurrentByteOffset;
+
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _OBJECT_ATTRIBUTES {
+
+    ULONG Length;
+
+    HANDLE RootDirectory;
+
+    PUNICODE_STRING ObjectName;
+
+    ULONG Attributes;
+
+    PVOID SecurityDescriptor;
+
+    PVOID SecurityQualityOfService;
+
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+#define OBJ_CASE_INSENSITIVE    0x00000040L
+#define OBJ_KERNEL_HANDLE       0x00000200L
+
+#define InitializeObjectAttributes(_p, _n, _a, _r, _s) {                    \
+            (_p)->Length = sizeof( OBJECT_ATTRIBUTES );                     \
+            (_p)->RootDirectory = (_r);                                     \
+            (_p)->Attributes = (_a);                                        \
+            (_p)->ObjectName = (_n);                                        \
+            (_p)->SecurityDescriptor = (_s);                                \
+            (_p)->SecurityQualityOfService = NULL;                          \
+        }
+
+typedef struct _OBJECT_TYPE *POBJECT_TYPE;
+
+NTSTATUS
+ObReferenceObjectByHandle (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    PVOID *Object,
+    PVOID HandleInformation
+    );
+
+VOID
+ObDereferenceObject (
+    PVOID Object
+    );
+
+NTSTATUS
+ZwClose (
+    HANDLE Handle
+    );
+
+HANDLE
+PsGetCurrentProcessId (
+    VOID
+    );
+
+HANDLE
+PsGetCurrentThreadId (
+    VOID
+    );
+
+//
+//  System threads.  A thread is an object, waited on for its exit.
+//
+
+#define THREAD_ALL_ACCESS   0x001FFFFF
+
+typedef VOID KSTART_ROUTINE( PVOID StartContext );
+typedef KSTART_ROUTINE *PKSTART_ROUTINE;
+
+extern POBJECT_TYPE *PsThreadType;
+
+NTSTATUS
+PsCreateSystemThread (
+    PHANDLE ThreadHandle,
+    ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle,
+    PVOID ClientId,
+    PKSTART_ROUTINE StartRoutine,
+    PVOID StartContext
+    );
+
+NTSTATUS
+PsTerminateSystemThread (
+    NTSTATUS ExitStatus
+    );
+
+KPROCESSOR_MODE
+ExGetPreviousMode (
+    VOID
+    );
+
+VOID
+ProbeForRead (
+    PVOID Address,
+    SIZE_T Length,
+    ULONG Alignment
+    );
+
+VOID
+ProbeForWrite (
+    PVOID Address,
+    SIZE_T Length,
+    ULONG Alignment
+    );
+
+VOID
+RtlInitUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCWSTR SourceString
+    );
+
+VOID
+RtlCopyUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCUNICODE_STRING SourceString
+    );
+
+NTSTATUS
+RtlAppendUnicodeToString (
+    PUNICODE_STRING Destination,
+    PCWSTR Source
+    );
+
+BOOLEAN
+RtlEqualUnicodeString (
+    PCUNICODE_STRING String1,
+    PCUNICODE_STRING String2,
+    BOOLEAN CaseInSensitive
+    );
+
+NTSTATUS
+RtlVolumeDeviceToDosName (
+    PVOID VolumeDeviceObject,
+    PUNICODE_STRING DosName
+    );
+
+/*************************************************************************
+    Registry and sections
+*************************************************************************/
+
+#define KEY_READ        0x20019
+
+#define REG_NONE        0
+#define REG_SZ          1
+#define REG_BINARY      3
+#define REG_DWORD       4
+#define REG_MULTI_SZ    7
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS {
+
+    KeyValueBasicInformation,
+    KeyValueFullInformation,
+    KeyValuePartialInformation
+
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION {
+
+    ULONG TitleIndex;
+
+    ULONG Type;
+
+    ULONG DataLength;
+
+    UCHAR Data[1];
+
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+//
+//  There is one key, the driver's service key, whatever its path; its
+//  values are the ones the harness set with SimSetParameter.
+//
+
+NTSTATUS
+ZwOpenKey (
+    PHANDLE KeyHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes
+    );
+
+NTSTATUS
+ZwQueryValueKey (
+    HANDLE KeyHandle,
+    PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    PVOID KeyValueInformation,
+    ULONG Length,
+    PULONG ResultLength
+    );
+
+#define SECTION_MAP_WRITE   0x0002
+#define SECTION_MAP_READ    0x0004
+#define SECTION_ALL_ACCESS  0x000F001F
+
+#define PAGE_READONLY       0x02
+#define PAGE_READWRITE      0x04
+
+#define SEC_COMMIT          0x08000000
+
+#define MEM_TOP_DOWN        0x00100000
+
+typedef enum _SECTION_INHERIT {
+
+    ViewShare = 1,
+    ViewUnmap = 2
+
+} SECTION_INHERIT;
+
+#define NtCurrentProcess()  ((HANDLE)(LONG_PTR)-1)
+#define ZwCurrentProcess()  NtCurrentProcess()
+
+NTSTATUS
+ZwCreateSection (
+    PHANDLE SectionHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PLARGE_INTEGER MaximumSize,
+    ULONG SectionPageProtection,
+    ULONG AllocationAttributes,
+    HANDLE FileHandle
+    );
+
+NTSTATUS
+ZwMapViewOfSection (
+    HANDLE SectionHandle,
+    HANDLE ProcessHandle,
+    PVOID *BaseAddress,
+    ULONG_PTR ZeroBits,
+    SIZE_T CommitSize,
+    PLARGE_INTEGER SectionOffset,
+    PSIZE_T ViewSize,
+    SECTION_INHERIT InheritDisposition,
+    ULONG AllocationType,
+    ULONG Win32Protect
+    );
+
+NTSTATUS
+ZwUnmapViewOfSection (
+    HANDLE ProcessHandle,
+    PVOID BaseAddress
+    );
+
+NTSTATUS
+MmMapViewInSystemSpace (
+    PVOID Section,
+    PVOID *MappedBase,
+    PSIZE_T ViewSize
+    );
+
+NTSTATUS
+MmUnmapViewInSystemSpace (
+    PVOID MappedBase
+    );
+
+/*************************************************************************
+    I/O
+*************************************************************************/
+
+#define IRP_MJ_CREATE                   0x00
+#define IRP_MJ_CLOSE                    0x02
+#define IRP_MJ_READ                     0x03
+#define IRP_MJ_WRITE                    0x04
+#define IRP_MJ_QUERY_INFORMATION        0x05
+#define IRP_MJ_SET_INFORMATION          0x06
+#define IRP_MJ_FLUSH_BUFFERS            0x09
+#define IRP_MJ_DIRECTORY_CONTROL        0x0c
+#define IRP_MJ_CLEANUP                  0x12
+#define IRP_MJ_MAXIMUM_FUNCTION         0x1b
+#define IRP_MJ_OPERATION_END            ((UCHAR)0x80)
+
+#define IRP_MJ_NETWORK_QUERY_OPEN       ((UCHAR)-14)
+
+#define IRP_MN_QUERY_DIRECTORY          0x01
+#define IRP_MN_NOTIFY_CHANGE_DIRECTORY  0x02
+
+#define IRP_NOCACHE                     0x00000001
+#define IRP_PAGING_IO                   0x00000002
+#define IRP_SYNCHRONOUS_API             0x00000004
+#define IRP_SYNCHRONOUS_PAGING_IO       0x00000040
+
+#define SL_OPEN_PAGING_FILE             0x02
+#define SL_RESTART_SCAN                 0x01
+#define SL_RETURN_SINGLE_ENTRY          0x02
+#define SL_INDEX_SPECIFIED              0x04
+
+#define FILE_DIRECTORY_FILE             0x00000001
+#define FILE_SYNCHRONOUS_IO_NONALERT    0x00000020
+#define FILE_NON_DIRECTORY_FILE         0x00000040
+
+#define FILE_ATTRIBUTE_READONLY         0x00000001
+#define FILE_ATTRIBUTE_HIDDEN           0x00000002
+#define FILE_ATTRIBUTE_DIRECTORY        0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE          0x00000020
+#define FILE_ATTRIBUTE_NORMAL           0x00000080
+
+#define FILE_SUPERSEDED                 0x00000000
+#define FILE_OPENED                     0x00000001
+#define FILE_CREATED                    0x00000002
+#define FILE_OVERWRITTEN                0x00000003
+
+#define FILE_USE_FILE_POINTER_POSITION  0xfffffffe
+#define FILE_WRITE_TO_END_OF_FILE       0xffffffff
+
+typedef enum _FILE_INFORMATION_CLASS {
+
+    FileDirectoryInformation = 1,
+    FileFullDirectoryInformation = 2,
+    FileBothDirectoryInformation = 3,
+    FileBasicInformation = 4,
+    FileStandardInformation = 5,
+    FileInternalInformation = 6,
+    FileNamesInformation = 12,
+    FilePositionInformation = 14,
+    FileAllInformation = 18,
+    FileAllocationInformation = 19,
+    FileEndOfFileInformation = 20,
+    FileNetworkOpenInformation = 34,
+    FileIdBothDirectoryInformation = 37,
+    FileIdFullDirectoryInformation = 38,
+    FileValidDataLengthInformation = 39,
+    FileIdGlobalTxDirectoryInformation = 50,
+    FileIdExtdDirectoryInformation = 60,
+    FileIdExtdBothDirectoryInformation = 63
+
+} FILE_INFORMATION_CLASS, *PFILE_INFORMATION_CLASS;
+
+typedef struct _FILE_DIRECTORY_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+
+} FILE_DIRECTORY_INFORMATION, *PFILE_DIRECTORY_INFORMATION;
+
+typedef struct _FILE_FULL_DIR_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    WCHAR FileName[1];
+
+} FILE_FULL_DIR_INFORMATION, *PFILE_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_ID_FULL_DIR_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    LARGE_INTEGER FileId;
+    WCHAR FileName[1];
+
+} FILE_ID_FULL_DIR_INFORMATION, *PFILE_ID_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_BOTH_DIR_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    WCHAR FileName[1];
+
+} FILE_BOTH_DIR_INFORMATION, *PFILE_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_BOTH_DIR_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    LARGE_INTEGER FileId;
+    WCHAR FileName[1];
+
+} FILE_ID_BOTH_DIR_INFORMATION, *PFILE_ID_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_NAMES_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+
+} FILE_NAMES_INFORMATION, *PFILE_NAMES_INFORMATION;
+
+typedef struct _FILE_BASIC_INFORMATION {
+
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    ULONG FileAttributes;
+
+} FILE_BASIC_INFORMATION, *PFILE_BASIC_INFORMATION;
+
+typedef struct _FILE_STANDARD_INFORMATION {
+
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG NumberOfLinks;
+    BOOLEAN DeletePending;
+    BOOLEAN Directory;
+
+} FILE_STANDARD_INFORMATION, *PFILE_STANDARD_INFORMATION;
+
+typedef struct _FILE_INTERNAL_INFORMATION {
+
+    LARGE_INTEGER IndexNumber;
+
+} FILE_INTERNAL_INFORMATION, *PFILE_INTERNAL_INFORMATION;
+
+typedef struct _FILE_END_OF_FILE_INFORMATION {
+
+    LARGE_INTEGER EndOfFile;
+
+} FILE_END_OF_FILE_INFORMATION, *PFILE_END_OF_FILE_INFORMATION;
+
+typedef struct _FILE_ALLOCATION_INFORMATION {
+
+    LARGE_INTEGER AllocationSize;
+
+} FILE_ALLOCATION_INFORMATION, *PFILE_ALLOCATION_INFORMATION;
+
+typedef struct _FILE_VALID_DATA_LENGTH_INFORMATION {
+
+    LARGE_INTEGER ValidDataLength;
+
+} FILE_VALID_DATA_LENGTH_INFORMATION, *PFILE_VALID_DATA_LENGTH_INFORMATION;
+
+typedef struct _FILE_NETWORK_OPEN_INFORMATION {
+
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG FileAttributes;
+
+} FILE_NETWORK_OPEN_INFORMATION, *PFILE_NETWORK_OPEN_INFORMATION;
+
+//
+//  FileAllInformation returns these one after the other.  Only the layout
+//  up to StandardInformation matters to the driver.
+//
+
+typedef struct _FILE_EA_INFORMATION {
+
+    ULONG EaSize;
+
+} FILE_EA_INFORMATION, *PFILE_EA_INFORMATION;
+
+typedef struct _FILE_ACCESS_INFORMATION {
+
+    ACCESS_MASK AccessFlags;
+
+} FILE_ACCESS_INFORMATION, *PFILE_ACCESS_INFORMATION;
+
+typedef struct _FILE_POSITION_INFORMATION {
+
+    LARGE_INTEGER CurrentByteOffset;
+
+} FILE_POSITION_INFORMATION, *PFILE_POSITION_INFORMATION;
+
+typedef struct _FILE_MODE_INFORMATION {
+
+    ULONG Mode;
+
+} FILE_MODE_INFORMATION, *PFILE_MODE_INFORMATION;
+
+typedef struct _FILE_ALIGNMENT_INFORMATION {
+
+    ULONG AlignmentRequirement;
+
+} FILE_ALIGNMENT_INFORMATION, *PFILE_ALIGNMENT_INFORMATION;
+
+typedef struct _FILE_NAME_INFORMATION {
+
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+
+} FILE_NAME_INFORMATION, *PFILE_NAME_INFORMATION;
+
+typedef struct _FILE_ALL_INFORMATION {
+
+    FILE_BASIC_INFORMATION BasicInformation;
+    FILE_STANDARD_INFORMATION StandardInformation;
+    FILE_INTERNAL_INFORMATION InternalInformation;
+    FILE_EA_INFORMATION EaInformation;
+    FILE_ACCESS_INFORMATION AccessInformation;
+    FILE_POSITION_INFORMATION PositionInformation;
+    FILE_MODE_INFORMATION ModeInformation;
+    FILE_ALIGNMENT_INFORMATION AlignmentInformation;
+    FILE_NAME_INFORMATION NameInformation;
+
+} FILE_ALL_INFORMATION, *PFILE_ALL_INFORMATION;
+
+/*************************************************************************
+    Filter manager
+*************************************************************************/
+
+typedef struct _FLT_FILTER *PFLT_FILTER;
+typedef struct _FLT_VOLUME *PFLT_VOLUME;
+typedef struct _FLT_INSTANCE *PFLT_INSTANCE;
+typedef struct _FLT_PORT *PFLT_PORT;
+typedef PVOID PFLT_CONTEXT;
+typedef PVOID PSECURITY_DESCRIPTOR;
+
+typedef USHORT FLT_CONTEXT_TYPE;
+
+#define FLT_VOLUME_CONTEXT          0x0001
+#define FLT_INSTANCE_CONTEXT        0x0002
+#define FLT_FILE_CONTEXT            0x0004
+#define FLT_STREAM_CONTEXT          0x0008
+#define FLT_STREAMHANDLE_CONTEXT    0x0010
+#define FLT_TRANSACTION_CONTEXT     0x0020
+#define FLT_CONTEXT_END             0xffff
+
+typedef ULONG FLT_SET_CONTEXT_OPERATION;
+
+#define FLT_SET_CONTEXT_REPLACE_IF_EXISTS   0
+#define FLT_SET_CONTEXT_KEEP_IF_EXISTS      1
+
+typedef enum _FLT_FILESYSTEM_TYPE {
+
+    FLT_FSTYPE_UNKNOWN,
+    FLT_FSTYPE_RAW,
+    FLT_FSTYPE_NTFS,
+    FLT_FSTYPE_FAT,
+    FLT_FSTYPE_CDFS,
+    FLT_FSTYPE_UDFS,
+    FLT_FSTYPE_LANMAN,
+    FLT_FSTYPE_WEBDAV,
+    FLT_FSTYPE_RDPDR,
+    FLT_FSTYPE_NFS,
+    FLT_FSTYPE_MS_NETWARE,
+    FLT_FSTYPE_NETWARE,
+    FLT_FSTYPE_BSUDF,
+    FLT_FSTYPE_MUP,
+    FLT_FSTYPE_RSFX,
+    FLT_FSTYPE_ROXIO_UDF1,
+    FLT_FSTYPE_ROXIO_UDF2,
+    FLT_FSTYPE_ROXIO_UDF3,
+    FLT_FSTYPE_TACIT,
+    FLT_FSTYPE_FS_REC,
+    FLT_FSTYPE_INCD,
+    FLT_FSTYPE_INCD_FAT,
+    FLT_FSTYPE_EXFAT,
+    FLT_FSTYPE_PSFS,
+    FLT_FSTYPE_GPFS,
+    FLT_FSTYPE_NPFS,
+    FLT_FSTYPE_MSFS,
+    FLT_FSTYPE_CSVFS,
+    FLT_FSTYPE_REFS
+
+} FLT_FILESYSTEM_TYPE, *PFLT_FILESYSTEM_TYPE;
+
+typedef enum _FLT_PREOP_CALLBACK_STATUS {
+
+    FLT_PREOP_SUCCESS_WITH_CALLBACK,
+    FLT_PREOP_SUCCESS_NO_CALLBACK,
+    FLT_PREOP_PENDING,
+    FLT_PREOP_DISALLOW_FASTIO,
+    FLT_PREOP_COMPLETE,
+    FLT_PREOP_SYNCHRONIZE
+
+} FLT_PREOP_CALLBACK_STATUS, *PFLT_PREOP_CALLBACK_STATUS;
+
+typedef enum _FLT_POSTOP_CALLBACK_STATUS {
+
+    FLT_POSTOP_FINISHED_PROCESSING,
+    FLT_POSTOP_MORE_PROCESSING_REQUIRED
+
+} FLT_POSTOP_CALLBACK_STATUS, *PFLT_POSTOP_CALLBACK_STATUS;
+
+typedef union _FLT_PARAMETERS {
+
+    struct {
+
+        PVOID SecurityContext;
+        ULONG Options;
+        USHORT FileAttributes;
+        USHORT ShareAccess;
+        ULONG EaLength;
+        PVOID EaBuffer;
+        LARGE_INTEGER AllocationSize;
+
+    } Create;
+
+    struct {
+
+        ULONG Length;
+        ULONG Key;
+        LARGE_INTEGER ByteOffset;
+        PVOID ReadBuffer;
+        PMDL MdlAddress;
+
+    } Read;
+
+    struct {
+
+        ULONG Length;
+        ULONG Key;
+        LARGE_INTEGER ByteOffset;
+        PVOID WriteBuffer;
+        PMDL MdlAddress;
+
+    } Write;
+
+    struct {
+
+        ULONG Length;
+        FILE_INFORMATION_CLASS FileInformationClass;
+        PVOID InfoBuffer;
+
+    } QueryFileInformation;
+
+    struct {
+
+        ULONG Length;
+        FILE_INFORMATION_CLASS FileInformationClass;
+        PFILE_OBJECT ParentOfTarget;
+
+        union {
+
+            struct {
+
+                BOOLEAN ReplaceIfExists;
+                BOOLEAN AdvanceOnly;
+            };
+
+            ULONG ClusterCount;
+            HANDLE DeleteHandle;
+        };
+
+        PVOID InfoBuffer;
+
+    } SetFileInformation;
+
+    union {
+
+        struct {
+
+            ULONG Length;
+            PUNICODE_STRING FileName;
+            FILE_INFORMATION_CLASS FileInformationClass;
+            ULONG FileIndex;
+            PVOID DirectoryBuffer;
+            PMDL MdlAddress;
+
+        } QueryDirectory;
+
+        struct {
+
+            ULONG Length;
+            ULONG CompletionFilter;
+            ULONG Spare1;
+            ULONG Spare2;
+            PVOID DirectoryBuffer;
+            PMDL MdlAddress;
+
+        } NotifyDirectory;
+
+    } DirectoryControl;
+
+} FLT_PARAMETERS, *PFLT_PARAMETERS;
+
+typedef struct _FLT_IO_PARAMETER_BLOCK {
+
+    ULONG IrpFlags;
+
+    UCHAR MajorFunction;
+
+    UCHAR MinorFunction;
+
+    UCHAR OperationFlags;
+
+    UCHAR Reserved;
+
+    PFILE_OBJECT TargetFileObject;
+
+    PFLT_INSTANCE TargetInstance;
+
+    FLT_PARAMETERS Parameters;
+
+} FLT_IO_PARAMETER_BLOCK, *PFLT_IO_PARAMETER_BLOCK;
+
+typedef ULONG FLT_CALLBACK_DATA_FLAGS;
+
+#define FLTFL_CALLBACK_DATA_REISSUE_MASK        0x0000FFFF
+#define FLTFL_CALLBACK_DATA_IRP_OPERATION       0x00000001
+#define FLTFL_CALLBACK_DATA_FAST_IO_OPERATION   0x00000002
+#define FLTFL_CALLBACK_DATA_FS_FILTER_OPERATION 0x00000004
+#define FLTFL_CALLBACK_DATA_SYSTEM_BUFFER       0x00000008
+#define FLTFL_CALLBACK_DATA_GENERATED_IO        0x00010000
+#define FLTFL_CALLBACK_DATA_DIRTY               0x80000000
+
+typedef struct _FLT_CALLBACK_DATA {
+
+    FLT_CALLBACK_DATA_FLAGS Flags;
+
+    PETHREAD Thread;
+
+    PFLT_IO_PARAMETER_BLOCK Iopb;
+
+    IO_STATUS_BLOCK IoStatus;
+
+    PVOID TagData;
+
+    LIST_ENTRY QueueLinks;
+
+    PVOID QueueContext[2];
+
+    KPROCESSOR_MODE RequestorMode;
+
+} FLT_CALLBACK_DATA, *PFLT_CALLBACK_DATA;
+
+#define FLT_IS_IRP_OPERATION(_data)         (FlagOn( (_data)->Flags, FLTFL_CALLBACK_DATA_IRP_OPERATION ))
+#define FLT_IS_FASTIO_OPERATION(_data)      (FlagOn( (_data)->Flags, FLTFL_CALLBACK_DATA_FAST_IO_OPERATION ))
+#define FLT_IS_FS_FILTER_OPERATION(_data)   (FlagOn( (_data)->Flags, FLTFL_CALLBACK_DATA_FS_FILTER_OPERATION ))
+#define FLT_IS_SYSTEM_BUFFER(_data)         (FlagOn( (_data)->Flags, FLTFL_CALLBACK_DATA_SYSTEM_BUFFER ))
+
+typedef struct _FLT_RELATED_OBJECTS {
+
+    USHORT Size;
+
+    USHORT TransactionContext;
+
+    PFLT_FILTER Filter;
+
+    PFLT_VOLUME Volume;
+
+    PFLT_INSTANCE Instance;
+
+    PFILE_OBJECT FileObject;
+
+    PVOID Transaction;
+
+} FLT_RELATED_OBJECTS, *PFLT_RELATED_OBJECTS;
+
+typedef const FLT_RELATED_OBJECTS *PCFLT_RELATED_OBJECTS;
+
+typedef ULONG FLT_POST_OPERATION_FLAGS;
+
+#define FLTFL_POST_OPERATION_DRAINING       0x00000001
+
+typedef FLT_PREOP_CALLBACK_STATUS
+(*PFLT_PRE_OPERATION_CALLBACK) (
+    PFLT_CALLBACK_DATA Data,
+    PCFLT_RELATED_OBJECTS FltObjects,
+    PVOID *CompletionContext
+    );
+
+typedef FLT_POSTOP_CALLBACK_STATUS
+(*PFLT_POST_OPERATION_CALLBACK) (
+    PFLT_CALLBACK_DATA Data,
+    PCFLT_RELATED_OBJECTS FltObjects,
+    PVOID CompletionContext,
+    FLT_POST_OPERATION_FLAGS Flags
+    );
+
+typedef ULONG FLT_OPERATION_REGISTRATION_FLAGS;
+
+#define FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO     0x00000001
+#define FLTFL_OPERATION_REGISTRATION_SKIP_CACHED_IO     0x00000002
+
+typedef struct _FLT_OPERATION_REGISTRATION {
+
+    UCHAR MajorFunction;
+
+    FLT_OPERATION_REGISTRATION_FLAGS Flags;
+
+    PFLT_PRE_OPERATION_CALLBACK PreOperation;
+
+    PFLT_POST_OPERATION_CALLBACK PostOperation;
+
+    PVOID Reserved1;
+
+} FLT_OPERATION_REGISTRATION, *PFLT_OPERATION_REGISTRATION;
+
+typedef VOID
+(*PFLT_CONTEXT_CLEANUP_CALLBACK) (
+    PFLT_CONTEXT Context,
+    FLT_CONTEXT_TYPE ContextType
+    );
+
+typedef struct _FLT_CONTEXT_REGISTRATION {
+
+    FLT_CONTEXT_TYPE ContextType;
+
+    USHORT Flags;
+
+    PFLT_CONTEXT_CLEANUP_CALLBACK ContextCleanupCallback;
+
+    SIZE_T Size;
+
+    ULONG PoolTag;
+
+    PVOID ContextAllocateCallback;
+
+    PVOID ContextFreeCallback;
+
+    PVOID Reserved1;
+
+} FLT_CONTEXT_REGISTRATION, *PFLT_CONTEXT_REGISTRATION;
+
+typedef ULONG FLT_FILTER_UNLOAD_FLAGS;
+typedef ULONG FLT_INSTANCE_SETUP_FLAGS;
+typedef ULONG FLT_INSTANCE_QUERY_TEARDOWN_FLAGS;
+typedef ULONG FLT_INSTANCE_TEARDOWN_FLAGS;
+
+#define FLTFL_INSTANCE_SETUP_AUTOMATIC_ATTACHMENT   0x00000001
+#define FLTFL_INSTANCE_TEARDOWN_FILTER_UNLOAD       0x00000004
+#define FLTFL_FILTER_UNLOAD_MANDATORY               0x00000001
+
+typedef NTSTATUS
+(*PFLT_FILTER_UNLOAD_CALLBACK) (
+    FLT_FILTER_UNLOAD_FLAGS Flags
+    );
+
+typedef NTSTATUS
+(*PFLT_INSTANCE_SETUP_CALLBACK) (
+    PCFLT_RELATED_OBJECTS FltObjects,
+    FLT_INSTANCE_SETUP_FLAGS Flags,
+    DEVICE_TYPE VolumeDeviceType,
+    FLT_FILESYSTEM_TYPE VolumeFilesystemType
+    );
+
+typedef NTSTATUS
+(*PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK) (
+    PCFLT_RELATED_OBJECTS FltObjects,
+    FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
+    );
+
+typedef VOID
+(*PFLT_INSTANCE_TEARDOWN_CALLBACK) (
+    PCFLT_RELATED_OBJECTS FltObjects,
+    FLT_INSTANCE_TEARDOWN_FLAGS Reason
+    );
+
+#define FLT_REGISTRATION_VERSION    0x0202
+
+typedef struct _FLT_REGISTRATION {
+
+    USHORT Size;
+
+    USHORT Version;
+
+    ULONG Flags;
+
+    const FLT_CONTEXT_REGISTRATION *ContextRegistration;
+
+    const FLT_OPERATION_REGISTRATION *OperationRegistration;
+
+    PFLT_FILTER_UNLOAD_CALLBACK FilterUnloadCallback;
+
+    PFLT_INSTANCE_SETUP_CALLBACK InstanceSetupCallback;
+
+    PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK InstanceQueryTeardownCallback;
+
+    PFLT_INSTANCE_TEARDOWN_CALLBACK InstanceTeardownStartCallback;
+
+    PFLT_INSTANCE_TEARDOWN_CALLBACK InstanceTeardownCompleteCallback;
+
+    PVOID GenerateFileNameCallback;
+
+    PVOID NormalizeNameComponentCallback;
+
+    PVOID NormalizeContextCleanupCallback;
+
+} FLT_REGISTRATION, *PFLT_REGISTRATION;
+
+typedef NTSTATUS DRIVER_INITIALIZE( PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath );
+
+NTSTATUS
+FltRegisterFilter (
+    PDRIVER_OBJECT Driver,
+    const FLT_REGISTRATION *Registration,
+    PFLT_FILTER *RetFilter
+    );
+
+NTSTATUS
+FltStartFiltering (
+    PFLT_FILTER Filter
+    );
+
+VOID
+FltUnregisterFilter (
+    PFLT_FILTER Filter
+    );
+
+//
+//  Contexts
+//
+
+NTSTATUS
+FltAllocateContext (
+    PFLT_FILTER Filter,
+    FLT_CONTEXT_TYPE ContextType,
+    SIZE_T ContextSize,
+    POOL_TYPE PoolType,
+    PFLT_CONTEXT *ReturnedContext
+    );
+
+VOID
+FltReferenceContext (
+    PFLT_CONTEXT Context
+    );
+
+VOID
+FltReleaseContext (
+    PFLT_CONTEXT Context
+    );
+
+VOID
+FltDeleteContext (
+    PFLT_CONTEXT Context
+    );
+
+NTSTATUS
+FltSetVolumeContext (
+    PFLT_VOLUME Volume,
+    FLT_SET_CONTEXT_OPERATION Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    );
+
+NTSTATUS
+FltGetVolumeContext (
+    PFLT_FILTER Filter,
+    PFLT_VOLUME Volume,
+    PFLT_CONTEXT *Context
+    );
+
+NTSTATUS
+FltSetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    FLT_SET_CONTEXT_OPERATION Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    );
+
+NTSTATUS
+FltGetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PFLT_CONTEXT *Context
+    );
+
+//
+//  Volumes and files
+//
+
+typedef struct _FLT_VOLUME_PROPERTIES {
+
+    DEVICE_TYPE DeviceType;
+
+    ULONG DeviceCharacteristics;
+
+    ULONG DeviceObjectFlags;
+
+    ULONG AlignmentRequirement;
+
+    USHORT SectorSize;
+
+    USHORT Flags;
+
+    UNICODE_STRING FileSystemDriverName;
+
+    UNICODE_STRING FileSystemDeviceName;
+
+    UNICODE_STRING RealDeviceName;
+
+} FLT_VOLUME_PROPERTIES, *PFLT_VOLUME_PROPERTIES;
+
+#define FILE_DEVICE_DISK_FILE_SYSTEM    0x00000008
+
+NTSTATUS
+FltGetVolumeProperties (
+    PFLT_VOLUME Volume,
+    PFLT_VOLUME_PROPERTIES VolumeProperties,
+    ULONG VolumePropertiesLength,
+    PULONG LengthReturned
+    );
+
+NTSTATUS
+FltGetDiskDeviceObject (
+    PFLT_VOLUME Volume,
+    PDEVICE_OBJECT *DiskDeviceObject
+    );
+
+NTSTATUS
+FltIsDirectory (
+    PFILE_OBJECT FileObject,
+    PFLT_INSTANCE Instance,
+    PBOOLEAN IsDirectory
+    );
+
+typedef ULONG FLT_FILE_NAME_OPTIONS;
+
+#define FLT_FILE_NAME_NORMALIZED                0x01
+#define FLT_FILE_NAME_OPENED                    0x02
+#define FLT_FILE_NAME_SHORT                     0x03
+#define FLT_FILE_NAME_QUERY_DEFAULT             0x0100
+#define FLT_FILE_NAME_QUERY_CACHE_ONLY          0x0200
+#define FLT_FILE_NAME_QUERY_FILESYSTEM_ONLY     0x0300
+#define FLT_FILE_NAME_QUERY_ALWAYS_ALLOW_CACHE_LOOKUP 0x0400
+
+typedef USHORT FLT_FILE_NAME_PARSED_FLAGS;
+
+typedef struct _FLT_FILE_NAME_INFORMATION {
+
+    USHORT Size;
+
+    FLT_FILE_NAME_PARSED_FLAGS NamesParsed;
+
+    FLT_FILE_NAME_OPTIONS Format;
+
+    UNICODE_STRING Name;
+
+    UNICODE_STRING Volume;
+
+    UNICODE_STRING Share;
+
+    UNICODE_STRING Extension;
+
+    UNICODE_STRING Stream;
+
+    UNICODE_STRING FinalComponent;
+
+    UNICODE_STRING ParentDir;
+
+} FLT_FILE_NAME_INFORMATION, *PFLT_FILE_NAME_INFORMATION;
+
+NTSTATUS
+FltGetFileNameInformation (
+    PFLT_CALLBACK_DATA CallbackData,
+    FLT_FILE_NAME_OPTIONS NameOptions,
+    PFLT_FILE_NAME_INFORMATION *FileNameInformation
+    );
+
+NTSTATUS
+FltParseFileNameInformation (
+    PFLT_FILE_NAME_INFORMATION FileNameInformation
+    );
+
+VOID
+FltReleaseFileNameInformation (
+    PFLT_FILE_NAME_INFORMATION FileNameInformation
+    );
+
+//
+//  I/O the filter issues below itself.  Synchronous only.
+//
+
+typedef ULONG FLT_IO_OPERATION_FLAGS;
+
+#define FLTFL_IO_OPERATION_NON_CACHED                   0x00000001
+#define FLTFL_IO_OPERATION_PAGING                       0x00000002
+#define FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET    0x00000004
+#define FLTFL_IO_OPERATION_SYNCHRONOUS_PAGING           0x00000008
+
+typedef VOID
+(*PFLT_COMPLETED_ASYNC_IO_CALLBACK) (
+    PFLT_CALLBACK_DATA CallbackData,
+    PFLT_CONTEXT Context
+    );
+
+NTSTATUS
+FltReadFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesRead,
+    PFLT_COMPLETED_ASYNC_IO_CALLBACK CallbackRoutine,
+    PVOID CallbackContext
+    );
+
+NTSTATUS
+FltWriteFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesWritten,
+    PFLT_COMPLETED_ASYNC_IO_CALLBACK CallbackRoutine,
+    PVOID CallbackContext
+    );
+
+NTSTATUS
+FltQueryInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass,
+    PULONG LengthReturned
+    );
+
+NTSTATUS
+FltSetInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass
+    );
+
+PVOID
+FltAllocatePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    );
+
+VOID
+FltFreePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    PVOID Buffer,
+    ULONG Tag
+    );
+
+VOID
+FltInitializePushLock (
+    PEX_PUSH_LOCK PushLock
+    );
+
+VOID
+FltDeletePushLock (
+    PEX_PUSH_LOCK PushLock
+    );
+
+VOID
+FltAcquirePushLockExclusive (
+    PEX_PUSH_LOCK PushLock
+    );
+
+VOID
+FltAcquirePushLockShared (
+    PEX_PUSH_LOCK PushLock
+    );
+
+VOID
+FltReleasePushLock (
+    PEX_PUSH_LOCK PushLock
+    );
+
+//
+//  Callback data
+//
+
+VOID
+FltSetCallbackDataDirty (
+    PFLT_CALLBACK_DATA Data
+    );
+
+NTSTATUS
+FltLockUserBuffer (
+    PFLT_CALLBACK_DATA CallbackData
+    );
+
+PMDL
+FltGetSwappedBufferMdlAddress (
+    PFLT_CALLBACK_DATA CallbackData
+    );
+
+VOID
+FltRetainSwappedBufferMdlAddress (
+    PFLT_CALLBACK_DATA CallbackData
+    );
+
+BOOLEAN
+FltDoCompletionProcessingWhenSafe (
+    PFLT_CALLBACK_DATA Data,
+    PCFLT_RELATED_OBJECTS FltObjects,
+    PVOID CompletionContext,
+    FLT_POST_OPERATION_FLAGS Flags,
+    PFLT_POST_OPERATION_CALLBACK SafePostCallback,
+    PFLT_POSTOP_CALLBACK_STATUS RetPostOperationStatus
+    );
+
+VOID
+FltCompletePendedPreOperation (
+    PFLT_CALLBACK_DATA CallbackData,
+    FLT_PREOP_CALLBACK_STATUS CallbackStatus,
+    PVOID Context
+    );
+
+VOID
+FltCompletePendedPostOperation (
+    PFLT_CALLBACK_DATA CallbackData
+    );
+
+//
+//  Communication ports.  The harness is the only client (SimControl).
+//
+
+#define FLT_PORT_ALL_ACCESS     0x001F0001
+
+typedef NTSTATUS
+(*PFLT_CONNECT_NOTIFY) (
+    PFLT_PORT ClientPort,
+    PVOID ServerPortCookie,
+    PVOID ConnectionContext,
+    ULONG SizeOfContext,
+    PVOID *ConnectionPortCookie
+    );
+
+typedef VOID
+(*PFLT_DISCONNECT_NOTIFY) (
+    PVOID ConnectionCookie
+    );
+
+typedef NTSTATUS
+(*PFLT_MESSAGE_NOTIFY) (
+    PVOID PortCookie,
+    PVOID InputBuffer,
+    ULONG InputBufferLength,
+    PVOID OutputBuffer,
+    ULONG OutputBufferLength,
+    PULONG ReturnOutputBufferLength
+    );
+
+NTSTATUS
+FltBuildDefaultSecurityDescriptor (
+    PSECURITY_DESCRIPTOR *SecurityDescriptor,
+    ACCESS_MASK DesiredAccess
+    );
+
+VOID
+FltFreeSecurityDescriptor (
+    PSECURITY_DESCRIPTOR SecurityDescriptor
+    );
+
+NTSTATUS
+FltCreateCommunicationPort (
+    PFLT_FILTER Filter,
+    PFLT_PORT *ServerPort,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PVOID ServerPortCookie,
+    PFLT_CONNECT_NOTIFY ConnectNotifyCallback,
+    PFLT_DISCONNECT_NOTIFY DisconnectNotifyCallback,
+    PFLT_MESSAGE_NOTIFY MessageNotifyCallback,
+    LONG MaxConnections
+    );
+
+VOID
+FltCloseCommunicationPort (
+    PFLT_PORT ServerPort
+    );
+
+VOID
+FltCloseClientPort (
+    PFLT_FILTER Filter,
+    PFLT_PORT *ClientPort
+    );
+
+#endif // __CSG_SIM_FLTKERNEL_H__